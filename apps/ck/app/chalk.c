@@ -56,6 +56,7 @@ Module Name:
     "  -c \"expr\" -- Execute the given expression and exit.\n"                \
     "  --debug-gc -- Stress the garbage collector.\n"                          \
     "  --debug-compiler -- Print the compiled bytecode.\n"                     \
+    "  --no-optimize -- Run the bytecode exactly as compiled.\n"               \
     "  --help -- Show this help text and exit.\n"                              \
     "  --version -- Print the application version information and exit.\n"
 
@@ -65,6 +66,7 @@ Module Name:
 
 #define CHALK_OPTION_DEBUG_GC 257
 #define CHALK_OPTION_DEBUG_COMPILER 258
+#define CHALK_OPTION_NO_OPTIMIZE 259
 
 //
 // ------------------------------------------------------ Data Type Definitions
@@ -138,6 +140,7 @@ ChalkReadLine (
 struct option ChalkLongOptions[] = {
     {"debug-gc", no_argument, 0, CHALK_OPTION_DEBUG_GC},
     {"debug-compiler", no_argument, 0, CHALK_OPTION_DEBUG_COMPILER},
+    {"no-optimize", no_argument, 0, CHALK_OPTION_NO_OPTIMIZE},
     {"help", no_argument, 0, 'h'},
     {"verbose", no_argument, 0, 'v'},
     {NULL, 0, 0, 0},
@@ -227,6 +230,10 @@ Return Value:
             Context.Configuration.Flags |= CK_CONFIGURATION_DEBUG_COMPILER;
             break;
 
+        case CHALK_OPTION_NO_OPTIMIZE:
+            Context.Configuration.Flags |= CK_CONFIGURATION_NO_OPTIMIZE;
+            break;
+
         case 'V':
             printf("Chalk version %d.%d.%d. Copyright 2016 Minoca Corp. "
                    "All Rights Reserved.\n",
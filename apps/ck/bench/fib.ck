@@ -0,0 +1,43 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    fib.ck
+
+Abstract:
+
+    This module benchmarks recursive function calls, integer comparisons
+    followed by conditional jumps, and integer arithmetic.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Chalk
+
+--*/
+
+function
+fib (
+    n
+    )
+
+{
+
+    if (n < 2) {
+        return n;
+    }
+
+    return fib(n - 1) + fib(n - 2);
+}
+
+Core.print(fib(30));
@@ -0,0 +1,100 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    fields.ck
+
+Abstract:
+
+    This module benchmarks instance field access and method calls on the
+    objects stored in fields.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Chalk
+
+--*/
+
+class Counter {
+    var _value;
+
+    function
+    __init (
+        )
+
+    {
+
+        _value = 0;
+        return this;
+    }
+
+    function
+    bump (
+        amount
+        )
+
+    {
+
+        _value += amount;
+        return _value;
+    }
+
+    function
+    value (
+        )
+
+    {
+
+        return _value;
+    }
+}
+
+class Tally {
+    var _counter;
+    var _items;
+
+    function
+    __init (
+        )
+
+    {
+
+        _counter = Counter();
+        _items = [];
+        return this;
+    }
+
+    function
+    run (
+        count
+        )
+
+    {
+
+        var index = 0;
+
+        while (index < count) {
+            _counter.bump(index & 7);
+            if (_items.length() < 64) {
+                _items.append(index);
+            }
+
+            index += 1;
+        }
+
+        return _counter.value() + _items.length();
+    }
+}
+
+Core.print(Tally().run(2000000));
@@ -0,0 +1,53 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    loop.ck
+
+Abstract:
+
+    This module benchmarks tight while loops over local variables, mixing
+    arithmetic, bitwise operators, and constant expressions.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Chalk
+
+--*/
+
+function
+loop (
+    count
+    )
+
+{
+
+    var i = 0;
+    var total = 0;
+
+    while (i < count) {
+        if ((i & 0xF) == 0) {
+            total = total ^ (i * 3);
+
+        } else {
+            total = total + (60 * 60 * 24) - (i | 1);
+        }
+
+        i = i + 1;
+    }
+
+    return total;
+}
+
+Core.print(loop(5000000));
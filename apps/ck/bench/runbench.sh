@@ -0,0 +1,55 @@
+#!/bin/sh
+## Copyright (c) 2026 Minoca Corp.
+##
+##    This file is licensed under the terms of the GNU General Public License
+##    version 3. Alternative licensing terms are available. Contact
+##    info@minocacorp.com for details. See the LICENSE file at the root of this
+##    project for complete licensing information.
+##
+## Script Name:
+##
+##     runbench.sh
+##
+## Abstract:
+##
+##     This script runs the Chalk benchmarks, both with and without the
+##     bytecode optimizer, and checks that both produce the same output.
+##
+## Author:
+##
+##     Minoca Developers 18-Oct-2026
+##
+## Environment:
+##
+##     Build
+##
+
+set -e
+
+CHALK=${CHALK:-chalk}
+BENCH_DIR=`dirname $0`
+status=0
+for bench in $BENCH_DIR/*.ck; do
+    name=`basename $bench .ck`
+    for mode in optimized unoptimized; do
+        options=
+        if [ $mode = unoptimized ]; then
+            options=--no-optimize
+        fi
+
+        start=`date +%s%N`
+        output=`$CHALK $options $bench`
+        end=`date +%s%N`
+        elapsed=$(( (end - start) / 1000000 ))
+        echo "$name $mode: ${elapsed}ms ($output)"
+        if [ $mode = optimized ]; then
+            expected="$output"
+
+        elif [ "$output" != "$expected" ]; then
+            echo "$name: Optimized output differs!"
+            status=1
+        fi
+    done
+done
+
+exit $status
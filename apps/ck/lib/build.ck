@@ -57,6 +57,7 @@ function build() {
         "compexpr.c",
         "compiler.c",
         "compio.c",
+        "compopt.c",
         "compvar.c",
         "core.c",
         "debug.c",
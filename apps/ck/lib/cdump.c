@@ -49,7 +49,7 @@ Module Name:
 // Define the current freeze file format version.
 //
 
-#define CK_FREEZE_VERSION 1
+#define CK_FREEZE_VERSION 3
 
 //
 // ------------------------------------------------------ Data Type Definitions
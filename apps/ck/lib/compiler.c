@@ -670,6 +670,10 @@ Return Value:
         goto FinalizeCompilerEnd;
     }
 
+    if (!CK_VM_FLAG_SET(Compiler->Parser->Vm, CK_CONFIGURATION_NO_OPTIMIZE)) {
+        CkpOptimizeFunction(Compiler);
+    }
+
     //
     // If this is a child compiler, emit the definition for the function just
     // compiled.
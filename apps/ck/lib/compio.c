@@ -49,20 +49,6 @@ Module Name:
 // ----------------------------------------------- Internal Function Prototypes
 //
 
-UINTN
-CkpGetInstructionSize (
-    PUCHAR ByteCode,
-    PCK_VALUE Constants,
-    UINTN Ip
-    );
-
-VOID
-CkpEmitLineNumberInformation (
-    PCK_COMPILER Compiler,
-    ULONG Line,
-    ULONG Offset
-    );
-
 VOID
 CkpReadUnicodeEscape (
     PCK_COMPILER Compiler,
@@ -164,6 +150,27 @@ CHAR CkOpcodeStackEffects[CkOpcodeCount] = {
     0,  // CkOpTry
     0,  // CkOpPopTry
     0,  // CkOpEnd
+    -1, // CkOpAdd
+    -1,
+    -1,
+    -1,
+    -1,
+    -1,
+    -1,
+    -1,
+    -1,
+    -1,
+    -1,
+    -1, // CkOpIsNotEqual
+    -1, // CkOpLessThanJump
+    -1,
+    -1,
+    -1,
+    -1,
+    -1, // CkOpIsNotEqualJump
+    1,  // CkOpLoadFieldThisCall
+    0,  // CkOpLoadLocalOperator
+    0,  // CkOpLoadLocalCompareJump
 };
 
 //
@@ -215,16 +222,16 @@ UCHAR CkCompilerOperandSizes[CkOpcodeCount] = {
     2, // CkOpCall8
     3, // CkOpCall
     1, // CkOpIndirectCall
-    4, // CkOpSuperCall0
-    4,
-    4,
-    4,
-    4,
-    4,
-    4,
-    4,
-    4, // CkOpSuperCall8
-    5, // CkOpSuperCall
+    2, // CkOpSuperCall0
+    2,
+    2,
+    2,
+    2,
+    2,
+    2,
+    2,
+    2, // CkOpSuperCall8
+    3, // CkOpSuperCall
     2, // CkOpJump
     2, // CkOpLoop
     2, // CkOpJumpIf
@@ -239,6 +246,27 @@ UCHAR CkCompilerOperandSizes[CkOpcodeCount] = {
     2, // CkOpTry
     0, // CkOpPopTry
     0, // CkOpEnd
+    2, // CkOpAdd
+    2,
+    2,
+    2,
+    2,
+    2,
+    2,
+    2,
+    2,
+    2,
+    2,
+    2, // CkOpIsNotEqual
+    2, // CkOpLessThanJump
+    2,
+    2,
+    2,
+    2,
+    2, // CkOpIsNotEqualJump
+    1, // CkOpLoadFieldThisCall
+    4, // CkOpLoadLocalOperator
+    4, // CkOpLoadLocalCompareJump
 };
 
 //
@@ -1374,10 +1402,6 @@ Return Value:
     return StringValue;
 }
 
-//
-// --------------------------------------------------------- Internal Functions
-//
-
 UINTN
 CkpGetInstructionSize (
     PUCHAR ByteCode,
@@ -1424,7 +1448,7 @@ Return Value:
         // upvalue.
         //
 
-        Size = 2 + (Function->UpvalueCount);
+        Size = 2 + (Function->UpvalueCount * 2);
 
     } else if (Op < CkOpcodeCount) {
         Size = CkCompilerOperandSizes[Op];
@@ -1648,6 +1672,10 @@ Return Value:
     return;
 }
 
+//
+// --------------------------------------------------------- Internal Functions
+//
+
 VOID
 CkpReadUnicodeEscape (
     PCK_COMPILER Compiler,
@@ -0,0 +1,1267 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    compopt.c
+
+Abstract:
+
+    This module implements the peephole optimizer that runs over the bytecode
+    of each function once it has been compiled. It folds operators applied to
+    integer constants, and substitutes superinstructions for common operator
+    and call sequences. Folding and most substitutions are made in place,
+    padding with no-ops. A final pass then rebuilds the code without the
+    padding, fusing local variable loads into the operator that follows them,
+    and relocates jump offsets and the line number program to match.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    C
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include "chalkp.h"
+#include <minoca/lib/status.h>
+#include <minoca/lib/yy.h>
+#include "compiler.h"
+#include "lang.h"
+#include "compsup.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the number of consecutive constant pushes the folder keeps track of.
+// Binary operators only need two, but keeping more allows the left side of
+// an expression to fold with the result of a nested expression on the right.
+//
+
+#define CK_FOLD_WINDOW 8
+
+//
+// Define the size of the load local superinstructions: the opcode, the local
+// slot, the operator opcode, and the method symbol.
+//
+
+#define CK_LOCAL_FUSION_SIZE 5
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _CK_FOLD_OPERATION {
+    CkFoldNone,
+    CkFoldAdd,
+    CkFoldSubtract,
+    CkFoldMultiply,
+    CkFoldAnd,
+    CkFoldOr,
+    CkFoldXor,
+    CkFoldLessThan,
+    CkFoldLessOrEqual,
+    CkFoldGreaterThan,
+    CkFoldGreaterOrEqual,
+    CkFoldEqual,
+    CkFoldNotEqual,
+    CkFoldNegate,
+    CkFoldComplement,
+    CkFoldLogicalNot
+} CK_FOLD_OPERATION, *PCK_FOLD_OPERATION;
+
+/*++
+
+Structure Description:
+
+    This structure describes an operator method the optimizer knows about.
+
+Members:
+
+    Name - Stores the method signature the compiler emits for the operator.
+
+    Arity - Stores the number of arguments the operator method takes, not
+        including the receiver.
+
+    Fold - Stores the folding operation to perform if the receiver and
+        arguments are all integer constants.
+
+    FastOp - Stores the opcode to substitute for the call, or CkOpNop if there
+        is no superinstruction for the operator.
+
+    JumpOp - Stores the opcode to substitute for the call if it is followed
+        by a conditional jump, or CkOpNop if the operator has no fused compare
+        and jump form.
+
+--*/
+
+typedef struct _CK_OPTIMIZER_OPERATOR {
+    PCSTR Name;
+    CK_ARITY Arity;
+    CK_FOLD_OPERATION Fold;
+    CK_OPCODE FastOp;
+    CK_OPCODE JumpOp;
+} CK_OPTIMIZER_OPERATOR, *PCK_OPTIMIZER_OPERATOR;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+CkpFindJumpTargets (
+    PCK_FUNCTION Function,
+    PUCHAR Targets
+    );
+
+VOID
+CkpFoldConstants (
+    PCK_COMPILER Compiler,
+    PUCHAR Targets
+    );
+
+VOID
+CkpSubstituteSuperinstructions (
+    PCK_FUNCTION Function
+    );
+
+VOID
+CkpCompactCode (
+    PCK_COMPILER Compiler,
+    PUCHAR Targets
+    );
+
+CK_OPCODE
+CkpGetLocalFusion (
+    PCK_FUNCTION Function,
+    PUCHAR Targets,
+    UINTN Ip,
+    PUCHAR Local,
+    PUCHAR Operator,
+    PUINTN Size
+    );
+
+VOID
+CkpRelocateLineProgram (
+    PCK_COMPILER Compiler,
+    PUINTN Map
+    );
+
+PCK_OPTIMIZER_OPERATOR
+CkpGetOptimizerOperator (
+    PCK_FUNCTION Function,
+    PUCHAR Instruction
+    );
+
+BOOL
+CkpGetConstantInteger (
+    PCK_FUNCTION Function,
+    PUCHAR Instruction,
+    PCK_INTEGER Value
+    );
+
+BOOL
+CkpEvaluateFold (
+    CK_FOLD_OPERATION Fold,
+    PCK_INTEGER Operands,
+    PCK_INTEGER Result
+    );
+
+UINTN
+CkpEmitFoldedConstant (
+    PCK_COMPILER Compiler,
+    PUCHAR Code,
+    CK_INTEGER Value
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+CK_OPTIMIZER_OPERATOR CkOptimizerOperators[] = {
+    {"__add@1", 1, CkFoldAdd, CkOpAdd, CkOpNop},
+    {"__sub@1", 1, CkFoldSubtract, CkOpSubtract, CkOpNop},
+    {"__mul@1", 1, CkFoldMultiply, CkOpMultiply, CkOpNop},
+    {"__and@1", 1, CkFoldAnd, CkOpBitAnd, CkOpNop},
+    {"__or@1", 1, CkFoldOr, CkOpBitOr, CkOpNop},
+    {"__xor@1", 1, CkFoldXor, CkOpBitXor, CkOpNop},
+    {"__lt@1", 1, CkFoldLessThan, CkOpLessThan, CkOpLessThanJump},
+    {"__le@1", 1, CkFoldLessOrEqual, CkOpLessOrEqual, CkOpLessOrEqualJump},
+    {"__gt@1", 1, CkFoldGreaterThan, CkOpGreaterThan, CkOpGreaterThanJump},
+    {"__ge@1",
+     1,
+     CkFoldGreaterOrEqual,
+     CkOpGreaterOrEqual,
+     CkOpGreaterOrEqualJump},
+
+    {"__eq@1", 1, CkFoldEqual, CkOpIsEqual, CkOpIsEqualJump},
+    {"__ne@1", 1, CkFoldNotEqual, CkOpIsNotEqual, CkOpIsNotEqualJump},
+    {"__neg@0", 0, CkFoldNegate, CkOpNop, CkOpNop},
+    {"__compl@0", 0, CkFoldComplement, CkOpNop, CkOpNop},
+    {"__lnot@0", 0, CkFoldLogicalNot, CkOpNop, CkOpNop},
+    {NULL, 0, CkFoldNone, CkOpNop, CkOpNop}
+};
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+VOID
+CkpOptimizeFunction (
+    PCK_COMPILER Compiler
+    )
+
+/*++
+
+Routine Description:
+
+    This routine runs the peephole optimizer over the function that was just
+    compiled. The code must be complete, with all jumps patched.
+
+Arguments:
+
+    Compiler - Supplies a pointer to the compiler.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PCK_FUNCTION Function;
+    PUCHAR Targets;
+
+    Function = Compiler->Function;
+    if ((Compiler->Parser->Errors != 0) || (Function->Code.Count == 0)) {
+        return;
+    }
+
+    //
+    // The optimizer is strictly optional, so just skip it if the jump target
+    // map cannot be allocated.
+    //
+
+    Targets = CkAllocate(Compiler->Parser->Vm, Function->Code.Count);
+    if (Targets == NULL) {
+        return;
+    }
+
+    CkZero(Targets, Function->Code.Count);
+    CkpFindJumpTargets(Function, Targets);
+    CkpFoldConstants(Compiler, Targets);
+    CkpSubstituteSuperinstructions(Function);
+    CkpCompactCode(Compiler, Targets);
+    CkFree(Compiler->Parser->Vm, Targets);
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+CkpFindJumpTargets (
+    PCK_FUNCTION Function,
+    PUCHAR Targets
+    )
+
+/*++
+
+Routine Description:
+
+    This routine marks every bytecode offset that some jump, loop, or
+    exception handler can land on. Sequences spanning one of these offsets
+    cannot be folded, since there is another way into the middle of them.
+
+Arguments:
+
+    Function - Supplies a pointer to the function to scan.
+
+    Targets - Supplies a pointer to an array of booleans, one for each byte of
+        code. Entries for jump targets are set to TRUE.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PUCHAR Code;
+    UINTN Ip;
+    USHORT Offset;
+    CK_OPCODE Op;
+    UINTN Size;
+    UINTN Target;
+
+    Code = Function->Code.Data;
+    Ip = 0;
+    while (Ip < Function->Code.Count) {
+        Op = Code[Ip];
+        Size = CkpGetInstructionSize(Code, Function->Constants.Data, Ip);
+        switch (Op) {
+        case CkOpJump:
+        case CkOpJumpIf:
+        case CkOpAnd:
+        case CkOpOr:
+        case CkOpTry:
+            Offset = CK_READ16(Code + Ip + 1);
+            Target = Ip + Size + Offset;
+            break;
+
+        case CkOpLoop:
+            Offset = CK_READ16(Code + Ip + 1);
+            Target = Ip + Size - Offset;
+            break;
+
+        default:
+            Target = -1;
+            break;
+        }
+
+        if (Target < Function->Code.Count) {
+            Targets[Target] = TRUE;
+        }
+
+        Ip += Size;
+    }
+
+    return;
+}
+
+VOID
+CkpFoldConstants (
+    PCK_COMPILER Compiler,
+    PUCHAR Targets
+    )
+
+/*++
+
+Routine Description:
+
+    This routine replaces operator calls whose operands are all integer
+    constants with the constant result. The freed bytes are filled with no-op
+    instructions, which are removed when the code is compacted.
+
+Arguments:
+
+    Compiler - Supplies a pointer to the compiler.
+
+    Targets - Supplies a pointer to the jump target map.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PUCHAR Code;
+    UINTN End;
+    UINTN First;
+    PCK_FUNCTION Function;
+    ULONG Index;
+    UINTN Ip;
+    CK_OPCODE Op;
+    PCK_OPTIMIZER_OPERATOR Operator;
+    CK_INTEGER Result;
+    UINTN Size;
+    UINTN Start;
+    CK_INTEGER Value;
+    ULONG WindowCount;
+    UINTN WindowOffsets[CK_FOLD_WINDOW];
+    CK_INTEGER WindowValues[CK_FOLD_WINDOW];
+
+    Function = Compiler->Function;
+    Code = Function->Code.Data;
+    WindowCount = 0;
+    Ip = 0;
+    while (Ip < Function->Code.Count) {
+        Op = Code[Ip];
+        Size = CkpGetInstructionSize(Code, Function->Constants.Data, Ip);
+
+        //
+        // Nothing can be folded across a jump target, as the stack contents
+        // depend on how the target was reached.
+        //
+
+        if (Targets[Ip] != FALSE) {
+            WindowCount = 0;
+        }
+
+        if (Op == CkOpNop) {
+            Ip += Size;
+            continue;
+        }
+
+        //
+        // Track the most recent run of consecutive constant pushes.
+        //
+
+        if (CkpGetConstantInteger(Function, Code + Ip, &Value) != FALSE) {
+            if (WindowCount == CK_FOLD_WINDOW) {
+                for (Index = 1; Index < CK_FOLD_WINDOW; Index += 1) {
+                    WindowOffsets[Index - 1] = WindowOffsets[Index];
+                    WindowValues[Index - 1] = WindowValues[Index];
+                }
+
+                WindowCount -= 1;
+            }
+
+            WindowOffsets[WindowCount] = Ip;
+            WindowValues[WindowCount] = Value;
+            WindowCount += 1;
+            Ip += Size;
+            continue;
+        }
+
+        if ((Op == CkOpCall0) || (Op == CkOpCall1)) {
+            Operator = CkpGetOptimizerOperator(Function, Code + Ip);
+            if ((Operator != NULL) &&
+                (Operator->Arity + 1 <= WindowCount) &&
+                (Operator->Arity == Op - CkOpCall0)) {
+
+                First = WindowCount - (Operator->Arity + 1);
+                End = Ip + Size;
+                if (CkpEvaluateFold(Operator->Fold,
+                                    &(WindowValues[First]),
+                                    &Result) != FALSE) {
+
+                    //
+                    // Write the result over the first operand, and pad out
+                    // the rest of the sequence.
+                    //
+
+                    Start = WindowOffsets[First];
+                    Size = CkpEmitFoldedConstant(Compiler,
+                                                 Code + Start,
+                                                 Result);
+
+                    if (Size != 0) {
+
+                        CK_ASSERT(Start + Size <= End);
+
+                        memset(Code + Start + Size,
+                               CkOpNop,
+                               End - (Start + Size));
+
+                        //
+                        // The result is itself a constant that may feed into
+                        // an enclosing operator.
+                        //
+
+                        WindowCount = First + 1;
+                        WindowValues[First] = Result;
+                        Ip = End;
+                        continue;
+                    }
+                }
+            }
+        }
+
+        WindowCount = 0;
+        Ip += CkpGetInstructionSize(Code, Function->Constants.Data, Ip);
+    }
+
+    return;
+}
+
+VOID
+CkpSubstituteSuperinstructions (
+    PCK_FUNCTION Function
+    )
+
+/*++
+
+Routine Description:
+
+    This routine replaces operator calls with opcodes that handle integer
+    operands directly, fuses comparisons with the conditional jump that
+    follows them, and fuses instance field loads with the method call that
+    follows them.
+
+Arguments:
+
+    Function - Supplies a pointer to the function to optimize.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PUCHAR Code;
+    UINTN Ip;
+    CK_OPCODE Next;
+    CK_OPCODE Op;
+    PCK_OPTIMIZER_OPERATOR Operator;
+    UINTN Size;
+
+    Code = Function->Code.Data;
+    Ip = 0;
+    while (Ip < Function->Code.Count) {
+        Op = Code[Ip];
+        Size = CkpGetInstructionSize(Code, Function->Constants.Data, Ip);
+        if (Op == CkOpCall1) {
+            Operator = CkpGetOptimizerOperator(Function, Code + Ip);
+            if ((Operator != NULL) && (Operator->FastOp != CkOpNop)) {
+
+                //
+                // The jump instruction is left intact, as it is still
+                // executed if the operands are not integers, or if something
+                // else jumps directly to it.
+                //
+
+                if ((Operator->JumpOp != CkOpNop) &&
+                    (Ip + Size < Function->Code.Count) &&
+                    (Code[Ip + Size] == CkOpJumpIf)) {
+
+                    Code[Ip] = Operator->JumpOp;
+
+                } else {
+                    Code[Ip] = Operator->FastOp;
+                }
+            }
+        }
+
+        Ip += Size;
+    }
+
+    //
+    // Fuse field loads with any plain calls that are left over. This is done
+    // second so that operator calls get their integer fast paths instead.
+    //
+
+    Ip = 0;
+    while (Ip < Function->Code.Count) {
+        Op = Code[Ip];
+        Size = CkpGetInstructionSize(Code, Function->Constants.Data, Ip);
+        if ((Op == CkOpLoadFieldThis) && (Ip + Size < Function->Code.Count)) {
+            Next = Code[Ip + Size];
+            if ((Next >= CkOpCall0) && (Next <= CkOpCall8)) {
+                Code[Ip] = CkOpLoadFieldThisCall;
+            }
+        }
+
+        Ip += Size;
+    }
+
+    return;
+}
+
+VOID
+CkpCompactCode (
+    PCK_COMPILER Compiler,
+    PUCHAR Targets
+    )
+
+/*++
+
+Routine Description:
+
+    This routine rebuilds the function's code without the no-op padding left
+    by the earlier passes, so folded expressions cost nothing to execute. Loads
+    of local variables that feed directly into an integer operator are fused
+    with it along the way. Jump offsets and the line number program are
+    relocated to the new layout. If anything fails, the code is left as it is,
+    which is still correct.
+
+Arguments:
+
+    Compiler - Supplies a pointer to the compiler.
+
+    Targets - Supplies a pointer to the jump target map.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL Changed;
+    PUCHAR Code;
+    UINTN Count;
+    PCK_FUNCTION Function;
+    CK_OPCODE Fused;
+    UINTN Index;
+    UINTN Ip;
+    UCHAR Local;
+    PUINTN Map;
+    PUCHAR NewCode;
+    CK_BYTE_ARRAY NewCodeArray;
+    UINTN NewIp;
+    UINTN NewOffset;
+    UINTN Offset;
+    CK_OPCODE Op;
+    UCHAR Operator;
+    BOOL Relocate;
+    UINTN Size;
+    UINTN Target;
+    PCK_VM Vm;
+
+    Function = Compiler->Function;
+    Vm = Compiler->Parser->Vm;
+    Code = Function->Code.Data;
+    Count = Function->Code.Count;
+    Map = CkAllocate(Vm, (Count + 1) * sizeof(UINTN));
+    if (Map == NULL) {
+        return;
+    }
+
+    CkpInitializeArray(&NewCodeArray);
+
+    //
+    // Lay out the new code, recording where every old offset lands. Padding
+    // maps to whatever follows it, and both halves of a fused pair map to the
+    // fused instruction.
+    //
+
+    Changed = FALSE;
+    Ip = 0;
+    NewIp = 0;
+    while (Ip < Count) {
+        if (Code[Ip] == CkOpNop) {
+            Map[Ip] = NewIp;
+            Ip += 1;
+            Changed = TRUE;
+            continue;
+        }
+
+        Fused = CkpGetLocalFusion(Function,
+                                  Targets,
+                                  Ip,
+                                  &Local,
+                                  &Operator,
+                                  &Size);
+
+        if (Fused != CkOpNop) {
+            for (Index = Ip; Index < Ip + Size; Index += 1) {
+                Map[Index] = NewIp;
+            }
+
+            NewIp += CK_LOCAL_FUSION_SIZE;
+            Changed = TRUE;
+
+        } else {
+            Size = CkpGetInstructionSize(Code, Function->Constants.Data, Ip);
+            for (Index = Ip; Index < Ip + Size; Index += 1) {
+                Map[Index] = NewIp + (Index - Ip);
+            }
+
+            NewIp += Size;
+        }
+
+        Ip += Size;
+    }
+
+    Map[Count] = NewIp;
+    if ((Changed == FALSE) ||
+        (CkpSizeArray(Vm, &NewCodeArray, NewIp) != CkSuccess)) {
+
+        goto CompactCodeEnd;
+    }
+
+    //
+    // Emit the new code and relocate the jumps. Fusing can grow the code, so
+    // give up if a jump no longer fits.
+    //
+
+    NewCode = NewCodeArray.Data;
+    Ip = 0;
+    while (Ip < Count) {
+        Op = Code[Ip];
+        if (Op == CkOpNop) {
+            Ip += 1;
+            continue;
+        }
+
+        NewIp = Map[Ip];
+        Fused = CkpGetLocalFusion(Function,
+                                  Targets,
+                                  Ip,
+                                  &Local,
+                                  &Operator,
+                                  &Size);
+
+        if (Fused != CkOpNop) {
+            NewCode[NewIp] = Fused;
+            NewCode[NewIp + 1] = Local;
+            NewCode[NewIp + 2] = Operator;
+            NewCode[NewIp + 3] = Code[Ip + Size - 2];
+            NewCode[NewIp + 4] = Code[Ip + Size - 1];
+            Ip += Size;
+            continue;
+        }
+
+        Size = CkpGetInstructionSize(Code, Function->Constants.Data, Ip);
+        CkCopy(NewCode + NewIp, Code + Ip, Size);
+        Relocate = TRUE;
+        switch (Op) {
+        case CkOpJump:
+        case CkOpJumpIf:
+        case CkOpAnd:
+        case CkOpOr:
+        case CkOpTry:
+            Offset = CK_READ16(Code + Ip + 1);
+            Target = Map[Ip + Size + Offset];
+            NewOffset = Target - (NewIp + Size);
+            break;
+
+        case CkOpLoop:
+            Offset = CK_READ16(Code + Ip + 1);
+            Target = Map[Ip + Size - Offset];
+            NewOffset = (NewIp + Size) - Target;
+            break;
+
+        default:
+            NewOffset = 0;
+            Relocate = FALSE;
+            break;
+        }
+
+        if (Relocate != FALSE) {
+            if (NewOffset >= CK_MAX_JUMP) {
+                goto CompactCodeEnd;
+            }
+
+            NewCode[NewIp + 1] = (UCHAR)(NewOffset >> 8);
+            NewCode[NewIp + 2] = (UCHAR)NewOffset;
+        }
+
+        Ip += Size;
+    }
+
+    NewCodeArray.Count = Map[Count];
+    CkpRelocateLineProgram(Compiler, Map);
+    CkpClearArray(Vm, &(Function->Code));
+    Function->Code = NewCodeArray;
+    CkpInitializeArray(&NewCodeArray);
+
+CompactCodeEnd:
+    if (NewCodeArray.Data != NULL) {
+        CkpClearArray(Vm, &NewCodeArray);
+    }
+
+    CkFree(Vm, Map);
+    return;
+}
+
+CK_OPCODE
+CkpGetLocalFusion (
+    PCK_FUNCTION Function,
+    PUCHAR Targets,
+    UINTN Ip,
+    PUCHAR Local,
+    PUCHAR Operator,
+    PUINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the instruction at the given offset is a
+    local variable load that can be fused with the integer operator or
+    compare and jump superinstruction that follows it.
+
+Arguments:
+
+    Function - Supplies a pointer to the function containing the code.
+
+    Targets - Supplies a pointer to the jump target map.
+
+    Ip - Supplies the offset of the instruction.
+
+    Local - Supplies a pointer where the local slot will be returned.
+
+    Operator - Supplies a pointer where the operator opcode for the fused
+        instruction will be returned.
+
+    Size - Supplies a pointer where the combined size of the two instructions
+        will be returned.
+
+Return Value:
+
+    Returns the fused opcode to use.
+
+    CkOpNop if the instruction cannot be fused.
+
+--*/
+
+{
+
+    PUCHAR Code;
+    CK_OPCODE Fused;
+    UINTN LoadSize;
+    UINTN Next;
+    CK_OPCODE Op;
+
+    Code = Function->Code.Data;
+    Op = Code[Ip];
+    if ((Op >= CkOpLoadLocal0) && (Op <= CkOpLoadLocal8)) {
+        *Local = Op - CkOpLoadLocal0;
+        LoadSize = 1;
+
+    } else if (Op == CkOpLoadLocal) {
+        *Local = Code[Ip + 1];
+        LoadSize = 2;
+
+    } else {
+        return CkOpNop;
+    }
+
+    //
+    // The operator cannot be absorbed if something else jumps to it.
+    //
+
+    Next = Ip + LoadSize;
+    if ((Next >= Function->Code.Count) || (Targets[Next] != FALSE)) {
+        return CkOpNop;
+    }
+
+    Op = Code[Next];
+    if ((Op >= CkOpAdd) && (Op <= CkOpIsNotEqual)) {
+        Fused = CkOpLoadLocalOperator;
+        *Operator = Op;
+
+    } else if ((Op >= CkOpLessThanJump) && (Op <= CkOpIsNotEqualJump)) {
+        Fused = CkOpLoadLocalCompareJump;
+        *Operator = Op - CkOpLessThanJump + CkOpLessThan;
+
+    } else {
+        return CkOpNop;
+    }
+
+    *Size = LoadSize + CkpGetInstructionSize(Code,
+                                             Function->Constants.Data,
+                                             Next);
+
+    return Fused;
+}
+
+VOID
+CkpRelocateLineProgram (
+    PCK_COMPILER Compiler,
+    PUINTN Map
+    )
+
+/*++
+
+Routine Description:
+
+    This routine rewrites the function's line number program for compacted
+    code. Each row of the old program is moved to its new offset. Where
+    several old rows land on the same offset, the last one is kept, since it
+    belongs to the instruction that survived there.
+
+Arguments:
+
+    Compiler - Supplies a pointer to the compiler.
+
+    Map - Supplies the map from old code offsets to new ones.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PUCHAR End;
+    PCK_FUNCTION Function;
+    BOOL HaveRow;
+    LONG Line;
+    PUCHAR LineProgram;
+    UINTN NewOffset;
+    UINTN Offset;
+    CK_BYTE_ARRAY OldProgram;
+    CK_LINE_OP Op;
+    LONG RowLine;
+    UINTN RowOffset;
+
+    Function = Compiler->Function;
+    OldProgram = Function->Debug.LineProgram;
+    CkpInitializeArray(&(Function->Debug.LineProgram));
+    Compiler->LastLineOp = NULL;
+    Compiler->PreviousLine = Function->Debug.FirstLine;
+    Compiler->LineOffset = 0;
+
+    //
+    // Decode the old program the same way line lookups do, emitting each row
+    // once the next row is known to be at a different offset.
+    //
+
+    LineProgram = OldProgram.Data;
+    End = LineProgram + OldProgram.Count;
+    Offset = 0;
+    Line = Function->Debug.FirstLine;
+    HaveRow = FALSE;
+    RowLine = 0;
+    RowOffset = 0;
+    while (LineProgram < End) {
+        Op = *LineProgram;
+        LineProgram += 1;
+        switch (Op) {
+        case CkLineOpNop:
+            continue;
+
+        case CkLineOpSetLine:
+            CkCopy(&Line, LineProgram, sizeof(ULONG));
+            LineProgram += sizeof(ULONG);
+            continue;
+
+        case CkLineOpAdvanceLine:
+            Line += CkpUtf8Decode(LineProgram, End - LineProgram);
+            LineProgram += CkpUtf8DecodeSize(*LineProgram);
+            continue;
+
+        case CkLineOpSetOffset:
+            Offset = 0;
+            CkCopy(&Offset, LineProgram, sizeof(ULONG));
+            LineProgram += sizeof(ULONG);
+            break;
+
+        case CkLineOpAdvanceOffset:
+            Offset += CkpUtf8Decode(LineProgram, End - LineProgram);
+            LineProgram += CkpUtf8DecodeSize(*LineProgram);
+            break;
+
+        case CkLineOpSpecial:
+        default:
+            Line += CK_LINE_ADVANCE(Op);
+            Offset += CK_OFFSET_ADVANCE(Op);
+            break;
+        }
+
+        CK_ASSERT(Offset <= Function->Code.Count);
+
+        NewOffset = Map[Offset];
+        if ((HaveRow != FALSE) && (NewOffset != RowOffset)) {
+            CkpEmitLineNumberInformation(Compiler, RowLine, RowOffset);
+        }
+
+        HaveRow = TRUE;
+        RowLine = Line;
+        RowOffset = NewOffset;
+    }
+
+    if (HaveRow != FALSE) {
+        CkpEmitLineNumberInformation(Compiler, RowLine, RowOffset);
+    }
+
+    CkpClearArray(Compiler->Parser->Vm, &OldProgram);
+    return;
+}
+
+PCK_OPTIMIZER_OPERATOR
+CkpGetOptimizerOperator (
+    PCK_FUNCTION Function,
+    PUCHAR Instruction
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given call instruction invokes an
+    operator method the optimizer knows about.
+
+Arguments:
+
+    Function - Supplies a pointer to the function containing the code.
+
+    Instruction - Supplies a pointer to a CkOpCall0 through CkOpCall8
+        instruction.
+
+Return Value:
+
+    Returns a pointer to the optimizer operator description on success.
+
+    NULL if the call is not to an operator the optimizer handles.
+
+--*/
+
+{
+
+    UINTN Length;
+    PCK_OPTIMIZER_OPERATOR Operator;
+    PCK_STRING String;
+    CK_SYMBOL_INDEX Symbol;
+
+    Symbol = CK_READ16(Instruction + 1);
+
+    CK_ASSERT(Symbol < Function->Module->Strings.List.Count);
+
+    String = CK_AS_STRING(Function->Module->Strings.List.Data[Symbol]);
+    Operator = CkOptimizerOperators;
+    while (Operator->Name != NULL) {
+        Length = strlen(Operator->Name);
+        if ((String->Length == Length) &&
+            (CkCompareMemory(String->Value, Operator->Name, Length) == 0)) {
+
+            return Operator;
+        }
+
+        Operator += 1;
+    }
+
+    return NULL;
+}
+
+BOOL
+CkpGetConstantInteger (
+    PCK_FUNCTION Function,
+    PUCHAR Instruction,
+    PCK_INTEGER Value
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether the given instruction pushes a constant
+    integer.
+
+Arguments:
+
+    Function - Supplies a pointer to the function containing the code.
+
+    Instruction - Supplies a pointer to the instruction.
+
+    Value - Supplies a pointer where the constant value will be returned.
+
+Return Value:
+
+    TRUE if the instruction pushes an integer constant.
+
+    FALSE otherwise.
+
+--*/
+
+{
+
+    CK_SYMBOL_INDEX Constant;
+    CK_OPCODE Op;
+
+    Op = *Instruction;
+    if ((Op >= CkOpLiteral0) && (Op <= CkOpLiteral8)) {
+        *Value = Op - CkOpLiteral0;
+        return TRUE;
+    }
+
+    if (Op == CkOpConstant) {
+        Constant = CK_READ16(Instruction + 1);
+
+        CK_ASSERT(Constant < Function->Constants.Count);
+
+        if (CK_IS_INTEGER(Function->Constants.Data[Constant])) {
+            *Value = CK_AS_INTEGER(Function->Constants.Data[Constant]);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+BOOL
+CkpEvaluateFold (
+    CK_FOLD_OPERATION Fold,
+    PCK_INTEGER Operands,
+    PCK_INTEGER Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine evaluates an operator on constant integers at compile time.
+    The results match what the Int class methods compute at runtime.
+    Arithmetic wraps rather than overflowing.
+
+Arguments:
+
+    Fold - Supplies the operation to perform.
+
+    Operands - Supplies the receiver, followed by the argument for binary
+        operators.
+
+    Result - Supplies a pointer where the result will be returned.
+
+Return Value:
+
+    TRUE if the operation was evaluated.
+
+    FALSE if the operation cannot be folded.
+
+--*/
+
+{
+
+    ULONGLONG Left;
+    ULONGLONG Right;
+
+    Left = Operands[0];
+    Right = 0;
+    if (Fold < CkFoldNegate) {
+        Right = Operands[1];
+    }
+
+    switch (Fold) {
+    case CkFoldAdd:
+        *Result = (CK_INTEGER)(Left + Right);
+        break;
+
+    case CkFoldSubtract:
+        *Result = (CK_INTEGER)(Left - Right);
+        break;
+
+    case CkFoldMultiply:
+        *Result = (CK_INTEGER)(Left * Right);
+        break;
+
+    case CkFoldAnd:
+        *Result = Left & Right;
+        break;
+
+    case CkFoldOr:
+        *Result = Left | Right;
+        break;
+
+    case CkFoldXor:
+        *Result = Left ^ Right;
+        break;
+
+    case CkFoldLessThan:
+        *Result = Operands[0] < Operands[1];
+        break;
+
+    case CkFoldLessOrEqual:
+        *Result = Operands[0] <= Operands[1];
+        break;
+
+    case CkFoldGreaterThan:
+        *Result = Operands[0] > Operands[1];
+        break;
+
+    case CkFoldGreaterOrEqual:
+        *Result = Operands[0] >= Operands[1];
+        break;
+
+    case CkFoldEqual:
+        *Result = Operands[0] == Operands[1];
+        break;
+
+    case CkFoldNotEqual:
+        *Result = Operands[0] != Operands[1];
+        break;
+
+    case CkFoldNegate:
+        *Result = (CK_INTEGER)(-Left);
+        break;
+
+    case CkFoldComplement:
+        *Result = ~Left;
+        break;
+
+    case CkFoldLogicalNot:
+        *Result = !Left;
+        break;
+
+    default:
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+UINTN
+CkpEmitFoldedConstant (
+    PCK_COMPILER Compiler,
+    PUCHAR Code,
+    CK_INTEGER Value
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes an instruction that pushes the given integer into the
+    code stream. Existing integer constants are reused where possible.
+
+Arguments:
+
+    Compiler - Supplies a pointer to the compiler.
+
+    Code - Supplies a pointer to the code to write to. There are always at
+        least as many bytes available as a CkOpConstant instruction takes.
+
+    Value - Supplies the integer to push.
+
+Return Value:
+
+    Returns the number of bytes written.
+
+    0 if the constant could not be added.
+
+--*/
+
+{
+
+    PCK_VALUE Constants;
+    CK_SYMBOL_INDEX Index;
+    CK_VALUE IntegerValue;
+
+    if ((Value >= 0) && (Value <= 8)) {
+        *Code = CkOpLiteral0 + Value;
+        return 1;
+    }
+
+    Constants = Compiler->Function->Constants.Data;
+    for (Index = 0; Index < Compiler->Function->Constants.Count; Index += 1) {
+        if ((CK_IS_INTEGER(Constants[Index])) &&
+            (CK_AS_INTEGER(Constants[Index]) == Value)) {
+
+            break;
+        }
+    }
+
+    if (Index == Compiler->Function->Constants.Count) {
+        if (Index >= CK_MAX_CONSTANTS) {
+            return 0;
+        }
+
+        CK_INT_VALUE(IntegerValue, Value);
+        Index = CkpAddConstant(Compiler, IntegerValue);
+        if (Index < 0) {
+            return 0;
+        }
+    }
+
+    Code[0] = CkOpConstant;
+    Code[1] = (UCHAR)(Index >> 8);
+    Code[2] = (UCHAR)Index;
+    return 3;
+}
+
@@ -1615,6 +1615,63 @@ Return Value:
 
 --*/
 
+UINTN
+CkpGetInstructionSize (
+    PUCHAR ByteCode,
+    PCK_VALUE Constants,
+    UINTN Ip
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines the size of the instruction in the bytecode,
+    including any operands.
+
+Arguments:
+
+    ByteCode - Supplies a pointer to the function bytecode stream.
+
+    Constants - Supplies a pointer to the constants table for the function.
+
+    Ip - Supplies the current instruction pointer.
+
+Return Value:
+
+    Returns the number of bytes in the instruction, including the opcode and
+    any arguments.
+
+--*/
+
+VOID
+CkpEmitLineNumberInformation (
+    PCK_COMPILER Compiler,
+    ULONG Line,
+    ULONG Offset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine updates the line number program to include the latest bytecode
+    that was emitted.
+
+Arguments:
+
+    Compiler - Supplies a pointer to the compiler.
+
+    Line - Supplies the line number the latest bytecode belongs to.
+
+    Offset - Supplies the offset within the bytecode that was just emitted.
+
+Return Value:
+
+    None.
+
+--*/
+
 CK_VALUE
 CkpReadSourceInteger (
     PCK_COMPILER Compiler,
@@ -1667,6 +1724,32 @@ Return Value:
 
 --*/
 
+//
+// Bytecode optimization functions
+//
+
+VOID
+CkpOptimizeFunction (
+    PCK_COMPILER Compiler
+    );
+
+/*++
+
+Routine Description:
+
+    This routine runs the peephole optimizer over the function that was just
+    compiled. The code must be complete, with all jumps patched.
+
+Arguments:
+
+    Compiler - Supplies a pointer to the compiler.
+
+Return Value:
+
+    None.
+
+--*/
+
 //
 // Lexer functionality.
 //
@@ -135,7 +135,28 @@ PSTR CkOpcodeNames[CkOpcodeCount] = {
     "StaticMethod",
     "Try",
     "PopTry",
-    "End"
+    "End",
+    "Add",
+    "Subtract",
+    "Multiply",
+    "BitAnd",
+    "BitOr",
+    "BitXor",
+    "LessThan",
+    "LessOrEqual",
+    "GreaterThan",
+    "GreaterOrEqual",
+    "IsEqual",
+    "IsNotEqual",
+    "LessThanJump",
+    "LessOrEqualJump",
+    "GreaterThanJump",
+    "GreaterOrEqualJump",
+    "IsEqualJump",
+    "IsNotEqualJump",
+    "LoadFieldThisCall",
+    "LoadLocalOperator",
+    "LoadLocalCompareJump"
 };
 
 PSTR CkObjectTypeNames[CkObjectTypeCount] = {
@@ -420,6 +441,7 @@ Return Value:
     PCK_FUNCTION LoadedFunction;
     PSTR LocalType;
     CK_OPCODE Op;
+    CK_OPCODE Operator;
     UINTN Start;
     PCK_STRING StringObject;
     CK_SYMBOL_INDEX Symbol;
@@ -509,6 +531,24 @@ Return Value:
     case CkOpSuperCall8:
     case CkOpMethod:
     case CkOpStaticMethod:
+    case CkOpAdd:
+    case CkOpSubtract:
+    case CkOpMultiply:
+    case CkOpBitAnd:
+    case CkOpBitOr:
+    case CkOpBitXor:
+    case CkOpLessThan:
+    case CkOpLessOrEqual:
+    case CkOpGreaterThan:
+    case CkOpGreaterOrEqual:
+    case CkOpIsEqual:
+    case CkOpIsNotEqual:
+    case CkOpLessThanJump:
+    case CkOpLessOrEqualJump:
+    case CkOpGreaterThanJump:
+    case CkOpGreaterOrEqualJump:
+    case CkOpIsEqualJump:
+    case CkOpIsNotEqualJump:
         Symbol = CK_READ16(ByteCode + Offset);
         Offset += 2;
 
@@ -520,6 +560,29 @@ Return Value:
         CkpDebugPrint(Vm, "%s", StringObject->Value);
         break;
 
+    case CkOpLoadLocalOperator:
+    case CkOpLoadLocalCompareJump:
+        Constant = CK_READ8(ByteCode + Offset);
+        Offset += 1;
+        Operator = CK_READ8(ByteCode + Offset);
+        Offset += 1;
+        Symbol = CK_READ16(ByteCode + Offset);
+        Offset += 2;
+
+        CK_ASSERT(Operator < CkOpcodeCount);
+        CK_ASSERT(Symbol < Function->Module->Strings.List.Count);
+
+        StringObject =
+                     CK_AS_STRING(Function->Module->Strings.List.Data[Symbol]);
+
+        CkpDebugPrint(Vm,
+                      "%d %s %s",
+                      Constant,
+                      CkOpcodeNames[Operator],
+                      StringObject->Value);
+
+        break;
+
     case CkOpIndirectCall:
     case CkOpLoadLocal:
     case CkOpStoreLocal:
@@ -529,6 +592,7 @@ Return Value:
     case CkOpStoreFieldThis:
     case CkOpLoadField:
     case CkOpStoreField:
+    case CkOpLoadFieldThisCall:
         Constant = CK_READ8(ByteCode + Offset);
         Offset += 1;
         CkpDebugPrint(Vm, "%d", Constant);
@@ -95,6 +95,56 @@ Module Name:
                                                         \
     CKI_LOAD_FRAME()                                    \
 
+//
+// This macro implements the superinstructions substituted for binary operator
+// calls. If both operands are integers, the operation is done directly.
+// Otherwise the operator method is called normally.
+//
+
+#define CKI_INTEGER_OPERATOR(_Operator)                                     \
+    CKI_READ_SYMBOL(Symbol);                                                \
+    Arguments = Fiber->StackTop - 2;                                        \
+    if ((CK_IS_INTEGER(Arguments[0])) && (CK_IS_INTEGER(Arguments[1]))) {  \
+        CK_INT_VALUE(Arguments[0],                                          \
+                     CK_AS_INTEGER(Arguments[0]) _Operator                  \
+                     CK_AS_INTEGER(Arguments[1]));                          \
+                                                                            \
+        CKI_DROP();                                                         \
+        CKI_DISPATCH();                                                     \
+    }                                                                       \
+                                                                            \
+    Arity = 2;                                                              \
+    goto RunInterpreterMethodCall;
+
+//
+// This macro implements the superinstructions substituted for a comparison
+// followed by a conditional jump. If both operands are integers, the
+// comparison and the jump are performed directly. Otherwise the operator
+// method is called, and the jump instruction runs normally afterwards.
+//
+
+#define CKI_INTEGER_COMPARE_JUMP(_Operator)                                 \
+    CKI_READ_SYMBOL(Symbol);                                                \
+    Arguments = Fiber->StackTop - 2;                                        \
+    if ((CK_IS_INTEGER(Arguments[0])) && (CK_IS_INTEGER(Arguments[1]))) {  \
+        Fiber->StackTop = Arguments;                                        \
+                                                                            \
+        CK_ASSERT(*Ip == CkOpJumpIf);                                       \
+                                                                            \
+        Ip += 1;                                                            \
+        CKI_READ_OFFSET(Offset);                                            \
+        if (!(CK_AS_INTEGER(Arguments[0]) _Operator                         \
+              CK_AS_INTEGER(Arguments[1]))) {                               \
+                                                                            \
+            Ip += Offset;                                                   \
+        }                                                                   \
+                                                                            \
+        CKI_DISPATCH();                                                     \
+    }                                                                       \
+                                                                            \
+    Arity = 2;                                                              \
+    goto RunInterpreterMethodCall;
+
 //
 // This macro prints the instruction and the stack. It can be used when
 // debugging the interpreter.
@@ -207,6 +257,27 @@ Module Name:
         CKI_GOTO_OFFSET(CkOpTry), \
         CKI_GOTO_OFFSET(CkOpPopTry), \
         CKI_GOTO_OFFSET(CkOpEnd), \
+        CKI_GOTO_OFFSET(CkOpAdd), \
+        CKI_GOTO_OFFSET(CkOpSubtract), \
+        CKI_GOTO_OFFSET(CkOpMultiply), \
+        CKI_GOTO_OFFSET(CkOpBitAnd), \
+        CKI_GOTO_OFFSET(CkOpBitOr), \
+        CKI_GOTO_OFFSET(CkOpBitXor), \
+        CKI_GOTO_OFFSET(CkOpLessThan), \
+        CKI_GOTO_OFFSET(CkOpLessOrEqual), \
+        CKI_GOTO_OFFSET(CkOpGreaterThan), \
+        CKI_GOTO_OFFSET(CkOpGreaterOrEqual), \
+        CKI_GOTO_OFFSET(CkOpIsEqual), \
+        CKI_GOTO_OFFSET(CkOpIsNotEqual), \
+        CKI_GOTO_OFFSET(CkOpLessThanJump), \
+        CKI_GOTO_OFFSET(CkOpLessOrEqualJump), \
+        CKI_GOTO_OFFSET(CkOpGreaterThanJump), \
+        CKI_GOTO_OFFSET(CkOpGreaterOrEqualJump), \
+        CKI_GOTO_OFFSET(CkOpIsEqualJump), \
+        CKI_GOTO_OFFSET(CkOpIsNotEqualJump), \
+        CKI_GOTO_OFFSET(CkOpLoadFieldThisCall), \
+        CKI_GOTO_OFFSET(CkOpLoadLocalOperator), \
+        CKI_GOTO_OFFSET(CkOpLoadLocalCompareJump), \
     };
 
 //
@@ -307,6 +378,13 @@ CkpValidateSuperclass (
     CK_SYMBOL_INDEX FieldCount
     );
 
+CK_INTEGER
+CkpEvaluateIntegerOperator (
+    CK_OPCODE Operator,
+    CK_INTEGER Left,
+    CK_INTEGER Right
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -1085,6 +1163,13 @@ Return Value:
         Arity = Instruction - CkOpCall0 + 1;
         CKI_READ_SYMBOL(Symbol);
         Arguments = Fiber->StackTop - Arity;
+
+    //
+    // The superinstructions jump here to call a method once the arity,
+    // symbol, and arguments are set up.
+    //
+
+    RunInterpreterMethodCall:
         Class = CkpGetClass(Vm, Arguments[0]);
         MethodName = Function->Module->Strings.List.Data[Symbol];
         CKI_STORE_FRAME();
@@ -1370,6 +1455,135 @@ Return Value:
         Fiber->TryCount -= 1;
         CKI_DISPATCH();
 
+    CKI_CASE(CkOpAdd):
+        CKI_INTEGER_OPERATOR(+);
+
+    CKI_CASE(CkOpSubtract):
+        CKI_INTEGER_OPERATOR(-);
+
+    CKI_CASE(CkOpMultiply):
+        CKI_INTEGER_OPERATOR(*);
+
+    CKI_CASE(CkOpBitAnd):
+        CKI_INTEGER_OPERATOR(&);
+
+    CKI_CASE(CkOpBitOr):
+        CKI_INTEGER_OPERATOR(|);
+
+    CKI_CASE(CkOpBitXor):
+        CKI_INTEGER_OPERATOR(^);
+
+    CKI_CASE(CkOpLessThan):
+        CKI_INTEGER_OPERATOR(<);
+
+    CKI_CASE(CkOpLessOrEqual):
+        CKI_INTEGER_OPERATOR(<=);
+
+    CKI_CASE(CkOpGreaterThan):
+        CKI_INTEGER_OPERATOR(>);
+
+    CKI_CASE(CkOpGreaterOrEqual):
+        CKI_INTEGER_OPERATOR(>=);
+
+    CKI_CASE(CkOpIsEqual):
+        CKI_INTEGER_OPERATOR(==);
+
+    CKI_CASE(CkOpIsNotEqual):
+        CKI_INTEGER_OPERATOR(!=);
+
+    CKI_CASE(CkOpLessThanJump):
+        CKI_INTEGER_COMPARE_JUMP(<);
+
+    CKI_CASE(CkOpLessOrEqualJump):
+        CKI_INTEGER_COMPARE_JUMP(<=);
+
+    CKI_CASE(CkOpGreaterThanJump):
+        CKI_INTEGER_COMPARE_JUMP(>);
+
+    CKI_CASE(CkOpGreaterOrEqualJump):
+        CKI_INTEGER_COMPARE_JUMP(>=);
+
+    CKI_CASE(CkOpIsEqualJump):
+        CKI_INTEGER_COMPARE_JUMP(==);
+
+    CKI_CASE(CkOpIsNotEqualJump):
+        CKI_INTEGER_COMPARE_JUMP(!=);
+
+    CKI_CASE(CkOpLoadFieldThisCall):
+        CKI_READ_FIELD(Field);
+        Receiver = Stack[0];
+
+        CK_ASSERT(CK_IS_INSTANCE(Receiver));
+
+        Instance = CK_AS_INSTANCE(Receiver);
+        Symbol = Field + Frame->Closure->Class->SuperFieldCount;
+
+        CK_ASSERT(Symbol < Instance->Header.Class->FieldCount);
+
+        CKI_PUSH(Instance->Fields[Symbol]);
+        CKI_READ_BYTE(Instruction);
+
+        CK_ASSERT((Instruction >= CkOpCall0) && (Instruction <= CkOpCall8));
+
+        Arity = Instruction - CkOpCall0 + 1;
+        CKI_READ_SYMBOL(Symbol);
+        Arguments = Fiber->StackTop - Arity;
+        goto RunInterpreterMethodCall;
+
+    CKI_CASE(CkOpLoadLocalOperator):
+        CKI_READ_LOCAL(Local);
+        CKI_READ_BYTE(Instruction);
+        CKI_READ_SYMBOL(Symbol);
+
+        CK_ASSERT(Local < Function->MaxStack);
+
+        Receiver = CKI_STACK_TOP();
+        Value = Stack[Local];
+        if ((CK_IS_INTEGER(Receiver)) && (CK_IS_INTEGER(Value))) {
+            CK_INT_VALUE(CKI_STACK_TOP(),
+                         CkpEvaluateIntegerOperator(Instruction,
+                                                    CK_AS_INTEGER(Receiver),
+                                                    CK_AS_INTEGER(Value)));
+
+            CKI_DISPATCH();
+        }
+
+        CKI_PUSH(Value);
+        Arity = 2;
+        Arguments = Fiber->StackTop - Arity;
+        goto RunInterpreterMethodCall;
+
+    CKI_CASE(CkOpLoadLocalCompareJump):
+        CKI_READ_LOCAL(Local);
+        CKI_READ_BYTE(Instruction);
+        CKI_READ_SYMBOL(Symbol);
+
+        CK_ASSERT(Local < Function->MaxStack);
+
+        Receiver = CKI_STACK_TOP();
+        Value = Stack[Local];
+        if ((CK_IS_INTEGER(Receiver)) && (CK_IS_INTEGER(Value))) {
+            CKI_DROP();
+
+            CK_ASSERT(*Ip == CkOpJumpIf);
+
+            Ip += 1;
+            CKI_READ_OFFSET(Offset);
+            if (CkpEvaluateIntegerOperator(Instruction,
+                                           CK_AS_INTEGER(Receiver),
+                                           CK_AS_INTEGER(Value)) == 0) {
+
+                Ip += Offset;
+            }
+
+            CKI_DISPATCH();
+        }
+
+        CKI_PUSH(Value);
+        Arity = 2;
+        Arguments = Fiber->StackTop - Arity;
+        goto RunInterpreterMethodCall;
+
     //
     // End opcodes should never get executed because they're always preceded
     // by a return.
@@ -1984,3 +2198,81 @@ Return Value:
     return TRUE;
 }
 
+CK_INTEGER
+CkpEvaluateIntegerOperator (
+    CK_OPCODE Operator,
+    CK_INTEGER Left,
+    CK_INTEGER Right
+    )
+
+/*++
+
+Routine Description:
+
+    This routine applies the operator named by one of the integer
+    superinstruction opcodes to two integers. This is the fast path of the
+    load local superinstructions, which carry the operator as an operand.
+
+Arguments:
+
+    Operator - Supplies the opcode of the operator, CkOpAdd through
+        CkOpIsNotEqual.
+
+    Left - Supplies the receiver.
+
+    Right - Supplies the argument.
+
+Return Value:
+
+    Returns the result of the operation. Comparisons return 1 or 0.
+
+--*/
+
+{
+
+    switch (Operator) {
+    case CkOpAdd:
+        return Left + Right;
+
+    case CkOpSubtract:
+        return Left - Right;
+
+    case CkOpMultiply:
+        return Left * Right;
+
+    case CkOpBitAnd:
+        return Left & Right;
+
+    case CkOpBitOr:
+        return Left | Right;
+
+    case CkOpBitXor:
+        return Left ^ Right;
+
+    case CkOpLessThan:
+        return Left < Right;
+
+    case CkOpLessOrEqual:
+        return Left <= Right;
+
+    case CkOpGreaterThan:
+        return Left > Right;
+
+    case CkOpGreaterOrEqual:
+        return Left >= Right;
+
+    case CkOpIsEqual:
+        return Left == Right;
+
+    case CkOpIsNotEqual:
+        return Left != Right;
+
+    default:
+        break;
+    }
+
+    CK_ASSERT(FALSE);
+
+    return 0;
+}
+
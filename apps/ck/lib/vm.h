@@ -230,6 +230,36 @@ Enumeration Description:
     CkOpEnd - This opcode terminates a compilation. It should always be
         preceded by a return and therefore should never be executed.
 
+    The remaining opcodes are never emitted directly by the compiler. They are
+    substituted by the bytecode optimizer.
+
+    CkOpAdd - Adds the top two stack values. The method symbol to call if the
+        operands are not both integers is specified in the next instruction
+        word. CkOpSubtract through CkOpIsNotEqual work the same way for their
+        respective operators.
+
+    CkOpLessThanJump - Compares the top two stack values. The method symbol to
+        call if the operands are not both integers is specified in the next
+        instruction word. This opcode is always followed by a JumpIf
+        instruction, which is consumed directly if the integer fast path is
+        taken. CkOpLessOrEqualJump through CkOpIsNotEqualJump work the same
+        way for their respective operators.
+
+    CkOpLoadFieldThisCall - Pushes the value of the instance field specified
+        in the next instruction byte, and then immediately executes the
+        CkOpCall0 through CkOpCall8 instruction that follows.
+
+    CkOpLoadLocalOperator - Applies a binary operator to the top of the stack
+        and a local variable. The next instruction byte is the local slot,
+        followed by a byte holding one of CkOpAdd through CkOpIsNotEqual, and
+        then the method symbol to call if the operands are not both integers.
+
+    CkOpLoadLocalCompareJump - Compares the top of the stack with a local
+        variable, encoded the same way as CkOpLoadLocalOperator with one of
+        CkOpLessThan through CkOpIsNotEqual. This opcode is always followed by
+        a JumpIf instruction, which is consumed directly if the integer fast
+        path is taken.
+
 --*/
 
 typedef enum _CK_OPCODE {
@@ -301,6 +331,27 @@ typedef enum _CK_OPCODE {
     CkOpTry,
     CkOpPopTry,
     CkOpEnd,
+    CkOpAdd,
+    CkOpSubtract,
+    CkOpMultiply,
+    CkOpBitAnd,
+    CkOpBitOr,
+    CkOpBitXor,
+    CkOpLessThan,
+    CkOpLessOrEqual,
+    CkOpGreaterThan,
+    CkOpGreaterOrEqual,
+    CkOpIsEqual,
+    CkOpIsNotEqual,
+    CkOpLessThanJump,
+    CkOpLessOrEqualJump,
+    CkOpGreaterThanJump,
+    CkOpGreaterOrEqualJump,
+    CkOpIsEqualJump,
+    CkOpIsNotEqualJump,
+    CkOpLoadFieldThisCall,
+    CkOpLoadLocalOperator,
+    CkOpLoadLocalCompareJump,
     CkOpcodeCount
 } CK_OPCODE, *PCK_OPCODE;
 
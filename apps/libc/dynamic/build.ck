@@ -143,6 +143,7 @@ function build() {
         "realpath.c",
         "regexcmp.c",
         "regexexe.c",
+        "regexnfa.c",
         "resolv.c",
         "resource.c",
         "scan.c",
@@ -182,12 +183,14 @@ function build() {
         "getopt.c",
         "qsort.c",
         "regexcmp.c",
-        "regexexe.c"
+        "regexexe.c",
+        "regexnfa.c"
     ];
 
     wincsupSources = [
         "regexcmp.c",
         "regexexe.c",
+        "regexnfa.c",
         "wincsup/strftime.c"
     ];
 
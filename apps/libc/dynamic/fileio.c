@@ -349,6 +349,10 @@ Return Value:
             Parameters.Flags |= SYS_OPEN_FLAG_ASYNCHRONOUS;
         }
 
+        if ((SetFlags & O_DIRECT) != 0) {
+            Parameters.Flags |= SYS_OPEN_FLAG_DIRECT;
+        }
+
         break;
 
     case F_GETOWN:
@@ -364,24 +368,50 @@ Return Value:
     case F_GETLK:
     case F_SETLK:
     case F_SETLKW:
+    case F_OFD_GETLK:
+    case F_OFD_SETLK:
+    case F_OFD_SETLKW:
         if (Command == F_GETLK) {
             FileControlCommand = FileControlCommandGetLock;
 
         } else if (Command == F_SETLK) {
             FileControlCommand = FileControlCommandSetLock;
 
+        } else if (Command == F_SETLKW) {
+            FileControlCommand = FileControlCommandBlockingSetLock;
+
+        } else if (Command == F_OFD_GETLK) {
+            FileControlCommand = FileControlCommandGetHandleLock;
+
+        } else if (Command == F_OFD_SETLK) {
+            FileControlCommand = FileControlCommandSetHandleLock;
+
         } else {
 
-            assert(Command == F_SETLKW);
+            assert(Command == F_OFD_SETLKW);
 
-            FileControlCommand = FileControlCommandBlockingSetLock;
+            FileControlCommand = FileControlCommandBlockingSetHandleLock;
         }
 
         //
-        // Convert the flock structure to a file lock. Start with the type.
+        // Convert the flock structure to a file lock. Open file description
+        // locks require the process ID to be zero on input.
         //
 
         FileLock = va_arg(ArgumentList, struct flock *);
+        if ((Command == F_OFD_GETLK) || (Command == F_OFD_SETLK) ||
+            (Command == F_OFD_SETLKW)) {
+
+            if (FileLock->l_pid != 0) {
+                Status = STATUS_INVALID_PARAMETER;
+                goto fcntlEnd;
+            }
+        }
+
+        //
+        // Start with the type.
+        //
+
         switch (FileLock->l_type) {
         case F_RDLCK:
             Parameters.FileLock.Type = FileLockRead;
@@ -470,7 +500,8 @@ Return Value:
         //
 
         if ((Command == F_GETLK) || (Command == F_SETLK) ||
-            (Command == F_SETLKW)) {
+            (Command == F_SETLKW) || (Command == F_OFD_GETLK) ||
+            (Command == F_OFD_SETLK) || (Command == F_OFD_SETLKW)) {
 
             if (Status == STATUS_ACCESS_DENIED) {
                 Status = STATUS_INVALID_HANDLE;
@@ -561,11 +592,18 @@ Return Value:
             ReturnValue |= O_ASYNC;
         }
 
+        if ((Flags & SYS_OPEN_FLAG_DIRECT) != 0) {
+            ReturnValue |= O_DIRECT;
+        }
+
         break;
 
     case F_GETLK:
     case F_SETLK:
     case F_SETLKW:
+    case F_OFD_GETLK:
+    case F_OFD_SETLK:
+    case F_OFD_SETLKW:
 
         //
         // Convert back to an flock structure.
@@ -588,7 +626,7 @@ Return Value:
 
         case FileLockUnlock:
             FileLock->l_type = F_UNLCK;
-            if (Command == F_GETLK) {
+            if ((Command == F_GETLK) || (Command == F_OFD_GETLK)) {
                 Status = STATUS_INVALID_PARAMETER;
             }
 
@@ -3492,6 +3530,10 @@ Return Value:
         OsOpenFlags |= SYS_OPEN_FLAG_ASYNCHRONOUS;
     }
 
+    if ((OpenFlags & O_DIRECT) != 0) {
+        OsOpenFlags |= SYS_OPEN_FLAG_DIRECT;
+    }
+
     //
     // Set other flags.
     //
@@ -111,6 +111,7 @@ Return Value:
 
 {
 
+    ClpInitializeStringRoutines();
     ClpInitializeEnvironment();
     ClpInitializeTimeZoneSupport();
     ClpInitializeFileIo();
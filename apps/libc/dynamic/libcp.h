@@ -424,6 +424,28 @@ Return Value:
 
 --*/
 
+VOID
+ClpInitializeStringRoutines (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine selects the implementations of the core memory and string
+    routines best suited to the current processor.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
 time_t
 ClpConvertSystemTimeToUnixTime (
     PSYSTEM_TIME SystemTime
@@ -152,6 +152,10 @@ Return Value:
         OsMapFlags |= SYS_MAP_FLAG_ANONYMOUS;
     }
 
+    if ((MapFlags & MAP_POPULATE) != 0) {
+        OsMapFlags |= SYS_MAP_FLAG_POPULATE;
+    }
+
     Status = OsMemoryMap((HANDLE)(UINTN)FileDescriptor,
                          Offset,
                          Length,
@@ -13,7 +13,10 @@ Module Name:
 
 Abstract:
 
-    This module implements the QuickSort standard C library function.
+    This module implements the QuickSort standard C library function. The
+    sort is an introsort: a median-of-three quicksort that falls back to
+    heapsort if the recursion gets too deep, and finishes small partitions
+    with insertion sort.
 
 Author:
 
@@ -38,33 +41,32 @@ Module Name:
 //
 
 //
-// This macro is a helper to the quicksort swap macro. It gets a pointer to a
-// void pointer at the given index.
+// This macro compares two elements, calling whichever form of comparison
+// function the sort was started with.
 //
 
-#define QUICKSORT_ELEMENT(_Base, _ElementSize, _Index) \
-    (*((void **)((_Base) + ((_ElementSize) * (_Index)))))
+#define QUICKSORT_COMPARE(_Sort, _Left, _Right)                             \
+    (((_Sort)->CompareFunction != NULL) ?                                   \
+     (_Sort)->CompareFunction((_Left), (_Right)) :                          \
+     (_Sort)->ContextCompareFunction((_Left), (_Right), (_Sort)->Context))
 
 //
 // This macro either performs an exchange directly for pointer sized elements,
-// or calls the bytewise swap function to exchange byte for byte. It assumes
-// the presence of a void pointer local called SwapPointer.
+// or calls the swap function to exchange the elements a word or a byte at a
+// time.
 //
 
-#define QUICKSORT_SWAP(_Base, _ElementSize, _FirstIndex, _SecondIndex)         \
+#define QUICKSORT_SWAP(_Sort, _First, _Second)                                 \
     {                                                                          \
-        if ((_ElementSize) == sizeof(void *)) {                                \
-            SwapPointer = QUICKSORT_ELEMENT(_Base, _ElementSize, _FirstIndex); \
-            QUICKSORT_ELEMENT(_Base, _ElementSize, _FirstIndex) =              \
-                        QUICKSORT_ELEMENT(_Base, _ElementSize, _SecondIndex);  \
+        if ((_Sort)->SwapType == QuickSortSwapPointer) {                       \
+            void *_SwapPointer;                                                \
+                                                                               \
+            _SwapPointer = *((void **)(_First));                               \
+            *((void **)(_First)) = *((void **)(_Second));                      \
+            *((void **)(_Second)) = _SwapPointer;                              \
                                                                                \
-            QUICKSORT_ELEMENT(_Base, _ElementSize, _SecondIndex) =             \
-                                                                  SwapPointer; \
         } else {                                                               \
-            ClpQuickSortSwap((_Base),                                          \
-                             (_ElementSize),                                   \
-                             (_FirstIndex),                                    \
-                             (_SecondIndex));                                  \
+            ClpQuickSortSwap((_Sort), (_First), (_Second));                    \
         }                                                                      \
     }
 
@@ -72,29 +74,112 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define the partition size at or below which insertion sort is used.
+//
+
+#define QUICKSORT_INSERTION_THRESHOLD 12
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+typedef enum _QUICKSORT_SWAP_TYPE {
+    QuickSortSwapPointer,
+    QuickSortSwapWords,
+    QuickSortSwapBytes
+} QUICKSORT_SWAP_TYPE, *PQUICKSORT_SWAP_TYPE;
+
+/*++
+
+Structure Description:
+
+    This structure stores the parameters of a sort that stay the same
+    throughout the operation.
+
+Members:
+
+    ElementSize - Stores the size of one element in bytes.
+
+    SwapType - Stores the method used to exchange two elements, determined by
+        the element size and alignment of the array.
+
+    CompareFunction - Stores a pointer to the standard comparison function, or
+        NULL if the comparison function takes a context parameter.
+
+    ContextCompareFunction - Stores a pointer to the comparison function that
+        takes a context parameter, if the standard one is NULL.
+
+    Context - Stores the context pointer passed to the comparison function.
+
+    DepthLimit - Stores the number of partitioning levels allowed before
+        switching to heapsort.
+
+--*/
+
+typedef struct _QUICKSORT {
+    size_t ElementSize;
+    QUICKSORT_SWAP_TYPE SwapType;
+    int (*CompareFunction)(const void *, const void *);
+    int (*ContextCompareFunction)(const void *, const void *, void *);
+    void *Context;
+    ULONG DepthLimit;
+} QUICKSORT, *PQUICKSORT;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
 VOID
-ClpQuickSort (
+ClpQuickSortInitialize (
+    PQUICKSORT Sort,
     void *ArrayBase,
-    size_t ElementSize,
-    ssize_t StartIndex,
-    ssize_t EndIndex,
-    int (*CompareFunction)(const void *, const void *)
+    size_t ElementCount,
+    size_t ElementSize
+    );
+
+VOID
+ClpIntroSort (
+    PQUICKSORT Sort,
+    char *Array,
+    size_t ElementCount,
+    ULONG DepthLimit
+    );
+
+char *
+ClpQuickSortPartition (
+    PQUICKSORT Sort,
+    char *Array,
+    size_t ElementCount
+    );
+
+VOID
+ClpHeapSort (
+    PQUICKSORT Sort,
+    char *Array,
+    size_t ElementCount
+    );
+
+VOID
+ClpHeapSortSiftDown (
+    PQUICKSORT Sort,
+    char *Array,
+    size_t Root,
+    size_t ElementCount
+    );
+
+VOID
+ClpInsertionSort (
+    PQUICKSORT Sort,
+    char *Array,
+    size_t ElementCount
     );
 
 VOID
 ClpQuickSortSwap (
-    void *ArrayBase,
-    size_t ElementSize,
-    ssize_t FirstIndex,
-    ssize_t SecondIndex
+    PQUICKSORT Sort,
+    void *First,
+    void *Second
     );
 
 //
@@ -145,31 +230,25 @@ Return Value:
 
 {
 
-    assert(ElementCount < (((size_t)-1) >> 1));
-    assert(ElementSize < (((size_t)-1) >> 1));
+    QUICKSORT Sort;
 
-    if (ElementCount > 1) {
-        ClpQuickSort(ArrayBase,
-                     ElementSize,
-                     0,
-                     ElementCount - 1,
-                     CompareFunction);
+    ClpQuickSortInitialize(&Sort, ArrayBase, ElementCount, ElementSize);
+    Sort.CompareFunction = CompareFunction;
+    if ((ElementCount > 1) && (ElementSize != 0)) {
+        ClpIntroSort(&Sort, ArrayBase, ElementCount, Sort.DepthLimit);
     }
 
     return;
 }
 
-//
-// --------------------------------------------------------- Internal Functions
-//
-
-VOID
-ClpQuickSort (
+LIBC_API
+void
+qsort_r (
     void *ArrayBase,
+    size_t ElementCount,
     size_t ElementSize,
-    ssize_t StartIndex,
-    ssize_t EndIndex,
-    int (*CompareFunction)(const void *, const void *)
+    int (*CompareFunction)(const void *, const void *, void *),
+    void *Context
     )
 
 /*++
@@ -177,25 +256,27 @@ ClpQuickSort (
 Routine Description:
 
     This routine sorts an array of items in place using the QuickSort algorithm.
+    It is the same as qsort, except that the given context pointer is passed
+    through to each call of the comparison function.
 
 Arguments:
 
     ArrayBase - Supplies a pointer to the array of items that will get pushed
         around.
 
-    ElementSize - Supplies the size of one of the elements.
-
-    StartIndex - Supplies the starting index of the array to sort, inclusive.
+    ElementCount - Supplies the number of elements in the array.
 
-    EndIndex - Supplies the ending index of the array to sort, inclusive.
+    ElementSize - Supplies the size of one of the elements.
 
     CompareFunction - Supplies a pointer to a function that will be used to
         compare elements. The function takes in two pointers that will point
-        within the array. It returns less than zero if the first element is
-        less than the second, zero if the first element is equal to the second,
-        and greater than zero if the first element is greater than the second.
-        The routine must not modify the array itself or inconsistently
-        report comparisons, otherwise the sorting will not come out correctly.
+        within the array, and the context pointer. It returns less than zero if
+        the first element is less than the second, zero if the first element is
+        equal to the second, and greater than zero if the first element is
+        greater than the second.
+
+    Context - Supplies a context pointer that is passed to the comparison
+        function.
 
 Return Value:
 
@@ -205,206 +286,335 @@ Return Value:
 
 {
 
-    int CompareResult;
-    ssize_t EqualIndex;
-    ssize_t LargerIndex;
-    ssize_t LargestIndex;
-    void *LastElement;
-    ssize_t SmallerIndex;
-    ssize_t SmallestIndex;
-    void *SwapPointer;
+    QUICKSORT Sort;
 
-    if (EndIndex <= StartIndex) {
-        return;
+    ClpQuickSortInitialize(&Sort, ArrayBase, ElementCount, ElementSize);
+    Sort.ContextCompareFunction = CompareFunction;
+    Sort.Context = Context;
+    if ((ElementCount > 1) && (ElementSize != 0)) {
+        ClpIntroSort(&Sort, ArrayBase, ElementCount, Sort.DepthLimit);
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+ClpQuickSortInitialize (
+    PQUICKSORT Sort,
+    void *ArrayBase,
+    size_t ElementCount,
+    size_t ElementSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes a sort structure, choosing how elements will be
+    swapped and how deep the quicksort can recurse. The caller fills in the
+    comparison function.
+
+Arguments:
+
+    Sort - Supplies a pointer to the sort structure to initialize.
+
+    ArrayBase - Supplies a pointer to the array that will be sorted.
+
+    ElementCount - Supplies the number of elements in the array.
+
+    ElementSize - Supplies the size of one of the elements.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    size_t Count;
+
+    assert(ElementCount < (((size_t)-1) >> 1));
+    assert(ElementSize < (((size_t)-1) >> 1));
+
+    Sort->ElementSize = ElementSize;
+    Sort->SwapType = QuickSortSwapBytes;
+    if ((((UINTN)ArrayBase | ElementSize) & (sizeof(UINTN) - 1)) == 0) {
+        Sort->SwapType = QuickSortSwapWords;
+        if (ElementSize == sizeof(void *)) {
+            Sort->SwapType = QuickSortSwapPointer;
+        }
     }
 
-    LastElement = ArrayBase + (EndIndex * ElementSize);
-    SmallerIndex = StartIndex - 1;
-    SmallestIndex = StartIndex - 1;
-    LargerIndex = EndIndex;
-    LargestIndex = EndIndex;
+    Sort->CompareFunction = NULL;
+    Sort->ContextCompareFunction = NULL;
+    Sort->Context = NULL;
 
     //
-    // Loop swapping elements that are on the wrong side of the pivot (which is
-    // selected to be the last element). The loop stops when the indices cross.
+    // Allow twice the ideal depth of log2(n) levels.
     //
 
-    while (TRUE) {
+    Sort->DepthLimit = 0;
+    for (Count = ElementCount; Count > 1; Count >>= 1) {
+        Sort->DepthLimit += 2;
+    }
 
-        //
-        // Scan along as long as the current value is less than the last value.
-        //
+    return;
+}
 
-        while (TRUE) {
-            SmallerIndex += 1;
-            if (SmallerIndex == EndIndex) {
-                break;
-            }
+VOID
+ClpIntroSort (
+    PQUICKSORT Sort,
+    char *Array,
+    size_t ElementCount,
+    ULONG DepthLimit
+    )
 
-            CompareResult =
-                      CompareFunction(ArrayBase + (SmallerIndex * ElementSize),
-                                      LastElement);
+/*++
 
-            if (CompareResult >= 0) {
-                break;
-            }
-        }
+Routine Description:
 
-        //
-        // Scan down as long as the current value is greater than the last
-        // value.
-        //
+    This routine sorts a range of the array. It partitions around a
+    median-of-three pivot, recursing on the smaller side and looping on the
+    larger one so the stack stays logarithmic. If the partitions keep coming
+    out lopsided it switches to heapsort, which bounds the worst case at
+    O(n log n). Small ranges are finished with insertion sort.
 
-        while (TRUE) {
-            LargerIndex -= 1;
-            CompareResult =
-                      CompareFunction(LastElement,
-                                      ArrayBase + (LargerIndex * ElementSize));
+Arguments:
 
-            if (CompareResult >= 0) {
-                break;
-            }
+    Sort - Supplies a pointer to the sort parameters.
 
-            if (LargerIndex == StartIndex) {
-                break;
-            }
-        }
+    Array - Supplies a pointer to the first element of the range.
 
-        //
-        // Stop if the paths crossed, as that means everything's on the correct
-        // side of the pivot if the pivot were here.
-        //
+    ElementCount - Supplies the number of elements in the range.
 
-        if (SmallerIndex >= LargerIndex) {
-            break;
-        }
+    DepthLimit - Supplies the number of partitioning levels remaining before
+        switching to heapsort.
 
-        //
-        // Exchange the two, as they're both on the wrong side of the pivot.
-        //
+Return Value:
 
-        if (SmallerIndex != LargerIndex) {
-            QUICKSORT_SWAP(ArrayBase, ElementSize, SmallerIndex, LargerIndex);
-        }
+    None.
 
-        //
-        // Move keys equal to the partitioning element over to the ends of the
-        // arrays. This is the beginning of what's called Bentley-McIlroy 3-way
-        // partitioning, and it helps to handle an array with lots of
-        // elements equal to the pivot. So the array is going to look like this:
-        // | equal | less |  xxx (unsorted)  | greater | equal |
-        // At the end, swap the equals to the center so that it looks like:
-        // | less | equal | greater |
-        // This has the benefit that it always uses N - 1 three way compares,
-        // there's no extra overhead if there are no equal keys, and only one
-        // extra exchange per equal key.
-        //
-
-        CompareResult =
-                      CompareFunction(ArrayBase + (SmallerIndex * ElementSize),
-                                      LastElement);
-
-        if (CompareResult == 0) {
-            SmallestIndex += 1;
-            QUICKSORT_SWAP(ArrayBase, ElementSize, SmallestIndex, SmallerIndex);
-        }
+--*/
+
+{
+
+    size_t LeftCount;
+    char *Pivot;
+    size_t RightCount;
 
-        CompareResult =
-                      CompareFunction(LastElement,
-                                      ArrayBase + (LargerIndex * ElementSize));
+    while (ElementCount > QUICKSORT_INSERTION_THRESHOLD) {
+        if (DepthLimit == 0) {
+            ClpHeapSort(Sort, Array, ElementCount);
+            return;
+        }
 
-        if (CompareResult == 0) {
-            LargestIndex -= 1;
-            QUICKSORT_SWAP(ArrayBase, ElementSize, LargerIndex, LargestIndex);
+        DepthLimit -= 1;
+        Pivot = ClpQuickSortPartition(Sort, Array, ElementCount);
+        LeftCount = (Pivot - Array) / Sort->ElementSize;
+        RightCount = ElementCount - LeftCount - 1;
+        if (LeftCount < RightCount) {
+            ClpIntroSort(Sort, Array, LeftCount, DepthLimit);
+            Array = Pivot + Sort->ElementSize;
+            ElementCount = RightCount;
+
+        } else {
+            ClpIntroSort(Sort,
+                         Pivot + Sort->ElementSize,
+                         RightCount,
+                         DepthLimit);
+
+            ElementCount = LeftCount;
         }
     }
 
+    ClpInsertionSort(Sort, Array, ElementCount);
+    return;
+}
+
+char *
+ClpQuickSortPartition (
+    PQUICKSORT Sort,
+    char *Array,
+    size_t ElementCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine partitions a range of the array around the median of its
+    first, middle, and last elements.
+
+Arguments:
+
+    Sort - Supplies a pointer to the sort parameters.
+
+    Array - Supplies a pointer to the first element of the range.
+
+    ElementCount - Supplies the number of elements in the range. This must be
+        at least three.
+
+Return Value:
+
+    Returns a pointer to the pivot element's final position. Everything before
+    it compares less than or equal to it, and everything after it compares
+    greater than or equal to it.
+
+--*/
+
+{
+
+    char *High;
+    char *Last;
+    char *Low;
+    char *Middle;
+    size_t Size;
+
+    Size = Sort->ElementSize;
+    Last = Array + ((ElementCount - 1) * Size);
+    Middle = Array + ((ElementCount / 2) * Size);
+
     //
-    // Put the pivot into place.
+    // Order the first, middle, and last elements. This leaves the median in
+    // the middle and an element no smaller than it at the end, which stops
+    // the upward scan below without a bounds check.
     //
 
-    QUICKSORT_SWAP(ArrayBase, ElementSize, SmallerIndex, EndIndex);
+    if (QUICKSORT_COMPARE(Sort, Middle, Array) < 0) {
+        QUICKSORT_SWAP(Sort, Middle, Array);
+    }
+
+    if (QUICKSORT_COMPARE(Sort, Last, Middle) < 0) {
+        QUICKSORT_SWAP(Sort, Last, Middle);
+        if (QUICKSORT_COMPARE(Sort, Middle, Array) < 0) {
+            QUICKSORT_SWAP(Sort, Middle, Array);
+        }
+    }
 
     //
-    // Move lower equal elements back up to the middle, and remove them from
-    // the partition of things that need to be resorted.
+    // Park the pivot at the start, where it also stops the downward scan.
+    // Both scans stop on elements equal to the pivot, which keeps the
+    // partitions balanced when there are many duplicates.
     //
 
-    LargerIndex = SmallerIndex + 1;
-    SmallerIndex -= 1;
-    for (EqualIndex = StartIndex; EqualIndex < SmallestIndex; EqualIndex += 1) {
-        QUICKSORT_SWAP(ArrayBase,
-                       ElementSize,
-                       EqualIndex,
-                       SmallerIndex);
+    QUICKSORT_SWAP(Sort, Array, Middle);
+    Low = Array + Size;
+    High = Last;
+    while (TRUE) {
+        while (QUICKSORT_COMPARE(Sort, Low, Array) < 0) {
+            Low += Size;
+        }
+
+        while (QUICKSORT_COMPARE(Sort, High, Array) > 0) {
+            High -= Size;
+        }
+
+        if (Low >= High) {
+            break;
+        }
 
-        SmallerIndex -= 1;
+        QUICKSORT_SWAP(Sort, Low, High);
+        Low += Size;
+        High -= Size;
     }
 
     //
-    // Move upper equal elements back down to the middle, and remove them from
-    // the partition of things that need to be resorted.
+    // Move the pivot into its final place.
     //
 
-    for (EqualIndex = EndIndex - 1;
-         EqualIndex > LargestIndex;
-         EqualIndex -= 1) {
+    if (High != Array) {
+        QUICKSORT_SWAP(Sort, Array, High);
+    }
+
+    return High;
+}
+
+VOID
+ClpHeapSort (
+    PQUICKSORT Sort,
+    char *Array,
+    size_t ElementCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sorts a range of the array using heapsort.
+
+Arguments:
+
+    Sort - Supplies a pointer to the sort parameters.
 
-        QUICKSORT_SWAP(ArrayBase,
-                       ElementSize,
-                       LargerIndex,
-                       EqualIndex);
+    Array - Supplies a pointer to the first element of the range.
 
-        LargerIndex += 1;
+    ElementCount - Supplies the number of elements in the range.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    size_t Index;
+    char *Last;
+
+    if (ElementCount < 2) {
+        return;
     }
 
     //
-    // Sort the bottom half and then the top half.
+    // Build a max heap, then repeatedly move the largest element to the end.
     //
 
-    if (SmallerIndex > StartIndex) {
-        ClpQuickSort(ArrayBase,
-                     ElementSize,
-                     StartIndex,
-                     SmallerIndex,
-                     CompareFunction);
+    Index = ElementCount / 2;
+    while (Index != 0) {
+        Index -= 1;
+        ClpHeapSortSiftDown(Sort, Array, Index, ElementCount);
     }
 
-    if (EndIndex > LargerIndex) {
-        ClpQuickSort(ArrayBase,
-                     ElementSize,
-                     LargerIndex,
-                     EndIndex,
-                     CompareFunction);
+    Index = ElementCount - 1;
+    while (Index != 0) {
+        Last = Array + (Index * Sort->ElementSize);
+        QUICKSORT_SWAP(Sort, Array, Last);
+        ClpHeapSortSiftDown(Sort, Array, 0, Index);
+        Index -= 1;
     }
 
     return;
 }
 
 VOID
-ClpQuickSortSwap (
-    void *ArrayBase,
-    size_t ElementSize,
-    ssize_t FirstIndex,
-    ssize_t SecondIndex
+ClpHeapSortSiftDown (
+    PQUICKSORT Sort,
+    char *Array,
+    size_t Root,
+    size_t ElementCount
     )
 
 /*++
 
 Routine Description:
 
-    This routine swaps two elements in the given array.
+    This routine moves an element down a max heap until neither of its
+    children is larger than it.
 
 Arguments:
 
-    ArrayBase - Supplies a pointer to the array of items that will get pushed
-        around.
+    Sort - Supplies a pointer to the sort parameters.
 
-    ElementSize - Supplies the size of one of the elements.
+    Array - Supplies a pointer to the first element of the heap.
 
-    FirstIndex - Supplies the first index of the indices to exchange.
+    Root - Supplies the index of the element to sift down.
 
-    SecondIndex - Supplies the second index of the indices to exchange.
+    ElementCount - Supplies the number of elements in the heap.
 
 Return Value:
 
@@ -414,17 +624,153 @@ Return Value:
 
 {
 
-    ssize_t ByteIndex;
-    unsigned char *FirstElement;
-    unsigned char *SecondElement;
+    size_t Child;
+    char *ChildElement;
+    char *RootElement;
+    size_t Size;
+
+    Size = Sort->ElementSize;
+    RootElement = Array + (Root * Size);
+    while (TRUE) {
+        Child = (Root * 2) + 1;
+        if (Child >= ElementCount) {
+            break;
+        }
+
+        ChildElement = Array + (Child * Size);
+        if ((Child + 1 < ElementCount) &&
+            (QUICKSORT_COMPARE(Sort, ChildElement, ChildElement + Size) < 0)) {
+
+            Child += 1;
+            ChildElement += Size;
+        }
+
+        if (QUICKSORT_COMPARE(Sort, RootElement, ChildElement) >= 0) {
+            break;
+        }
+
+        QUICKSORT_SWAP(Sort, RootElement, ChildElement);
+        Root = Child;
+        RootElement = ChildElement;
+    }
+
+    return;
+}
+
+VOID
+ClpInsertionSort (
+    PQUICKSORT Sort,
+    char *Array,
+    size_t ElementCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sorts a small range of the array using insertion sort.
+
+Arguments:
+
+    Sort - Supplies a pointer to the sort parameters.
+
+    Array - Supplies a pointer to the first element of the range.
+
+    ElementCount - Supplies the number of elements in the range.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    char *Current;
+    char *End;
+    char *Previous;
+    size_t Size;
+
+    if (ElementCount < 2) {
+        return;
+    }
+
+    Size = Sort->ElementSize;
+    End = Array + (ElementCount * Size);
+    for (Current = Array + Size; Current < End; Current += Size) {
+        Previous = Current;
+        while ((Previous > Array) &&
+               (QUICKSORT_COMPARE(Sort, Previous - Size, Previous) > 0)) {
+
+            QUICKSORT_SWAP(Sort, Previous - Size, Previous);
+            Previous -= Size;
+        }
+    }
+
+    return;
+}
+
+VOID
+ClpQuickSortSwap (
+    PQUICKSORT Sort,
+    void *First,
+    void *Second
+    )
+
+/*++
+
+Routine Description:
+
+    This routine swaps two elements in the array, a word at a time if the
+    array and element size allow it, or a byte at a time otherwise.
+
+Arguments:
+
+    Sort - Supplies a pointer to the sort parameters.
+
+    First - Supplies a pointer to the first element to exchange.
+
+    Second - Supplies a pointer to the second element to exchange.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    size_t Count;
+    unsigned char *FirstBytes;
+    PUINTN FirstWords;
+    unsigned char *SecondBytes;
+    PUINTN SecondWords;
     unsigned char Swap;
+    UINTN SwapWord;
+
+    if (Sort->SwapType == QuickSortSwapBytes) {
+        FirstBytes = First;
+        SecondBytes = Second;
+        for (Count = Sort->ElementSize; Count != 0; Count -= 1) {
+            Swap = *FirstBytes;
+            *FirstBytes = *SecondBytes;
+            *SecondBytes = Swap;
+            FirstBytes += 1;
+            SecondBytes += 1;
+        }
 
-    FirstElement = (unsigned char *)ArrayBase + (ElementSize * FirstIndex);
-    SecondElement = (unsigned char *)ArrayBase + (ElementSize * SecondIndex);
-    for (ByteIndex = 0; ByteIndex < ElementSize; ByteIndex += 1) {
-        Swap = FirstElement[ByteIndex];
-        FirstElement[ByteIndex] = SecondElement[ByteIndex];
-        SecondElement[ByteIndex] = Swap;
+    } else {
+        FirstWords = First;
+        SecondWords = Second;
+        Count = Sort->ElementSize / sizeof(UINTN);
+        while (Count != 0) {
+            SwapWord = *FirstWords;
+            *FirstWords = *SecondWords;
+            *SecondWords = SwapWord;
+            FirstWords += 1;
+            SecondWords += 1;
+            Count -= 1;
+        }
     }
 
     return;
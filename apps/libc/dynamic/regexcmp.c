@@ -531,6 +531,14 @@ Return Value:
         goto CompileRegularExpressionEnd;
     }
 
+    //
+    // Try to build the automaton form of the expression so that it can be
+    // executed without backtracking. This is optional; expressions it cannot
+    // handle are executed by the backtracking matcher.
+    //
+
+    ClpCreateRegularExpressionProgram(Result);
+
 CompileRegularExpressionEnd:
     if (Status != RegexStatusSuccess) {
         if (Result != NULL) {
@@ -573,6 +581,11 @@ Return Value:
         return;
     }
 
+    if (Expression->Program != NULL) {
+        ClpDestroyRegularExpressionProgram(Expression->Program);
+        Expression->Program = NULL;
+    }
+
     while (LIST_EMPTY(&(Expression->BaseEntry.ChildList)) == FALSE) {
         Entry = LIST_VALUE(Expression->BaseEntry.ChildList.Next,
                            REGULAR_EXPRESSION_ENTRY,
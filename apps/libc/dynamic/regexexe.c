@@ -340,6 +340,21 @@ Return Value:
     ULONG StartIndex;
     REGULAR_EXPRESSION_STATUS Status;
 
+    //
+    // Expressions without back references have an automaton form that runs
+    // in linear time. Use that whenever it's available.
+    //
+
+    if (RegularExpression->Program != NULL) {
+        Status = ClpExecuteRegularExpressionProgram(RegularExpression,
+                                                    String,
+                                                    Match,
+                                                    MatchArraySize,
+                                                    Flags);
+
+        return Status;
+    }
+
     Status = RegexStatusNoMatch;
     INITIALIZE_LIST_HEAD(&(Context.Choices));
     INITIALIZE_LIST_HEAD(&(Context.FreeChoices));
@@ -1333,14 +1348,8 @@ Return Value:
 
 {
 
-    PREGULAR_BRACKET_ENTRY BracketEntry;
-    PREGULAR_BRACKET_EXPRESSION BracketExpression;
     CHAR Character;
-    ULONG CharacterCount;
-    ULONG CharacterIndex;
-    PLIST_ENTRY CurrentEntry;
-    PSTR RegularCharacters;
-    REGULAR_EXPRESSION_STATUS Status;
+    BOOL Result;
 
     assert(Entry->Type == RegexEntryBracketExpression);
 
@@ -1353,6 +1362,63 @@ Return Value:
         return RegexStatusNoMatch;
     }
 
+    Result = ClpRegularExpressionMatchBracketCharacter(Context->Expression,
+                                                       Entry,
+                                                       Character);
+
+    if (Result == FALSE) {
+        return RegexStatusNoMatch;
+    }
+
+    Context->NextInput += 1;
+    return RegexStatusSuccess;
+}
+
+BOOL
+ClpRegularExpressionMatchBracketCharacter (
+    PREGULAR_EXPRESSION Expression,
+    PREGULAR_EXPRESSION_ENTRY Entry,
+    CHAR Character
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines if the given character is a member of the given
+    bracket expression.
+
+Arguments:
+
+    Expression - Supplies a pointer to the compiled regular expression the
+        entry belongs to.
+
+    Entry - Supplies a pointer to the bracket expression entry.
+
+    Character - Supplies the character to test. This should not be the null
+        terminator.
+
+Return Value:
+
+    TRUE if the character matches the bracket expression (taking negation into
+    account).
+
+    FALSE if the character does not match.
+
+--*/
+
+{
+
+    PREGULAR_BRACKET_ENTRY BracketEntry;
+    PREGULAR_BRACKET_EXPRESSION BracketExpression;
+    ULONG CharacterCount;
+    ULONG CharacterIndex;
+    PLIST_ENTRY CurrentEntry;
+    PSTR RegularCharacters;
+    REGULAR_EXPRESSION_STATUS Status;
+
+    assert(Entry->Type == RegexEntryBracketExpression);
+
     Status = RegexStatusNoMatch;
     BracketExpression = &(Entry->U.BracketExpression);
     CharacterCount = BracketExpression->RegularCharacters.Size;
@@ -1367,7 +1433,7 @@ Return Value:
          CharacterIndex += 1) {
 
         if ((Character == RegularCharacters[CharacterIndex]) ||
-            (((Context->Expression->Flags & REG_ICASE) != 0) &&
+            (((Expression->Flags & REG_ICASE) != 0) &&
               (tolower(Character) ==
                tolower(RegularCharacters[CharacterIndex])))) {
 
@@ -1441,7 +1507,7 @@ Return Value:
 
         case BracketExpressionCharacterClassLowercase:
             if ((islower(Character)) ||
-                (((Context->Expression->Flags & REG_ICASE) != 0) &&
+                (((Expression->Flags & REG_ICASE) != 0) &&
                  (isupper(Character)))) {
 
                 Status = RegexStatusSuccess;
@@ -1472,7 +1538,7 @@ Return Value:
 
         case BracketExpressionCharacterClassUppercase:
             if ((isupper(Character)) ||
-                (((Context->Expression->Flags & REG_ICASE) != 0) &&
+                (((Expression->Flags & REG_ICASE) != 0) &&
                  (islower(Character)))) {
 
                 Status = RegexStatusSuccess;
@@ -1517,10 +1583,10 @@ Return Value:
     }
 
     if (Status == RegexStatusSuccess) {
-        Context->NextInput += 1;
+        return TRUE;
     }
 
-    return Status;
+    return FALSE;
 }
 
 VOID
@@ -0,0 +1,2823 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    regexnfa.c
+
+Abstract:
+
+    This module implements execution of regular expressions without
+    backtracking. Expressions that do not contain back references are
+    converted into a small instruction program describing a Thompson NFA. A
+    lazily constructed DFA answers whether or not the input matches, and a
+    Pike VM simulation of the NFA recovers the match and subexpression
+    offsets when the caller wants them. Both run in time linear in the size of
+    the input.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    User Mode C Library
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#define LIBC_API __DLLEXPORT
+#define RTL_API
+
+#include <minoca/lib/types.h>
+#include <minoca/lib/status.h>
+#include <minoca/lib/rtl.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+#include "regexp.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// Define the maximum number of instructions a program can have. Expressions
+// with large duplication counts that expand beyond this are left to the
+// backtracking matcher.
+//
+
+#define REGEX_PROGRAM_MAX_SIZE 8192
+
+//
+// Define the index of the first instruction in a program.
+//
+
+#define REGEX_PROGRAM_START 0
+
+//
+// Define an invalid instruction index, used to terminate patch lists.
+//
+
+#define REGEX_INVALID_INSTRUCTION ((ULONG)-1)
+
+//
+// Define the number of bits in a character set.
+//
+
+#define REGEX_CHARACTER_SET_SIZE 256
+
+//
+// These macros test and add membership of a character in a character set.
+//
+
+#define REGEX_SET_BITS (sizeof(ULONG) * BITS_PER_BYTE)
+#define REGEX_SET_CONTAINS(_Set, _Character)                          \
+    (((_Set)->Bits[(_Character) / REGEX_SET_BITS] &                   \
+      (1U << ((_Character) % REGEX_SET_BITS))) != 0)
+
+#define REGEX_SET_ADD(_Set, _Character)                               \
+    ((_Set)->Bits[(_Character) / REGEX_SET_BITS] |=                   \
+     (1U << ((_Character) % REGEX_SET_BITS)))
+
+//
+// Define program flags.
+//
+
+//
+// This flag is set if the program can only match at the very beginning of
+// the input.
+//
+
+#define REGEX_PROGRAM_ANCHORED_START 0x00000001
+
+//
+// Define the context flags describing the position in the input. These are
+// used to evaluate zero-width assertions.
+//
+
+#define REGEX_CONTEXT_BEGIN_LINE 0x00000001
+#define REGEX_CONTEXT_AFTER_WORD 0x00000002
+#define REGEX_CONTEXT_NOT_END_OF_LINE 0x00000004
+#define REGEX_CONTEXT_MASK 0x00000007
+
+//
+// Define DFA state flags. These share space with the context flags.
+//
+
+#define REGEX_DFA_STATE_MATCH 0x00000100
+#define REGEX_DFA_STATE_START 0x00000200
+
+//
+// Define the number of hash buckets in the DFA state cache.
+//
+
+#define REGEX_DFA_HASH_SIZE 256
+
+//
+// Define the amount of memory the DFA state cache is allowed to consume
+// before it is flushed.
+//
+
+#define REGEX_DFA_MEMORY_LIMIT (256 * 1024)
+
+//
+// Define the stack marker for a slot restore in the NFA simulation.
+//
+
+#define REGEX_RESTORE_SLOT ((ULONG)-1)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _REGEX_OPCODE {
+    RegexOpInvalid,
+    RegexOpCharacterSet,
+    RegexOpSplit,
+    RegexOpJump,
+    RegexOpSave,
+    RegexOpAssert,
+    RegexOpMarkLoop,
+    RegexOpCheckLoop,
+    RegexOpMatch
+} REGEX_OPCODE, *PREGEX_OPCODE;
+
+typedef enum _REGEX_ASSERTION {
+    RegexAssertBeginLine,
+    RegexAssertEndLine,
+    RegexAssertStartOfWord,
+    RegexAssertEndOfWord
+} REGEX_ASSERTION, *PREGEX_ASSERTION;
+
+/*++
+
+Structure Description:
+
+    This structure defines a single instruction in a regular expression
+    program.
+
+Members:
+
+    Opcode - Stores the operation this instruction performs.
+
+    Argument - Stores the argument of the instruction. For character sets this
+        is the set index, for saves it's the match slot, for assertions it's
+        the assertion type, and for loop instructions it's the loop index.
+
+    Target - Stores the instruction to go to next for jumps, the preferred
+        path for splits, and the loop head for loop checks.
+
+    Alternate - Stores the less preferred path for splits, and the loop exit
+        for loop checks.
+
+--*/
+
+typedef struct _REGEX_INSTRUCTION {
+    REGEX_OPCODE Opcode;
+    ULONG Argument;
+    ULONG Target;
+    ULONG Alternate;
+} REGEX_INSTRUCTION, *PREGEX_INSTRUCTION;
+
+/*++
+
+Structure Description:
+
+    This structure defines a set of characters matched by a single program
+    instruction.
+
+Members:
+
+    Bits - Stores the bitmap of characters in the set.
+
+--*/
+
+typedef struct _REGEX_CHARACTER_SET {
+    ULONG Bits[REGEX_CHARACTER_SET_SIZE / (sizeof(ULONG) * BITS_PER_BYTE)];
+} REGEX_CHARACTER_SET, *PREGEX_CHARACTER_SET;
+
+typedef struct _REGEX_DFA REGEX_DFA, *PREGEX_DFA;
+typedef struct _REGEX_DFA_STATE REGEX_DFA_STATE, *PREGEX_DFA_STATE;
+
+/*++
+
+Structure Description:
+
+    This structure defines the automaton form of a regular expression.
+
+Members:
+
+    Instructions - Stores the array of instructions.
+
+    InstructionCount - Stores the number of valid instructions in the array.
+
+    InstructionCapacity - Stores the number of elements the instruction array
+        can hold.
+
+    Sets - Stores the array of character sets referenced by the instructions.
+
+    SetCount - Stores the number of valid character sets.
+
+    SetCapacity - Stores the number of elements the set array can hold.
+
+    LoopCount - Stores the number of unbounded loops in the program. Each
+        needs a slot during simulation to detect empty iterations.
+
+    Flags - Stores a bitfield of flags. See REGEX_PROGRAM_* definitions.
+
+    ExpressionFlags - Stores the REG_* flags the expression was compiled with.
+
+    Prefix - Stores an optional pointer to a null terminated literal string
+        that every match must begin with.
+
+    ByteClassCount - Stores the number of distinct byte classes.
+
+    ByteClass - Stores the byte class of each character. Characters in the
+        same class behave identically in every instruction and assertion, so
+        DFA transitions only need to be stored per class.
+
+    Dfa - Stores a pointer to the cached DFA, if one is not currently in use.
+
+--*/
+
+struct _REGULAR_EXPRESSION_PROGRAM {
+    PREGEX_INSTRUCTION Instructions;
+    ULONG InstructionCount;
+    ULONG InstructionCapacity;
+    PREGEX_CHARACTER_SET Sets;
+    ULONG SetCount;
+    ULONG SetCapacity;
+    ULONG LoopCount;
+    ULONG Flags;
+    ULONG ExpressionFlags;
+    PSTR Prefix;
+    ULONG ByteClassCount;
+    UCHAR ByteClass[REGEX_CHARACTER_SET_SIZE];
+    PREGEX_DFA volatile Dfa;
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines a single state of the lazily built DFA. A state is
+    the set of NFA instructions waiting to run at the current position, plus
+    the context of that position.
+
+Members:
+
+    HashNext - Stores a pointer to the next state in the same hash bucket.
+
+    Hash - Stores the hash of the state's flags and instructions.
+
+    Flags - Stores the context flags and state flags. See REGEX_CONTEXT_* and
+        REGEX_DFA_STATE_* definitions.
+
+    Count - Stores the number of instructions in the state.
+
+    Next - Stores the array of transitions, indexed by byte class. Entries
+        that have not been computed yet are NULL.
+
+    Instructions - Stores the sorted array of instruction indices.
+
+--*/
+
+struct _REGEX_DFA_STATE {
+    PREGEX_DFA_STATE HashNext;
+    ULONG Hash;
+    ULONG Flags;
+    ULONG Count;
+    PREGEX_DFA_STATE *Next;
+    ULONG Instructions[ANYSIZE_ARRAY];
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines the lazily built DFA for a program.
+
+Members:
+
+    Program - Stores a pointer to the program this DFA simulates.
+
+    Buckets - Stores the state cache hash table.
+
+    MemoryUsed - Stores the number of bytes currently allocated to states.
+
+    Visited - Stores the array of generation numbers, one per instruction,
+        used to avoid visiting an instruction twice in one closure.
+
+    Generation - Stores the current closure generation number.
+
+    Stack - Stores the work stack used while computing closures.
+
+    Kernel - Stores the character set instructions found by the last closure.
+
+    Step - Stores the instructions for the state being built.
+
+--*/
+
+struct _REGEX_DFA {
+    PREGULAR_EXPRESSION_PROGRAM Program;
+    PREGEX_DFA_STATE Buckets[REGEX_DFA_HASH_SIZE];
+    ULONG MemoryUsed;
+    PULONG Visited;
+    ULONG Generation;
+    PULONG Stack;
+    PULONG Kernel;
+    PULONG Step;
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines an entry on the NFA simulation work stack.
+
+Members:
+
+    Instruction - Stores the instruction to visit, or REGEX_RESTORE_SLOT if
+        this entry restores a slot value.
+
+    Slot - Stores the slot to restore.
+
+    Value - Stores the value to restore into the slot.
+
+--*/
+
+typedef struct _REGEX_NFA_STACK_ENTRY {
+    ULONG Instruction;
+    ULONG Slot;
+    regoff_t Value;
+} REGEX_NFA_STACK_ENTRY, *PREGEX_NFA_STACK_ENTRY;
+
+/*++
+
+Structure Description:
+
+    This structure defines an ordered list of NFA threads, highest priority
+    first.
+
+Members:
+
+    Count - Stores the number of threads in the list.
+
+    Instructions - Stores the instruction each thread is waiting at.
+
+    Slots - Stores the match slots of each thread, back to back.
+
+--*/
+
+typedef struct _REGEX_NFA_THREAD_LIST {
+    ULONG Count;
+    PULONG Instructions;
+    regoff_t *Slots;
+} REGEX_NFA_THREAD_LIST, *PREGEX_NFA_THREAD_LIST;
+
+/*++
+
+Structure Description:
+
+    This structure defines the state of an NFA simulation.
+
+Members:
+
+    Program - Stores a pointer to the program being run.
+
+    Input - Stores a pointer to the input string.
+
+    Flags - Stores the REG_* execution flags.
+
+    CaptureSlotCount - Stores the number of slots used for match offsets.
+
+    SlotCount - Stores the total number of slots per thread, including those
+        used to detect empty loop iterations.
+
+    Lists - Stores the current and next thread lists.
+
+    Visited - Stores the array of generation numbers, one per instruction,
+        used to add each instruction at most once per input position.
+
+    Generation - Stores the current generation number.
+
+    Stack - Stores the work stack used when adding threads.
+
+    Slots - Stores the working slot array.
+
+    MatchSlots - Stores the slots of the best match found so far.
+
+    Matched - Stores a boolean indicating whether a match has been found.
+
+--*/
+
+typedef struct _REGEX_NFA_EXECUTION {
+    PREGULAR_EXPRESSION_PROGRAM Program;
+    PSTR Input;
+    int Flags;
+    ULONG CaptureSlotCount;
+    ULONG SlotCount;
+    REGEX_NFA_THREAD_LIST Lists[2];
+    PULONG Visited;
+    ULONG Generation;
+    PREGEX_NFA_STACK_ENTRY Stack;
+    regoff_t *Slots;
+    regoff_t *MatchSlots;
+    BOOL Matched;
+} REGEX_NFA_EXECUTION, *PREGEX_NFA_EXECUTION;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+BOOL
+ClpCompileRegexEntry (
+    PREGULAR_EXPRESSION Expression,
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    PREGULAR_EXPRESSION_ENTRY Entry
+    );
+
+BOOL
+ClpCompileRegexEntryOnce (
+    PREGULAR_EXPRESSION Expression,
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    PREGULAR_EXPRESSION_ENTRY Entry
+    );
+
+BOOL
+ClpCompileRegexChildren (
+    PREGULAR_EXPRESSION Expression,
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    PREGULAR_EXPRESSION_ENTRY Entry
+    );
+
+BOOL
+ClpCompileRegexCharacterSet (
+    PREGULAR_EXPRESSION Expression,
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    PREGULAR_EXPRESSION_ENTRY Entry,
+    CHAR Character
+    );
+
+ULONG
+ClpEmitRegexInstruction (
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    REGEX_OPCODE Opcode,
+    ULONG Argument,
+    ULONG Target,
+    ULONG Alternate
+    );
+
+VOID
+ClpPatchRegexInstructions (
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    ULONG PatchList,
+    BOOL PatchTarget,
+    ULONG Destination
+    );
+
+VOID
+ClpComputeRegexByteClasses (
+    PREGULAR_EXPRESSION_PROGRAM Program
+    );
+
+BOOL
+ClpFindRegexPrefix (
+    PREGULAR_EXPRESSION Expression,
+    PREGULAR_EXPRESSION_PROGRAM Program
+    );
+
+ULONG
+ClpGetRegexContext (
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    PSTR Input,
+    ULONG Index,
+    int Flags
+    );
+
+BOOL
+ClpTestRegexAssertion (
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    REGEX_ASSERTION Assertion,
+    ULONG Context,
+    CHAR Next
+    );
+
+PREGEX_DFA
+ClpCreateRegexDfa (
+    PREGULAR_EXPRESSION_PROGRAM Program
+    );
+
+VOID
+ClpDestroyRegexDfa (
+    PREGEX_DFA Dfa
+    );
+
+VOID
+ClpFlushRegexDfa (
+    PREGEX_DFA Dfa
+    );
+
+REGULAR_EXPRESSION_STATUS
+ClpSearchRegexDfa (
+    PREGEX_DFA Dfa,
+    PSTR Input,
+    int Flags
+    );
+
+PREGEX_DFA_STATE
+ClpComputeRegexDfaTransition (
+    PREGEX_DFA Dfa,
+    PREGEX_DFA_STATE State,
+    CHAR Character
+    );
+
+PREGEX_DFA_STATE
+ClpLookupRegexDfaState (
+    PREGEX_DFA Dfa,
+    ULONG Flags,
+    PULONG Instructions,
+    ULONG Count,
+    PBOOL Flushed
+    );
+
+int
+ClpCompareRegexInstructionIndices (
+    const void *Left,
+    const void *Right
+    );
+
+REGULAR_EXPRESSION_STATUS
+ClpRunRegexNfa (
+    PREGULAR_EXPRESSION Expression,
+    PSTR Input,
+    regmatch_t Match[],
+    size_t MatchArraySize,
+    int Flags
+    );
+
+VOID
+ClpAddRegexNfaThread (
+    PREGEX_NFA_EXECUTION Execution,
+    PREGEX_NFA_THREAD_LIST List,
+    ULONG Instruction,
+    ULONG Index,
+    ULONG Context
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+VOID
+ClpCreateRegularExpressionProgram (
+    PREGULAR_EXPRESSION Expression
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to convert a parsed regular expression into an
+    automaton program that can be executed without backtracking. Expressions
+    that contain back references or that expand into too many instructions are
+    left without a program, and will be executed by the backtracking matcher.
+
+Arguments:
+
+    Expression - Supplies a pointer to the parsed regular expression. On
+        success, the program pointer will be filled in.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PREGULAR_EXPRESSION_ENTRY First;
+    PREGULAR_EXPRESSION_PROGRAM Program;
+    BOOL Result;
+
+    Expression->Program = NULL;
+    Program = malloc(sizeof(REGULAR_EXPRESSION_PROGRAM));
+    if (Program == NULL) {
+        return;
+    }
+
+    memset(Program, 0, sizeof(REGULAR_EXPRESSION_PROGRAM));
+    Program->ExpressionFlags = Expression->Flags;
+    Result = ClpCompileRegexEntry(Expression, Program, &(Expression->BaseEntry));
+    if (Result == FALSE) {
+        goto CreateRegularExpressionProgramEnd;
+    }
+
+    if (ClpEmitRegexInstruction(Program, RegexOpMatch, 0, 0, 0) ==
+        REGEX_INVALID_INSTRUCTION) {
+
+        Result = FALSE;
+        goto CreateRegularExpressionProgramEnd;
+    }
+
+    //
+    // If the expression starts with a beginning of line anchor and newlines
+    // are not special, then the only place it can match is the start.
+    //
+
+    if ((Expression->Flags & REG_NEWLINE) == 0) {
+        if ((Expression->BaseEntry.Flags &
+             REGULAR_EXPRESSION_ANCHORED_LEFT) != 0) {
+
+            Program->Flags |= REGEX_PROGRAM_ANCHORED_START;
+
+        } else if (LIST_EMPTY(&(Expression->BaseEntry.ChildList)) == FALSE) {
+            First = LIST_VALUE(Expression->BaseEntry.ChildList.Next,
+                               REGULAR_EXPRESSION_ENTRY,
+                               ListEntry);
+
+            if ((First->Type == RegexEntryStringBegin) &&
+                (First->DuplicateMin != 0)) {
+
+                Program->Flags |= REGEX_PROGRAM_ANCHORED_START;
+            }
+        }
+    }
+
+    if ((Program->Flags & REGEX_PROGRAM_ANCHORED_START) == 0) {
+        Result = ClpFindRegexPrefix(Expression, Program);
+        if (Result == FALSE) {
+            goto CreateRegularExpressionProgramEnd;
+        }
+    }
+
+    ClpComputeRegexByteClasses(Program);
+
+CreateRegularExpressionProgramEnd:
+    if (Result == FALSE) {
+        ClpDestroyRegularExpressionProgram(Program);
+        return;
+    }
+
+    Expression->Program = Program;
+    return;
+}
+
+VOID
+ClpDestroyRegularExpressionProgram (
+    PREGULAR_EXPRESSION_PROGRAM Program
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a regular expression automaton program.
+
+Arguments:
+
+    Program - Supplies a pointer to the program to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Program->Dfa != NULL) {
+        ClpDestroyRegexDfa(Program->Dfa);
+    }
+
+    if (Program->Instructions != NULL) {
+        free(Program->Instructions);
+    }
+
+    if (Program->Sets != NULL) {
+        free(Program->Sets);
+    }
+
+    if (Program->Prefix != NULL) {
+        free(Program->Prefix);
+    }
+
+    free(Program);
+    return;
+}
+
+REGULAR_EXPRESSION_STATUS
+ClpExecuteRegularExpressionProgram (
+    PREGULAR_EXPRESSION Expression,
+    PSTR String,
+    regmatch_t Match[],
+    size_t MatchArraySize,
+    int Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine executes a regular expression using its automaton program,
+    searching the given string for the leftmost match.
+
+Arguments:
+
+    Expression - Supplies a pointer to the compiled regular expression, which
+        must have a program.
+
+    String - Supplies a pointer to the string to check for a match.
+
+    Match - Supplies an optional pointer to an array where the string indices of
+        the match and its subexpressions will be returned.
+
+    MatchArraySize - Supplies the number of elements in the match array
+        parameter. Supply zero and the match array parameter will be ignored.
+
+    Flags - Supplies a bitfield of flags governing the search. See some REG_*
+        definitions (specifically REG_NOTBOL and REG_NOTEOL).
+
+Return Value:
+
+    Success if there was a match.
+
+    No match if there was no match.
+
+    No memory if the execution state could not be allocated.
+
+--*/
+
+{
+
+    PREGEX_DFA Dfa;
+    size_t MatchIndex;
+    PREGEX_DFA Previous;
+    PREGULAR_EXPRESSION_PROGRAM Program;
+    BOOL ReportMatches;
+    REGULAR_EXPRESSION_STATUS Status;
+
+    Program = Expression->Program;
+
+    assert(Program != NULL);
+
+    ReportMatches = FALSE;
+    if ((Expression->Flags & REG_NOSUB) == 0) {
+        for (MatchIndex = 0; MatchIndex < MatchArraySize; MatchIndex += 1) {
+            Match[MatchIndex].rm_so = -1;
+            Match[MatchIndex].rm_eo = -1;
+        }
+
+        if (MatchArraySize != 0) {
+            ReportMatches = TRUE;
+        }
+    }
+
+    //
+    // Take the cached DFA for the duration of the search, or create a new
+    // one if another thread is using it. Running the DFA first quickly
+    // rejects inputs that don't match, and is all that's needed if the caller
+    // doesn't want the match offsets.
+    //
+
+    Dfa = (PREGEX_DFA)RtlAtomicExchange((PUINTN)&(Program->Dfa), (UINTN)NULL);
+    if (Dfa == NULL) {
+        Dfa = ClpCreateRegexDfa(Program);
+    }
+
+    if (Dfa != NULL) {
+        Status = ClpSearchRegexDfa(Dfa, String, Flags);
+
+        //
+        // Put the DFA back in the cache, unless another thread beat this one
+        // to it.
+        //
+
+        Previous = (PREGEX_DFA)RtlAtomicCompareExchange((PUINTN)&(Program->Dfa),
+                                                        (UINTN)Dfa,
+                                                        (UINTN)NULL);
+
+        if (Previous != NULL) {
+            ClpDestroyRegexDfa(Dfa);
+        }
+
+        if (Status == RegexStatusNoMatch) {
+            return Status;
+        }
+
+        if ((Status == RegexStatusSuccess) && (ReportMatches == FALSE)) {
+            return Status;
+        }
+    }
+
+    //
+    // Either the offsets are needed or the DFA could not run. Simulate the
+    // NFA to find the leftmost match.
+    //
+
+    Status = ClpRunRegexNfa(Expression, String, Match, MatchArraySize, Flags);
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+BOOL
+ClpCompileRegexEntry (
+    PREGULAR_EXPRESSION Expression,
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    PREGULAR_EXPRESSION_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compiles a regular expression entry, including its
+    duplication count, into the program.
+
+Arguments:
+
+    Expression - Supplies a pointer to the regular expression.
+
+    Program - Supplies a pointer to the program being built.
+
+    Entry - Supplies a pointer to the entry to compile.
+
+Return Value:
+
+    TRUE on success.
+
+    FALSE if the entry cannot be represented or on allocation failure.
+
+--*/
+
+{
+
+    ULONG Head;
+    ULONG Iteration;
+    ULONG Loop;
+    ULONG Maximum;
+    ULONG PatchList;
+    BOOL Result;
+    ULONG Split;
+
+    //
+    // Emit the required iterations back to back.
+    //
+
+    for (Iteration = 0; Iteration < Entry->DuplicateMin; Iteration += 1) {
+        Result = ClpCompileRegexEntryOnce(Expression, Program, Entry);
+        if (Result == FALSE) {
+            return FALSE;
+        }
+    }
+
+    Maximum = Entry->DuplicateMax;
+
+    //
+    // Unbounded repeats become a loop. The loop records the input position at
+    // the start of each iteration so that an iteration that consumes nothing
+    // exits the loop rather than spinning, which is also what the
+    // backtracking matcher does.
+    //
+
+    if (Maximum == (ULONG)-1) {
+        Loop = Program->LoopCount;
+        Program->LoopCount += 1;
+        Head = ClpEmitRegexInstruction(Program,
+                                       RegexOpSplit,
+                                       0,
+                                       Program->InstructionCount + 1,
+                                       REGEX_INVALID_INSTRUCTION);
+
+        if (Head == REGEX_INVALID_INSTRUCTION) {
+            return FALSE;
+        }
+
+        if (ClpEmitRegexInstruction(Program, RegexOpMarkLoop, Loop, 0, 0) ==
+            REGEX_INVALID_INSTRUCTION) {
+
+            return FALSE;
+        }
+
+        Result = ClpCompileRegexEntryOnce(Expression, Program, Entry);
+        if (Result == FALSE) {
+            return FALSE;
+        }
+
+        if (ClpEmitRegexInstruction(Program,
+                                    RegexOpCheckLoop,
+                                    Loop,
+                                    Head,
+                                    Program->InstructionCount + 1) ==
+            REGEX_INVALID_INSTRUCTION) {
+
+            return FALSE;
+        }
+
+        Program->Instructions[Head].Alternate = Program->InstructionCount;
+
+    //
+    // Bounded optional repeats become a chain of splits that all exit to the
+    // same place.
+    //
+
+    } else if (Maximum > Entry->DuplicateMin) {
+        PatchList = REGEX_INVALID_INSTRUCTION;
+        for (Iteration = Entry->DuplicateMin;
+             Iteration < Maximum;
+             Iteration += 1) {
+
+            Split = ClpEmitRegexInstruction(Program,
+                                            RegexOpSplit,
+                                            0,
+                                            Program->InstructionCount + 1,
+                                            PatchList);
+
+            if (Split == REGEX_INVALID_INSTRUCTION) {
+                return FALSE;
+            }
+
+            PatchList = Split;
+            Result = ClpCompileRegexEntryOnce(Expression, Program, Entry);
+            if (Result == FALSE) {
+                return FALSE;
+            }
+        }
+
+        ClpPatchRegexInstructions(Program,
+                                  PatchList,
+                                  FALSE,
+                                  Program->InstructionCount);
+    }
+
+    return TRUE;
+}
+
+BOOL
+ClpCompileRegexEntryOnce (
+    PREGULAR_EXPRESSION Expression,
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    PREGULAR_EXPRESSION_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compiles a single occurrence of a regular expression entry
+    into the program.
+
+Arguments:
+
+    Expression - Supplies a pointer to the regular expression.
+
+    Program - Supplies a pointer to the program being built.
+
+    Entry - Supplies a pointer to the entry to compile.
+
+Return Value:
+
+    TRUE on success.
+
+    FALSE if the entry cannot be represented or on allocation failure.
+
+--*/
+
+{
+
+    REGEX_ASSERTION Assertion;
+    PREGULAR_EXPRESSION_ENTRY Child;
+    PLIST_ENTRY CurrentEntry;
+    ULONG Index;
+    ULONG Jump;
+    ULONG PatchList;
+    BOOL Result;
+    ULONG Split;
+    ULONG SubexpressionNumber;
+
+    Result = TRUE;
+    switch (Entry->Type) {
+    case RegexEntryOrdinaryCharacters:
+        for (Index = 0; Index < Entry->U.String.Size; Index += 1) {
+            Result = ClpCompileRegexCharacterSet(Expression,
+                                                 Program,
+                                                 Entry,
+                                                 Entry->U.String.Data[Index]);
+
+            if (Result == FALSE) {
+                break;
+            }
+        }
+
+        break;
+
+    case RegexEntryAnyCharacter:
+    case RegexEntryBracketExpression:
+        Result = ClpCompileRegexCharacterSet(Expression, Program, Entry, 0);
+        break;
+
+    //
+    // Back references cannot be expressed by a finite automaton.
+    //
+
+    case RegexEntryBackReference:
+        Result = FALSE;
+        break;
+
+    //
+    // Subexpressions record their start and end offsets around their
+    // contents. The base entry is subexpression zero, and also carries the
+    // anchors of basic regular expressions.
+    //
+
+    case RegexEntrySubexpression:
+        SubexpressionNumber = Entry->U.SubexpressionNumber;
+        if (ClpEmitRegexInstruction(Program,
+                                    RegexOpSave,
+                                    SubexpressionNumber * 2,
+                                    0,
+                                    0) == REGEX_INVALID_INSTRUCTION) {
+
+            Result = FALSE;
+            break;
+        }
+
+        if ((Entry->Flags & REGULAR_EXPRESSION_ANCHORED_LEFT) != 0) {
+            if (ClpEmitRegexInstruction(Program,
+                                        RegexOpAssert,
+                                        RegexAssertBeginLine,
+                                        0,
+                                        0) == REGEX_INVALID_INSTRUCTION) {
+
+                Result = FALSE;
+                break;
+            }
+        }
+
+        Result = ClpCompileRegexChildren(Expression, Program, Entry);
+        if (Result == FALSE) {
+            break;
+        }
+
+        if ((Entry->Flags & REGULAR_EXPRESSION_ANCHORED_RIGHT) != 0) {
+            if (ClpEmitRegexInstruction(Program,
+                                        RegexOpAssert,
+                                        RegexAssertEndLine,
+                                        0,
+                                        0) == REGEX_INVALID_INSTRUCTION) {
+
+                Result = FALSE;
+                break;
+            }
+        }
+
+        if (ClpEmitRegexInstruction(Program,
+                                    RegexOpSave,
+                                    (SubexpressionNumber * 2) + 1,
+                                    0,
+                                    0) == REGEX_INVALID_INSTRUCTION) {
+
+            Result = FALSE;
+        }
+
+        break;
+
+    //
+    // Branches try each option in order. Every option but the last is
+    // preceded by a split to the next option, and followed by a jump to the
+    // end of the branch.
+    //
+
+    case RegexEntryBranch:
+        PatchList = REGEX_INVALID_INSTRUCTION;
+        CurrentEntry = Entry->ChildList.Next;
+        while (CurrentEntry != &(Entry->ChildList)) {
+            Child = LIST_VALUE(CurrentEntry,
+                               REGULAR_EXPRESSION_ENTRY,
+                               ListEntry);
+
+            CurrentEntry = CurrentEntry->Next;
+            Split = REGEX_INVALID_INSTRUCTION;
+            if (CurrentEntry != &(Entry->ChildList)) {
+                Split = ClpEmitRegexInstruction(Program,
+                                                RegexOpSplit,
+                                                0,
+                                                Program->InstructionCount + 1,
+                                                REGEX_INVALID_INSTRUCTION);
+
+                if (Split == REGEX_INVALID_INSTRUCTION) {
+                    Result = FALSE;
+                    break;
+                }
+            }
+
+            Result = ClpCompileRegexEntry(Expression, Program, Child);
+            if (Result == FALSE) {
+                break;
+            }
+
+            if (Split != REGEX_INVALID_INSTRUCTION) {
+                Jump = ClpEmitRegexInstruction(Program,
+                                               RegexOpJump,
+                                               0,
+                                               PatchList,
+                                               0);
+
+                if (Jump == REGEX_INVALID_INSTRUCTION) {
+                    Result = FALSE;
+                    break;
+                }
+
+                PatchList = Jump;
+                Program->Instructions[Split].Alternate =
+                                                     Program->InstructionCount;
+            }
+        }
+
+        if (Result != FALSE) {
+            ClpPatchRegexInstructions(Program,
+                                      PatchList,
+                                      TRUE,
+                                      Program->InstructionCount);
+        }
+
+        break;
+
+    case RegexEntryBranchOption:
+        Result = ClpCompileRegexChildren(Expression, Program, Entry);
+        break;
+
+    case RegexEntryStringBegin:
+    case RegexEntryStringEnd:
+    case RegexEntryStartOfWord:
+    case RegexEntryEndOfWord:
+        if (Entry->Type == RegexEntryStringBegin) {
+            Assertion = RegexAssertBeginLine;
+
+        } else if (Entry->Type == RegexEntryStringEnd) {
+            Assertion = RegexAssertEndLine;
+
+        } else if (Entry->Type == RegexEntryStartOfWord) {
+            Assertion = RegexAssertStartOfWord;
+
+        } else {
+            Assertion = RegexAssertEndOfWord;
+        }
+
+        if (ClpEmitRegexInstruction(Program,
+                                    RegexOpAssert,
+                                    Assertion,
+                                    0,
+                                    0) == REGEX_INVALID_INSTRUCTION) {
+
+            Result = FALSE;
+        }
+
+        break;
+
+    default:
+
+        assert(FALSE);
+
+        Result = FALSE;
+        break;
+    }
+
+    return Result;
+}
+
+BOOL
+ClpCompileRegexChildren (
+    PREGULAR_EXPRESSION Expression,
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    PREGULAR_EXPRESSION_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compiles the children of a regular expression entry in
+    sequence.
+
+Arguments:
+
+    Expression - Supplies a pointer to the regular expression.
+
+    Program - Supplies a pointer to the program being built.
+
+    Entry - Supplies a pointer to the entry whose children should be compiled.
+
+Return Value:
+
+    TRUE on success.
+
+    FALSE if the entry cannot be represented or on allocation failure.
+
+--*/
+
+{
+
+    PREGULAR_EXPRESSION_ENTRY Child;
+    PLIST_ENTRY CurrentEntry;
+    BOOL Result;
+
+    CurrentEntry = Entry->ChildList.Next;
+    while (CurrentEntry != &(Entry->ChildList)) {
+        Child = LIST_VALUE(CurrentEntry, REGULAR_EXPRESSION_ENTRY, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        Result = ClpCompileRegexEntry(Expression, Program, Child);
+        if (Result == FALSE) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+BOOL
+ClpCompileRegexCharacterSet (
+    PREGULAR_EXPRESSION Expression,
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    PREGULAR_EXPRESSION_ENTRY Entry,
+    CHAR Character
+    )
+
+/*++
+
+Routine Description:
+
+    This routine emits an instruction matching a single character from the
+    set described by the given entry. The set is computed by asking the same
+    questions the backtracking matcher would ask of each possible character,
+    so the two always agree.
+
+Arguments:
+
+    Expression - Supplies a pointer to the regular expression.
+
+    Program - Supplies a pointer to the program being built.
+
+    Entry - Supplies a pointer to the ordinary character, any character, or
+        bracket expression entry.
+
+    Character - Supplies the character to match for ordinary character
+        entries.
+
+Return Value:
+
+    TRUE on success.
+
+    FALSE on allocation failure or if the program is too large.
+
+--*/
+
+{
+
+    ULONG Index;
+    BOOL Member;
+    PVOID NewBuffer;
+    ULONG NewCapacity;
+    REGEX_CHARACTER_SET Set;
+    ULONG SetIndex;
+    CHAR Value;
+
+    memset(&Set, 0, sizeof(REGEX_CHARACTER_SET));
+
+    //
+    // The null terminator is never matched, so start at one.
+    //
+
+    for (Index = 1; Index < REGEX_CHARACTER_SET_SIZE; Index += 1) {
+        Value = (CHAR)Index;
+        switch (Entry->Type) {
+        case RegexEntryOrdinaryCharacters:
+            Member = FALSE;
+            if ((Value == Character) ||
+                (((Expression->Flags & REG_ICASE) != 0) &&
+                 (tolower(Value) == tolower(Character)))) {
+
+                Member = TRUE;
+            }
+
+            break;
+
+        case RegexEntryAnyCharacter:
+            Member = TRUE;
+            if ((Value == '\n') && ((Expression->Flags & REG_NEWLINE) != 0)) {
+                Member = FALSE;
+            }
+
+            break;
+
+        case RegexEntryBracketExpression:
+            Member = ClpRegularExpressionMatchBracketCharacter(Expression,
+                                                               Entry,
+                                                               Value);
+
+            break;
+
+        default:
+
+            assert(FALSE);
+
+            return FALSE;
+        }
+
+        if (Member != FALSE) {
+            REGEX_SET_ADD(&Set, Index);
+        }
+    }
+
+    //
+    // Reuse an existing identical set if there is one, as the number of sets
+    // determines how many byte classes there are.
+    //
+
+    for (SetIndex = 0; SetIndex < Program->SetCount; SetIndex += 1) {
+        if (memcmp(&(Program->Sets[SetIndex]),
+                   &Set,
+                   sizeof(REGEX_CHARACTER_SET)) == 0) {
+
+            break;
+        }
+    }
+
+    if (SetIndex == Program->SetCount) {
+        if (Program->SetCount == Program->SetCapacity) {
+            NewCapacity = Program->SetCapacity * 2;
+            if (NewCapacity == 0) {
+                NewCapacity = 8;
+            }
+
+            NewBuffer = realloc(Program->Sets,
+                                NewCapacity * sizeof(REGEX_CHARACTER_SET));
+
+            if (NewBuffer == NULL) {
+                return FALSE;
+            }
+
+            Program->Sets = NewBuffer;
+            Program->SetCapacity = NewCapacity;
+        }
+
+        memcpy(&(Program->Sets[SetIndex]), &Set, sizeof(REGEX_CHARACTER_SET));
+        Program->SetCount += 1;
+    }
+
+    if (ClpEmitRegexInstruction(Program,
+                                RegexOpCharacterSet,
+                                SetIndex,
+                                0,
+                                0) == REGEX_INVALID_INSTRUCTION) {
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+ULONG
+ClpEmitRegexInstruction (
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    REGEX_OPCODE Opcode,
+    ULONG Argument,
+    ULONG Target,
+    ULONG Alternate
+    )
+
+/*++
+
+Routine Description:
+
+    This routine appends an instruction to the program.
+
+Arguments:
+
+    Program - Supplies a pointer to the program being built.
+
+    Opcode - Supplies the instruction opcode.
+
+    Argument - Supplies the instruction argument.
+
+    Target - Supplies the instruction target.
+
+    Alternate - Supplies the alternate instruction target.
+
+Return Value:
+
+    Returns the index of the new instruction.
+
+    REGEX_INVALID_INSTRUCTION on allocation failure or if the program has grown
+    too large.
+
+--*/
+
+{
+
+    ULONG Index;
+    PREGEX_INSTRUCTION Instruction;
+    ULONG NewCapacity;
+    PVOID NewInstructions;
+
+    if (Program->InstructionCount >= REGEX_PROGRAM_MAX_SIZE) {
+        return REGEX_INVALID_INSTRUCTION;
+    }
+
+    if (Program->InstructionCount == Program->InstructionCapacity) {
+        NewCapacity = Program->InstructionCapacity * 2;
+        if (NewCapacity == 0) {
+            NewCapacity = 16;
+        }
+
+        NewInstructions = realloc(Program->Instructions,
+                                  NewCapacity * sizeof(REGEX_INSTRUCTION));
+
+        if (NewInstructions == NULL) {
+            return REGEX_INVALID_INSTRUCTION;
+        }
+
+        Program->Instructions = NewInstructions;
+        Program->InstructionCapacity = NewCapacity;
+    }
+
+    Index = Program->InstructionCount;
+    Instruction = &(Program->Instructions[Index]);
+    Instruction->Opcode = Opcode;
+    Instruction->Argument = Argument;
+    Instruction->Target = Target;
+    Instruction->Alternate = Alternate;
+    Program->InstructionCount += 1;
+    return Index;
+}
+
+VOID
+ClpPatchRegexInstructions (
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    ULONG PatchList,
+    BOOL PatchTarget,
+    ULONG Destination
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resolves a list of forward references. The list is threaded
+    through the target or alternate fields of the instructions themselves.
+
+Arguments:
+
+    Program - Supplies a pointer to the program being built.
+
+    PatchList - Supplies the index of the first instruction to patch, or
+        REGEX_INVALID_INSTRUCTION if the list is empty.
+
+    PatchTarget - Supplies a boolean indicating whether the target field
+        (TRUE) or the alternate field (FALSE) forms the list.
+
+    Destination - Supplies the instruction index to patch in.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PREGEX_INSTRUCTION Instruction;
+
+    while (PatchList != REGEX_INVALID_INSTRUCTION) {
+        Instruction = &(Program->Instructions[PatchList]);
+        if (PatchTarget != FALSE) {
+            PatchList = Instruction->Target;
+            Instruction->Target = Destination;
+
+        } else {
+            PatchList = Instruction->Alternate;
+            Instruction->Alternate = Destination;
+        }
+    }
+
+    return;
+}
+
+VOID
+ClpComputeRegexByteClasses (
+    PREGULAR_EXPRESSION_PROGRAM Program
+    )
+
+/*++
+
+Routine Description:
+
+    This routine partitions the characters into classes whose members are
+    indistinguishable to the program. Each character set, along with the
+    character properties used by assertions, splits the existing classes.
+
+Arguments:
+
+    Program - Supplies a pointer to the program.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Character;
+    ULONG ClassCount;
+    ULONG Key;
+    UCHAR Map[REGEX_CHARACTER_SET_SIZE * 2];
+    BOOL Member;
+    ULONG NewClassCount;
+    PREGEX_CHARACTER_SET Set;
+    ULONG SetIndex;
+
+    memset(Program->ByteClass, 0, sizeof(Program->ByteClass));
+    ClassCount = 1;
+
+    //
+    // Refine by each set, and then by the three character properties that
+    // assertions care about: being the terminator, a newline, or a word
+    // character.
+    //
+
+    for (SetIndex = 0; SetIndex < Program->SetCount + 3; SetIndex += 1) {
+        Set = NULL;
+        if (SetIndex < Program->SetCount) {
+            Set = &(Program->Sets[SetIndex]);
+        }
+
+        memset(Map, 0xFF, ClassCount * 2);
+        NewClassCount = 0;
+        for (Character = 0;
+             Character < REGEX_CHARACTER_SET_SIZE;
+             Character += 1) {
+
+            if (Set != NULL) {
+                Member = FALSE;
+                if (REGEX_SET_CONTAINS(Set, Character)) {
+                    Member = TRUE;
+                }
+
+            } else if (SetIndex == Program->SetCount) {
+                Member = (Character == '\0');
+
+            } else if (SetIndex == Program->SetCount + 1) {
+                Member = (Character == '\n');
+
+            } else {
+                Member = REGULAR_EXPRESSION_IS_NAME((CHAR)Character);
+            }
+
+            Key = (Program->ByteClass[Character] * 2) + (Member != FALSE);
+            if (Map[Key] == 0xFF) {
+                Map[Key] = NewClassCount;
+                NewClassCount += 1;
+            }
+
+            Program->ByteClass[Character] = Map[Key];
+        }
+
+        ClassCount = NewClassCount;
+    }
+
+    Program->ByteClassCount = ClassCount;
+    return;
+}
+
+BOOL
+ClpFindRegexPrefix (
+    PREGULAR_EXPRESSION Expression,
+    PREGULAR_EXPRESSION_PROGRAM Program
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether every match of the expression must begin
+    with a particular literal string. If so, the search can skip directly to
+    occurrences of that string.
+
+Arguments:
+
+    Expression - Supplies a pointer to the regular expression.
+
+    Program - Supplies a pointer to the program.
+
+Return Value:
+
+    TRUE on success (including if no prefix was found).
+
+    FALSE on allocation failure.
+
+--*/
+
+{
+
+    PREGULAR_EXPRESSION_ENTRY Entry;
+    PREGULAR_EXPRESSION_ENTRY Parent;
+
+    if ((Expression->Flags & REG_ICASE) != 0) {
+        return TRUE;
+    }
+
+    //
+    // Walk down the leading subexpressions to the first real entry.
+    //
+
+    Parent = &(Expression->BaseEntry);
+    while (TRUE) {
+        if (LIST_EMPTY(&(Parent->ChildList)) != FALSE) {
+            return TRUE;
+        }
+
+        Entry = LIST_VALUE(Parent->ChildList.Next,
+                           REGULAR_EXPRESSION_ENTRY,
+                           ListEntry);
+
+        if (Entry->DuplicateMin == 0) {
+            return TRUE;
+        }
+
+        if (Entry->Type != RegexEntrySubexpression) {
+            break;
+        }
+
+        Parent = Entry;
+    }
+
+    if (Entry->Type != RegexEntryOrdinaryCharacters) {
+        return TRUE;
+    }
+
+    Program->Prefix = malloc(Entry->U.String.Size + 1);
+    if (Program->Prefix == NULL) {
+        return FALSE;
+    }
+
+    memcpy(Program->Prefix, Entry->U.String.Data, Entry->U.String.Size);
+    Program->Prefix[Entry->U.String.Size] = '\0';
+    return TRUE;
+}
+
+ULONG
+ClpGetRegexContext (
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    PSTR Input,
+    ULONG Index,
+    int Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine computes the context flags for a position in the input.
+
+Arguments:
+
+    Program - Supplies a pointer to the program.
+
+    Input - Supplies a pointer to the input string.
+
+    Index - Supplies the position in the input.
+
+    Flags - Supplies the REG_* execution flags.
+
+Return Value:
+
+    Returns a bitfield of REGEX_CONTEXT_* flags.
+
+--*/
+
+{
+
+    ULONG Context;
+    CHAR Previous;
+
+    Context = 0;
+    if ((Flags & REG_NOTEOL) != 0) {
+        Context |= REGEX_CONTEXT_NOT_END_OF_LINE;
+    }
+
+    if (Index == 0) {
+        if ((Flags & REG_NOTBOL) == 0) {
+            Context |= REGEX_CONTEXT_BEGIN_LINE;
+        }
+
+    } else {
+        Previous = Input[Index - 1];
+        if ((Previous == '\n') &&
+            ((Program->ExpressionFlags & REG_NEWLINE) != 0)) {
+
+            Context |= REGEX_CONTEXT_BEGIN_LINE;
+        }
+
+        if (REGULAR_EXPRESSION_IS_NAME(Previous)) {
+            Context |= REGEX_CONTEXT_AFTER_WORD;
+        }
+    }
+
+    return Context;
+}
+
+BOOL
+ClpTestRegexAssertion (
+    PREGULAR_EXPRESSION_PROGRAM Program,
+    REGEX_ASSERTION Assertion,
+    ULONG Context,
+    CHAR Next
+    )
+
+/*++
+
+Routine Description:
+
+    This routine evaluates a zero-width assertion.
+
+Arguments:
+
+    Program - Supplies a pointer to the program.
+
+    Assertion - Supplies the assertion to test.
+
+    Context - Supplies the context flags of the current position.
+
+    Next - Supplies the character at the current position.
+
+Return Value:
+
+    TRUE if the assertion holds.
+
+    FALSE if the assertion does not hold.
+
+--*/
+
+{
+
+    switch (Assertion) {
+    case RegexAssertBeginLine:
+        if ((Context & REGEX_CONTEXT_BEGIN_LINE) != 0) {
+            return TRUE;
+        }
+
+        break;
+
+    case RegexAssertEndLine:
+        if (((Next == '\0') &&
+             ((Context & REGEX_CONTEXT_NOT_END_OF_LINE) == 0)) ||
+            ((Next == '\n') &&
+             ((Program->ExpressionFlags & REG_NEWLINE) != 0))) {
+
+            return TRUE;
+        }
+
+        break;
+
+    case RegexAssertStartOfWord:
+        if ((REGULAR_EXPRESSION_IS_NAME(Next)) &&
+            ((Context & REGEX_CONTEXT_AFTER_WORD) == 0)) {
+
+            return TRUE;
+        }
+
+        break;
+
+    case RegexAssertEndOfWord:
+        if (((Context & REGEX_CONTEXT_AFTER_WORD) != 0) &&
+            (!REGULAR_EXPRESSION_IS_NAME(Next))) {
+
+            return TRUE;
+        }
+
+        break;
+
+    default:
+
+        assert(FALSE);
+
+        break;
+    }
+
+    return FALSE;
+}
+
+PREGEX_DFA
+ClpCreateRegexDfa (
+    PREGULAR_EXPRESSION_PROGRAM Program
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates an empty DFA for the given program.
+
+Arguments:
+
+    Program - Supplies a pointer to the program.
+
+Return Value:
+
+    Returns a pointer to the new DFA on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    size_t AllocationSize;
+    PREGEX_DFA Dfa;
+    ULONG InstructionCount;
+
+    InstructionCount = Program->InstructionCount;
+
+    //
+    // The visited array, kernel, and step list each hold at most one entry
+    // per instruction (plus the start instruction in the step list). Every
+    // instruction visited in a closure pushes at most two entries onto the
+    // stack, on top of the initial state.
+    //
+
+    AllocationSize = sizeof(REGEX_DFA) +
+                     (InstructionCount * 7 * sizeof(ULONG)) + sizeof(ULONG);
+
+    Dfa = malloc(AllocationSize);
+    if (Dfa == NULL) {
+        return NULL;
+    }
+
+    memset(Dfa, 0, AllocationSize);
+    Dfa->Program = Program;
+    Dfa->Visited = (PULONG)(Dfa + 1);
+    Dfa->Kernel = Dfa->Visited + InstructionCount;
+    Dfa->Step = Dfa->Kernel + InstructionCount;
+    Dfa->Stack = Dfa->Step + InstructionCount + 1;
+    return Dfa;
+}
+
+VOID
+ClpDestroyRegexDfa (
+    PREGEX_DFA Dfa
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a DFA and all its cached states.
+
+Arguments:
+
+    Dfa - Supplies a pointer to the DFA to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ClpFlushRegexDfa(Dfa);
+    free(Dfa);
+    return;
+}
+
+VOID
+ClpFlushRegexDfa (
+    PREGEX_DFA Dfa
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees all the cached states of a DFA.
+
+Arguments:
+
+    Dfa - Supplies a pointer to the DFA to flush.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Bucket;
+    PREGEX_DFA_STATE Next;
+    PREGEX_DFA_STATE State;
+
+    for (Bucket = 0; Bucket < REGEX_DFA_HASH_SIZE; Bucket += 1) {
+        State = Dfa->Buckets[Bucket];
+        while (State != NULL) {
+            Next = State->HashNext;
+            free(State);
+            State = Next;
+        }
+
+        Dfa->Buckets[Bucket] = NULL;
+    }
+
+    Dfa->MemoryUsed = 0;
+    return;
+}
+
+REGULAR_EXPRESSION_STATUS
+ClpSearchRegexDfa (
+    PREGEX_DFA Dfa,
+    PSTR Input,
+    int Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine runs the DFA over the input to determine whether it contains
+    a match anywhere.
+
+Arguments:
+
+    Dfa - Supplies a pointer to the DFA.
+
+    Input - Supplies a pointer to the input string.
+
+    Flags - Supplies the REG_* execution flags.
+
+Return Value:
+
+    Success if there was a match.
+
+    No match if there was no match.
+
+    No memory if a state could not be allocated.
+
+--*/
+
+{
+
+    CHAR Character;
+    ULONG Context;
+    BOOL Flushed;
+    PSTR Found;
+    ULONG Index;
+    PREGEX_DFA_STATE Next;
+    PREGULAR_EXPRESSION_PROGRAM Program;
+    ULONG Start;
+    PREGEX_DFA_STATE State;
+
+    Program = Dfa->Program;
+    Index = 0;
+    Start = REGEX_PROGRAM_START;
+    Context = ClpGetRegexContext(Program, Input, Index, Flags);
+    State = ClpLookupRegexDfaState(Dfa, Context, &Start, 1, &Flushed);
+    if (State == NULL) {
+        return RegexStatusNoMemory;
+    }
+
+    while (TRUE) {
+
+        //
+        // If nothing is in progress, skip ahead to the next place a match
+        // could start.
+        //
+
+        if (((State->Flags & REGEX_DFA_STATE_START) != 0) &&
+            (Program->Prefix != NULL)) {
+
+            Found = strstr(Input + Index, Program->Prefix);
+            if (Found == NULL) {
+                return RegexStatusNoMatch;
+            }
+
+            if (Found != Input + Index) {
+                Index = Found - Input;
+                Context = ClpGetRegexContext(Program, Input, Index, Flags);
+                State = ClpLookupRegexDfaState(Dfa,
+                                               Context,
+                                               &Start,
+                                               1,
+                                               &Flushed);
+
+                if (State == NULL) {
+                    return RegexStatusNoMemory;
+                }
+            }
+        }
+
+        Character = Input[Index];
+        Next = State->Next[Program->ByteClass[(UCHAR)Character]];
+        if (Next == NULL) {
+            Next = ClpComputeRegexDfaTransition(Dfa, State, Character);
+            if (Next == NULL) {
+                return RegexStatusNoMemory;
+            }
+        }
+
+        if ((Next->Flags & REGEX_DFA_STATE_MATCH) != 0) {
+            return RegexStatusSuccess;
+        }
+
+        if ((Character == '\0') || (Next->Count == 0)) {
+            break;
+        }
+
+        State = Next;
+        Index += 1;
+    }
+
+    return RegexStatusNoMatch;
+}
+
+PREGEX_DFA_STATE
+ClpComputeRegexDfaTransition (
+    PREGEX_DFA Dfa,
+    PREGEX_DFA_STATE State,
+    CHAR Character
+    )
+
+/*++
+
+Routine Description:
+
+    This routine computes and caches the transition out of a DFA state on the
+    given character.
+
+Arguments:
+
+    Dfa - Supplies a pointer to the DFA.
+
+    State - Supplies a pointer to the state to transition out of. This state
+        may be freed if the cache needs to be flushed.
+
+    Character - Supplies the character at the current position.
+
+Return Value:
+
+    Returns a pointer to the next state. This has the match flag set if a
+    match ends right before the given character.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    ULONG Count;
+    ULONG Flags;
+    BOOL Flushed;
+    PREGEX_INSTRUCTION Instruction;
+    ULONG InstructionIndex;
+    ULONG KernelCount;
+    ULONG KernelIndex;
+    BOOL Matched;
+    PREGEX_DFA_STATE Next;
+    PREGULAR_EXPRESSION_PROGRAM Program;
+    PREGEX_CHARACTER_SET Set;
+    ULONG StackSize;
+    UCHAR Value;
+
+    Program = Dfa->Program;
+    Value = (UCHAR)Character;
+
+    //
+    // Follow all the empty transitions out of the state's instructions to
+    // find the character matching instructions (the kernel) and whether or
+    // not the match instruction is reachable.
+    //
+
+    Dfa->Generation += 1;
+    if (Dfa->Generation == 0) {
+        memset(Dfa->Visited, 0, Program->InstructionCount * sizeof(ULONG));
+        Dfa->Generation = 1;
+    }
+
+    StackSize = 0;
+    for (Count = State->Count; Count != 0; Count -= 1) {
+        Dfa->Stack[StackSize] = State->Instructions[Count - 1];
+        StackSize += 1;
+    }
+
+    KernelCount = 0;
+    Matched = FALSE;
+    while (StackSize != 0) {
+        StackSize -= 1;
+        InstructionIndex = Dfa->Stack[StackSize];
+        if (Dfa->Visited[InstructionIndex] == Dfa->Generation) {
+            continue;
+        }
+
+        Dfa->Visited[InstructionIndex] = Dfa->Generation;
+        Instruction = &(Program->Instructions[InstructionIndex]);
+        switch (Instruction->Opcode) {
+        case RegexOpCharacterSet:
+            Dfa->Kernel[KernelCount] = InstructionIndex;
+            KernelCount += 1;
+            break;
+
+        case RegexOpMatch:
+            Matched = TRUE;
+            break;
+
+        //
+        // Whether a loop continues depends on where the iteration started,
+        // which the DFA doesn't track. Following both paths is equivalent,
+        // since an empty iteration leads back to instructions already in the
+        // closure.
+        //
+
+        case RegexOpSplit:
+        case RegexOpCheckLoop:
+            Dfa->Stack[StackSize] = Instruction->Alternate;
+            Dfa->Stack[StackSize + 1] = Instruction->Target;
+            StackSize += 2;
+            break;
+
+        case RegexOpJump:
+            Dfa->Stack[StackSize] = Instruction->Target;
+            StackSize += 1;
+            break;
+
+        case RegexOpSave:
+        case RegexOpMarkLoop:
+            Dfa->Stack[StackSize] = InstructionIndex + 1;
+            StackSize += 1;
+            break;
+
+        case RegexOpAssert:
+            if (ClpTestRegexAssertion(Program,
+                                      Instruction->Argument,
+                                      State->Flags & REGEX_CONTEXT_MASK,
+                                      Character) != FALSE) {
+
+                Dfa->Stack[StackSize] = InstructionIndex + 1;
+                StackSize += 1;
+            }
+
+            break;
+
+        default:
+
+            assert(FALSE);
+
+            break;
+        }
+    }
+
+    //
+    // A match ending here is all the caller cares about, so all matching
+    // transitions lead to the same state.
+    //
+
+    Count = 0;
+    if (Matched != FALSE) {
+        Flags = REGEX_DFA_STATE_MATCH;
+
+    } else {
+        Flags = State->Flags & REGEX_CONTEXT_NOT_END_OF_LINE;
+        if (Character != '\0') {
+            for (KernelIndex = 0; KernelIndex < KernelCount; KernelIndex += 1) {
+                InstructionIndex = Dfa->Kernel[KernelIndex];
+                Instruction = &(Program->Instructions[InstructionIndex]);
+                Set = &(Program->Sets[Instruction->Argument]);
+                if (REGEX_SET_CONTAINS(Set, Value)) {
+                    Dfa->Step[Count] = InstructionIndex + 1;
+                    Count += 1;
+                }
+            }
+
+            if ((Program->Flags & REGEX_PROGRAM_ANCHORED_START) == 0) {
+                Dfa->Step[Count] = REGEX_PROGRAM_START;
+                Count += 1;
+            }
+
+            if ((Character == '\n') &&
+                ((Program->ExpressionFlags & REG_NEWLINE) != 0)) {
+
+                Flags |= REGEX_CONTEXT_BEGIN_LINE;
+            }
+
+            if (REGULAR_EXPRESSION_IS_NAME(Character)) {
+                Flags |= REGEX_CONTEXT_AFTER_WORD;
+            }
+        }
+    }
+
+    Next = ClpLookupRegexDfaState(Dfa, Flags, Dfa->Step, Count, &Flushed);
+    if ((Next != NULL) && (Flushed == FALSE)) {
+        State->Next[Program->ByteClass[Value]] = Next;
+    }
+
+    return Next;
+}
+
+PREGEX_DFA_STATE
+ClpLookupRegexDfaState (
+    PREGEX_DFA Dfa,
+    ULONG Flags,
+    PULONG Instructions,
+    ULONG Count,
+    PBOOL Flushed
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds or creates the DFA state for the given set of
+    instructions.
+
+Arguments:
+
+    Dfa - Supplies a pointer to the DFA.
+
+    Flags - Supplies the context and state flags of the state.
+
+    Instructions - Supplies an array of instruction indices. This array may be
+        sorted in place.
+
+    Count - Supplies the number of elements in the instruction array.
+
+    Flushed - Supplies a pointer where a boolean will be returned indicating
+        whether the state cache had to be flushed to make room. If so, any
+        state pointers the caller held are no longer valid.
+
+Return Value:
+
+    Returns a pointer to the state on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    size_t AllocationSize;
+    ULONG Bucket;
+    ULONG Hash;
+    ULONG Index;
+    ULONG Unique;
+    PREGEX_DFA_STATE State;
+
+    *Flushed = FALSE;
+
+    //
+    // Put the set in canonical form.
+    //
+
+    if (Count > 1) {
+        qsort(Instructions,
+              Count,
+              sizeof(ULONG),
+              ClpCompareRegexInstructionIndices);
+
+        Unique = 1;
+        for (Index = 1; Index < Count; Index += 1) {
+            if (Instructions[Index] != Instructions[Unique - 1]) {
+                Instructions[Unique] = Instructions[Index];
+                Unique += 1;
+            }
+        }
+
+        Count = Unique;
+    }
+
+    if ((Count == 1) && (Instructions[0] == REGEX_PROGRAM_START)) {
+        Flags |= REGEX_DFA_STATE_START;
+    }
+
+    Hash = Flags;
+    for (Index = 0; Index < Count; Index += 1) {
+        Hash = (Hash * 31) + Instructions[Index];
+    }
+
+    Bucket = Hash % REGEX_DFA_HASH_SIZE;
+    State = Dfa->Buckets[Bucket];
+    while (State != NULL) {
+        if ((State->Hash == Hash) && (State->Flags == Flags) &&
+            (State->Count == Count) &&
+            (memcmp(State->Instructions,
+                    Instructions,
+                    Count * sizeof(ULONG)) == 0)) {
+
+            return State;
+        }
+
+        State = State->HashNext;
+    }
+
+    //
+    // Create a new state, flushing the cache first if it's full.
+    //
+
+    AllocationSize = sizeof(REGEX_DFA_STATE) + (Count * sizeof(ULONG));
+    AllocationSize = ALIGN_RANGE_UP(AllocationSize, sizeof(PVOID));
+    AllocationSize += Dfa->Program->ByteClassCount * sizeof(PREGEX_DFA_STATE);
+    if (Dfa->MemoryUsed + AllocationSize > REGEX_DFA_MEMORY_LIMIT) {
+        ClpFlushRegexDfa(Dfa);
+        *Flushed = TRUE;
+    }
+
+    State = malloc(AllocationSize);
+    if (State == NULL) {
+        return NULL;
+    }
+
+    memset(State, 0, AllocationSize);
+    State->Hash = Hash;
+    State->Flags = Flags;
+    State->Count = Count;
+    memcpy(State->Instructions, Instructions, Count * sizeof(ULONG));
+    State->Next = (PREGEX_DFA_STATE *)((PUCHAR)State + AllocationSize -
+                   (Dfa->Program->ByteClassCount * sizeof(PREGEX_DFA_STATE)));
+
+    State->HashNext = Dfa->Buckets[Bucket];
+    Dfa->Buckets[Bucket] = State;
+    Dfa->MemoryUsed += AllocationSize;
+    return State;
+}
+
+int
+ClpCompareRegexInstructionIndices (
+    const void *Left,
+    const void *Right
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two instruction indices for sorting.
+
+Arguments:
+
+    Left - Supplies a pointer to the left index.
+
+    Right - Supplies a pointer to the right index.
+
+Return Value:
+
+    Less than zero if the left index is smaller, zero if they're equal, or
+    greater than zero if the left index is larger.
+
+--*/
+
+{
+
+    ULONG LeftValue;
+    ULONG RightValue;
+
+    LeftValue = *((PULONG)Left);
+    RightValue = *((PULONG)Right);
+    if (LeftValue < RightValue) {
+        return -1;
+    }
+
+    if (LeftValue > RightValue) {
+        return 1;
+    }
+
+    return 0;
+}
+
+REGULAR_EXPRESSION_STATUS
+ClpRunRegexNfa (
+    PREGULAR_EXPRESSION Expression,
+    PSTR Input,
+    regmatch_t Match[],
+    size_t MatchArraySize,
+    int Flags
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the leftmost match by simulating the NFA, tracking all
+    possible threads in priority order. Among matches starting at the same
+    position, it returns the one the backtracking matcher would have found
+    first.
+
+Arguments:
+
+    Expression - Supplies a pointer to the compiled regular expression.
+
+    Input - Supplies a pointer to the input string.
+
+    Match - Supplies an optional pointer to an array where the string indices of
+        the match and its subexpressions will be returned.
+
+    MatchArraySize - Supplies the number of elements in the match array.
+
+    Flags - Supplies the REG_* execution flags.
+
+Return Value:
+
+    Success if there was a match.
+
+    No match if there was no match.
+
+    No memory if the execution state could not be allocated.
+
+--*/
+
+{
+
+    PVOID Allocation;
+    size_t AllocationSize;
+    ULONG CaptureCount;
+    CHAR Character;
+    ULONG Context;
+    PREGEX_NFA_THREAD_LIST Current;
+    REGEX_NFA_EXECUTION Execution;
+    PSTR Found;
+    ULONG Index;
+    PREGEX_INSTRUCTION Instruction;
+    ULONG InstructionCount;
+    ULONG InstructionIndex;
+    ULONG ListIndex;
+    PREGEX_NFA_THREAD_LIST Next;
+    ULONG NextContext;
+    PREGULAR_EXPRESSION_PROGRAM Program;
+    PREGEX_CHARACTER_SET Set;
+    ULONG Slot;
+    ULONG SlotCount;
+    regoff_t *ThreadSlots;
+    ULONG ThreadIndex;
+    UCHAR Value;
+
+    Program = Expression->Program;
+    InstructionCount = Program->InstructionCount;
+    CaptureCount = 0;
+    if (((Expression->Flags & REG_NOSUB) == 0) && (MatchArraySize != 0)) {
+        CaptureCount = Expression->SubexpressionCount + 1;
+        if (CaptureCount > MatchArraySize) {
+            CaptureCount = MatchArraySize;
+        }
+    }
+
+    memset(&Execution, 0, sizeof(REGEX_NFA_EXECUTION));
+    Execution.Program = Program;
+    Execution.Input = Input;
+    Execution.Flags = Flags;
+    Execution.CaptureSlotCount = CaptureCount * 2;
+    SlotCount = Execution.CaptureSlotCount + Program->LoopCount;
+    Execution.SlotCount = SlotCount;
+
+    //
+    // Allocate everything in one go: the slots for two full thread lists plus
+    // the working and match slots, the instruction arrays for the two lists,
+    // the visited array, and the stack. Every instruction visited while
+    // adding a thread pushes at most two stack entries.
+    //
+
+    AllocationSize = (((2 * InstructionCount) + 2) * SlotCount *
+                      sizeof(regoff_t)) +
+                     (3 * InstructionCount * sizeof(ULONG)) +
+                     (((2 * InstructionCount) + 2) *
+                      sizeof(REGEX_NFA_STACK_ENTRY));
+
+    Allocation = malloc(AllocationSize);
+    if (Allocation == NULL) {
+        return RegexStatusNoMemory;
+    }
+
+    Execution.Lists[0].Slots = Allocation;
+    Execution.Lists[1].Slots = Execution.Lists[0].Slots +
+                               (InstructionCount * SlotCount);
+
+    Execution.Slots = Execution.Lists[1].Slots + (InstructionCount * SlotCount);
+    Execution.MatchSlots = Execution.Slots + SlotCount;
+    Execution.Lists[0].Instructions =
+                                  (PULONG)(Execution.MatchSlots + SlotCount);
+
+    Execution.Lists[1].Instructions = Execution.Lists[0].Instructions +
+                                      InstructionCount;
+
+    Execution.Visited = Execution.Lists[1].Instructions + InstructionCount;
+    memset(Execution.Visited, 0, InstructionCount * sizeof(ULONG));
+    Execution.Stack = (PREGEX_NFA_STACK_ENTRY)(Execution.Visited +
+                                               InstructionCount);
+
+    Current = &(Execution.Lists[0]);
+    Next = &(Execution.Lists[1]);
+    Current->Count = 0;
+    Execution.Generation = 1;
+    Index = 0;
+    while (TRUE) {
+
+        //
+        // Start a new thread at this position unless a match has already been
+        // found (all threads from here on would be lower priority). It goes
+        // at the end of the list, as earlier starting positions win.
+        //
+
+        if ((Execution.Matched == FALSE) &&
+            ((Index == 0) ||
+             ((Program->Flags & REGEX_PROGRAM_ANCHORED_START) == 0))) {
+
+            if ((Current->Count == 0) && (Program->Prefix != NULL)) {
+                Found = strstr(Input + Index, Program->Prefix);
+                if (Found == NULL) {
+                    break;
+                }
+
+                if (Found != Input + Index) {
+                    Index = Found - Input;
+                    Execution.Generation += 1;
+                }
+            }
+
+            for (Slot = 0; Slot < SlotCount; Slot += 1) {
+                Execution.Slots[Slot] = -1;
+            }
+
+            Context = ClpGetRegexContext(Program, Input, Index, Flags);
+            ClpAddRegexNfaThread(&Execution,
+                                 Current,
+                                 REGEX_PROGRAM_START,
+                                 Index,
+                                 Context);
+        }
+
+        //
+        // If there are no threads left, stop if no more can be started, or
+        // move on to the next position.
+        //
+
+        Character = Input[Index];
+        if (Current->Count == 0) {
+            if ((Execution.Matched != FALSE) || (Character == '\0') ||
+                ((Program->Flags & REGEX_PROGRAM_ANCHORED_START) != 0)) {
+
+                break;
+            }
+
+            Execution.Generation += 1;
+            Index += 1;
+            continue;
+        }
+
+        //
+        // Advance every thread over the current character, in priority
+        // order.
+        //
+
+        Value = (UCHAR)Character;
+        Next->Count = 0;
+        Execution.Generation += 1;
+        NextContext = 0;
+        if (Character != '\0') {
+            NextContext = ClpGetRegexContext(Program, Input, Index + 1, Flags);
+        }
+
+        for (ThreadIndex = 0; ThreadIndex < Current->Count; ThreadIndex += 1) {
+            InstructionIndex = Current->Instructions[ThreadIndex];
+            Instruction = &(Program->Instructions[InstructionIndex]);
+            ThreadSlots = Current->Slots + (ThreadIndex * SlotCount);
+
+            //
+            // If this thread matched, remember it and cut off all the lower
+            // priority threads. Higher priority threads already moved to the
+            // next list may still find a preferred match.
+            //
+
+            if (Instruction->Opcode == RegexOpMatch) {
+                Execution.Matched = TRUE;
+                memcpy(Execution.MatchSlots,
+                       ThreadSlots,
+                       SlotCount * sizeof(regoff_t));
+
+                break;
+            }
+
+            assert(Instruction->Opcode == RegexOpCharacterSet);
+
+            if (Character == '\0') {
+                continue;
+            }
+
+            Set = &(Program->Sets[Instruction->Argument]);
+            if (REGEX_SET_CONTAINS(Set, Value)) {
+                memcpy(Execution.Slots,
+                       ThreadSlots,
+                       SlotCount * sizeof(regoff_t));
+
+                ClpAddRegexNfaThread(&Execution,
+                                     Next,
+                                     InstructionIndex + 1,
+                                     Index + 1,
+                                     NextContext);
+            }
+        }
+
+        if (Character == '\0') {
+            break;
+        }
+
+        ListIndex = (Current == &(Execution.Lists[0]));
+        Current = Next;
+        Next = &(Execution.Lists[ListIndex ^ 1]);
+        Index += 1;
+    }
+
+    if (Execution.Matched == FALSE) {
+        free(Allocation);
+        return RegexStatusNoMatch;
+    }
+
+    for (Slot = 0; Slot < CaptureCount; Slot += 1) {
+        Match[Slot].rm_so = Execution.MatchSlots[Slot * 2];
+        Match[Slot].rm_eo = Execution.MatchSlots[(Slot * 2) + 1];
+    }
+
+    free(Allocation);
+    return RegexStatusSuccess;
+}
+
+VOID
+ClpAddRegexNfaThread (
+    PREGEX_NFA_EXECUTION Execution,
+    PREGEX_NFA_THREAD_LIST List,
+    ULONG Instruction,
+    ULONG Index,
+    ULONG Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a thread to the given list, following all empty
+    transitions in priority order. Each instruction is added at most once per
+    input position; the first (highest priority) thread to reach it wins.
+
+Arguments:
+
+    Execution - Supplies a pointer to the execution state. The working slots
+        contain the slots of the thread being added.
+
+    List - Supplies a pointer to the list to add to.
+
+    Instruction - Supplies the instruction the thread is at.
+
+    Index - Supplies the current input position.
+
+    Context - Supplies the context flags for the current input position.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PREGEX_INSTRUCTION Current;
+    PREGEX_NFA_STACK_ENTRY Entry;
+    ULONG InstructionIndex;
+    CHAR Next;
+    PREGULAR_EXPRESSION_PROGRAM Program;
+    regoff_t *Slots;
+    ULONG Slot;
+    ULONG StackSize;
+
+    Program = Execution->Program;
+    Slots = Execution->Slots;
+    Next = Execution->Input[Index];
+    Execution->Stack[0].Instruction = Instruction;
+    StackSize = 1;
+    while (StackSize != 0) {
+        StackSize -= 1;
+        Entry = &(Execution->Stack[StackSize]);
+        if (Entry->Instruction == REGEX_RESTORE_SLOT) {
+            Slots[Entry->Slot] = Entry->Value;
+            continue;
+        }
+
+        InstructionIndex = Entry->Instruction;
+        if (Execution->Visited[InstructionIndex] == Execution->Generation) {
+            continue;
+        }
+
+        Execution->Visited[InstructionIndex] = Execution->Generation;
+        Current = &(Program->Instructions[InstructionIndex]);
+        switch (Current->Opcode) {
+        case RegexOpCharacterSet:
+        case RegexOpMatch:
+            List->Instructions[List->Count] = InstructionIndex;
+            memcpy(List->Slots + (List->Count * Execution->SlotCount),
+                   Slots,
+                   Execution->SlotCount * sizeof(regoff_t));
+
+            List->Count += 1;
+            break;
+
+        case RegexOpSplit:
+            Execution->Stack[StackSize].Instruction = Current->Alternate;
+            Execution->Stack[StackSize + 1].Instruction = Current->Target;
+            StackSize += 2;
+            break;
+
+        case RegexOpJump:
+            Execution->Stack[StackSize].Instruction = Current->Target;
+            StackSize += 1;
+            break;
+
+        //
+        // Saves and loop marks record the current position in a slot. Push
+        // an entry to restore the old value once everything reachable from
+        // here has been added.
+        //
+
+        case RegexOpSave:
+        case RegexOpMarkLoop:
+            Slot = Current->Argument;
+            if (Current->Opcode == RegexOpMarkLoop) {
+                Slot += Execution->CaptureSlotCount;
+
+            } else if (Slot >= Execution->CaptureSlotCount) {
+                Execution->Stack[StackSize].Instruction = InstructionIndex + 1;
+                StackSize += 1;
+                break;
+            }
+
+            Entry = &(Execution->Stack[StackSize]);
+            Entry->Instruction = REGEX_RESTORE_SLOT;
+            Entry->Slot = Slot;
+            Entry->Value = Slots[Slot];
+            Slots[Slot] = Index;
+            Execution->Stack[StackSize + 1].Instruction = InstructionIndex + 1;
+            StackSize += 2;
+            break;
+
+        //
+        // Leave the loop if this iteration didn't consume anything.
+        //
+
+        case RegexOpCheckLoop:
+            Slot = Current->Argument + Execution->CaptureSlotCount;
+            if (Slots[Slot] == Index) {
+                Execution->Stack[StackSize].Instruction = Current->Alternate;
+
+            } else {
+                Execution->Stack[StackSize].Instruction = Current->Target;
+            }
+
+            StackSize += 1;
+            break;
+
+        case RegexOpAssert:
+            if (ClpTestRegexAssertion(Program,
+                                      Current->Argument,
+                                      Context,
+                                      Next) != FALSE) {
+
+                Execution->Stack[StackSize].Instruction = InstructionIndex + 1;
+                StackSize += 1;
+            }
+
+            break;
+
+        default:
+
+            assert(FALSE);
+
+            break;
+        }
+    }
+
+    return;
+}
+
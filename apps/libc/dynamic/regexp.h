@@ -200,6 +200,9 @@ typedef struct _REGULAR_BRACKET_EXPRESSION {
 typedef struct _REGULAR_EXPRESSION_ENTRY
     REGULAR_EXPRESSION_ENTRY, *PREGULAR_EXPRESSION_ENTRY;
 
+typedef struct _REGULAR_EXPRESSION_PROGRAM
+    REGULAR_EXPRESSION_PROGRAM, *PREGULAR_EXPRESSION_PROGRAM;
+
 /*++
 
 Structure Description:
@@ -270,12 +273,18 @@ Structure Description:
     BaseEntry - Stores the initial subexpression entry, a slightly modified
         subexpression.
 
+    Program - Stores an optional pointer to the automaton form of the
+        expression. This is built for expressions without back references, and
+        allows them to be executed in time linear in the input size. If this
+        is NULL, the backtracking matcher is used.
+
 --*/
 
 typedef struct _REGULAR_EXPRESSION {
     ULONG SubexpressionCount;
     ULONG Flags;
     REGULAR_EXPRESSION_ENTRY BaseEntry;
+    PREGULAR_EXPRESSION_PROGRAM Program;
 } REGULAR_EXPRESSION, *PREGULAR_EXPRESSION;
 
 //
@@ -285,3 +294,132 @@ typedef struct _REGULAR_EXPRESSION {
 //
 // -------------------------------------------------------- Function Prototypes
 //
+
+//
+// Functions implemented by the backtracking matcher.
+//
+
+BOOL
+ClpRegularExpressionMatchBracketCharacter (
+    PREGULAR_EXPRESSION Expression,
+    PREGULAR_EXPRESSION_ENTRY Entry,
+    CHAR Character
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines if the given character is a member of the given
+    bracket expression.
+
+Arguments:
+
+    Expression - Supplies a pointer to the compiled regular expression the
+        entry belongs to.
+
+    Entry - Supplies a pointer to the bracket expression entry.
+
+    Character - Supplies the character to test. This should not be the null
+        terminator.
+
+Return Value:
+
+    TRUE if the character matches the bracket expression (taking negation into
+    account).
+
+    FALSE if the character does not match.
+
+--*/
+
+//
+// Functions implemented by the automaton matcher.
+//
+
+VOID
+ClpCreateRegularExpressionProgram (
+    PREGULAR_EXPRESSION Expression
+    );
+
+/*++
+
+Routine Description:
+
+    This routine attempts to convert a parsed regular expression into an
+    automaton program that can be executed without backtracking. Expressions
+    that contain back references or that expand into too many instructions are
+    left without a program, and will be executed by the backtracking matcher.
+
+Arguments:
+
+    Expression - Supplies a pointer to the parsed regular expression. On
+        success, the program pointer will be filled in.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+ClpDestroyRegularExpressionProgram (
+    PREGULAR_EXPRESSION_PROGRAM Program
+    );
+
+/*++
+
+Routine Description:
+
+    This routine destroys a regular expression automaton program.
+
+Arguments:
+
+    Program - Supplies a pointer to the program to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+REGULAR_EXPRESSION_STATUS
+ClpExecuteRegularExpressionProgram (
+    PREGULAR_EXPRESSION Expression,
+    PSTR String,
+    regmatch_t Match[],
+    size_t MatchArraySize,
+    int Flags
+    );
+
+/*++
+
+Routine Description:
+
+    This routine executes a regular expression using its automaton program,
+    searching the given string for the leftmost match.
+
+Arguments:
+
+    Expression - Supplies a pointer to the compiled regular expression, which
+        must have a program.
+
+    String - Supplies a pointer to the string to check for a match.
+
+    Match - Supplies an optional pointer to an array where the string indices of
+        the match and its subexpressions will be returned.
+
+    MatchArraySize - Supplies the number of elements in the match array
+        parameter. Supply zero and the match array parameter will be ignored.
+
+    Flags - Supplies a bitfield of flags governing the search. See some REG_*
+        definitions (specifically REG_NOTBOL and REG_NOTEOL).
+
+Return Value:
+
+    Success if there was a match.
+
+    No match if there was no match.
+
+    No memory if the execution state could not be allocated.
+
+--*/
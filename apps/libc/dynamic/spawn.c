@@ -33,8 +33,11 @@ Module Name:
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <spawn.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -42,6 +45,13 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define the size of the stack a child borrowing its parent's address space
+// runs on until it executes the new image.
+//
+
+#define POSIX_SPAWN_STACK_SIZE 0x10000
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -195,6 +205,40 @@ typedef struct _POSIX_SPAWN_FILE_ENTRY {
 
 } POSIX_SPAWN_FILE_ENTRY, *PPOSIX_SPAWN_FILE_ENTRY;
 
+/*++
+
+Structure Description:
+
+    This structure stores the state shared between the parent and a child
+    that borrows the parent's address space to spawn an image.
+
+Members:
+
+    FileActions - Stores an optional pointer to the file actions to perform
+        in the child.
+
+    Attributes - Stores an optional pointer to the spawn attributes to put into
+        effect in the child.
+
+    Environment - Stores a pointer to the kernel process environment of the
+        image to execute, created ahead of time by the parent.
+
+    SignalMask - Stores the parent's signal mask from before the spawn, which
+        the child starts with.
+
+    Error - Stores the error number from the child if it failed to execute
+        the image.
+
+--*/
+
+typedef struct _POSIX_SPAWN_CONTEXT {
+    PPOSIX_SPAWN_FILE_ACTION FileActions;
+    PPOSIX_SPAWN_ATTRIBUTES Attributes;
+    PPROCESS_ENVIRONMENT Environment;
+    sigset_t SignalMask;
+    volatile INT Error;
+} POSIX_SPAWN_CONTEXT, *PPOSIX_SPAWN_CONTEXT;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -210,6 +254,25 @@ ClpPosixSpawn (
     BOOL UsePath
     );
 
+INT
+ClpPosixSpawnShared (
+    PPOSIX_SPAWN_CONTEXT Context,
+    pid_t *ChildPid
+    );
+
+VOID
+ClpPosixSpawnSharedChild (
+    PVOID Parameter
+    );
+
+PPROCESS_ENVIRONMENT
+ClpCreateSpawnEnvironment (
+    const char *Path,
+    char *const Arguments[],
+    char *const Environment[],
+    BOOL UsePath
+    );
+
 INT
 ClpProcessSpawnAttributes (
     PPOSIX_SPAWN_ATTRIBUTES Attributes
@@ -1184,11 +1247,44 @@ Return Value:
 
 {
 
-    volatile int Error;
+    POSIX_SPAWN_CONTEXT Context;
+    int Error;
     pid_t Pid;
 
+    if (Environment == NULL) {
+        Environment = environ;
+    }
+
+    //
+    // Most of the time the image can be resolved and its environment built
+    // up front, in which case the child can borrow this process' address
+    // space rather than copying all of it just to throw it away on exec.
+    //
+
+    Context.Environment = ClpCreateSpawnEnvironment(Path,
+                                                    Arguments,
+                                                    Environment,
+                                                    UsePath);
+
+    if (Context.Environment != NULL) {
+        Context.FileActions = NULL;
+        if (FileActions != NULL) {
+            Context.FileActions = *FileActions;
+        }
+
+        Context.Attributes = NULL;
+        if (Attributes != NULL) {
+            Context.Attributes = *Attributes;
+        }
+
+        Error = ClpPosixSpawnShared(&Context, ChildPid);
+        OsDestroyEnvironment(Context.Environment);
+        return Error;
+    }
+
     //
-    // TODO: Use vfork when it is implemented.
+    // Scripts that need an interpreter and images not found on the path go
+    // through the full exec routines in a forked child.
     //
 
     Error = 0;
@@ -1197,9 +1293,9 @@ Return Value:
         return errno;
 
     //
-    // In the child, process the attributes and execute the image. With vfork,
-    // the values set in error here will be accessible by the parent, since
-    // vfork temporarily shares the memory of the parent.
+    // In the child, process the attributes and execute the image. The error
+    // set here is not visible to the parent, which will only see the exit
+    // status.
     //
 
     } else if (Pid == 0) {
@@ -1217,10 +1313,6 @@ Return Value:
             }
         }
 
-        if (Environment == NULL) {
-            Environment = environ;
-        }
-
         if (UsePath != FALSE) {
             execvpe(Path, Arguments, Environment);
 
@@ -1232,7 +1324,6 @@ Return Value:
         // Oops, getting this far means exec didn't succeed. Fail.
         //
 
-        Error = errno;
         _exit(127);
 
     //
@@ -1240,24 +1331,344 @@ Return Value:
     //
 
     } else {
+        if (ChildPid != NULL) {
+            *ChildPid = Pid;
+        }
+    }
 
-        //
-        // If the child had a problem, then with vfork the error variable will
-        // be set, and this routine can return a more detailed status. Reap the
-        // child here.
-        //
+    return Error;
+}
 
-        if (Error != 0) {
-            waitpid(Pid, NULL, 0);
+INT
+ClpPosixSpawnShared (
+    PPOSIX_SPAWN_CONTEXT Context,
+    pid_t *ChildPid
+    )
 
-        } else {
-            if (ChildPid != NULL) {
-                *ChildPid = Pid;
+/*++
+
+Routine Description:
+
+    This routine spawns a child that borrows the current process' address
+    space until it executes the new image. The calling thread is suspended
+    until the child has either executed the image or failed.
+
+Arguments:
+
+    Context - Supplies a pointer to the spawn context, with the environment,
+        file actions, and attributes filled in.
+
+    ChildPid - Supplies an optional pointer where the child process ID will be
+        returned on success.
+
+Return Value:
+
+    0 on success.
+
+    Returns an error number on failure.
+
+--*/
+
+{
+
+    sigset_t AllSignals;
+    PROCESS_ID Pid;
+    INT SavedError;
+    PVOID Stack;
+    KSTATUS Status;
+
+    //
+    // The child cannot run on this thread's stack, since this thread's frames
+    // are still live.
+    //
+
+    Stack = mmap(NULL,
+                 POSIX_SPAWN_STACK_SIZE,
+                 PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS,
+                 -1,
+                 0);
+
+    if (Stack == MAP_FAILED) {
+        return errno;
+    }
+
+    //
+    // Block all signals so that none of this process' signal handlers run in
+    // the child before it gets a chance to reset them. The child restores
+    // the original mask once it has.
+    //
+
+    sigfillset(&AllSignals);
+    sigprocmask(SIG_SETMASK, &AllSignals, &(Context->SignalMask));
+    Context->Error = 0;
+
+    //
+    // The child runs on this thread's thread pointer, so any C library call
+    // it makes writes this thread's errno. Put it back once the child is gone,
+    // since the child reports its failures through the context instead.
+    //
+
+    SavedError = errno;
+    Status = OsVforkProcess(0,
+                            ClpPosixSpawnSharedChild,
+                            Context,
+                            Stack,
+                            POSIX_SPAWN_STACK_SIZE,
+                            &Pid);
+
+    errno = SavedError;
+    sigprocmask(SIG_SETMASK, &(Context->SignalMask), NULL);
+    munmap(Stack, POSIX_SPAWN_STACK_SIZE);
+    if (!KSUCCESS(Status)) {
+        return ClConvertKstatusToErrorNumber(Status);
+    }
+
+    //
+    // If the child failed, it has already exited by the time the parent
+    // runs again. Reap it and return the more detailed error.
+    //
+
+    if (Context->Error != 0) {
+        waitpid(Pid, NULL, 0);
+        return Context->Error;
+    }
+
+    if (ChildPid != NULL) {
+        *ChildPid = Pid;
+    }
+
+    return 0;
+}
+
+VOID
+ClpPosixSpawnSharedChild (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine runs in a spawned child that is borrowing its parent's
+    address space. It puts the spawn attributes and file actions into effect
+    and executes the image. It must not allocate memory or change any C
+    library state, as that all belongs to the parent. Even errno is shared
+    with the calling thread, so failures are reported only through the
+    context's error field, and the parent restores its errno afterwards.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the spawn context.
+
+Return Value:
+
+    Does not return.
+
+--*/
+
+{
+
+    PPOSIX_SPAWN_CONTEXT Context;
+    INT Error;
+    SIGNAL_SET Signals;
+    KSTATUS Status;
+
+    Context = Parameter;
+
+    //
+    // The parent's signal handlers must never run in the child. Reset them
+    // with the kernel directly, leaving the C library's handler table (which
+    // belongs to the parent) alone. Only then restore the original mask.
+    //
+
+    FILL_SIGNAL_SET(Signals);
+    OsSetSignalBehavior(SignalMaskHandled, SignalMaskOperationClear, &Signals);
+    sigprocmask(SIG_SETMASK, &(Context->SignalMask), NULL);
+    Error = 0;
+    if (Context->Attributes != NULL) {
+        Error = ClpProcessSpawnAttributes(Context->Attributes);
+    }
+
+    if ((Error == 0) && (Context->FileActions != NULL)) {
+        Error = ClpProcessSpawnFileActions(Context->FileActions);
+    }
+
+    if (Error == 0) {
+        Status = OsExecuteImage(Context->Environment);
+        Error = ClConvertKstatusToErrorNumber(Status);
+    }
+
+    Context->Error = Error;
+    _exit(127);
+}
+
+PPROCESS_ENVIRONMENT
+ClpCreateSpawnEnvironment (
+    const char *Path,
+    char *const Arguments[],
+    char *const Environment[],
+    BOOL UsePath
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resolves the image to spawn and creates its kernel process
+    environment ahead of time, so that a child borrowing the parent's address
+    space does not have to allocate anything.
+
+Arguments:
+
+    Path - Supplies a pointer to the file path to execute.
+
+    Arguments - Supplies the arguments to pass to the new child.
+
+    Environment - Supplies the environment to pass to the new child.
+
+    UsePath - Supplies a boolean indicating whether to search the PATH for the
+        image the way the exec*p functions do.
+
+Return Value:
+
+    Returns a pointer to the new process environment on success.
+
+    NULL if the image could not be found, is a script that needs an
+    interpreter, or there was not enough memory. The caller should spawn the
+    child with the full exec routines instead.
+
+--*/
+
+{
+
+    UINTN ArgumentCount;
+    UINTN ArgumentValuesTotalLength;
+    ssize_t BytesRead;
+    PSTR CombinedPath;
+    INT Descriptor;
+    UINTN EnvironmentCount;
+    UINTN EnvironmentValuesTotalLength;
+    size_t FileLength;
+    CHAR Header[2];
+    const char *ImagePath;
+    PPROCESS_ENVIRONMENT ProcessEnvironment;
+    const char *PathEntry;
+    const char *PathEntryEnd;
+    size_t PathEntryLength;
+    PSTR PathVariable;
+
+    CombinedPath = NULL;
+    ImagePath = Path;
+    ProcessEnvironment = NULL;
+
+    //
+    // Search the path the same way execvpe does, taking the first executable
+    // match.
+    //
+
+    PathVariable = NULL;
+    if (UsePath != FALSE) {
+        PathVariable = getenv("PATH");
+    }
+
+    if ((PathVariable != NULL) && (*PathVariable != '\0') &&
+        (strchr(Path, '/') == NULL)) {
+
+        FileLength = strlen(Path);
+        CombinedPath = malloc(strlen(PathVariable) + FileLength + 2);
+        if (CombinedPath == NULL) {
+            goto CreateSpawnEnvironmentEnd;
+        }
+
+        ImagePath = NULL;
+        PathEntry = PathVariable;
+        while (*PathEntry != '\0') {
+            PathEntryEnd = strchr(PathEntry, ':');
+            if (PathEntryEnd == NULL) {
+                PathEntryEnd = PathEntry + strlen(PathEntry);
+            }
+
+            PathEntryLength = PathEntryEnd - PathEntry;
+            if (PathEntryLength != 0) {
+                memcpy(CombinedPath, PathEntry, PathEntryLength);
+                if (CombinedPath[PathEntryLength - 1] == '/') {
+                    PathEntryLength -= 1;
+                }
+
+                CombinedPath[PathEntryLength] = '/';
+                strcpy(CombinedPath + PathEntryLength + 1, Path);
+                if (access(CombinedPath, X_OK) == 0) {
+                    ImagePath = CombinedPath;
+                    break;
+                }
             }
+
+            PathEntry = PathEntryEnd;
+            if (*PathEntry == ':') {
+                PathEntry += 1;
+            }
+        }
+
+        if (ImagePath == NULL) {
+            goto CreateSpawnEnvironmentEnd;
         }
     }
 
-    return Error;
+    //
+    // Leave scripts to execve, which knows how to find their interpreter.
+    //
+
+    Descriptor = open(ImagePath, O_RDONLY);
+    if (Descriptor < 0) {
+        goto CreateSpawnEnvironmentEnd;
+    }
+
+    do {
+        BytesRead = read(Descriptor, Header, sizeof(Header));
+
+    } while ((BytesRead < 0) && (errno == EINTR));
+
+    close(Descriptor);
+    if ((BytesRead == sizeof(Header)) &&
+        (Header[0] == '#') && (Header[1] == '!')) {
+
+        goto CreateSpawnEnvironmentEnd;
+    }
+
+    ArgumentCount = 0;
+    ArgumentValuesTotalLength = 0;
+    while (Arguments[ArgumentCount] != NULL) {
+        ArgumentValuesTotalLength += strlen(Arguments[ArgumentCount]) + 1;
+        ArgumentCount += 1;
+    }
+
+    EnvironmentCount = 0;
+    EnvironmentValuesTotalLength = 0;
+    if (Environment != NULL) {
+        while (Environment[EnvironmentCount] != NULL) {
+            EnvironmentValuesTotalLength +=
+                                     strlen(Environment[EnvironmentCount]) + 1;
+
+            EnvironmentCount += 1;
+        }
+    }
+
+    ProcessEnvironment = OsCreateEnvironment((PSTR)ImagePath,
+                                             strlen(ImagePath) + 1,
+                                             (PSTR *)Arguments,
+                                             ArgumentValuesTotalLength,
+                                             ArgumentCount,
+                                             (PSTR *)Environment,
+                                             EnvironmentValuesTotalLength,
+                                             EnvironmentCount);
+
+CreateSpawnEnvironmentEnd:
+    if (CombinedPath != NULL) {
+        free(CombinedPath);
+    }
+
+    return ProcessEnvironment;
 }
 
 INT
@@ -1286,8 +1697,17 @@ Return Value:
 
 {
 
-    struct sigaction Action;
-    int Signal;
+    ULONG Fields;
+    THREAD_IDENTITY Identity;
+    SIGNAL_SET Signals;
+    KSTATUS Status;
+
+    //
+    // This runs in children that may be borrowing the parent's address space,
+    // so the C library's cached identity and signal handler table are left
+    // alone in favor of calling the kernel directly. They don't survive the
+    // exec anyway.
+    //
 
     if ((Attributes->Flags & POSIX_SPAWN_SETPGROUP) != 0) {
         if (setpgid(0, Attributes->ProcessGroup) != 0) {
@@ -1300,12 +1720,18 @@ Return Value:
     //
 
     if ((Attributes->Flags & POSIX_SPAWN_RESETIDS) != 0) {
-        if (setegid(getgid()) != 0) {
-            return errno;
+        Status = OsSetThreadIdentity(0, &Identity);
+        if (KSUCCESS(Status)) {
+            Identity.EffectiveGroupId = Identity.RealGroupId;
+            Identity.EffectiveUserId = Identity.RealUserId;
+            Fields = THREAD_IDENTITY_FIELD_EFFECTIVE_GROUP_ID |
+                     THREAD_IDENTITY_FIELD_EFFECTIVE_USER_ID;
+
+            Status = OsSetThreadIdentity(Fields, &Identity);
         }
 
-        if (seteuid(getuid()) != 0) {
-            return errno;
+        if (!KSUCCESS(Status)) {
+            return ClConvertKstatusToErrorNumber(Status);
         }
     }
 
@@ -1321,15 +1747,14 @@ Return Value:
     //
 
     if ((Attributes->Flags & POSIX_SPAWN_SETSIGDEF) != 0) {
-        memset(&Action, 0, sizeof(Action));
-        Action.sa_handler = SIG_DFL;
-        for (Signal = 1; Signal < NSIG; Signal += 1) {
-            if (sigismember(&(Attributes->DefaultMask), Signal) != 0) {
-                if (sigaction(Signal, &Action, NULL) != 0) {
-                    return errno;
-                }
-            }
-        }
+        Signals = Attributes->DefaultMask;
+        OsSetSignalBehavior(SignalMaskHandled,
+                            SignalMaskOperationClear,
+                            &Signals);
+
+        OsSetSignalBehavior(SignalMaskIgnored,
+                            SignalMaskOperationClear,
+                            &Signals);
     }
 
     return 0;
@@ -45,10 +45,200 @@ Module Name:
 // ------------------------------------------------------ Data Type Definitions
 //
 
+typedef
+PVOID
+(*PCL_COPY_MEMORY_ROUTINE) (
+    PVOID Destination,
+    PCVOID Source,
+    UINTN ByteCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine copies a section of memory. The buffers do not overlap.
+
+Arguments:
+
+    Destination - Supplies a pointer to the buffer where the memory will be
+        copied to.
+
+    Source - Supplies a pointer to the buffer to be copied.
+
+    ByteCount - Supplies the number of bytes to copy.
+
+Return Value:
+
+    Returns the destination pointer.
+
+--*/
+
+typedef
+VOID
+(*PCL_SET_MEMORY_ROUTINE) (
+    PVOID Buffer,
+    INT Byte,
+    UINTN Count
+    );
+
+/*++
+
+Routine Description:
+
+    This routine writes the given byte value repeatedly into a region of memory.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the buffer to set.
+
+    Byte - Supplies the byte to set.
+
+    Count - Supplies the number of bytes to set.
+
+Return Value:
+
+    None.
+
+--*/
+
+typedef
+UINTN
+(*PCL_FIND_MEMORY_DIFFERENCE_ROUTINE) (
+    PCVOID FirstBuffer,
+    PCVOID SecondBuffer,
+    UINTN Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds the first byte where two buffers differ.
+
+Arguments:
+
+    FirstBuffer - Supplies a pointer to the first buffer to compare.
+
+    SecondBuffer - Supplies a pointer to the second buffer to compare.
+
+    Size - Supplies the number of bytes to compare.
+
+Return Value:
+
+    Returns the offset of the first byte that differs, or the size if the
+    buffers are equal.
+
+--*/
+
+typedef
+UINTN
+(*PCL_STRING_LENGTH_ROUTINE) (
+    PCSTR String
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines the length of the given string, not including its
+    null terminator.
+
+Arguments:
+
+    String - Supplies a pointer to the beginning of the string.
+
+Return Value:
+
+    Returns the length of the string.
+
+--*/
+
+typedef
+PVOID
+(*PCL_FIND_MEMORY_CHARACTER_ROUTINE) (
+    PCVOID Buffer,
+    INT Character,
+    UINTN Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds the first occurrence of a byte in a buffer.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the buffer to search.
+
+    Character - Supplies the byte to search for.
+
+    Size - Supplies the size of the buffer in bytes.
+
+Return Value:
+
+    Returns a pointer to the first occurrence of the byte, or NULL if the byte
+    does not occur in the buffer.
+
+--*/
+
+typedef
+PSTR
+(*PCL_STRING_FIND_CHARACTER_ROUTINE) (
+    PCSTR String,
+    INT Character
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds the first occurrence of a character or the null
+    terminator in a string.
+
+Arguments:
+
+    String - Supplies a pointer to the string to search.
+
+    Character - Supplies the character to search for.
+
+Return Value:
+
+    Returns a pointer to the first occurrence of the character, or to the null
+    terminator if the character does not occur in the string.
+
+--*/
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+UINTN
+ClpFindMemoryDifference (
+    PCVOID FirstBuffer,
+    PCVOID SecondBuffer,
+    UINTN Size
+    );
+
+UINTN
+ClpStringLength (
+    PCSTR String
+    );
+
+PVOID
+ClpFindMemoryCharacter (
+    PCVOID Buffer,
+    INT Character,
+    UINTN Size
+    );
+
+PSTR
+ClpStringFindCharacter (
+    PCSTR String,
+    INT Character
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -59,6 +249,43 @@ Module Name:
 
 char *ClStringTokenizerContext;
 
+//
+// Store pointers to the routines that back the core memory and string
+// functions. These start out pointing at routines that work on any processor,
+// and are switched to the vector implementations during initialization if the
+// processor supports them. x64 always has SSE2.
+//
+
+#if defined(__amd64)
+
+PCL_COPY_MEMORY_ROUTINE ClCopyMemoryRoutine = RtlVectorCopyMemory;
+PCL_SET_MEMORY_ROUTINE ClSetMemoryRoutine = RtlVectorSetMemory;
+PCL_FIND_MEMORY_DIFFERENCE_ROUTINE ClFindMemoryDifferenceRoutine =
+                                                 RtlVectorFindMemoryDifference;
+
+PCL_STRING_LENGTH_ROUTINE ClStringLengthRoutine = RtlVectorStringLength;
+PCL_FIND_MEMORY_CHARACTER_ROUTINE ClFindMemoryCharacterRoutine =
+                                                  RtlVectorFindMemoryCharacter;
+
+PCL_STRING_FIND_CHARACTER_ROUTINE ClStringFindCharacterRoutine =
+                                                  RtlVectorStringFindCharacter;
+
+#else
+
+PCL_COPY_MEMORY_ROUTINE ClCopyMemoryRoutine = RtlCopyMemory;
+PCL_SET_MEMORY_ROUTINE ClSetMemoryRoutine = RtlSetMemory;
+PCL_FIND_MEMORY_DIFFERENCE_ROUTINE ClFindMemoryDifferenceRoutine =
+                                                       ClpFindMemoryDifference;
+
+PCL_STRING_LENGTH_ROUTINE ClStringLengthRoutine = ClpStringLength;
+PCL_FIND_MEMORY_CHARACTER_ROUTINE ClFindMemoryCharacterRoutine =
+                                                        ClpFindMemoryCharacter;
+
+PCL_STRING_FIND_CHARACTER_ROUTINE ClStringFindCharacterRoutine =
+                                                        ClpStringFindCharacter;
+
+#endif
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -98,19 +325,7 @@ Return Value:
 
 {
 
-    PSTR CharacterBuffer;
-
-    CharacterBuffer = (PSTR)Buffer;
-    while (Size != 0) {
-        if ((unsigned char)*CharacterBuffer == (unsigned char)Character) {
-            return CharacterBuffer;
-        }
-
-        CharacterBuffer += 1;
-        Size -= 1;
-    }
-
-    return NULL;
+    return ClFindMemoryCharacterRoutine(Buffer, Character, Size);
 }
 
 LIBC_API
@@ -147,24 +362,15 @@ Return Value:
 
 {
 
-    int Difference;
     size_t Index;
-    unsigned char *LeftCharacters;
-    unsigned char *RightCharacters;
 
-    LeftCharacters = (unsigned char *)Left;
-    RightCharacters = (unsigned char *)Right;
-    for (Index = 0; Index < Size; Index += 1) {
-        Difference = *LeftCharacters - *RightCharacters;
-        if (Difference != 0) {
-            return Difference;
-        }
-
-        LeftCharacters += 1;
-        RightCharacters += 1;
+    Index = ClFindMemoryDifferenceRoutine(Left, Right, Size);
+    if (Index >= Size) {
+        return 0;
     }
 
-    return 0;
+    return ((const unsigned char *)Left)[Index] -
+           ((const unsigned char *)Right)[Index];
 }
 
 LIBC_API
@@ -197,7 +403,7 @@ Return Value:
 
 {
 
-    return RtlCopyMemory(Destination, (PVOID)Source, ByteCount);
+    return ClCopyMemoryRoutine(Destination, Source, ByteCount);
 }
 
 LIBC_API
@@ -287,7 +493,7 @@ Return Value:
 
 {
 
-    RtlSetMemory(Destination, Character, ByteCount);
+    ClSetMemoryRoutine(Destination, Character, ByteCount);
     return Destination;
 }
 
@@ -484,16 +690,11 @@ Return Value:
 
 {
 
-    while (TRUE) {
-        if (*String == (char)Character) {
-            return (char *)String;
-        }
-
-        if (*String == '\0') {
-            break;
-        }
+    char *Result;
 
-        String += 1;
+    Result = ClStringFindCharacterRoutine(String, Character);
+    if (*Result == (char)Character) {
+        return Result;
     }
 
     return NULL;
@@ -571,7 +772,7 @@ Return Value:
 
 {
 
-    return RtlStringLength((PSTR)String);
+    return ClStringLengthRoutine(String);
 }
 
 LIBC_API
@@ -1880,7 +2081,221 @@ Return Value:
     return;
 }
 
+VOID
+ClpInitializeStringRoutines (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine selects the implementations of the core memory and string
+    routines best suited to the current processor.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+#if defined(__i386)
+
+    if (OsTestProcessorFeature(OsX86Sse2) == FALSE) {
+        return;
+    }
+
+#elif defined(__arm__)
+
+    if (OsTestProcessorFeature(OsArmNeon32) == FALSE) {
+        return;
+    }
+
+#elif defined(__amd64)
+
+    return;
+
+#else
+
+#error Unknown Architecture
+
+#endif
+
+#if !defined(__amd64)
+
+    ClCopyMemoryRoutine = RtlVectorCopyMemory;
+    ClSetMemoryRoutine = RtlVectorSetMemory;
+    ClFindMemoryDifferenceRoutine = RtlVectorFindMemoryDifference;
+    ClStringLengthRoutine = RtlVectorStringLength;
+    ClFindMemoryCharacterRoutine = RtlVectorFindMemoryCharacter;
+    ClStringFindCharacterRoutine = RtlVectorStringFindCharacter;
+
+#endif
+
+    return;
+}
+
 //
 // --------------------------------------------------------- Internal Functions
 //
 
+UINTN
+ClpFindMemoryDifference (
+    PCVOID FirstBuffer,
+    PCVOID SecondBuffer,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the first byte where two buffers differ, one byte at a
+    time.
+
+Arguments:
+
+    FirstBuffer - Supplies a pointer to the first buffer to compare.
+
+    SecondBuffer - Supplies a pointer to the second buffer to compare.
+
+    Size - Supplies the number of bytes to compare.
+
+Return Value:
+
+    Returns the offset of the first byte that differs, or the size if the
+    buffers are equal.
+
+--*/
+
+{
+
+    const unsigned char *FirstBytes;
+    UINTN Index;
+    const unsigned char *SecondBytes;
+
+    FirstBytes = FirstBuffer;
+    SecondBytes = SecondBuffer;
+    for (Index = 0; Index < Size; Index += 1) {
+        if (FirstBytes[Index] != SecondBytes[Index]) {
+            break;
+        }
+    }
+
+    return Index;
+}
+
+UINTN
+ClpStringLength (
+    PCSTR String
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines the length of the given string, not including its
+    null terminator.
+
+Arguments:
+
+    String - Supplies a pointer to the beginning of the string.
+
+Return Value:
+
+    Returns the length of the string.
+
+--*/
+
+{
+
+    return RtlStringLength(String);
+}
+
+PVOID
+ClpFindMemoryCharacter (
+    PCVOID Buffer,
+    INT Character,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the first occurrence of a byte in a buffer, one byte at
+    a time.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the buffer to search.
+
+    Character - Supplies the byte to search for.
+
+    Size - Supplies the size of the buffer in bytes.
+
+Return Value:
+
+    Returns a pointer to the first occurrence of the byte, or NULL if the byte
+    does not occur in the buffer.
+
+--*/
+
+{
+
+    PSTR CharacterBuffer;
+
+    CharacterBuffer = (PSTR)Buffer;
+    while (Size != 0) {
+        if ((unsigned char)*CharacterBuffer == (unsigned char)Character) {
+            return CharacterBuffer;
+        }
+
+        CharacterBuffer += 1;
+        Size -= 1;
+    }
+
+    return NULL;
+}
+
+PSTR
+ClpStringFindCharacter (
+    PCSTR String,
+    INT Character
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the first occurrence of a character or the null
+    terminator in a string, one byte at a time.
+
+Arguments:
+
+    String - Supplies a pointer to the string to search.
+
+    Character - Supplies the character to search for.
+
+Return Value:
+
+    Returns a pointer to the first occurrence of the character, or to the null
+    terminator if the character does not occur in the string.
+
+--*/
+
+{
+
+    while ((*String != (CHAR)Character) && (*String != '\0')) {
+        String += 1;
+    }
+
+    return (PSTR)String;
+}
+
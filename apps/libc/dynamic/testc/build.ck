@@ -47,6 +47,7 @@ function build() {
 
     buildLibs = [
         "apps/libc/dynamic:build_libc",
+        "lib/rtl/base:build_basertl",
     ];
 
     includes = [
@@ -39,6 +39,7 @@ Module Name:
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -46,10 +47,28 @@ Module Name:
 
 #define TEST_QUICKSORT_ARRAY_COUNT 1000
 
+//
+// Define the most comparisons a sort of the test array may use. This is
+// several times n log2 n, well short of the n^2 / 2 a quadratic case uses.
+//
+
+#define TEST_QUICKSORT_MAX_COMPARES (TEST_QUICKSORT_ARRAY_COUNT * 10 * 4)
+
+//
+// Define the size of the odd sized records used to test bytewise swapping.
+//
+
+#define TEST_QUICKSORT_RECORD_DATA_SIZE 9
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+typedef struct _TEST_QUICKSORT_RECORD {
+    UCHAR Key[2];
+    UCHAR Data[TEST_QUICKSORT_RECORD_DATA_SIZE];
+} PACKED TEST_QUICKSORT_RECORD, *PTEST_QUICKSORT_RECORD;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -62,17 +81,43 @@ TestQuickSortCase (
     BOOL ExactSet
     );
 
+ULONG
+TestQuickSortWithContext (
+    ULONG TestIndex,
+    PULONG Array,
+    ULONG ArrayCount
+    );
+
+ULONG
+TestQuickSortRecords (
+    VOID
+    );
+
 int
 TestQuickSortCompare (
     const void *Left,
     const void *Right
     );
 
+int
+TestQuickSortCompareWithContext (
+    const void *Left,
+    const void *Right,
+    void *Context
+    );
+
+int
+TestQuickSortCompareRecords (
+    const void *Left,
+    const void *Right
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 ULONG TestQuickSortArray[TEST_QUICKSORT_ARRAY_COUNT];
+TEST_QUICKSORT_RECORD TestQuickSortRecordArray[TEST_QUICKSORT_ARRAY_COUNT];
 
 //
 // ------------------------------------------------------------------ Functions
@@ -229,6 +274,42 @@ Return Value:
                                   FALSE);
 
     Case += 1;
+
+    //
+    // Make sure presorted, reversed, and organ pipe inputs don't go quadratic.
+    //
+
+    for (Index = 0; Index < TEST_QUICKSORT_ARRAY_COUNT; Index += 1) {
+        Array[Index] = Index;
+    }
+
+    Failures += TestQuickSortWithContext(Case,
+                                         Array,
+                                         TEST_QUICKSORT_ARRAY_COUNT);
+
+    Case += 1;
+    for (Index = 0; Index < TEST_QUICKSORT_ARRAY_COUNT; Index += 1) {
+        Array[Index] = TEST_QUICKSORT_ARRAY_COUNT - Index;
+    }
+
+    Failures += TestQuickSortWithContext(Case,
+                                         Array,
+                                         TEST_QUICKSORT_ARRAY_COUNT);
+
+    Case += 1;
+    for (Index = 0; Index < TEST_QUICKSORT_ARRAY_COUNT; Index += 1) {
+        Array[Index] = Index;
+        if (Index >= TEST_QUICKSORT_ARRAY_COUNT / 2) {
+            Array[Index] = TEST_QUICKSORT_ARRAY_COUNT - Index;
+        }
+    }
+
+    Failures += TestQuickSortWithContext(Case,
+                                         Array,
+                                         TEST_QUICKSORT_ARRAY_COUNT);
+
+    Case += 1;
+    Failures += TestQuickSortRecords();
     return Failures;
 }
 
@@ -317,6 +398,139 @@ Return Value:
     return 0;
 }
 
+ULONG
+TestQuickSortWithContext (
+    ULONG TestIndex,
+    PULONG Array,
+    ULONG ArrayCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine runs the context variant of quicksort on the given array,
+    and validates the results and the number of comparisons made.
+
+Arguments:
+
+    TestIndex - Supplies the test case number for error printing.
+
+    Array - Supplies a pointer to the array of integers.
+
+    ArrayCount - Supplies the size of the array in elements.
+
+Return Value:
+
+    Returns the number of failures.
+
+--*/
+
+{
+
+    ULONG CompareCount;
+    ULONG Failures;
+    ULONG Index;
+
+    CompareCount = 0;
+    Failures = 0;
+    qsort_r(Array,
+            ArrayCount,
+            sizeof(ULONG),
+            TestQuickSortCompareWithContext,
+            &CompareCount);
+
+    for (Index = 1; Index < ArrayCount; Index += 1) {
+        if (Array[Index] < Array[Index - 1]) {
+            printf("Error: Test case %d failed: index %d had %d in it, but "
+                   "previous value was %d.\n",
+                   TestIndex,
+                   Index,
+                   Array[Index],
+                   Array[Index - 1]);
+
+            Failures += 1;
+            break;
+        }
+    }
+
+    if (CompareCount > TEST_QUICKSORT_MAX_COMPARES) {
+        printf("Error: Test case %d used %d comparisons to sort %d "
+               "elements.\n",
+               TestIndex,
+               CompareCount,
+               ArrayCount);
+
+        Failures += 1;
+    }
+
+    return Failures;
+}
+
+ULONG
+TestQuickSortRecords (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sorts an array of odd sized records, which have to be swapped
+    a byte at a time, and makes sure each record moved intact.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of failures.
+
+--*/
+
+{
+
+    ULONG Failures;
+    ULONG Index;
+    ULONG Key;
+    ULONG PreviousKey;
+    PTEST_QUICKSORT_RECORD Record;
+
+    Failures = 0;
+    for (Index = 0; Index < TEST_QUICKSORT_ARRAY_COUNT; Index += 1) {
+        Record = &(TestQuickSortRecordArray[Index]);
+        Key = rand() % TEST_QUICKSORT_ARRAY_COUNT;
+        Record->Key[0] = Key >> 8;
+        Record->Key[1] = Key & 0xFF;
+        memset(Record->Data, Key & 0xFF, TEST_QUICKSORT_RECORD_DATA_SIZE);
+    }
+
+    qsort(TestQuickSortRecordArray,
+          TEST_QUICKSORT_ARRAY_COUNT,
+          sizeof(TEST_QUICKSORT_RECORD),
+          TestQuickSortCompareRecords);
+
+    PreviousKey = 0;
+    for (Index = 0; Index < TEST_QUICKSORT_ARRAY_COUNT; Index += 1) {
+        Record = &(TestQuickSortRecordArray[Index]);
+        Key = (Record->Key[0] << 8) | Record->Key[1];
+        if ((Key < PreviousKey) ||
+            (Record->Data[0] != (Key & 0xFF)) ||
+            (Record->Data[TEST_QUICKSORT_RECORD_DATA_SIZE - 1] !=
+             (Key & 0xFF))) {
+
+            printf("Error: Record sort failed at index %d.\n", Index);
+            Failures += 1;
+            break;
+        }
+
+        PreviousKey = Key;
+    }
+
+    return Failures;
+}
+
 int
 TestQuickSortCompare (
     const void *Left,
@@ -365,3 +579,77 @@ Return Value:
     return 0;
 }
 
+int
+TestQuickSortCompareWithContext (
+    const void *Left,
+    const void *Right,
+    void *Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two test array elements, and counts the comparison.
+    It is used by the context quicksort function.
+
+Arguments:
+
+    Left - Supplies a pointer into the array of the left side of the comparison.
+
+    Right - Supplies a pointer into the array of the right side of the
+        comparison.
+
+    Context - Supplies a pointer to the comparison count.
+
+Return Value:
+
+    <0 if the left is less than the right.
+
+    0 if the two elements are equal.
+
+    >0 if the left element is greater than the right.
+
+--*/
+
+{
+
+    *((PULONG)Context) += 1;
+    return TestQuickSortCompare(Left, Right);
+}
+
+int
+TestQuickSortCompareRecords (
+    const void *Left,
+    const void *Right
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two test records by their keys.
+
+Arguments:
+
+    Left - Supplies a pointer to the left record.
+
+    Right - Supplies a pointer to the right record.
+
+Return Value:
+
+    <0 if the left is less than the right.
+
+    0 if the two elements are equal.
+
+    >0 if the left element is greater than the right.
+
+--*/
+
+{
+
+    return memcmp(((PTEST_QUICKSORT_RECORD)Left)->Key,
+                  ((PTEST_QUICKSORT_RECORD)Right)->Key,
+                  sizeof(((PTEST_QUICKSORT_RECORD)Left)->Key));
+}
+
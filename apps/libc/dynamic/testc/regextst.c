@@ -644,6 +644,104 @@ REGEX_EXECUTION_TEST_CASE RegexExecutionTestCases[] = {
         REG_NOMATCH,
         {{-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}},
     },
+
+    //
+    // Try a nested repeat that would take exponential time to fail with
+    // backtracking.
+    //
+
+    {
+
+        "(a*)*b", REG_EXTENDED,
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaac", 0,
+        REG_NOMATCH,
+        {{-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}},
+    },
+
+    {
+
+        "(a|aa)*(a|aa)*c", REG_EXTENDED,
+        "xaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaac", 0,
+        0,
+        {{1, 45}, {43, 44}, {-1, -1}, {-1, -1}, {-1, -1}},
+    },
+
+    //
+    // Try a literal prefix that appears several times before the match.
+    //
+
+    {
+
+        "abc(d|e)f", REG_EXTENDED,
+        "abcabcdabcgabcef", 0,
+        0,
+        {{11, 16}, {14, 15}, {-1, -1}, {-1, -1}, {-1, -1}},
+    },
+
+    {
+
+        "\\(xy\\)*z", 0,
+        "xyxyxyq", 0,
+        REG_NOMATCH,
+        {{-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}},
+    },
+
+    //
+    // Alternatives are tried in order, and an unused subexpression has no
+    // match.
+    //
+
+    {
+
+        "(a|ab)(c|bcd)(d*)", REG_EXTENDED,
+        "abcd", 0,
+        0,
+        {{0, 4}, {0, 1}, {1, 4}, {4, 4}, {-1, -1}},
+    },
+
+    {
+
+        "x(a)?|y", REG_EXTENDED,
+        "xy", 0,
+        0,
+        {{0, 1}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}},
+    },
+
+    //
+    // Try a bounded repeat inside an alternation.
+    //
+
+    {
+
+        "a{2}b|x", REG_EXTENDED,
+        "aaaax", 0,
+        0,
+        {{4, 5}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}},
+    },
+
+    //
+    // Anchors apply at each line when newlines are special.
+    //
+
+    {
+
+        "^b+$", REG_EXTENDED | REG_NEWLINE,
+        "abb\nbbb\nc", 0,
+        0,
+        {{4, 7}, {-1, -1}, {-1, -1}, {-1, -1}, {-1, -1}},
+    },
+
+    //
+    // Back references are still handled.
+    //
+
+    {
+
+        "(a*)b\\1", REG_EXTENDED,
+        "aabaab", 0,
+        0,
+        {{0, 5}, {0, 2}, {-1, -1}, {-1, -1}, {-1, -1}},
+    },
 };
 
 //
@@ -249,6 +249,13 @@ BOOL ClDebugCustomTimeZoneParsing;
 
 OS_LOCK ClTimeZoneLock;
 
+//
+// Store each thread's most recently used span of local time, which lets
+// repeated local time conversions avoid the shared time zone state entirely.
+//
+
+__THREAD TIME_ZONE_TRANSITION_CACHE ClTimeZoneTransitionCache;
+
 //
 // Store the timer backing the alarm function.
 //
@@ -1303,7 +1310,11 @@ Return Value:
         return NULL;
     }
 
-    Status = RtlSystemTimeToLocalCalendarTime(&SystemTime, &CalendarTime);
+    Status = RtlSystemTimeToLocalCalendarTimeCached(
+                                                  &SystemTime,
+                                                  &CalendarTime,
+                                                  &ClTimeZoneTransitionCache);
+
     if (!KSUCCESS(Status)) {
         errno = ClConvertKstatusToErrorNumber(Status);
         return NULL;
@@ -111,6 +111,30 @@ extern "C" {
 
 #define F_CLOSEM 11
 
+//
+// Get record locking information for locks owned by the open file
+// description rather than the process.
+//
+
+#define F_OFD_GETLK 12
+
+//
+// Set record locking information owned by the open file description. These
+// locks are shared by all descriptors duplicated from the same open call, are
+// not released when some other descriptor for the file is closed, and
+// conflict with locks held through other open file descriptions, even within
+// the same process.
+//
+
+#define F_OFD_SETLK 13
+
+//
+// Set record locking information owned by the open file description, waiting
+// if blocked.
+//
+
+#define F_OFD_SETLKW 14
+
 //
 // There's no need for 64-bit versions, since off_t is always 64 bits.
 //
@@ -258,6 +282,15 @@ extern "C" {
 #define O_ASYNC 0x00010000
 #define FASYNC O_ASYNC
 
+//
+// Set this flag to transfer data directly between the caller's buffer and the
+// device, bypassing the file cache. The file offset, transfer size, and buffer
+// address must all be aligned to the device block size (the page size for
+// regular files), or the I/O fails with EINVAL.
+//
+
+#define O_DIRECT 0x00020000
+
 //
 // Set this flag to enable opening files whose offsets cannot be described in
 // off_t types but can be described in off64_t. Since off_t is always 64-bits,
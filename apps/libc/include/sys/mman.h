@@ -99,6 +99,12 @@ extern "C" {
 #define MAP_ANONYMOUS 0x0008
 #define MAP_ANON MAP_ANONYMOUS
 
+//
+// Fault in the entire mapping when it is created rather than on first access.
+//
+
+#define MAP_POPULATE 0x0010
+
 //
 // Define flags use for memory synchronization.
 //
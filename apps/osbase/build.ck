@@ -49,6 +49,7 @@ function build() {
     sources = [
         "env.c",
         "heap.c",
+        "ioring.c",
         "osimag.c",
         "osbase.c",
         "rwlock.c",
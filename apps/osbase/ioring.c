@@ -0,0 +1,366 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ioring.c
+
+Abstract:
+
+    This module implements the user mode side of the I/O submission and
+    completion ring.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    User Mode
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include "osbasep.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+OS_API
+KSTATUS
+OsCreateIoRing (
+    ULONG SubmissionCount,
+    ULONG CompletionCount,
+    ULONG WorkerCount,
+    POS_IO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the I/O submission and completion ring for the
+    current process. A process can have only one ring at a time.
+
+Arguments:
+
+    SubmissionCount - Supplies the number of submission entries. This must be
+        a power of two.
+
+    CompletionCount - Supplies the number of completion entries. This must be
+        a power of two, and is usually at least the submission count.
+
+    WorkerCount - Supplies the number of kernel threads to service the ring,
+        which bounds how many blocking operations can be in progress at once.
+        Supply zero to use the default.
+
+    Ring - Supplies a pointer where the ring will be initialized.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PVOID Buffer;
+    SYSTEM_CALL_CREATE_IO_RING Parameters;
+    UINTN Size;
+    KSTATUS Status;
+
+    RtlZeroMemory(Ring, sizeof(OS_IO_RING));
+    if ((SubmissionCount > IO_RING_MAX_ENTRIES) ||
+        (CompletionCount > IO_RING_MAX_ENTRIES)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Size = IO_RING_SIZE(SubmissionCount, CompletionCount);
+    Size = ALIGN_RANGE_UP(Size, OsPageSize);
+    Buffer = NULL;
+    Status = OsMemoryMap(INVALID_HANDLE,
+                         0,
+                         Size,
+                         SYS_MAP_FLAG_ANONYMOUS |
+                         SYS_MAP_FLAG_READ |
+                         SYS_MAP_FLAG_WRITE,
+                         &Buffer);
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Parameters.Buffer = Buffer;
+    Parameters.Size = Size;
+    Parameters.SubmissionCount = SubmissionCount;
+    Parameters.CompletionCount = CompletionCount;
+    Parameters.WorkerCount = WorkerCount;
+    Status = OsSystemCall(SystemCallCreateIoRing, &Parameters);
+    if (!KSUCCESS(Status)) {
+        OsMemoryUnmap(Buffer, Size);
+        return Status;
+    }
+
+    Ring->Header = Buffer;
+    Ring->Submissions = Buffer + IO_RING_SUBMISSIONS_OFFSET;
+    Ring->Completions = Buffer + IO_RING_COMPLETIONS_OFFSET(SubmissionCount);
+    Ring->Size = Size;
+    Ring->SubmissionTail = 0;
+    return STATUS_SUCCESS;
+}
+
+OS_API
+VOID
+OsDestroyIoRing (
+    POS_IO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys the current process' I/O ring. Operations that have
+    not completed are abandoned.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    SYSTEM_CALL_CREATE_IO_RING Parameters;
+
+    if (Ring->Header == NULL) {
+        return;
+    }
+
+    RtlZeroMemory(&Parameters, sizeof(SYSTEM_CALL_CREATE_IO_RING));
+    OsSystemCall(SystemCallCreateIoRing, &Parameters);
+    OsMemoryUnmap(Ring->Header, Ring->Size);
+    RtlZeroMemory(Ring, sizeof(OS_IO_RING));
+    return;
+}
+
+OS_API
+PIO_RING_SUBMISSION
+OsIoRingGetSubmission (
+    POS_IO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the next free submission entry. The entry is not
+    seen by the kernel until the next call to submit. This routine is not
+    thread safe; callers sharing a ring must serialize their submissions.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+Return Value:
+
+    Returns a pointer to a zeroed submission entry for the caller to fill in.
+
+    NULL if the submission array is full.
+
+--*/
+
+{
+
+    PIO_RING_HEADER Header;
+    ULONG Index;
+    PIO_RING_SUBMISSION Submission;
+
+    Header = Ring->Header;
+    if ((Ring->SubmissionTail - Header->SubmissionHead) >=
+        Header->SubmissionCount) {
+
+        return NULL;
+    }
+
+    Index = Ring->SubmissionTail & (Header->SubmissionCount - 1);
+    Submission = &(Ring->Submissions[Index]);
+    RtlZeroMemory(Submission, sizeof(IO_RING_SUBMISSION));
+    Ring->SubmissionTail += 1;
+    return Submission;
+}
+
+OS_API
+KSTATUS
+OsIoRingSubmit (
+    POS_IO_RING Ring,
+    ULONG MinimumCompleteCount,
+    ULONG TimeoutInMilliseconds,
+    PULONG SubmittedCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine publishes all submission entries handed out since the last
+    call and enters the kernel once to start them, optionally waiting for
+    completions. The kernel will not consume more submissions than there is
+    room for in the completion array; anything left over stays published and
+    is picked up by the next call.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    MinimumCompleteCount - Supplies the number of unreaped completions to wait
+        for before returning. Supply zero to not wait.
+
+    TimeoutInMilliseconds - Supplies the maximum time to wait for completions.
+        Use SYS_WAIT_TIME_INDEFINITE to wait forever.
+
+    SubmittedCount - Supplies an optional pointer where the number of entries
+        the kernel consumed will be returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_TIMEOUT or STATUS_INTERRUPTED if nothing was submitted and the wait
+    did not complete.
+
+    Other error codes on failure.
+
+--*/
+
+{
+
+    PIO_RING_HEADER Header;
+    SYSTEM_CALL_ENTER_IO_RING Parameters;
+    INTN Result;
+
+    Header = Ring->Header;
+
+    //
+    // Make sure the entries are filled in before the kernel can see the tail
+    // that covers them.
+    //
+
+    RtlMemoryBarrier();
+    Header->SubmissionTail = Ring->SubmissionTail;
+    Parameters.SubmitCount = Ring->SubmissionTail - Header->SubmissionHead;
+    Parameters.MinimumCompleteCount = MinimumCompleteCount;
+    Parameters.TimeoutInMilliseconds = TimeoutInMilliseconds;
+    if ((Parameters.SubmitCount == 0) && (MinimumCompleteCount == 0)) {
+        Result = 0;
+
+    } else {
+        Result = OsSystemCall(SystemCallEnterIoRing, &Parameters);
+    }
+
+    if (Result < 0) {
+        if (SubmittedCount != NULL) {
+            *SubmittedCount = 0;
+        }
+
+        return (KSTATUS)Result;
+    }
+
+    if (SubmittedCount != NULL) {
+        *SubmittedCount = (ULONG)Result;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+OS_API
+BOOL
+OsIoRingReapCompletion (
+    POS_IO_RING Ring,
+    PIO_RING_COMPLETION Completion
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes the oldest completion from the ring without entering
+    the kernel. This routine is not thread safe; callers sharing a ring must
+    serialize their reaping.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Completion - Supplies a pointer where the completion will be copied.
+
+Return Value:
+
+    TRUE if a completion was returned.
+
+    FALSE if the completion array is empty.
+
+--*/
+
+{
+
+    PIO_RING_HEADER Header;
+    ULONG Head;
+    ULONG Index;
+
+    Header = Ring->Header;
+    Head = Header->CompletionHead;
+    if (Head == Header->CompletionTail) {
+        return FALSE;
+    }
+
+    //
+    // Read the tail before the entry it covers, and finish reading the entry
+    // before handing the slot back to the kernel.
+    //
+
+    RtlMemoryBarrier();
+    Index = Head & (Header->CompletionCount - 1);
+    RtlCopyMemory(Completion,
+                  &(Ring->Completions[Index]),
+                  sizeof(IO_RING_COMPLETION));
+
+    RtlMemoryBarrier();
+    Header->CompletionHead = Head + 1;
+    return TRUE;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
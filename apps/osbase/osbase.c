@@ -742,6 +742,7 @@ Return Value:
     // child. Or a negative status code to the parent if the fork failed.
     //
 
+    RtlZeroMemory(&Parameters, sizeof(SYSTEM_CALL_FORK));
     Parameters.Flags = Flags;
     Result = OspSystemCallFull(SystemCallForkProcess, &Parameters);
     if (Result < 0) {
@@ -753,6 +754,75 @@ Return Value:
     return STATUS_SUCCESS;
 }
 
+OS_API
+KSTATUS
+OsVforkProcess (
+    ULONG Flags,
+    PTHREAD_ENTRY_ROUTINE ThreadRoutine,
+    PVOID Parameter,
+    PVOID StackBase,
+    ULONG StackSize,
+    PPROCESS_ID NewProcessId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a child process that borrows the current process'
+    address space rather than getting a copy of it. The child starts
+    executing the given routine on the given stack, and the calling thread is
+    suspended until the child either executes a new image or exits. The child
+    must not return from the thread routine.
+
+Arguments:
+
+    Flags - Supplies a bitfield of flags governing the behavior of the new
+        process. See FORK_FLAG_* definitions. The share address space flag is
+        implied.
+
+    ThreadRoutine - Supplies a pointer to the routine the child runs.
+
+    Parameter - Supplies a pointer that will be passed directly to the thread
+        routine.
+
+    StackBase - Supplies a pointer to the base of the stack the child runs on.
+        This memory must stay mapped until this routine returns.
+
+    StackSize - Supplies the size of the child's stack in bytes.
+
+    NewProcessId - Supplies a pointer that on success contains the process ID
+        of the child process. This value contains -1 if the new process failed
+        to spawn.
+
+Return Value:
+
+    STATUS_SUCCESS once the child has executed a new image or exited.
+
+    Other status codes if the child failed to spawn.
+
+--*/
+
+{
+
+    SYSTEM_CALL_FORK Parameters;
+    INTN Result;
+
+    Parameters.Flags = Flags | FORK_FLAG_SHARE_ADDRESS_SPACE;
+    Parameters.ThreadRoutine = ThreadRoutine;
+    Parameters.Parameter = Parameter;
+    Parameters.StackBase = StackBase;
+    Parameters.StackSize = StackSize;
+    Result = OsSystemCall(SystemCallForkProcess, &Parameters);
+    if (Result < 0) {
+        *NewProcessId = -1;
+        return (KSTATUS)Result;
+    }
+
+    *NewProcessId = Result;
+    return STATUS_SUCCESS;
+}
+
 OS_API
 KSTATUS
 OsExecuteImage (
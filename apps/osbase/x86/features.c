@@ -51,7 +51,8 @@ ULONG OsProcessorFeatureMasks[OsX86FeatureCount] = {
     0,
     X86_FEATURE_SYSENTER,
     X86_FEATURE_I686,
-    X86_FEATURE_FXSAVE
+    X86_FEATURE_FXSAVE,
+    X86_FEATURE_SSE2
 };
 
 //
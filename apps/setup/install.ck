@@ -108,6 +108,7 @@ var DriverFiles = [
     "sd.drv",
     "smsc95xx.drv",
     "special.drv",
+    "tmpfs.drv",
     "usbcomp.drv",
     "usbcore.drv",
     "usbhid.drv",
@@ -128,9 +129,13 @@ if (arch == "x86") {
         "e100.drv",
         "e1000.drv",
         "i8042.drv",
+        "nvme.drv",
         "rtl81xx.drv",
         "uhci.drv",
         "pcnet32.drv",
+        "vioblk.drv",
+        "vionet.drv",
+        "virtio.drv",
     ];
 
 } else if ((arch == "armv7") || (arch == "armv6")) {
@@ -154,12 +159,15 @@ if (arch == "x86") {
     BootDrivers += [
         "ahci.drv",
         "ata.drv",
+        "nvme.drv",
         "pci.drv",
         "ehci.drv",
         "usbcomp.drv",
         "usbhub.drv",
         "usbmass.drv",
         "sd.drv",
+        "virtio.drv",
+        "vioblk.drv",
     ];
 }
 
@@ -481,6 +489,7 @@ if (plat == "install-armv6") {
         "net80211.drv",
         "netcore.drv",
         "null.drv",
+        "nvme.drv",
         "om4gpio.drv",
         "onering.drv",
         "part.drv",
@@ -503,6 +512,7 @@ if (plat == "install-armv6") {
         "smsc95xx.drv",
         "spb.drv",
         "special.drv",
+        "tmpfs.drv",
         "tps65217.drv",
         "usbcomp.drv",
         "usbcore.drv",
@@ -513,6 +523,9 @@ if (plat == "install-armv6") {
         "usbmouse.drv",
         "usrinput.drv",
         "videocon.drv",
+        "vioblk.drv",
+        "vionet.drv",
+        "virtio.drv",
     ];
 
     Files += [
@@ -604,6 +617,7 @@ if (plat == "install-armv7") {
         "net80211.drv",
         "netcore.drv",
         "null.drv",
+        "nvme.drv",
         "om4gpio.drv",
         "omap4mlo",
         "onering.drv",
@@ -630,6 +644,7 @@ if (plat == "install-armv7") {
         "smsc95xx.drv",
         "spb.drv",
         "special.drv",
+        "tmpfs.drv",
         "tps65217.drv",
         "usbcomp.drv",
         "usbcore.drv",
@@ -728,6 +743,7 @@ if (plat == "install-x86") {
         "net80211.drv",
         "netcore.drv",
         "null.drv",
+        "nvme.drv",
         "onering.drv",
         "part.drv",
         "pci.drv",
@@ -742,6 +758,7 @@ if (plat == "install-x86") {
         "ser16550.drv",
         "smsc95xx.drv",
         "special.drv",
+        "tmpfs.drv",
         "uhci.drv",
         "usbcomp.drv",
         "usbcore.drv",
@@ -407,6 +407,7 @@ Return Value:
     PSTR FullCommandPath;
     ULONG FullCommandPathSize;
     BOOL Result;
+    INT SpawnedChild;
     INT Status;
     PSWISS_COMMAND_ENTRY SwissCommand;
     id_t UserId;
@@ -514,6 +515,25 @@ Return Value:
     }
 
     if (SwForkSupported != 0) {
+
+        //
+        // Spawn the command directly if possible, which saves copying the
+        // whole shell only to throw the copy away on exec. If the command
+        // could not be executed, report the error the same way the forked
+        // child would have.
+        //
+
+        Status = ShSpawnCommand(FullCommandPath, Arguments, &SpawnedChild);
+        if (Status == 0) {
+            Child = SpawnedChild;
+            goto RunCommandEnd;
+
+        } else if (Status > 0) {
+            *ReturnValue = Status;
+            Status = 0;
+            goto RunCommandEnd;
+        }
+
         Child = SwFork();
         if (Child < 0) {
             PRINT_ERROR("sh: Failed to fork: %s\n", strerror(errno));
@@ -907,6 +907,47 @@ Return Value:
     return;
 }
 
+int
+ShSpawnCommand (
+    char *Command,
+    char **Arguments,
+    int *ProcessId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine spawns the given command directly, without first copying the
+    shell with fork. The child starts with the original signal dispositions
+    the shell was started with.
+
+Arguments:
+
+    Command - Supplies a pointer to the full path of the command to run.
+
+    Arguments - Supplies a pointer to the null terminated array of command
+        argument strings. This includes the first argument, the command name.
+
+    ProcessId - Supplies a pointer where the process ID of the child will be
+        returned on success.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the command cannot be spawned directly, in which case the caller
+    should fork and execute the command itself.
+
+    Returns an error number if the command could not be executed.
+
+--*/
+
+{
+
+    return -1;
+}
+
 void
 ShGetExecutableExtensions (
     char ***ExtensionList,
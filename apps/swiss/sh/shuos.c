@@ -37,6 +37,7 @@ Module Name:
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <spawn.h>
 #include <pwd.h>
 #include <sys/times.h>
 #include <sys/wait.h>
@@ -80,6 +81,8 @@ long ShClockTicksPerSecond;
 struct sigaction ShOriginalSignalDispositions[ShellSignalCount];
 int ShOriginalSignalDispositionValid[ShellSignalCount];
 
+extern char **environ;
+
 //
 // Store a global that's non-zero if this OS supports an executable permission
 // bit.
@@ -806,6 +809,112 @@ Return Value:
     return;
 }
 
+int
+ShSpawnCommand (
+    char *Command,
+    char **Arguments,
+    int *ProcessId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine spawns the given command directly, without first copying the
+    shell with fork. The child starts with the original signal dispositions
+    the shell was started with.
+
+Arguments:
+
+    Command - Supplies a pointer to the full path of the command to run.
+
+    Arguments - Supplies a pointer to the null terminated array of command
+        argument strings. This includes the first argument, the command name.
+
+    ProcessId - Supplies a pointer where the process ID of the child will be
+        returned on success.
+
+Return Value:
+
+    0 on success.
+
+    -1 if the command cannot be spawned directly, in which case the caller
+    should fork and execute the command itself.
+
+    Returns an error number if the command could not be executed.
+
+--*/
+
+{
+
+    posix_spawnattr_t Attributes;
+    pid_t Child;
+    struct sigaction CurrentAction;
+    sigset_t DefaultSignals;
+    struct sigaction *OriginalAction;
+    int OsSignalNumber;
+    int Result;
+    int SignalIndex;
+
+    //
+    // Signals that were originally at their default disposition can be reset
+    // by the spawn. Ignored signals stay ignored across the exec, but only if
+    // the shell hasn't changed them. Anything else needs a real fork.
+    //
+
+    sigemptyset(&DefaultSignals);
+    for (SignalIndex = 0; SignalIndex < ShellSignalCount; SignalIndex += 1) {
+        OsSignalNumber = ShConvertToOsSignal(SignalIndex);
+        if ((OsSignalNumber == 0) ||
+            (ShOriginalSignalDispositionValid[SignalIndex] == 0)) {
+
+            continue;
+        }
+
+        OriginalAction = &(ShOriginalSignalDispositions[SignalIndex]);
+        if (OriginalAction->sa_handler == SIG_DFL) {
+            sigaddset(&DefaultSignals, OsSignalNumber);
+            continue;
+        }
+
+        if ((OriginalAction->sa_handler != SIG_IGN) ||
+            (sigaction(OsSignalNumber, NULL, &CurrentAction) != 0) ||
+            (CurrentAction.sa_handler != SIG_IGN)) {
+
+            return -1;
+        }
+    }
+
+    if (posix_spawnattr_init(&Attributes) != 0) {
+        return -1;
+    }
+
+    Result = posix_spawnattr_setsigdefault(&Attributes, &DefaultSignals);
+    if (Result == 0) {
+        Result = posix_spawnattr_setflags(&Attributes, POSIX_SPAWN_SETSIGDEF);
+    }
+
+    if (Result == 0) {
+        fflush(NULL);
+        Result = posix_spawnp(&Child,
+                              Command,
+                              NULL,
+                              &Attributes,
+                              Arguments,
+                              environ);
+
+        if (Result == 0) {
+            *ProcessId = Child;
+        }
+
+    } else {
+        Result = -1;
+    }
+
+    posix_spawnattr_destroy(&Attributes);
+    return Result;
+}
+
 void
 ShGetExecutableExtensions (
     char ***ExtensionList,
@@ -42,6 +42,7 @@ function build() {
         "dlopen.c",
         "dup.c",
         "getppid.c",
+        "ioring.c",
         "exec.c",
         "fork.c",
         "malloc.c",
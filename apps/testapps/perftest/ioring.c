@@ -0,0 +1,326 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ioring.c
+
+Abstract:
+
+    This module implements the performance benchmark test for the I/O
+    submission and completion ring. It reads the same cached file as the read
+    test, but keeps a batch of reads outstanding and enters the kernel once
+    per batch.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    User
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/lib/minocaos.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "perftest.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PT_IO_RING_TEST_FILE_NAME_LENGTH 48
+#define PT_IO_RING_TEST_FILE_SIZE (2 * 1024 * 1024)
+#define PT_IO_RING_TEST_BUFFER_SIZE 4096
+#define PT_IO_RING_TEST_QUEUE_DEPTH 32
+#define PT_IO_RING_TEST_WORKER_COUNT 4
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+void
+IoRingMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs the I/O ring performance benchmark test.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    char *Buffer;
+    ssize_t BytesWritten;
+    IO_RING_COMPLETION Completion;
+    int FileCreated;
+    int FileDescriptor;
+    char FileName[PT_IO_RING_TEST_FILE_NAME_LENGTH];
+    int Index;
+    KSTATUS KernelStatus;
+    unsigned long long NextOffset;
+    int Outstanding;
+    pid_t ProcessId;
+    OS_IO_RING Ring;
+    int RingCreated;
+    int Status;
+    PIO_RING_SUBMISSION Submission;
+    unsigned long long TotalBytes;
+
+    FileCreated = 0;
+    FileDescriptor = -1;
+    RingCreated = 0;
+    Result->Type = PtResultBytes;
+    Result->Status = 0;
+    TotalBytes = 0;
+
+    //
+    // Allocate a buffer for each read that can be outstanding.
+    //
+
+    Buffer = malloc(PT_IO_RING_TEST_BUFFER_SIZE * PT_IO_RING_TEST_QUEUE_DEPTH);
+    if (Buffer == NULL) {
+        Result->Status = ENOMEM;
+        goto MainEnd;
+    }
+
+    //
+    // Get the process ID and create a process safe file path.
+    //
+
+    ProcessId = getpid();
+    Status = snprintf(FileName,
+                      PT_IO_RING_TEST_FILE_NAME_LENGTH,
+                      "ioring_%d.txt",
+                      ProcessId);
+
+    if (Status < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    FileDescriptor = open(FileName,
+                          O_RDWR | O_CREAT | O_TRUNC,
+                          S_IRUSR | S_IWUSR);
+
+    if (FileDescriptor < 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    FileCreated = 1;
+
+    //
+    // Prime the cache with junk data, just like the read test, so that the
+    // two results can be compared directly.
+    //
+
+    for (Index = 0;
+         Index < (PT_IO_RING_TEST_FILE_SIZE / PT_IO_RING_TEST_BUFFER_SIZE);
+         Index += 1) {
+
+        do {
+            BytesWritten = write(FileDescriptor,
+                                 Buffer,
+                                 PT_IO_RING_TEST_BUFFER_SIZE);
+
+        } while ((BytesWritten < 0) && (errno == EINTR));
+
+        if (BytesWritten < 0) {
+            Result->Status = errno;
+            goto MainEnd;
+        }
+
+        if (BytesWritten != PT_IO_RING_TEST_BUFFER_SIZE) {
+            Result->Status = EIO;
+            goto MainEnd;
+        }
+    }
+
+    Status = fsync(FileDescriptor);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    KernelStatus = OsCreateIoRing(PT_IO_RING_TEST_QUEUE_DEPTH,
+                                  PT_IO_RING_TEST_QUEUE_DEPTH,
+                                  PT_IO_RING_TEST_WORKER_COUNT,
+                                  &Ring);
+
+    if (!KSUCCESS(KernelStatus)) {
+        Result->Status = EIO;
+        goto MainEnd;
+    }
+
+    RingCreated = 1;
+
+    //
+    // Start the test. This snaps resource usage and starts the clock ticking.
+    //
+
+    Status = PtStartTimedTest(Test->Duration);
+    if (Status != 0) {
+        Result->Status = errno;
+        goto MainEnd;
+    }
+
+    //
+    // Keep the ring full of reads walking through the file, reaping whatever
+    // has finished each time around. Each completion's user data is the index
+    // of the buffer it used, which is then free for the next read.
+    //
+
+    NextOffset = 0;
+    Outstanding = 0;
+    for (Index = 0; Index < PT_IO_RING_TEST_QUEUE_DEPTH; Index += 1) {
+        Submission = OsIoRingGetSubmission(&Ring);
+        Submission->Operation = IoRingOperationRead;
+        Submission->Handle = (HANDLE)(UINTN)FileDescriptor;
+        Submission->Buffer = Buffer + (Index * PT_IO_RING_TEST_BUFFER_SIZE);
+        Submission->Size = PT_IO_RING_TEST_BUFFER_SIZE;
+        Submission->Offset = NextOffset;
+        Submission->TimeoutInMilliseconds = SYS_WAIT_TIME_INDEFINITE;
+        Submission->UserData = Index;
+        NextOffset = (NextOffset + PT_IO_RING_TEST_BUFFER_SIZE) %
+                     PT_IO_RING_TEST_FILE_SIZE;
+
+        Outstanding += 1;
+    }
+
+    while (PtIsTimedTestRunning() != 0) {
+        KernelStatus = OsIoRingSubmit(&Ring,
+                                      1,
+                                      SYS_WAIT_TIME_INDEFINITE,
+                                      NULL);
+
+        if ((!KSUCCESS(KernelStatus)) &&
+            (KernelStatus != STATUS_INTERRUPTED)) {
+
+            Result->Status = EIO;
+            break;
+        }
+
+        while (OsIoRingReapCompletion(&Ring, &Completion) != FALSE) {
+            Outstanding -= 1;
+            if (!KSUCCESS(Completion.Status)) {
+                Result->Status = EIO;
+                break;
+            }
+
+            TotalBytes += Completion.BytesCompleted;
+            Index = (int)Completion.UserData;
+            Submission = OsIoRingGetSubmission(&Ring);
+            Submission->Operation = IoRingOperationRead;
+            Submission->Handle = (HANDLE)(UINTN)FileDescriptor;
+            Submission->Buffer = Buffer +
+                                 (Index * PT_IO_RING_TEST_BUFFER_SIZE);
+
+            Submission->Size = PT_IO_RING_TEST_BUFFER_SIZE;
+            Submission->Offset = NextOffset;
+            Submission->TimeoutInMilliseconds = SYS_WAIT_TIME_INDEFINITE;
+            Submission->UserData = Index;
+            NextOffset = (NextOffset + PT_IO_RING_TEST_BUFFER_SIZE) %
+                         PT_IO_RING_TEST_FILE_SIZE;
+
+            Outstanding += 1;
+        }
+
+        if (Result->Status != 0) {
+            break;
+        }
+    }
+
+    Status = PtFinishTimedTest(Result);
+    if ((Status != 0) && (Result->Status == 0)) {
+        Result->Status = errno;
+    }
+
+    //
+    // Let the reads still in flight land before the buffers go away.
+    //
+
+    while (Outstanding > 0) {
+        KernelStatus = OsIoRingSubmit(&Ring,
+                                      1,
+                                      SYS_WAIT_TIME_INDEFINITE,
+                                      NULL);
+
+        if ((!KSUCCESS(KernelStatus)) &&
+            (KernelStatus != STATUS_INTERRUPTED)) {
+
+            break;
+        }
+
+        while (OsIoRingReapCompletion(&Ring, &Completion) != FALSE) {
+            Outstanding -= 1;
+        }
+    }
+
+MainEnd:
+    if (RingCreated != 0) {
+        OsDestroyIoRing(&Ring);
+    }
+
+    if (FileCreated != 0) {
+        close(FileDescriptor);
+        remove(FileName);
+    }
+
+    if (Buffer != NULL) {
+        free(Buffer);
+    }
+
+    Result->Data.Bytes = TotalBytes;
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
@@ -392,6 +392,13 @@ PT_TEST_INFORMATION PerformanceTests[PtTestTypeCount] = {
      PtTestFstat,
      PtResultIterations,
      FSTAT_TEST_DEFAULT_DURATION},
+
+    {IO_RING_TEST_NAME,
+     IO_RING_TEST_DESCRIPTION,
+     IoRingMain,
+     PtTestIoRing,
+     PtResultBytes,
+     IO_RING_TEST_DEFAULT_DURATION},
 };
 
 //
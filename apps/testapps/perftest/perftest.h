@@ -133,6 +133,10 @@ Module Name:
 #define FSTAT_TEST_DESCRIPTION \
     "Benchmarks the fstat() C library routine."
 
+#define IO_RING_TEST_NAME "io_ring"
+#define IO_RING_TEST_DESCRIPTION \
+    "Benchmarks batched read throughput through the I/O ring."
+
 //
 // Default test durations, in seconds.
 //
@@ -165,6 +169,7 @@ Module Name:
 #define MUTEX_CONTENDED_TEST_DEFAULT_DURATION 30
 #define STAT_TEST_DEFAULT_DURATION 30
 #define FSTAT_TEST_DEFAULT_DURATION 30
+#define IO_RING_TEST_DEFAULT_DURATION 60
 
 //
 // Define the number of variables supplied to an iteration of the execute test
@@ -207,6 +212,7 @@ typedef enum _PT_TEST_TYPE {
     PtTestMutexContended,
     PtTestStat,
     PtTestFstat,
+    PtTestIoRing,
     PtTestTypeCount
 } PT_TEST_TYPE, *PPT_TEST_TYPE;
 
@@ -978,3 +984,28 @@ Return Value:
 
 --*/
 
+void
+IoRingMain (
+    PPT_TEST_INFORMATION Test,
+    PPT_TEST_RESULT Result
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs the I/O ring performance benchmark test.
+
+Arguments:
+
+    Test - Supplies a pointer to the performance test being executed.
+
+    Result - Supplies a pointer to a performance test result structure that
+        receives the tests results.
+
+Return Value:
+
+    None.
+
+--*/
+
@@ -252,6 +252,23 @@ Return Value:
                  MmStatistics.PageSize) / _1MB;
 
     printf("Non-Paged Physical Memory: %I64dMB\n", Megabytes);
+    printf("Paged Out Pages: %ld\n", MmStatistics.PagedOutPages);
+    printf("Refaulted Pages: %ld\n", MmStatistics.RefaultedPages);
+    printf("Reactivated Pages: %ld\n", MmStatistics.ReactivatedPages);
+    if (MmStatistics.CompressedSwapCapacity != 0) {
+        printf("Compressed Swap:\n");
+        printf("    Capacity: %ld\n", MmStatistics.CompressedSwapCapacity);
+        printf("    Pages: %ld\n", MmStatistics.CompressedSwapPages);
+        printf("    Compressed Size: %ld\n",
+               MmStatistics.CompressedSwapBytes);
+
+        printf("    Written Back Pages: %ld\n",
+               MmStatistics.CompressedSwapWrittenBackPages);
+
+        printf("    Rejected Pages: %ld\n",
+               MmStatistics.CompressedSwapRejectedPages);
+    }
+
     printf("Non Paged Pool:\n");
     printf("    Size: %ld\n", MmStatistics.NonPagedPool.TotalHeapSize);
     printf("    Maximum Size: %ld\n", MmStatistics.NonPagedPool.MaxHeapSize);
@@ -303,6 +320,8 @@ Return Value:
     printf("Page Cache Size: %lldMB\n", Megabytes);
     Megabytes = (IoCache.DirtyPageCount * MmStatistics.PageSize) / _1MB;
     printf("Dirty Page Cache Size: %lldMB\n", Megabytes);
+    printf("Page Cache Evicted Pages: %ld\n", IoCache.EvictedPages);
+    printf("Page Cache Refaulted Pages: %ld\n", IoCache.RefaultedPages);
     return ReturnValue;
 }
 
@@ -42,15 +42,18 @@ function build() {
         "drivers/i8042:i8042",
         "drivers/net:net_drivers",
         "drivers/null:null",
+        "drivers/nvme:nvme",
         "drivers/part:part",
         "drivers/pci:pci",
         "drivers/plat:platform_drivers",
         "drivers/ramdisk:ramdisk",
         "drivers/sd:sd_drivers",
         "drivers/special:special",
+        "drivers/tmpfs:tmpfs",
         "drivers/term/ser16550:ser16550",
         "drivers/usb:usb_drivers",
-        "drivers/videocon:videocon"
+        "drivers/videocon:videocon",
+        "drivers/virtio:virtio_drivers"
     ];
 
     if ((arch == "armv7") || (arch == "armv6")) {
@@ -57,6 +57,7 @@ function build() {
             "drivers/net/ethernet/e1000:e1000",
             "drivers/net/ethernet/pcnet32:pcnet32",
             "drivers/net/ethernet/rtl81xx:rtl81xx",
+            "drivers/net/ethernet/vionet:vionet",
         ];
     }
 
@@ -0,0 +1,339 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    vionet.h
+
+Abstract:
+
+    This header contains internal definitions for the virtio network driver.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/virtio/virtio.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define VIONET_ALLOCATION_TAG 0x744E5656 // 'tNVV'
+
+//
+// Define the queue indices and how many descriptors to ask for in each.
+//
+
+#define VIONET_RECEIVE_QUEUE 0
+#define VIONET_TRANSMIT_QUEUE 1
+#define VIONET_QUEUE_SIZE 256
+
+//
+// Define the size of each receive buffer. It holds the virtio header plus a
+// full Ethernet frame.
+//
+
+#define VIONET_RECEIVE_BUFFER_SIZE 2048
+
+//
+// Define the largest Ethernet frame the device sends or receives, not
+// counting the virtio header or the CRC.
+//
+
+#define VIONET_MAX_FRAME_SIZE 1514
+
+//
+// Define the maximum amount of packets that will be kept queued before
+// packets start getting dropped.
+//
+
+#define VIONET_MAX_TRANSMIT_PACKET_LIST_COUNT (VIONET_QUEUE_SIZE * 2)
+
+//
+// Define the size of the header in front of every packet. Legacy devices
+// use the shorter form unless mergeable receive buffers are negotiated,
+// which this driver does not do.
+//
+
+#define VIONET_LEGACY_HEADER_SIZE 10
+#define VIONET_HEADER_SIZE 12
+
+//
+// Define the virtio network device feature bits.
+//
+
+#define VIRTIO_NET_FEATURE_MAC    (1ULL << 5)
+#define VIRTIO_NET_FEATURE_STATUS (1ULL << 16)
+
+#define VIONET_FEATURES (VIRTIO_NET_FEATURE_MAC | VIRTIO_NET_FEATURE_STATUS)
+
+//
+// Define the offsets of the fields in the device configuration.
+//
+
+#define VIRTIO_NET_CONFIGURATION_MAC 0x00
+#define VIRTIO_NET_CONFIGURATION_STATUS 0x06
+
+//
+// Define the link status bits.
+//
+
+#define VIRTIO_NET_STATUS_LINK_UP 0x0001
+
+//
+// Virtual links have no real speed, so report something reasonable.
+//
+
+#define VIONET_LINK_SPEED NET_SPEED_1000_MBPS
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines a virtio network device.
+
+Members:
+
+    OsDevice - Stores a pointer to the OS device.
+
+    Virtio - Stores a pointer to the virtio transport for the device.
+
+    NetworkLink - Stores a pointer to the core networking link.
+
+    Features - Stores the negotiated feature bits.
+
+    HeaderSize - Stores the size of the virtio header in front of each packet.
+
+    ReceiveQueue - Stores a pointer to the receive queue.
+
+    ReceiveIoBuffer - Stores the I/O buffer holding the receive buffers.
+
+    ReceiveBufferCount - Stores the number of receive buffers.
+
+    ReceiveLock - Stores the lock serializing access to the receive queue.
+
+    TransmitQueue - Stores a pointer to the transmit queue.
+
+    TransmitLock - Stores the lock serializing access to the transmit queue
+        and the list of packets waiting to be sent.
+
+    TransmitPacketList - Stores the list of packets waiting for room in the
+        transmit queue.
+
+    LinkActive - Stores a boolean indicating whether the link is up.
+
+    MacAddress - Stores the device's MAC address.
+
+--*/
+
+typedef struct _VIONET_DEVICE {
+    PDEVICE OsDevice;
+    PVIRTIO_DEVICE Virtio;
+    PNET_LINK NetworkLink;
+    ULONGLONG Features;
+    ULONG HeaderSize;
+    PVIRTIO_QUEUE ReceiveQueue;
+    PIO_BUFFER ReceiveIoBuffer;
+    ULONG ReceiveBufferCount;
+    PQUEUED_LOCK ReceiveLock;
+    PVIRTIO_QUEUE TransmitQueue;
+    PQUEUED_LOCK TransmitLock;
+    NET_PACKET_LIST TransmitPacketList;
+    BOOL LinkActive;
+    BYTE MacAddress[ETHERNET_ADDRESS_SIZE];
+} VIONET_DEVICE, *PVIONET_DEVICE;
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+//
+// Hardware functions called by the administrative side.
+//
+
+KSTATUS
+VionetSend (
+    PVOID DeviceContext,
+    PNET_PACKET_LIST PacketList
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sends data through the network.
+
+Arguments:
+
+    DeviceContext - Supplies a pointer to the device context associated with
+        the link down which this data is to be sent.
+
+    PacketList - Supplies a pointer to a list of network packets to send. Data
+        in these packets may be modified by this routine, but must not be used
+        once this routine returns.
+
+Return Value:
+
+    STATUS_SUCCESS if all packets were sent.
+
+    STATUS_RESOURCE_IN_USE if some or all of the packets were dropped due to
+    the hardware being backed up with too many packets to send.
+
+    Other failure codes indicate that none of the packets were sent.
+
+--*/
+
+KSTATUS
+VionetGetSetInformation (
+    PVOID DeviceContext,
+    NET_LINK_INFORMATION_TYPE InformationType,
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    );
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the network device layer's link information.
+
+Arguments:
+
+    DeviceContext - Supplies a pointer to the device context associated with
+        the link for which information is being set or queried.
+
+    InformationType - Supplies the type of information being queried or set.
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the data
+        buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or a
+        set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+VionetpInitializeDevice (
+    PVIONET_DEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine negotiates features with the device, reads its
+    configuration, and sets up its queues and receive buffers.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+VionetpStartDevice (
+    PVIONET_DEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine hands the receive buffers to the device, tells it the driver
+    is ready, and picks up the initial link state.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+INTERRUPT_STATUS
+VionetpInterruptServiceWorker (
+    PVOID Parameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine processes interrupts for the virtio network device at low
+    level.
+
+Arguments:
+
+    Parameter - Supplies the context pointer given when the interrupt was
+        connected, which points to the device.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+//
+// Administrative functions called by the hardware side.
+//
+
+KSTATUS
+VionetpAddNetworkDevice (
+    PVIONET_DEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine adds the device to core networking's available links.
+
+Arguments:
+
+    Device - Supplies a pointer to the device to add.
+
+Return Value:
+
+    Status code.
+
+--*/
+
@@ -0,0 +1,778 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    vionethw.c
+
+Abstract:
+
+    This module implements the queue handling for the virtio network driver.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include <minoca/net/netdrv.h>
+#include "vionet.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+VionetpReapReceivedBuffers (
+    PVIONET_DEVICE Device
+    );
+
+VOID
+VionetpReapTransmittedPackets (
+    PVIONET_DEVICE Device
+    );
+
+VOID
+VionetpSendPendingPackets (
+    PVIONET_DEVICE Device
+    );
+
+KSTATUS
+VionetpAddReceiveBuffer (
+    PVIONET_DEVICE Device,
+    ULONG Index
+    );
+
+VOID
+VionetpUpdateLinkState (
+    PVIONET_DEVICE Device
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+BOOL VionetDisablePacketDropping = FALSE;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+VionetSend (
+    PVOID DeviceContext,
+    PNET_PACKET_LIST PacketList
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends data through the network.
+
+Arguments:
+
+    DeviceContext - Supplies a pointer to the device context associated with
+        the link down which this data is to be sent.
+
+    PacketList - Supplies a pointer to a list of network packets to send. Data
+        in these packets may be modified by this routine, but must not be used
+        once this routine returns.
+
+Return Value:
+
+    STATUS_SUCCESS if all packets were sent.
+
+    STATUS_RESOURCE_IN_USE if some or all of the packets were dropped due to
+    the hardware being backed up with too many packets to send.
+
+    Other failure codes indicate that none of the packets were sent.
+
+--*/
+
+{
+
+    PVIONET_DEVICE Device;
+    UINTN PacketListCount;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Device = (PVIONET_DEVICE)DeviceContext;
+    KeAcquireQueuedLock(Device->TransmitLock);
+    if (Device->LinkActive == FALSE) {
+        Status = STATUS_NO_NETWORK_CONNECTION;
+        goto SendEnd;
+    }
+
+    //
+    // If there is any room in the packet list (or dropping packets is
+    // disabled), add all of the packets to the list waiting to be sent.
+    //
+
+    PacketListCount = Device->TransmitPacketList.Count;
+    if ((PacketListCount < VIONET_MAX_TRANSMIT_PACKET_LIST_COUNT) ||
+        (VionetDisablePacketDropping != FALSE)) {
+
+        NET_APPEND_PACKET_LIST(PacketList, &(Device->TransmitPacketList));
+        VionetpSendPendingPackets(Device);
+        Status = STATUS_SUCCESS;
+
+    //
+    // Otherwise report that the resource is use as it is too busy to handle
+    // more packets.
+    //
+
+    } else {
+        Status = STATUS_RESOURCE_IN_USE;
+    }
+
+SendEnd:
+    KeReleaseQueuedLock(Device->TransmitLock);
+    return Status;
+}
+
+KSTATUS
+VionetGetSetInformation (
+    PVOID DeviceContext,
+    NET_LINK_INFORMATION_TYPE InformationType,
+    PVOID Data,
+    PUINTN DataSize,
+    BOOL Set
+    )
+
+/*++
+
+Routine Description:
+
+    This routine gets or sets the network device layer's link information.
+
+Arguments:
+
+    DeviceContext - Supplies a pointer to the device context associated with
+        the link for which information is being set or queried.
+
+    InformationType - Supplies the type of information being queried or set.
+
+    Data - Supplies a pointer to the data buffer where the data is either
+        returned for a get operation or given for a set operation.
+
+    DataSize - Supplies a pointer that on input contains the size of the data
+        buffer. On output, contains the required size of the data buffer.
+
+    Set - Supplies a boolean indicating if this is a get operation (FALSE) or a
+        set operation (TRUE).
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PULONG BooleanOption;
+    PULONG Flags;
+    KSTATUS Status;
+
+    Status = STATUS_SUCCESS;
+    switch (InformationType) {
+    case NetLinkInformationChecksumOffload:
+        if (*DataSize != sizeof(ULONG)) {
+            Status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        if (Set != FALSE) {
+            Status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+
+        Flags = (PULONG)Data;
+        *Flags = 0;
+        break;
+
+    //
+    // Promiscuous mode is switched through the control queue, which this
+    // driver does not set up.
+    //
+
+    case NetLinkInformationPromiscuousMode:
+        if (*DataSize != sizeof(ULONG)) {
+            Status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        if (Set != FALSE) {
+            Status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+
+        BooleanOption = (PULONG)Data;
+        *BooleanOption = FALSE;
+        break;
+
+    default:
+        Status = STATUS_NOT_SUPPORTED;
+        break;
+    }
+
+    return Status;
+}
+
+KSTATUS
+VionetpInitializeDevice (
+    PVIONET_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine negotiates features with the device, reads its
+    configuration, and sets up its queues and receive buffers.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    ULONGLONG Features;
+    KSTATUS Status;
+    PVIRTIO_DEVICE Virtio;
+
+    Virtio = Device->Virtio;
+    Status = VirtioNegotiateFeatures(Virtio, VIONET_FEATURES, &Features);
+    if (!KSUCCESS(Status)) {
+        goto InitializeDeviceEnd;
+    }
+
+    Device->Features = Features;
+    Device->HeaderSize = VIONET_LEGACY_HEADER_SIZE;
+    if ((Features & VIRTIO_FEATURE_VERSION_1) != 0) {
+        Device->HeaderSize = VIONET_HEADER_SIZE;
+    }
+
+    //
+    // Use the address the hypervisor assigned if there is one, otherwise
+    // make one up.
+    //
+
+    if ((Features & VIRTIO_NET_FEATURE_MAC) != 0) {
+        Status = VirtioReadDeviceConfiguration(Virtio,
+                                               VIRTIO_NET_CONFIGURATION_MAC,
+                                               Device->MacAddress,
+                                               ETHERNET_ADDRESS_SIZE);
+
+        if (!KSUCCESS(Status)) {
+            goto InitializeDeviceEnd;
+        }
+
+    } else {
+        NetCreateEthernetAddress(Device->MacAddress);
+    }
+
+    NET_INITIALIZE_PACKET_LIST(&(Device->TransmitPacketList));
+    if (Device->TransmitLock == NULL) {
+        Device->TransmitLock = KeCreateQueuedLock();
+        if (Device->TransmitLock == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto InitializeDeviceEnd;
+        }
+    }
+
+    if (Device->ReceiveLock == NULL) {
+        Device->ReceiveLock = KeCreateQueuedLock();
+        if (Device->ReceiveLock == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto InitializeDeviceEnd;
+        }
+    }
+
+    Status = VirtioCreateQueue(Virtio,
+                               VIONET_RECEIVE_QUEUE,
+                               VIONET_QUEUE_SIZE,
+                               &(Device->ReceiveQueue));
+
+    if (!KSUCCESS(Status)) {
+        goto InitializeDeviceEnd;
+    }
+
+    Status = VirtioCreateQueue(Virtio,
+                               VIONET_TRANSMIT_QUEUE,
+                               VIONET_QUEUE_SIZE,
+                               &(Device->TransmitQueue));
+
+    if (!KSUCCESS(Status)) {
+        goto InitializeDeviceEnd;
+    }
+
+    //
+    // Each receive buffer takes two descriptors, one for the header and one
+    // for the frame.
+    //
+
+    Device->ReceiveBufferCount =
+                           VirtioQueueGetFreeCount(Device->ReceiveQueue) / 2;
+
+    if (Device->ReceiveBufferCount == 0) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto InitializeDeviceEnd;
+    }
+
+    if (Device->ReceiveIoBuffer == NULL) {
+        AllocationSize = Device->ReceiveBufferCount *
+                         VIONET_RECEIVE_BUFFER_SIZE;
+
+        Device->ReceiveIoBuffer = MmAllocateNonPagedIoBuffer(
+                                         0,
+                                         MAX_ULONGLONG,
+                                         VIONET_RECEIVE_BUFFER_SIZE,
+                                         AllocationSize,
+                                         IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS);
+
+        if (Device->ReceiveIoBuffer == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto InitializeDeviceEnd;
+        }
+    }
+
+InitializeDeviceEnd:
+    return Status;
+}
+
+KSTATUS
+VionetpStartDevice (
+    PVIONET_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands the receive buffers to the device, tells it the driver
+    is ready, and picks up the initial link state.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Index;
+    KSTATUS Status;
+
+    KeAcquireQueuedLock(Device->ReceiveLock);
+    for (Index = 0; Index < Device->ReceiveBufferCount; Index += 1) {
+        Status = VionetpAddReceiveBuffer(Device, Index);
+        if (!KSUCCESS(Status)) {
+            KeReleaseQueuedLock(Device->ReceiveLock);
+            goto StartDeviceEnd;
+        }
+    }
+
+    //
+    // The device may not be notified until the driver is marked ready.
+    //
+
+    Status = VirtioSetDriverReady(Device->Virtio);
+    if (KSUCCESS(Status)) {
+        VirtioQueueNotify(Device->ReceiveQueue);
+    }
+
+    KeReleaseQueuedLock(Device->ReceiveLock);
+    if (!KSUCCESS(Status)) {
+        goto StartDeviceEnd;
+    }
+
+    VionetpUpdateLinkState(Device);
+
+StartDeviceEnd:
+    return Status;
+}
+
+INTERRUPT_STATUS
+VionetpInterruptServiceWorker (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine processes interrupts for the virtio network device at low
+    level.
+
+Arguments:
+
+    Parameter - Supplies the context pointer given when the interrupt was
+        connected, which points to the device.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+{
+
+    PVIONET_DEVICE Device;
+    ULONG PendingBits;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Device = (PVIONET_DEVICE)Parameter;
+    PendingBits = VirtioGetPendingInterrupts(Device->Virtio);
+    if (PendingBits == 0) {
+        return InterruptStatusNotClaimed;
+    }
+
+    if ((PendingBits & VIRTIO_INTERRUPT_CONFIGURATION_CHANGE) != 0) {
+        VionetpUpdateLinkState(Device);
+    }
+
+    if ((PendingBits & VIRTIO_INTERRUPT_QUEUE) != 0) {
+        VionetpReapReceivedBuffers(Device);
+        VionetpReapTransmittedPackets(Device);
+    }
+
+    return InterruptStatusClaimed;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+VionetpReapReceivedBuffers (
+    PVIONET_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine passes any received frames up to the networking core and
+    hands their buffers back to the device.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PUCHAR BufferBase;
+    PVOID Cookie;
+    ULONG Index;
+    ULONG Length;
+    NET_PACKET_BUFFER Packet;
+    PHYSICAL_ADDRESS PhysicalBase;
+    PVIRTIO_QUEUE Queue;
+
+    BufferBase = Device->ReceiveIoBuffer->Fragment[0].VirtualAddress;
+    PhysicalBase = Device->ReceiveIoBuffer->Fragment[0].PhysicalAddress;
+    Queue = Device->ReceiveQueue;
+    Packet.Flags = 0;
+    KeAcquireQueuedLock(Device->ReceiveLock);
+
+    //
+    // Reap with interrupts off, and go around again if more frames arrived
+    // while turning them back on.
+    //
+
+    do {
+        VirtioQueueDisableInterrupts(Queue);
+        while (VirtioQueueGetUsed(Queue, &Cookie, &Length) != FALSE) {
+            Index = ((PUCHAR)Cookie - BufferBase) / VIONET_RECEIVE_BUFFER_SIZE;
+
+            ASSERT(Index < Device->ReceiveBufferCount);
+
+            if ((Length > Device->HeaderSize) &&
+                (Device->NetworkLink != NULL)) {
+
+                Packet.Buffer = (PUCHAR)Cookie + Device->HeaderSize;
+                Packet.BufferPhysicalAddress =
+                                 PhysicalBase +
+                                 (Index * VIONET_RECEIVE_BUFFER_SIZE) +
+                                 Device->HeaderSize;
+
+                Packet.BufferSize = Length - Device->HeaderSize;
+                Packet.DataSize = Packet.BufferSize;
+                Packet.DataOffset = 0;
+                Packet.FooterOffset = Packet.DataSize;
+                NetProcessReceivedPacket(Device->NetworkLink, &Packet);
+            }
+
+            VionetpAddReceiveBuffer(Device, Index);
+        }
+
+    } while (VirtioQueueEnableInterrupts(Queue, 0) != FALSE);
+
+    VirtioQueueNotify(Queue);
+    KeReleaseQueuedLock(Device->ReceiveLock);
+    return;
+}
+
+VOID
+VionetpReapTransmittedPackets (
+    PVIONET_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees any packets the device has finished sending, and sends
+    more if there is now room.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID Cookie;
+    ULONG Length;
+    BOOL PacketReaped;
+
+    PacketReaped = FALSE;
+    KeAcquireQueuedLock(Device->TransmitLock);
+    while (VirtioQueueGetUsed(Device->TransmitQueue, &Cookie, &Length) !=
+           FALSE) {
+
+        NetFreeBuffer(Cookie);
+        PacketReaped = TRUE;
+    }
+
+    if (PacketReaped != FALSE) {
+        VionetpSendPendingPackets(Device);
+    }
+
+    KeReleaseQueuedLock(Device->TransmitLock);
+    return;
+}
+
+VOID
+VionetpSendPendingPackets (
+    PVIONET_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends as many packets as can fit in the transmit queue. This
+    routine assumes the transmit lock is already held.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID Header;
+    PNET_PACKET_BUFFER Packet;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    VIRTIO_SEGMENT Segments[2];
+    KSTATUS Status;
+
+    while ((NET_PACKET_LIST_EMPTY(&(Device->TransmitPacketList)) == FALSE) &&
+           (VirtioQueueGetFreeCount(Device->TransmitQueue) >= 2)) {
+
+        Packet = LIST_VALUE(Device->TransmitPacketList.Head.Next,
+                            NET_PACKET_BUFFER,
+                            ListEntry);
+
+        NET_REMOVE_PACKET_FROM_LIST(Packet, &(Device->TransmitPacketList));
+
+        //
+        // Fill in the room left in front of the frame with an empty header,
+        // asking for no offloads.
+        //
+
+        ASSERT(Packet->DataOffset >= Device->HeaderSize);
+
+        Packet->DataOffset -= Device->HeaderSize;
+        Header = Packet->Buffer + Packet->DataOffset;
+        RtlZeroMemory(Header, Device->HeaderSize);
+        PhysicalAddress = Packet->BufferPhysicalAddress + Packet->DataOffset;
+        Segments[0].Address = PhysicalAddress;
+        Segments[0].Length = Device->HeaderSize;
+        Segments[0].Flags = 0;
+        Segments[1].Address = PhysicalAddress + Device->HeaderSize;
+        Segments[1].Length = Packet->FooterOffset - Packet->DataOffset -
+                             Device->HeaderSize;
+
+        Segments[1].Flags = 0;
+        Status = VirtioQueueAddBuffer(Device->TransmitQueue,
+                                      Segments,
+                                      2,
+                                      Packet);
+
+        ASSERT(KSUCCESS(Status));
+    }
+
+    VirtioQueueNotify(Device->TransmitQueue);
+    return;
+}
+
+KSTATUS
+VionetpAddReceiveBuffer (
+    PVIONET_DEVICE Device,
+    ULONG Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands a receive buffer to the device. This routine assumes
+    the receive lock is held.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+    Index - Supplies the index of the receive buffer.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PHYSICAL_ADDRESS PhysicalAddress;
+    VIRTIO_SEGMENT Segments[2];
+    KSTATUS Status;
+    PUCHAR VirtualAddress;
+
+    VirtualAddress = Device->ReceiveIoBuffer->Fragment[0].VirtualAddress;
+    VirtualAddress += Index * VIONET_RECEIVE_BUFFER_SIZE;
+    PhysicalAddress = Device->ReceiveIoBuffer->Fragment[0].PhysicalAddress;
+    PhysicalAddress += Index * VIONET_RECEIVE_BUFFER_SIZE;
+    Segments[0].Address = PhysicalAddress;
+    Segments[0].Length = Device->HeaderSize;
+    Segments[0].Flags = VIRTIO_SEGMENT_FLAG_DEVICE_WRITE;
+    Segments[1].Address = PhysicalAddress + Device->HeaderSize;
+    Segments[1].Length = VIONET_RECEIVE_BUFFER_SIZE - Device->HeaderSize;
+    Segments[1].Flags = VIRTIO_SEGMENT_FLAG_DEVICE_WRITE;
+    Status = VirtioQueueAddBuffer(Device->ReceiveQueue,
+                                  Segments,
+                                  2,
+                                  VirtualAddress);
+
+    return Status;
+}
+
+VOID
+VionetpUpdateLinkState (
+    PVIONET_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the link state from the device and reports any change
+    to the networking core. Devices that don't report link state are always
+    considered connected.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL LinkActive;
+    USHORT LinkStatus;
+    KSTATUS Status;
+
+    LinkActive = TRUE;
+    if ((Device->Features & VIRTIO_NET_FEATURE_STATUS) != 0) {
+        Status = VirtioReadDeviceConfiguration(Device->Virtio,
+                                               VIRTIO_NET_CONFIGURATION_STATUS,
+                                               &LinkStatus,
+                                               sizeof(USHORT));
+
+        if (!KSUCCESS(Status)) {
+            return;
+        }
+
+        if ((LinkStatus & VIRTIO_NET_STATUS_LINK_UP) == 0) {
+            LinkActive = FALSE;
+        }
+    }
+
+    KeAcquireQueuedLock(Device->TransmitLock);
+    if ((Device->NetworkLink != NULL) && (LinkActive != Device->LinkActive)) {
+        Device->LinkActive = LinkActive;
+        NetSetLinkState(Device->NetworkLink, LinkActive, VIONET_LINK_SPEED);
+    }
+
+    KeReleaseQueuedLock(Device->TransmitLock);
+    return;
+}
+
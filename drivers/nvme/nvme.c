@@ -0,0 +1,1446 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    nvme.c
+
+Abstract:
+
+    This module implements the NVM Express storage controller driver. Each
+    active namespace on the controller is presented as a disk, and I/O is
+    spread across one queue pair per processor.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include "nvme.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+NvmeAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    );
+
+VOID
+NvmeDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+NvmeDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+NvmeDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+NvmeDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+NvmeDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+NvmepDispatchControllerStateChange (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    );
+
+VOID
+NvmepDispatchDiskStateChange (
+    PIRP Irp,
+    PNVME_DISK Disk
+    );
+
+VOID
+NvmepDispatchDiskSystemControl (
+    PIRP Irp,
+    PNVME_DISK Disk
+    );
+
+KSTATUS
+NvmepProcessResourceRequirements (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    );
+
+KSTATUS
+NvmepStartController (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    );
+
+KSTATUS
+NvmepConnectInterrupts (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    );
+
+VOID
+NvmepEnumerateDisks (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    );
+
+VOID
+NvmepProcessPciMsiInterfaceChangeNotification (
+    PVOID Context,
+    PDEVICE Device,
+    PVOID InterfaceBuffer,
+    ULONG InterfaceBufferSize,
+    BOOL Arrival
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+PDRIVER NvmeDriver = NULL;
+UUID NvmeDiskInterfaceUuid = UUID_DISK_INTERFACE;
+UUID NvmePciMsiInterfaceUuid = UUID_PCI_MESSAGE_SIGNALED_INTERRUPTS;
+
+DISK_INTERFACE NvmeDiskInterfaceTemplate = {
+    DISK_INTERFACE_VERSION,
+    NULL,
+    0,
+    0,
+    NvmepBlockIoInitialize,
+    NvmepBlockIoReset,
+    NvmepBlockIoRead,
+    NvmepBlockIoWrite
+};
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+DriverEntry (
+    PDRIVER Driver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for the NVMe driver. It registers its
+    other dispatch functions, and performs driver-wide initialization.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver object.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code on error.
+
+--*/
+
+{
+
+    DRIVER_FUNCTION_TABLE FunctionTable;
+    KSTATUS Status;
+
+    NvmeDriver = Driver;
+    RtlZeroMemory(&FunctionTable, sizeof(DRIVER_FUNCTION_TABLE));
+    FunctionTable.Version = DRIVER_FUNCTION_TABLE_VERSION;
+    FunctionTable.AddDevice = NvmeAddDevice;
+    FunctionTable.DispatchStateChange = NvmeDispatchStateChange;
+    FunctionTable.DispatchOpen = NvmeDispatchOpen;
+    FunctionTable.DispatchClose = NvmeDispatchClose;
+    FunctionTable.DispatchIo = NvmeDispatchIo;
+    FunctionTable.DispatchSystemControl = NvmeDispatchSystemControl;
+    Status = IoRegisterDriverFunctions(Driver, &FunctionTable);
+    return Status;
+}
+
+KSTATUS
+NvmeAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a device is detected for which the NVMe
+    driver acts as the function driver. The driver will attach itself to the
+    stack.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver being called.
+
+    DeviceId - Supplies a pointer to a string with the device ID.
+
+    ClassId - Supplies a pointer to a string containing the device's class ID.
+
+    CompatibleIds - Supplies a pointer to a string containing device IDs
+        that would be compatible with this device.
+
+    DeviceToken - Supplies an opaque token that the driver can use to identify
+        the device in the system. This token should be used when attaching to
+        the stack.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code if the driver was unsuccessful in attaching itself.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+    KSTATUS Status;
+
+    Controller = MmAllocateNonPagedPool(sizeof(NVME_CONTROLLER),
+                                        NVME_ALLOCATION_TAG);
+
+    if (Controller == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto AddDeviceEnd;
+    }
+
+    RtlZeroMemory(Controller, sizeof(NVME_CONTROLLER));
+    Controller->Type = NvmeContextController;
+    Controller->OsDevice = DeviceToken;
+    Controller->InterruptHandle = INVALID_HANDLE;
+    Controller->InterruptVector = INVALID_INTERRUPT_VECTOR;
+    Controller->InterruptLine = INVALID_INTERRUPT_LINE;
+    Controller->AdminQueue.Controller = Controller;
+    Status = IoAttachDriverToDevice(Driver, DeviceToken, Controller);
+    if (!KSUCCESS(Status)) {
+        goto AddDeviceEnd;
+    }
+
+AddDeviceEnd:
+    if (!KSUCCESS(Status)) {
+        if (Controller != NULL) {
+            MmFreeNonPagedPool(Controller);
+        }
+    }
+
+    return Status;
+}
+
+VOID
+NvmeDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles State Change IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+
+    Controller = DeviceContext;
+    switch (Controller->Type) {
+    case NvmeContextController:
+        NvmepDispatchControllerStateChange(Irp, Controller);
+        break;
+
+    case NvmeContextDisk:
+        NvmepDispatchDiskStateChange(Irp, (PNVME_DISK)Controller);
+        break;
+
+    default:
+
+        ASSERT(FALSE);
+
+        IoCompleteIrp(NvmeDriver, Irp, STATUS_INVALID_CONFIGURATION);
+        break;
+    }
+
+    return;
+}
+
+VOID
+NvmeDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Open IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_DISK Disk;
+
+    //
+    // Only the disks can be opened or closed.
+    //
+
+    Disk = (PNVME_DISK)DeviceContext;
+    if (Disk->Type != NvmeContextDisk) {
+        return;
+    }
+
+    Irp->U.Open.DeviceContext = Disk;
+    IoCompleteIrp(NvmeDriver, Irp, STATUS_SUCCESS);
+    return;
+}
+
+VOID
+NvmeDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Close IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_DISK Disk;
+
+    Disk = (PNVME_DISK)DeviceContext;
+    if (Disk->Type != NvmeContextDisk) {
+        return;
+    }
+
+    IoCompleteIrp(NvmeDriver, Irp, STATUS_SUCCESS);
+    return;
+}
+
+VOID
+NvmeDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles I/O IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL CompleteIrp;
+    PNVME_DISK Disk;
+    ULONG IrpReadWriteFlags;
+    BOOL PmReferenceAdded;
+    KSTATUS Status;
+
+    Disk = (PNVME_DISK)Irp->U.ReadWrite.DeviceContext;
+    if (Disk->Type != NvmeContextDisk) {
+        return;
+    }
+
+    CompleteIrp = TRUE;
+    IrpReadWriteFlags = IRP_READ_WRITE_FLAG_DMA;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        IrpReadWriteFlags |= IRP_READ_WRITE_FLAG_WRITE;
+    }
+
+    //
+    // If the IRP is on the way up, then clean up after the DMA. An IRP going
+    // up is already complete.
+    //
+
+    PmReferenceAdded = FALSE;
+    if (Irp->Direction == IrpUp) {
+        CompleteIrp = FALSE;
+        PmDeviceReleaseReference(Disk->OsDevice);
+        Status = IoCompleteReadWriteIrp(&(Irp->U.ReadWrite), IrpReadWriteFlags);
+        if (!KSUCCESS(Status)) {
+            IoUpdateIrpStatus(Irp, Status);
+        }
+
+        goto DispatchIoEnd;
+    }
+
+    Status = PmDeviceAddReference(Disk->OsDevice);
+    if (!KSUCCESS(Status)) {
+        goto DispatchIoEnd;
+    }
+
+    PmReferenceAdded = TRUE;
+    Irp->U.ReadWrite.NewIoOffset = Irp->U.ReadWrite.IoOffset;
+    if (Irp->U.ReadWrite.IoSizeInBytes == 0) {
+        Status = STATUS_SUCCESS;
+        goto DispatchIoEnd;
+    }
+
+    //
+    // The controller takes any physical address. Keeping every fragment
+    // block aligned means a command never has to stop partway into a block
+    // when the fragments don't line up with pages.
+    //
+
+    Status = IoPrepareReadWriteIrp(&(Irp->U.ReadWrite),
+                                   Disk->BlockSize,
+                                   0,
+                                   MAX_ULONGLONG,
+                                   IrpReadWriteFlags);
+
+    if (!KSUCCESS(Status)) {
+        goto DispatchIoEnd;
+    }
+
+    CompleteIrp = FALSE;
+    Status = NvmepEnqueueIrp(Disk, Irp);
+    if (!KSUCCESS(Status)) {
+        IoCompleteReadWriteIrp(&(Irp->U.ReadWrite), IrpReadWriteFlags);
+        CompleteIrp = TRUE;
+    }
+
+DispatchIoEnd:
+    if (CompleteIrp != FALSE) {
+        if (PmReferenceAdded != FALSE) {
+            PmDeviceReleaseReference(Disk->OsDevice);
+        }
+
+        IoCompleteIrp(NvmeDriver, Irp, Status);
+    }
+
+    return;
+}
+
+VOID
+NvmeDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_DISK Disk;
+
+    ASSERT(Irp->MajorCode == IrpMajorSystemControl);
+
+    Disk = (PNVME_DISK)DeviceContext;
+    if (Disk->Type == NvmeContextDisk) {
+        NvmepDispatchDiskSystemControl(Irp, Disk);
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+NvmepDispatchControllerStateChange (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles state change IRPs for an NVMe controller.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the controller context.
+
+Return Value:
+
+    None. The routine completes the IRP if appropriate.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    if (Irp->Direction == IrpUp) {
+        if (!KSUCCESS(IoGetIrpStatus(Irp))) {
+            return;
+        }
+
+        switch (Irp->MinorCode) {
+        case IrpMinorQueryResources:
+            Status = NvmepProcessResourceRequirements(Irp, Controller);
+            if (!KSUCCESS(Status)) {
+                IoCompleteIrp(NvmeDriver, Irp, Status);
+            }
+
+            break;
+
+        case IrpMinorStartDevice:
+            Status = NvmepStartController(Irp, Controller);
+            if (!KSUCCESS(Status)) {
+                IoCompleteIrp(NvmeDriver, Irp, Status);
+            }
+
+            break;
+
+        case IrpMinorQueryChildren:
+            NvmepEnumerateDisks(Irp, Controller);
+            break;
+
+        case IrpMinorIdle:
+        case IrpMinorSuspend:
+        case IrpMinorResume:
+        default:
+            break;
+        }
+    }
+
+    return;
+}
+
+VOID
+NvmepDispatchDiskStateChange (
+    PIRP Irp,
+    PNVME_DISK Disk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles state change IRPs for an NVMe namespace.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Disk - Supplies a pointer to the disk.
+
+Return Value:
+
+    None. The routine completes the IRP if appropriate.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    if (Irp->Direction == IrpDown) {
+        switch (Irp->MinorCode) {
+        case IrpMinorStartDevice:
+
+            ASSERT(Disk->OsDevice == Irp->Device);
+
+            Status = PmInitialize(Irp->Device);
+            if (!KSUCCESS(Status)) {
+                IoCompleteIrp(NvmeDriver, Irp, Status);
+                break;
+            }
+
+            //
+            // Publish the disk interface.
+            //
+
+            Status = STATUS_SUCCESS;
+            if (Disk->DiskInterface.DiskToken == NULL) {
+                RtlCopyMemory(&(Disk->DiskInterface),
+                              &NvmeDiskInterfaceTemplate,
+                              sizeof(DISK_INTERFACE));
+
+                Disk->DiskInterface.DiskToken = Disk;
+                Disk->DiskInterface.BlockSize = Disk->BlockSize;
+                Disk->DiskInterface.BlockCount = Disk->BlockCount;
+                Status = IoCreateInterface(&NvmeDiskInterfaceUuid,
+                                           Irp->Device,
+                                           &(Disk->DiskInterface),
+                                           sizeof(DISK_INTERFACE));
+
+                if (!KSUCCESS(Status)) {
+                    Disk->DiskInterface.DiskToken = NULL;
+                }
+            }
+
+            IoCompleteIrp(NvmeDriver, Irp, Status);
+            break;
+
+        case IrpMinorQueryResources:
+        case IrpMinorQueryChildren:
+        case IrpMinorIdle:
+        case IrpMinorSuspend:
+        case IrpMinorResume:
+            IoCompleteIrp(NvmeDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        case IrpMinorRemoveDevice:
+            if (Disk->DiskInterface.DiskToken != NULL) {
+                IoDestroyInterface(&NvmeDiskInterfaceUuid,
+                                   Irp->Device,
+                                   &(Disk->DiskInterface));
+
+                Disk->DiskInterface.DiskToken = NULL;
+            }
+
+            NvmepProcessDiskRemoval(Disk);
+            IoCompleteIrp(NvmeDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return;
+}
+
+VOID
+NvmepDispatchDiskSystemControl (
+    PIRP Irp,
+    PNVME_DISK Disk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs for an NVMe namespace.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Disk - Supplies a pointer to the disk.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID Context;
+    PSYSTEM_CONTROL_FILE_OPERATION FileOperation;
+    PSYSTEM_CONTROL_LOOKUP Lookup;
+    PFILE_PROPERTIES Properties;
+    ULONGLONG PropertiesFileSize;
+    KSTATUS Status;
+
+    Context = Irp->U.SystemControl.SystemContext;
+    if (Irp->Direction == IrpUp) {
+
+        ASSERT(Irp->MinorCode == IrpMinorSystemControlSynchronize);
+
+        PmDeviceReleaseReference(Disk->OsDevice);
+        return;
+    }
+
+    switch (Irp->MinorCode) {
+    case IrpMinorSystemControlLookup:
+        Lookup = (PSYSTEM_CONTROL_LOOKUP)Context;
+        Status = STATUS_PATH_NOT_FOUND;
+        if (Lookup->Root != FALSE) {
+
+            //
+            // Enable opening of the root as a single file.
+            //
+
+            Properties = Lookup->Properties;
+            Properties->FileId = 0;
+            Properties->Type = IoObjectBlockDevice;
+            Properties->HardLinkCount = 1;
+            Properties->BlockSize = Disk->BlockSize;
+            Properties->BlockCount = Disk->BlockCount;
+            Properties->Size = Disk->BlockCount << Disk->BlockShift;
+            Status = STATUS_SUCCESS;
+        }
+
+        IoCompleteIrp(NvmeDriver, Irp, Status);
+        break;
+
+    //
+    // Writes to the disk's properties are not allowed. Fail if the data
+    // has changed.
+    //
+
+    case IrpMinorSystemControlWriteFileProperties:
+        FileOperation = (PSYSTEM_CONTROL_FILE_OPERATION)Context;
+        Properties = FileOperation->FileProperties;
+        PropertiesFileSize = Properties->Size;
+        if ((Properties->FileId != 0) ||
+            (Properties->Type != IoObjectBlockDevice) ||
+            (Properties->HardLinkCount != 1) ||
+            (Properties->BlockSize != Disk->BlockSize) ||
+            (Properties->BlockCount != Disk->BlockCount) ||
+            (PropertiesFileSize != (Disk->BlockCount << Disk->BlockShift))) {
+
+            Status = STATUS_NOT_SUPPORTED;
+
+        } else {
+            Status = STATUS_SUCCESS;
+        }
+
+        IoCompleteIrp(NvmeDriver, Irp, Status);
+        break;
+
+    //
+    // Do not support disk device truncation.
+    //
+
+    case IrpMinorSystemControlTruncate:
+        IoCompleteIrp(NvmeDriver, Irp, STATUS_NOT_SUPPORTED);
+        break;
+
+    //
+    // Gather and return device information.
+    //
+
+    case IrpMinorSystemControlDeviceInformation:
+        break;
+
+    //
+    // Send a flush command upon getting a synchronize request. Controllers
+    // without a volatile write cache have nothing to flush.
+    //
+
+    case IrpMinorSystemControlSynchronize:
+        if (Disk->Controller->VolatileWriteCache == FALSE) {
+            IoCompleteIrp(NvmeDriver, Irp, STATUS_SUCCESS);
+            break;
+        }
+
+        Status = PmDeviceAddReference(Disk->OsDevice);
+        if (!KSUCCESS(Status)) {
+            IoCompleteIrp(NvmeDriver, Irp, Status);
+            break;
+        }
+
+        Status = NvmepEnqueueIrp(Disk, Irp);
+        if (!KSUCCESS(Status)) {
+            PmDeviceReleaseReference(Disk->OsDevice);
+            IoCompleteIrp(NvmeDriver, Irp, Status);
+        }
+
+        break;
+
+    //
+    // Ignore everything unrecognized.
+    //
+
+    default:
+
+        ASSERT(FALSE);
+
+        break;
+    }
+
+    return;
+}
+
+KSTATUS
+NvmepProcessResourceRequirements (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine filters through the resource requirements presented by the
+    bus for an NVMe controller. It asks for one MSI-X vector per I/O queue if
+    the controller supports MSI-X, and a vector for the legacy interrupt line
+    otherwise.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PRESOURCE_CONFIGURATION_LIST ConfigurationList;
+    ULONG Index;
+    PCI_MSI_INFORMATION MsiInformation;
+    PINTERFACE_PCI_MSI MsiInterface;
+    PRESOURCE_REQUIREMENT_LIST RequirementList;
+    KSTATUS Status;
+    ULONG VectorCount;
+    PRESOURCE_REQUIREMENT VectorRequirement;
+    RESOURCE_REQUIREMENT VectorTemplate;
+
+    ASSERT((Irp->MajorCode == IrpMajorStateChange) &&
+           (Irp->MinorCode == IrpMinorQueryResources));
+
+    //
+    // Initialize a nice interrupt vector requirement in preparation.
+    //
+
+    RtlZeroMemory(&VectorTemplate, sizeof(RESOURCE_REQUIREMENT));
+    VectorTemplate.Type = ResourceTypeInterruptVector;
+    VectorTemplate.Minimum = 0;
+    VectorTemplate.Maximum = -1;
+    VectorTemplate.Length = 1;
+    if ((Controller->PciMsiFlags &
+         NVME_PCI_MSI_FLAG_INTERFACE_REGISTERED) == 0) {
+
+        Status = IoRegisterForInterfaceNotifications(
+                                &NvmePciMsiInterfaceUuid,
+                                NvmepProcessPciMsiInterfaceChangeNotification,
+                                Irp->Device,
+                                Controller,
+                                TRUE);
+
+        if (!KSUCCESS(Status)) {
+            goto ProcessResourceRequirementsEnd;
+        }
+
+        Controller->PciMsiFlags |= NVME_PCI_MSI_FLAG_INTERFACE_REGISTERED;
+    }
+
+    //
+    // If the MSI interface is ever going to be present, then it should have
+    // been registered immediately. Ask for a vector per processor, up to what
+    // the MSI-X table holds.
+    //
+
+    VectorCount = 0;
+    if ((Controller->PciMsiFlags &
+         NVME_PCI_MSI_FLAG_INTERFACE_AVAILABLE) != 0) {
+
+        MsiInterface = &(Controller->PciMsiInterface);
+        RtlZeroMemory(&MsiInformation, sizeof(PCI_MSI_INFORMATION));
+        MsiInformation.Version = PCI_MSI_INTERFACE_INFORMATION_VERSION;
+        MsiInformation.MsiType = PciMsiTypeExtended;
+        Status = MsiInterface->GetSetInformation(MsiInterface->DeviceToken,
+                                                 &MsiInformation,
+                                                 FALSE);
+
+        if (KSUCCESS(Status)) {
+            VectorCount = KeGetActiveProcessorCount();
+            if (VectorCount > NVME_MAX_IO_QUEUES) {
+                VectorCount = NVME_MAX_IO_QUEUES;
+            }
+
+            if (VectorCount > MsiInformation.MaxVectorCount) {
+                VectorCount = MsiInformation.MaxVectorCount;
+            }
+        }
+    }
+
+    ConfigurationList = Irp->U.QueryResources.ResourceRequirements;
+    if (VectorCount != 0) {
+        RequirementList = IoGetNextResourceConfiguration(ConfigurationList,
+                                                         NULL);
+
+        while (RequirementList != NULL) {
+            for (Index = 0; Index < VectorCount; Index += 1) {
+                VectorTemplate.Characteristics =
+                                               INTERRUPT_VECTOR_EDGE_TRIGGERED;
+
+                VectorTemplate.OwningRequirement = NULL;
+                Status = IoCreateAndAddResourceRequirement(&VectorTemplate,
+                                                           RequirementList,
+                                                           &VectorRequirement);
+
+                if (!KSUCCESS(Status)) {
+                    goto ProcessResourceRequirementsEnd;
+                }
+            }
+
+            RequirementList = IoGetNextResourceConfiguration(ConfigurationList,
+                                                             RequirementList);
+        }
+
+        Controller->PciMsiFlags |= NVME_PCI_MSI_FLAG_RESOURCES_REQUESTED;
+
+    //
+    // Otherwise stick with the good, old legacy interrupt setup.
+    //
+
+    } else {
+        Status = IoCreateAndAddInterruptVectorsForLines(ConfigurationList,
+                                                        &VectorTemplate);
+
+        if (!KSUCCESS(Status)) {
+            goto ProcessResourceRequirementsEnd;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+ProcessResourceRequirementsEnd:
+    return Status;
+}
+
+KSTATUS
+NvmepStartController (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts an NVMe controller.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG AlignmentOffset;
+    PRESOURCE_ALLOCATION Allocation;
+    PRESOURCE_ALLOCATION_LIST AllocationList;
+    PRESOURCE_ALLOCATION ControllerBase;
+    PHYSICAL_ADDRESS EndAddress;
+    PRESOURCE_ALLOCATION LineAllocation;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    ULONG QueueCount;
+    ULONG Size;
+    KSTATUS Status;
+
+    //
+    // Once the queues are up the controller is left running.
+    //
+
+    if (Controller->Started != FALSE) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Loop through the allocated resources to get the controller base and the
+    // interrupts. Vectors without an owning line are MSI-X vectors, one per
+    // I/O queue.
+    //
+
+    ControllerBase = NULL;
+    Controller->MsiVectorCount = 0;
+    AllocationList = Irp->U.StartDevice.ProcessorLocalResources;
+    Allocation = IoGetNextResourceAllocation(AllocationList, NULL);
+    while (Allocation != NULL) {
+        if (Allocation->Type == ResourceTypeInterruptVector) {
+            LineAllocation = Allocation->OwningAllocation;
+            if (LineAllocation == NULL) {
+
+                ASSERT((Controller->PciMsiFlags &
+                        NVME_PCI_MSI_FLAG_RESOURCES_REQUESTED) != 0);
+
+                if (Controller->MsiVectorCount < NVME_MAX_IO_QUEUES) {
+                    Controller->MsiVectors[Controller->MsiVectorCount] =
+                                                        Allocation->Allocation;
+
+                    Controller->MsiVectorCount += 1;
+                }
+
+            } else {
+
+                ASSERT(LineAllocation->Type == ResourceTypeInterruptLine);
+
+                Controller->InterruptLine = LineAllocation->Allocation;
+                Controller->InterruptVector = Allocation->Allocation;
+            }
+
+        //
+        // Look for the first physical address reservation, the registers.
+        //
+
+        } else if (Allocation->Type == ResourceTypePhysicalAddressSpace) {
+            if ((ControllerBase == NULL) && (Allocation->Length != 0)) {
+                ControllerBase = Allocation;
+            }
+        }
+
+        Allocation = IoGetNextResourceAllocation(AllocationList, Allocation);
+    }
+
+    if ((ControllerBase == NULL) ||
+        ((Controller->MsiVectorCount == 0) &&
+         (Controller->InterruptVector == INVALID_INTERRUPT_VECTOR))) {
+
+        Status = STATUS_INVALID_CONFIGURATION;
+        goto StartControllerEnd;
+    }
+
+    if (Controller->MsiVectorCount != 0) {
+        Controller->InterruptLine = INVALID_INTERRUPT_LINE;
+    }
+
+    //
+    // Map the controller.
+    //
+
+    if (Controller->ControllerBase == NULL) {
+
+        //
+        // Page align the mapping request.
+        //
+
+        PageSize = MmPageSize();
+        PhysicalAddress = ControllerBase->Allocation;
+        EndAddress = PhysicalAddress + ControllerBase->Length;
+        PhysicalAddress = ALIGN_RANGE_DOWN(PhysicalAddress, PageSize);
+        AlignmentOffset = ControllerBase->Allocation - PhysicalAddress;
+        EndAddress = ALIGN_RANGE_UP(EndAddress, PageSize);
+        Size = (ULONG)(EndAddress - PhysicalAddress);
+        Controller->ControllerBase = MmMapPhysicalAddress(PhysicalAddress,
+                                                          Size,
+                                                          TRUE,
+                                                          FALSE,
+                                                          TRUE);
+
+        if (Controller->ControllerBase == NULL) {
+            Status = STATUS_NO_MEMORY;
+            goto StartControllerEnd;
+        }
+
+        Controller->ControllerBase += AlignmentOffset;
+    }
+
+    Status = NvmepInitializeController(Controller);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    //
+    // Ask for a queue pair per processor. With MSI-X that was already capped
+    // by the vectors handed out.
+    //
+
+    QueueCount = Controller->MsiVectorCount;
+    if (QueueCount == 0) {
+        QueueCount = KeGetActiveProcessorCount();
+        if (QueueCount > NVME_MAX_IO_QUEUES) {
+            QueueCount = NVME_MAX_IO_QUEUES;
+        }
+    }
+
+    Status = NvmepCreateIoQueues(Controller, QueueCount);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    Status = NvmepIdentifyNamespaces(Controller);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    Status = NvmepConnectInterrupts(Irp, Controller);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    Controller->Started = TRUE;
+
+StartControllerEnd:
+    if (!KSUCCESS(Status)) {
+        RtlDebugPrint("NVMe: Failed to start: %d\n", Status);
+    }
+
+    return Status;
+}
+
+KSTATUS
+NvmepConnectInterrupts (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine connects the controller's interrupts. With MSI-X, each I/O
+    queue gets its own vector, aimed at the processor that submits to it.
+    Otherwise a single legacy interrupt serves every queue.
+
+Arguments:
+
+    Irp - Supplies a pointer to the start IRP.
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    IO_CONNECT_INTERRUPT_PARAMETERS Connect;
+    ULONG Index;
+    PCI_MSI_INFORMATION MsiInformation;
+    PINTERFACE_PCI_MSI MsiInterface;
+    PROCESSOR_SET ProcessorSet;
+    PNVME_QUEUE Queue;
+    KSTATUS Status;
+
+    RtlZeroMemory(&Connect, sizeof(IO_CONNECT_INTERRUPT_PARAMETERS));
+    Connect.Version = IO_CONNECT_INTERRUPT_PARAMETERS_VERSION;
+    Connect.Device = Irp->Device;
+    if (Controller->MsiVectorCount == 0) {
+        if (Controller->InterruptHandle == INVALID_HANDLE) {
+            Connect.LineNumber = Controller->InterruptLine;
+            Connect.Vector = Controller->InterruptVector;
+            Connect.InterruptServiceRoutine = NvmeInterruptService;
+            Connect.DispatchServiceRoutine = NvmeInterruptServiceDpc;
+            Connect.Context = Controller;
+            Connect.Interrupt = &(Controller->InterruptHandle);
+            Status = IoConnectInterrupt(&Connect);
+            if (!KSUCCESS(Status)) {
+                return Status;
+            }
+        }
+
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // There is nothing to read to find out whether a message came from this
+    // device, so the queues only get a dispatch level routine.
+    //
+
+    ASSERT(Controller->IoQueueCount <= Controller->MsiVectorCount);
+
+    MsiInterface = &(Controller->PciMsiInterface);
+    for (Index = 0; Index < Controller->IoQueueCount; Index += 1) {
+        Queue = &(Controller->IoQueues[Index]);
+        if (Queue->InterruptHandle == INVALID_HANDLE) {
+            Connect.LineNumber = INVALID_INTERRUPT_LINE;
+            Connect.Vector = Queue->InterruptVector;
+            Connect.DispatchServiceRoutine = NvmeQueueInterruptServiceDpc;
+            Connect.Context = Queue;
+            Connect.Interrupt = &(Queue->InterruptHandle);
+            Status = IoConnectInterrupt(&Connect);
+            if (!KSUCCESS(Status)) {
+                return Status;
+            }
+        }
+
+        ProcessorSet.Target = ProcessorTargetSingleProcessor;
+        ProcessorSet.U.Number = Index;
+        Status = MsiInterface->SetVectors(MsiInterface->DeviceToken,
+                                          PciMsiTypeExtended,
+                                          Queue->InterruptVector,
+                                          Index,
+                                          1,
+                                          &ProcessorSet);
+
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
+    RtlZeroMemory(&MsiInformation, sizeof(PCI_MSI_INFORMATION));
+    MsiInformation.Version = PCI_MSI_INTERFACE_INFORMATION_VERSION;
+    MsiInformation.MsiType = PciMsiTypeExtended;
+    MsiInformation.Flags = PCI_MSI_INTERFACE_FLAG_ENABLED;
+    MsiInformation.VectorCount = Controller->IoQueueCount;
+    Status = MsiInterface->GetSetInformation(MsiInterface->DeviceToken,
+                                             &MsiInformation,
+                                             TRUE);
+
+    return Status;
+}
+
+VOID
+NvmepEnumerateDisks (
+    PIRP Irp,
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reports each active namespace as a child of the controller.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    None. The IRP is completed with the appropriate status.
+
+--*/
+
+{
+
+    PDEVICE Children[NVME_MAX_NAMESPACES];
+    PNVME_DISK Disk;
+    ULONG Index;
+    KSTATUS Status;
+
+    Status = STATUS_SUCCESS;
+    if ((Controller->Started == FALSE) || (Controller->DiskCount == 0)) {
+        goto EnumerateDisksEnd;
+    }
+
+    for (Index = 0; Index < Controller->DiskCount; Index += 1) {
+        Disk = Controller->Disks[Index];
+        if (Disk->OsDevice == NULL) {
+            Status = IoCreateDevice(NvmeDriver,
+                                    Disk,
+                                    Irp->Device,
+                                    "Disk",
+                                    DISK_CLASS_ID,
+                                    NULL,
+                                    &(Disk->OsDevice));
+
+            if (!KSUCCESS(Status)) {
+                goto EnumerateDisksEnd;
+            }
+        }
+
+        Children[Index] = Disk->OsDevice;
+    }
+
+    Status = IoMergeChildArrays(Irp,
+                                Children,
+                                Controller->DiskCount,
+                                NVME_ALLOCATION_TAG);
+
+EnumerateDisksEnd:
+    IoCompleteIrp(NvmeDriver, Irp, Status);
+    return;
+}
+
+VOID
+NvmepProcessPciMsiInterfaceChangeNotification (
+    PVOID Context,
+    PDEVICE Device,
+    PVOID InterfaceBuffer,
+    ULONG InterfaceBufferSize,
+    BOOL Arrival
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a PCI MSI interface changes in availability.
+
+Arguments:
+
+    Context - Supplies the caller's context pointer, supplied when the caller
+        requested interface notifications.
+
+    Device - Supplies a pointer to the device exposing or deleting the
+        interface.
+
+    InterfaceBuffer - Supplies a pointer to the interface buffer of the
+        interface.
+
+    InterfaceBufferSize - Supplies the buffer size.
+
+    Arrival - Supplies TRUE if a new interface is arriving, or FALSE if an
+        interface is departing.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+
+    Controller = (PNVME_CONTROLLER)Context;
+    if (Arrival != FALSE) {
+        if (InterfaceBufferSize >= sizeof(INTERFACE_PCI_MSI)) {
+
+            ASSERT((Controller->PciMsiFlags &
+                    NVME_PCI_MSI_FLAG_INTERFACE_AVAILABLE) == 0);
+
+            RtlCopyMemory(&(Controller->PciMsiInterface),
+                          InterfaceBuffer,
+                          sizeof(INTERFACE_PCI_MSI));
+
+            Controller->PciMsiFlags |= NVME_PCI_MSI_FLAG_INTERFACE_AVAILABLE;
+        }
+
+    } else {
+        Controller->PciMsiFlags &= ~NVME_PCI_MSI_FLAG_INTERFACE_AVAILABLE;
+    }
+
+    return;
+}
+
@@ -0,0 +1,940 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    nvme.h
+
+Abstract:
+
+    This header contains definitions for the NVM Express storage controller
+    driver.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/intrface/disk.h>
+#include <minoca/intrface/pci.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// These macros read from and write to controller registers.
+//
+
+#define NVME_READ(_Controller, _Register) \
+    HlReadRegister32((PUCHAR)(_Controller)->ControllerBase + (_Register))
+
+#define NVME_WRITE(_Controller, _Register, _Value)                         \
+    HlWriteRegister32((PUCHAR)(_Controller)->ControllerBase + (_Register), \
+                      (_Value))
+
+//
+// This macro writes a queue doorbell, given its offset from the controller
+// base.
+//
+
+#define NVME_WRITE_DOORBELL(_Controller, _Offset, _Value)                \
+    HlWriteRegister32((PUCHAR)(_Controller)->ControllerBase + (_Offset), \
+                      (_Value))
+
+//
+// This macro returns the offset of a submission queue tail doorbell, or the
+// completion queue head doorbell if the completion parameter is 1.
+//
+
+#define NVME_DOORBELL_OFFSET(_Controller, _QueueId, _Completion) \
+    (NvmeDoorbellBase +                                          \
+     ((((_QueueId) * 2) + (_Completion)) << (_Controller)->DoorbellShift))
+
+//
+// These macros pull the status fields out of the last completion dword.
+//
+
+#define NVME_COMPLETION_COMMAND_ID(_Dword3) ((_Dword3) & 0xFFFF)
+#define NVME_COMPLETION_PHASE(_Dword3) (((_Dword3) >> 16) & 0x1)
+#define NVME_COMPLETION_STATUS(_Dword3) (((_Dword3) >> 17) & 0x7FF)
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define NVME_ALLOCATION_TAG 0x654D764E // 'eMvN'
+
+//
+// Define the memory page size the driver programs into the controller. Queue
+// memory and PRP entries are in units of this size.
+//
+
+#define NVME_PAGE_SIZE 0x1000
+#define NVME_PAGE_SHIFT 12
+
+//
+// Define the number of entries in the admin queues.
+//
+
+#define NVME_ADMIN_QUEUE_SIZE 32
+
+//
+// Define the number of entries in an I/O queue. This fills exactly one page
+// of submission entries. One entry is always left empty, so the number of
+// commands outstanding in a queue is one less. Each queue tracks its free
+// commands in a 64-bit mask.
+//
+
+#define NVME_IO_QUEUE_SIZE 64
+#define NVME_IO_COMMAND_COUNT (NVME_IO_QUEUE_SIZE - 1)
+
+//
+// Define the maximum number of I/O queue pairs to create. There is one per
+// processor, up to this limit.
+//
+
+#define NVME_MAX_IO_QUEUES 16
+
+//
+// Define the maximum number of namespaces to expose as disks.
+//
+
+#define NVME_MAX_NAMESPACES 16
+
+//
+// Define the number of entries in one page of PRP list, and the largest
+// transfer a single command built from one such page can describe.
+//
+
+#define NVME_PRP_LIST_ENTRIES (NVME_PAGE_SIZE / sizeof(ULONGLONG))
+#define NVME_MAX_TRANSFER_SIZE (NVME_PRP_LIST_ENTRIES * NVME_PAGE_SIZE)
+
+//
+// Define how long to wait for an admin command or a polled I/O command, and
+// how often to check on it, both in microseconds.
+//
+
+#define NVME_COMMAND_TIMEOUT 10000000
+#define NVME_POLL_INTERVAL 10
+
+//
+// Define the size of the bounce buffer used for polled I/O.
+//
+
+#define NVME_POLLED_BUFFER_SIZE 0x10000
+
+//
+// Define the size of the submission and completion queue entries.
+//
+
+#define NVME_SUBMISSION_ENTRY_SIZE 64
+#define NVME_COMPLETION_ENTRY_SIZE 16
+#define NVME_SUBMISSION_ENTRY_SHIFT 6
+#define NVME_COMPLETION_ENTRY_SHIFT 4
+
+//
+// Define controller capability register bits.
+//
+
+#define NVME_CAPABILITY_MAX_QUEUE_ENTRIES_MASK 0x0000FFFF
+#define NVME_CAPABILITY_TIMEOUT_SHIFT 24
+#define NVME_CAPABILITY_TIMEOUT_MASK 0xFF
+#define NVME_CAPABILITY_HIGH_DOORBELL_STRIDE_MASK 0x0000000F
+#define NVME_CAPABILITY_HIGH_NVM_COMMAND_SET 0x00000020
+#define NVME_CAPABILITY_HIGH_MIN_PAGE_SIZE_SHIFT 16
+#define NVME_CAPABILITY_HIGH_MIN_PAGE_SIZE_MASK 0xF
+
+//
+// Define controller configuration register bits.
+//
+
+#define NVME_CONFIGURATION_ENABLE 0x00000001
+#define NVME_CONFIGURATION_SHUTDOWN_NORMAL 0x00004000
+#define NVME_CONFIGURATION_SHUTDOWN_MASK 0x0000C000
+#define NVME_CONFIGURATION_SUBMISSION_ENTRY_SHIFT 16
+#define NVME_CONFIGURATION_COMPLETION_ENTRY_SHIFT 20
+
+//
+// Define controller status register bits.
+//
+
+#define NVME_STATUS_READY 0x00000001
+#define NVME_STATUS_FATAL 0x00000002
+#define NVME_STATUS_SHUTDOWN_MASK 0x0000000C
+#define NVME_STATUS_SHUTDOWN_COMPLETE 0x00000008
+
+//
+// Define the value register reads return once the device has been removed
+// from the bus.
+//
+
+#define NVME_REGISTER_ABSENT 0xFFFFFFFF
+
+//
+// Define the admin queue attributes register fields.
+//
+
+#define NVME_ADMIN_QUEUE_COMPLETION_SIZE_SHIFT 16
+
+//
+// Define the admin command opcodes.
+//
+
+#define NVME_ADMIN_DELETE_SUBMISSION_QUEUE 0x00
+#define NVME_ADMIN_CREATE_SUBMISSION_QUEUE 0x01
+#define NVME_ADMIN_DELETE_COMPLETION_QUEUE 0x04
+#define NVME_ADMIN_CREATE_COMPLETION_QUEUE 0x05
+#define NVME_ADMIN_IDENTIFY 0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+
+//
+// Define the NVM command set opcodes.
+//
+
+#define NVME_COMMAND_FLUSH 0x00
+#define NVME_COMMAND_WRITE 0x01
+#define NVME_COMMAND_READ 0x02
+
+//
+// Define the identify structure types.
+//
+
+#define NVME_IDENTIFY_NAMESPACE 0x00
+#define NVME_IDENTIFY_CONTROLLER 0x01
+
+//
+// Define the number of queues feature, and how its value is laid out.
+//
+
+#define NVME_FEATURE_NUMBER_OF_QUEUES 0x07
+#define NVME_QUEUE_COUNT_COMPLETION_SHIFT 16
+
+//
+// Define create queue command fields.
+//
+
+#define NVME_QUEUE_SIZE_SHIFT 16
+#define NVME_CREATE_QUEUE_PHYSICALLY_CONTIGUOUS 0x00000001
+#define NVME_CREATE_QUEUE_INTERRUPTS_ENABLED 0x00000002
+#define NVME_CREATE_QUEUE_VECTOR_SHIFT 16
+#define NVME_CREATE_QUEUE_COMPLETION_QUEUE_SHIFT 16
+
+//
+// Define read and write command fields.
+//
+
+#define NVME_READ_WRITE_FORCE_UNIT_ACCESS 0x40000000
+
+//
+// Define fields in the identify controller data.
+//
+
+#define NVME_IDENTIFY_CONTROLLER_MAX_TRANSFER_OFFSET 77
+#define NVME_IDENTIFY_CONTROLLER_NAMESPACE_COUNT_OFFSET 516
+#define NVME_IDENTIFY_CONTROLLER_WRITE_CACHE_OFFSET 525
+#define NVME_IDENTIFY_CONTROLLER_WRITE_CACHE_PRESENT 0x01
+
+//
+// Define fields in the identify namespace data.
+//
+
+#define NVME_IDENTIFY_NAMESPACE_SIZE_OFFSET 0
+#define NVME_IDENTIFY_NAMESPACE_FORMAT_OFFSET 26
+#define NVME_IDENTIFY_NAMESPACE_FORMAT_MASK 0x0F
+#define NVME_IDENTIFY_NAMESPACE_LBA_FORMATS_OFFSET 128
+#define NVME_LBA_FORMAT_METADATA_SIZE_MASK 0x0000FFFF
+#define NVME_LBA_FORMAT_DATA_SIZE_SHIFT 16
+#define NVME_LBA_FORMAT_DATA_SIZE_MASK 0xFF
+
+//
+// Define the smallest block size the controller can report, as a power of 2.
+//
+
+#define NVME_MIN_BLOCK_SHIFT 9
+
+//
+// Define the completion status value for success.
+//
+
+#define NVME_STATUS_SUCCESS 0x000
+
+//
+// Define software controller flags for the PCI MSI interface.
+//
+
+#define NVME_PCI_MSI_FLAG_INTERFACE_REGISTERED 0x00000001
+#define NVME_PCI_MSI_FLAG_INTERFACE_AVAILABLE  0x00000002
+#define NVME_PCI_MSI_FLAG_RESOURCES_REQUESTED  0x00000004
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _NVME_CONTEXT_TYPE {
+    NvmeContextInvalid,
+    NvmeContextController,
+    NvmeContextDisk
+} NVME_CONTEXT_TYPE, *PNVME_CONTEXT_TYPE;
+
+typedef enum _NVME_REGISTER {
+    NvmeCapabilities = 0x00,
+    NvmeCapabilitiesHigh = 0x04,
+    NvmeVersion = 0x08,
+    NvmeInterruptMaskSet = 0x0C,
+    NvmeInterruptMaskClear = 0x10,
+    NvmeConfiguration = 0x14,
+    NvmeStatus = 0x1C,
+    NvmeAdminQueueAttributes = 0x24,
+    NvmeAdminSubmissionQueue = 0x28,
+    NvmeAdminSubmissionQueueHigh = 0x2C,
+    NvmeAdminCompletionQueue = 0x30,
+    NvmeAdminCompletionQueueHigh = 0x34,
+    NvmeDoorbellBase = 0x1000
+} NVME_REGISTER, *PNVME_REGISTER;
+
+typedef struct _NVME_CONTROLLER NVME_CONTROLLER, *PNVME_CONTROLLER;
+typedef struct _NVME_DISK NVME_DISK, *PNVME_DISK;
+
+/*++
+
+Structure Description:
+
+    This structure defines a submission queue entry.
+
+Members:
+
+    Opcode - Stores the command opcode.
+
+    Flags - Stores the fused operation and data pointer type. The driver
+        always uses zero, meaning PRPs.
+
+    CommandId - Stores the identifier echoed back in the completion entry.
+
+    NamespaceId - Stores the namespace the command applies to.
+
+    Reserved - Stores reserved dwords.
+
+    MetadataPointer - Stores the metadata pointer, unused by the driver.
+
+    Prp1 - Stores the first PRP entry, which may have a page offset.
+
+    Prp2 - Stores the second PRP entry, or the address of a PRP list.
+
+    CommandDword - Stores the command specific dwords 10 through 15.
+
+--*/
+
+typedef struct _NVME_SUBMISSION_ENTRY {
+    UCHAR Opcode;
+    UCHAR Flags;
+    USHORT CommandId;
+    ULONG NamespaceId;
+    ULONG Reserved[2];
+    ULONGLONG MetadataPointer;
+    ULONGLONG Prp1;
+    ULONGLONG Prp2;
+    ULONG CommandDword[6];
+} PACKED NVME_SUBMISSION_ENTRY, *PNVME_SUBMISSION_ENTRY;
+
+/*++
+
+Structure Description:
+
+    This structure defines a completion queue entry.
+
+Members:
+
+    CommandSpecific - Stores the command specific result.
+
+    Reserved - Stores a reserved dword.
+
+    SubmissionHead - Stores the submission queue head pointer as of this
+        completion.
+
+    SubmissionQueueId - Stores the submission queue the command came from.
+
+    Status - Stores the command identifier, phase tag, and status field. See
+        the NVME_COMPLETION_* macros.
+
+--*/
+
+typedef struct _NVME_COMPLETION_ENTRY {
+    ULONG CommandSpecific;
+    ULONG Reserved;
+    USHORT SubmissionHead;
+    USHORT SubmissionQueueId;
+    ULONG Status;
+} PACKED NVME_COMPLETION_ENTRY, *PNVME_COMPLETION_ENTRY;
+
+/*++
+
+Structure Description:
+
+    This structure defines the state for one command slot in an I/O queue.
+
+Members:
+
+    Irp - Stores a pointer to the IRP the command is working on, or NULL if
+        the slot is free or the IRP was abandoned because the disk went away.
+
+    Disk - Stores a pointer to the disk the command is for.
+
+    IoSize - Stores the number of bytes this round of the command transfers.
+
+    PrpList - Stores the virtual address of the command's PRP list page.
+
+    PrpListPhysical - Stores the physical address of the command's PRP list
+        page.
+
+--*/
+
+typedef struct _NVME_COMMAND {
+    PIRP Irp;
+    PNVME_DISK Disk;
+    UINTN IoSize;
+    PULONGLONG PrpList;
+    PHYSICAL_ADDRESS PrpListPhysical;
+} NVME_COMMAND, *PNVME_COMMAND;
+
+/*++
+
+Structure Description:
+
+    This structure defines a submission and completion queue pair.
+
+Members:
+
+    Controller - Stores a pointer to the controller that owns the queue.
+
+    QueueId - Stores the queue identifier. Zero is the admin queue.
+
+    Size - Stores the number of entries in each of the two queues.
+
+    IoBuffer - Stores the I/O buffer holding the queue memory.
+
+    SubmissionQueue - Stores a pointer to the submission queue entries.
+
+    CompletionQueue - Stores a pointer to the completion queue entries.
+
+    SubmissionPhysical - Stores the physical address of the submission queue.
+
+    CompletionPhysical - Stores the physical address of the completion queue.
+
+    SubmissionTail - Stores the next submission queue entry to fill.
+
+    CompletionHead - Stores the next completion queue entry to look at.
+
+    Phase - Stores the phase tag value that marks a new completion entry.
+
+    SubmissionDoorbell - Stores the offset of the submission tail doorbell.
+
+    CompletionDoorbell - Stores the offset of the completion head doorbell.
+
+    Lock - Stores the lock serializing access to the queue. It is acquired
+        at dispatch level.
+
+    IrpQueue - Stores the list of IRPs waiting for a free command.
+
+    FreeCommands - Stores a mask of the free command slots.
+
+    CommandCount - Stores the number of command slots in use by the queue.
+
+    Commands - Stores the array of command slots.
+
+    PrpIoBuffer - Stores the I/O buffer holding the PRP list pages.
+
+    InterruptVector - Stores the vector the queue's completions arrive on,
+        when each queue has its own vector.
+
+    InterruptHandle - Stores the handle for the queue's connected interrupt.
+
+--*/
+
+typedef struct _NVME_QUEUE {
+    PNVME_CONTROLLER Controller;
+    USHORT QueueId;
+    USHORT Size;
+    PIO_BUFFER IoBuffer;
+    PNVME_SUBMISSION_ENTRY SubmissionQueue;
+    volatile NVME_COMPLETION_ENTRY *CompletionQueue;
+    PHYSICAL_ADDRESS SubmissionPhysical;
+    PHYSICAL_ADDRESS CompletionPhysical;
+    USHORT SubmissionTail;
+    USHORT CompletionHead;
+    ULONG Phase;
+    ULONG SubmissionDoorbell;
+    ULONG CompletionDoorbell;
+    KSPIN_LOCK Lock;
+    LIST_ENTRY IrpQueue;
+    ULONGLONG FreeCommands;
+    ULONG CommandCount;
+    NVME_COMMAND Commands[NVME_IO_COMMAND_COUNT];
+    PIO_BUFFER PrpIoBuffer;
+    ULONGLONG InterruptVector;
+    HANDLE InterruptHandle;
+} NVME_QUEUE, *PNVME_QUEUE;
+
+/*++
+
+Structure Description:
+
+    This structure defines a namespace on an NVMe controller, presented as a
+    disk.
+
+Members:
+
+    Type - Stores the context type, NvmeContextDisk.
+
+    Controller - Stores a pointer to the controller the disk belongs to.
+
+    OsDevice - Stores a pointer to the OS device for the disk.
+
+    NamespaceId - Stores the namespace identifier.
+
+    BlockSize - Stores the size of a block, in bytes.
+
+    BlockShift - Stores the base 2 logarithm of the block size.
+
+    BlockCount - Stores the number of blocks in the namespace.
+
+    Removed - Stores a boolean indicating whether the disk has been removed,
+        after which new I/O is failed.
+
+    DiskInterface - Stores the disk interface published for the disk.
+
+--*/
+
+struct _NVME_DISK {
+    NVME_CONTEXT_TYPE Type;
+    PNVME_CONTROLLER Controller;
+    PDEVICE OsDevice;
+    ULONG NamespaceId;
+    ULONG BlockSize;
+    ULONG BlockShift;
+    ULONGLONG BlockCount;
+    BOOL Removed;
+    DISK_INTERFACE DiskInterface;
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines an NVMe controller.
+
+Members:
+
+    Type - Stores the context type, NvmeContextController.
+
+    OsDevice - Stores a pointer to the OS device for the PCI function.
+
+    ControllerBase - Stores the virtual address of the controller registers.
+
+    InterruptLine - Stores the legacy interrupt line, or
+        INVALID_INTERRUPT_LINE if MSI-X vectors are in use.
+
+    InterruptVector - Stores the legacy interrupt vector.
+
+    InterruptHandle - Stores the handle for the legacy interrupt.
+
+    PendingInterrupts - Stores a boolean set by the legacy interrupt service
+        routine when it masks the controller's interrupt.
+
+    MsiVectors - Stores the array of MSI-X vectors allocated to the device.
+
+    MsiVectorCount - Stores the number of MSI-X vectors allocated.
+
+    PciMsiFlags - Stores a bitmask of NVME_PCI_MSI_FLAG_* values.
+
+    PciMsiInterface - Stores the PCI MSI interface.
+
+    DoorbellShift - Stores the base 2 logarithm of the doorbell stride.
+
+    ReadyTimeout - Stores how long the controller may take to change its
+        ready state, in microseconds.
+
+    MaxQueueEntries - Stores the largest queue the controller supports.
+
+    MaxTransferSize - Stores the largest transfer of a single command.
+
+    VolatileWriteCache - Stores a boolean indicating whether the controller
+        has a write cache that needs flushing.
+
+    NamespaceCount - Stores the number of namespaces the controller reports.
+
+    AdminQueue - Stores the admin queue pair.
+
+    IdentifyIoBuffer - Stores a page used to receive identify data.
+
+    IoQueues - Stores the array of I/O queue pairs.
+
+    IoQueueCount - Stores the number of I/O queue pairs.
+
+    Disks - Stores the array of namespaces found.
+
+    DiskCount - Stores the number of namespaces found.
+
+    PolledIoBuffer - Stores the bounce buffer used for polled I/O.
+
+    Started - Stores a boolean indicating whether the controller is running.
+
+--*/
+
+struct _NVME_CONTROLLER {
+    NVME_CONTEXT_TYPE Type;
+    PDEVICE OsDevice;
+    PVOID ControllerBase;
+    ULONGLONG InterruptLine;
+    ULONGLONG InterruptVector;
+    HANDLE InterruptHandle;
+    volatile ULONG PendingInterrupts;
+    ULONGLONG MsiVectors[NVME_MAX_IO_QUEUES];
+    ULONG MsiVectorCount;
+    ULONG PciMsiFlags;
+    INTERFACE_PCI_MSI PciMsiInterface;
+    ULONG DoorbellShift;
+    ULONG ReadyTimeout;
+    ULONG MaxQueueEntries;
+    ULONG MaxTransferSize;
+    BOOL VolatileWriteCache;
+    ULONG NamespaceCount;
+    NVME_QUEUE AdminQueue;
+    PIO_BUFFER IdentifyIoBuffer;
+    PNVME_QUEUE IoQueues;
+    ULONG IoQueueCount;
+    PNVME_DISK Disks[NVME_MAX_NAMESPACES];
+    ULONG DiskCount;
+    PIO_BUFFER PolledIoBuffer;
+    BOOL Started;
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+extern PDRIVER NvmeDriver;
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+INTERRUPT_STATUS
+NvmeInterruptService (
+    PVOID Context
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the NVMe interrupt service routine for a legacy
+    interrupt shared by all queues.
+
+Arguments:
+
+    Context - Supplies the context pointer given to the system when the
+        interrupt was connected. In this case, this points to the controller.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+INTERRUPT_STATUS
+NvmeInterruptServiceDpc (
+    PVOID Parameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine processes completions on every I/O queue at dispatch level
+    for a legacy interrupt shared by all queues.
+
+Arguments:
+
+    Parameter - Supplies the context, in this case the controller.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+INTERRUPT_STATUS
+NvmeQueueInterruptServiceDpc (
+    PVOID Parameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine processes completions for a queue with its own MSI-X vector
+    at dispatch level.
+
+Arguments:
+
+    Parameter - Supplies the context, in this case the queue.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+KSTATUS
+NvmepInitializeController (
+    PNVME_CONTROLLER Controller
+    );
+
+/*++
+
+Routine Description:
+
+    This routine resets and enables an NVMe controller with its admin queue,
+    and reads the controller's identify data.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller, with its registers
+        mapped.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+NvmepCreateIoQueues (
+    PNVME_CONTROLLER Controller,
+    ULONG QueueCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine asks the controller for I/O queues and creates as many of
+    them as it grants, up to the given count. If MSI-X vectors were allocated,
+    each queue's completions go to its own vector.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    QueueCount - Supplies the number of I/O queue pairs to ask for.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+NvmepIdentifyNamespaces (
+    PNVME_CONTROLLER Controller
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds the active namespaces on the controller and creates a
+    disk structure for each one.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+NvmepEnqueueIrp (
+    PNVME_DISK Disk,
+    PIRP Irp
+    );
+
+/*++
+
+Routine Description:
+
+    This routine pends an I/O or synchronize IRP and sends it down the
+    current processor's queue, or holds it there until a command is free.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+    Irp - Supplies a pointer to the IRP.
+
+Return Value:
+
+    Status code. On failure, the caller is responsible for completing the IRP.
+
+--*/
+
+VOID
+NvmepProcessDiskRemoval (
+    PNVME_DISK Disk
+    );
+
+/*++
+
+Routine Description:
+
+    This routine fails all queued IRPs for a disk that is going away. IRPs
+    already handed to the controller are failed too once the controller can
+    no longer touch their buffers: either it has been physically removed, or
+    this was its last disk and it has been disabled.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+NvmepBlockIoInitialize (
+    PVOID DiskToken
+    );
+
+/*++
+
+Routine Description:
+
+    This routine must be called before using the block read and write
+    routines in order to allow the disk to prepare for block I/O. This must be
+    called at low level.
+
+Arguments:
+
+    DiskToken - Supplies an opaque token for the disk. The appropriate token
+        is retrieved by querying the disk device information.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+NvmepBlockIoReset (
+    PVOID DiskToken
+    );
+
+/*++
+
+Routine Description:
+
+    This routine resets the controller and brings up a single polled I/O
+    queue, so that block I/O can run regardless of what the system was doing.
+    This routine must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies an opaque token for the disk.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+NvmepBlockIoRead (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads the block contents from the disk into the given I/O
+    buffer using polled I/O. This must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies an opaque token for the disk.
+
+    IoBuffer - Supplies a pointer to the I/O buffer where the data will be
+        read.
+
+    BlockAddress - Supplies the block index to read from (for physical disk,
+        this is the LBA).
+
+    BlockCount - Supplies the number of blocks to read.
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks read.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+NvmepBlockIoWrite (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    );
+
+/*++
+
+Routine Description:
+
+    This routine writes the contents of the given I/O buffer to the disk using
+    polled I/O. This must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies an opaque token for the disk.
+
+    IoBuffer - Supplies a pointer to the I/O buffer containing the data to
+        write.
+
+    BlockAddress - Supplies the block index to write to (for physical disk,
+        this is the LBA).
+
+    BlockCount - Supplies the number of blocks to write.
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks written.
+
+Return Value:
+
+    Status code.
+
+--*/
+
@@ -0,0 +1,2411 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    nvmehw.c
+
+Abstract:
+
+    This module implements the hardware side of the NVMe driver: bringing up
+    the controller and its queues, turning IRPs into commands with PRP lists,
+    completing them from the completion queues, and the polled path used for
+    crash dumps.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include "nvme.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+NvmepEnableController (
+    PNVME_CONTROLLER Controller
+    );
+
+KSTATUS
+NvmepDisableController (
+    PNVME_CONTROLLER Controller
+    );
+
+KSTATUS
+NvmepWaitForReady (
+    PNVME_CONTROLLER Controller,
+    BOOL Ready
+    );
+
+KSTATUS
+NvmepAllocateQueue (
+    PNVME_QUEUE Queue,
+    USHORT QueueId,
+    USHORT Size
+    );
+
+KSTATUS
+NvmepInitializeCommands (
+    PNVME_QUEUE Queue
+    );
+
+VOID
+NvmepResetQueue (
+    PNVME_QUEUE Queue
+    );
+
+KSTATUS
+NvmepCreateQueuePair (
+    PNVME_QUEUE Queue,
+    BOOL InterruptsEnabled,
+    ULONG InterruptIndex
+    );
+
+KSTATUS
+NvmepExecuteAdminCommand (
+    PNVME_CONTROLLER Controller,
+    PNVME_SUBMISSION_ENTRY Entry,
+    PULONG Result
+    );
+
+KSTATUS
+NvmepPollForCompletion (
+    PNVME_QUEUE Queue,
+    PNVME_COMPLETION_ENTRY Completion
+    );
+
+VOID
+NvmepSubmitEntry (
+    PNVME_QUEUE Queue,
+    PNVME_SUBMISSION_ENTRY Entry
+    );
+
+BOOL
+NvmepGetCompletion (
+    PNVME_QUEUE Queue,
+    PNVME_COMPLETION_ENTRY Completion
+    );
+
+KSTATUS
+NvmepSubmitIrp (
+    PNVME_QUEUE Queue,
+    PIRP Irp
+    );
+
+VOID
+NvmepStartCommand (
+    PNVME_QUEUE Queue,
+    PNVME_COMMAND Command
+    );
+
+UINTN
+NvmepBuildPrpList (
+    PNVME_COMMAND Command,
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    UINTN Size,
+    PNVME_SUBMISSION_ENTRY Entry
+    );
+
+VOID
+NvmepProcessCompletions (
+    PNVME_QUEUE Queue
+    );
+
+VOID
+NvmepCompleteCommand (
+    PNVME_QUEUE Queue,
+    PNVME_COMMAND Command,
+    ULONG CompletionStatus
+    );
+
+VOID
+NvmepSubmitQueuedIrps (
+    PNVME_QUEUE Queue
+    );
+
+PNVME_DISK
+NvmepGetIrpDisk (
+    PNVME_CONTROLLER Controller,
+    PIRP Irp
+    );
+
+KSTATUS
+NvmepPerformPolledIo (
+    PNVME_DISK Disk,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    BOOL Write,
+    PUINTN BlocksCompleted
+    );
+
+KSTATUS
+NvmepTranslateStatus (
+    ULONG CompletionStatus
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INTERRUPT_STATUS
+NvmeInterruptService (
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the NVMe interrupt service routine for a legacy
+    interrupt shared by all queues.
+
+Arguments:
+
+    Context - Supplies the context pointer given to the system when the
+        interrupt was connected. In this case, this points to the controller.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+    ULONG Index;
+    PNVME_QUEUE Queue;
+    ULONG Status;
+
+    //
+    // There is no interrupt status register, so look for a new entry at the
+    // head of each completion queue. The interrupt stays masked until the
+    // DPC has drained them.
+    //
+
+    Controller = (PNVME_CONTROLLER)Context;
+    for (Index = 0; Index < Controller->IoQueueCount; Index += 1) {
+        Queue = &(Controller->IoQueues[Index]);
+        Status = Queue->CompletionQueue[Queue->CompletionHead].Status;
+        if (NVME_COMPLETION_PHASE(Status) == Queue->Phase) {
+            NVME_WRITE(Controller, NvmeInterruptMaskSet, 1);
+            RtlAtomicOr32(&(Controller->PendingInterrupts), 1);
+            return InterruptStatusClaimed;
+        }
+    }
+
+    return InterruptStatusNotClaimed;
+}
+
+INTERRUPT_STATUS
+NvmeInterruptServiceDpc (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine processes completions on every I/O queue at dispatch level
+    for a legacy interrupt shared by all queues.
+
+Arguments:
+
+    Parameter - Supplies the context, in this case the controller.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+    ULONG Index;
+
+    Controller = Parameter;
+    if (RtlAtomicExchange32(&(Controller->PendingInterrupts), 0) == 0) {
+        return InterruptStatusNotClaimed;
+    }
+
+    for (Index = 0; Index < Controller->IoQueueCount; Index += 1) {
+        NvmeQueueInterruptServiceDpc(&(Controller->IoQueues[Index]));
+    }
+
+    NVME_WRITE(Controller, NvmeInterruptMaskClear, 1);
+    return InterruptStatusClaimed;
+}
+
+INTERRUPT_STATUS
+NvmeQueueInterruptServiceDpc (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine processes completions for a queue with its own MSI-X vector
+    at dispatch level.
+
+Arguments:
+
+    Parameter - Supplies the context, in this case the queue.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+{
+
+    PNVME_QUEUE Queue;
+
+    Queue = Parameter;
+    KeAcquireSpinLock(&(Queue->Lock));
+    NvmepProcessCompletions(Queue);
+    NvmepSubmitQueuedIrps(Queue);
+    KeReleaseSpinLock(&(Queue->Lock));
+    return InterruptStatusClaimed;
+}
+
+KSTATUS
+NvmepInitializeController (
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets and enables an NVMe controller with its admin queue,
+    and reads the controller's identify data.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller, with its registers
+        mapped.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Capabilities;
+    ULONG CapabilitiesHigh;
+    NVME_SUBMISSION_ENTRY Entry;
+    PUCHAR Identify;
+    PIO_BUFFER IoBuffer;
+    ULONG MaxTransferShift;
+    USHORT Size;
+    KSTATUS Status;
+    ULONG Timeout;
+
+    Capabilities = NVME_READ(Controller, NvmeCapabilities);
+    CapabilitiesHigh = NVME_READ(Controller, NvmeCapabilitiesHigh);
+    if ((CapabilitiesHigh & NVME_CAPABILITY_HIGH_NVM_COMMAND_SET) == 0) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    //
+    // The driver always uses 4KB pages, which every controller is supposed
+    // to support.
+    //
+
+    if (((CapabilitiesHigh >> NVME_CAPABILITY_HIGH_MIN_PAGE_SIZE_SHIFT) &
+         NVME_CAPABILITY_HIGH_MIN_PAGE_SIZE_MASK) != 0) {
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    //
+    // Doorbells are 4 bytes apart, times a power of two stride.
+    //
+
+    Controller->DoorbellShift = CapabilitiesHigh &
+                                NVME_CAPABILITY_HIGH_DOORBELL_STRIDE_MASK;
+
+    Controller->DoorbellShift += 2;
+
+    Controller->MaxQueueEntries =
+                  (Capabilities & NVME_CAPABILITY_MAX_QUEUE_ENTRIES_MASK) + 1;
+
+    //
+    // The timeout is reported in units of 500 milliseconds.
+    //
+
+    Timeout = (Capabilities >> NVME_CAPABILITY_TIMEOUT_SHIFT) &
+              NVME_CAPABILITY_TIMEOUT_MASK;
+
+    if (Timeout == 0) {
+        Timeout = 1;
+    }
+
+    Controller->ReadyTimeout = Timeout * 500 * MICROSECONDS_PER_MILLISECOND;
+    Size = NVME_ADMIN_QUEUE_SIZE;
+    if (Size > Controller->MaxQueueEntries) {
+        Size = Controller->MaxQueueEntries;
+    }
+
+    Status = NvmepAllocateQueue(&(Controller->AdminQueue), 0, Size);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    if (Controller->IdentifyIoBuffer == NULL) {
+        Controller->IdentifyIoBuffer = MmAllocateNonPagedIoBuffer(
+                                         0,
+                                         MAX_ULONGLONG,
+                                         NVME_PAGE_SIZE,
+                                         NVME_PAGE_SIZE,
+                                         IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS);
+
+        if (Controller->IdentifyIoBuffer == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    Status = NvmepEnableController(Controller);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    IoBuffer = Controller->IdentifyIoBuffer;
+    RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+    Entry.Opcode = NVME_ADMIN_IDENTIFY;
+    Entry.Prp1 = IoBuffer->Fragment[0].PhysicalAddress;
+    Entry.CommandDword[0] = NVME_IDENTIFY_CONTROLLER;
+    Status = NvmepExecuteAdminCommand(Controller, &Entry, NULL);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    //
+    // A maximum transfer size of zero means there is no limit. Otherwise it
+    // is a power of two multiple of the minimum page size. Either way, a
+    // single page of PRP list caps it too.
+    //
+
+    Identify = IoBuffer->Fragment[0].VirtualAddress;
+    Controller->MaxTransferSize = NVME_MAX_TRANSFER_SIZE;
+    MaxTransferShift = Identify[NVME_IDENTIFY_CONTROLLER_MAX_TRANSFER_OFFSET];
+    if ((MaxTransferShift != 0) &&
+        ((NVME_PAGE_SIZE << MaxTransferShift) < NVME_MAX_TRANSFER_SIZE)) {
+
+        Controller->MaxTransferSize = NVME_PAGE_SIZE << MaxTransferShift;
+    }
+
+    Controller->NamespaceCount =
+       *((PULONG)&(Identify[NVME_IDENTIFY_CONTROLLER_NAMESPACE_COUNT_OFFSET]));
+
+    Controller->VolatileWriteCache = FALSE;
+    if ((Identify[NVME_IDENTIFY_CONTROLLER_WRITE_CACHE_OFFSET] &
+         NVME_IDENTIFY_CONTROLLER_WRITE_CACHE_PRESENT) != 0) {
+
+        Controller->VolatileWriteCache = TRUE;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+NvmepCreateIoQueues (
+    PNVME_CONTROLLER Controller,
+    ULONG QueueCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine asks the controller for I/O queues and creates as many of
+    them as it grants, up to the given count. If MSI-X vectors were allocated,
+    each queue's completions go to its own vector.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    QueueCount - Supplies the number of I/O queue pairs to ask for.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    ULONG Allocated;
+    NVME_SUBMISSION_ENTRY Entry;
+    ULONG Index;
+    ULONG InterruptIndex;
+    PNVME_QUEUE Queue;
+    ULONG Result;
+    USHORT Size;
+    KSTATUS Status;
+
+    ASSERT((QueueCount != 0) && (QueueCount <= NVME_MAX_IO_QUEUES));
+
+    //
+    // Both counts in the number of queues feature are zero based.
+    //
+
+    RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+    Entry.Opcode = NVME_ADMIN_SET_FEATURES;
+    Entry.CommandDword[0] = NVME_FEATURE_NUMBER_OF_QUEUES;
+    Entry.CommandDword[1] = (QueueCount - 1) |
+                            ((QueueCount - 1) <<
+                             NVME_QUEUE_COUNT_COMPLETION_SHIFT);
+
+    Status = NvmepExecuteAdminCommand(Controller, &Entry, &Result);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Allocated = (Result & 0xFFFF) + 1;
+    if (QueueCount > Allocated) {
+        QueueCount = Allocated;
+    }
+
+    Allocated = (Result >> NVME_QUEUE_COUNT_COMPLETION_SHIFT) + 1;
+    if (QueueCount > Allocated) {
+        QueueCount = Allocated;
+    }
+
+    if (Controller->IoQueues == NULL) {
+        AllocationSize = sizeof(NVME_QUEUE) * NVME_MAX_IO_QUEUES;
+        Controller->IoQueues = MmAllocateNonPagedPool(AllocationSize,
+                                                      NVME_ALLOCATION_TAG);
+
+        if (Controller->IoQueues == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(Controller->IoQueues, AllocationSize);
+        for (Index = 0; Index < NVME_MAX_IO_QUEUES; Index += 1) {
+            Queue = &(Controller->IoQueues[Index]);
+            Queue->Controller = Controller;
+            Queue->InterruptHandle = INVALID_HANDLE;
+            KeInitializeSpinLock(&(Queue->Lock));
+            INITIALIZE_LIST_HEAD(&(Queue->IrpQueue));
+        }
+    }
+
+    Size = NVME_IO_QUEUE_SIZE;
+    if (Size > Controller->MaxQueueEntries) {
+        Size = Controller->MaxQueueEntries;
+    }
+
+    //
+    // Without MSI-X every queue signals the one legacy interrupt.
+    //
+
+    for (Index = 0; Index < QueueCount; Index += 1) {
+        Queue = &(Controller->IoQueues[Index]);
+        Status = NvmepAllocateQueue(Queue, Index + 1, Size);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        Status = NvmepInitializeCommands(Queue);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        InterruptIndex = 0;
+        if (Controller->MsiVectorCount != 0) {
+
+            ASSERT(Index < Controller->MsiVectorCount);
+
+            Queue->InterruptVector = Controller->MsiVectors[Index];
+            InterruptIndex = Index;
+        }
+
+        Status = NvmepCreateQueuePair(Queue, TRUE, InterruptIndex);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
+    Controller->IoQueueCount = QueueCount;
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+NvmepIdentifyNamespaces (
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the active namespaces on the controller and creates a
+    disk structure for each one.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG BlockShift;
+    PNVME_DISK Disk;
+    NVME_SUBMISSION_ENTRY Entry;
+    ULONG Format;
+    PUCHAR Identify;
+    PIO_BUFFER IoBuffer;
+    ULONG NamespaceCount;
+    ULONG NamespaceId;
+    ULONGLONG NamespaceSize;
+    ULONG Offset;
+    KSTATUS Status;
+
+    //
+    // The namespaces are only gathered once, the first time the controller
+    // starts.
+    //
+
+    if (Controller->DiskCount != 0) {
+        return STATUS_SUCCESS;
+    }
+
+    IoBuffer = Controller->IdentifyIoBuffer;
+    Identify = IoBuffer->Fragment[0].VirtualAddress;
+    NamespaceCount = Controller->NamespaceCount;
+    if (NamespaceCount > NVME_MAX_NAMESPACES) {
+        NamespaceCount = NVME_MAX_NAMESPACES;
+    }
+
+    for (NamespaceId = 1; NamespaceId <= NamespaceCount; NamespaceId += 1) {
+        RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+        Entry.Opcode = NVME_ADMIN_IDENTIFY;
+        Entry.NamespaceId = NamespaceId;
+        Entry.Prp1 = IoBuffer->Fragment[0].PhysicalAddress;
+        Entry.CommandDword[0] = NVME_IDENTIFY_NAMESPACE;
+        Status = NvmepExecuteAdminCommand(Controller, &Entry, NULL);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        //
+        // Inactive namespaces report a size of zero.
+        //
+
+        NamespaceSize =
+             *((PULONGLONG)&(Identify[NVME_IDENTIFY_NAMESPACE_SIZE_OFFSET]));
+
+        if (NamespaceSize == 0) {
+            continue;
+        }
+
+        //
+        // Skip formats with metadata, which the driver has nowhere to put,
+        // and blocks that don't fit in a page.
+        //
+
+        Format = Identify[NVME_IDENTIFY_NAMESPACE_FORMAT_OFFSET] &
+                 NVME_IDENTIFY_NAMESPACE_FORMAT_MASK;
+
+        Offset = NVME_IDENTIFY_NAMESPACE_LBA_FORMATS_OFFSET +
+                 (Format * sizeof(ULONG));
+
+        Format = *((PULONG)&(Identify[Offset]));
+
+        BlockShift = (Format >> NVME_LBA_FORMAT_DATA_SIZE_SHIFT) &
+                     NVME_LBA_FORMAT_DATA_SIZE_MASK;
+
+        if (((Format & NVME_LBA_FORMAT_METADATA_SIZE_MASK) != 0) ||
+            (BlockShift < NVME_MIN_BLOCK_SHIFT) ||
+            (BlockShift > NVME_PAGE_SHIFT)) {
+
+            RtlDebugPrint("NVMe: Skipping namespace %d with format 0x%x\n",
+                          NamespaceId,
+                          Format);
+
+            continue;
+        }
+
+        Disk = MmAllocateNonPagedPool(sizeof(NVME_DISK), NVME_ALLOCATION_TAG);
+        if (Disk == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(Disk, sizeof(NVME_DISK));
+        Disk->Type = NvmeContextDisk;
+        Disk->Controller = Controller;
+        Disk->NamespaceId = NamespaceId;
+        Disk->BlockShift = BlockShift;
+        Disk->BlockSize = 1 << BlockShift;
+        Disk->BlockCount = NamespaceSize;
+        Controller->Disks[Controller->DiskCount] = Disk;
+        Controller->DiskCount += 1;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+NvmepEnqueueIrp (
+    PNVME_DISK Disk,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pends an I/O or synchronize IRP and sends it down the
+    current processor's queue, or holds it there until a command is free.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+    Irp - Supplies a pointer to the IRP.
+
+Return Value:
+
+    Status code. On failure, the caller is responsible for completing the IRP.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+    RUNLEVEL OldRunLevel;
+    PNVME_QUEUE Queue;
+    KSTATUS Status;
+
+    Controller = Disk->Controller;
+    IoPendIrp(NvmeDriver, Irp);
+
+    //
+    // Each processor submits to its own queue, so the common case takes a
+    // lock no other processor is contending for. Running at dispatch keeps
+    // the thread from migrating after picking it.
+    //
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Queue = &(Controller->IoQueues[KeGetCurrentProcessorNumber() %
+                                   Controller->IoQueueCount]);
+
+    KeAcquireSpinLock(&(Queue->Lock));
+
+    //
+    // If the disk disappeared, fail the I/O now.
+    //
+
+    if (Disk->Removed != FALSE) {
+        Status = STATUS_NO_SUCH_DEVICE;
+        goto EnqueueIrpEnd;
+    }
+
+    //
+    // Keep IRPs in order behind anything already waiting.
+    //
+
+    Status = STATUS_RESOURCE_IN_USE;
+    if (LIST_EMPTY(&(Queue->IrpQueue)) != FALSE) {
+        Status = NvmepSubmitIrp(Queue, Irp);
+    }
+
+    if (Status == STATUS_RESOURCE_IN_USE) {
+        INSERT_BEFORE(&(Irp->ListEntry), &(Queue->IrpQueue));
+        Status = STATUS_SUCCESS;
+    }
+
+EnqueueIrpEnd:
+    KeReleaseSpinLock(&(Queue->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    return Status;
+}
+
+VOID
+NvmepProcessDiskRemoval (
+    PNVME_DISK Disk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fails all queued IRPs for a disk that is going away. IRPs
+    already handed to the controller are failed too once the controller can
+    no longer touch their buffers: either it has been physically removed, or
+    this was its last disk and it has been disabled. Otherwise they are left
+    with the controller, and complete normally when it finishes them.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG CommandIndex;
+    PNVME_CONTROLLER Controller;
+    PLIST_ENTRY CurrentEntry;
+    ULONG DiskIndex;
+    BOOL FailInFlight;
+    ULONGLONG InFlight;
+    PIRP Irp;
+    RUNLEVEL OldRunLevel;
+    PNVME_QUEUE Queue;
+    ULONG QueueIndex;
+    KSTATUS Status;
+
+    Controller = Disk->Controller;
+    Disk->Removed = TRUE;
+
+    //
+    // Register reads come back as all ones once the device is gone from the
+    // bus, in which case nothing is left to transfer into any buffer.
+    // Otherwise, if no other disk is using the controller, disable it to stop
+    // whatever it still has in flight. Disabling it with another disk still
+    // in use would fail that disk's I/O too.
+    //
+
+    FailInFlight = TRUE;
+    if (NVME_READ(Controller, NvmeStatus) != NVME_REGISTER_ABSENT) {
+        for (DiskIndex = 0; DiskIndex < Controller->DiskCount; DiskIndex += 1) {
+            if (Controller->Disks[DiskIndex]->Removed == FALSE) {
+                FailInFlight = FALSE;
+                break;
+            }
+        }
+
+        if (FailInFlight != FALSE) {
+            Status = NvmepDisableController(Controller);
+            if (!KSUCCESS(Status)) {
+                RtlDebugPrint("NVMe: Failed to disable: %d\n", Status);
+                FailInFlight = FALSE;
+            }
+        }
+    }
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    for (QueueIndex = 0;
+         QueueIndex < Controller->IoQueueCount;
+         QueueIndex += 1) {
+
+        Queue = &(Controller->IoQueues[QueueIndex]);
+        KeAcquireSpinLock(&(Queue->Lock));
+
+        //
+        // Commands for removed disks will never complete once the controller
+        // is stopped or gone. This includes commands left in flight by disks
+        // removed earlier, while the controller was still running.
+        //
+
+        if (FailInFlight != FALSE) {
+            InFlight = ~(Queue->FreeCommands);
+            for (CommandIndex = 0;
+                 CommandIndex < Queue->CommandCount;
+                 CommandIndex += 1) {
+
+                if (((InFlight & (1ULL << CommandIndex)) == 0) ||
+                    (Queue->Commands[CommandIndex].Disk == NULL) ||
+                    (Queue->Commands[CommandIndex].Disk->Removed == FALSE)) {
+
+                    continue;
+                }
+
+                Irp = Queue->Commands[CommandIndex].Irp;
+                Queue->Commands[CommandIndex].Irp = NULL;
+                Queue->Commands[CommandIndex].Disk = NULL;
+                Queue->FreeCommands |= 1ULL << CommandIndex;
+                if (Irp != NULL) {
+                    IoCompleteIrp(NvmeDriver, Irp, STATUS_NO_SUCH_DEVICE);
+                }
+            }
+        }
+
+        CurrentEntry = Queue->IrpQueue.Next;
+        while (CurrentEntry != &(Queue->IrpQueue)) {
+            Irp = LIST_VALUE(CurrentEntry, IRP, ListEntry);
+            CurrentEntry = CurrentEntry->Next;
+            if (Irp->Device == Disk->OsDevice) {
+                LIST_REMOVE(&(Irp->ListEntry));
+                IoCompleteIrp(NvmeDriver, Irp, STATUS_NO_SUCH_DEVICE);
+            }
+        }
+
+        KeReleaseSpinLock(&(Queue->Lock));
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    return;
+}
+
+KSTATUS
+NvmepBlockIoInitialize (
+    PVOID DiskToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares the disk for polled block I/O by allocating the
+    bounce buffer it uses. This must be called at low level.
+
+Arguments:
+
+    DiskToken - Supplies a pointer to the disk.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+    PNVME_DISK Disk;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Disk = DiskToken;
+    Controller = Disk->Controller;
+    if (Controller->PolledIoBuffer == NULL) {
+        Controller->PolledIoBuffer = MmAllocateNonPagedIoBuffer(
+                                         0,
+                                         MAX_ULONGLONG,
+                                         NVME_PAGE_SIZE,
+                                         NVME_POLLED_BUFFER_SIZE,
+                                         IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS);
+
+        if (Controller->PolledIoBuffer == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+NvmepBlockIoReset (
+    PVOID DiskToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets the controller and brings up a single polled I/O
+    queue, so that block I/O can run regardless of what the system was doing.
+    This routine must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies a pointer to the disk.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+    PNVME_DISK Disk;
+    NVME_SUBMISSION_ENTRY Entry;
+    ULONG Index;
+    PNVME_QUEUE Queue;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelHigh);
+
+    Disk = DiskToken;
+    Controller = Disk->Controller;
+    if ((Controller->PolledIoBuffer == NULL) ||
+        (Controller->Started == FALSE)) {
+
+        return STATUS_NOT_READY;
+    }
+
+    //
+    // Disabling the controller throws away every queue and command. Bring
+    // back just the first I/O queue, with interrupts off.
+    //
+
+    Status = NvmepEnableController(Controller);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+    Entry.Opcode = NVME_ADMIN_SET_FEATURES;
+    Entry.CommandDword[0] = NVME_FEATURE_NUMBER_OF_QUEUES;
+    Status = NvmepExecuteAdminCommand(Controller, &Entry, NULL);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Queue = &(Controller->IoQueues[0]);
+    Queue->FreeCommands = 0;
+    for (Index = 0; Index < Queue->CommandCount; Index += 1) {
+        Queue->Commands[Index].Irp = NULL;
+        Queue->FreeCommands |= 1ULL << Index;
+    }
+
+    Status = NvmepCreateQueuePair(Queue, FALSE, 0);
+    return Status;
+}
+
+KSTATUS
+NvmepBlockIoRead (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the block contents from the disk into the given I/O
+    buffer using polled I/O. This must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies a pointer to the disk.
+
+    IoBuffer - Supplies a pointer to the I/O buffer where the data will be
+        read.
+
+    BlockAddress - Supplies the block index to read from (for physical disk,
+        this is the LBA).
+
+    BlockCount - Supplies the number of blocks to read.
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks read.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelHigh);
+
+    Status = NvmepPerformPolledIo(DiskToken,
+                                  IoBuffer,
+                                  BlockAddress,
+                                  BlockCount,
+                                  FALSE,
+                                  BlocksCompleted);
+
+    return Status;
+}
+
+KSTATUS
+NvmepBlockIoWrite (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes the contents of the given I/O buffer to the disk using
+    polled I/O. This must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies a pointer to the disk.
+
+    IoBuffer - Supplies a pointer to the I/O buffer containing the data to
+        write.
+
+    BlockAddress - Supplies the block index to write to (for physical disk,
+        this is the LBA).
+
+    BlockCount - Supplies the number of blocks to write.
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks written.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelHigh);
+
+    Status = NvmepPerformPolledIo(DiskToken,
+                                  IoBuffer,
+                                  BlockAddress,
+                                  BlockCount,
+                                  TRUE,
+                                  BlocksCompleted);
+
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+NvmepEnableController (
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine disables the controller, which resets all of its queues,
+    then points it at a fresh admin queue and enables it again.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PNVME_QUEUE AdminQueue;
+    ULONG Attributes;
+    ULONG Configuration;
+    KSTATUS Status;
+
+    Status = NvmepDisableController(Controller);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    AdminQueue = &(Controller->AdminQueue);
+    NvmepResetQueue(AdminQueue);
+    Attributes = (AdminQueue->Size - 1) |
+                 ((AdminQueue->Size - 1) <<
+                  NVME_ADMIN_QUEUE_COMPLETION_SIZE_SHIFT);
+
+    NVME_WRITE(Controller, NvmeAdminQueueAttributes, Attributes);
+    NVME_WRITE(Controller,
+               NvmeAdminSubmissionQueue,
+               (ULONG)(AdminQueue->SubmissionPhysical));
+
+    NVME_WRITE(Controller,
+               NvmeAdminSubmissionQueueHigh,
+               (ULONG)(AdminQueue->SubmissionPhysical >> 32));
+
+    NVME_WRITE(Controller,
+               NvmeAdminCompletionQueue,
+               (ULONG)(AdminQueue->CompletionPhysical));
+
+    NVME_WRITE(Controller,
+               NvmeAdminCompletionQueueHigh,
+               (ULONG)(AdminQueue->CompletionPhysical >> 32));
+
+    //
+    // Use the NVM command set, 4KB pages, and the standard entry sizes.
+    //
+
+    Configuration = NVME_CONFIGURATION_ENABLE |
+                    (NVME_SUBMISSION_ENTRY_SHIFT <<
+                     NVME_CONFIGURATION_SUBMISSION_ENTRY_SHIFT) |
+                    (NVME_COMPLETION_ENTRY_SHIFT <<
+                     NVME_CONFIGURATION_COMPLETION_ENTRY_SHIFT);
+
+    NVME_WRITE(Controller, NvmeConfiguration, Configuration);
+    Status = NvmepWaitForReady(Controller, TRUE);
+    return Status;
+}
+
+KSTATUS
+NvmepDisableController (
+    PNVME_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine disables the controller and waits for it to stop. Once it
+    reports not ready, it has dropped every queue and command and is no longer
+    transferring data.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Configuration;
+    KSTATUS Status;
+
+    Configuration = NVME_READ(Controller, NvmeConfiguration);
+    if ((Configuration & NVME_CONFIGURATION_ENABLE) != 0) {
+        Configuration &= ~NVME_CONFIGURATION_ENABLE;
+        NVME_WRITE(Controller, NvmeConfiguration, Configuration);
+    }
+
+    Status = NvmepWaitForReady(Controller, FALSE);
+    return Status;
+}
+
+KSTATUS
+NvmepWaitForReady (
+    PNVME_CONTROLLER Controller,
+    BOOL Ready
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits for the controller to report the given ready state.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Ready - Supplies a boolean indicating whether to wait for the controller
+        to become ready (TRUE) or not ready (FALSE).
+
+Return Value:
+
+    STATUS_SUCCESS once the controller is in the given state.
+
+    STATUS_DEVICE_IO_ERROR if the controller reports a fatal error.
+
+    STATUS_TIMEOUT if the controller did not change state in time.
+
+--*/
+
+{
+
+    BOOL CurrentlyReady;
+    ULONG Status;
+    ULONG Waited;
+
+    Waited = 0;
+    while (TRUE) {
+        Status = NVME_READ(Controller, NvmeStatus);
+        CurrentlyReady = FALSE;
+        if ((Status & NVME_STATUS_READY) != 0) {
+            CurrentlyReady = TRUE;
+        }
+
+        if (CurrentlyReady == Ready) {
+            break;
+        }
+
+        //
+        // A fatal error only matters on the way up. Disabling the controller
+        // is how it gets cleared.
+        //
+
+        if ((Ready != FALSE) && ((Status & NVME_STATUS_FATAL) != 0)) {
+            return STATUS_DEVICE_IO_ERROR;
+        }
+
+        if (Waited >= Controller->ReadyTimeout) {
+            return STATUS_TIMEOUT;
+        }
+
+        HlBusySpin(MICROSECONDS_PER_MILLISECOND);
+        Waited += MICROSECONDS_PER_MILLISECOND;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+NvmepAllocateQueue (
+    PNVME_QUEUE Queue,
+    USHORT QueueId,
+    USHORT Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates the memory for a submission and completion queue
+    pair, if it hasn't been already. The submission queue gets the first page
+    and the completion queue the second.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    QueueId - Supplies the queue identifier.
+
+    Size - Supplies the number of entries in each queue.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PIO_BUFFER_FRAGMENT Fragment;
+
+    ASSERT((Size * NVME_SUBMISSION_ENTRY_SIZE) <= NVME_PAGE_SIZE);
+
+    Queue->QueueId = QueueId;
+    Queue->Size = Size;
+    if (Queue->IoBuffer == NULL) {
+        Queue->IoBuffer = MmAllocateNonPagedIoBuffer(
+                                         0,
+                                         MAX_ULONGLONG,
+                                         NVME_PAGE_SIZE,
+                                         NVME_PAGE_SIZE * 2,
+                                         IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS);
+
+        if (Queue->IoBuffer == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        ASSERT(Queue->IoBuffer->FragmentCount == 1);
+
+        Fragment = &(Queue->IoBuffer->Fragment[0]);
+        Queue->SubmissionQueue = Fragment->VirtualAddress;
+        Queue->SubmissionPhysical = Fragment->PhysicalAddress;
+        Queue->CompletionQueue = Fragment->VirtualAddress + NVME_PAGE_SIZE;
+        Queue->CompletionPhysical = Fragment->PhysicalAddress +
+                                    NVME_PAGE_SIZE;
+    }
+
+    NvmepResetQueue(Queue);
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+NvmepInitializeCommands (
+    PNVME_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a page of PRP list for each command slot in an I/O
+    queue and marks every slot free.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PNVME_COMMAND Command;
+    ULONG CommandCount;
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
+    UINTN FragmentOffset;
+    ULONG Index;
+    PIO_BUFFER IoBuffer;
+
+    CommandCount = Queue->Size - 1;
+    if (CommandCount > NVME_IO_COMMAND_COUNT) {
+        CommandCount = NVME_IO_COMMAND_COUNT;
+    }
+
+    //
+    // The PRP list pages need not be contiguous with each other.
+    //
+
+    if (Queue->PrpIoBuffer == NULL) {
+        Queue->PrpIoBuffer = MmAllocateNonPagedIoBuffer(
+                                                0,
+                                                MAX_ULONGLONG,
+                                                NVME_PAGE_SIZE,
+                                                CommandCount * NVME_PAGE_SIZE,
+                                                0);
+
+        if (Queue->PrpIoBuffer == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    IoBuffer = Queue->PrpIoBuffer;
+    FragmentIndex = 0;
+    FragmentOffset = 0;
+    Queue->FreeCommands = 0;
+    for (Index = 0; Index < CommandCount; Index += 1) {
+
+        ASSERT(FragmentIndex < IoBuffer->FragmentCount);
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        Command = &(Queue->Commands[Index]);
+        Command->Irp = NULL;
+        Command->Disk = NULL;
+        Command->IoSize = 0;
+        Command->PrpList = Fragment->VirtualAddress + FragmentOffset;
+        Command->PrpListPhysical = Fragment->PhysicalAddress + FragmentOffset;
+        Queue->FreeCommands |= 1ULL << Index;
+        FragmentOffset += NVME_PAGE_SIZE;
+        if (FragmentOffset >= Fragment->Size) {
+            FragmentIndex += 1;
+            FragmentOffset = 0;
+        }
+    }
+
+    Queue->CommandCount = CommandCount;
+    return STATUS_SUCCESS;
+}
+
+VOID
+NvmepResetQueue (
+    PNVME_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine clears a queue pair's memory and software state so it can
+    be handed to the controller fresh.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+
+    Controller = Queue->Controller;
+    RtlZeroMemory(Queue->IoBuffer->Fragment[0].VirtualAddress,
+                  Queue->IoBuffer->Fragment[0].Size);
+
+    Queue->SubmissionTail = 0;
+    Queue->CompletionHead = 0;
+    Queue->Phase = 1;
+    Queue->SubmissionDoorbell = NVME_DOORBELL_OFFSET(Controller,
+                                                     Queue->QueueId,
+                                                     0);
+
+    Queue->CompletionDoorbell = NVME_DOORBELL_OFFSET(Controller,
+                                                     Queue->QueueId,
+                                                     1);
+
+    return;
+}
+
+KSTATUS
+NvmepCreateQueuePair (
+    PNVME_QUEUE Queue,
+    BOOL InterruptsEnabled,
+    ULONG InterruptIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets an I/O queue pair's state and creates it on the
+    controller, completion queue first.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    InterruptsEnabled - Supplies a boolean indicating whether the completion
+        queue should generate interrupts.
+
+    InterruptIndex - Supplies the MSI-X table index the completion queue
+        signals.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PNVME_CONTROLLER Controller;
+    NVME_SUBMISSION_ENTRY Entry;
+    ULONG QueueAttributes;
+    KSTATUS Status;
+
+    Controller = Queue->Controller;
+    NvmepResetQueue(Queue);
+    RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+    Entry.Opcode = NVME_ADMIN_CREATE_COMPLETION_QUEUE;
+    Entry.Prp1 = Queue->CompletionPhysical;
+    Entry.CommandDword[0] = Queue->QueueId |
+                            ((Queue->Size - 1) << NVME_QUEUE_SIZE_SHIFT);
+
+    QueueAttributes = NVME_CREATE_QUEUE_PHYSICALLY_CONTIGUOUS;
+    if (InterruptsEnabled != FALSE) {
+        QueueAttributes |= NVME_CREATE_QUEUE_INTERRUPTS_ENABLED |
+                           (InterruptIndex << NVME_CREATE_QUEUE_VECTOR_SHIFT);
+    }
+
+    Entry.CommandDword[1] = QueueAttributes;
+    Status = NvmepExecuteAdminCommand(Controller, &Entry, NULL);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+    Entry.Opcode = NVME_ADMIN_CREATE_SUBMISSION_QUEUE;
+    Entry.Prp1 = Queue->SubmissionPhysical;
+    Entry.CommandDword[0] = Queue->QueueId |
+                            ((Queue->Size - 1) << NVME_QUEUE_SIZE_SHIFT);
+
+    Entry.CommandDword[1] = NVME_CREATE_QUEUE_PHYSICALLY_CONTIGUOUS |
+                            (Queue->QueueId <<
+                             NVME_CREATE_QUEUE_COMPLETION_QUEUE_SHIFT);
+
+    Status = NvmepExecuteAdminCommand(Controller, &Entry, NULL);
+    return Status;
+}
+
+KSTATUS
+NvmepExecuteAdminCommand (
+    PNVME_CONTROLLER Controller,
+    PNVME_SUBMISSION_ENTRY Entry,
+    PULONG Result
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends a command to the admin queue and spins until it
+    completes. Admin commands are only sent while the controller is being
+    brought up or reset, one at a time.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Entry - Supplies a pointer to the command. Its command identifier is
+        filled in by this routine.
+
+    Result - Supplies an optional pointer where the command specific result
+        is returned.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    NVME_COMPLETION_ENTRY Completion;
+    PNVME_QUEUE Queue;
+    KSTATUS Status;
+
+    Queue = &(Controller->AdminQueue);
+    Entry->CommandId = Queue->SubmissionTail;
+    NvmepSubmitEntry(Queue, Entry);
+    Status = NvmepPollForCompletion(Queue, &Completion);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    ASSERT(NVME_COMPLETION_COMMAND_ID(Completion.Status) == Entry->CommandId);
+
+    if (Result != NULL) {
+        *Result = Completion.CommandSpecific;
+    }
+
+    Status = NvmepTranslateStatus(Completion.Status);
+    if (!KSUCCESS(Status)) {
+        RtlDebugPrint("NVMe: Admin command 0x%x failed: 0x%x\n",
+                      Entry->Opcode,
+                      NVME_COMPLETION_STATUS(Completion.Status));
+    }
+
+    return Status;
+}
+
+KSTATUS
+NvmepPollForCompletion (
+    PNVME_QUEUE Queue,
+    PNVME_COMPLETION_ENTRY Completion
+    )
+
+/*++
+
+Routine Description:
+
+    This routine spins waiting for the next completion on a queue that isn't
+    serviced by interrupts.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Completion - Supplies a pointer where the completion entry is returned.
+
+Return Value:
+
+    STATUS_SUCCESS if a completion arrived.
+
+    STATUS_TIMEOUT if nothing completed in time.
+
+--*/
+
+{
+
+    ULONG Waited;
+
+    Waited = 0;
+    while (NvmepGetCompletion(Queue, Completion) == FALSE) {
+        if (Waited >= NVME_COMMAND_TIMEOUT) {
+            return STATUS_TIMEOUT;
+        }
+
+        HlBusySpin(NVME_POLL_INTERVAL);
+        Waited += NVME_POLL_INTERVAL;
+    }
+
+    NVME_WRITE_DOORBELL(Queue->Controller,
+                        Queue->CompletionDoorbell,
+                        Queue->CompletionHead);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NvmepSubmitEntry (
+    PNVME_QUEUE Queue,
+    PNVME_SUBMISSION_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies a command into the next submission queue slot and
+    rings the doorbell. The caller makes sure there is room.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Entry - Supplies a pointer to the command.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RtlCopyMemory(&(Queue->SubmissionQueue[Queue->SubmissionTail]),
+                  Entry,
+                  sizeof(NVME_SUBMISSION_ENTRY));
+
+    Queue->SubmissionTail += 1;
+    if (Queue->SubmissionTail == Queue->Size) {
+        Queue->SubmissionTail = 0;
+    }
+
+    RtlMemoryBarrier();
+    NVME_WRITE_DOORBELL(Queue->Controller,
+                        Queue->SubmissionDoorbell,
+                        Queue->SubmissionTail);
+
+    return;
+}
+
+BOOL
+NvmepGetCompletion (
+    PNVME_QUEUE Queue,
+    PNVME_COMPLETION_ENTRY Completion
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pulls the next new entry off a completion queue, if there is
+    one. The caller is responsible for writing the head doorbell afterwards.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Completion - Supplies a pointer where the completion entry is returned.
+
+Return Value:
+
+    TRUE if an entry was returned.
+
+    FALSE if the controller hasn't posted a new entry.
+
+--*/
+
+{
+
+    volatile NVME_COMPLETION_ENTRY *Entry;
+    ULONG Status;
+
+    Entry = &(Queue->CompletionQueue[Queue->CompletionHead]);
+    Status = Entry->Status;
+    if (NVME_COMPLETION_PHASE(Status) != Queue->Phase) {
+        return FALSE;
+    }
+
+    //
+    // Don't read the rest of the entry before seeing the phase flip.
+    //
+
+    RtlMemoryBarrier();
+    Completion->CommandSpecific = Entry->CommandSpecific;
+    Completion->SubmissionHead = Entry->SubmissionHead;
+    Completion->SubmissionQueueId = Entry->SubmissionQueueId;
+    Completion->Status = Status;
+    Queue->CompletionHead += 1;
+    if (Queue->CompletionHead == Queue->Size) {
+        Queue->CompletionHead = 0;
+        Queue->Phase ^= 1;
+    }
+
+    return TRUE;
+}
+
+KSTATUS
+NvmepSubmitIrp (
+    PNVME_QUEUE Queue,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a free command slot and sends the first piece of the
+    given IRP to the controller. This routine assumes the queue lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Irp - Supplies a pointer to the IRP.
+
+Return Value:
+
+    STATUS_SUCCESS if the command was submitted.
+
+    STATUS_RESOURCE_IN_USE if there are no free commands.
+
+    STATUS_NO_SUCH_DEVICE if the IRP's disk is gone.
+
+--*/
+
+{
+
+    PNVME_COMMAND Command;
+    PNVME_DISK Disk;
+    ULONG Index;
+
+    if (Queue->FreeCommands == 0) {
+        return STATUS_RESOURCE_IN_USE;
+    }
+
+    Disk = NvmepGetIrpDisk(Queue->Controller, Irp);
+    if ((Disk == NULL) || (Disk->Removed != FALSE)) {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    Index = RtlCountTrailingZeros64(Queue->FreeCommands);
+    Queue->FreeCommands &= ~(1ULL << Index);
+    Command = &(Queue->Commands[Index]);
+    Command->Irp = Irp;
+    Command->Disk = Disk;
+    NvmepStartCommand(Queue, Command);
+    return STATUS_SUCCESS;
+}
+
+VOID
+NvmepStartCommand (
+    PNVME_QUEUE Queue,
+    PNVME_COMMAND Command
+    )
+
+/*++
+
+Routine Description:
+
+    This routine submits the next round of a command's IRP. A synchronize IRP
+    gets a flush. A read or write gets as much of its remaining data as one
+    command can describe. This routine assumes the queue lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Command - Supplies a pointer to the command, with its IRP and disk filled
+        in.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG BlockCount;
+    UINTN BytesPreviouslyCompleted;
+    PNVME_DISK Disk;
+    NVME_SUBMISSION_ENTRY Entry;
+    PIO_BUFFER IoBuffer;
+    UINTN IoBufferOffset;
+    PIRP Irp;
+    ULONGLONG Lba;
+    UINTN TransferSize;
+
+    Irp = Command->Irp;
+    Disk = Command->Disk;
+    RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+    Entry.CommandId = Command - Queue->Commands;
+    Entry.NamespaceId = Disk->NamespaceId;
+    if (Irp->MajorCode != IrpMajorIo) {
+        Entry.Opcode = NVME_COMMAND_FLUSH;
+        Command->IoSize = 0;
+        NvmepSubmitEntry(Queue, &Entry);
+        return;
+    }
+
+    IoBuffer = Irp->U.ReadWrite.IoBuffer;
+    BytesPreviouslyCompleted = Irp->U.ReadWrite.IoBytesCompleted;
+
+    ASSERT(BytesPreviouslyCompleted < Irp->U.ReadWrite.IoSizeInBytes);
+
+    TransferSize = Irp->U.ReadWrite.IoSizeInBytes - BytesPreviouslyCompleted;
+    if (TransferSize > Queue->Controller->MaxTransferSize) {
+        TransferSize = Queue->Controller->MaxTransferSize;
+    }
+
+    IoBufferOffset = MmGetIoBufferCurrentOffset(IoBuffer) +
+                     BytesPreviouslyCompleted;
+
+    TransferSize = NvmepBuildPrpList(Command,
+                                     IoBuffer,
+                                     IoBufferOffset,
+                                     TransferSize,
+                                     &Entry);
+
+    ASSERT((TransferSize != 0) &&
+           (IS_ALIGNED(TransferSize, Disk->BlockSize) != FALSE));
+
+    Lba = Irp->U.ReadWrite.NewIoOffset >> Disk->BlockShift;
+    BlockCount = TransferSize >> Disk->BlockShift;
+    Entry.Opcode = NVME_COMMAND_READ;
+    Entry.CommandDword[0] = (ULONG)Lba;
+    Entry.CommandDword[1] = (ULONG)(Lba >> 32);
+    Entry.CommandDword[2] = BlockCount - 1;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        Entry.Opcode = NVME_COMMAND_WRITE;
+
+        //
+        // A synchronized write isn't done until the data is out of the
+        // controller's cache, so have the controller write it through rather
+        // than following up with a flush.
+        //
+
+        if ((Irp->U.ReadWrite.IoFlags & IO_FLAG_DATA_SYNCHRONIZED) != 0) {
+            Entry.CommandDword[2] |= NVME_READ_WRITE_FORCE_UNIT_ACCESS;
+        }
+    }
+
+    Command->IoSize = TransferSize;
+    NvmepSubmitEntry(Queue, &Entry);
+    return;
+}
+
+UINTN
+NvmepBuildPrpList (
+    PNVME_COMMAND Command,
+    PIO_BUFFER IoBuffer,
+    UINTN Offset,
+    UINTN Size,
+    PNVME_SUBMISSION_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills in a command's PRP entries for a run of an I/O buffer,
+    walking the buffer's fragments rather than looking up each page. Every
+    entry after the first must start on a page, and every entry before the
+    last must end on one, so the run stops early at a fragment boundary that
+    isn't page aligned, or when the command's PRP list page is full.
+
+Arguments:
+
+    Command - Supplies a pointer to the command, whose PRP list page is used
+        if more than two entries are needed.
+
+    IoBuffer - Supplies a pointer to the I/O buffer.
+
+    Offset - Supplies the offset from the beginning of the I/O buffer, not
+        the current offset, where the run begins.
+
+    Size - Supplies the most bytes to describe.
+
+    Entry - Supplies a pointer to the submission entry whose PRP fields are
+        filled in.
+
+Return Value:
+
+    Returns the number of bytes the PRP entries describe.
+
+--*/
+
+{
+
+    PHYSICAL_ADDRESS Address;
+    UINTN Chunk;
+    ULONG EntryCount;
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
+    UINTN FragmentOffset;
+    UINTN TransferSize;
+
+    //
+    // Get to the starting spot in the I/O buffer.
+    //
+
+    FragmentIndex = 0;
+    FragmentOffset = Offset;
+    while (FragmentIndex < IoBuffer->FragmentCount) {
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        if (FragmentOffset < Fragment->Size) {
+            break;
+        }
+
+        FragmentOffset -= Fragment->Size;
+        FragmentIndex += 1;
+    }
+
+    EntryCount = 0;
+    TransferSize = 0;
+    while ((TransferSize < Size) &&
+           (EntryCount < NVME_PRP_LIST_ENTRIES + 1)) {
+
+        ASSERT(FragmentIndex < IoBuffer->FragmentCount);
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        Address = Fragment->PhysicalAddress + FragmentOffset;
+        if ((EntryCount != 0) &&
+            (IS_ALIGNED(Address, NVME_PAGE_SIZE) == FALSE)) {
+
+            break;
+        }
+
+        Chunk = NVME_PAGE_SIZE - REMAINDER(Address, NVME_PAGE_SIZE);
+        if (Chunk > Fragment->Size - FragmentOffset) {
+            Chunk = Fragment->Size - FragmentOffset;
+        }
+
+        if (Chunk > Size - TransferSize) {
+            Chunk = Size - TransferSize;
+        }
+
+        if (EntryCount == 0) {
+            Entry->Prp1 = Address;
+
+        } else {
+            Command->PrpList[EntryCount - 1] = Address;
+        }
+
+        EntryCount += 1;
+        TransferSize += Chunk;
+        FragmentOffset += Chunk;
+        if (FragmentOffset >= Fragment->Size) {
+            FragmentIndex += 1;
+            FragmentOffset = 0;
+        }
+
+        if (IS_ALIGNED(Address + Chunk, NVME_PAGE_SIZE) == FALSE) {
+            break;
+        }
+    }
+
+    //
+    // Two entries fit in the command itself. Beyond that the second points
+    // at the list.
+    //
+
+    Entry->Prp2 = 0;
+    if (EntryCount == 2) {
+        Entry->Prp2 = Command->PrpList[0];
+
+    } else if (EntryCount > 2) {
+        Entry->Prp2 = Command->PrpListPhysical;
+    }
+
+    return TransferSize;
+}
+
+VOID
+NvmepProcessCompletions (
+    PNVME_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles every new entry on an I/O completion queue. This
+    routine assumes the queue lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG CommandId;
+    NVME_COMPLETION_ENTRY Completion;
+    BOOL Processed;
+
+    Processed = FALSE;
+    while (NvmepGetCompletion(Queue, &Completion) != FALSE) {
+        Processed = TRUE;
+        CommandId = NVME_COMPLETION_COMMAND_ID(Completion.Status);
+        if (CommandId >= Queue->CommandCount) {
+
+            ASSERT(FALSE);
+
+            continue;
+        }
+
+        NvmepCompleteCommand(Queue,
+                             &(Queue->Commands[CommandId]),
+                             Completion.Status);
+    }
+
+    if (Processed != FALSE) {
+        NVME_WRITE_DOORBELL(Queue->Controller,
+                            Queue->CompletionDoorbell,
+                            Queue->CompletionHead);
+    }
+
+    return;
+}
+
+VOID
+NvmepCompleteCommand (
+    PNVME_QUEUE Queue,
+    PNVME_COMMAND Command,
+    ULONG CompletionStatus
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles a command the controller has finished, either
+    sending the next round of its IRP in the same slot or completing the IRP.
+    This routine assumes the queue lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Command - Supplies a pointer to the finished command.
+
+    CompletionStatus - Supplies the status dword from the completion entry.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIRP Irp;
+    KSTATUS Status;
+
+    Irp = Command->Irp;
+    if (Irp != NULL) {
+        Status = NvmepTranslateStatus(CompletionStatus);
+        if ((KSUCCESS(Status)) && (Irp->MajorCode == IrpMajorIo)) {
+            Irp->U.ReadWrite.IoBytesCompleted += Command->IoSize;
+            Irp->U.ReadWrite.NewIoOffset += Command->IoSize;
+            if (Irp->U.ReadWrite.IoBytesCompleted <
+                Irp->U.ReadWrite.IoSizeInBytes) {
+
+                //
+                // If the disk went away while this was in flight, finish
+                // the IRP with what was transferred rather than sending
+                // another round.
+                //
+
+                if (Command->Disk->Removed == FALSE) {
+                    NvmepStartCommand(Queue, Command);
+                    return;
+                }
+
+                Status = STATUS_NO_SUCH_DEVICE;
+            }
+        }
+
+        Command->Irp = NULL;
+        IoCompleteIrp(NvmeDriver, Irp, Status);
+    }
+
+    Command->Disk = NULL;
+    Queue->FreeCommands |= 1ULL << (Command - Queue->Commands);
+    return;
+}
+
+VOID
+NvmepSubmitQueuedIrps (
+    PNVME_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends as many waiting IRPs to the controller as there are
+    free commands for. This routine assumes the queue lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIRP Irp;
+    KSTATUS Status;
+
+    while (LIST_EMPTY(&(Queue->IrpQueue)) == FALSE) {
+        Irp = LIST_VALUE(Queue->IrpQueue.Next, IRP, ListEntry);
+        Status = NvmepSubmitIrp(Queue, Irp);
+        if (Status == STATUS_RESOURCE_IN_USE) {
+            break;
+        }
+
+        LIST_REMOVE(&(Irp->ListEntry));
+        if (!KSUCCESS(Status)) {
+            IoCompleteIrp(NvmeDriver, Irp, Status);
+        }
+    }
+
+    return;
+}
+
+PNVME_DISK
+NvmepGetIrpDisk (
+    PNVME_CONTROLLER Controller,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the disk an I/O or synchronize IRP was sent to.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Irp - Supplies a pointer to the IRP.
+
+Return Value:
+
+    Returns a pointer to the disk, or NULL if it isn't one of the
+    controller's.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    if (Irp->MajorCode == IrpMajorIo) {
+        return Irp->U.ReadWrite.DeviceContext;
+    }
+
+    for (Index = 0; Index < Controller->DiskCount; Index += 1) {
+        if (Controller->Disks[Index]->OsDevice == Irp->Device) {
+            return Controller->Disks[Index];
+        }
+    }
+
+    return NULL;
+}
+
+KSTATUS
+NvmepPerformPolledIo (
+    PNVME_DISK Disk,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    BOOL Write,
+    PUINTN BlocksCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs polled I/O through the bounce buffer on the first
+    I/O queue, one command at a time, spinning until each one finishes.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+    IoBuffer - Supplies a pointer to the I/O buffer containing the data.
+
+    BlockAddress - Supplies the block index to start at.
+
+    BlockCount - Supplies the number of blocks to transfer.
+
+    Write - Supplies a boolean indicating if this is a write (TRUE) or a read
+        (FALSE).
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks transferred.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PVOID BounceBuffer;
+    UINTN BytesCompleted;
+    UINTN BytesToComplete;
+    PNVME_COMMAND Command;
+    NVME_COMPLETION_ENTRY Completion;
+    PNVME_CONTROLLER Controller;
+    NVME_SUBMISSION_ENTRY Entry;
+    ULONGLONG Lba;
+    PNVME_QUEUE Queue;
+    UINTN Size;
+    KSTATUS Status;
+
+    Controller = Disk->Controller;
+    Queue = &(Controller->IoQueues[0]);
+    Command = &(Queue->Commands[0]);
+    BounceBuffer = Controller->PolledIoBuffer->Fragment[0].VirtualAddress;
+    BytesCompleted = 0;
+    BytesToComplete = BlockCount << Disk->BlockShift;
+    Lba = BlockAddress;
+    Status = STATUS_SUCCESS;
+    while (BytesCompleted < BytesToComplete) {
+        Size = BytesToComplete - BytesCompleted;
+        if (Size > NVME_POLLED_BUFFER_SIZE) {
+            Size = NVME_POLLED_BUFFER_SIZE;
+        }
+
+        if (Size > Controller->MaxTransferSize) {
+            Size = Controller->MaxTransferSize;
+        }
+
+        RtlZeroMemory(&Entry, sizeof(NVME_SUBMISSION_ENTRY));
+        Entry.Opcode = NVME_COMMAND_READ;
+        if (Write != FALSE) {
+            Status = MmCopyIoBufferData(IoBuffer,
+                                        BounceBuffer,
+                                        BytesCompleted,
+                                        Size,
+                                        FALSE);
+
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+
+            Entry.Opcode = NVME_COMMAND_WRITE;
+        }
+
+        Entry.CommandId = 0;
+        Entry.NamespaceId = Disk->NamespaceId;
+        NvmepBuildPrpList(Command,
+                          Controller->PolledIoBuffer,
+                          0,
+                          Size,
+                          &Entry);
+
+        Entry.CommandDword[0] = (ULONG)Lba;
+        Entry.CommandDword[1] = (ULONG)(Lba >> 32);
+        Entry.CommandDword[2] = (Size >> Disk->BlockShift) - 1;
+        NvmepSubmitEntry(Queue, &Entry);
+
+        //
+        // The queue was recreated before polled I/O began, so the only thing
+        // that can come back is this command.
+        //
+
+        Status = NvmepPollForCompletion(Queue, &Completion);
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        Status = NvmepTranslateStatus(Completion.Status);
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        if (Write == FALSE) {
+            Status = MmCopyIoBufferData(IoBuffer,
+                                        BounceBuffer,
+                                        BytesCompleted,
+                                        Size,
+                                        TRUE);
+
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+        }
+
+        BytesCompleted += Size;
+        Lba += Size >> Disk->BlockShift;
+    }
+
+    *BlocksCompleted = BytesCompleted >> Disk->BlockShift;
+    return Status;
+}
+
+KSTATUS
+NvmepTranslateStatus (
+    ULONG CompletionStatus
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts the status field of a completion entry into a
+    status code.
+
+Arguments:
+
+    CompletionStatus - Supplies the status dword from the completion entry.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    if (NVME_COMPLETION_STATUS(CompletionStatus) == NVME_STATUS_SUCCESS) {
+        return STATUS_SUCCESS;
+    }
+
+    return STATUS_DEVICE_IO_ERROR;
+}
+
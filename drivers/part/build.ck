@@ -35,6 +35,7 @@ function build() {
     var sources;
 
     sources = [
+        "iosched.c",
         "part.c"
     ];
 
@@ -0,0 +1,1491 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    iosched.c
+
+Abstract:
+
+    This module implements the per-disk I/O queue. The partition manager sits
+    directly above the disk driver in every disk I/O stack, so it is in a
+    position to hold requests back while the disk is busy. Held requests are
+    kept sorted by disk offset and released in one-way elevator order,
+    contiguous neighbors are merged into a single larger transfer, and
+    per-direction deadlines keep requests far from the elevator from
+    starving.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include <minoca/devinfo/part.h>
+#include "iosched.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PART_IO_QUEUE_ALLOCATION_TAG 0x51747250 // 'QtrP'
+
+//
+// Define the default and largest number of requests the queue will have
+// outstanding at the disk at once.
+//
+
+#define PART_IO_QUEUE_DEFAULT_MAX_IN_FLIGHT 4
+#define PART_IO_QUEUE_MAX_IN_FLIGHT 256
+
+//
+// Define the largest transfer the queue will build by merging requests.
+//
+
+#define PART_IO_QUEUE_MAX_MERGE_SIZE _128KB
+
+//
+// Define how long reads and writes can wait in the queue before they are
+// sent out of elevator order, in milliseconds. Reads usually have someone
+// blocked on them, writes usually do not.
+//
+
+#define PART_IO_QUEUE_READ_DEADLINE 50
+#define PART_IO_QUEUE_WRITE_DEADLINE 500
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _PART_IO_REQUEST_STATE {
+    PartIoRequestInvalid,
+    PartIoRequestQueued,
+    PartIoRequestReleased,
+    PartIoRequestIssued,
+    PartIoRequestMerged
+} PART_IO_REQUEST_STATE, *PPART_IO_REQUEST_STATE;
+
+/*++
+
+Structure Description:
+
+    This structure stores the queue's bookkeeping for one I/O IRP.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous requests in the
+        sorted list, the in-flight list, or the member list of the request
+        this one was merged into.
+
+    FifoListEntry - Stores pointers to the next and previous requests in the
+        read or write list while the request is queued.
+
+    Irp - Stores a pointer to the IRP.
+
+    State - Stores the state of the request.
+
+    Write - Stores a boolean indicating if this is a write (TRUE) or a read
+        (FALSE).
+
+    Mergeable - Stores a boolean indicating if the request's buffer is made
+        of whole, physically known pages that can be stitched into a merged
+        buffer.
+
+    Mapped - Stores a boolean indicating if every page of the request's
+        buffer has a virtual address.
+
+    Deadline - Stores the time counter value after which the request should
+        be sent ahead of the elevator.
+
+    Offset - Stores the disk offset of the request, in bytes.
+
+    Size - Stores the size of the request, in bytes.
+
+    TotalSize - Stores the size of the request plus all the requests merged
+        into it, in bytes.
+
+    MemberList - Stores the head of the list of requests merged into this
+        one, in offset order.
+
+    OriginalIoBuffer - Stores the IRP's own I/O buffer while the merged buffer
+        is swapped in.
+
+    MergedIoBuffer - Stores the I/O buffer covering this request and all its
+        members.
+
+--*/
+
+typedef struct _PART_IO_REQUEST {
+    LIST_ENTRY ListEntry;
+    LIST_ENTRY FifoListEntry;
+    PIRP Irp;
+    PART_IO_REQUEST_STATE State;
+    BOOL Write;
+    BOOL Mergeable;
+    BOOL Mapped;
+    ULONGLONG Deadline;
+    IO_OFFSET Offset;
+    UINTN Size;
+    UINTN TotalSize;
+    LIST_ENTRY MemberList;
+    PIO_BUFFER OriginalIoBuffer;
+    PIO_BUFFER MergedIoBuffer;
+} PART_IO_REQUEST, *PPART_IO_REQUEST;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+PartpIoQueueSubmit (
+    PPART_IO_QUEUE Queue,
+    PIRP Irp
+    );
+
+VOID
+PartpIoQueueComplete (
+    PPART_IO_QUEUE Queue,
+    PIRP Irp
+    );
+
+VOID
+PartpIoQueueStart (
+    PPART_IO_QUEUE Queue
+    );
+
+VOID
+PartpIoQueueInsert (
+    PPART_IO_QUEUE Queue,
+    PPART_IO_REQUEST Request
+    );
+
+VOID
+PartpIoQueueRemove (
+    PPART_IO_QUEUE Queue,
+    PPART_IO_REQUEST Request
+    );
+
+PPART_IO_REQUEST
+PartpIoQueueSelect (
+    PPART_IO_QUEUE Queue
+    );
+
+PPART_IO_REQUEST
+PartpIoQueueMerge (
+    PPART_IO_QUEUE Queue,
+    PPART_IO_REQUEST Request
+    );
+
+BOOL
+PartpIoQueueCanMerge (
+    PPART_IO_REQUEST Front,
+    PPART_IO_REQUEST Back,
+    UINTN TotalSize
+    );
+
+VOID
+PartpIoQueueUnmerge (
+    PPART_IO_QUEUE Queue,
+    PPART_IO_REQUEST Request
+    );
+
+PPART_IO_REQUEST
+PartpIoQueueFindInFlight (
+    PPART_IO_QUEUE Queue,
+    PIRP Irp
+    );
+
+VOID
+PartpIoQueueCheckBuffer (
+    PPART_IO_REQUEST Request
+    );
+
+KSTATUS
+PartpIoQueueBuildMergedBuffer (
+    PPART_IO_REQUEST Request
+    );
+
+VOID
+PartpIoQueueAppendPages (
+    PIO_BUFFER MergedBuffer,
+    PPART_IO_REQUEST Request,
+    BOOL Mapped
+    );
+
+VOID
+PartpIoQueueCompleteMerged (
+    PPART_IO_REQUEST Request
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+PartpInitializeIoQueue (
+    PPART_IO_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes a disk I/O queue.
+
+Arguments:
+
+    Queue - Supplies a pointer to the zeroed queue to initialize.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if the lock could not be created.
+
+--*/
+
+{
+
+    ULONGLONG Frequency;
+
+    Queue->Lock = KeCreateQueuedLock();
+    if (Queue->Lock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    INITIALIZE_LIST_HEAD(&(Queue->SortedList));
+    INITIALIZE_LIST_HEAD(&(Queue->ReadList));
+    INITIALIZE_LIST_HEAD(&(Queue->WriteList));
+    INITIALIZE_LIST_HEAD(&(Queue->InFlightList));
+    Queue->Flags = DISK_QUEUE_FLAG_ENABLED;
+    Queue->MaxInFlight = PART_IO_QUEUE_DEFAULT_MAX_IN_FLIGHT;
+    Frequency = HlQueryTimeCounterFrequency();
+    Queue->ReadDeadline = (Frequency * PART_IO_QUEUE_READ_DEADLINE) /
+                          MILLISECONDS_PER_SECOND;
+
+    Queue->WriteDeadline = (Frequency * PART_IO_QUEUE_WRITE_DEADLINE) /
+                           MILLISECONDS_PER_SECOND;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+PartpDestroyIoQueue (
+    PPART_IO_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tears down a disk I/O queue. The queue must be idle.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Queue->Lock != NULL) {
+
+        ASSERT((LIST_EMPTY(&(Queue->SortedList)) != FALSE) &&
+               (LIST_EMPTY(&(Queue->InFlightList)) != FALSE));
+
+        KeDestroyQueuedLock(Queue->Lock);
+        Queue->Lock = NULL;
+    }
+
+    return;
+}
+
+VOID
+PartpIoQueueDispatch (
+    PPART_IO_QUEUE Queue,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine runs an I/O IRP headed to or returning from the disk through
+    the queue. On the way down the IRP may be pended until the disk has room
+    for it. On the way up, the request's slot is released and any requests
+    merged into it are completed.
+
+Arguments:
+
+    Queue - Supplies a pointer to the disk's queue.
+
+    Irp - Supplies a pointer to the I/O IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Irp->MajorCode == IrpMajorIo);
+
+    if (Queue->Lock == NULL) {
+        return;
+    }
+
+    if (Irp->Direction == IrpDown) {
+        PartpIoQueueSubmit(Queue, Irp);
+
+    } else {
+
+        ASSERT(Irp->Direction == IrpUp);
+
+        PartpIoQueueComplete(Queue, Irp);
+    }
+
+    return;
+}
+
+VOID
+PartpGetIoQueueInformation (
+    PPART_IO_QUEUE Queue,
+    PDISK_QUEUE_INFORMATION Information
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a snapshot of the queue's settings and statistics.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Information - Supplies a pointer where the information will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RtlZeroMemory(Information, sizeof(DISK_QUEUE_INFORMATION));
+    Information->Version = DISK_QUEUE_INFORMATION_VERSION;
+    KeAcquireQueuedLock(Queue->Lock);
+    Information->Flags = Queue->Flags;
+    Information->MaxInFlight = Queue->MaxInFlight;
+    Information->InFlight = Queue->InFlight;
+    Information->QueueDepth = Queue->QueueDepth;
+    Information->MaxQueueDepth = Queue->MaxQueueDepth;
+    Information->RequestCount = Queue->RequestCount;
+    Information->MergeCount = Queue->MergeCount;
+    Information->DispatchCount = Queue->DispatchCount;
+    Information->DeadlineCount = Queue->DeadlineCount;
+    KeReleaseQueuedLock(Queue->Lock);
+    return;
+}
+
+KSTATUS
+PartpSetIoQueueInformation (
+    PPART_IO_QUEUE Queue,
+    PDISK_QUEUE_INFORMATION Information
+    )
+
+/*++
+
+Routine Description:
+
+    This routine changes the queue's flags and in-flight limit.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Information - Supplies a pointer to the new settings. Only the flags and
+        maximum in-flight count are used.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the version or settings are not valid.
+
+--*/
+
+{
+
+    if ((Information->Version < DISK_QUEUE_INFORMATION_VERSION) ||
+        ((Information->Flags & ~DISK_QUEUE_FLAG_ENABLED) != 0) ||
+        (Information->MaxInFlight == 0) ||
+        (Information->MaxInFlight > PART_IO_QUEUE_MAX_IN_FLIGHT)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    // Raising the limit or turning the queue off may free up room for
+    // waiting requests, so kick the queue.
+    //
+
+    KeAcquireQueuedLock(Queue->Lock);
+    Queue->Flags = Information->Flags;
+    Queue->MaxInFlight = Information->MaxInFlight;
+    PartpIoQueueStart(Queue);
+    KeReleaseQueuedLock(Queue->Lock);
+    return STATUS_SUCCESS;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+PartpIoQueueSubmit (
+    PPART_IO_QUEUE Queue,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles an I/O IRP on its way down to the disk. The IRP is
+    either sent straight through or pended in the queue.
+
+Arguments:
+
+    Queue - Supplies a pointer to the disk's queue.
+
+    Irp - Supplies a pointer to the I/O IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIRP_READ_WRITE ReadWrite;
+    PPART_IO_REQUEST Request;
+    KSTATUS Status;
+
+    //
+    // If this IRP was released from the queue, this is its second trip
+    // through. Mark it issued and let it go down to the disk.
+    //
+
+    KeAcquireQueuedLock(Queue->Lock);
+    Request = PartpIoQueueFindInFlight(Queue, Irp);
+    if (Request != NULL) {
+
+        ASSERT(Request->State == PartIoRequestReleased);
+
+        Request->State = PartIoRequestIssued;
+        KeReleaseQueuedLock(Queue->Lock);
+
+        //
+        // If other requests were merged into this one, swap in a buffer that
+        // covers all of them. If that fails, put the members back in the
+        // queue and send this request down on its own.
+        //
+
+        if (LIST_EMPTY(&(Request->MemberList)) == FALSE) {
+            Status = PartpIoQueueBuildMergedBuffer(Request);
+            if (!KSUCCESS(Status)) {
+                KeAcquireQueuedLock(Queue->Lock);
+                PartpIoQueueUnmerge(Queue, Request);
+                PartpIoQueueStart(Queue);
+                KeReleaseQueuedLock(Queue->Lock);
+            }
+        }
+
+        return;
+    }
+
+    Queue->RequestCount += 1;
+    KeReleaseQueuedLock(Queue->Lock);
+
+    //
+    // When the queue is off, requests go straight to the disk untracked. The
+    // same goes for requests the queue cannot afford to track.
+    //
+
+    if ((Queue->Flags & DISK_QUEUE_FLAG_ENABLED) == 0) {
+        return;
+    }
+
+    Request = MmAllocateNonPagedPool(sizeof(PART_IO_REQUEST),
+                                     PART_IO_QUEUE_ALLOCATION_TAG);
+
+    if (Request == NULL) {
+        return;
+    }
+
+    RtlZeroMemory(Request, sizeof(PART_IO_REQUEST));
+    ReadWrite = &(Irp->U.ReadWrite);
+    Request->Irp = Irp;
+    Request->Write = FALSE;
+    Request->Deadline = KeGetRecentTimeCounter();
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        Request->Write = TRUE;
+        Request->Deadline += Queue->WriteDeadline;
+
+    } else {
+        Request->Deadline += Queue->ReadDeadline;
+    }
+
+    Request->Offset = ReadWrite->IoOffset;
+    Request->Size = ReadWrite->IoSizeInBytes;
+    Request->TotalSize = Request->Size;
+    INITIALIZE_LIST_HEAD(&(Request->MemberList));
+    PartpIoQueueCheckBuffer(Request);
+
+    //
+    // If the disk has room and nobody is waiting, send the request right
+    // down. Otherwise get in line.
+    //
+
+    KeAcquireQueuedLock(Queue->Lock);
+    if ((Queue->InFlight < Queue->MaxInFlight) && (Queue->QueueDepth == 0)) {
+        Request->State = PartIoRequestIssued;
+        INSERT_BEFORE(&(Request->ListEntry), &(Queue->InFlightList));
+        Queue->InFlight += 1;
+        Queue->DispatchCount += 1;
+        Queue->NextOffset = Request->Offset + Request->Size;
+
+    } else {
+        IoPendIrp(PartDriver, Irp);
+        PartpIoQueueInsert(Queue, Request);
+        PartpIoQueueStart(Queue);
+    }
+
+    KeReleaseQueuedLock(Queue->Lock);
+    return;
+}
+
+VOID
+PartpIoQueueComplete (
+    PPART_IO_QUEUE Queue,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles an I/O IRP on its way back up from the disk. If the
+    queue sent it down, its slot is freed, any requests merged into it are
+    completed, and the next requests are released.
+
+Arguments:
+
+    Queue - Supplies a pointer to the disk's queue.
+
+    Irp - Supplies a pointer to the I/O IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPART_IO_REQUEST Request;
+
+    //
+    // IRPs the queue never tracked and members completed on behalf of a
+    // merged request are not on the in-flight list, and just keep going up.
+    //
+
+    KeAcquireQueuedLock(Queue->Lock);
+    Request = PartpIoQueueFindInFlight(Queue, Irp);
+    if (Request == NULL) {
+        KeReleaseQueuedLock(Queue->Lock);
+        return;
+    }
+
+    ASSERT(Request->State == PartIoRequestIssued);
+
+    LIST_REMOVE(&(Request->ListEntry));
+    Queue->InFlight -= 1;
+    KeReleaseQueuedLock(Queue->Lock);
+    if (Request->MergedIoBuffer != NULL) {
+        PartpIoQueueCompleteMerged(Request);
+    }
+
+    ASSERT(LIST_EMPTY(&(Request->MemberList)) != FALSE);
+
+    Request->State = PartIoRequestInvalid;
+    MmFreeNonPagedPool(Request);
+    KeAcquireQueuedLock(Queue->Lock);
+    PartpIoQueueStart(Queue);
+    KeReleaseQueuedLock(Queue->Lock);
+    return;
+}
+
+VOID
+PartpIoQueueStart (
+    PPART_IO_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases waiting requests to the disk until the in-flight
+    limit is reached or the queue is empty. This routine assumes the queue
+    lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL Enabled;
+    PPART_IO_REQUEST Request;
+
+    Enabled = FALSE;
+    if ((Queue->Flags & DISK_QUEUE_FLAG_ENABLED) != 0) {
+        Enabled = TRUE;
+    }
+
+    //
+    // When the queue has been turned off, drain everything that is waiting
+    // regardless of the limit.
+    //
+
+    while ((LIST_EMPTY(&(Queue->SortedList)) == FALSE) &&
+           ((Queue->InFlight < Queue->MaxInFlight) || (Enabled == FALSE))) {
+
+        Request = PartpIoQueueSelect(Queue);
+        PartpIoQueueRemove(Queue, Request);
+        if (Enabled != FALSE) {
+            Request = PartpIoQueueMerge(Queue, Request);
+        }
+
+        Request->State = PartIoRequestReleased;
+        INSERT_BEFORE(&(Request->ListEntry), &(Queue->InFlightList));
+        Queue->InFlight += 1;
+        Queue->DispatchCount += 1;
+        Queue->NextOffset = Request->Offset + Request->TotalSize;
+        IoContinueIrp(PartDriver, Request->Irp);
+    }
+
+    return;
+}
+
+VOID
+PartpIoQueueInsert (
+    PPART_IO_QUEUE Queue,
+    PPART_IO_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a request to the sorted list and the tail of its
+    direction's deadline list. This routine assumes the queue lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Request - Supplies a pointer to the request to insert.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PPART_IO_REQUEST Existing;
+
+    //
+    // Requests tend to arrive in ascending order, so search from the back.
+    //
+
+    CurrentEntry = Queue->SortedList.Previous;
+    while (CurrentEntry != &(Queue->SortedList)) {
+        Existing = LIST_VALUE(CurrentEntry, PART_IO_REQUEST, ListEntry);
+        if (Existing->Offset <= Request->Offset) {
+            break;
+        }
+
+        CurrentEntry = CurrentEntry->Previous;
+    }
+
+    INSERT_AFTER(&(Request->ListEntry), CurrentEntry);
+    if (Request->Write != FALSE) {
+        INSERT_BEFORE(&(Request->FifoListEntry), &(Queue->WriteList));
+
+    } else {
+        INSERT_BEFORE(&(Request->FifoListEntry), &(Queue->ReadList));
+    }
+
+    Request->State = PartIoRequestQueued;
+    Queue->QueueDepth += 1;
+    if (Queue->QueueDepth > Queue->MaxQueueDepth) {
+        Queue->MaxQueueDepth = Queue->QueueDepth;
+    }
+
+    return;
+}
+
+VOID
+PartpIoQueueRemove (
+    PPART_IO_QUEUE Queue,
+    PPART_IO_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pulls a waiting request out of the sorted and deadline
+    lists. This routine assumes the queue lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Request - Supplies a pointer to the request to remove.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Request->State == PartIoRequestQueued);
+    ASSERT(Queue->QueueDepth != 0);
+
+    LIST_REMOVE(&(Request->ListEntry));
+    LIST_REMOVE(&(Request->FifoListEntry));
+    Queue->QueueDepth -= 1;
+    return;
+}
+
+PPART_IO_REQUEST
+PartpIoQueueSelect (
+    PPART_IO_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine picks the next request to send to the disk. A request whose
+    deadline has passed goes first. Otherwise the elevator picks the first
+    request at or beyond where the last one ended, wrapping back to the
+    lowest offset when it runs off the end. This routine assumes the queue
+    lock is held and that the queue is not empty.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    Returns a pointer to the chosen request, still in the queue.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PPART_IO_REQUEST Expired;
+    PPART_IO_REQUEST Oldest;
+    PPART_IO_REQUEST Request;
+    ULONGLONG Time;
+
+    ASSERT(LIST_EMPTY(&(Queue->SortedList)) == FALSE);
+
+    //
+    // Each deadline list is in arrival order, so only the heads need to be
+    // checked. If both have expired, take the one that expired first.
+    //
+
+    Time = KeGetRecentTimeCounter();
+    Expired = NULL;
+    if (LIST_EMPTY(&(Queue->ReadList)) == FALSE) {
+        Oldest = LIST_VALUE(Queue->ReadList.Next,
+                            PART_IO_REQUEST,
+                            FifoListEntry);
+
+        if (Oldest->Deadline <= Time) {
+            Expired = Oldest;
+        }
+    }
+
+    if (LIST_EMPTY(&(Queue->WriteList)) == FALSE) {
+        Oldest = LIST_VALUE(Queue->WriteList.Next,
+                            PART_IO_REQUEST,
+                            FifoListEntry);
+
+        if ((Oldest->Deadline <= Time) &&
+            ((Expired == NULL) || (Oldest->Deadline < Expired->Deadline))) {
+
+            Expired = Oldest;
+        }
+    }
+
+    if (Expired != NULL) {
+        Queue->DeadlineCount += 1;
+        return Expired;
+    }
+
+    CurrentEntry = Queue->SortedList.Next;
+    while (CurrentEntry != &(Queue->SortedList)) {
+        Request = LIST_VALUE(CurrentEntry, PART_IO_REQUEST, ListEntry);
+        if (Request->Offset >= Queue->NextOffset) {
+            return Request;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    return LIST_VALUE(Queue->SortedList.Next, PART_IO_REQUEST, ListEntry);
+}
+
+PPART_IO_REQUEST
+PartpIoQueueMerge (
+    PPART_IO_QUEUE Queue,
+    PPART_IO_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pulls waiting requests that are contiguous with the given
+    one out of the queue and hangs them off the lowest request of the run,
+    so they all go to the disk as one transfer. This routine assumes the
+    queue lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Request - Supplies a pointer to the request that was selected, which has
+        already been removed from the queue.
+
+Return Value:
+
+    Returns a pointer to the request that carries the run: the given request
+    or a waiting one just below it. The carrier is out of the queue and the
+    rest of the run is on its member list in offset order.
+
+--*/
+
+{
+
+    PLIST_ENTRY BackEntry;
+    PLIST_ENTRY CurrentEntry;
+    PPART_IO_REQUEST Member;
+    PPART_IO_REQUEST Neighbor;
+    PPART_IO_REQUEST Previous;
+
+    ASSERT(Request->State == PartIoRequestQueued);
+    ASSERT(LIST_EMPTY(&(Request->MemberList)) != FALSE);
+
+    if (Request->Mergeable == FALSE) {
+        return Request;
+    }
+
+    //
+    // Find where the request sat in the sorted list, then walk forward
+    // absorbing requests that start where the run ends.
+    //
+
+    CurrentEntry = Queue->SortedList.Next;
+    while (CurrentEntry != &(Queue->SortedList)) {
+        Neighbor = LIST_VALUE(CurrentEntry, PART_IO_REQUEST, ListEntry);
+        if (Neighbor->Offset >= Request->Offset + Request->Size) {
+            break;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    BackEntry = CurrentEntry->Previous;
+    Previous = Request;
+    while (CurrentEntry != &(Queue->SortedList)) {
+        Neighbor = LIST_VALUE(CurrentEntry, PART_IO_REQUEST, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (PartpIoQueueCanMerge(Previous,
+                                 Neighbor,
+                                 Request->TotalSize + Neighbor->Size) ==
+            FALSE) {
+
+            break;
+        }
+
+        PartpIoQueueRemove(Queue, Neighbor);
+        Neighbor->State = PartIoRequestMerged;
+        INSERT_BEFORE(&(Neighbor->ListEntry), &(Request->MemberList));
+        Request->TotalSize += Neighbor->Size;
+        Queue->MergeCount += 1;
+        Previous = Neighbor;
+    }
+
+    //
+    // Now walk backward absorbing requests that end where the run begins.
+    // Each one becomes the new carrier, taking the old carrier and its
+    // members onto its own member list.
+    //
+
+    CurrentEntry = BackEntry;
+    while (CurrentEntry != &(Queue->SortedList)) {
+        Neighbor = LIST_VALUE(CurrentEntry, PART_IO_REQUEST, ListEntry);
+        CurrentEntry = CurrentEntry->Previous;
+        if (PartpIoQueueCanMerge(Neighbor,
+                                 Request,
+                                 Request->TotalSize + Neighbor->Size) ==
+            FALSE) {
+
+            break;
+        }
+
+        PartpIoQueueRemove(Queue, Neighbor);
+        INSERT_BEFORE(&(Request->ListEntry), &(Neighbor->MemberList));
+        while (LIST_EMPTY(&(Request->MemberList)) == FALSE) {
+            Member = LIST_VALUE(Request->MemberList.Next,
+                                PART_IO_REQUEST,
+                                ListEntry);
+
+            LIST_REMOVE(&(Member->ListEntry));
+            INSERT_BEFORE(&(Member->ListEntry), &(Neighbor->MemberList));
+        }
+
+        Neighbor->TotalSize = Neighbor->Size + Request->TotalSize;
+        Request->State = PartIoRequestMerged;
+        Request->TotalSize = Request->Size;
+        Queue->MergeCount += 1;
+        Request = Neighbor;
+    }
+
+    return Request;
+}
+
+BOOL
+PartpIoQueueCanMerge (
+    PPART_IO_REQUEST Front,
+    PPART_IO_REQUEST Back,
+    UINTN TotalSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether two requests can go to the disk as one
+    transfer.
+
+Arguments:
+
+    Front - Supplies a pointer to the request at the lower offset.
+
+    Back - Supplies a pointer to the request at the higher offset.
+
+    TotalSize - Supplies the size the merged transfer would have.
+
+Return Value:
+
+    TRUE if the requests can be merged.
+
+    FALSE if they must go separately.
+
+--*/
+
+{
+
+    PIRP_READ_WRITE BackReadWrite;
+    PIRP_READ_WRITE FrontReadWrite;
+
+    if ((Front->Mergeable == FALSE) ||
+        (Back->Mergeable == FALSE) ||
+        (Front->Write != Back->Write) ||
+        (Front->Offset + Front->Size != Back->Offset) ||
+        (TotalSize > PART_IO_QUEUE_MAX_MERGE_SIZE)) {
+
+        return FALSE;
+    }
+
+    FrontReadWrite = &(Front->Irp->U.ReadWrite);
+    BackReadWrite = &(Back->Irp->U.ReadWrite);
+    if ((FrontReadWrite->DeviceContext != BackReadWrite->DeviceContext) ||
+        (FrontReadWrite->IoFlags != BackReadWrite->IoFlags)) {
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID
+PartpIoQueueUnmerge (
+    PPART_IO_QUEUE Queue,
+    PPART_IO_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine puts the requests merged into the given request back into
+    the queue. This routine assumes the queue lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Request - Supplies a pointer to the carrier request.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPART_IO_REQUEST Member;
+
+    while (LIST_EMPTY(&(Request->MemberList)) == FALSE) {
+        Member = LIST_VALUE(Request->MemberList.Next,
+                            PART_IO_REQUEST,
+                            ListEntry);
+
+        ASSERT(Member->State == PartIoRequestMerged);
+
+        LIST_REMOVE(&(Member->ListEntry));
+        PartpIoQueueInsert(Queue, Member);
+        Queue->MergeCount -= 1;
+    }
+
+    Request->TotalSize = Request->Size;
+    return;
+}
+
+PPART_IO_REQUEST
+PartpIoQueueFindInFlight (
+    PPART_IO_QUEUE Queue,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the in-flight request for the given IRP. The list is
+    never longer than the in-flight limit. This routine assumes the queue
+    lock is held.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Irp - Supplies a pointer to the IRP to look up.
+
+Return Value:
+
+    Returns a pointer to the request on success.
+
+    NULL if the IRP is not in flight through the queue.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PPART_IO_REQUEST Request;
+
+    CurrentEntry = Queue->InFlightList.Next;
+    while (CurrentEntry != &(Queue->InFlightList)) {
+        Request = LIST_VALUE(CurrentEntry, PART_IO_REQUEST, ListEntry);
+        if (Request->Irp == Irp) {
+            return Request;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    return NULL;
+}
+
+VOID
+PartpIoQueueCheckBuffer (
+    PPART_IO_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a request's buffer can be stitched into
+    a merged buffer. That requires every page of the transfer to be whole
+    and to have a known physical address. Buffers that still need to be
+    locked (typically user mode buffers) are not merged, as locking them
+    could require paging I/O to this very disk while the queue is full.
+
+Arguments:
+
+    Request - Supplies a pointer to the request to check.
+
+Return Value:
+
+    None. The mergeable and mapped flags are set in the request.
+
+--*/
+
+{
+
+    UINTN BufferOffset;
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
+    UINTN FragmentSize;
+    PIO_BUFFER IoBuffer;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN SizeRemaining;
+
+    Request->Mergeable = FALSE;
+    Request->Mapped = FALSE;
+    PageSize = MmPageSize();
+    IoBuffer = Request->Irp->U.ReadWrite.IoBuffer;
+    if ((IoBuffer == NULL) ||
+        (Request->Size == 0) ||
+        (IS_ALIGNED(Request->Size, PageSize) == FALSE)) {
+
+        return;
+    }
+
+    //
+    // Skip to the fragment containing the buffer's current offset.
+    //
+
+    BufferOffset = MmGetIoBufferCurrentOffset(IoBuffer);
+    FragmentIndex = 0;
+    while (FragmentIndex < IoBuffer->FragmentCount) {
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        if (BufferOffset < Fragment->Size) {
+            break;
+        }
+
+        BufferOffset -= Fragment->Size;
+        FragmentIndex += 1;
+    }
+
+    Request->Mapped = TRUE;
+    SizeRemaining = Request->Size;
+    while ((SizeRemaining != 0) &&
+           (FragmentIndex < IoBuffer->FragmentCount)) {
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        if (Fragment->PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+            return;
+        }
+
+        PhysicalAddress = Fragment->PhysicalAddress + BufferOffset;
+        FragmentSize = Fragment->Size - BufferOffset;
+        if (FragmentSize > SizeRemaining) {
+            FragmentSize = SizeRemaining;
+        }
+
+        if ((IS_ALIGNED(PhysicalAddress, PageSize) == FALSE) ||
+            (IS_ALIGNED(FragmentSize, PageSize) == FALSE)) {
+
+            return;
+        }
+
+        if (Fragment->VirtualAddress == NULL) {
+            Request->Mapped = FALSE;
+        }
+
+        SizeRemaining -= FragmentSize;
+        BufferOffset = 0;
+        FragmentIndex += 1;
+    }
+
+    if (SizeRemaining == 0) {
+        Request->Mergeable = TRUE;
+    }
+
+    return;
+}
+
+KSTATUS
+PartpIoQueueBuildMergedBuffer (
+    PPART_IO_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a buffer describing the pages of the carrier and
+    all its members in order, and swaps it into the carrier's IRP.
+
+Arguments:
+
+    Request - Supplies a pointer to the carrier request.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if the buffer could not be allocated.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    BOOL Mapped;
+    PPART_IO_REQUEST Member;
+    PIO_BUFFER MergedBuffer;
+    PIRP_READ_WRITE ReadWrite;
+
+    ASSERT(Request->MergedIoBuffer == NULL);
+
+    MergedBuffer = MmAllocateUninitializedIoBuffer(
+                                                 Request->TotalSize,
+                                                 IO_BUFFER_FLAG_MEMORY_LOCKED);
+
+    if (MergedBuffer == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    //
+    // Only carry virtual addresses over if every piece has them. Otherwise
+    // the disk driver maps the whole thing if it needs to.
+    //
+
+    Mapped = Request->Mapped;
+    CurrentEntry = Request->MemberList.Next;
+    while (CurrentEntry != &(Request->MemberList)) {
+        Member = LIST_VALUE(CurrentEntry, PART_IO_REQUEST, ListEntry);
+        if (Member->Mapped == FALSE) {
+            Mapped = FALSE;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    PartpIoQueueAppendPages(MergedBuffer, Request, Mapped);
+    CurrentEntry = Request->MemberList.Next;
+    while (CurrentEntry != &(Request->MemberList)) {
+        Member = LIST_VALUE(CurrentEntry, PART_IO_REQUEST, ListEntry);
+        PartpIoQueueAppendPages(MergedBuffer, Member, Mapped);
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    ASSERT(MmGetIoBufferSize(MergedBuffer) == Request->TotalSize);
+
+    ReadWrite = &(Request->Irp->U.ReadWrite);
+    Request->OriginalIoBuffer = ReadWrite->IoBuffer;
+    Request->MergedIoBuffer = MergedBuffer;
+    ReadWrite->IoBuffer = MergedBuffer;
+    ReadWrite->IoSizeInBytes = Request->TotalSize;
+    return STATUS_SUCCESS;
+}
+
+VOID
+PartpIoQueueAppendPages (
+    PIO_BUFFER MergedBuffer,
+    PPART_IO_REQUEST Request,
+    BOOL Mapped
+    )
+
+/*++
+
+Routine Description:
+
+    This routine appends the pages of a request's transfer to a merged
+    buffer. The request must have been found to be mergeable.
+
+Arguments:
+
+    MergedBuffer - Supplies a pointer to the merged buffer.
+
+    Request - Supplies a pointer to the request whose pages are appended.
+
+    Mapped - Supplies a boolean indicating whether to carry over virtual
+        addresses.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BufferOffset;
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
+    PIO_BUFFER IoBuffer;
+    ULONG PageSize;
+    UINTN SizeRemaining;
+    PVOID VirtualAddress;
+
+    ASSERT(Request->Mergeable != FALSE);
+
+    PageSize = MmPageSize();
+    IoBuffer = Request->Irp->U.ReadWrite.IoBuffer;
+    BufferOffset = MmGetIoBufferCurrentOffset(IoBuffer);
+    FragmentIndex = 0;
+    while (FragmentIndex < IoBuffer->FragmentCount) {
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        if (BufferOffset < Fragment->Size) {
+            break;
+        }
+
+        BufferOffset -= Fragment->Size;
+        FragmentIndex += 1;
+    }
+
+    SizeRemaining = Request->Size;
+    while (SizeRemaining != 0) {
+
+        ASSERT(FragmentIndex < IoBuffer->FragmentCount);
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        while ((BufferOffset < Fragment->Size) && (SizeRemaining != 0)) {
+            VirtualAddress = NULL;
+            if (Mapped != FALSE) {
+                VirtualAddress = Fragment->VirtualAddress + BufferOffset;
+            }
+
+            MmIoBufferAppendPage(MergedBuffer,
+                                 NULL,
+                                 VirtualAddress,
+                                 Fragment->PhysicalAddress + BufferOffset);
+
+            BufferOffset += PageSize;
+            SizeRemaining -= PageSize;
+        }
+
+        BufferOffset = 0;
+        FragmentIndex += 1;
+    }
+
+    return;
+}
+
+VOID
+PartpIoQueueCompleteMerged (
+    PPART_IO_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine splits the result of a merged transfer back out to the
+    carrier and its members. Bytes are handed out in offset order, so a
+    short transfer shorts the later requests. Each member is completed.
+
+Arguments:
+
+    Request - Supplies a pointer to the carrier request, which has been
+        removed from the in-flight list.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    UINTN BytesRemaining;
+    PPART_IO_REQUEST Member;
+    PIRP_READ_WRITE ReadWrite;
+    KSTATUS Status;
+
+    ReadWrite = &(Request->Irp->U.ReadWrite);
+    Status = IoGetIrpStatus(Request->Irp);
+    BytesRemaining = ReadWrite->IoBytesCompleted;
+    ReadWrite->IoBuffer = Request->OriginalIoBuffer;
+    ReadWrite->IoSizeInBytes = Request->Size;
+    MmFreeIoBuffer(Request->MergedIoBuffer);
+    Request->MergedIoBuffer = NULL;
+    Request->OriginalIoBuffer = NULL;
+    BytesCompleted = Request->Size;
+    if (BytesCompleted > BytesRemaining) {
+        BytesCompleted = BytesRemaining;
+    }
+
+    ReadWrite->IoBytesCompleted = BytesCompleted;
+    ReadWrite->NewIoOffset = Request->Offset + BytesCompleted;
+    BytesRemaining -= BytesCompleted;
+    while (LIST_EMPTY(&(Request->MemberList)) == FALSE) {
+        Member = LIST_VALUE(Request->MemberList.Next,
+                            PART_IO_REQUEST,
+                            ListEntry);
+
+        ASSERT(Member->State == PartIoRequestMerged);
+
+        LIST_REMOVE(&(Member->ListEntry));
+        BytesCompleted = Member->Size;
+        if (BytesCompleted > BytesRemaining) {
+            BytesCompleted = BytesRemaining;
+        }
+
+        BytesRemaining -= BytesCompleted;
+        ReadWrite = &(Member->Irp->U.ReadWrite);
+        ReadWrite->IoBytesCompleted = BytesCompleted;
+        ReadWrite->NewIoOffset = Member->Offset + BytesCompleted;
+        IoCompleteIrp(PartDriver, Member->Irp, Status);
+        Member->State = PartIoRequestInvalid;
+        MmFreeNonPagedPool(Member);
+    }
+
+    return;
+}
+
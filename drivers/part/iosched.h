@@ -0,0 +1,244 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    iosched.h
+
+Abstract:
+
+    This header contains definitions for the per-disk I/O queue that sits
+    between the partition manager and the disk driver.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure stores the I/O queue for a disk. Requests that cannot be
+    sent to the disk right away wait here sorted by disk offset, and are
+    handed to the disk in elevator order, merging contiguous neighbors.
+
+Members:
+
+    Lock - Stores a pointer to the lock serializing access to the queue.
+
+    SortedList - Stores the head of the list of waiting requests, sorted by
+        disk offset.
+
+    ReadList - Stores the head of the list of waiting reads, in arrival (and
+        therefore deadline) order.
+
+    WriteList - Stores the head of the list of waiting writes, in arrival
+        (and therefore deadline) order.
+
+    InFlightList - Stores the head of the list of requests that have been
+        released to the disk.
+
+    Flags - Stores a bitfield of flags. See DISK_QUEUE_FLAG_* definitions.
+
+    MaxInFlight - Stores the maximum number of requests to have outstanding
+        at the disk at once.
+
+    InFlight - Stores the number of requests currently outstanding at the
+        disk.
+
+    QueueDepth - Stores the number of requests in the sorted list.
+
+    MaxQueueDepth - Stores the high water mark of the queue depth.
+
+    NextOffset - Stores the disk offset just past the last request sent down.
+        The elevator continues from here.
+
+    ReadDeadline - Stores the number of time counter ticks a read can wait
+        before it is sent out of order.
+
+    WriteDeadline - Stores the number of time counter ticks a write can wait
+        before it is sent out of order.
+
+    RequestCount - Stores the total number of requests seen.
+
+    MergeCount - Stores the number of requests merged into a neighbor.
+
+    DispatchCount - Stores the number of requests sent to the disk.
+
+    DeadlineCount - Stores the number of requests sent because their deadline
+        expired.
+
+--*/
+
+typedef struct _PART_IO_QUEUE {
+    PQUEUED_LOCK Lock;
+    LIST_ENTRY SortedList;
+    LIST_ENTRY ReadList;
+    LIST_ENTRY WriteList;
+    LIST_ENTRY InFlightList;
+    ULONG Flags;
+    ULONG MaxInFlight;
+    ULONG InFlight;
+    ULONG QueueDepth;
+    ULONG MaxQueueDepth;
+    IO_OFFSET NextOffset;
+    ULONGLONG ReadDeadline;
+    ULONGLONG WriteDeadline;
+    ULONGLONG RequestCount;
+    ULONGLONG MergeCount;
+    ULONGLONG DispatchCount;
+    ULONGLONG DeadlineCount;
+} PART_IO_QUEUE, *PPART_IO_QUEUE;
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+extern PDRIVER PartDriver;
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+KSTATUS
+PartpInitializeIoQueue (
+    PPART_IO_QUEUE Queue
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes a disk I/O queue.
+
+Arguments:
+
+    Queue - Supplies a pointer to the zeroed queue to initialize.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if the lock could not be created.
+
+--*/
+
+VOID
+PartpDestroyIoQueue (
+    PPART_IO_QUEUE Queue
+    );
+
+/*++
+
+Routine Description:
+
+    This routine tears down a disk I/O queue. The queue must be idle.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+PartpIoQueueDispatch (
+    PPART_IO_QUEUE Queue,
+    PIRP Irp
+    );
+
+/*++
+
+Routine Description:
+
+    This routine runs an I/O IRP headed to or returning from the disk through
+    the queue. On the way down the IRP may be pended until the disk has room
+    for it. On the way up, the request's slot is released and any requests
+    merged into it are completed.
+
+Arguments:
+
+    Queue - Supplies a pointer to the disk's queue.
+
+    Irp - Supplies a pointer to the I/O IRP.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+PartpGetIoQueueInformation (
+    PPART_IO_QUEUE Queue,
+    PDISK_QUEUE_INFORMATION Information
+    );
+
+/*++
+
+Routine Description:
+
+    This routine takes a snapshot of the queue's settings and statistics.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Information - Supplies a pointer where the information will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+PartpSetIoQueueInformation (
+    PPART_IO_QUEUE Queue,
+    PDISK_QUEUE_INFORMATION Information
+    );
+
+/*++
+
+Routine Description:
+
+    This routine changes the queue's flags and in-flight limit.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Information - Supplies a pointer to the new settings. Only the flags and
+        maximum in-flight count are used.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INVALID_PARAMETER if the version or settings are not valid.
+
+--*/
+
@@ -31,6 +31,7 @@ Module Name:
 
 #include <minoca/kernel/driver.h>
 #include <minoca/lib/partlib.h>
+#include "iosched.h"
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -93,6 +94,9 @@ Structure Description:
 
     RawDisk - Stores a pointer to the raw disk device.
 
+    IoQueue - Stores the queue that sorts and merges I/O on its way to the
+        disk.
+
 --*/
 
 typedef struct _PARTITION_PARENT {
@@ -102,6 +106,7 @@ typedef struct _PARTITION_PARENT {
     PARTITION_CONTEXT PartitionContext;
     PDEVICE *Children;
     PDEVICE RawDisk;
+    PART_IO_QUEUE IoQueue;
 } PARTITION_PARENT, *PPARTITION_PARENT;
 
 /*++
@@ -191,6 +196,12 @@ PartpHandleDeviceInformationRequest (
     PPARTITION_CHILD Child
     );
 
+VOID
+PartpHandleQueueInformationRequest (
+    PIRP Irp,
+    PPARTITION_PARENT Parent
+    );
+
 VOID
 PartpHandleBlockInformationRequest (
     PIRP Irp,
@@ -242,6 +253,7 @@ PartpDestroyDevice (
 PDRIVER PartDriver;
 
 UUID PartPartitionDeviceInformationUuid = PARTITION_DEVICE_INFORMATION_UUID;
+UUID PartDiskQueueInformationUuid = DISK_QUEUE_INFORMATION_UUID;
 
 //
 // ------------------------------------------------------------------ Functions
@@ -341,11 +353,17 @@ Return Value:
     Context->Header.Type = PartitionObjectParent;
     Context->Header.ReferenceCount = 1;
     Context->Device = DeviceToken;
+    Status = PartpInitializeIoQueue(&(Context->IoQueue));
+    if (!KSUCCESS(Status)) {
+        goto AddDeviceEnd;
+    }
+
     Status = IoAttachDriverToDevice(Driver, DeviceToken, Context);
 
 AddDeviceEnd:
     if (!KSUCCESS(Status)) {
         if (Context != NULL) {
+            PartpDestroyIoQueue(&(Context->IoQueue));
             PartpFree(Context);
             Context = NULL;
         }
@@ -449,6 +467,17 @@ Return Value:
                                            &PartPartitionDeviceInformationUuid,
                                            TRUE);
 
+            //
+            // The raw disk also publishes the disk's I/O queue information.
+            //
+
+            if ((KSUCCESS(Status)) && (Child->Index == -1)) {
+                Status = IoRegisterDeviceInformation(
+                                                 Irp->Device,
+                                                 &PartDiskQueueInformationUuid,
+                                                 TRUE);
+            }
+
             IoCompleteIrp(PartDriver, Irp, Status);
             break;
 
@@ -472,6 +501,12 @@ Return Value:
                                         &PartPartitionDeviceInformationUuid,
                                         FALSE);
 
+            if (Child->Index == -1) {
+                IoRegisterDeviceInformation(Irp->Device,
+                                            &PartDiskQueueInformationUuid,
+                                            FALSE);
+            }
+
             PartpReleaseReference(Object);
             IoCompleteIrp(PartDriver, Irp, STATUS_SUCCESS);
             break;
@@ -613,6 +648,7 @@ Return Value:
     PPARTITION_CHILD Child;
     PPARTITION_OBJECT Object;
     ULONGLONG OriginalBlockCount;
+    PPARTITION_PARENT Parent;
     PPARTITION_INFORMATION Partition;
     PIRP_READ_WRITE ReadWrite;
     KSTATUS Status;
@@ -620,11 +656,16 @@ Return Value:
     Object = (PPARTITION_OBJECT)DeviceContext;
 
     //
-    // Don't process I/O as the parent (bus driver), let that head down to the
-    // disk.
+    // As the parent, this driver sits right above the disk and sees all I/O
+    // headed there. Run it through the disk's queue.
     //
 
     if (Object->Type != PartitionObjectChild) {
+
+        ASSERT(Object->Type == PartitionObjectParent);
+
+        Parent = PARENT_STRUCTURE(Object, PARTITION_PARENT, Header);
+        PartpIoQueueDispatch(&(Parent->IoQueue), Irp);
         return;
     }
 
@@ -1222,6 +1263,20 @@ Return Value:
 
     Request = Irp->U.SystemControl.SystemContext;
 
+    //
+    // The raw disk also answers for the disk's I/O queue.
+    //
+
+    if (Child->Index == -1) {
+        Match = RtlAreUuidsEqual(&(Request->Uuid),
+                                 &PartDiskQueueInformationUuid);
+
+        if (Match != FALSE) {
+            PartpHandleQueueInformationRequest(Irp, Child->Parent);
+            return;
+        }
+    }
+
     //
     // If this is not a request for the partition device information, ignore it.
     //
@@ -1307,6 +1362,61 @@ Return Value:
     return;
 }
 
+VOID
+PartpHandleQueueInformationRequest (
+    PIRP Irp,
+    PPARTITION_PARENT Parent
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles requests to get and set the I/O queue information
+    for a disk.
+
+Arguments:
+
+    Irp - Supplies a pointer to the IRP making the request.
+
+    Parent - Supplies a pointer to the disk context.
+
+Return Value:
+
+    None. Any completion status is set in the IRP.
+
+--*/
+
+{
+
+    PDISK_QUEUE_INFORMATION Information;
+    PSYSTEM_CONTROL_DEVICE_INFORMATION Request;
+    KSTATUS Status;
+
+    Request = Irp->U.SystemControl.SystemContext;
+    if (Request->DataSize < sizeof(DISK_QUEUE_INFORMATION)) {
+        Request->DataSize = sizeof(DISK_QUEUE_INFORMATION);
+        Status = STATUS_BUFFER_TOO_SMALL;
+        goto HandleQueueInformationRequestEnd;
+    }
+
+    Information = Request->Data;
+    if (Request->Set != FALSE) {
+        Status = PartpSetIoQueueInformation(&(Parent->IoQueue), Information);
+        if (!KSUCCESS(Status)) {
+            goto HandleQueueInformationRequestEnd;
+        }
+    }
+
+    Request->DataSize = sizeof(DISK_QUEUE_INFORMATION);
+    PartpGetIoQueueInformation(&(Parent->IoQueue), Information);
+    Status = STATUS_SUCCESS;
+
+HandleQueueInformationRequestEnd:
+    IoCompleteIrp(PartDriver, Irp, Status);
+    return;
+}
+
 VOID
 PartpHandleBlockInformationRequest (
     PIRP Irp,
@@ -1756,6 +1866,8 @@ Return Value:
             MmFreePagedPool(Parent->Children);
         }
 
+        PartpDestroyIoQueue(&(Parent->IoQueue));
+
         ASSERT(Parent->IoHandle == NULL);
 
         Parent->Header.Type = PartitionObjectInvalid;
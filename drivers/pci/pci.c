@@ -3746,6 +3746,10 @@ Return Value:
             return "AHCI";
         }
 
+        if (Subclass == PCI_CLASS_MASS_STORAGE_NVME) {
+            return "NVMe";
+        }
+
         break;
 
     case PCI_CLASS_BRIDGE:
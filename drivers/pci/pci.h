@@ -214,6 +214,7 @@ Module Name:
 #define PCI_CLASS_MASS_STORAGE_IDE 0x0100
 
 #define PCI_CLASS_MASS_STORAGE_SATA 0x0601
+#define PCI_CLASS_MASS_STORAGE_NVME 0x0802
 
 #define PCI_CLASS_BRIDGE_ISA 0x0100
 #define PCI_CLASS_BRIDGE_PCI 0x0400
@@ -0,0 +1,3110 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    tmpfs.c
+
+Abstract:
+
+    This module implements a memory-backed file system. Directories are kept
+    as in-memory trees. File data has no backing device: the page cache holds
+    the only copy, and pages are only written out (to the page file) when the
+    page cache needs to release them.
+
+    Every mount of a tmpfs device gets a volume of its own, with its own files
+    and its own size limit. The volume and its files go away when the mount
+    does.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include <minoca/devinfo/tmpfs.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define TMPFS_ALLOCATION_TAG 0x73666D54 // 'sfmT'
+
+#define TMPFS_DEVICE_ID "tmpfs"
+
+//
+// Define the file ID of the root directory. Other files get increasing IDs
+// after it.
+//
+
+#define TMPFS_ROOT_FILE_ID 1
+
+//
+// Define the longest name a directory entry can have, not including the null
+// terminator.
+//
+
+#define TMPFS_MAX_NAME_LENGTH 255
+
+//
+// By default, let a file system hold up to half of physical memory worth of
+// file data.
+//
+
+#define TMPFS_DEFAULT_SIZE_DIVISOR 2
+
+#define TMPFS_DEFAULT_PERMISSIONS \
+    (FILE_PERMISSION_ALL | FILE_PERMISSION_RESTRICTED)
+
+//
+// Define the maximum size of a page file region backing a file. Like shared
+// memory objects, this keeps a large file from needing a large contiguous
+// piece of the page file, and lets the dirty bitmap fit in a ULONG.
+//
+
+#define TMPFS_MAX_REGION_SIZE _128KB
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _TMPFS_OBJECT_TYPE {
+    TmpfsObjectInvalid,
+    TmpfsObjectDevice,
+    TmpfsObjectVolume
+} TMPFS_OBJECT_TYPE, *PTMPFS_OBJECT_TYPE;
+
+typedef struct _TMPFS_NODE TMPFS_NODE, *PTMPFS_NODE;
+
+/*++
+
+Structure Description:
+
+    This structure defines the raw memory-backed file system device. Each
+    mount of it gets a volume, which holds the files.
+
+Members:
+
+    Type - Stores the object type, TmpfsObjectDevice.
+
+    ListEntry - Stores pointers to the next and previous tmpfs devices.
+
+    OsDevice - Stores a pointer to the system device.
+
+    VolumeList - Stores the head of the list of volumes mounted from this
+        device. This is protected by the device list lock.
+
+    MaxSize - Stores the maximum number of bytes of file data that new volumes
+        on this device start out with.
+
+--*/
+
+typedef struct _TMPFS_DEVICE {
+    TMPFS_OBJECT_TYPE Type;
+    LIST_ENTRY ListEntry;
+    PDEVICE OsDevice;
+    LIST_ENTRY VolumeList;
+    ULONGLONG MaxSize;
+} TMPFS_DEVICE, *PTMPFS_DEVICE;
+
+/*++
+
+Structure Description:
+
+    This structure defines a mounted memory-backed file system.
+
+Members:
+
+    Type - Stores the object type, TmpfsObjectVolume.
+
+    ListEntry - Stores pointers to the next and previous volumes on the
+        device.
+
+    Device - Stores a pointer to the tmpfs device underneath the volume.
+
+    MaxSize - Stores the maximum number of bytes of file data that can be
+        charged against this file system.
+
+    UsedSize - Stores the number of bytes of file data charged against this
+        file system.
+
+    FileCount - Stores the number of files on the file system.
+
+    Lock - Stores a pointer to the lock protecting the namespace: the node
+        tree, every directory's entry trees, and the next file ID.
+
+    NodeTree - Stores the tree of every node on the volume, keyed by file ID.
+
+    NextFileId - Stores the file ID to give the next node created.
+
+    Root - Stores a pointer to the root directory.
+
+--*/
+
+typedef struct _TMPFS_VOLUME {
+    TMPFS_OBJECT_TYPE Type;
+    LIST_ENTRY ListEntry;
+    PTMPFS_DEVICE Device;
+    ULONGLONG MaxSize;
+    volatile ULONGLONG UsedSize;
+    volatile ULONGLONG FileCount;
+    PSHARED_EXCLUSIVE_LOCK Lock;
+    RED_BLACK_TREE NodeTree;
+    FILE_ID NextFileId;
+    PTMPFS_NODE Root;
+} TMPFS_VOLUME, *PTMPFS_VOLUME;
+
+/*++
+
+Structure Description:
+
+    This structure defines a directory entry.
+
+Members:
+
+    NameNode - Stores the node in the directory's tree of entries sorted by
+        name.
+
+    CookieNode - Stores the node in the directory's tree of entries sorted by
+        cookie.
+
+    Node - Stores a pointer to the file the entry names.
+
+    Cookie - Stores the directory offset of this entry. Cookies are handed
+        out in increasing order and never reused within a directory, so a
+        directory read can resume after entries come and go.
+
+    Name - Stores a pointer to the null terminated name.
+
+    NameSize - Stores the size of the name in bytes, including the null
+        terminator.
+
+--*/
+
+typedef struct _TMPFS_ENTRY {
+    RED_BLACK_TREE_NODE NameNode;
+    RED_BLACK_TREE_NODE CookieNode;
+    PTMPFS_NODE Node;
+    ULONGLONG Cookie;
+    PCSTR Name;
+    ULONG NameSize;
+} TMPFS_ENTRY, *PTMPFS_ENTRY;
+
+/*++
+
+Structure Description:
+
+    This structure defines a region of the page file holding file data that
+    the page cache has released.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous regions of the file.
+
+    ImageBacking - Stores the page file space for the region.
+
+    Offset - Stores the file offset where the region starts.
+
+    Size - Stores the size of the region, in bytes.
+
+    DirtyBitmap - Stores a bitmap of which pages in the region have been
+        written to the page file. Other pages read back as zero.
+
+--*/
+
+typedef struct _TMPFS_REGION {
+    LIST_ENTRY ListEntry;
+    IMAGE_BACKING ImageBacking;
+    IO_OFFSET Offset;
+    ULONG Size;
+    ULONG DirtyBitmap;
+} TMPFS_REGION, *PTMPFS_REGION;
+
+/*++
+
+Structure Description:
+
+    This structure defines a file or directory.
+
+Members:
+
+    TreeNode - Stores the node in the volume's tree of nodes.
+
+    Properties - Stores the file properties. The system keeps the live copy
+        while the file is in use and writes it back here.
+
+    Entry - Stores a pointer to the directory entry naming this node, or NULL
+        for the root and for unlinked files.
+
+    Lock - Stores a pointer to the lock protecting the region list and the
+        charged size.
+
+    ChargedSize - Stores the number of bytes charged against the file system
+        for this file's data. This is always page aligned.
+
+    RegionList - Stores the head of the list of page file regions, sorted by
+        offset.
+
+    NameTree - Stores the tree of directory entries sorted by name, for
+        directories.
+
+    CookieTree - Stores the tree of directory entries sorted by cookie, for
+        directories.
+
+    NextCookie - Stores the cookie to give the next entry added to this
+        directory.
+
+    EntryCount - Stores the number of entries in this directory.
+
+--*/
+
+struct _TMPFS_NODE {
+    RED_BLACK_TREE_NODE TreeNode;
+    FILE_PROPERTIES Properties;
+    PTMPFS_ENTRY Entry;
+    PQUEUED_LOCK Lock;
+    ULONGLONG ChargedSize;
+    LIST_ENTRY RegionList;
+    RED_BLACK_TREE NameTree;
+    RED_BLACK_TREE CookieTree;
+    ULONGLONG NextCookie;
+    ULONG EntryCount;
+};
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+TmpfsAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    );
+
+VOID
+TmpfsDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpfsDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpfsDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpfsDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+TmpfsDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+KSTATUS
+TmpfspCreateVolume (
+    PVOID Driver,
+    PTMPFS_DEVICE Device,
+    PVOID DeviceToken
+    );
+
+VOID
+TmpfspDestroyVolume (
+    PTMPFS_VOLUME Volume
+    );
+
+VOID
+TmpfspDeviceSystemControl (
+    PIRP Irp,
+    PTMPFS_DEVICE Device
+    );
+
+VOID
+TmpfspHandleDeviceInformationRequest (
+    PIRP Irp,
+    PVOID DeviceContext
+    );
+
+KSTATUS
+TmpfspLookup (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_LOOKUP Lookup
+    );
+
+KSTATUS
+TmpfspCreate (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_CREATE Create
+    );
+
+KSTATUS
+TmpfspUnlink (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_UNLINK Unlink
+    );
+
+KSTATUS
+TmpfspRename (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_RENAME Rename
+    );
+
+KSTATUS
+TmpfspTruncate (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_TRUNCATE Truncate
+    );
+
+KSTATUS
+TmpfspDelete (
+    PTMPFS_VOLUME Volume,
+    PFILE_PROPERTIES Properties
+    );
+
+KSTATUS
+TmpfspEnumerateDirectory (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Directory,
+    PIRP Irp
+    );
+
+KSTATUS
+TmpfspPerformIo (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    PIRP Irp
+    );
+
+KSTATUS
+TmpfspChargeNode (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    ULONGLONG NewSize
+    );
+
+PTMPFS_NODE
+TmpfspCreateNode (
+    PTMPFS_VOLUME Volume,
+    PFILE_PROPERTIES Properties
+    );
+
+VOID
+TmpfspDestroyNode (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node
+    );
+
+PTMPFS_NODE
+TmpfspGetNode (
+    PTMPFS_VOLUME Volume,
+    FILE_ID FileId
+    );
+
+PTMPFS_ENTRY
+TmpfspCreateEntry (
+    PCSTR Name,
+    ULONG NameSize
+    );
+
+VOID
+TmpfspInsertEntry (
+    PTMPFS_NODE Directory,
+    PTMPFS_ENTRY Entry,
+    PTMPFS_NODE Node
+    );
+
+VOID
+TmpfspRemoveEntry (
+    PTMPFS_NODE Directory,
+    PTMPFS_ENTRY Entry
+    );
+
+PTMPFS_ENTRY
+TmpfspFindEntry (
+    PTMPFS_NODE Directory,
+    PCSTR Name,
+    ULONG NameSize
+    );
+
+ULONG
+TmpfspGetNameLength (
+    PCSTR Name,
+    ULONG NameSize
+    );
+
+PTMPFS_REGION
+TmpfspCreateRegion (
+    PTMPFS_NODE Node,
+    IO_OFFSET Offset,
+    PTMPFS_REGION NextRegion
+    );
+
+VOID
+TmpfspDestroyRegion (
+    PTMPFS_REGION Region
+    );
+
+COMPARISON_RESULT
+TmpfspCompareNodes (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+COMPARISON_RESULT
+TmpfspCompareEntryNames (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+COMPARISON_RESULT
+TmpfspCompareEntryCookies (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+PDRIVER TmpfsDriver = NULL;
+
+//
+// Store the list of tmpfs devices, so that volumes can be matched to them,
+// and the lock that protects it and each device's list of volumes.
+//
+
+LIST_ENTRY TmpfsDeviceList;
+PQUEUED_LOCK TmpfsDeviceListLock;
+
+UUID TmpfsDeviceInformationUuid = TMPFS_DEVICE_INFORMATION_UUID;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+DriverEntry (
+    PDRIVER Driver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for the tmpfs driver. It registers its
+    other dispatch functions, and registers itself as a file system.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver object.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code on error.
+
+--*/
+
+{
+
+    DRIVER_FUNCTION_TABLE FunctionTable;
+    KSTATUS Status;
+
+    TmpfsDriver = Driver;
+    INITIALIZE_LIST_HEAD(&TmpfsDeviceList);
+    TmpfsDeviceListLock = KeCreateQueuedLock();
+    if (TmpfsDeviceListLock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto DriverEntryEnd;
+    }
+
+    RtlZeroMemory(&FunctionTable, sizeof(DRIVER_FUNCTION_TABLE));
+    FunctionTable.Version = DRIVER_FUNCTION_TABLE_VERSION;
+    FunctionTable.AddDevice = TmpfsAddDevice;
+    FunctionTable.DispatchStateChange = TmpfsDispatchStateChange;
+    FunctionTable.DispatchOpen = TmpfsDispatchOpen;
+    FunctionTable.DispatchClose = TmpfsDispatchClose;
+    FunctionTable.DispatchIo = TmpfsDispatchIo;
+    FunctionTable.DispatchSystemControl = TmpfsDispatchSystemControl;
+    Status = IoRegisterDriverFunctions(Driver, &FunctionTable);
+    if (!KSUCCESS(Status)) {
+        goto DriverEntryEnd;
+    }
+
+    Status = IoRegisterFileSystem(Driver);
+
+DriverEntryEnd:
+    return Status;
+}
+
+KSTATUS
+TmpfsAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called both for the raw tmpfs devices listed in the device
+    map, and for every volume that arrives in the system. It attaches to the
+    former, and to the volumes sitting on top of them.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver being called.
+
+    DeviceId - Supplies a pointer to a string with the device ID.
+
+    ClassId - Supplies a pointer to a string containing the device's class ID.
+
+    CompatibleIds - Supplies a pointer to a string containing device IDs
+        that would be compatible with this device.
+
+    DeviceToken - Supplies an opaque token that the driver can use to identify
+        the device in the system. This token should be used when attaching to
+        the stack.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code if the driver was unsuccessful in attaching itself.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PTMPFS_DEVICE Device;
+    ULONG PageSize;
+    KSTATUS Status;
+    PDEVICE TargetDevice;
+
+    //
+    // If this is a volume, attach only if it sits on a tmpfs device.
+    //
+
+    TargetDevice = IoGetTargetDevice(DeviceToken);
+    if (TargetDevice != NULL) {
+        Status = STATUS_NOT_SUPPORTED;
+        KeAcquireQueuedLock(TmpfsDeviceListLock);
+        CurrentEntry = TmpfsDeviceList.Next;
+        while (CurrentEntry != &TmpfsDeviceList) {
+            Device = LIST_VALUE(CurrentEntry, TMPFS_DEVICE, ListEntry);
+            if (Device->OsDevice == TargetDevice) {
+                Status = TmpfspCreateVolume(Driver, Device, DeviceToken);
+                break;
+            }
+
+            CurrentEntry = CurrentEntry->Next;
+        }
+
+        KeReleaseQueuedLock(TmpfsDeviceListLock);
+        return Status;
+    }
+
+    if (IoAreDeviceIdsEqual(DeviceId, TMPFS_DEVICE_ID) == FALSE) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    Device = MmAllocatePagedPool(sizeof(TMPFS_DEVICE), TMPFS_ALLOCATION_TAG);
+    if (Device == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Device, sizeof(TMPFS_DEVICE));
+    PageSize = MmPageSize();
+    Device->Type = TmpfsObjectDevice;
+    Device->OsDevice = DeviceToken;
+    INITIALIZE_LIST_HEAD(&(Device->VolumeList));
+    Device->MaxSize = (ULONGLONG)MmGetTotalPhysicalPages() * PageSize /
+                      TMPFS_DEFAULT_SIZE_DIVISOR;
+
+    Device->MaxSize = ALIGN_RANGE_DOWN(Device->MaxSize, PageSize);
+    Status = IoAttachDriverToDevice(Driver, DeviceToken, Device);
+    if (!KSUCCESS(Status)) {
+        MmFreePagedPool(Device);
+        return Status;
+    }
+
+    KeAcquireQueuedLock(TmpfsDeviceListLock);
+    INSERT_BEFORE(&(Device->ListEntry), &TmpfsDeviceList);
+    KeReleaseQueuedLock(TmpfsDeviceListLock);
+    return STATUS_SUCCESS;
+}
+
+VOID
+TmpfsDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles State Change IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_DEVICE Device;
+    KSTATUS Status;
+    PTMPFS_VOLUME Volume;
+
+    ASSERT(Irp->MajorCode == IrpMajorStateChange);
+
+    //
+    // Volumes are handled on the way down, like other file systems.
+    //
+
+    if (*((PTMPFS_OBJECT_TYPE)DeviceContext) == TmpfsObjectVolume) {
+        Volume = DeviceContext;
+        if (Irp->Direction != IrpDown) {
+            return;
+        }
+
+        switch (Irp->MinorCode) {
+        case IrpMinorQueryResources:
+            IoCompleteIrp(TmpfsDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        //
+        // Each volume publishes its own size information, as each has its own
+        // limit.
+        //
+
+        case IrpMinorStartDevice:
+            Status = IoRegisterDeviceInformation(Irp->Device,
+                                                 &TmpfsDeviceInformationUuid,
+                                                 TRUE);
+
+            IoCompleteIrp(TmpfsDriver, Irp, Status);
+            break;
+
+        case IrpMinorQueryChildren:
+            Irp->U.QueryChildren.ChildCount = 0;
+            Irp->U.QueryChildren.Children = NULL;
+            IoCompleteIrp(TmpfsDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        case IrpMinorRemoveDevice:
+            IoRegisterDeviceInformation(Irp->Device,
+                                        &TmpfsDeviceInformationUuid,
+                                        FALSE);
+
+            TmpfspDestroyVolume(Volume);
+            IoCompleteIrp(TmpfsDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        default:
+            break;
+        }
+
+        return;
+    }
+
+    //
+    // The raw device is a root device with no bus driver, so it completes
+    // its requests on the way back up.
+    //
+
+    Device = DeviceContext;
+    switch (Irp->MinorCode) {
+    case IrpMinorQueryResources:
+        if (Irp->Direction == IrpUp) {
+            IoCompleteIrp(TmpfsDriver, Irp, STATUS_SUCCESS);
+        }
+
+        break;
+
+    case IrpMinorStartDevice:
+        if (Irp->Direction == IrpUp) {
+            Status = IoRegisterDeviceInformation(Irp->Device,
+                                                 &TmpfsDeviceInformationUuid,
+                                                 TRUE);
+
+            //
+            // Mark the device mountable, with a new volume for every mount so
+            // that each mount is a separate file system.
+            //
+
+            if (KSUCCESS(Status)) {
+                IoSetDeviceVolumePerMount(Irp->Device);
+                IoSetDeviceMountable(Irp->Device);
+            }
+
+            IoCompleteIrp(TmpfsDriver, Irp, Status);
+        }
+
+        break;
+
+    case IrpMinorQueryChildren:
+        IoCompleteIrp(TmpfsDriver, Irp, STATUS_SUCCESS);
+        break;
+
+    case IrpMinorRemoveDevice:
+        if (Irp->Direction == IrpUp) {
+            IoRegisterDeviceInformation(Irp->Device,
+                                        &TmpfsDeviceInformationUuid,
+                                        FALSE);
+
+            KeAcquireQueuedLock(TmpfsDeviceListLock);
+            LIST_REMOVE(&(Device->ListEntry));
+            KeReleaseQueuedLock(TmpfsDeviceListLock);
+
+            ASSERT(LIST_EMPTY(&(Device->VolumeList)) != FALSE);
+
+            MmFreePagedPool(Device);
+            IoCompleteIrp(TmpfsDriver, Irp, STATUS_SUCCESS);
+        }
+
+        break;
+
+    //
+    // For all other IRPs, do nothing.
+    //
+
+    default:
+        break;
+    }
+
+    return;
+}
+
+VOID
+TmpfsDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Open IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+    PTMPFS_VOLUME Volume;
+
+    ASSERT(Irp->MajorCode == IrpMajorOpen);
+    ASSERT(Irp->MinorCode == IrpMinorOpen);
+
+    //
+    // The raw device has nothing to open, but allow it so that it can be
+    // looked at.
+    //
+
+    if (*((PTMPFS_OBJECT_TYPE)DeviceContext) == TmpfsObjectDevice) {
+        Irp->U.Open.DeviceContext = NULL;
+        IoCompleteIrp(TmpfsDriver, Irp, STATUS_SUCCESS);
+        return;
+    }
+
+    //
+    // The data lives in memory, so there is nowhere to put a page file.
+    //
+
+    if ((Irp->U.Open.OpenFlags & OPEN_FLAG_PAGE_FILE) != 0) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto DispatchOpenEnd;
+    }
+
+    Volume = DeviceContext;
+    KeAcquireSharedExclusiveLockShared(Volume->Lock);
+    Node = TmpfspGetNode(Volume, Irp->U.Open.FileProperties->FileId);
+    KeReleaseSharedExclusiveLockShared(Volume->Lock);
+    if (Node == NULL) {
+        Status = STATUS_PATH_NOT_FOUND;
+        goto DispatchOpenEnd;
+    }
+
+    Irp->U.Open.DeviceContext = Node;
+    Status = STATUS_SUCCESS;
+
+DispatchOpenEnd:
+    IoCompleteIrp(TmpfsDriver, Irp, Status);
+    return;
+}
+
+VOID
+TmpfsDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Close IRPs. Nodes live until they are deleted, so
+    there is nothing to tear down.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Irp->MajorCode == IrpMajorClose);
+    ASSERT(Irp->MinorCode == IrpMinorClose);
+
+    IoCompleteIrp(TmpfsDriver, Irp, STATUS_SUCCESS);
+    return;
+}
+
+VOID
+TmpfsDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles I/O IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+    PTMPFS_VOLUME Volume;
+
+    ASSERT(Irp->Direction == IrpDown);
+    ASSERT(Irp->MajorCode == IrpMajorIo);
+
+    //
+    // The raw device holds no data of its own.
+    //
+
+    if (*((PTMPFS_OBJECT_TYPE)DeviceContext) == TmpfsObjectDevice) {
+        IoCompleteIrp(TmpfsDriver, Irp, STATUS_NOT_SUPPORTED);
+        return;
+    }
+
+    Volume = DeviceContext;
+    Node = Irp->U.ReadWrite.DeviceContext;
+
+    ASSERT(Node != NULL);
+    ASSERT(Irp->U.ReadWrite.IoBuffer != NULL);
+
+    if (Node->Properties.Type == IoObjectRegularDirectory) {
+
+        //
+        // Directories cannot be written to directly.
+        //
+
+        if (Irp->MinorCode == IrpMinorIoWrite) {
+            Status = STATUS_ACCESS_DENIED;
+
+        } else {
+            Status = TmpfspEnumerateDirectory(Volume, Node, Irp);
+        }
+
+    } else {
+        Status = TmpfspPerformIo(Volume, Node, Irp);
+    }
+
+    IoCompleteIrp(TmpfsDriver, Irp, Status);
+    return;
+}
+
+VOID
+TmpfsDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID Context;
+    PSYSTEM_CONTROL_FILE_OPERATION FileOperation;
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+    PTMPFS_VOLUME Volume;
+
+    if (*((PTMPFS_OBJECT_TYPE)DeviceContext) == TmpfsObjectDevice) {
+        TmpfspDeviceSystemControl(Irp, DeviceContext);
+        return;
+    }
+
+    Volume = DeviceContext;
+    Context = Irp->U.SystemControl.SystemContext;
+    switch (Irp->MinorCode) {
+    case IrpMinorSystemControlLookup:
+        Status = TmpfspLookup(Volume, Context);
+        IoCompleteIrp(TmpfsDriver, Irp, Status);
+        break;
+
+    case IrpMinorSystemControlCreate:
+        Status = TmpfspCreate(Volume, Context);
+        IoCompleteIrp(TmpfsDriver, Irp, Status);
+        break;
+
+    case IrpMinorSystemControlDelete:
+        FileOperation = (PSYSTEM_CONTROL_FILE_OPERATION)Context;
+        Status = TmpfspDelete(Volume, FileOperation->FileProperties);
+        IoCompleteIrp(TmpfsDriver, Irp, Status);
+        break;
+
+    //
+    // Save the properties, as there is nowhere else to put them.
+    //
+
+    case IrpMinorSystemControlWriteFileProperties:
+        FileOperation = (PSYSTEM_CONTROL_FILE_OPERATION)Context;
+        Status = STATUS_SUCCESS;
+        KeAcquireSharedExclusiveLockExclusive(Volume->Lock);
+        Node = TmpfspGetNode(Volume, FileOperation->FileProperties->FileId);
+        if (Node != NULL) {
+            RtlCopyMemory(&(Node->Properties),
+                          FileOperation->FileProperties,
+                          sizeof(FILE_PROPERTIES));
+
+        } else {
+            Status = STATUS_PATH_NOT_FOUND;
+        }
+
+        KeReleaseSharedExclusiveLockExclusive(Volume->Lock);
+        IoCompleteIrp(TmpfsDriver, Irp, Status);
+        break;
+
+    case IrpMinorSystemControlUnlink:
+        Status = TmpfspUnlink(Volume, Context);
+        IoCompleteIrp(TmpfsDriver, Irp, Status);
+        break;
+
+    case IrpMinorSystemControlRename:
+        Status = TmpfspRename(Volume, Context);
+        IoCompleteIrp(TmpfsDriver, Irp, Status);
+        break;
+
+    case IrpMinorSystemControlTruncate:
+        Status = TmpfspTruncate(Volume, Context);
+        IoCompleteIrp(TmpfsDriver, Irp, Status);
+        break;
+
+    //
+    // There are no disk blocks behind the files.
+    //
+
+    case IrpMinorSystemControlGetBlockInformation:
+        IoCompleteIrp(TmpfsDriver, Irp, STATUS_NOT_SUPPORTED);
+        break;
+
+    //
+    // Nothing is stored anywhere that could be synchronized.
+    //
+
+    case IrpMinorSystemControlSynchronize:
+        IoCompleteIrp(TmpfsDriver, Irp, STATUS_SUCCESS);
+        break;
+
+    case IrpMinorSystemControlDeviceInformation:
+        TmpfspHandleDeviceInformationRequest(Irp, Volume);
+        break;
+
+    //
+    // Ignore everything unrecognized.
+    //
+
+    default:
+        break;
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+TmpfspCreateVolume (
+    PVOID Driver,
+    PTMPFS_DEVICE Device,
+    PVOID DeviceToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates an empty file system and attaches it to a volume
+    sitting on the given tmpfs device. This routine assumes the device list
+    lock is held.
+
+Arguments:
+
+    Driver - Supplies a pointer to this driver.
+
+    Device - Supplies a pointer to the tmpfs device underneath the volume.
+
+    DeviceToken - Supplies the volume's device token.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    FILE_PROPERTIES Properties;
+    PTMPFS_NODE Root;
+    KSTATUS Status;
+    PTMPFS_VOLUME Volume;
+
+    Volume = MmAllocatePagedPool(sizeof(TMPFS_VOLUME), TMPFS_ALLOCATION_TAG);
+    if (Volume == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateVolumeEnd;
+    }
+
+    RtlZeroMemory(Volume, sizeof(TMPFS_VOLUME));
+    Volume->Type = TmpfsObjectVolume;
+    Volume->Device = Device;
+    Volume->MaxSize = Device->MaxSize;
+    Volume->NextFileId = TMPFS_ROOT_FILE_ID;
+    RtlRedBlackTreeInitialize(&(Volume->NodeTree), 0, TmpfspCompareNodes);
+    Volume->Lock = KeCreateSharedExclusiveLock();
+    if (Volume->Lock == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateVolumeEnd;
+    }
+
+    RtlZeroMemory(&Properties, sizeof(FILE_PROPERTIES));
+    Properties.Type = IoObjectRegularDirectory;
+    Properties.Permissions = TMPFS_DEFAULT_PERMISSIONS;
+    KeGetSystemTime(&(Properties.StatusChangeTime));
+    RtlCopyMemory(&(Properties.ModifiedTime),
+                  &(Properties.StatusChangeTime),
+                  sizeof(SYSTEM_TIME));
+
+    RtlCopyMemory(&(Properties.AccessTime),
+                  &(Properties.StatusChangeTime),
+                  sizeof(SYSTEM_TIME));
+
+    RtlCopyMemory(&(Properties.CreationTime),
+                  &(Properties.StatusChangeTime),
+                  sizeof(SYSTEM_TIME));
+
+    Root = TmpfspCreateNode(Volume, &Properties);
+    if (Root == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateVolumeEnd;
+    }
+
+    ASSERT(Root->Properties.FileId == TMPFS_ROOT_FILE_ID);
+
+    Volume->Root = Root;
+    Status = IoAttachDriverToDevice(Driver, DeviceToken, Volume);
+    if (!KSUCCESS(Status)) {
+        goto CreateVolumeEnd;
+    }
+
+    INSERT_BEFORE(&(Volume->ListEntry), &(Device->VolumeList));
+
+CreateVolumeEnd:
+    if (!KSUCCESS(Status)) {
+        if (Volume != NULL) {
+            TmpfspDestroyVolume(Volume);
+        }
+    }
+
+    return Status;
+}
+
+VOID
+TmpfspDestroyVolume (
+    PTMPFS_VOLUME Volume
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a volume and every file on it. If the volume is on
+    its device's list, the device list lock must not be held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_ENTRY Entry;
+    PRED_BLACK_TREE_NODE EntryNode;
+    PTMPFS_NODE Node;
+    PRED_BLACK_TREE_NODE TreeNode;
+
+    //
+    // Tear down every directory's entries first, then the nodes themselves.
+    //
+
+    TreeNode = RtlRedBlackTreeGetLowestNode(&(Volume->NodeTree));
+    while (TreeNode != NULL) {
+        Node = RED_BLACK_TREE_VALUE(TreeNode, TMPFS_NODE, TreeNode);
+        if (Node->Properties.Type == IoObjectRegularDirectory) {
+            while (TRUE) {
+                EntryNode = RtlRedBlackTreeGetLowestNode(&(Node->CookieTree));
+                if (EntryNode == NULL) {
+                    break;
+                }
+
+                Entry = RED_BLACK_TREE_VALUE(EntryNode,
+                                             TMPFS_ENTRY,
+                                             CookieNode);
+
+                TmpfspRemoveEntry(Node, Entry);
+                MmFreePagedPool(Entry);
+            }
+        }
+
+        TreeNode = RtlRedBlackTreeGetNextNode(&(Volume->NodeTree),
+                                              FALSE,
+                                              TreeNode);
+    }
+
+    while (TRUE) {
+        TreeNode = RtlRedBlackTreeGetLowestNode(&(Volume->NodeTree));
+        if (TreeNode == NULL) {
+            break;
+        }
+
+        Node = RED_BLACK_TREE_VALUE(TreeNode, TMPFS_NODE, TreeNode);
+        TmpfspDestroyNode(Volume, Node);
+    }
+
+    ASSERT(Volume->UsedSize == 0);
+
+    if (Volume->ListEntry.Next != NULL) {
+        KeAcquireQueuedLock(TmpfsDeviceListLock);
+        LIST_REMOVE(&(Volume->ListEntry));
+        KeReleaseQueuedLock(TmpfsDeviceListLock);
+    }
+
+    if (Volume->Lock != NULL) {
+        KeDestroySharedExclusiveLock(Volume->Lock);
+    }
+
+    MmFreePagedPool(Volume);
+    return;
+}
+
+VOID
+TmpfspDeviceSystemControl (
+    PIRP Irp,
+    PTMPFS_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles system control requests sent to the raw tmpfs device.
+    The device can be looked up as a block device so that it can be named as
+    the target of a mount.
+
+Arguments:
+
+    Irp - Supplies a pointer to the system control IRP.
+
+    Device - Supplies a pointer to the tmpfs device.
+
+Return Value:
+
+    None. The IRP is completed or passed on.
+
+--*/
+
+{
+
+    PVOID Context;
+    PSYSTEM_CONTROL_LOOKUP Lookup;
+    PFILE_PROPERTIES Properties;
+    KSTATUS Status;
+
+    Context = Irp->U.SystemControl.SystemContext;
+    switch (Irp->MinorCode) {
+    case IrpMinorSystemControlLookup:
+        Lookup = (PSYSTEM_CONTROL_LOOKUP)Context;
+        Status = STATUS_PATH_NOT_FOUND;
+        if (Lookup->Root != FALSE) {
+            Properties = Lookup->Properties;
+            Properties->FileId = 0;
+            Properties->Type = IoObjectBlockDevice;
+            Properties->HardLinkCount = 1;
+            Properties->BlockSize = MmPageSize();
+            Properties->BlockCount = 0;
+            Properties->Size = 0;
+            Lookup->Flags = LOOKUP_FLAG_NON_CACHED;
+            Status = STATUS_SUCCESS;
+        }
+
+        IoCompleteIrp(TmpfsDriver, Irp, Status);
+        break;
+
+    case IrpMinorSystemControlWriteFileProperties:
+        IoCompleteIrp(TmpfsDriver, Irp, STATUS_SUCCESS);
+        break;
+
+    case IrpMinorSystemControlTruncate:
+        IoCompleteIrp(TmpfsDriver, Irp, STATUS_NOT_SUPPORTED);
+        break;
+
+    case IrpMinorSystemControlDeviceInformation:
+        TmpfspHandleDeviceInformationRequest(Irp, Device);
+        break;
+
+    case IrpMinorSystemControlSynchronize:
+        IoCompleteIrp(TmpfsDriver, Irp, STATUS_SUCCESS);
+        break;
+
+    default:
+        break;
+    }
+
+    return;
+}
+
+VOID
+TmpfspHandleDeviceInformationRequest (
+    PIRP Irp,
+    PVOID DeviceContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles requests to get and set the file system's size
+    information. For a volume, this is the volume's own limit and usage. For
+    the raw device, the limit is the one new volumes start out with, and the
+    usage is the total across all of the device's volumes.
+
+Arguments:
+
+    Irp - Supplies a pointer to the IRP making the request.
+
+    DeviceContext - Supplies a pointer to the tmpfs device or volume.
+
+Return Value:
+
+    None. Any completion status is set in the IRP.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PTMPFS_DEVICE Device;
+    ULONGLONG FileCount;
+    PTMPFS_DEVICE_INFORMATION Information;
+    BOOL Match;
+    ULONGLONG MaxSize;
+    PSYSTEM_CONTROL_DEVICE_INFORMATION Request;
+    KSTATUS Status;
+    ULONGLONG UsedSize;
+    PTMPFS_VOLUME Volume;
+
+    Request = Irp->U.SystemControl.SystemContext;
+    Match = RtlAreUuidsEqual(&(Request->Uuid), &TmpfsDeviceInformationUuid);
+    if (Match == FALSE) {
+        return;
+    }
+
+    if (Request->DataSize < sizeof(TMPFS_DEVICE_INFORMATION)) {
+        Request->DataSize = sizeof(TMPFS_DEVICE_INFORMATION);
+        Status = STATUS_BUFFER_TOO_SMALL;
+        goto HandleDeviceInformationRequestEnd;
+    }
+
+    Request->DataSize = sizeof(TMPFS_DEVICE_INFORMATION);
+    Information = Request->Data;
+
+    //
+    // Only the maximum size can be changed. Shrinking it below what is in use
+    // is allowed; new data is refused until enough is freed.
+    //
+
+    MaxSize = 0;
+    if (Request->Set != FALSE) {
+        if (Information->Version < TMPFS_DEVICE_INFORMATION_VERSION) {
+            Status = STATUS_INVALID_PARAMETER;
+            goto HandleDeviceInformationRequestEnd;
+        }
+
+        MaxSize = ALIGN_RANGE_DOWN(Information->MaxSize, MmPageSize());
+        if (MaxSize == 0) {
+            Status = STATUS_INVALID_PARAMETER;
+            goto HandleDeviceInformationRequestEnd;
+        }
+    }
+
+    if (*((PTMPFS_OBJECT_TYPE)DeviceContext) == TmpfsObjectVolume) {
+        Volume = DeviceContext;
+        if (MaxSize != 0) {
+            Volume->MaxSize = MaxSize;
+        }
+
+        MaxSize = Volume->MaxSize;
+        UsedSize = Volume->UsedSize;
+        FileCount = Volume->FileCount;
+
+    } else {
+        Device = DeviceContext;
+        if (MaxSize != 0) {
+            Device->MaxSize = MaxSize;
+        }
+
+        MaxSize = Device->MaxSize;
+        UsedSize = 0;
+        FileCount = 0;
+        KeAcquireQueuedLock(TmpfsDeviceListLock);
+        CurrentEntry = Device->VolumeList.Next;
+        while (CurrentEntry != &(Device->VolumeList)) {
+            Volume = LIST_VALUE(CurrentEntry, TMPFS_VOLUME, ListEntry);
+            UsedSize += Volume->UsedSize;
+            FileCount += Volume->FileCount;
+            CurrentEntry = CurrentEntry->Next;
+        }
+
+        KeReleaseQueuedLock(TmpfsDeviceListLock);
+    }
+
+    RtlZeroMemory(Information, sizeof(TMPFS_DEVICE_INFORMATION));
+    Information->Version = TMPFS_DEVICE_INFORMATION_VERSION;
+    Information->MaxSize = MaxSize;
+    Information->UsedSize = UsedSize;
+    Information->FileCount = FileCount;
+    Status = STATUS_SUCCESS;
+
+HandleDeviceInformationRequestEnd:
+    IoCompleteIrp(TmpfsDriver, Irp, Status);
+    return;
+}
+
+KSTATUS
+TmpfspLookup (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_LOOKUP Lookup
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up a file by name, or the root directory.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Lookup - Supplies a pointer to the lookup request.
+
+Return Value:
+
+    STATUS_SUCCESS if the file was found.
+
+    STATUS_PATH_NOT_FOUND if no entry by that name exists.
+
+--*/
+
+{
+
+    PTMPFS_NODE Directory;
+    PTMPFS_ENTRY Entry;
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+
+    //
+    // The page cache is the only place file data lives. Tell the system not
+    // to let go of written pages without sending a hard flush.
+    //
+
+    Lookup->Flags = LOOKUP_FLAG_HARD_FLUSH_REQUIRED;
+    KeAcquireSharedExclusiveLockShared(Volume->Lock);
+    if (Lookup->Root != FALSE) {
+        Node = Volume->Root;
+
+    } else {
+        Node = NULL;
+        Directory = TmpfspGetNode(Volume,
+                                  Lookup->DirectoryProperties->FileId);
+
+        if (Directory != NULL) {
+            Entry = TmpfspFindEntry(Directory,
+                                    Lookup->FileName,
+                                    Lookup->FileNameSize);
+
+            if (Entry != NULL) {
+                Node = Entry->Node;
+            }
+        }
+    }
+
+    if (Node != NULL) {
+        RtlCopyMemory(Lookup->Properties,
+                      &(Node->Properties),
+                      sizeof(FILE_PROPERTIES));
+
+        Status = STATUS_SUCCESS;
+
+    } else {
+        Status = STATUS_PATH_NOT_FOUND;
+    }
+
+    KeReleaseSharedExclusiveLockShared(Volume->Lock);
+    return Status;
+}
+
+KSTATUS
+TmpfspCreate (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_CREATE Create
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new file or directory.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Create - Supplies a pointer to the create request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE Directory;
+    PTMPFS_ENTRY Entry;
+    ULONG NameLength;
+    PTMPFS_NODE Node;
+    PFILE_PROPERTIES Properties;
+    KSTATUS Status;
+
+    Entry = NULL;
+    NameLength = TmpfspGetNameLength(Create->Name, Create->NameSize);
+    if (NameLength > TMPFS_MAX_NAME_LENGTH) {
+        return STATUS_NAME_TOO_LONG;
+    }
+
+    //
+    // Refuse new files once the file system is full. Otherwise a full file
+    // system could still be filled with empty files indefinitely.
+    //
+
+    if (Volume->UsedSize >= Volume->MaxSize) {
+        return STATUS_VOLUME_FULL;
+    }
+
+    Entry = TmpfspCreateEntry(Create->Name, NameLength + 1);
+    if (Entry == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeAcquireSharedExclusiveLockExclusive(Volume->Lock);
+    Directory = TmpfspGetNode(Volume, Create->DirectoryProperties->FileId);
+    if (Directory == NULL) {
+        Status = STATUS_PATH_NOT_FOUND;
+        goto CreateEnd;
+    }
+
+    if (TmpfspFindEntry(Directory, Entry->Name, Entry->NameSize) != NULL) {
+        Status = STATUS_FILE_EXISTS;
+        goto CreateEnd;
+    }
+
+    Properties = &(Create->FileProperties);
+    Properties->HardLinkCount = 1;
+    Properties->Size = 0;
+    Properties->BlockSize = MmPageSize();
+    Properties->BlockCount = 0;
+    Node = TmpfspCreateNode(Volume, Properties);
+    if (Node == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateEnd;
+    }
+
+    RtlCopyMemory(Properties, &(Node->Properties), sizeof(FILE_PROPERTIES));
+    TmpfspInsertEntry(Directory, Entry, Node);
+    Entry = NULL;
+    Create->DirectorySize = 0;
+    Status = STATUS_SUCCESS;
+
+CreateEnd:
+    KeReleaseSharedExclusiveLockExclusive(Volume->Lock);
+    if (Entry != NULL) {
+        MmFreePagedPool(Entry);
+    }
+
+    return Status;
+}
+
+KSTATUS
+TmpfspUnlink (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_UNLINK Unlink
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a directory entry. The file itself is destroyed by
+    the delete request the system sends once it is no longer in use.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Unlink - Supplies a pointer to the unlink request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE Directory;
+    PTMPFS_ENTRY Entry;
+    KSTATUS Status;
+
+    KeAcquireSharedExclusiveLockExclusive(Volume->Lock);
+    Directory = TmpfspGetNode(Volume, Unlink->DirectoryProperties->FileId);
+    if (Directory == NULL) {
+        Status = STATUS_PATH_NOT_FOUND;
+        goto UnlinkEnd;
+    }
+
+    Entry = TmpfspFindEntry(Directory, Unlink->Name, Unlink->NameSize);
+    if ((Entry == NULL) ||
+        (Entry->Node->Properties.FileId != Unlink->FileProperties->FileId)) {
+
+        Status = STATUS_PATH_NOT_FOUND;
+        goto UnlinkEnd;
+    }
+
+    if (Entry->Node->EntryCount != 0) {
+        Status = STATUS_DIRECTORY_NOT_EMPTY;
+        goto UnlinkEnd;
+    }
+
+    TmpfspRemoveEntry(Directory, Entry);
+    MmFreePagedPool(Entry);
+    Unlink->Unlinked = TRUE;
+    Status = STATUS_SUCCESS;
+
+UnlinkEnd:
+    KeReleaseSharedExclusiveLockExclusive(Volume->Lock);
+    return Status;
+}
+
+KSTATUS
+TmpfspRename (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_RENAME Rename
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves a directory entry, replacing whatever is at the
+    destination. The system has already checked the types of the source and
+    destination and that a directory is not being moved under itself.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Rename - Supplies a pointer to the rename request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE DestinationDirectory;
+    PTMPFS_ENTRY DestinationEntry;
+    ULONG NameLength;
+    PTMPFS_ENTRY NewEntry;
+    PTMPFS_NODE Node;
+    PTMPFS_NODE SourceDirectory;
+    PTMPFS_ENTRY SourceEntry;
+    KSTATUS Status;
+
+    Rename->SourceFileHardLinkDelta = 0;
+    Rename->DestinationDirectorySize = 0;
+    NameLength = TmpfspGetNameLength(Rename->Name, Rename->NameSize);
+    if (NameLength > TMPFS_MAX_NAME_LENGTH) {
+        return STATUS_NAME_TOO_LONG;
+    }
+
+    NewEntry = TmpfspCreateEntry(Rename->Name, NameLength + 1);
+    if (NewEntry == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeAcquireSharedExclusiveLockExclusive(Volume->Lock);
+    SourceDirectory = TmpfspGetNode(Volume,
+                                    Rename->SourceDirectoryProperties->FileId);
+
+    DestinationDirectory = TmpfspGetNode(
+                                Volume,
+                                Rename->DestinationDirectoryProperties->FileId);
+
+    Node = TmpfspGetNode(Volume, Rename->SourceFileProperties->FileId);
+    if ((SourceDirectory == NULL) || (DestinationDirectory == NULL) ||
+        (Node == NULL) || (Node->Entry == NULL)) {
+
+        Status = STATUS_PATH_NOT_FOUND;
+        goto RenameEnd;
+    }
+
+    SourceEntry = Node->Entry;
+
+    //
+    // Check the destination before changing anything, so that a failure
+    // leaves both names in place.
+    //
+
+    DestinationEntry = TmpfspFindEntry(DestinationDirectory,
+                                       NewEntry->Name,
+                                       NewEntry->NameSize);
+
+    if (DestinationEntry != NULL) {
+        if ((Rename->DestinationFileProperties == NULL) ||
+            (DestinationEntry->Node->Properties.FileId !=
+             Rename->DestinationFileProperties->FileId)) {
+
+            Status = STATUS_FILE_EXISTS;
+            goto RenameEnd;
+        }
+
+        if (DestinationEntry->Node->EntryCount != 0) {
+            Status = STATUS_DIRECTORY_NOT_EMPTY;
+            goto RenameEnd;
+        }
+
+        TmpfspRemoveEntry(DestinationDirectory, DestinationEntry);
+        MmFreePagedPool(DestinationEntry);
+        Rename->DestinationFileUnlinked = TRUE;
+    }
+
+    TmpfspRemoveEntry(SourceDirectory, SourceEntry);
+    MmFreePagedPool(SourceEntry);
+    TmpfspInsertEntry(DestinationDirectory, NewEntry, Node);
+    NewEntry = NULL;
+    Status = STATUS_SUCCESS;
+
+RenameEnd:
+    KeReleaseSharedExclusiveLockExclusive(Volume->Lock);
+    if (NewEntry != NULL) {
+        MmFreePagedPool(NewEntry);
+    }
+
+    return Status;
+}
+
+KSTATUS
+TmpfspTruncate (
+    PTMPFS_VOLUME Volume,
+    PSYSTEM_CONTROL_TRUNCATE Truncate
+    )
+
+/*++
+
+Routine Description:
+
+    This routine changes the size of a file. Growing the file is charged
+    against the file system's limit. The page cache also sends this before a
+    cached write grows the file, so a write past the limit fails up front
+    rather than leaving dirty pages that can never be flushed. Shrinking the
+    file releases page file space past the new end.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Truncate - Supplies a pointer to the truncate request.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    ULONGLONG NewSize;
+    PTMPFS_NODE Node;
+    ULONG PageCount;
+    ULONG PageSize;
+    PTMPFS_REGION Region;
+    ULONG RegionSize;
+    KSTATUS Status;
+
+    Node = Truncate->DeviceContext;
+
+    ASSERT(Node != NULL);
+    ASSERT(Truncate->FileProperties->Type != IoObjectRegularDirectory);
+
+    NewSize = Truncate->NewSize;
+    PageSize = MmPageSize();
+    KeAcquireQueuedLock(Node->Lock);
+    Status = TmpfspChargeNode(Volume,
+                              Node,
+                              ALIGN_RANGE_UP(NewSize, PageSize));
+
+    if (!KSUCCESS(Status)) {
+        goto TruncateEnd;
+    }
+
+    //
+    // Free page file regions entirely past the end. Don't bother partially
+    // freeing a region that straddles the end, just forget the pages past it
+    // so they read back as zero if the file grows again.
+    //
+
+    CurrentEntry = Node->RegionList.Next;
+    while (CurrentEntry != &(Node->RegionList)) {
+        Region = LIST_VALUE(CurrentEntry, TMPFS_REGION, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (Region->Offset >= NewSize) {
+            LIST_REMOVE(&(Region->ListEntry));
+            Region->ListEntry.Next = NULL;
+            TmpfspDestroyRegion(Region);
+
+        } else if ((Region->Offset + Region->Size) > NewSize) {
+            RegionSize = (ULONG)(NewSize - Region->Offset);
+            RegionSize = ALIGN_RANGE_UP(RegionSize, PageSize);
+            PageCount = RegionSize >> MmPageShift();
+            Region->DirtyBitmap &= (1 << PageCount) - 1;
+        }
+    }
+
+    Truncate->FileProperties->Size = NewSize;
+    Truncate->FileProperties->BlockCount = Node->ChargedSize / PageSize;
+
+TruncateEnd:
+    KeReleaseQueuedLock(Node->Lock);
+    return Status;
+}
+
+KSTATUS
+TmpfspDelete (
+    PTMPFS_VOLUME Volume,
+    PFILE_PROPERTIES Properties
+    )
+
+/*++
+
+Routine Description:
+
+    This routine destroys a file whose last link is gone and that is no longer
+    in use.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Properties - Supplies a pointer to the file's properties.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PTMPFS_NODE Node;
+    KSTATUS Status;
+
+    ASSERT(Properties->HardLinkCount == 0);
+    ASSERT(Properties->FileId != TMPFS_ROOT_FILE_ID);
+
+    KeAcquireSharedExclusiveLockExclusive(Volume->Lock);
+    Node = TmpfspGetNode(Volume, Properties->FileId);
+    if (Node != NULL) {
+
+        ASSERT((Node->Entry == NULL) && (Node->EntryCount == 0));
+
+        TmpfspDestroyNode(Volume, Node);
+        Status = STATUS_SUCCESS;
+
+    } else {
+        Status = STATUS_PATH_NOT_FOUND;
+    }
+
+    KeReleaseSharedExclusiveLockExclusive(Volume->Lock);
+    return Status;
+}
+
+KSTATUS
+TmpfspEnumerateDirectory (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Directory,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads directory entries starting at the given cookie.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Directory - Supplies a pointer to the directory to read.
+
+    Irp - Supplies a pointer to the read IRP. The bytes completed on input
+        holds the space already used by the relative entries.
+
+Return Value:
+
+    STATUS_SUCCESS if entries were returned.
+
+    STATUS_END_OF_FILE if there are no more entries.
+
+    STATUS_MORE_PROCESSING_REQUIRED if the next entry does not fit.
+
+--*/
+
+{
+
+    UINTN BytesWritten;
+    DIRECTORY_ENTRY DirectoryEntry;
+    PTMPFS_ENTRY Entry;
+    ULONG EntrySize;
+    IO_OFFSET NextOffset;
+    TMPFS_ENTRY SearchEntry;
+    UINTN SpaceLeft;
+    KSTATUS Status;
+    PRED_BLACK_TREE_NODE TreeNode;
+
+    ASSERT(Irp->U.ReadWrite.IoOffset >= DIRECTORY_CONTENTS_OFFSET);
+
+    BytesWritten = Irp->U.ReadWrite.IoBytesCompleted;
+    SpaceLeft = Irp->U.ReadWrite.IoSizeInBytes - BytesWritten;
+    NextOffset = Irp->U.ReadWrite.IoOffset;
+    Status = STATUS_SUCCESS;
+    KeAcquireSharedExclusiveLockShared(Volume->Lock);
+    SearchEntry.Cookie = NextOffset;
+    TreeNode = RtlRedBlackTreeSearchClosest(&(Directory->CookieTree),
+                                            &(SearchEntry.CookieNode),
+                                            TRUE);
+
+    while (TreeNode != NULL) {
+        Entry = RED_BLACK_TREE_VALUE(TreeNode, TMPFS_ENTRY, CookieNode);
+        EntrySize = ALIGN_RANGE_UP(sizeof(DIRECTORY_ENTRY) + Entry->NameSize,
+                                   8);
+
+        if (EntrySize > SpaceLeft) {
+            Status = STATUS_MORE_PROCESSING_REQUIRED;
+            break;
+        }
+
+        DirectoryEntry.FileId = Entry->Node->Properties.FileId;
+        DirectoryEntry.NextOffset = Entry->Cookie + 1;
+        DirectoryEntry.Size = EntrySize;
+        DirectoryEntry.Type = Entry->Node->Properties.Type;
+        Status = MmCopyIoBufferData(Irp->U.ReadWrite.IoBuffer,
+                                    &DirectoryEntry,
+                                    BytesWritten,
+                                    sizeof(DIRECTORY_ENTRY),
+                                    TRUE);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        Status = MmCopyIoBufferData(Irp->U.ReadWrite.IoBuffer,
+                                    (PVOID)(Entry->Name),
+                                    BytesWritten + sizeof(DIRECTORY_ENTRY),
+                                    Entry->NameSize,
+                                    TRUE);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        BytesWritten += EntrySize;
+        SpaceLeft -= EntrySize;
+        NextOffset = DirectoryEntry.NextOffset;
+        TreeNode = RtlRedBlackTreeGetNextNode(&(Directory->CookieTree),
+                                              FALSE,
+                                              TreeNode);
+    }
+
+    KeReleaseSharedExclusiveLockShared(Volume->Lock);
+    if ((TreeNode == NULL) && (BytesWritten == 0)) {
+        Status = STATUS_END_OF_FILE;
+    }
+
+    Irp->U.ReadWrite.IoBytesCompleted = BytesWritten;
+    Irp->U.ReadWrite.NewIoOffset = NextOffset;
+    return Status;
+}
+
+KSTATUS
+TmpfspPerformIo (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads or writes file data. Cached writes that grow a file
+    have already been charged through a truncate before reaching the page
+    cache, so ordinary writes here only charge any extent that is somehow
+    still missing; the page cache keeps the data. Hard flushes, sent when the
+    page cache wants to release pages, save the data to the page file. Reads
+    return whatever was saved, and zeroes elsewhere.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Node - Supplies a pointer to the file.
+
+    Irp - Supplies a pointer to the I/O IRP.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AlignedSize;
+    UINTN BytesCompleted;
+    UINTN BytesCompletedThisRound;
+    UINTN BytesRemaining;
+    UINTN BytesThisRound;
+    PLIST_ENTRY CurrentEntry;
+    IO_OFFSET CurrentOffset;
+    PIO_BUFFER IoBuffer;
+    IO_OFFSET IoEnd;
+    UINTN OriginalIoBufferOffset;
+    ULONG PageCount;
+    ULONG PageIndex;
+    ULONG PageMask;
+    ULONG PageShift;
+    ULONG PageSize;
+    PTMPFS_REGION Region;
+    IO_OFFSET RegionEnd;
+    ULONG RegionOffset;
+    KSTATUS Status;
+    BOOL Write;
+
+    IoBuffer = Irp->U.ReadWrite.IoBuffer;
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    BytesCompleted = 0;
+    Write = FALSE;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        Write = TRUE;
+    }
+
+    OriginalIoBufferOffset = MmGetIoBufferCurrentOffset(IoBuffer);
+    AlignedSize = ALIGN_RANGE_UP(Irp->U.ReadWrite.IoSizeInBytes, PageSize);
+    if (Write != FALSE) {
+
+        //
+        // The backing write is a no-allocate IRP path. Make sure the I/O
+        // buffer is mapped before taking the lock.
+        //
+
+        if ((Irp->U.ReadWrite.IoFlags & IO_FLAG_HARD_FLUSH) != 0) {
+            MmMapIoBuffer(IoBuffer, FALSE, FALSE, FALSE);
+        }
+
+        KeAcquireQueuedLock(Node->Lock);
+        IoEnd = Irp->U.ReadWrite.IoOffset + Irp->U.ReadWrite.IoSizeInBytes;
+        IoEnd = ALIGN_RANGE_UP(IoEnd, PageSize);
+        if (IoEnd > Node->ChargedSize) {
+            Status = TmpfspChargeNode(Volume, Node, IoEnd);
+            if (!KSUCCESS(Status)) {
+                goto PerformIoEnd;
+            }
+        }
+
+        //
+        // If this is not a hard flush, act like the write succeeded. The page
+        // cache still has the data.
+        //
+
+        if ((Irp->U.ReadWrite.IoFlags & IO_FLAG_HARD_FLUSH) == 0) {
+            BytesCompleted = Irp->U.ReadWrite.IoSizeInBytes;
+            goto PerformIoEnd;
+        }
+
+    } else {
+
+        //
+        // The backing read is a no-allocate IRP path, not allowed to extend
+        // the I/O buffer. Zero it, and fill in only the saved pages.
+        //
+
+        MmZeroIoBuffer(IoBuffer, 0, AlignedSize);
+        KeAcquireQueuedLock(Node->Lock);
+    }
+
+    //
+    // Everything past this point comes from the page cache, which works in
+    // whole pages.
+    //
+
+    ASSERT(IS_ALIGNED(Irp->U.ReadWrite.IoOffset, PageSize) != FALSE);
+
+    BytesRemaining = AlignedSize;
+    CurrentOffset = Irp->U.ReadWrite.IoOffset;
+    CurrentEntry = Node->RegionList.Next;
+    IoEnd = CurrentOffset + BytesRemaining;
+    Status = STATUS_SUCCESS;
+    while (BytesRemaining != 0) {
+
+        //
+        // If the current entry is the head of the list, there are no more
+        // regions. One will have to be allocated below.
+        //
+
+        if (CurrentEntry == &(Node->RegionList)) {
+            Region = NULL;
+            BytesThisRound = BytesRemaining;
+
+        } else {
+            Region = LIST_VALUE(CurrentEntry, TMPFS_REGION, ListEntry);
+            RegionEnd = Region->Offset + Region->Size;
+            if (CurrentOffset >= RegionEnd) {
+                CurrentEntry = CurrentEntry->Next;
+                continue;
+            }
+
+            if (RegionEnd < IoEnd) {
+                BytesThisRound = RegionEnd - CurrentOffset;
+
+            } else {
+                BytesThisRound = IoEnd - CurrentOffset;
+            }
+        }
+
+        //
+        // Reads skip gaps between regions, as the buffer is already zeroed.
+        // Writes fill the gap with a new region.
+        //
+
+        if ((Region == NULL) || (CurrentOffset < Region->Offset)) {
+            if (Write == FALSE) {
+                if ((Region != NULL) &&
+                    ((CurrentOffset + BytesThisRound) > Region->Offset)) {
+
+                    BytesThisRound = Region->Offset - CurrentOffset;
+                }
+
+                MmIoBufferIncrementOffset(IoBuffer, BytesThisRound);
+                BytesRemaining -= BytesThisRound;
+                BytesCompleted += BytesThisRound;
+                CurrentOffset += BytesThisRound;
+
+            } else {
+                Region = TmpfspCreateRegion(Node, CurrentOffset, Region);
+                if (Region == NULL) {
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                    goto PerformIoEnd;
+                }
+
+                CurrentEntry = &(Region->ListEntry);
+            }
+
+            continue;
+        }
+
+        RegionOffset = (ULONG)(CurrentOffset - Region->Offset);
+
+        //
+        // On read, only the pages that were previously written are valid.
+        // Skip the clean ones, then read the run of saved pages after them.
+        //
+
+        if (Write == FALSE) {
+            PageIndex = RegionOffset >> PageShift;
+            PageCount = BytesThisRound >> PageShift;
+            PageMask = (1 << PageCount) - 1;
+            PageMask &= (Region->DirtyBitmap >> PageIndex);
+            if (PageMask != 0) {
+                PageCount = RtlCountTrailingZeros32(PageMask);
+            }
+
+            BytesThisRound = PageCount << PageShift;
+            MmIoBufferIncrementOffset(IoBuffer, BytesThisRound);
+            BytesRemaining -= BytesThisRound;
+            BytesCompleted += BytesThisRound;
+            CurrentOffset += BytesThisRound;
+            RegionOffset += BytesThisRound;
+            BytesThisRound = 0;
+            if (PageMask != 0) {
+                PageMask >>= PageCount;
+                PageCount = RtlCountTrailingZeros32(~PageMask);
+                BytesThisRound = PageCount << PageShift;
+            }
+
+            if (BytesThisRound == 0) {
+                CurrentEntry = CurrentEntry->Next;
+                continue;
+            }
+        }
+
+        Status = MmPageFilePerformIo(&(Region->ImageBacking),
+                                     IoBuffer,
+                                     RegionOffset,
+                                     BytesThisRound,
+                                     Irp->U.ReadWrite.IoFlags,
+                                     Irp->U.ReadWrite.TimeoutInMilliseconds,
+                                     Write,
+                                     &BytesCompletedThisRound);
+
+        if (!KSUCCESS(Status)) {
+            goto PerformIoEnd;
+        }
+
+        ASSERT(BytesThisRound == BytesCompletedThisRound);
+
+        if (Write != FALSE) {
+            PageIndex = RegionOffset >> PageShift;
+            PageMask = (1 << (BytesCompletedThisRound >> PageShift)) - 1;
+            Region->DirtyBitmap |= (PageMask << PageIndex);
+        }
+
+        MmIoBufferIncrementOffset(IoBuffer, BytesCompletedThisRound);
+        BytesRemaining -= BytesCompletedThisRound;
+        BytesCompleted += BytesCompletedThisRound;
+        CurrentOffset += BytesCompletedThisRound;
+        if (CurrentOffset >= (Region->Offset + Region->Size)) {
+            CurrentEntry = CurrentEntry->Next;
+        }
+    }
+
+PerformIoEnd:
+    KeReleaseQueuedLock(Node->Lock);
+
+    //
+    // The I/O size may have been aligned up to a page. Make sure the bytes
+    // completed is not larger than the request.
+    //
+
+    if (BytesCompleted > Irp->U.ReadWrite.IoSizeInBytes) {
+        BytesCompleted = Irp->U.ReadWrite.IoSizeInBytes;
+    }
+
+    MmSetIoBufferCurrentOffset(IoBuffer, OriginalIoBufferOffset);
+    Irp->U.ReadWrite.IoBytesCompleted = BytesCompleted;
+    Irp->U.ReadWrite.NewIoOffset = Irp->U.ReadWrite.IoOffset + BytesCompleted;
+    return Status;
+}
+
+KSTATUS
+TmpfspChargeNode (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node,
+    ULONGLONG NewSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the number of bytes charged to a file, growing or
+    shrinking the file system's usage to match. This routine assumes the
+    node's lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Node - Supplies a pointer to the file.
+
+    NewSize - Supplies the new page aligned charge.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_VOLUME_FULL if growing the charge would exceed the limit.
+
+--*/
+
+{
+
+    ULONGLONG Delta;
+    ULONGLONG OldUsedSize;
+
+    if (NewSize > Node->ChargedSize) {
+        Delta = NewSize - Node->ChargedSize;
+        OldUsedSize = RtlAtomicAdd64(&(Volume->UsedSize), Delta);
+        if ((OldUsedSize + Delta) > Volume->MaxSize) {
+            RtlAtomicAdd64(&(Volume->UsedSize), -Delta);
+            return STATUS_VOLUME_FULL;
+        }
+
+    } else {
+        Delta = Node->ChargedSize - NewSize;
+        RtlAtomicAdd64(&(Volume->UsedSize), -Delta);
+    }
+
+    Node->ChargedSize = NewSize;
+    return STATUS_SUCCESS;
+}
+
+PTMPFS_NODE
+TmpfspCreateNode (
+    PTMPFS_VOLUME Volume,
+    PFILE_PROPERTIES Properties
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new file and adds it to the volume's node tree.
+    This routine assumes the volume lock is held exclusively, or that the
+    volume is not yet published.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Properties - Supplies a pointer to the initial file properties. The file
+        ID is assigned here.
+
+Return Value:
+
+    Returns a pointer to the new node on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    PTMPFS_NODE Node;
+
+    Node = MmAllocatePagedPool(sizeof(TMPFS_NODE), TMPFS_ALLOCATION_TAG);
+    if (Node == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(Node, sizeof(TMPFS_NODE));
+    Node->Lock = KeCreateQueuedLock();
+    if (Node->Lock == NULL) {
+        MmFreePagedPool(Node);
+        return NULL;
+    }
+
+    RtlCopyMemory(&(Node->Properties), Properties, sizeof(FILE_PROPERTIES));
+    Node->Properties.FileId = Volume->NextFileId;
+    Node->Properties.HardLinkCount = 1;
+    Node->Properties.BlockSize = MmPageSize();
+    Volume->NextFileId += 1;
+    INITIALIZE_LIST_HEAD(&(Node->RegionList));
+    RtlRedBlackTreeInitialize(&(Node->NameTree), 0, TmpfspCompareEntryNames);
+    RtlRedBlackTreeInitialize(&(Node->CookieTree),
+                              0,
+                              TmpfspCompareEntryCookies);
+
+    Node->NextCookie = DIRECTORY_CONTENTS_OFFSET;
+    RtlRedBlackTreeInsert(&(Volume->NodeTree), &(Node->TreeNode));
+    RtlAtomicAdd64(&(Volume->FileCount), 1);
+    return Node;
+}
+
+VOID
+TmpfspDestroyNode (
+    PTMPFS_VOLUME Volume,
+    PTMPFS_NODE Node
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a file's page file space and charge, removes it from
+    the volume, and frees it. This routine assumes the volume lock is held
+    exclusively and the directory is empty.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    Node - Supplies a pointer to the node to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTMPFS_REGION Region;
+
+    ASSERT(Node->EntryCount == 0);
+
+    while (LIST_EMPTY(&(Node->RegionList)) == FALSE) {
+        Region = LIST_VALUE(Node->RegionList.Next, TMPFS_REGION, ListEntry);
+        LIST_REMOVE(&(Region->ListEntry));
+        Region->ListEntry.Next = NULL;
+        TmpfspDestroyRegion(Region);
+    }
+
+    TmpfspChargeNode(Volume, Node, 0);
+    RtlRedBlackTreeRemove(&(Volume->NodeTree), &(Node->TreeNode));
+    RtlAtomicAdd64(&(Volume->FileCount), -1);
+    KeDestroyQueuedLock(Node->Lock);
+    MmFreePagedPool(Node);
+    return;
+}
+
+PTMPFS_NODE
+TmpfspGetNode (
+    PTMPFS_VOLUME Volume,
+    FILE_ID FileId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds a node by file ID. This routine assumes the volume
+    lock is held.
+
+Arguments:
+
+    Volume - Supplies a pointer to the volume.
+
+    FileId - Supplies the file ID to find.
+
+Return Value:
+
+    Returns a pointer to the node, or NULL if there is no such file.
+
+--*/
+
+{
+
+    TMPFS_NODE SearchNode;
+    PRED_BLACK_TREE_NODE TreeNode;
+
+    SearchNode.Properties.FileId = FileId;
+    TreeNode = RtlRedBlackTreeSearch(&(Volume->NodeTree),
+                                     &(SearchNode.TreeNode));
+
+    if (TreeNode == NULL) {
+        return NULL;
+    }
+
+    return RED_BLACK_TREE_VALUE(TreeNode, TMPFS_NODE, TreeNode);
+}
+
+PTMPFS_ENTRY
+TmpfspCreateEntry (
+    PCSTR Name,
+    ULONG NameSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a directory entry with a copy of the given name.
+
+Arguments:
+
+    Name - Supplies a pointer to the name, which need not be null terminated.
+
+    NameSize - Supplies the size of the name including room for the null
+        terminator.
+
+Return Value:
+
+    Returns a pointer to the new entry on success.
+
+    NULL on allocation failure.
+
+--*/
+
+{
+
+    PTMPFS_ENTRY Entry;
+    PSTR EntryName;
+
+    Entry = MmAllocatePagedPool(sizeof(TMPFS_ENTRY) + NameSize,
+                                TMPFS_ALLOCATION_TAG);
+
+    if (Entry == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(Entry, sizeof(TMPFS_ENTRY));
+    EntryName = (PSTR)(Entry + 1);
+    RtlCopyMemory(EntryName, Name, NameSize - 1);
+    EntryName[NameSize - 1] = '\0';
+    Entry->Name = EntryName;
+    Entry->NameSize = NameSize;
+    return Entry;
+}
+
+VOID
+TmpfspInsertEntry (
+    PTMPFS_NODE Directory,
+    PTMPFS_ENTRY Entry,
+    PTMPFS_NODE Node
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds an entry to a directory. This routine assumes the volume
+    lock is held exclusively.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory.
+
+    Entry - Supplies a pointer to the entry to add.
+
+    Node - Supplies a pointer to the file the entry names.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Entry->Node = Node;
+    Entry->Cookie = Directory->NextCookie;
+    Directory->NextCookie += 1;
+    RtlRedBlackTreeInsert(&(Directory->NameTree), &(Entry->NameNode));
+    RtlRedBlackTreeInsert(&(Directory->CookieTree), &(Entry->CookieNode));
+    Directory->EntryCount += 1;
+    Node->Entry = Entry;
+    return;
+}
+
+VOID
+TmpfspRemoveEntry (
+    PTMPFS_NODE Directory,
+    PTMPFS_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes an entry from a directory. The caller frees it. This
+    routine assumes the volume lock is held exclusively.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory.
+
+    Entry - Supplies a pointer to the entry to remove.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Directory->EntryCount != 0);
+
+    RtlRedBlackTreeRemove(&(Directory->NameTree), &(Entry->NameNode));
+    RtlRedBlackTreeRemove(&(Directory->CookieTree), &(Entry->CookieNode));
+    Directory->EntryCount -= 1;
+    if (Entry->Node->Entry == Entry) {
+        Entry->Node->Entry = NULL;
+    }
+
+    return;
+}
+
+PTMPFS_ENTRY
+TmpfspFindEntry (
+    PTMPFS_NODE Directory,
+    PCSTR Name,
+    ULONG NameSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds a directory entry by name. This routine assumes the
+    volume lock is held.
+
+Arguments:
+
+    Directory - Supplies a pointer to the directory to search.
+
+    Name - Supplies a pointer to the name, which need not be null terminated.
+
+    NameSize - Supplies the size of the name buffer including room for a null
+        terminator.
+
+Return Value:
+
+    Returns a pointer to the entry, or NULL if there is none by that name.
+
+--*/
+
+{
+
+    TMPFS_ENTRY SearchEntry;
+    PRED_BLACK_TREE_NODE TreeNode;
+
+    SearchEntry.Name = Name;
+    SearchEntry.NameSize = TmpfspGetNameLength(Name, NameSize) + 1;
+    TreeNode = RtlRedBlackTreeSearch(&(Directory->NameTree),
+                                     &(SearchEntry.NameNode));
+
+    if (TreeNode == NULL) {
+        return NULL;
+    }
+
+    return RED_BLACK_TREE_VALUE(TreeNode, TMPFS_ENTRY, NameNode);
+}
+
+ULONG
+TmpfspGetNameLength (
+    PCSTR Name,
+    ULONG NameSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the length of a name that may or may not be null
+    terminated.
+
+Arguments:
+
+    Name - Supplies a pointer to the name.
+
+    NameSize - Supplies the size of the name buffer including room for a null
+        terminator.
+
+Return Value:
+
+    Returns the length of the name, not including any terminator.
+
+--*/
+
+{
+
+    ULONG Length;
+
+    if (NameSize == 0) {
+        return 0;
+    }
+
+    Length = 0;
+    while ((Length < NameSize - 1) && (Name[Length] != '\0')) {
+        Length += 1;
+    }
+
+    return Length;
+}
+
+PTMPFS_REGION
+TmpfspCreateRegion (
+    PTMPFS_NODE Node,
+    IO_OFFSET Offset,
+    PTMPFS_REGION NextRegion
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates page file space for a file at the given offset and
+    inserts the region in the file's region list. This routine assumes the
+    node's lock is held.
+
+Arguments:
+
+    Node - Supplies a pointer to the file.
+
+    Offset - Supplies the page aligned file offset that needs a region.
+
+    NextRegion - Supplies a pointer to the region before which the new region
+        goes, or NULL to put it at the end.
+
+Return Value:
+
+    Returns a pointer to the new region on success.
+
+    NULL on failure.
+
+--*/
+
+{
+
+    PTMPFS_REGION NewRegion;
+    ULONG PageSize;
+    IO_OFFSET PreviousEnd;
+    PTMPFS_REGION PreviousRegion;
+    IO_OFFSET RegionEnd;
+    IO_OFFSET RegionOffset;
+    UINTN RegionSize;
+    ULONG RetryCount;
+    KSTATUS Status;
+
+    NewRegion = MmAllocatePagedPool(sizeof(TMPFS_REGION),
+                                    TMPFS_ALLOCATION_TAG);
+
+    if (NewRegion == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(NewRegion, sizeof(TMPFS_REGION));
+    NewRegion->ImageBacking.DeviceHandle = INVALID_HANDLE;
+    PreviousRegion = NULL;
+    if (NextRegion == NULL) {
+        if (LIST_EMPTY(&(Node->RegionList)) == FALSE) {
+            PreviousRegion = LIST_VALUE(Node->RegionList.Previous,
+                                        TMPFS_REGION,
+                                        ListEntry);
+        }
+
+    } else if (NextRegion->ListEntry.Previous != &(Node->RegionList)) {
+        PreviousRegion = LIST_VALUE(NextRegion->ListEntry.Previous,
+                                    TMPFS_REGION,
+                                    ListEntry);
+    }
+
+    //
+    // Try for a maximum size region, backing off to smaller ones if the page
+    // file is tight. If paging is not enabled at all this fails, and the page
+    // cache simply keeps the pages.
+    //
+
+    RetryCount = 0;
+    RegionSize = TMPFS_MAX_REGION_SIZE;
+    PageSize = MmPageSize();
+    Status = STATUS_INSUFFICIENT_RESOURCES;
+    while (RegionSize >= PageSize) {
+        RegionOffset = ALIGN_RANGE_DOWN(Offset, RegionSize);
+        if (PreviousRegion != NULL) {
+            PreviousEnd = PreviousRegion->Offset + PreviousRegion->Size;
+            if (PreviousEnd > RegionOffset) {
+                RegionSize -= (PreviousEnd - RegionOffset);
+                RegionOffset = PreviousEnd;
+            }
+        }
+
+        if (NextRegion != NULL) {
+            RegionEnd = RegionOffset + RegionSize;
+            if (NextRegion->Offset < RegionEnd) {
+                RegionSize -= (RegionEnd - NextRegion->Offset);
+            }
+        }
+
+        ASSERT(RegionSize >= PageSize);
+
+        Status = MmAllocatePageFileSpace(&(NewRegion->ImageBacking),
+                                         RegionSize);
+
+        if ((KSUCCESS(Status)) || (Status != STATUS_INSUFFICIENT_RESOURCES)) {
+            break;
+        }
+
+        RetryCount += 1;
+        RegionSize = TMPFS_MAX_REGION_SIZE >> RetryCount;
+    }
+
+    if (!KSUCCESS(Status)) {
+        MmFreePagedPool(NewRegion);
+        return NULL;
+    }
+
+    NewRegion->Offset = RegionOffset;
+    NewRegion->Size = RegionSize;
+    if (NextRegion != NULL) {
+        INSERT_BEFORE(&(NewRegion->ListEntry), &(NextRegion->ListEntry));
+
+    } else {
+        INSERT_BEFORE(&(NewRegion->ListEntry), &(Node->RegionList));
+    }
+
+    return NewRegion;
+}
+
+VOID
+TmpfspDestroyRegion (
+    PTMPFS_REGION Region
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a region and its page file space.
+
+Arguments:
+
+    Region - Supplies a pointer to the region, which must already be off its
+        list.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Region->ListEntry.Next == NULL);
+
+    MmFreePageFileSpace(&(Region->ImageBacking), Region->Size);
+    MmFreePagedPool(Region);
+    return;
+}
+
+COMPARISON_RESULT
+TmpfspCompareNodes (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares nodes by file ID.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PTMPFS_NODE First;
+    PTMPFS_NODE Second;
+
+    First = RED_BLACK_TREE_VALUE(FirstNode, TMPFS_NODE, TreeNode);
+    Second = RED_BLACK_TREE_VALUE(SecondNode, TMPFS_NODE, TreeNode);
+    if (First->Properties.FileId > Second->Properties.FileId) {
+        return ComparisonResultDescending;
+    }
+
+    if (First->Properties.FileId < Second->Properties.FileId) {
+        return ComparisonResultAscending;
+    }
+
+    return ComparisonResultSame;
+}
+
+COMPARISON_RESULT
+TmpfspCompareEntryNames (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares directory entries by name. The search entry's name
+    may not be null terminated, so only the name sizes are trusted.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PTMPFS_ENTRY First;
+    ULONG Index;
+    ULONG Length;
+    PTMPFS_ENTRY Second;
+
+    First = RED_BLACK_TREE_VALUE(FirstNode, TMPFS_ENTRY, NameNode);
+    Second = RED_BLACK_TREE_VALUE(SecondNode, TMPFS_ENTRY, NameNode);
+    Length = First->NameSize;
+    if (Second->NameSize < Length) {
+        Length = Second->NameSize;
+    }
+
+    Length -= 1;
+    for (Index = 0; Index < Length; Index += 1) {
+        if ((UCHAR)(First->Name[Index]) > (UCHAR)(Second->Name[Index])) {
+            return ComparisonResultDescending;
+        }
+
+        if ((UCHAR)(First->Name[Index]) < (UCHAR)(Second->Name[Index])) {
+            return ComparisonResultAscending;
+        }
+    }
+
+    if (First->NameSize > Second->NameSize) {
+        return ComparisonResultDescending;
+    }
+
+    if (First->NameSize < Second->NameSize) {
+        return ComparisonResultAscending;
+    }
+
+    return ComparisonResultSame;
+}
+
+COMPARISON_RESULT
+TmpfspCompareEntryCookies (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares directory entries by cookie.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PTMPFS_ENTRY First;
+    PTMPFS_ENTRY Second;
+
+    First = RED_BLACK_TREE_VALUE(FirstNode, TMPFS_ENTRY, CookieNode);
+    Second = RED_BLACK_TREE_VALUE(SecondNode, TMPFS_ENTRY, CookieNode);
+    if (First->Cookie > Second->Cookie) {
+        return ComparisonResultDescending;
+    }
+
+    if (First->Cookie < Second->Cookie) {
+        return ComparisonResultAscending;
+    }
+
+    return ComparisonResultSame;
+}
+
@@ -0,0 +1,1130 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    vioblk.c
+
+Abstract:
+
+    This module implements the virtio block driver, which presents a
+    paravirtualized disk from the hypervisor as a regular disk device.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include "vioblk.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+VioblkAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    );
+
+VOID
+VioblkDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+VioblkDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+VioblkDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+VioblkDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+VioblkDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    );
+
+VOID
+VioblkpDispatchControllerStateChange (
+    PIRP Irp,
+    PVIOBLK_CONTROLLER Controller
+    );
+
+VOID
+VioblkpDispatchDiskStateChange (
+    PIRP Irp,
+    PVIOBLK_DISK Disk
+    );
+
+VOID
+VioblkpDispatchDiskSystemControl (
+    PIRP Irp,
+    PVIOBLK_DISK Disk
+    );
+
+KSTATUS
+VioblkpStartController (
+    PIRP Irp,
+    PVIOBLK_CONTROLLER Controller
+    );
+
+VOID
+VioblkpEnumerateDisk (
+    PIRP Irp,
+    PVIOBLK_CONTROLLER Controller
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+PDRIVER VioblkDriver = NULL;
+UUID VioblkDiskInterfaceUuid = UUID_DISK_INTERFACE;
+
+DISK_INTERFACE VioblkDiskInterfaceTemplate = {
+    DISK_INTERFACE_VERSION,
+    NULL,
+    0,
+    0,
+    VioblkpBlockIoInitialize,
+    VioblkpBlockIoReset,
+    VioblkpBlockIoRead,
+    VioblkpBlockIoWrite
+};
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+DriverEntry (
+    PDRIVER Driver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is the entry point for the virtio block driver. It registers
+    its other dispatch functions, and performs driver-wide initialization.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver object.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code on error.
+
+--*/
+
+{
+
+    DRIVER_FUNCTION_TABLE FunctionTable;
+    KSTATUS Status;
+
+    VioblkDriver = Driver;
+    RtlZeroMemory(&FunctionTable, sizeof(DRIVER_FUNCTION_TABLE));
+    FunctionTable.Version = DRIVER_FUNCTION_TABLE_VERSION;
+    FunctionTable.AddDevice = VioblkAddDevice;
+    FunctionTable.DispatchStateChange = VioblkDispatchStateChange;
+    FunctionTable.DispatchOpen = VioblkDispatchOpen;
+    FunctionTable.DispatchClose = VioblkDispatchClose;
+    FunctionTable.DispatchIo = VioblkDispatchIo;
+    FunctionTable.DispatchSystemControl = VioblkDispatchSystemControl;
+    Status = IoRegisterDriverFunctions(Driver, &FunctionTable);
+    return Status;
+}
+
+KSTATUS
+VioblkAddDevice (
+    PVOID Driver,
+    PCSTR DeviceId,
+    PCSTR ClassId,
+    PCSTR CompatibleIds,
+    PVOID DeviceToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a device is detected for which the virtio
+    block driver acts as the function driver. The driver will attach itself to
+    the stack.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver being called.
+
+    DeviceId - Supplies a pointer to a string with the device ID.
+
+    ClassId - Supplies a pointer to a string containing the device's class ID.
+
+    CompatibleIds - Supplies a pointer to a string containing device IDs
+        that would be compatible with this device.
+
+    DeviceToken - Supplies an opaque token that the driver can use to identify
+        the device in the system. This token should be used when attaching to
+        the stack.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    Failure code if the driver was unsuccessful in attaching itself.
+
+--*/
+
+{
+
+    PVIOBLK_CONTROLLER Controller;
+    KSTATUS Status;
+
+    Controller = MmAllocateNonPagedPool(sizeof(VIOBLK_CONTROLLER),
+                                        VIOBLK_ALLOCATION_TAG);
+
+    if (Controller == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto AddDeviceEnd;
+    }
+
+    RtlZeroMemory(Controller, sizeof(VIOBLK_CONTROLLER));
+    Controller->Type = VioblkContextController;
+    Controller->OsDevice = DeviceToken;
+    KeInitializeSpinLock(&(Controller->DpcLock));
+    INITIALIZE_LIST_HEAD(&(Controller->IrpQueue));
+    INITIALIZE_LIST_HEAD(&(Controller->FreeRequests));
+    Controller->Disk.Type = VioblkContextDisk;
+    Controller->Disk.Controller = Controller;
+    Status = VirtioCreateDevice(DeviceToken, &(Controller->Virtio));
+    if (!KSUCCESS(Status)) {
+        goto AddDeviceEnd;
+    }
+
+    Status = IoAttachDriverToDevice(Driver, DeviceToken, Controller);
+    if (!KSUCCESS(Status)) {
+        goto AddDeviceEnd;
+    }
+
+AddDeviceEnd:
+    if (!KSUCCESS(Status)) {
+        if (Controller != NULL) {
+            if (Controller->Virtio != NULL) {
+                VirtioDestroyDevice(Controller->Virtio);
+            }
+
+            MmFreeNonPagedPool(Controller);
+        }
+    }
+
+    return Status;
+}
+
+VOID
+VioblkDispatchStateChange (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles State Change IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVIOBLK_CONTROLLER Controller;
+
+    Controller = DeviceContext;
+    switch (Controller->Type) {
+    case VioblkContextController:
+        VioblkpDispatchControllerStateChange(Irp, Controller);
+        break;
+
+    case VioblkContextDisk:
+        VioblkpDispatchDiskStateChange(Irp, (PVIOBLK_DISK)Controller);
+        break;
+
+    default:
+
+        ASSERT(FALSE);
+
+        IoCompleteIrp(VioblkDriver, Irp, STATUS_INVALID_CONFIGURATION);
+        break;
+    }
+
+    return;
+}
+
+VOID
+VioblkDispatchOpen (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Open IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVIOBLK_DISK Disk;
+
+    //
+    // Only the disk can be opened or closed.
+    //
+
+    Disk = (PVIOBLK_DISK)DeviceContext;
+    if (Disk->Type != VioblkContextDisk) {
+        return;
+    }
+
+    Irp->U.Open.DeviceContext = Disk;
+    IoCompleteIrp(VioblkDriver, Irp, STATUS_SUCCESS);
+    return;
+}
+
+VOID
+VioblkDispatchClose (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles Close IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVIOBLK_DISK Disk;
+
+    Disk = (PVIOBLK_DISK)DeviceContext;
+    if (Disk->Type != VioblkContextDisk) {
+        return;
+    }
+
+    IoCompleteIrp(VioblkDriver, Irp, STATUS_SUCCESS);
+    return;
+}
+
+VOID
+VioblkDispatchIo (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles I/O IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL CompleteIrp;
+    PVIOBLK_DISK Disk;
+    ULONG IrpReadWriteFlags;
+    BOOL PmReferenceAdded;
+    KSTATUS Status;
+    BOOL Write;
+
+    Disk = (PVIOBLK_DISK)Irp->U.ReadWrite.DeviceContext;
+    if (Disk->Type != VioblkContextDisk) {
+        return;
+    }
+
+    CompleteIrp = TRUE;
+    Write = FALSE;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        Write = TRUE;
+    }
+
+    IrpReadWriteFlags = IRP_READ_WRITE_FLAG_DMA;
+    if (Write != FALSE) {
+        IrpReadWriteFlags |= IRP_READ_WRITE_FLAG_WRITE;
+    }
+
+    //
+    // If the IRP is on the way up, then clean up after the DMA. An IRP going
+    // up is already complete.
+    //
+
+    PmReferenceAdded = FALSE;
+    if (Irp->Direction == IrpUp) {
+        CompleteIrp = FALSE;
+        PmDeviceReleaseReference(Disk->OsDevice);
+        Status = IoCompleteReadWriteIrp(&(Irp->U.ReadWrite), IrpReadWriteFlags);
+        if (!KSUCCESS(Status)) {
+            IoUpdateIrpStatus(Irp, Status);
+        }
+
+        goto DispatchIoEnd;
+    }
+
+    if ((Write != FALSE) && (Disk->ReadOnly != FALSE)) {
+        Status = STATUS_ACCESS_DENIED;
+        goto DispatchIoEnd;
+    }
+
+    Status = PmDeviceAddReference(Disk->OsDevice);
+    if (!KSUCCESS(Status)) {
+        goto DispatchIoEnd;
+    }
+
+    PmReferenceAdded = TRUE;
+    Irp->U.ReadWrite.NewIoOffset = Irp->U.ReadWrite.IoOffset;
+    if (Irp->U.ReadWrite.IoSizeInBytes == 0) {
+        Status = STATUS_SUCCESS;
+        goto DispatchIoEnd;
+    }
+
+    //
+    // The device takes any physical address, but needs whole blocks.
+    //
+
+    Status = IoPrepareReadWriteIrp(&(Irp->U.ReadWrite),
+                                   Disk->BlockSize,
+                                   0,
+                                   MAX_ULONGLONG,
+                                   IrpReadWriteFlags);
+
+    if (!KSUCCESS(Status)) {
+        goto DispatchIoEnd;
+    }
+
+    CompleteIrp = FALSE;
+    Status = VioblkpEnqueueIrp(Disk, Irp);
+    if (!KSUCCESS(Status)) {
+        IoCompleteReadWriteIrp(&(Irp->U.ReadWrite), IrpReadWriteFlags);
+        CompleteIrp = TRUE;
+    }
+
+DispatchIoEnd:
+    if (CompleteIrp != FALSE) {
+        if (PmReferenceAdded != FALSE) {
+            PmDeviceReleaseReference(Disk->OsDevice);
+        }
+
+        IoCompleteIrp(VioblkDriver, Irp, Status);
+    }
+
+    return;
+}
+
+VOID
+VioblkDispatchSystemControl (
+    PIRP Irp,
+    PVOID DeviceContext,
+    PVOID IrpContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    DeviceContext - Supplies the context pointer supplied by the driver when it
+        attached itself to the driver stack. Presumably this pointer contains
+        driver-specific device context.
+
+    IrpContext - Supplies the context pointer supplied by the driver when
+        the IRP was created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVIOBLK_DISK Disk;
+
+    ASSERT(Irp->MajorCode == IrpMajorSystemControl);
+
+    Disk = (PVIOBLK_DISK)DeviceContext;
+    if (Disk->Type == VioblkContextDisk) {
+        VioblkpDispatchDiskSystemControl(Irp, Disk);
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+VioblkpDispatchControllerStateChange (
+    PIRP Irp,
+    PVIOBLK_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles state change IRPs for a virtio block device.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the controller context.
+
+Return Value:
+
+    None. The routine completes the IRP if appropriate.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    if (Irp->Direction == IrpUp) {
+        if (!KSUCCESS(IoGetIrpStatus(Irp))) {
+            return;
+        }
+
+        switch (Irp->MinorCode) {
+        case IrpMinorQueryResources:
+            Status = VirtioProcessResourceRequirements(Controller->Virtio, Irp);
+            if (!KSUCCESS(Status)) {
+                IoCompleteIrp(VioblkDriver, Irp, Status);
+            }
+
+            break;
+
+        case IrpMinorStartDevice:
+            Status = VioblkpStartController(Irp, Controller);
+            if (!KSUCCESS(Status)) {
+                IoCompleteIrp(VioblkDriver, Irp, Status);
+            }
+
+            break;
+
+        case IrpMinorQueryChildren:
+            VioblkpEnumerateDisk(Irp, Controller);
+            break;
+
+        case IrpMinorIdle:
+        case IrpMinorSuspend:
+        case IrpMinorResume:
+        default:
+            break;
+        }
+    }
+
+    return;
+}
+
+VOID
+VioblkpDispatchDiskStateChange (
+    PIRP Irp,
+    PVIOBLK_DISK Disk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles state change IRPs for a virtio block disk.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Disk - Supplies a pointer to the disk.
+
+Return Value:
+
+    None. The routine completes the IRP if appropriate.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    if (Irp->Direction == IrpDown) {
+        switch (Irp->MinorCode) {
+        case IrpMinorStartDevice:
+
+            ASSERT(Disk->OsDevice == Irp->Device);
+
+            Status = PmInitialize(Irp->Device);
+            if (!KSUCCESS(Status)) {
+                IoCompleteIrp(VioblkDriver, Irp, Status);
+                break;
+            }
+
+            //
+            // Publish the disk interface.
+            //
+
+            Status = STATUS_SUCCESS;
+            if (Disk->DiskInterface.DiskToken == NULL) {
+                RtlCopyMemory(&(Disk->DiskInterface),
+                              &VioblkDiskInterfaceTemplate,
+                              sizeof(DISK_INTERFACE));
+
+                Disk->DiskInterface.DiskToken = Disk;
+                Disk->DiskInterface.BlockSize = Disk->BlockSize;
+                Disk->DiskInterface.BlockCount = Disk->BlockCount;
+                Status = IoCreateInterface(&VioblkDiskInterfaceUuid,
+                                           Irp->Device,
+                                           &(Disk->DiskInterface),
+                                           sizeof(DISK_INTERFACE));
+
+                if (!KSUCCESS(Status)) {
+                    Disk->DiskInterface.DiskToken = NULL;
+                }
+            }
+
+            IoCompleteIrp(VioblkDriver, Irp, Status);
+            break;
+
+        case IrpMinorQueryResources:
+        case IrpMinorQueryChildren:
+        case IrpMinorIdle:
+        case IrpMinorSuspend:
+        case IrpMinorResume:
+            IoCompleteIrp(VioblkDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        case IrpMinorRemoveDevice:
+            if (Disk->DiskInterface.DiskToken != NULL) {
+                IoDestroyInterface(&VioblkDiskInterfaceUuid,
+                                   Irp->Device,
+                                   &(Disk->DiskInterface));
+
+                Disk->DiskInterface.DiskToken = NULL;
+            }
+
+            VioblkpProcessDiskRemoval(Disk);
+            IoCompleteIrp(VioblkDriver, Irp, STATUS_SUCCESS);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return;
+}
+
+VOID
+VioblkpDispatchDiskSystemControl (
+    PIRP Irp,
+    PVIOBLK_DISK Disk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles System Control IRPs for a virtio block disk.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Disk - Supplies a pointer to the disk.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID Context;
+    PSYSTEM_CONTROL_FILE_OPERATION FileOperation;
+    PSYSTEM_CONTROL_LOOKUP Lookup;
+    PFILE_PROPERTIES Properties;
+    ULONGLONG PropertiesFileSize;
+    KSTATUS Status;
+
+    Context = Irp->U.SystemControl.SystemContext;
+    if (Irp->Direction == IrpUp) {
+
+        ASSERT(Irp->MinorCode == IrpMinorSystemControlSynchronize);
+
+        PmDeviceReleaseReference(Disk->OsDevice);
+        return;
+    }
+
+    switch (Irp->MinorCode) {
+    case IrpMinorSystemControlLookup:
+        Lookup = (PSYSTEM_CONTROL_LOOKUP)Context;
+        Status = STATUS_PATH_NOT_FOUND;
+        if (Lookup->Root != FALSE) {
+
+            //
+            // Enable opening of the root as a single file.
+            //
+
+            Properties = Lookup->Properties;
+            Properties->FileId = 0;
+            Properties->Type = IoObjectBlockDevice;
+            Properties->HardLinkCount = 1;
+            Properties->BlockSize = Disk->BlockSize;
+            Properties->BlockCount = Disk->BlockCount;
+            Properties->Size = Disk->BlockCount * Disk->BlockSize;
+            Status = STATUS_SUCCESS;
+        }
+
+        IoCompleteIrp(VioblkDriver, Irp, Status);
+        break;
+
+    //
+    // Writes to the disk's properties are not allowed. Fail if the data
+    // has changed.
+    //
+
+    case IrpMinorSystemControlWriteFileProperties:
+        FileOperation = (PSYSTEM_CONTROL_FILE_OPERATION)Context;
+        Properties = FileOperation->FileProperties;
+        PropertiesFileSize = Properties->Size;
+        if ((Properties->FileId != 0) ||
+            (Properties->Type != IoObjectBlockDevice) ||
+            (Properties->HardLinkCount != 1) ||
+            (Properties->BlockSize != Disk->BlockSize) ||
+            (Properties->BlockCount != Disk->BlockCount) ||
+            (PropertiesFileSize != (Disk->BlockCount * Disk->BlockSize))) {
+
+            Status = STATUS_NOT_SUPPORTED;
+
+        } else {
+            Status = STATUS_SUCCESS;
+        }
+
+        IoCompleteIrp(VioblkDriver, Irp, Status);
+        break;
+
+    //
+    // Do not support disk device truncation.
+    //
+
+    case IrpMinorSystemControlTruncate:
+        IoCompleteIrp(VioblkDriver, Irp, STATUS_NOT_SUPPORTED);
+        break;
+
+    //
+    // Gather and return device information.
+    //
+
+    case IrpMinorSystemControlDeviceInformation:
+        break;
+
+    //
+    // Send a flush request to the device upon getting a synchronize request.
+    // Devices that don't offer flush have no volatile cache to flush.
+    //
+
+    case IrpMinorSystemControlSynchronize:
+        if ((Disk->Controller->Features & VIRTIO_BLK_FEATURE_FLUSH) == 0) {
+            IoCompleteIrp(VioblkDriver, Irp, STATUS_SUCCESS);
+            break;
+        }
+
+        Status = PmDeviceAddReference(Disk->OsDevice);
+        if (!KSUCCESS(Status)) {
+            IoCompleteIrp(VioblkDriver, Irp, Status);
+            break;
+        }
+
+        Status = VioblkpEnqueueIrp(Disk, Irp);
+        if (!KSUCCESS(Status)) {
+            PmDeviceReleaseReference(Disk->OsDevice);
+            IoCompleteIrp(VioblkDriver, Irp, Status);
+        }
+
+        break;
+
+    //
+    // Ignore everything unrecognized.
+    //
+
+    default:
+
+        ASSERT(FALSE);
+
+        break;
+    }
+
+    return;
+}
+
+KSTATUS
+VioblkpStartController (
+    PIRP Irp,
+    PVIOBLK_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine starts a virtio block device.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG BlockSize;
+    ULONGLONG Capacity;
+    PVIOBLK_DISK Disk;
+    ULONGLONG Features;
+    ULONG FreeCount;
+    PVIRTIO_QUEUE Queue;
+    KSTATUS Status;
+    ULONG Value;
+    PVIRTIO_DEVICE Virtio;
+
+    //
+    // Once the queue is up the device is left running.
+    //
+
+    if (Controller->Queue != NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    Virtio = Controller->Virtio;
+    Disk = &(Controller->Disk);
+    Status = VirtioStartDevice(Virtio,
+                               Irp->U.StartDevice.ProcessorLocalResources);
+
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    Status = VirtioNegotiateFeatures(Virtio, VIOBLK_FEATURES, &Features);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    Controller->Features = Features;
+    Status = VirtioReadDeviceConfiguration(Virtio,
+                                           VIRTIO_BLK_CONFIGURATION_CAPACITY,
+                                           &Capacity,
+                                           sizeof(ULONGLONG));
+
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    //
+    // Use the device's preferred block size if it is sensible.
+    //
+
+    BlockSize = VIOBLK_SECTOR_SIZE;
+    if ((Features & VIRTIO_BLK_FEATURE_BLOCK_SIZE) != 0) {
+        Status = VirtioReadDeviceConfiguration(
+                                           Virtio,
+                                           VIRTIO_BLK_CONFIGURATION_BLOCK_SIZE,
+                                           &Value,
+                                           sizeof(ULONG));
+
+        if (!KSUCCESS(Status)) {
+            goto StartControllerEnd;
+        }
+
+        if ((Value > VIOBLK_SECTOR_SIZE) && (Value <= MmPageSize()) &&
+            (POWER_OF_2(Value) != FALSE)) {
+
+            BlockSize = Value;
+        }
+    }
+
+    Controller->MaxSegmentSize = VIOBLK_MAX_TRANSFER_SIZE;
+    if ((Features & VIRTIO_BLK_FEATURE_SIZE_MAX) != 0) {
+        Status = VirtioReadDeviceConfiguration(
+                                             Virtio,
+                                             VIRTIO_BLK_CONFIGURATION_SIZE_MAX,
+                                             &Value,
+                                             sizeof(ULONG));
+
+        if (!KSUCCESS(Status)) {
+            goto StartControllerEnd;
+        }
+
+        Value = ALIGN_RANGE_DOWN(Value, BlockSize);
+        if ((Value != 0) && (Value < Controller->MaxSegmentSize)) {
+            Controller->MaxSegmentSize = Value;
+        }
+    }
+
+    Controller->MaxSegments = VIOBLK_MAX_SEGMENTS;
+    if ((Features & VIRTIO_BLK_FEATURE_SEG_MAX) != 0) {
+        Status = VirtioReadDeviceConfiguration(
+                                              Virtio,
+                                              VIRTIO_BLK_CONFIGURATION_SEG_MAX,
+                                              &Value,
+                                              sizeof(ULONG));
+
+        if (!KSUCCESS(Status)) {
+            goto StartControllerEnd;
+        }
+
+        if ((Value != 0) && (Value < Controller->MaxSegments)) {
+            Controller->MaxSegments = Value;
+        }
+    }
+
+    Status = VirtioCreateQueue(Virtio, 0, VIOBLK_QUEUE_SIZE, &Queue);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    //
+    // Every request needs a header and status descriptor besides the data.
+    //
+
+    FreeCount = VirtioQueueGetFreeCount(Queue);
+    if (FreeCount < 3) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto StartControllerEnd;
+    }
+
+    if (Controller->MaxSegments > FreeCount - 2) {
+        Controller->MaxSegments = FreeCount - 2;
+    }
+
+    Status = VioblkpInitializeRequests(Controller);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    Status = VirtioConnectInterrupt(Virtio,
+                                    VioblkpInterruptServiceDpc,
+                                    NULL,
+                                    Controller);
+
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    Status = VirtioSetDriverReady(Virtio);
+    if (!KSUCCESS(Status)) {
+        goto StartControllerEnd;
+    }
+
+    Disk->BlockSize = BlockSize;
+    Disk->BlockCount = (Capacity * VIOBLK_SECTOR_SIZE) / BlockSize;
+    Disk->ReadOnly = FALSE;
+    if ((Features & VIRTIO_BLK_FEATURE_READ_ONLY) != 0) {
+        Disk->ReadOnly = TRUE;
+    }
+
+    Controller->Queue = Queue;
+
+StartControllerEnd:
+    if (!KSUCCESS(Status)) {
+        RtlDebugPrint("VirtioBlk: Failed to start: %d\n", Status);
+    }
+
+    return Status;
+}
+
+VOID
+VioblkpEnumerateDisk (
+    PIRP Irp,
+    PVIOBLK_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reports the disk as the only child of the device.
+
+Arguments:
+
+    Irp - Supplies a pointer to the I/O request packet.
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    None. The IRP is completed with the appropriate status.
+
+--*/
+
+{
+
+    PVIOBLK_DISK Disk;
+    KSTATUS Status;
+
+    Disk = &(Controller->Disk);
+    Status = STATUS_SUCCESS;
+    if ((Controller->Queue == NULL) || (Disk->BlockCount == 0)) {
+        goto EnumerateDiskEnd;
+    }
+
+    if (Disk->OsDevice == NULL) {
+        Status = IoCreateDevice(VioblkDriver,
+                                Disk,
+                                Irp->Device,
+                                "Disk",
+                                DISK_CLASS_ID,
+                                NULL,
+                                &(Disk->OsDevice));
+
+        if (!KSUCCESS(Status)) {
+            goto EnumerateDiskEnd;
+        }
+    }
+
+    Status = IoMergeChildArrays(Irp,
+                                &(Disk->OsDevice),
+                                1,
+                                VIOBLK_ALLOCATION_TAG);
+
+EnumerateDiskEnd:
+    IoCompleteIrp(VioblkDriver, Irp, Status);
+    return;
+}
+
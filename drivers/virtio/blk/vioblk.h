@@ -0,0 +1,522 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    vioblk.h
+
+Abstract:
+
+    This header contains internal definitions for the virtio block driver.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/intrface/disk.h>
+#include <minoca/virtio/virtio.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define VIOBLK_ALLOCATION_TAG 0x6B6C4256 // 'klBV'
+
+//
+// Define the size of a sector in the eyes of the virtio block protocol. The
+// capacity and request offsets are always in these units.
+//
+
+#define VIOBLK_SECTOR_SIZE 512
+
+//
+// Define the number of descriptors to ask for in the request queue.
+//
+
+#define VIOBLK_QUEUE_SIZE 256
+
+//
+// Define the number of requests that can be outstanding at once.
+//
+
+#define VIOBLK_REQUEST_COUNT 32
+
+//
+// Define the maximum number of data segments in a single request, and the
+// largest transfer a single request will carry.
+//
+
+#define VIOBLK_MAX_SEGMENTS 64
+#define VIOBLK_MAX_TRANSFER_SIZE 0x100000
+
+//
+// Define the size of the buffer used to bounce polled I/O during a crash
+// dump, and how long to wait for each polled request in microseconds.
+//
+
+#define VIOBLK_POLLED_BUFFER_SIZE 0x10000
+#define VIOBLK_POLLED_TIMEOUT 10000000
+#define VIOBLK_POLL_INTERVAL 10
+
+//
+// Define the virtio block device feature bits.
+//
+
+#define VIRTIO_BLK_FEATURE_SIZE_MAX   (1ULL << 1)
+#define VIRTIO_BLK_FEATURE_SEG_MAX    (1ULL << 2)
+#define VIRTIO_BLK_FEATURE_READ_ONLY  (1ULL << 5)
+#define VIRTIO_BLK_FEATURE_BLOCK_SIZE (1ULL << 6)
+#define VIRTIO_BLK_FEATURE_FLUSH      (1ULL << 9)
+
+#define VIOBLK_FEATURES                  \
+    (VIRTIO_BLK_FEATURE_SIZE_MAX |       \
+     VIRTIO_BLK_FEATURE_SEG_MAX |        \
+     VIRTIO_BLK_FEATURE_READ_ONLY |      \
+     VIRTIO_BLK_FEATURE_BLOCK_SIZE |     \
+     VIRTIO_BLK_FEATURE_FLUSH)
+
+//
+// Define the offsets of the fields in the device configuration.
+//
+
+#define VIRTIO_BLK_CONFIGURATION_CAPACITY 0x00
+#define VIRTIO_BLK_CONFIGURATION_SIZE_MAX 0x08
+#define VIRTIO_BLK_CONFIGURATION_SEG_MAX 0x0C
+#define VIRTIO_BLK_CONFIGURATION_BLOCK_SIZE 0x14
+
+//
+// Define the request types.
+//
+
+#define VIRTIO_BLK_REQUEST_READ  0
+#define VIRTIO_BLK_REQUEST_WRITE 1
+#define VIRTIO_BLK_REQUEST_FLUSH 4
+
+//
+// Define the values the device writes into the status byte.
+//
+
+#define VIRTIO_BLK_STATUS_OK          0
+#define VIRTIO_BLK_STATUS_IO_ERROR    1
+#define VIRTIO_BLK_STATUS_UNSUPPORTED 2
+
+//
+// Define the offset of the status byte within a request's DMA area, and the
+// size of that area.
+//
+
+#define VIOBLK_REQUEST_STATUS_OFFSET 0x10
+#define VIOBLK_REQUEST_DMA_SIZE 0x20
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _VIOBLK_CONTEXT_TYPE {
+    VioblkContextInvalid,
+    VioblkContextController,
+    VioblkContextDisk
+} VIOBLK_CONTEXT_TYPE, *PVIOBLK_CONTEXT_TYPE;
+
+typedef struct _VIOBLK_CONTROLLER VIOBLK_CONTROLLER, *PVIOBLK_CONTROLLER;
+
+/*++
+
+Structure Description:
+
+    This structure defines the header at the start of every virtio block
+    request.
+
+Members:
+
+    Type - Stores the request type. See VIRTIO_BLK_REQUEST_* definitions.
+
+    Reserved - Stores a reserved field that must be zero.
+
+    Sector - Stores the sector to start at, in units of 512 bytes regardless
+        of the device's block size.
+
+--*/
+
+typedef struct _VIRTIO_BLK_REQUEST_HEADER {
+    ULONG Type;
+    ULONG Reserved;
+    ULONGLONG Sector;
+} PACKED VIRTIO_BLK_REQUEST_HEADER, *PVIRTIO_BLK_REQUEST_HEADER;
+
+/*++
+
+Structure Description:
+
+    This structure defines an outstanding request to a virtio block device.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous free requests.
+
+    Irp - Stores a pointer to the IRP the request is working on, or NULL if
+        the IRP was abandoned because the disk went away.
+
+    IoSize - Stores the number of bytes this round of the request transfers.
+
+    Flush - Stores a boolean indicating whether this round of the request is
+        a cache flush.
+
+    Header - Stores a pointer to the request header.
+
+    HeaderPhysical - Stores the physical address of the request header.
+
+    Status - Stores a pointer to the status byte the device fills in.
+
+    StatusPhysical - Stores the physical address of the status byte.
+
+--*/
+
+typedef struct _VIOBLK_REQUEST {
+    LIST_ENTRY ListEntry;
+    PIRP Irp;
+    UINTN IoSize;
+    BOOL Flush;
+    PVIRTIO_BLK_REQUEST_HEADER Header;
+    PHYSICAL_ADDRESS HeaderPhysical;
+    volatile UCHAR *Status;
+    PHYSICAL_ADDRESS StatusPhysical;
+} VIOBLK_REQUEST, *PVIOBLK_REQUEST;
+
+/*++
+
+Structure Description:
+
+    This structure defines the disk presented by a virtio block device.
+
+Members:
+
+    Type - Stores the context type, VioblkContextDisk.
+
+    Controller - Stores a pointer to the controller the disk belongs to.
+
+    OsDevice - Stores a pointer to the OS device for the disk.
+
+    BlockSize - Stores the size of a block on the disk in bytes.
+
+    BlockCount - Stores the number of blocks on the disk.
+
+    ReadOnly - Stores a boolean indicating whether the device refuses writes.
+
+    Removed - Stores a boolean indicating whether the disk has been removed,
+        after which new I/O is failed.
+
+    DiskInterface - Stores the disk interface published for the disk.
+
+--*/
+
+typedef struct _VIOBLK_DISK {
+    VIOBLK_CONTEXT_TYPE Type;
+    PVIOBLK_CONTROLLER Controller;
+    PDEVICE OsDevice;
+    ULONG BlockSize;
+    ULONGLONG BlockCount;
+    BOOL ReadOnly;
+    BOOL Removed;
+    DISK_INTERFACE DiskInterface;
+} VIOBLK_DISK, *PVIOBLK_DISK;
+
+/*++
+
+Structure Description:
+
+    This structure defines a virtio block device.
+
+Members:
+
+    Type - Stores the context type, VioblkContextController.
+
+    OsDevice - Stores a pointer to the OS device for the PCI function.
+
+    Virtio - Stores a pointer to the virtio transport for the device.
+
+    Queue - Stores a pointer to the request queue.
+
+    Features - Stores the negotiated feature bits.
+
+    MaxSegments - Stores the maximum number of data segments in a request.
+
+    MaxSegmentSize - Stores the maximum size of a single data segment.
+
+    DpcLock - Stores the lock serializing access to the queue and the
+        request lists.
+
+    IrpQueue - Stores the list of IRPs waiting for a free request.
+
+    FreeRequests - Stores the list of free requests.
+
+    Requests - Stores the array of requests.
+
+    RequestIoBuffer - Stores the I/O buffer holding the request headers and
+        status bytes.
+
+    Segments - Stores a scratch array used to build the segment list for a
+        request. It is protected by the DPC lock.
+
+    PolledIoBuffer - Stores the I/O buffer used to bounce polled I/O.
+
+    PolledRequest - Stores the request used for polled I/O.
+
+    Disk - Stores the disk presented by the device.
+
+--*/
+
+struct _VIOBLK_CONTROLLER {
+    VIOBLK_CONTEXT_TYPE Type;
+    PDEVICE OsDevice;
+    PVIRTIO_DEVICE Virtio;
+    PVIRTIO_QUEUE Queue;
+    ULONGLONG Features;
+    ULONG MaxSegments;
+    ULONG MaxSegmentSize;
+    KSPIN_LOCK DpcLock;
+    LIST_ENTRY IrpQueue;
+    LIST_ENTRY FreeRequests;
+    VIOBLK_REQUEST Requests[VIOBLK_REQUEST_COUNT];
+    PIO_BUFFER RequestIoBuffer;
+    VIRTIO_SEGMENT Segments[VIOBLK_MAX_SEGMENTS + 2];
+    PIO_BUFFER PolledIoBuffer;
+    VIOBLK_REQUEST PolledRequest;
+    VIOBLK_DISK Disk;
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+extern PDRIVER VioblkDriver;
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+KSTATUS
+VioblkpInitializeRequests (
+    PVIOBLK_CONTROLLER Controller
+    );
+
+/*++
+
+Routine Description:
+
+    This routine allocates the DMA memory for the controller's requests and
+    puts them all on the free list.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+VioblkpEnqueueIrp (
+    PVIOBLK_DISK Disk,
+    PIRP Irp
+    );
+
+/*++
+
+Routine Description:
+
+    This routine pends an I/O or synchronize IRP and either sends it to the
+    device or queues it until a request is free.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+    Irp - Supplies a pointer to the IRP.
+
+Return Value:
+
+    Status code. On failure, the caller is responsible for completing the IRP.
+
+--*/
+
+VOID
+VioblkpProcessDiskRemoval (
+    PVIOBLK_DISK Disk
+    );
+
+/*++
+
+Routine Description:
+
+    This routine fails all queued IRPs and abandons all outstanding ones for a
+    disk that is going away.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+Return Value:
+
+    None.
+
+--*/
+
+INTERRUPT_STATUS
+VioblkpInterruptServiceDpc (
+    PVOID Context
+    );
+
+/*++
+
+Routine Description:
+
+    This routine processes completed requests at dispatch level.
+
+Arguments:
+
+    Context - Supplies a pointer to the controller.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+KSTATUS
+VioblkpBlockIoInitialize (
+    PVOID DiskToken
+    );
+
+/*++
+
+Routine Description:
+
+    This routine prepares the disk for polled block I/O by allocating the
+    bounce buffer it uses. This must be called at low level.
+
+Arguments:
+
+    DiskToken - Supplies a pointer to the disk.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+VioblkpBlockIoReset (
+    PVOID DiskToken
+    );
+
+/*++
+
+Routine Description:
+
+    This routine resets the device for polled block I/O, abandoning anything
+    that was in flight. This routine is called at high run level.
+
+Arguments:
+
+    DiskToken - Supplies a pointer to the disk.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+VioblkpBlockIoRead (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads the block contents from the disk into the given I/O
+    buffer using polled I/O. It does so without acquiring any locks or
+    allocating any resources, as this routine is used for crash dump support
+    when the system is in a very fragile state. It must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies a pointer to the disk.
+
+    IoBuffer - Supplies a pointer to the I/O buffer where the data will be read.
+
+    BlockAddress - Supplies the block index to read.
+
+    BlockCount - Supplies the number of blocks to read.
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks read.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+VioblkpBlockIoWrite (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    );
+
+/*++
+
+Routine Description:
+
+    This routine writes the contents of the given I/O buffer to the disk using
+    polled I/O. It does so without acquiring any locks or allocating any
+    resources, as this routine is used for crash dump support when the system
+    is in a very fragile state. It must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies a pointer to the disk.
+
+    IoBuffer - Supplies a pointer to the I/O buffer containing the data to
+        write.
+
+    BlockAddress - Supplies the block index to write to.
+
+    BlockCount - Supplies the number of blocks to write.
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks written.
+
+Return Value:
+
+    Status code.
+
+--*/
+
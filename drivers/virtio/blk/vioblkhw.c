@@ -0,0 +1,1250 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    vioblkhw.c
+
+Abstract:
+
+    This module implements the request handling for the virtio block driver:
+    turning IRPs into descriptor chains, completing them when the device is
+    done, and the polled path used for crash dumps.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include "vioblk.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+VioblkpSubmitIrp (
+    PVIOBLK_CONTROLLER Controller,
+    PIRP Irp
+    );
+
+KSTATUS
+VioblkpStartRequest (
+    PVIOBLK_CONTROLLER Controller,
+    PVIOBLK_REQUEST Request
+    );
+
+KSTATUS
+VioblkpStartIo (
+    PVIOBLK_CONTROLLER Controller,
+    PVIOBLK_REQUEST Request
+    );
+
+KSTATUS
+VioblkpStartFlush (
+    PVIOBLK_CONTROLLER Controller,
+    PVIOBLK_REQUEST Request
+    );
+
+VOID
+VioblkpCompleteRequest (
+    PVIOBLK_CONTROLLER Controller,
+    PVIOBLK_REQUEST Request
+    );
+
+VOID
+VioblkpSubmitQueuedIrps (
+    PVIOBLK_CONTROLLER Controller
+    );
+
+KSTATUS
+VioblkpPerformPolledIo (
+    PVIOBLK_DISK Disk,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    BOOL Write,
+    PUINTN BlocksCompleted
+    );
+
+KSTATUS
+VioblkpTranslateStatus (
+    UCHAR DeviceStatus
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+VioblkpInitializeRequests (
+    PVIOBLK_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates the DMA memory for the controller's requests and
+    puts them all on the free list.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    PIO_BUFFER IoBuffer;
+    ULONG Index;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PVIOBLK_REQUEST Request;
+    PUCHAR VirtualAddress;
+
+    //
+    // The polled request gets the slot after the regular ones.
+    //
+
+    if (Controller->RequestIoBuffer == NULL) {
+        AllocationSize = (VIOBLK_REQUEST_COUNT + 1) * VIOBLK_REQUEST_DMA_SIZE;
+        AllocationSize = ALIGN_RANGE_UP(AllocationSize, MmPageSize());
+        Controller->RequestIoBuffer = MmAllocateNonPagedIoBuffer(
+                                         0,
+                                         MAX_ULONGLONG,
+                                         VIOBLK_REQUEST_DMA_SIZE,
+                                         AllocationSize,
+                                         IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS);
+
+        if (Controller->RequestIoBuffer == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    IoBuffer = Controller->RequestIoBuffer;
+
+    ASSERT(IoBuffer->FragmentCount == 1);
+
+    RtlZeroMemory(IoBuffer->Fragment[0].VirtualAddress,
+                  IoBuffer->Fragment[0].Size);
+
+    VirtualAddress = IoBuffer->Fragment[0].VirtualAddress;
+    PhysicalAddress = IoBuffer->Fragment[0].PhysicalAddress;
+    INITIALIZE_LIST_HEAD(&(Controller->FreeRequests));
+    for (Index = 0; Index <= VIOBLK_REQUEST_COUNT; Index += 1) {
+        if (Index == VIOBLK_REQUEST_COUNT) {
+            Request = &(Controller->PolledRequest);
+
+        } else {
+            Request = &(Controller->Requests[Index]);
+        }
+
+        Request->Irp = NULL;
+        Request->IoSize = 0;
+        Request->Flush = FALSE;
+        Request->Header = (PVIRTIO_BLK_REQUEST_HEADER)VirtualAddress;
+        Request->HeaderPhysical = PhysicalAddress;
+        Request->Status = VirtualAddress + VIOBLK_REQUEST_STATUS_OFFSET;
+        Request->StatusPhysical = PhysicalAddress +
+                                  VIOBLK_REQUEST_STATUS_OFFSET;
+
+        if (Index != VIOBLK_REQUEST_COUNT) {
+            INSERT_BEFORE(&(Request->ListEntry), &(Controller->FreeRequests));
+        }
+
+        VirtualAddress += VIOBLK_REQUEST_DMA_SIZE;
+        PhysicalAddress += VIOBLK_REQUEST_DMA_SIZE;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+VioblkpEnqueueIrp (
+    PVIOBLK_DISK Disk,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pends an I/O or synchronize IRP and either sends it to the
+    device or queues it until a request is free.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+    Irp - Supplies a pointer to the IRP.
+
+Return Value:
+
+    Status code. On failure, the caller is responsible for completing the IRP.
+
+--*/
+
+{
+
+    PVIOBLK_CONTROLLER Controller;
+    RUNLEVEL OldRunLevel;
+    KSTATUS Status;
+
+    Controller = Disk->Controller;
+    IoPendIrp(VioblkDriver, Irp);
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Controller->DpcLock));
+
+    //
+    // If the device disappeared, fail the I/O now.
+    //
+
+    if (Disk->Removed != FALSE) {
+        Status = STATUS_NO_SUCH_DEVICE;
+        goto EnqueueIrpEnd;
+    }
+
+    //
+    // Keep IRPs in order behind anything already waiting.
+    //
+
+    Status = STATUS_RESOURCE_IN_USE;
+    if (LIST_EMPTY(&(Controller->IrpQueue)) != FALSE) {
+        Status = VioblkpSubmitIrp(Controller, Irp);
+    }
+
+    if (Status == STATUS_RESOURCE_IN_USE) {
+        INSERT_BEFORE(&(Irp->ListEntry), &(Controller->IrpQueue));
+        Status = STATUS_SUCCESS;
+
+    } else if (KSUCCESS(Status)) {
+        VirtioQueueNotify(Controller->Queue);
+    }
+
+EnqueueIrpEnd:
+    KeReleaseSpinLock(&(Controller->DpcLock));
+    KeLowerRunLevel(OldRunLevel);
+    return Status;
+}
+
+VOID
+VioblkpProcessDiskRemoval (
+    PVIOBLK_DISK Disk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fails all queued IRPs and abandons all outstanding ones for a
+    disk that is going away.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVIOBLK_CONTROLLER Controller;
+    ULONG Index;
+    PIRP Irp;
+    RUNLEVEL OldRunLevel;
+    PVIOBLK_REQUEST Request;
+
+    Controller = Disk->Controller;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Controller->DpcLock));
+    Disk->Removed = TRUE;
+
+    //
+    // The device may still hand back requests that were in flight, so those
+    // stay off the free list until it does. Only their IRPs are let go.
+    //
+
+    for (Index = 0; Index < VIOBLK_REQUEST_COUNT; Index += 1) {
+        Request = &(Controller->Requests[Index]);
+        Irp = Request->Irp;
+        if (Irp != NULL) {
+            Request->Irp = NULL;
+            IoCompleteIrp(VioblkDriver, Irp, STATUS_NO_SUCH_DEVICE);
+        }
+    }
+
+    while (LIST_EMPTY(&(Controller->IrpQueue)) == FALSE) {
+        Irp = LIST_VALUE(Controller->IrpQueue.Next, IRP, ListEntry);
+        LIST_REMOVE(&(Irp->ListEntry));
+        IoCompleteIrp(VioblkDriver, Irp, STATUS_NO_SUCH_DEVICE);
+    }
+
+    KeReleaseSpinLock(&(Controller->DpcLock));
+    KeLowerRunLevel(OldRunLevel);
+    return;
+}
+
+INTERRUPT_STATUS
+VioblkpInterruptServiceDpc (
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine processes completed requests at dispatch level.
+
+Arguments:
+
+    Context - Supplies a pointer to the controller.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+{
+
+    PVOID Cookie;
+    PVIOBLK_CONTROLLER Controller;
+    ULONG Length;
+    ULONG PendingBits;
+    PVIRTIO_QUEUE Queue;
+
+    Controller = Context;
+    PendingBits = VirtioGetPendingInterrupts(Controller->Virtio);
+    if (PendingBits == 0) {
+        return InterruptStatusNotClaimed;
+    }
+
+    //
+    // Configuration changes (like a resize) are not acted on.
+    //
+
+    if ((PendingBits & VIRTIO_INTERRUPT_QUEUE) == 0) {
+        return InterruptStatusClaimed;
+    }
+
+    KeAcquireSpinLock(&(Controller->DpcLock));
+    Queue = Controller->Queue;
+    if (Queue == NULL) {
+        goto InterruptServiceDpcEnd;
+    }
+
+    //
+    // Reap with interrupts off, and go around again if more requests finished
+    // while turning them back on.
+    //
+
+    do {
+        VirtioQueueDisableInterrupts(Queue);
+        while (VirtioQueueGetUsed(Queue, &Cookie, &Length) != FALSE) {
+            VioblkpCompleteRequest(Controller, Cookie);
+        }
+
+    } while (VirtioQueueEnableInterrupts(Queue, 0) != FALSE);
+
+    VioblkpSubmitQueuedIrps(Controller);
+    VirtioQueueNotify(Queue);
+
+InterruptServiceDpcEnd:
+    KeReleaseSpinLock(&(Controller->DpcLock));
+    return InterruptStatusClaimed;
+}
+
+KSTATUS
+VioblkpBlockIoInitialize (
+    PVOID DiskToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prepares the disk for polled block I/O by allocating the
+    bounce buffer it uses. This must be called at low level.
+
+Arguments:
+
+    DiskToken - Supplies a pointer to the disk.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PVIOBLK_CONTROLLER Controller;
+    PVIOBLK_DISK Disk;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    Disk = DiskToken;
+    Controller = Disk->Controller;
+    if (Controller->PolledIoBuffer == NULL) {
+        Controller->PolledIoBuffer = MmAllocateNonPagedIoBuffer(
+                                         0,
+                                         MAX_ULONGLONG,
+                                         Disk->BlockSize,
+                                         VIOBLK_POLLED_BUFFER_SIZE,
+                                         IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS);
+
+        if (Controller->PolledIoBuffer == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+VioblkpBlockIoReset (
+    PVOID DiskToken
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets the device and its queue so polled I/O can run from
+    a clean state, regardless of what the system was doing when it crashed.
+    This routine must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies a pointer to the disk.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PVIOBLK_CONTROLLER Controller;
+    PVIOBLK_DISK Disk;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelHigh);
+
+    Disk = DiskToken;
+    Controller = Disk->Controller;
+    if ((Controller->PolledIoBuffer == NULL) || (Controller->Queue == NULL)) {
+        return STATUS_NOT_READY;
+    }
+
+    Status = VirtioReinitializeDevice(Controller->Virtio);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    VirtioQueueDisableInterrupts(Controller->Queue);
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+VioblkpBlockIoRead (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the block contents from the disk into the given I/O
+    buffer using polled I/O. This must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies a pointer to the disk.
+
+    IoBuffer - Supplies a pointer to the I/O buffer where the data will be
+        read.
+
+    BlockAddress - Supplies the block index to read from (for physical disk,
+        this is the LBA).
+
+    BlockCount - Supplies the number of blocks to read.
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks read.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelHigh);
+
+    Status = VioblkpPerformPolledIo(DiskToken,
+                                    IoBuffer,
+                                    BlockAddress,
+                                    BlockCount,
+                                    FALSE,
+                                    BlocksCompleted);
+
+    return Status;
+}
+
+KSTATUS
+VioblkpBlockIoWrite (
+    PVOID DiskToken,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    PUINTN BlocksCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes the contents of the given I/O buffer to the disk using
+    polled I/O. This must be called at high level.
+
+Arguments:
+
+    DiskToken - Supplies a pointer to the disk.
+
+    IoBuffer - Supplies a pointer to the I/O buffer containing the data to
+        write.
+
+    BlockAddress - Supplies the block index to write to (for physical disk,
+        this is the LBA).
+
+    BlockCount - Supplies the number of blocks to write.
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks written.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelHigh);
+
+    Status = VioblkpPerformPolledIo(DiskToken,
+                                    IoBuffer,
+                                    BlockAddress,
+                                    BlockCount,
+                                    TRUE,
+                                    BlocksCompleted);
+
+    return Status;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+VioblkpSubmitIrp (
+    PVIOBLK_CONTROLLER Controller,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes a free request and hands the next piece of the given
+    IRP to the device. This routine assumes the DPC lock is held.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Irp - Supplies a pointer to the IRP.
+
+Return Value:
+
+    STATUS_SUCCESS if the request was added to the queue.
+
+    STATUS_RESOURCE_IN_USE if there are no free requests or descriptors.
+
+    Other error codes if the IRP should be failed.
+
+--*/
+
+{
+
+    PVIOBLK_REQUEST Request;
+    KSTATUS Status;
+
+    if (LIST_EMPTY(&(Controller->FreeRequests)) != FALSE) {
+        return STATUS_RESOURCE_IN_USE;
+    }
+
+    Request = LIST_VALUE(Controller->FreeRequests.Next,
+                         VIOBLK_REQUEST,
+                         ListEntry);
+
+    Request->Irp = Irp;
+    Status = VioblkpStartRequest(Controller, Request);
+    if (!KSUCCESS(Status)) {
+        Request->Irp = NULL;
+        return Status;
+    }
+
+    LIST_REMOVE(&(Request->ListEntry));
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+VioblkpStartRequest (
+    PVIOBLK_CONTROLLER Controller,
+    PVIOBLK_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds the next round of a request's IRP to the queue. A
+    synchronize IRP, or a synchronized write with all its data transferred,
+    gets a cache flush. Anything else gets the next chunk of data. This
+    routine assumes the DPC lock is held.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Request - Supplies a pointer to the request, with its IRP filled in.
+
+Return Value:
+
+    STATUS_SUCCESS if the request was added to the queue.
+
+    STATUS_RESOURCE_IN_USE if there are not enough free descriptors.
+
+--*/
+
+{
+
+    PIRP Irp;
+    KSTATUS Status;
+
+    Irp = Request->Irp;
+    if ((Irp->MajorCode != IrpMajorIo) ||
+        (Irp->U.ReadWrite.IoBytesCompleted >= Irp->U.ReadWrite.IoSizeInBytes)) {
+
+        Status = VioblkpStartFlush(Controller, Request);
+
+    } else {
+        Status = VioblkpStartIo(Controller, Request);
+    }
+
+    return Status;
+}
+
+KSTATUS
+VioblkpStartIo (
+    PVIOBLK_CONTROLLER Controller,
+    PVIOBLK_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a descriptor chain for the next chunk of data in a read
+    or write IRP. This routine assumes the DPC lock is held.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Request - Supplies a pointer to the request.
+
+Return Value:
+
+    STATUS_SUCCESS if the request was added to the queue.
+
+    STATUS_RESOURCE_IN_USE if there are not enough free descriptors.
+
+--*/
+
+{
+
+    UINTN BytesPreviouslyCompleted;
+    UINTN BytesToComplete;
+    UINTN EntrySize;
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
+    UINTN FragmentOffset;
+    ULONG FreeCount;
+    PIO_BUFFER IoBuffer;
+    UINTN IoBufferOffset;
+    PIRP Irp;
+    ULONG MaxSegments;
+    ULONG SegmentCount;
+    ULONG SegmentFlags;
+    PVIRTIO_SEGMENT Segments;
+    KSTATUS Status;
+    UINTN TransferSize;
+    UINTN TransferSizeRemaining;
+
+    Irp = Request->Irp;
+    IoBuffer = Irp->U.ReadWrite.IoBuffer;
+    BytesPreviouslyCompleted = Irp->U.ReadWrite.IoBytesCompleted;
+    BytesToComplete = Irp->U.ReadWrite.IoSizeInBytes;
+
+    ASSERT(BytesPreviouslyCompleted < BytesToComplete);
+
+    //
+    // Every chain needs the header and status descriptors plus at least one
+    // for data.
+    //
+
+    FreeCount = VirtioQueueGetFreeCount(Controller->Queue);
+    if (FreeCount < 3) {
+        return STATUS_RESOURCE_IN_USE;
+    }
+
+    MaxSegments = Controller->MaxSegments;
+    if (MaxSegments > FreeCount - 2) {
+        MaxSegments = FreeCount - 2;
+    }
+
+    TransferSize = BytesToComplete - BytesPreviouslyCompleted;
+    if (TransferSize > VIOBLK_MAX_TRANSFER_SIZE) {
+        TransferSize = VIOBLK_MAX_TRANSFER_SIZE;
+    }
+
+    SegmentFlags = VIRTIO_SEGMENT_FLAG_DEVICE_WRITE;
+    Request->Header->Type = VIRTIO_BLK_REQUEST_READ;
+    if (Irp->MinorCode == IrpMinorIoWrite) {
+        SegmentFlags = 0;
+        Request->Header->Type = VIRTIO_BLK_REQUEST_WRITE;
+    }
+
+    Request->Header->Reserved = 0;
+    Request->Header->Sector = Irp->U.ReadWrite.NewIoOffset /
+                              VIOBLK_SECTOR_SIZE;
+
+    Segments = Controller->Segments;
+    Segments[0].Address = Request->HeaderPhysical;
+    Segments[0].Length = sizeof(VIRTIO_BLK_REQUEST_HEADER);
+    Segments[0].Flags = 0;
+    SegmentCount = 1;
+
+    //
+    // Get to the current spot in the I/O buffer.
+    //
+
+    IoBufferOffset = MmGetIoBufferCurrentOffset(IoBuffer);
+    IoBufferOffset += BytesPreviouslyCompleted;
+    FragmentIndex = 0;
+    FragmentOffset = 0;
+    while (IoBufferOffset != 0) {
+
+        ASSERT(FragmentIndex < IoBuffer->FragmentCount);
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        if (IoBufferOffset < Fragment->Size) {
+            FragmentOffset = IoBufferOffset;
+            break;
+        }
+
+        IoBufferOffset -= Fragment->Size;
+        FragmentIndex += 1;
+    }
+
+    //
+    // Add a data segment for each physically contiguous run, stopping early
+    // if the device's segment limit is reached.
+    //
+
+    TransferSizeRemaining = TransferSize;
+    while ((TransferSizeRemaining != 0) &&
+           (SegmentCount - 1 < MaxSegments)) {
+
+        ASSERT(FragmentIndex < IoBuffer->FragmentCount);
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        EntrySize = TransferSizeRemaining;
+        if (EntrySize > (Fragment->Size - FragmentOffset)) {
+            EntrySize = Fragment->Size - FragmentOffset;
+        }
+
+        if (EntrySize > Controller->MaxSegmentSize) {
+            EntrySize = Controller->MaxSegmentSize;
+        }
+
+        Segments[SegmentCount].Address = Fragment->PhysicalAddress +
+                                         FragmentOffset;
+
+        Segments[SegmentCount].Length = EntrySize;
+        Segments[SegmentCount].Flags = SegmentFlags;
+        SegmentCount += 1;
+        TransferSizeRemaining -= EntrySize;
+        FragmentOffset += EntrySize;
+        if (FragmentOffset >= Fragment->Size) {
+            FragmentIndex += 1;
+            FragmentOffset = 0;
+        }
+    }
+
+    TransferSize -= TransferSizeRemaining;
+
+    ASSERT(IS_ALIGNED(TransferSize, Controller->Disk.BlockSize) != FALSE);
+
+    *(Request->Status) = 0xFF;
+    Segments[SegmentCount].Address = Request->StatusPhysical;
+    Segments[SegmentCount].Length = sizeof(UCHAR);
+    Segments[SegmentCount].Flags = VIRTIO_SEGMENT_FLAG_DEVICE_WRITE;
+    SegmentCount += 1;
+    Request->IoSize = TransferSize;
+    Request->Flush = FALSE;
+    Status = VirtioQueueAddBuffer(Controller->Queue,
+                                  Segments,
+                                  SegmentCount,
+                                  Request);
+
+    return Status;
+}
+
+KSTATUS
+VioblkpStartFlush (
+    PVIOBLK_CONTROLLER Controller,
+    PVIOBLK_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a descriptor chain asking the device to flush its write
+    cache. This routine assumes the DPC lock is held.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Request - Supplies a pointer to the request.
+
+Return Value:
+
+    STATUS_SUCCESS if the request was added to the queue.
+
+    STATUS_RESOURCE_IN_USE if there are not enough free descriptors.
+
+--*/
+
+{
+
+    PVIRTIO_SEGMENT Segments;
+    KSTATUS Status;
+
+    Request->Header->Type = VIRTIO_BLK_REQUEST_FLUSH;
+    Request->Header->Reserved = 0;
+    Request->Header->Sector = 0;
+    *(Request->Status) = 0xFF;
+    Segments = Controller->Segments;
+    Segments[0].Address = Request->HeaderPhysical;
+    Segments[0].Length = sizeof(VIRTIO_BLK_REQUEST_HEADER);
+    Segments[0].Flags = 0;
+    Segments[1].Address = Request->StatusPhysical;
+    Segments[1].Length = sizeof(UCHAR);
+    Segments[1].Flags = VIRTIO_SEGMENT_FLAG_DEVICE_WRITE;
+    Request->IoSize = 0;
+    Request->Flush = TRUE;
+    Status = VirtioQueueAddBuffer(Controller->Queue, Segments, 2, Request);
+    return Status;
+}
+
+VOID
+VioblkpCompleteRequest (
+    PVIOBLK_CONTROLLER Controller,
+    PVIOBLK_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles a request the device has finished with, either
+    sending the next round of its IRP or completing the IRP. This routine
+    assumes the DPC lock is held.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+    Request - Supplies a pointer to the finished request.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL FlushNeeded;
+    PIRP Irp;
+    KSTATUS Status;
+
+    if (Request == &(Controller->PolledRequest)) {
+        return;
+    }
+
+    Irp = Request->Irp;
+
+    //
+    // If the disk went away while this was in flight, the IRP was already
+    // completed and the request just needs to be freed.
+    //
+
+    if (Irp == NULL) {
+        INSERT_BEFORE(&(Request->ListEntry), &(Controller->FreeRequests));
+        return;
+    }
+
+    Status = VioblkpTranslateStatus(*(Request->Status));
+    if ((KSUCCESS(Status)) &&
+        (Irp->MajorCode == IrpMajorIo) &&
+        (Request->Flush == FALSE)) {
+
+        Irp->U.ReadWrite.IoBytesCompleted += Request->IoSize;
+        Irp->U.ReadWrite.NewIoOffset += Request->IoSize;
+
+        //
+        // A synchronized write isn't done until the data is out of the
+        // device's cache, if it has one.
+        //
+
+        FlushNeeded = FALSE;
+        if ((Irp->MinorCode == IrpMinorIoWrite) &&
+            ((Irp->U.ReadWrite.IoFlags & IO_FLAG_DATA_SYNCHRONIZED) != 0) &&
+            ((Controller->Features & VIRTIO_BLK_FEATURE_FLUSH) != 0)) {
+
+            FlushNeeded = TRUE;
+        }
+
+        if ((Irp->U.ReadWrite.IoBytesCompleted <
+             Irp->U.ReadWrite.IoSizeInBytes) ||
+            (FlushNeeded != FALSE)) {
+
+            Status = VioblkpStartRequest(Controller, Request);
+            if (KSUCCESS(Status)) {
+                return;
+            }
+
+            //
+            // If the queue is momentarily out of descriptors, put the IRP at
+            // the front of the line. It picks up where it left off.
+            //
+
+            if (Status == STATUS_RESOURCE_IN_USE) {
+                Request->Irp = NULL;
+                INSERT_AFTER(&(Irp->ListEntry), &(Controller->IrpQueue));
+                INSERT_BEFORE(&(Request->ListEntry),
+                              &(Controller->FreeRequests));
+
+                return;
+            }
+        }
+    }
+
+    Request->Irp = NULL;
+    INSERT_BEFORE(&(Request->ListEntry), &(Controller->FreeRequests));
+    IoCompleteIrp(VioblkDriver, Irp, Status);
+    return;
+}
+
+VOID
+VioblkpSubmitQueuedIrps (
+    PVIOBLK_CONTROLLER Controller
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sends as many waiting IRPs to the device as there are free
+    requests and descriptors for. This routine assumes the DPC lock is held.
+
+Arguments:
+
+    Controller - Supplies a pointer to the controller.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIRP Irp;
+    KSTATUS Status;
+
+    while (LIST_EMPTY(&(Controller->IrpQueue)) == FALSE) {
+        Irp = LIST_VALUE(Controller->IrpQueue.Next, IRP, ListEntry);
+        Status = VioblkpSubmitIrp(Controller, Irp);
+        if (Status == STATUS_RESOURCE_IN_USE) {
+            break;
+        }
+
+        LIST_REMOVE(&(Irp->ListEntry));
+        if (!KSUCCESS(Status)) {
+            IoCompleteIrp(VioblkDriver, Irp, Status);
+        }
+    }
+
+    return;
+}
+
+KSTATUS
+VioblkpPerformPolledIo (
+    PVIOBLK_DISK Disk,
+    PIO_BUFFER IoBuffer,
+    ULONGLONG BlockAddress,
+    UINTN BlockCount,
+    BOOL Write,
+    PUINTN BlocksCompleted
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs polled I/O through the bounce buffer, one request
+    at a time, spinning until the device finishes each one.
+
+Arguments:
+
+    Disk - Supplies a pointer to the disk.
+
+    IoBuffer - Supplies a pointer to the I/O buffer containing the data.
+
+    BlockAddress - Supplies the block index to start at.
+
+    BlockCount - Supplies the number of blocks to transfer.
+
+    Write - Supplies a boolean indicating if this is a write (TRUE) or a read
+        (FALSE).
+
+    BlocksCompleted - Supplies a pointer that receives the total number of
+        blocks transferred.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PVOID BounceBuffer;
+    UINTN BytesCompleted;
+    UINTN BytesToComplete;
+    PVIOBLK_CONTROLLER Controller;
+    PVOID Cookie;
+    ULONG Length;
+    ULONGLONG Offset;
+    PIO_BUFFER_FRAGMENT PolledFragment;
+    PVIOBLK_REQUEST Request;
+    VIRTIO_SEGMENT Segments[3];
+    UINTN Size;
+    KSTATUS Status;
+    ULONG Waited;
+
+    Controller = Disk->Controller;
+    Request = &(Controller->PolledRequest);
+    PolledFragment = &(Controller->PolledIoBuffer->Fragment[0]);
+    BounceBuffer = PolledFragment->VirtualAddress;
+    BytesCompleted = 0;
+    BytesToComplete = BlockCount * Disk->BlockSize;
+    Offset = BlockAddress * Disk->BlockSize;
+    Status = STATUS_SUCCESS;
+    while (BytesCompleted < BytesToComplete) {
+        Size = BytesToComplete - BytesCompleted;
+        if (Size > VIOBLK_POLLED_BUFFER_SIZE) {
+            Size = VIOBLK_POLLED_BUFFER_SIZE;
+        }
+
+        if (Size > Controller->MaxSegmentSize) {
+            Size = Controller->MaxSegmentSize;
+        }
+
+        if (Write != FALSE) {
+            Status = MmCopyIoBufferData(IoBuffer,
+                                        BounceBuffer,
+                                        BytesCompleted,
+                                        Size,
+                                        FALSE);
+
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+
+            Request->Header->Type = VIRTIO_BLK_REQUEST_WRITE;
+            Segments[1].Flags = 0;
+
+        } else {
+            Request->Header->Type = VIRTIO_BLK_REQUEST_READ;
+            Segments[1].Flags = VIRTIO_SEGMENT_FLAG_DEVICE_WRITE;
+        }
+
+        Request->Header->Reserved = 0;
+        Request->Header->Sector = Offset / VIOBLK_SECTOR_SIZE;
+        *(Request->Status) = 0xFF;
+        Segments[0].Address = Request->HeaderPhysical;
+        Segments[0].Length = sizeof(VIRTIO_BLK_REQUEST_HEADER);
+        Segments[0].Flags = 0;
+        Segments[1].Address = PolledFragment->PhysicalAddress;
+        Segments[1].Length = Size;
+        Segments[2].Address = Request->StatusPhysical;
+        Segments[2].Length = sizeof(UCHAR);
+        Segments[2].Flags = VIRTIO_SEGMENT_FLAG_DEVICE_WRITE;
+        Status = VirtioQueueAddBuffer(Controller->Queue, Segments, 3, Request);
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        VirtioQueueNotify(Controller->Queue);
+
+        //
+        // The queue was reset before polled I/O began, so the only thing
+        // that can come back is this request.
+        //
+
+        Waited = 0;
+        while (VirtioQueueGetUsed(Controller->Queue, &Cookie, &Length) ==
+               FALSE) {
+
+            if (Waited >= VIOBLK_POLLED_TIMEOUT) {
+                Status = STATUS_TIMEOUT;
+                break;
+            }
+
+            HlBusySpin(VIOBLK_POLL_INTERVAL);
+            Waited += VIOBLK_POLL_INTERVAL;
+        }
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        ASSERT(Cookie == Request);
+
+        Status = VioblkpTranslateStatus(*(Request->Status));
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        if (Write == FALSE) {
+            Status = MmCopyIoBufferData(IoBuffer,
+                                        BounceBuffer,
+                                        BytesCompleted,
+                                        Size,
+                                        TRUE);
+
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+        }
+
+        BytesCompleted += Size;
+        Offset += Size;
+    }
+
+    *BlocksCompleted = BytesCompleted / Disk->BlockSize;
+    return Status;
+}
+
+KSTATUS
+VioblkpTranslateStatus (
+    UCHAR DeviceStatus
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts the status byte the device wrote into a status code.
+
+Arguments:
+
+    DeviceStatus - Supplies the status byte from the device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    switch (DeviceStatus) {
+    case VIRTIO_BLK_STATUS_OK:
+        return STATUS_SUCCESS;
+
+    case VIRTIO_BLK_STATUS_UNSUPPORTED:
+        return STATUS_NOT_SUPPORTED;
+
+    default:
+        break;
+    }
+
+    return STATUS_DEVICE_IO_ERROR;
+}
+
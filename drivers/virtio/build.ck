@@ -0,0 +1,41 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    Virtio
+
+Abstract:
+
+    This directory contains drivers for paravirtualized virtio devices.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+from menv import group;
+
+function build() {
+    var entries;
+    var virtioDrivers;
+
+    virtioDrivers = [
+        "drivers/virtio/blk:vioblk",
+    ];
+
+    entries = group("virtio_drivers", virtioDrivers);
+    return entries;
+}
+
@@ -0,0 +1,2177 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    virtio.c
+
+Abstract:
+
+    This module implements the virtio PCI transport, which finds a virtio
+    device's registers, negotiates features, and sets up its queues on behalf
+    of the individual virtio device drivers.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include "virtiop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+VirtioDriverUnload (
+    PVOID Driver
+    );
+
+VOID
+VirtiopProcessPciConfigInterfaceChangeNotification (
+    PVOID Context,
+    PDEVICE Device,
+    PVOID InterfaceBuffer,
+    ULONG InterfaceBufferSize,
+    BOOL Arrival
+    );
+
+KSTATUS
+VirtiopReadPciConfig (
+    PVIRTIO_DEVICE Device,
+    ULONG Offset,
+    ULONG AccessSize,
+    PULONG Value
+    );
+
+KSTATUS
+VirtiopFindModernRegions (
+    PVIRTIO_DEVICE Device,
+    PRESOURCE_ALLOCATION *Bars
+    );
+
+KSTATUS
+VirtiopMapRegion (
+    PVIRTIO_DEVICE Device,
+    PRESOURCE_ALLOCATION *Bars,
+    ULONG BarIndex,
+    ULONG Offset,
+    ULONG Length,
+    PVIRTIO_REGION Region
+    );
+
+KSTATUS
+VirtiopResetDevice (
+    PVIRTIO_DEVICE Device
+    );
+
+UCHAR
+VirtiopGetStatus (
+    PVIRTIO_DEVICE Device
+    );
+
+VOID
+VirtiopSetStatus (
+    PVIRTIO_DEVICE Device,
+    UCHAR Status
+    );
+
+ULONGLONG
+VirtiopGetDeviceFeatures (
+    PVIRTIO_DEVICE Device
+    );
+
+KSTATUS
+VirtiopSetDriverFeatures (
+    PVIRTIO_DEVICE Device,
+    ULONGLONG Features
+    );
+
+KSTATUS
+VirtiopProgramQueue (
+    PVIRTIO_QUEUE Queue
+    );
+
+INTERRUPT_STATUS
+VirtiopInterruptService (
+    PVOID Context
+    );
+
+INTERRUPT_STATUS
+VirtiopDispatchService (
+    PVOID Context
+    );
+
+INTERRUPT_STATUS
+VirtiopLowLevelService (
+    PVOID Context
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+UUID VirtioPciConfigurationInterfaceUuid = UUID_PCI_CONFIG_ACCESS;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+DriverEntry (
+    PDRIVER Driver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the initial entry point of the virtio core
+    library, called when the library is first loaded.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver object.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    DRIVER_FUNCTION_TABLE FunctionTable;
+    KSTATUS Status;
+
+    RtlZeroMemory(&FunctionTable, sizeof(DRIVER_FUNCTION_TABLE));
+    FunctionTable.Version = DRIVER_FUNCTION_TABLE_VERSION;
+    FunctionTable.Unload = VirtioDriverUnload;
+    Status = IoRegisterDriverFunctions(Driver, &FunctionTable);
+    return Status;
+}
+
+VIRTIO_API
+KSTATUS
+VirtioCreateDevice (
+    PDEVICE OsDevice,
+    PVIRTIO_DEVICE *Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the virtio transport state for a virtio PCI device.
+    This is usually called from a driver's add device routine.
+
+Arguments:
+
+    OsDevice - Supplies a pointer to the OS device the driver is attaching to.
+
+    Device - Supplies a pointer where a pointer to the new virtio device will
+        be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PVIRTIO_DEVICE NewDevice;
+
+    NewDevice = MmAllocateNonPagedPool(sizeof(VIRTIO_DEVICE),
+                                       VIRTIO_ALLOCATION_TAG);
+
+    if (NewDevice == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(NewDevice, sizeof(VIRTIO_DEVICE));
+    NewDevice->OsDevice = OsDevice;
+    NewDevice->InterruptHandle = INVALID_HANDLE;
+    *Device = NewDevice;
+    return STATUS_SUCCESS;
+}
+
+VIRTIO_API
+VOID
+VirtioDestroyDevice (
+    PVIRTIO_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets and destroys a virtio device, including all of its
+    queues.
+
+Arguments:
+
+    Device - Supplies a pointer to the device to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+    PVIRTIO_QUEUE Queue;
+
+    //
+    // Stop the device from touching queue memory before freeing it.
+    //
+
+    if (Device->Common.Length != 0) {
+        VirtiopResetDevice(Device);
+    }
+
+    if (Device->InterruptHandle != INVALID_HANDLE) {
+        IoDisconnectInterrupt(Device->InterruptHandle);
+        Device->InterruptHandle = INVALID_HANDLE;
+    }
+
+    for (Index = 0; Index < VIRTIO_MAX_QUEUES; Index += 1) {
+        Queue = Device->Queues[Index];
+        if (Queue == NULL) {
+            continue;
+        }
+
+        if (Queue->IoBuffer != NULL) {
+            MmFreeIoBuffer(Queue->IoBuffer);
+        }
+
+        if (Queue->Cookies != NULL) {
+            MmFreeNonPagedPool(Queue->Cookies);
+        }
+
+        MmFreeNonPagedPool(Queue);
+        Device->Queues[Index] = NULL;
+    }
+
+    for (Index = 0; Index < VIRTIO_PCI_BAR_COUNT; Index += 1) {
+        if (Device->BarMappings[Index] != NULL) {
+            MmUnmapAddress(Device->BarMappings[Index],
+                           Device->BarMappingSizes[Index]);
+
+            Device->BarMappings[Index] = NULL;
+        }
+    }
+
+    if (Device->RegisteredForPciConfigInterfaces != FALSE) {
+        IoUnregisterForInterfaceNotifications(
+                            &VirtioPciConfigurationInterfaceUuid,
+                            VirtiopProcessPciConfigInterfaceChangeNotification,
+                            Device->OsDevice,
+                            Device);
+
+        Device->RegisteredForPciConfigInterfaces = FALSE;
+    }
+
+    MmFreeNonPagedPool(Device);
+    return;
+}
+
+VIRTIO_API
+KSTATUS
+VirtioProcessResourceRequirements (
+    PVIRTIO_DEVICE Device,
+    PIRP Irp
+    )
+
+/*++
+
+Routine Description:
+
+    This routine handles a query resources IRP on its way back up for a virtio
+    device, signing up for PCI configuration access and asking for an
+    interrupt vector for the device's interrupt line.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    Irp - Supplies a pointer to the query resources IRP.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PRESOURCE_CONFIGURATION_LIST Requirements;
+    KSTATUS Status;
+    RESOURCE_REQUIREMENT VectorRequirement;
+
+    ASSERT((Irp->MajorCode == IrpMajorStateChange) &&
+           (Irp->MinorCode == IrpMinorQueryResources));
+
+    //
+    // Start listening for a PCI config interface, which is needed to find the
+    // modern register layout.
+    //
+
+    if (Device->RegisteredForPciConfigInterfaces == FALSE) {
+        Status = IoRegisterForInterfaceNotifications(
+                            &VirtioPciConfigurationInterfaceUuid,
+                            VirtiopProcessPciConfigInterfaceChangeNotification,
+                            Irp->Device,
+                            Device,
+                            TRUE);
+
+        if (!KSUCCESS(Status)) {
+            goto ProcessResourceRequirementsEnd;
+        }
+
+        Device->RegisteredForPciConfigInterfaces = TRUE;
+    }
+
+    if (Device->PciConfigInterfaceAvailable == FALSE) {
+        Status = STATUS_NOT_CONFIGURED;
+        goto ProcessResourceRequirementsEnd;
+    }
+
+    RtlZeroMemory(&VectorRequirement, sizeof(RESOURCE_REQUIREMENT));
+    VectorRequirement.Type = ResourceTypeInterruptVector;
+    VectorRequirement.Minimum = 0;
+    VectorRequirement.Maximum = -1;
+    VectorRequirement.Length = 1;
+    Requirements = Irp->U.QueryResources.ResourceRequirements;
+    Status = IoCreateAndAddInterruptVectorsForLines(Requirements,
+                                                    &VectorRequirement);
+
+ProcessResourceRequirementsEnd:
+    return Status;
+}
+
+VIRTIO_API
+KSTATUS
+VirtioStartDevice (
+    PVIRTIO_DEVICE Device,
+    PRESOURCE_ALLOCATION_LIST AllocationList
+    )
+
+/*++
+
+Routine Description:
+
+    This routine locates and maps the device's registers, using the modern
+    interface if the device has one and falling back to the legacy one
+    otherwise. The device is then reset and acknowledged.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    AllocationList - Supplies a pointer to the processor local resources
+        allocated to the device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PRESOURCE_ALLOCATION Allocation;
+    ULONG BarIndex;
+    PRESOURCE_ALLOCATION Bars[VIRTIO_PCI_BAR_COUNT];
+    ULONG BarValue;
+    PRESOURCE_ALLOCATION LineAllocation;
+    KSTATUS Status;
+
+    if (Device->PciConfigInterfaceAvailable == FALSE) {
+        Status = STATUS_NOT_CONFIGURED;
+        goto StartDeviceEnd;
+    }
+
+    //
+    // Sort the allocations into interrupts and BARs. The PCI bus driver hands
+    // out one allocation per BAR, in order, with a 64-bit BAR using up two
+    // BAR slots but only one allocation.
+    //
+
+    RtlZeroMemory(Bars, sizeof(Bars));
+    BarIndex = 0;
+    Device->InterruptResourcesFound = FALSE;
+    Allocation = IoGetNextResourceAllocation(AllocationList, NULL);
+    while (Allocation != NULL) {
+        if (Allocation->Type == ResourceTypeInterruptVector) {
+
+            ASSERT(Device->InterruptResourcesFound == FALSE);
+            ASSERT(Allocation->OwningAllocation != NULL);
+
+            LineAllocation = Allocation->OwningAllocation;
+            Device->InterruptLine = LineAllocation->Allocation;
+            Device->InterruptVector = Allocation->Allocation;
+            Device->InterruptResourcesFound = TRUE;
+
+        } else if (((Allocation->Type == ResourceTypeIoPort) ||
+                    (Allocation->Type == ResourceTypePhysicalAddressSpace)) &&
+                   (BarIndex < VIRTIO_PCI_BAR_COUNT)) {
+
+            Bars[BarIndex] = Allocation;
+            Status = VirtiopReadPciConfig(
+                               Device,
+                               VIRTIO_PCI_BAR_OFFSET + (BarIndex * 4),
+                               sizeof(ULONG),
+                               &BarValue);
+
+            if (!KSUCCESS(Status)) {
+                goto StartDeviceEnd;
+            }
+
+            BarIndex += 1;
+            if (((BarValue & VIRTIO_PCI_BAR_IO_SPACE) == 0) &&
+                ((BarValue & VIRTIO_PCI_BAR_MEMORY_SIZE_MASK) ==
+                 VIRTIO_PCI_BAR_MEMORY_64_BIT)) {
+
+                BarIndex += 1;
+            }
+        }
+
+        Allocation = IoGetNextResourceAllocation(AllocationList, Allocation);
+    }
+
+    //
+    // Find the registers if this is the first time through.
+    //
+
+    if (Device->Common.Length == 0) {
+        Status = VirtiopFindModernRegions(Device, Bars);
+        if (KSUCCESS(Status)) {
+            Device->Modern = TRUE;
+
+        } else if (Status == STATUS_NOT_FOUND) {
+
+            //
+            // Legacy devices have a single register block in I/O space at
+            // BAR 0, with the device configuration following the common
+            // registers.
+            //
+
+            Allocation = Bars[0];
+            if ((Allocation == NULL) ||
+                (Allocation->Type != ResourceTypeIoPort) ||
+                (Allocation->Length <= VIRTIO_LEGACY_DEVICE_CONFIGURATION)) {
+
+                Status = STATUS_INVALID_CONFIGURATION;
+                goto StartDeviceEnd;
+            }
+
+            Device->Modern = FALSE;
+            Device->Common.IoSpace = TRUE;
+            Device->Common.IoPort = (USHORT)(Allocation->Allocation);
+            Device->Common.Length = VIRTIO_LEGACY_DEVICE_CONFIGURATION;
+            Device->Notify.IoSpace = TRUE;
+            Device->Notify.IoPort = Device->Common.IoPort +
+                                    VirtioLegacyQueueNotify;
+
+            Device->Notify.Length = sizeof(USHORT);
+            Device->NotifyMultiplier = 0;
+            Device->Isr.IoSpace = TRUE;
+            Device->Isr.IoPort = Device->Common.IoPort + VirtioLegacyIsrStatus;
+            Device->Isr.Length = sizeof(UCHAR);
+            Device->DeviceConfiguration.IoSpace = TRUE;
+            Device->DeviceConfiguration.IoPort =
+                      Device->Common.IoPort + VIRTIO_LEGACY_DEVICE_CONFIGURATION;
+
+            Device->DeviceConfiguration.Length =
+                      Allocation->Length - VIRTIO_LEGACY_DEVICE_CONFIGURATION;
+
+        } else {
+            goto StartDeviceEnd;
+        }
+    }
+
+    Status = VirtiopResetDevice(Device);
+    if (!KSUCCESS(Status)) {
+        goto StartDeviceEnd;
+    }
+
+    VirtiopSetStatus(Device,
+                     VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+StartDeviceEnd:
+    return Status;
+}
+
+VIRTIO_API
+KSTATUS
+VirtioNegotiateFeatures (
+    PVIRTIO_DEVICE Device,
+    ULONGLONG DriverFeatures,
+    PULONGLONG AcceptedFeatures
+    )
+
+/*++
+
+Routine Description:
+
+    This routine negotiates the feature set with the device. The transport
+    and ring features the core library implements are added automatically.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    DriverFeatures - Supplies the device specific features the driver would
+        like to use.
+
+    AcceptedFeatures - Supplies a pointer where the negotiated features will be
+        returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_SUPPORTED if the device rejected the feature set.
+
+--*/
+
+{
+
+    ULONGLONG DeviceFeatures;
+    ULONGLONG Features;
+    KSTATUS Status;
+
+    DeviceFeatures = VirtiopGetDeviceFeatures(Device);
+    Features = DriverFeatures | VIRTIO_FEATURE_EVENT_INDEX;
+    if (Device->Modern != FALSE) {
+
+        //
+        // A modern interface without the version 1 feature is not something
+        // this library knows how to talk to.
+        //
+
+        if ((DeviceFeatures & VIRTIO_FEATURE_VERSION_1) == 0) {
+            Status = STATUS_NOT_SUPPORTED;
+            goto NegotiateFeaturesEnd;
+        }
+
+        //
+        // Buffers are described by physical address, which is exactly what a
+        // platform without an IOMMU in front of the device expects.
+        //
+
+        Features |= VIRTIO_FEATURE_VERSION_1 | VIRTIO_FEATURE_ACCESS_PLATFORM;
+
+    } else {
+        Features &= MAX_ULONG;
+    }
+
+    Features &= DeviceFeatures;
+    Status = VirtiopSetDriverFeatures(Device, Features);
+    if (!KSUCCESS(Status)) {
+        goto NegotiateFeaturesEnd;
+    }
+
+    Device->Features = Features;
+
+NegotiateFeaturesEnd:
+    if (!KSUCCESS(Status)) {
+        VirtiopSetStatus(Device,
+                         VirtiopGetStatus(Device) | VIRTIO_STATUS_FAILED);
+
+        Features = 0;
+    }
+
+    *AcceptedFeatures = Features;
+    return Status;
+}
+
+VIRTIO_API
+KSTATUS
+VirtioReadDeviceConfiguration (
+    PVIRTIO_DEVICE Device,
+    ULONG Offset,
+    PVOID Buffer,
+    ULONG Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads from the device specific configuration space. The read
+    is retried if the device changes the configuration midway through.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    Offset - Supplies the offset within the device configuration to read.
+
+    Buffer - Supplies a pointer where the data will be returned.
+
+    Size - Supplies the number of bytes to read.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PUCHAR Bytes;
+    ULONG Current;
+    UCHAR Generation;
+    UCHAR NewGeneration;
+    PVIRTIO_REGION Region;
+    ULONG Value;
+
+    Region = &(Device->DeviceConfiguration);
+    if ((Offset >= Region->Length) || (Size > Region->Length - Offset)) {
+        return STATUS_OUT_OF_BOUNDS;
+    }
+
+    Bytes = Buffer;
+    Generation = 0;
+    do {
+        if (Device->Modern != FALSE) {
+            Generation = VirtiopRead8(&(Device->Common),
+                                      VirtioCommonConfigurationGeneration);
+        }
+
+        //
+        // Use the widest naturally aligned accesses possible, as some fields
+        // are only guaranteed to read atomically that way.
+        //
+
+        Current = 0;
+        while (Current < Size) {
+            if (((Offset + Current) % sizeof(ULONG) == 0) &&
+                (Size - Current >= sizeof(ULONG))) {
+
+                Value = VirtiopRead32(Region, Offset + Current);
+                RtlCopyMemory(Bytes + Current, &Value, sizeof(ULONG));
+                Current += sizeof(ULONG);
+
+            } else if (((Offset + Current) % sizeof(USHORT) == 0) &&
+                       (Size - Current >= sizeof(USHORT))) {
+
+                Value = VirtiopRead16(Region, Offset + Current);
+                *((PUSHORT)(Bytes + Current)) = (USHORT)Value;
+                Current += sizeof(USHORT);
+
+            } else {
+                Bytes[Current] = VirtiopRead8(Region, Offset + Current);
+                Current += 1;
+            }
+        }
+
+        NewGeneration = Generation;
+        if (Device->Modern != FALSE) {
+            NewGeneration = VirtiopRead8(&(Device->Common),
+                                         VirtioCommonConfigurationGeneration);
+        }
+
+    } while (NewGeneration != Generation);
+
+    return STATUS_SUCCESS;
+}
+
+VIRTIO_API
+KSTATUS
+VirtioCreateQueue (
+    PVIRTIO_DEVICE Device,
+    USHORT Index,
+    USHORT MaxSize,
+    PVIRTIO_QUEUE *Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates and programs a virtqueue. Features must have been
+    negotiated first. The queue starts with interrupts enabled.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    Index - Supplies the index of the queue on the device.
+
+    MaxSize - Supplies the maximum number of descriptors the caller wants in
+        the queue. Modern devices are given the smaller of this and their own
+        maximum. Legacy devices dictate the size themselves.
+
+    Queue - Supplies a pointer where a pointer to the queue will be returned.
+        The queue is destroyed along with the device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    UINTN AvailableOffset;
+    PVOID Base;
+    USHORT DeviceSize;
+    PIO_BUFFER IoBuffer;
+    PHYSICAL_ADDRESS MaxAddress;
+    PVIRTIO_QUEUE NewQueue;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    USHORT Size;
+    KSTATUS Status;
+    UINTN UsedOffset;
+
+    NewQueue = NULL;
+    if ((Index >= VIRTIO_MAX_QUEUES) || (Device->Queues[Index] != NULL) ||
+        (MaxSize == 0)) {
+
+        Status = STATUS_INVALID_PARAMETER;
+        goto CreateQueueEnd;
+    }
+
+    if (Device->Modern != FALSE) {
+        VirtiopWrite16(&(Device->Common), VirtioCommonQueueSelect, Index);
+        DeviceSize = VirtiopRead16(&(Device->Common), VirtioCommonQueueSize);
+
+    } else {
+        VirtiopWrite16(&(Device->Common), VirtioLegacyQueueSelect, Index);
+        DeviceSize = VirtiopRead16(&(Device->Common), VirtioLegacyQueueSize);
+    }
+
+    if (DeviceSize == 0) {
+        Status = STATUS_NOT_SUPPORTED;
+        goto CreateQueueEnd;
+    }
+
+    //
+    // Modern devices accept any power of two up to their maximum. Legacy
+    // devices have no say in the matter.
+    //
+
+    Size = DeviceSize;
+    if (Device->Modern != FALSE) {
+        if (Size > MaxSize) {
+            Size = MaxSize;
+        }
+
+        if (Size > VIRTIO_MAX_QUEUE_SIZE) {
+            Size = VIRTIO_MAX_QUEUE_SIZE;
+        }
+
+        while ((Size & (Size - 1)) != 0) {
+            Size &= Size - 1;
+        }
+
+        MaxAddress = MAX_ULONGLONG;
+
+    } else {
+        if ((Size > VIRTIO_MAX_QUEUE_SIZE) || ((Size & (Size - 1)) != 0)) {
+            Status = STATUS_NOT_SUPPORTED;
+            goto CreateQueueEnd;
+        }
+
+        //
+        // The legacy queue address register holds a 32-bit page frame number.
+        //
+
+        MaxAddress = ((ULONGLONG)MAX_ULONG <<
+                      VIRTIO_LEGACY_QUEUE_ADDRESS_SHIFT) |
+                     (VIRTIO_LEGACY_QUEUE_ALIGNMENT - 1);
+    }
+
+    NewQueue = MmAllocateNonPagedPool(sizeof(VIRTIO_QUEUE),
+                                      VIRTIO_ALLOCATION_TAG);
+
+    if (NewQueue == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateQueueEnd;
+    }
+
+    RtlZeroMemory(NewQueue, sizeof(VIRTIO_QUEUE));
+    NewQueue->Device = Device;
+    NewQueue->Index = Index;
+    NewQueue->Size = Size;
+    NewQueue->Cookies = MmAllocateNonPagedPool(sizeof(PVOID) * Size,
+                                               VIRTIO_ALLOCATION_TAG);
+
+    if (NewQueue->Cookies == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateQueueEnd;
+    }
+
+    //
+    // Lay the queue out the way legacy devices demand, which suits modern
+    // devices just as well: descriptors, then the available ring, then the
+    // used ring on the next page.
+    //
+
+    AvailableOffset = VIRTQ_DESCRIPTORS_SIZE(Size);
+    UsedOffset = ALIGN_RANGE_UP(AvailableOffset + VIRTQ_AVAILABLE_SIZE(Size),
+                                VIRTIO_LEGACY_QUEUE_ALIGNMENT);
+
+    AllocationSize = ALIGN_RANGE_UP(UsedOffset + VIRTQ_USED_SIZE(Size),
+                                    MmPageSize());
+
+    IoBuffer = MmAllocateNonPagedIoBuffer(0,
+                                          MaxAddress,
+                                          VIRTIO_LEGACY_QUEUE_ALIGNMENT,
+                                          AllocationSize,
+                                          IO_BUFFER_FLAG_PHYSICALLY_CONTIGUOUS);
+
+    if (IoBuffer == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateQueueEnd;
+    }
+
+    ASSERT(IoBuffer->FragmentCount == 1);
+
+    NewQueue->IoBuffer = IoBuffer;
+    Base = IoBuffer->Fragment[0].VirtualAddress;
+    PhysicalAddress = IoBuffer->Fragment[0].PhysicalAddress;
+    NewQueue->Descriptors = Base;
+    NewQueue->Available = Base + AvailableOffset;
+    NewQueue->Used = Base + UsedOffset;
+
+    //
+    // The event indices trail each ring. Compute their addresses from the
+    // ring base, as taking the address of a packed member is not allowed.
+    //
+
+    NewQueue->UsedEvent = (volatile USHORT *)(Base + AvailableOffset +
+                                         FIELD_OFFSET(VIRTQ_AVAILABLE, Ring) +
+                                         (Size * sizeof(USHORT)));
+
+    NewQueue->AvailableEvent = (volatile USHORT *)(Base + UsedOffset +
+                                         FIELD_OFFSET(VIRTQ_USED, Ring) +
+                                         (Size * sizeof(VIRTQ_USED_ELEMENT)));
+
+    NewQueue->DescriptorsPhysical = PhysicalAddress;
+    NewQueue->AvailablePhysical = PhysicalAddress + AvailableOffset;
+    NewQueue->UsedPhysical = PhysicalAddress + UsedOffset;
+    VirtiopInitializeQueueState(NewQueue);
+    Status = VirtiopProgramQueue(NewQueue);
+    if (!KSUCCESS(Status)) {
+        goto CreateQueueEnd;
+    }
+
+    Device->Queues[Index] = NewQueue;
+
+CreateQueueEnd:
+    if (!KSUCCESS(Status)) {
+        if (NewQueue != NULL) {
+            if (NewQueue->IoBuffer != NULL) {
+                MmFreeIoBuffer(NewQueue->IoBuffer);
+            }
+
+            if (NewQueue->Cookies != NULL) {
+                MmFreeNonPagedPool(NewQueue->Cookies);
+            }
+
+            MmFreeNonPagedPool(NewQueue);
+            NewQueue = NULL;
+        }
+    }
+
+    *Queue = NewQueue;
+    return Status;
+}
+
+VIRTIO_API
+KSTATUS
+VirtioSetDriverReady (
+    PVIRTIO_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tells the device that the driver has finished setting it up,
+    after which the device may start using its queues.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_DEVICE_IO_ERROR if the device has given up.
+
+--*/
+
+{
+
+    UCHAR Status;
+
+    Status = VirtiopGetStatus(Device);
+    VirtiopSetStatus(Device, Status | VIRTIO_STATUS_DRIVER_OK);
+    Status = VirtiopGetStatus(Device);
+    if ((Status & VIRTIO_STATUS_DEVICE_NEEDS_RESET) != 0) {
+        return STATUS_DEVICE_IO_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VIRTIO_API
+KSTATUS
+VirtioReinitializeDevice (
+    PVIRTIO_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets the device and brings it back up with the same
+    features and queues, discarding anything that was in flight. It neither
+    allocates memory nor acquires locks, so it is suitable for use at high
+    run level when preparing for a crash dump.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Index;
+    PVIRTIO_QUEUE Queue;
+    KSTATUS Status;
+
+    Status = VirtiopResetDevice(Device);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    VirtiopSetStatus(Device,
+                     VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    Status = VirtiopSetDriverFeatures(Device, Device->Features);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    for (Index = 0; Index < VIRTIO_MAX_QUEUES; Index += 1) {
+        Queue = Device->Queues[Index];
+        if (Queue == NULL) {
+            continue;
+        }
+
+        VirtiopInitializeQueueState(Queue);
+        Status = VirtiopProgramQueue(Queue);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
+    return VirtioSetDriverReady(Device);
+}
+
+VIRTIO_API
+KSTATUS
+VirtioConnectInterrupt (
+    PVIRTIO_DEVICE Device,
+    PINTERRUPT_SERVICE_ROUTINE DispatchServiceRoutine,
+    PINTERRUPT_SERVICE_ROUTINE LowLevelServiceRoutine,
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine connects the device's interrupt. The core library services
+    the interrupt itself and then runs the given routine at dispatch or low
+    level, which should collect the reasons with
+    VirtioGetPendingInterrupts.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    DispatchServiceRoutine - Supplies an optional routine to run at dispatch
+        level after an interrupt.
+
+    LowLevelServiceRoutine - Supplies an optional routine to run at low level
+        after an interrupt.
+
+    Context - Supplies the context passed to the service routine.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    IO_CONNECT_INTERRUPT_PARAMETERS Connect;
+
+    if (Device->InterruptResourcesFound == FALSE) {
+        return STATUS_INVALID_CONFIGURATION;
+    }
+
+    if (Device->InterruptHandle != INVALID_HANDLE) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // The interrupt status register is read-to-clear, so the core's own
+    // service routine has to be the one to read it. The driver's routines are
+    // called from wrappers that pass along the driver's context.
+    //
+
+    Device->DispatchServiceRoutine = DispatchServiceRoutine;
+    Device->LowLevelServiceRoutine = LowLevelServiceRoutine;
+    Device->InterruptContext = Context;
+    RtlZeroMemory(&Connect, sizeof(IO_CONNECT_INTERRUPT_PARAMETERS));
+    Connect.Version = IO_CONNECT_INTERRUPT_PARAMETERS_VERSION;
+    Connect.Device = Device->OsDevice;
+    Connect.LineNumber = Device->InterruptLine;
+    Connect.Vector = Device->InterruptVector;
+    Connect.InterruptServiceRoutine = VirtiopInterruptService;
+    if (DispatchServiceRoutine != NULL) {
+        Connect.DispatchServiceRoutine = VirtiopDispatchService;
+    }
+
+    if (LowLevelServiceRoutine != NULL) {
+        Connect.LowLevelServiceRoutine = VirtiopLowLevelService;
+    }
+
+    Connect.Context = Device;
+    Connect.Interrupt = &(Device->InterruptHandle);
+    return IoConnectInterrupt(&Connect);
+}
+
+VIRTIO_API
+ULONG
+VirtioGetPendingInterrupts (
+    PVIRTIO_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine collects and clears the interrupt reasons gathered since the
+    last call.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+Return Value:
+
+    Returns a bitmask of VIRTIO_INTERRUPT_* values.
+
+--*/
+
+{
+
+    return RtlAtomicExchange32(&(Device->PendingInterrupts), 0);
+}
+
+UCHAR
+VirtiopRead8 (
+    PVIRTIO_REGION Region,
+    ULONG Offset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads a byte from a virtio register region.
+
+Arguments:
+
+    Region - Supplies a pointer to the region.
+
+    Offset - Supplies the offset within the region to read.
+
+Return Value:
+
+    Returns the value read.
+
+--*/
+
+{
+
+    if (Region->IoSpace != FALSE) {
+        return HlIoPortInByte(Region->IoPort + Offset);
+    }
+
+    return HlReadRegister8(Region->Base + Offset);
+}
+
+USHORT
+VirtiopRead16 (
+    PVIRTIO_REGION Region,
+    ULONG Offset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads a 16-bit value from a virtio register region.
+
+Arguments:
+
+    Region - Supplies a pointer to the region.
+
+    Offset - Supplies the offset within the region to read.
+
+Return Value:
+
+    Returns the value read.
+
+--*/
+
+{
+
+    if (Region->IoSpace != FALSE) {
+        return HlIoPortInShort(Region->IoPort + Offset);
+    }
+
+    return HlReadRegister16(Region->Base + Offset);
+}
+
+ULONG
+VirtiopRead32 (
+    PVIRTIO_REGION Region,
+    ULONG Offset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads a 32-bit value from a virtio register region.
+
+Arguments:
+
+    Region - Supplies a pointer to the region.
+
+    Offset - Supplies the offset within the region to read.
+
+Return Value:
+
+    Returns the value read.
+
+--*/
+
+{
+
+    if (Region->IoSpace != FALSE) {
+        return HlIoPortInLong(Region->IoPort + Offset);
+    }
+
+    return HlReadRegister32(Region->Base + Offset);
+}
+
+VOID
+VirtiopWrite8 (
+    PVIRTIO_REGION Region,
+    ULONG Offset,
+    UCHAR Value
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes a byte to a virtio register region.
+
+Arguments:
+
+    Region - Supplies a pointer to the region.
+
+    Offset - Supplies the offset within the region to write.
+
+    Value - Supplies the value to write.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Region->IoSpace != FALSE) {
+        HlIoPortOutByte(Region->IoPort + Offset, Value);
+
+    } else {
+        HlWriteRegister8(Region->Base + Offset, Value);
+    }
+
+    return;
+}
+
+VOID
+VirtiopWrite16 (
+    PVIRTIO_REGION Region,
+    ULONG Offset,
+    USHORT Value
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes a 16-bit value to a virtio register region.
+
+Arguments:
+
+    Region - Supplies a pointer to the region.
+
+    Offset - Supplies the offset within the region to write.
+
+    Value - Supplies the value to write.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Region->IoSpace != FALSE) {
+        HlIoPortOutShort(Region->IoPort + Offset, Value);
+
+    } else {
+        HlWriteRegister16(Region->Base + Offset, Value);
+    }
+
+    return;
+}
+
+VOID
+VirtiopWrite32 (
+    PVIRTIO_REGION Region,
+    ULONG Offset,
+    ULONG Value
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes a 32-bit value to a virtio register region.
+
+Arguments:
+
+    Region - Supplies a pointer to the region.
+
+    Offset - Supplies the offset within the region to write.
+
+    Value - Supplies the value to write.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Region->IoSpace != FALSE) {
+        HlIoPortOutLong(Region->IoPort + Offset, Value);
+
+    } else {
+        HlWriteRegister32(Region->Base + Offset, Value);
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+VirtioDriverUnload (
+    PVOID Driver
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called before a driver is about to be unloaded from memory.
+    The driver should take this opportunity to free any resources it may have
+    set up in the driver entry routine.
+
+Arguments:
+
+    Driver - Supplies a pointer to the driver being torn down.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    return;
+}
+
+VOID
+VirtiopProcessPciConfigInterfaceChangeNotification (
+    PVOID Context,
+    PDEVICE Device,
+    PVOID InterfaceBuffer,
+    ULONG InterfaceBufferSize,
+    BOOL Arrival
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called when a PCI configuration space access interface
+    changes in availability.
+
+Arguments:
+
+    Context - Supplies the caller's context pointer, supplied when the caller
+        requested interface notifications.
+
+    Device - Supplies a pointer to the device exposing or deleting the
+        interface.
+
+    InterfaceBuffer - Supplies a pointer to the interface buffer of the
+        interface.
+
+    InterfaceBufferSize - Supplies the buffer size.
+
+    Arrival - Supplies TRUE if a new interface is arriving, or FALSE if an
+        interface is departing.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVIRTIO_DEVICE VirtioDevice;
+
+    VirtioDevice = (PVIRTIO_DEVICE)Context;
+    if (Arrival != FALSE) {
+        if (InterfaceBufferSize >= sizeof(INTERFACE_PCI_CONFIG_ACCESS)) {
+
+            ASSERT(VirtioDevice->PciConfigInterfaceAvailable == FALSE);
+
+            RtlCopyMemory(&(VirtioDevice->PciConfigInterface),
+                          InterfaceBuffer,
+                          sizeof(INTERFACE_PCI_CONFIG_ACCESS));
+
+            VirtioDevice->PciConfigInterfaceAvailable = TRUE;
+        }
+
+    } else {
+        VirtioDevice->PciConfigInterfaceAvailable = FALSE;
+    }
+
+    return;
+}
+
+KSTATUS
+VirtiopReadPciConfig (
+    PVIRTIO_DEVICE Device,
+    ULONG Offset,
+    ULONG AccessSize,
+    PULONG Value
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads from the device's PCI configuration space.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    Offset - Supplies the offset within configuration space to read.
+
+    AccessSize - Supplies the size of the access in bytes.
+
+    Value - Supplies a pointer where the value read will be returned.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONGLONG LongValue;
+    KSTATUS Status;
+
+    if (Device->PciConfigInterfaceAvailable == FALSE) {
+        return STATUS_NOT_CONFIGURED;
+    }
+
+    Status = Device->PciConfigInterface.ReadPciConfig(
+                                        Device->PciConfigInterface.DeviceToken,
+                                        Offset,
+                                        AccessSize,
+                                        &LongValue);
+
+    *Value = (ULONG)LongValue;
+    return Status;
+}
+
+KSTATUS
+VirtiopFindModernRegions (
+    PVIRTIO_DEVICE Device,
+    PRESOURCE_ALLOCATION *Bars
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks the device's PCI capabilities looking for the virtio
+    structures that describe where the modern registers live, and maps them.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    Bars - Supplies the array of resource allocations for each BAR.
+
+Return Value:
+
+    STATUS_SUCCESS if the modern registers were found and mapped.
+
+    STATUS_NOT_FOUND if the device only has the legacy interface.
+
+    Other errors on failure.
+
+--*/
+
+{
+
+    ULONG Bar;
+    ULONG CapabilityCount;
+    ULONG CapabilityId;
+    ULONG CapabilityLength;
+    ULONG Length;
+    ULONG Offset;
+    ULONG Pointer;
+    PVIRTIO_REGION Region;
+    KSTATUS Status;
+    ULONG Type;
+    ULONG Value;
+
+    Status = VirtiopReadPciConfig(Device,
+                                 VIRTIO_PCI_STATUS_OFFSET,
+                                 sizeof(USHORT),
+                                 &Value);
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    if ((Value & VIRTIO_PCI_STATUS_CAPABILITIES_LIST) == 0) {
+        return STATUS_NOT_FOUND;
+    }
+
+    Status = VirtiopReadPciConfig(Device,
+                                  VIRTIO_PCI_CAPABILITIES_POINTER_OFFSET,
+                                  sizeof(UCHAR),
+                                  &Pointer);
+
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    CapabilityCount = 0;
+    Pointer &= VIRTIO_PCI_CAPABILITY_POINTER_MASK;
+    while ((Pointer != 0) &&
+           (CapabilityCount < VIRTIO_PCI_MAX_CAPABILITIES)) {
+
+        CapabilityCount += 1;
+        Status = VirtiopReadPciConfig(Device,
+                                      Pointer + VIRTIO_PCI_CAP_ID,
+                                      sizeof(UCHAR),
+                                      &CapabilityId);
+
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        if (CapabilityId != VIRTIO_PCI_CAPABILITY_VENDOR_SPECIFIC) {
+            goto NextCapability;
+        }
+
+        Status = VirtiopReadPciConfig(Device,
+                                      Pointer + VIRTIO_PCI_CAP_LENGTH,
+                                      sizeof(UCHAR),
+                                      &CapabilityLength);
+
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        if (CapabilityLength < VIRTIO_PCI_CAP_MIN_LENGTH) {
+            goto NextCapability;
+        }
+
+        Status = VirtiopReadPciConfig(Device,
+                                      Pointer + VIRTIO_PCI_CAP_TYPE,
+                                      sizeof(UCHAR),
+                                      &Type);
+
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        switch (Type) {
+        case VIRTIO_PCI_CAP_COMMON_CONFIGURATION:
+            Region = &(Device->Common);
+            break;
+
+        case VIRTIO_PCI_CAP_NOTIFY_CONFIGURATION:
+            Region = &(Device->Notify);
+            break;
+
+        case VIRTIO_PCI_CAP_ISR_CONFIGURATION:
+            Region = &(Device->Isr);
+            break;
+
+        case VIRTIO_PCI_CAP_DEVICE_CONFIGURATION:
+            Region = &(Device->DeviceConfiguration);
+            break;
+
+        default:
+            Region = NULL;
+            break;
+        }
+
+        //
+        // The device may offer the same structure more than once, in order of
+        // preference. Take the first one.
+        //
+
+        if ((Region == NULL) || (Region->Length != 0)) {
+            goto NextCapability;
+        }
+
+        Status = VirtiopReadPciConfig(Device,
+                                      Pointer + VIRTIO_PCI_CAP_BAR,
+                                      sizeof(UCHAR),
+                                      &Bar);
+
+        if (KSUCCESS(Status)) {
+            Status = VirtiopReadPciConfig(Device,
+                                          Pointer + VIRTIO_PCI_CAP_OFFSET,
+                                          sizeof(ULONG),
+                                          &Offset);
+        }
+
+        if (KSUCCESS(Status)) {
+            Status = VirtiopReadPciConfig(
+                                      Device,
+                                      Pointer + VIRTIO_PCI_CAP_REGION_LENGTH,
+                                      sizeof(ULONG),
+                                      &Length);
+        }
+
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        if ((Type == VIRTIO_PCI_CAP_NOTIFY_CONFIGURATION) &&
+            (CapabilityLength >= VIRTIO_PCI_CAP_NOTIFY_MULTIPLIER +
+                                 sizeof(ULONG))) {
+
+            Status = VirtiopReadPciConfig(
+                                  Device,
+                                  Pointer + VIRTIO_PCI_CAP_NOTIFY_MULTIPLIER,
+                                  sizeof(ULONG),
+                                  &(Device->NotifyMultiplier));
+
+            if (!KSUCCESS(Status)) {
+                return Status;
+            }
+        }
+
+        //
+        // Skip structures that point at BARs that are not there rather than
+        // failing, as there may be a later duplicate that works.
+        //
+
+        if ((Bar < VIRTIO_PCI_BAR_COUNT) && (Bars[Bar] != NULL) &&
+            (Length != 0)) {
+
+            Status = VirtiopMapRegion(Device, Bars, Bar, Offset, Length, Region);
+            if (!KSUCCESS(Status)) {
+                return Status;
+            }
+        }
+
+NextCapability:
+        Status = VirtiopReadPciConfig(Device,
+                                      Pointer + VIRTIO_PCI_CAP_NEXT,
+                                      sizeof(UCHAR),
+                                      &Pointer);
+
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+
+        Pointer &= VIRTIO_PCI_CAPABILITY_POINTER_MASK;
+    }
+
+    //
+    // All but the device configuration are required for the modern
+    // interface. Without them, fall back to legacy.
+    //
+
+    if ((Device->Common.Length == 0) || (Device->Notify.Length == 0) ||
+        (Device->Isr.Length == 0)) {
+
+        RtlZeroMemory(&(Device->Common), sizeof(VIRTIO_REGION));
+        RtlZeroMemory(&(Device->Notify), sizeof(VIRTIO_REGION));
+        RtlZeroMemory(&(Device->Isr), sizeof(VIRTIO_REGION));
+        RtlZeroMemory(&(Device->DeviceConfiguration), sizeof(VIRTIO_REGION));
+        return STATUS_NOT_FOUND;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+VirtiopMapRegion (
+    PVIRTIO_DEVICE Device,
+    PRESOURCE_ALLOCATION *Bars,
+    ULONG BarIndex,
+    ULONG Offset,
+    ULONG Length,
+    PVIRTIO_REGION Region
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets up a register region that lives within one of the
+    device's BARs, mapping the BAR if it is in memory space.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    Bars - Supplies the array of resource allocations for each BAR.
+
+    BarIndex - Supplies the index of the BAR the region lives in.
+
+    Offset - Supplies the offset of the region within the BAR.
+
+    Length - Supplies the length of the region.
+
+    Region - Supplies a pointer to the region to fill in.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG AlignmentOffset;
+    PRESOURCE_ALLOCATION Allocation;
+    PHYSICAL_ADDRESS EndAddress;
+    PVOID Mapping;
+    ULONG PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN Size;
+
+    Allocation = Bars[BarIndex];
+    if ((Offset >= Allocation->Length) ||
+        (Length > Allocation->Length - Offset)) {
+
+        return STATUS_INVALID_CONFIGURATION;
+    }
+
+    RtlZeroMemory(Region, sizeof(VIRTIO_REGION));
+    if (Allocation->Type == ResourceTypeIoPort) {
+        Region->IoSpace = TRUE;
+        Region->IoPort = (USHORT)(Allocation->Allocation + Offset);
+        Region->Length = Length;
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Map the whole BAR once, since several regions usually share one.
+    //
+
+    if (Device->BarMappings[BarIndex] == NULL) {
+        PageSize = MmPageSize();
+        PhysicalAddress = Allocation->Allocation;
+        EndAddress = PhysicalAddress + Allocation->Length;
+        PhysicalAddress = ALIGN_RANGE_DOWN(PhysicalAddress, PageSize);
+        AlignmentOffset = Allocation->Allocation - PhysicalAddress;
+        EndAddress = ALIGN_RANGE_UP(EndAddress, PageSize);
+        Size = (UINTN)(EndAddress - PhysicalAddress);
+        Mapping = MmMapPhysicalAddress(PhysicalAddress,
+                                       Size,
+                                       TRUE,
+                                       FALSE,
+                                       TRUE);
+
+        if (Mapping == NULL) {
+            return STATUS_NO_MEMORY;
+        }
+
+        Device->BarMappings[BarIndex] = Mapping;
+        Device->BarMappingSizes[BarIndex] = Size;
+
+    } else {
+        PhysicalAddress = ALIGN_RANGE_DOWN(Allocation->Allocation,
+                                           MmPageSize());
+
+        AlignmentOffset = Allocation->Allocation - PhysicalAddress;
+    }
+
+    Region->Base = Device->BarMappings[BarIndex] + AlignmentOffset + Offset;
+    Region->Length = Length;
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+VirtiopResetDevice (
+    PVIRTIO_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets the device and waits for the reset to finish.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_TIMEOUT if the device never finished resetting.
+
+--*/
+
+{
+
+    ULONG Waited;
+
+    VirtiopSetStatus(Device, 0);
+    Waited = 0;
+    while (VirtiopGetStatus(Device) != 0) {
+        if (Waited >= VIRTIO_RESET_TIMEOUT) {
+            return STATUS_TIMEOUT;
+        }
+
+        HlBusySpin(VIRTIO_RESET_POLL_INTERVAL);
+        Waited += VIRTIO_RESET_POLL_INTERVAL;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+UCHAR
+VirtiopGetStatus (
+    PVIRTIO_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the device status register.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+Return Value:
+
+    Returns the device status. See VIRTIO_STATUS_* definitions.
+
+--*/
+
+{
+
+    if (Device->Modern != FALSE) {
+        return VirtiopRead8(&(Device->Common), VirtioCommonDeviceStatus);
+    }
+
+    return VirtiopRead8(&(Device->Common), VirtioLegacyDeviceStatus);
+}
+
+VOID
+VirtiopSetStatus (
+    PVIRTIO_DEVICE Device,
+    UCHAR Status
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes the device status register.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    Status - Supplies the new status. See VIRTIO_STATUS_* definitions.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Device->Modern != FALSE) {
+        VirtiopWrite8(&(Device->Common), VirtioCommonDeviceStatus, Status);
+
+    } else {
+        VirtiopWrite8(&(Device->Common), VirtioLegacyDeviceStatus, Status);
+    }
+
+    return;
+}
+
+ULONGLONG
+VirtiopGetDeviceFeatures (
+    PVIRTIO_DEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the features the device offers.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+Return Value:
+
+    Returns the device's feature bits.
+
+--*/
+
+{
+
+    ULONGLONG Features;
+
+    if (Device->Modern == FALSE) {
+        return VirtiopRead32(&(Device->Common), VirtioLegacyDeviceFeatures);
+    }
+
+    VirtiopWrite32(&(Device->Common), VirtioCommonDeviceFeatureSelect, 1);
+    Features = VirtiopRead32(&(Device->Common), VirtioCommonDeviceFeature);
+    Features <<= 32;
+    VirtiopWrite32(&(Device->Common), VirtioCommonDeviceFeatureSelect, 0);
+    Features |= VirtiopRead32(&(Device->Common), VirtioCommonDeviceFeature);
+    return Features;
+}
+
+KSTATUS
+VirtiopSetDriverFeatures (
+    PVIRTIO_DEVICE Device,
+    ULONGLONG Features
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes the features the driver accepts and, on modern
+    devices, makes sure the device is happy with them.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    Features - Supplies the features to accept.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_SUPPORTED if the device rejected the features.
+
+--*/
+
+{
+
+    UCHAR Status;
+
+    if (Device->Modern == FALSE) {
+        VirtiopWrite32(&(Device->Common),
+                       VirtioLegacyDriverFeatures,
+                       (ULONG)Features);
+
+        return STATUS_SUCCESS;
+    }
+
+    VirtiopWrite32(&(Device->Common), VirtioCommonDriverFeatureSelect, 0);
+    VirtiopWrite32(&(Device->Common),
+                   VirtioCommonDriverFeature,
+                   (ULONG)Features);
+
+    VirtiopWrite32(&(Device->Common), VirtioCommonDriverFeatureSelect, 1);
+    VirtiopWrite32(&(Device->Common),
+                   VirtioCommonDriverFeature,
+                   (ULONG)(Features >> 32));
+
+    Status = VirtiopGetStatus(Device);
+    VirtiopSetStatus(Device, Status | VIRTIO_STATUS_FEATURES_OK);
+    Status = VirtiopGetStatus(Device);
+    if ((Status & VIRTIO_STATUS_FEATURES_OK) == 0) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+VirtiopProgramQueue (
+    PVIRTIO_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tells the device where a queue's rings live and enables it.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PVIRTIO_REGION Common;
+    PVIRTIO_DEVICE Device;
+    ULONG NotifyOffset;
+
+    Device = Queue->Device;
+    Common = &(Device->Common);
+    if (Device->Modern == FALSE) {
+        VirtiopWrite16(Common, VirtioLegacyQueueSelect, Queue->Index);
+        VirtiopWrite32(Common,
+                       VirtioLegacyQueueAddress,
+                       (ULONG)(Queue->DescriptorsPhysical >>
+                               VIRTIO_LEGACY_QUEUE_ADDRESS_SHIFT));
+
+        Queue->NotifyOffset = 0;
+        return STATUS_SUCCESS;
+    }
+
+    VirtiopWrite16(Common, VirtioCommonQueueSelect, Queue->Index);
+    VirtiopWrite16(Common, VirtioCommonQueueSize, Queue->Size);
+    VirtiopWrite32(Common,
+                   VirtioCommonQueueDescriptorLow,
+                   (ULONG)(Queue->DescriptorsPhysical));
+
+    VirtiopWrite32(Common,
+                   VirtioCommonQueueDescriptorHigh,
+                   (ULONG)(Queue->DescriptorsPhysical >> 32));
+
+    VirtiopWrite32(Common,
+                   VirtioCommonQueueDriverLow,
+                   (ULONG)(Queue->AvailablePhysical));
+
+    VirtiopWrite32(Common,
+                   VirtioCommonQueueDriverHigh,
+                   (ULONG)(Queue->AvailablePhysical >> 32));
+
+    VirtiopWrite32(Common,
+                   VirtioCommonQueueDeviceLow,
+                   (ULONG)(Queue->UsedPhysical));
+
+    VirtiopWrite32(Common,
+                   VirtioCommonQueueDeviceHigh,
+                   (ULONG)(Queue->UsedPhysical >> 32));
+
+    NotifyOffset = VirtiopRead16(Common, VirtioCommonQueueNotifyOffset);
+    NotifyOffset *= Device->NotifyMultiplier;
+    if ((NotifyOffset >= Device->Notify.Length) ||
+        (Device->Notify.Length - NotifyOffset < sizeof(USHORT))) {
+
+        return STATUS_INVALID_CONFIGURATION;
+    }
+
+    Queue->NotifyOffset = NotifyOffset;
+    VirtiopWrite16(Common, VirtioCommonQueueEnable, 1);
+    return STATUS_SUCCESS;
+}
+
+INTERRUPT_STATUS
+VirtiopInterruptService (
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the virtio interrupt service routine.
+
+Arguments:
+
+    Context - Supplies the context pointer given to the system when the
+        interrupt was connected. In this case, this points to the virtio
+        device.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+{
+
+    PVIRTIO_DEVICE Device;
+    ULONG Status;
+
+    Device = (PVIRTIO_DEVICE)Context;
+
+    //
+    // Reading the ISR status acknowledges the interrupt and deasserts the
+    // line.
+    //
+
+    Status = VirtiopRead8(&(Device->Isr), 0);
+    if (Status == 0) {
+        return InterruptStatusNotClaimed;
+    }
+
+    RtlAtomicOr32(&(Device->PendingInterrupts), Status);
+    return InterruptStatusClaimed;
+}
+
+INTERRUPT_STATUS
+VirtiopDispatchService (
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine calls the driver's dispatch level interrupt service routine.
+
+Arguments:
+
+    Context - Supplies a pointer to the virtio device.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+{
+
+    PVIRTIO_DEVICE Device;
+
+    Device = (PVIRTIO_DEVICE)Context;
+    return Device->DispatchServiceRoutine(Device->InterruptContext);
+}
+
+INTERRUPT_STATUS
+VirtiopLowLevelService (
+    PVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    This routine calls the driver's low level interrupt service routine.
+
+Arguments:
+
+    Context - Supplies a pointer to the virtio device.
+
+Return Value:
+
+    Interrupt status.
+
+--*/
+
+{
+
+    PVIRTIO_DEVICE Device;
+
+    Device = (PVIRTIO_DEVICE)Context;
+    return Device->LowLevelServiceRoutine(Device->InterruptContext);
+}
+
@@ -0,0 +1,694 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    virtiop.h
+
+Abstract:
+
+    This header contains internal definitions for the virtio core library.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#define VIRTIO_API __DLLEXPORT
+
+#include <minoca/intrface/pci.h>
+#include <minoca/virtio/virtio.h>
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// These macros compute the size of the pieces of a split virtqueue with the
+// given number of descriptors, including the trailing event index fields.
+//
+
+#define VIRTQ_DESCRIPTORS_SIZE(_QueueSize) \
+    (sizeof(VIRTQ_DESCRIPTOR) * (_QueueSize))
+
+#define VIRTQ_AVAILABLE_SIZE(_QueueSize) \
+    (sizeof(VIRTQ_AVAILABLE) + (sizeof(USHORT) * ((_QueueSize) + 1)))
+
+#define VIRTQ_USED_SIZE(_QueueSize) \
+    (sizeof(VIRTQ_USED) +           \
+     (sizeof(VIRTQ_USED_ELEMENT) * (_QueueSize)) + sizeof(USHORT))
+
+//
+// This macro determines whether the other side needs an event given the index
+// it asked to hear about, the new index, and the index at the last event.
+//
+
+#define VIRTQ_NEED_EVENT(_EventIndex, _NewIndex, _OldIndex)        \
+    ((USHORT)((_NewIndex) - (_EventIndex) - 1) <                   \
+     (USHORT)((_NewIndex) - (_OldIndex)))
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define VIRTIO_ALLOCATION_TAG 0x74726956 // 'triV'
+
+//
+// Define the maximum number of queues a device can have.
+//
+
+#define VIRTIO_MAX_QUEUES 8
+
+//
+// Define the maximum number of descriptors in a queue.
+//
+
+#define VIRTIO_MAX_QUEUE_SIZE 1024
+
+//
+// Define the alignment of the used ring, which is what legacy devices
+// require. Modern devices are happy with this too.
+//
+
+#define VIRTIO_LEGACY_QUEUE_ALIGNMENT 0x1000
+#define VIRTIO_LEGACY_QUEUE_ADDRESS_SHIFT 12
+
+//
+// Define how long to wait for a reset to take effect, in microseconds.
+//
+
+#define VIRTIO_RESET_TIMEOUT 1000000
+#define VIRTIO_RESET_POLL_INTERVAL 100
+
+//
+// Define the descriptor flags.
+//
+
+#define VIRTQ_DESCRIPTOR_NEXT     0x0001
+#define VIRTQ_DESCRIPTOR_WRITE    0x0002
+#define VIRTQ_DESCRIPTOR_INDIRECT 0x0004
+
+//
+// Define the available ring flags.
+//
+
+#define VIRTQ_AVAILABLE_NO_INTERRUPT 0x0001
+
+//
+// Define the used ring flags.
+//
+
+#define VIRTQ_USED_NO_NOTIFY 0x0001
+
+//
+// Define the index used to terminate the descriptor free list.
+//
+
+#define VIRTQ_END_OF_LIST 0xFFFF
+
+//
+// Define the PCI configuration space definitions needed to find the modern
+// virtio capabilities and decode the BARs.
+//
+
+#define VIRTIO_PCI_STATUS_OFFSET 0x06
+#define VIRTIO_PCI_STATUS_CAPABILITIES_LIST 0x0010
+#define VIRTIO_PCI_BAR_OFFSET 0x10
+#define VIRTIO_PCI_BAR_COUNT 6
+#define VIRTIO_PCI_BAR_IO_SPACE 0x00000001
+#define VIRTIO_PCI_BAR_MEMORY_SIZE_MASK 0x00000006
+#define VIRTIO_PCI_BAR_MEMORY_64_BIT 0x00000004
+#define VIRTIO_PCI_CAPABILITIES_POINTER_OFFSET 0x34
+#define VIRTIO_PCI_CAPABILITY_POINTER_MASK 0xFC
+#define VIRTIO_PCI_CAPABILITY_VENDOR_SPECIFIC 0x09
+#define VIRTIO_PCI_MAX_CAPABILITIES 48
+
+//
+// Define the layout of a virtio vendor specific PCI capability.
+//
+
+#define VIRTIO_PCI_CAP_ID 0x00
+#define VIRTIO_PCI_CAP_NEXT 0x01
+#define VIRTIO_PCI_CAP_LENGTH 0x02
+#define VIRTIO_PCI_CAP_TYPE 0x03
+#define VIRTIO_PCI_CAP_BAR 0x04
+#define VIRTIO_PCI_CAP_OFFSET 0x08
+#define VIRTIO_PCI_CAP_REGION_LENGTH 0x0C
+#define VIRTIO_PCI_CAP_NOTIFY_MULTIPLIER 0x10
+#define VIRTIO_PCI_CAP_MIN_LENGTH 0x10
+
+//
+// Define the modern capability types.
+//
+
+#define VIRTIO_PCI_CAP_COMMON_CONFIGURATION 1
+#define VIRTIO_PCI_CAP_NOTIFY_CONFIGURATION 2
+#define VIRTIO_PCI_CAP_ISR_CONFIGURATION 3
+#define VIRTIO_PCI_CAP_DEVICE_CONFIGURATION 4
+
+//
+// Define the offset of the device configuration in the legacy register
+// block when MSI-X is disabled.
+//
+
+#define VIRTIO_LEGACY_DEVICE_CONFIGURATION 0x14
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// Define the registers in the legacy I/O port register block.
+//
+
+typedef enum _VIRTIO_LEGACY_REGISTER {
+    VirtioLegacyDeviceFeatures = 0x00,
+    VirtioLegacyDriverFeatures = 0x04,
+    VirtioLegacyQueueAddress = 0x08,
+    VirtioLegacyQueueSize = 0x0C,
+    VirtioLegacyQueueSelect = 0x0E,
+    VirtioLegacyQueueNotify = 0x10,
+    VirtioLegacyDeviceStatus = 0x12,
+    VirtioLegacyIsrStatus = 0x13
+} VIRTIO_LEGACY_REGISTER, *PVIRTIO_LEGACY_REGISTER;
+
+//
+// Define the registers in the modern common configuration structure.
+//
+
+typedef enum _VIRTIO_COMMON_REGISTER {
+    VirtioCommonDeviceFeatureSelect = 0x00,
+    VirtioCommonDeviceFeature = 0x04,
+    VirtioCommonDriverFeatureSelect = 0x08,
+    VirtioCommonDriverFeature = 0x0C,
+    VirtioCommonMsixConfiguration = 0x10,
+    VirtioCommonQueueCount = 0x12,
+    VirtioCommonDeviceStatus = 0x14,
+    VirtioCommonConfigurationGeneration = 0x15,
+    VirtioCommonQueueSelect = 0x16,
+    VirtioCommonQueueSize = 0x18,
+    VirtioCommonQueueMsixVector = 0x1A,
+    VirtioCommonQueueEnable = 0x1C,
+    VirtioCommonQueueNotifyOffset = 0x1E,
+    VirtioCommonQueueDescriptorLow = 0x20,
+    VirtioCommonQueueDescriptorHigh = 0x24,
+    VirtioCommonQueueDriverLow = 0x28,
+    VirtioCommonQueueDriverHigh = 0x2C,
+    VirtioCommonQueueDeviceLow = 0x30,
+    VirtioCommonQueueDeviceHigh = 0x34
+} VIRTIO_COMMON_REGISTER, *PVIRTIO_COMMON_REGISTER;
+
+/*++
+
+Structure Description:
+
+    This structure defines a virtqueue descriptor.
+
+Members:
+
+    Address - Stores the physical address of the buffer.
+
+    Length - Stores the length of the buffer in bytes.
+
+    Flags - Stores a bitmask of flags. See VIRTQ_DESCRIPTOR_* definitions.
+
+    Next - Stores the index of the next descriptor in the chain if the next
+        flag is set.
+
+--*/
+
+typedef struct _VIRTQ_DESCRIPTOR {
+    ULONGLONG Address;
+    ULONG Length;
+    USHORT Flags;
+    USHORT Next;
+} PACKED VIRTQ_DESCRIPTOR, *PVIRTQ_DESCRIPTOR;
+
+/*++
+
+Structure Description:
+
+    This structure defines the header of the available ring, which the driver
+    uses to hand buffers to the device. The ring itself follows, and after
+    that the used event index.
+
+Members:
+
+    Flags - Stores a bitmask of flags. See VIRTQ_AVAILABLE_* definitions.
+
+    Index - Stores the index the driver will write the next ring entry to,
+        modulo the queue size.
+
+    Ring - Stores the array of descriptor chain heads.
+
+--*/
+
+typedef struct _VIRTQ_AVAILABLE {
+    USHORT Flags;
+    USHORT Index;
+    USHORT Ring[ANYSIZE_ARRAY];
+} PACKED VIRTQ_AVAILABLE, *PVIRTQ_AVAILABLE;
+
+/*++
+
+Structure Description:
+
+    This structure defines an entry in the used ring.
+
+Members:
+
+    Id - Stores the index of the head of the descriptor chain that was used.
+
+    Length - Stores the number of bytes the device wrote into the chain.
+
+--*/
+
+typedef struct _VIRTQ_USED_ELEMENT {
+    ULONG Id;
+    ULONG Length;
+} PACKED VIRTQ_USED_ELEMENT, *PVIRTQ_USED_ELEMENT;
+
+/*++
+
+Structure Description:
+
+    This structure defines the header of the used ring, which the device uses
+    to hand buffers back to the driver. The ring itself follows, and after
+    that the available event index.
+
+Members:
+
+    Flags - Stores a bitmask of flags. See VIRTQ_USED_* definitions.
+
+    Index - Stores the index the device will write the next ring entry to,
+        modulo the queue size.
+
+    Ring - Stores the array of used elements.
+
+--*/
+
+typedef struct _VIRTQ_USED {
+    USHORT Flags;
+    USHORT Index;
+    VIRTQ_USED_ELEMENT Ring[ANYSIZE_ARRAY];
+} PACKED VIRTQ_USED, *PVIRTQ_USED;
+
+/*++
+
+Structure Description:
+
+    This structure defines a register region of a virtio device, which may
+    live in either I/O port or memory space.
+
+Members:
+
+    Base - Stores the virtual address of the region if it is in memory space.
+
+    IoPort - Stores the base I/O port of the region if it is in I/O space.
+
+    Length - Stores the size of the region in bytes.
+
+    IoSpace - Stores a boolean indicating whether the region is in I/O space.
+
+--*/
+
+typedef struct _VIRTIO_REGION {
+    PVOID Base;
+    USHORT IoPort;
+    ULONG Length;
+    BOOL IoSpace;
+} VIRTIO_REGION, *PVIRTIO_REGION;
+
+/*++
+
+Structure Description:
+
+    This structure defines a split virtqueue.
+
+Members:
+
+    Device - Stores a pointer to the device that owns the queue.
+
+    Index - Stores the index of the queue on the device.
+
+    Size - Stores the number of descriptors in the queue.
+
+    IoBuffer - Stores a pointer to the I/O buffer holding the rings.
+
+    Descriptors - Stores a pointer to the descriptor table.
+
+    Available - Stores a pointer to the available ring.
+
+    Used - Stores a pointer to the used ring.
+
+    UsedEvent - Stores a pointer to the used event index, written by the
+        driver to say when it next wants an interrupt.
+
+    AvailableEvent - Stores a pointer to the available event index, written
+        by the device to say when it next wants a notification.
+
+    DescriptorsPhysical - Stores the physical address of the descriptors.
+
+    AvailablePhysical - Stores the physical address of the available ring.
+
+    UsedPhysical - Stores the physical address of the used ring.
+
+    NotifyOffset - Stores the offset within the notify region to write to
+        notify the device about this queue.
+
+    FreeHead - Stores the index of the first free descriptor.
+
+    FreeCount - Stores the number of free descriptors.
+
+    AvailableIndex - Stores the driver's copy of the available ring index.
+
+    NotifiedIndex - Stores the available ring index as of the last time the
+        device was notified.
+
+    LastUsedIndex - Stores the used ring index up to which the driver has
+        processed.
+
+    InterruptsDisabled - Stores a boolean indicating whether the driver has
+        asked the device not to interrupt for this queue.
+
+    Cookies - Stores an array of caller cookies, indexed by the head
+        descriptor of each chain.
+
+--*/
+
+struct _VIRTIO_QUEUE {
+    PVIRTIO_DEVICE Device;
+    USHORT Index;
+    USHORT Size;
+    PIO_BUFFER IoBuffer;
+    PVIRTQ_DESCRIPTOR Descriptors;
+    volatile VIRTQ_AVAILABLE *Available;
+    volatile VIRTQ_USED *Used;
+    volatile USHORT *UsedEvent;
+    volatile USHORT *AvailableEvent;
+    PHYSICAL_ADDRESS DescriptorsPhysical;
+    PHYSICAL_ADDRESS AvailablePhysical;
+    PHYSICAL_ADDRESS UsedPhysical;
+    ULONG NotifyOffset;
+    USHORT FreeHead;
+    USHORT FreeCount;
+    USHORT AvailableIndex;
+    USHORT NotifiedIndex;
+    USHORT LastUsedIndex;
+    BOOL InterruptsDisabled;
+    PVOID *Cookies;
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines the transport state of a virtio PCI device.
+
+Members:
+
+    OsDevice - Stores a pointer to the OS device.
+
+    PciConfigInterface - Stores the interface used to access PCI
+        configuration space.
+
+    PciConfigInterfaceAvailable - Stores a boolean indicating whether the PCI
+        configuration space interface has arrived.
+
+    RegisteredForPciConfigInterfaces - Stores a boolean indicating whether
+        the device has signed up for PCI configuration interface
+        notifications.
+
+    Modern - Stores a boolean indicating whether the device is driven through
+        the modern (virtio 1.0) interface rather than the legacy one.
+
+    Common - Stores the common configuration region for modern devices, or
+        the entire register block for legacy ones.
+
+    Notify - Stores the notification region for modern devices.
+
+    NotifyMultiplier - Stores the value to multiply a queue's notify offset by
+        to get its offset within the notify region.
+
+    Isr - Stores the interrupt status region for modern devices.
+
+    DeviceConfiguration - Stores the device specific configuration region.
+
+    BarMappings - Stores the virtual mappings of any memory BARs, indexed by
+        BAR number.
+
+    BarMappingSizes - Stores the size of each BAR mapping.
+
+    Features - Stores the negotiated feature bits.
+
+    InterruptLine - Stores the interrupt line the device interrupts on.
+
+    InterruptVector - Stores the interrupt vector the device interrupts on.
+
+    InterruptResourcesFound - Stores a boolean indicating whether the line and
+        vector are valid.
+
+    InterruptHandle - Stores the handle of the connected interrupt.
+
+    DispatchServiceRoutine - Stores the driver's dispatch level interrupt
+        service routine.
+
+    LowLevelServiceRoutine - Stores the driver's low level interrupt service
+        routine.
+
+    InterruptContext - Stores the context to pass to the driver's interrupt
+        service routines.
+
+    PendingInterrupts - Stores the interrupt reasons collected by the
+        interrupt service routine and not yet picked up by the driver.
+
+    Queues - Stores the queues created on the device, indexed by queue index.
+
+--*/
+
+struct _VIRTIO_DEVICE {
+    PDEVICE OsDevice;
+    INTERFACE_PCI_CONFIG_ACCESS PciConfigInterface;
+    BOOL PciConfigInterfaceAvailable;
+    BOOL RegisteredForPciConfigInterfaces;
+    BOOL Modern;
+    VIRTIO_REGION Common;
+    VIRTIO_REGION Notify;
+    ULONG NotifyMultiplier;
+    VIRTIO_REGION Isr;
+    VIRTIO_REGION DeviceConfiguration;
+    PVOID BarMappings[VIRTIO_PCI_BAR_COUNT];
+    UINTN BarMappingSizes[VIRTIO_PCI_BAR_COUNT];
+    ULONGLONG Features;
+    ULONGLONG InterruptLine;
+    ULONGLONG InterruptVector;
+    BOOL InterruptResourcesFound;
+    HANDLE InterruptHandle;
+    PINTERRUPT_SERVICE_ROUTINE DispatchServiceRoutine;
+    PINTERRUPT_SERVICE_ROUTINE LowLevelServiceRoutine;
+    PVOID InterruptContext;
+    volatile ULONG PendingInterrupts;
+    PVIRTIO_QUEUE Queues[VIRTIO_MAX_QUEUES];
+};
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+//
+// Register access functions
+//
+
+UCHAR
+VirtiopRead8 (
+    PVIRTIO_REGION Region,
+    ULONG Offset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads a byte from a virtio register region.
+
+Arguments:
+
+    Region - Supplies a pointer to the region.
+
+    Offset - Supplies the offset within the region.
+
+Return Value:
+
+    Returns the value read.
+
+--*/
+
+USHORT
+VirtiopRead16 (
+    PVIRTIO_REGION Region,
+    ULONG Offset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads a 16-bit value from a virtio register region.
+
+Arguments:
+
+    Region - Supplies a pointer to the region.
+
+    Offset - Supplies the offset within the region.
+
+Return Value:
+
+    Returns the value read.
+
+--*/
+
+ULONG
+VirtiopRead32 (
+    PVIRTIO_REGION Region,
+    ULONG Offset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads a 32-bit value from a virtio register region.
+
+Arguments:
+
+    Region - Supplies a pointer to the region.
+
+    Offset - Supplies the offset within the region.
+
+Return Value:
+
+    Returns the value read.
+
+--*/
+
+VOID
+VirtiopWrite8 (
+    PVIRTIO_REGION Region,
+    ULONG Offset,
+    UCHAR Value
+    );
+
+/*++
+
+Routine Description:
+
+    This routine writes a byte to a virtio register region.
+
+Arguments:
+
+    Region - Supplies a pointer to the region.
+
+    Offset - Supplies the offset within the region.
+
+    Value - Supplies the value to write.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+VirtiopWrite16 (
+    PVIRTIO_REGION Region,
+    ULONG Offset,
+    USHORT Value
+    );
+
+/*++
+
+Routine Description:
+
+    This routine writes a 16-bit value to a virtio register region.
+
+Arguments:
+
+    Region - Supplies a pointer to the region.
+
+    Offset - Supplies the offset within the region.
+
+    Value - Supplies the value to write.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+VirtiopWrite32 (
+    PVIRTIO_REGION Region,
+    ULONG Offset,
+    ULONG Value
+    );
+
+/*++
+
+Routine Description:
+
+    This routine writes a 32-bit value to a virtio register region.
+
+Arguments:
+
+    Region - Supplies a pointer to the region.
+
+    Offset - Supplies the offset within the region.
+
+    Value - Supplies the value to write.
+
+Return Value:
+
+    None.
+
+--*/
+
+//
+// Virtqueue functions
+//
+
+VOID
+VirtiopInitializeQueueState (
+    PVIRTIO_QUEUE Queue
+    );
+
+/*++
+
+Routine Description:
+
+    This routine resets a queue's rings and descriptor free list to their
+    initial empty state. The device must not be using the queue.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    None.
+
+--*/
@@ -0,0 +1,484 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    virtq.c
+
+Abstract:
+
+    This module implements split virtqueue management: handing descriptor
+    chains to the device, reaping them when the device is done, and deciding
+    when notifications and interrupts are actually needed.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/driver.h>
+#include "virtiop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+VIRTIO_API
+KSTATUS
+VirtioQueueAddBuffer (
+    PVIRTIO_QUEUE Queue,
+    PVIRTIO_SEGMENT Segments,
+    ULONG SegmentCount,
+    PVOID Cookie
+    )
+
+/*++
+
+Routine Description:
+
+    This routine chains the given segments together into one buffer and makes
+    it available to the device. The device is not notified until
+    VirtioQueueNotify is called, so several buffers can be batched into one
+    notification. The caller must synchronize access to the queue.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Segments - Supplies an array of segments making up the buffer. All device
+        readable segments must come first.
+
+    SegmentCount - Supplies the number of segments in the array.
+
+    Cookie - Supplies a non-null value returned when the device is done with
+        the buffer.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_RESOURCE_IN_USE if there are not enough free descriptors.
+
+--*/
+
+{
+
+    PVIRTQ_DESCRIPTOR Descriptor;
+    USHORT Flags;
+    USHORT Head;
+    USHORT Index;
+    ULONG SegmentIndex;
+
+    ASSERT((SegmentCount != 0) && (Cookie != NULL));
+
+    if (SegmentCount > Queue->FreeCount) {
+        return STATUS_RESOURCE_IN_USE;
+    }
+
+    //
+    // Pull descriptors off the free list, reusing each one's link to the next
+    // free descriptor as its link to the next one in the chain.
+    //
+
+    Head = Queue->FreeHead;
+    Index = Head;
+    for (SegmentIndex = 0; SegmentIndex < SegmentCount; SegmentIndex += 1) {
+        Descriptor = &(Queue->Descriptors[Index]);
+        Descriptor->Address = Segments[SegmentIndex].Address;
+        Descriptor->Length = Segments[SegmentIndex].Length;
+        Flags = 0;
+        if ((Segments[SegmentIndex].Flags &
+             VIRTIO_SEGMENT_FLAG_DEVICE_WRITE) != 0) {
+
+            Flags |= VIRTQ_DESCRIPTOR_WRITE;
+        }
+
+        if (SegmentIndex + 1 < SegmentCount) {
+            Flags |= VIRTQ_DESCRIPTOR_NEXT;
+        }
+
+        Descriptor->Flags = Flags;
+        Index = Descriptor->Next;
+    }
+
+    Queue->FreeHead = Index;
+    Queue->FreeCount -= SegmentCount;
+    Queue->Cookies[Head] = Cookie;
+
+    //
+    // The ring entry has to be visible before the index that publishes it.
+    //
+
+    Queue->Available->Ring[Queue->AvailableIndex & (Queue->Size - 1)] = Head;
+    RtlMemoryBarrier();
+    Queue->AvailableIndex += 1;
+    Queue->Available->Index = Queue->AvailableIndex;
+    return STATUS_SUCCESS;
+}
+
+VIRTIO_API
+ULONG
+VirtioQueueGetFreeCount (
+    PVIRTIO_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the number of free descriptors in the queue, which
+    is the largest number of segments a new buffer can have.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    Returns the number of free descriptors.
+
+--*/
+
+{
+
+    return Queue->FreeCount;
+}
+
+VIRTIO_API
+VOID
+VirtioQueueNotify (
+    PVIRTIO_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine notifies the device that new buffers are available, unless
+    the device has said it does not need to hear about them.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVIRTIO_DEVICE Device;
+    BOOL NeedNotify;
+    USHORT NewIndex;
+    USHORT OldIndex;
+
+    //
+    // The new available index has to be visible before looking at whether
+    // the device wants a notification, or the two sides could each decide
+    // the other will act.
+    //
+
+    RtlMemoryBarrier();
+    Device = Queue->Device;
+    NewIndex = Queue->AvailableIndex;
+    OldIndex = Queue->NotifiedIndex;
+    if (NewIndex == OldIndex) {
+        return;
+    }
+
+    Queue->NotifiedIndex = NewIndex;
+    if ((Device->Features & VIRTIO_FEATURE_EVENT_INDEX) != 0) {
+        NeedNotify = VIRTQ_NEED_EVENT(*(Queue->AvailableEvent),
+                                      NewIndex,
+                                      OldIndex);
+
+    } else {
+        NeedNotify = FALSE;
+        if ((Queue->Used->Flags & VIRTQ_USED_NO_NOTIFY) == 0) {
+            NeedNotify = TRUE;
+        }
+    }
+
+    if (NeedNotify != FALSE) {
+        VirtiopWrite16(&(Device->Notify), Queue->NotifyOffset, Queue->Index);
+    }
+
+    return;
+}
+
+VIRTIO_API
+BOOL
+VirtioQueueGetUsed (
+    PVIRTIO_QUEUE Queue,
+    PVOID *Cookie,
+    PULONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes the next buffer the device has finished with off the
+    queue and frees its descriptors. The caller must synchronize access to the
+    queue.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Cookie - Supplies a pointer where the cookie the buffer was added with is
+        returned.
+
+    Length - Supplies a pointer where the number of bytes the device wrote
+        into the buffer is returned.
+
+Return Value:
+
+    TRUE if a buffer was returned.
+
+    FALSE if the device has not finished with any more buffers.
+
+--*/
+
+{
+
+    ULONG Count;
+    PVIRTQ_DESCRIPTOR Descriptor;
+    volatile VIRTQ_USED_ELEMENT *Element;
+    ULONG Head;
+    USHORT Index;
+
+    if (Queue->Used->Index == Queue->LastUsedIndex) {
+        return FALSE;
+    }
+
+    //
+    // Don't read the element until after the index that covers it.
+    //
+
+    RtlMemoryBarrier();
+    Element = &(Queue->Used->Ring[Queue->LastUsedIndex & (Queue->Size - 1)]);
+    Head = Element->Id;
+    *Length = Element->Length;
+
+    ASSERT((Head < Queue->Size) && (Queue->Cookies[Head] != NULL));
+
+    *Cookie = Queue->Cookies[Head];
+    Queue->Cookies[Head] = NULL;
+
+    //
+    // Put the whole chain back on the free list.
+    //
+
+    Count = 1;
+    Index = Head;
+    Descriptor = &(Queue->Descriptors[Index]);
+    while ((Descriptor->Flags & VIRTQ_DESCRIPTOR_NEXT) != 0) {
+        Index = Descriptor->Next;
+        Descriptor = &(Queue->Descriptors[Index]);
+        Count += 1;
+    }
+
+    Descriptor->Next = Queue->FreeHead;
+    Queue->FreeHead = Head;
+    Queue->FreeCount += Count;
+    Queue->LastUsedIndex += 1;
+
+    //
+    // With event indices, keep asking for an interrupt on the next buffer if
+    // interrupts are on, or else the device won't interrupt again until the
+    // index wraps around.
+    //
+
+    if ((Queue->InterruptsDisabled == FALSE) &&
+        ((Queue->Device->Features & VIRTIO_FEATURE_EVENT_INDEX) != 0)) {
+
+        *(Queue->UsedEvent) = Queue->LastUsedIndex;
+        RtlMemoryBarrier();
+    }
+
+    return TRUE;
+}
+
+VIRTIO_API
+VOID
+VirtioQueueDisableInterrupts (
+    PVIRTIO_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine asks the device not to interrupt when it finishes with
+    buffers in this queue. This is only a hint, and spurious interrupts may
+    still arrive.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Queue->InterruptsDisabled = TRUE;
+    Queue->Available->Flags |= VIRTQ_AVAILABLE_NO_INTERRUPT;
+
+    //
+    // Devices using event indices ignore the flag. Point the event index
+    // behind the current position so it won't be crossed until the index
+    // wraps around.
+    //
+
+    if ((Queue->Device->Features & VIRTIO_FEATURE_EVENT_INDEX) != 0) {
+        *(Queue->UsedEvent) = Queue->LastUsedIndex - 1;
+    }
+
+    return;
+}
+
+VIRTIO_API
+BOOL
+VirtioQueueEnableInterrupts (
+    PVIRTIO_QUEUE Queue,
+    ULONG Threshold
+    )
+
+/*++
+
+Routine Description:
+
+    This routine asks the device to interrupt again when it finishes with
+    buffers in this queue.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Threshold - Supplies the number of additional buffers that should finish
+        before interrupting. Zero interrupts on the next one. Devices without
+        event index support interrupt on the next one regardless.
+
+Return Value:
+
+    TRUE if buffers finished while interrupts were off and the caller should
+    process the queue again rather than wait for an interrupt.
+
+    FALSE if the queue is idle.
+
+--*/
+
+{
+
+    USHORT Pending;
+
+    if (Threshold >= Queue->Size) {
+        Threshold = Queue->Size - 1;
+    }
+
+    Queue->InterruptsDisabled = FALSE;
+    Queue->Available->Flags &= ~VIRTQ_AVAILABLE_NO_INTERRUPT;
+    if ((Queue->Device->Features & VIRTIO_FEATURE_EVENT_INDEX) != 0) {
+        *(Queue->UsedEvent) = Queue->LastUsedIndex + Threshold;
+    }
+
+    //
+    // Anything the device finished before it could see the new setting won't
+    // generate an interrupt, so look again now.
+    //
+
+    RtlMemoryBarrier();
+    Pending = Queue->Used->Index - Queue->LastUsedIndex;
+    if (Pending > Threshold) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+VOID
+VirtiopInitializeQueueState (
+    PVIRTIO_QUEUE Queue
+    )
+
+/*++
+
+Routine Description:
+
+    This routine resets a queue's rings and bookkeeping to the empty state,
+    with every descriptor on the free list.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    USHORT Index;
+
+    RtlZeroMemory(Queue->IoBuffer->Fragment[0].VirtualAddress,
+                  Queue->IoBuffer->Fragment[0].Size);
+
+    for (Index = 0; Index < Queue->Size; Index += 1) {
+        Queue->Descriptors[Index].Next = Index + 1;
+    }
+
+    Queue->Descriptors[Queue->Size - 1].Next = VIRTQ_END_OF_LIST;
+    RtlZeroMemory(Queue->Cookies, sizeof(PVOID) * Queue->Size);
+    Queue->FreeHead = 0;
+    Queue->FreeCount = Queue->Size;
+    Queue->AvailableIndex = 0;
+    Queue->NotifiedIndex = 0;
+    Queue->LastUsedIndex = 0;
+    Queue->InterruptsDisabled = FALSE;
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
@@ -35,6 +35,11 @@ Module Name:
 
 #define PARTITION_DEVICE_INFORMATION_VERSION 0x00010000
 
+#define DISK_QUEUE_INFORMATION_UUID \
+    {{0x5C0E9A71, 0x31D64F2B, 0x8E4A07C3, 0xB26F1D95}}
+
+#define DISK_QUEUE_INFORMATION_VERSION 0x00010000
+
 //
 // Define the size of a disk identifier (which happens to be large enough to
 // hold a GPT GUID).
@@ -84,6 +89,17 @@ Module Name:
 
 #define PARTITION_FLAG_RAW_DISK 0x00000010
 
+//
+// Define disk queue flags.
+//
+
+//
+// This flag is set if the disk queue is sorting and merging requests. When
+// clear, requests pass straight through to the disk.
+//
+
+#define DISK_QUEUE_FLAG_ENABLED 0x00000001
+
 //
 // Define recognized partition system ID byte values. Some super old values
 // that will probably never come up are simply ignored.
@@ -217,6 +233,56 @@ typedef struct _PARTITION_DEVICE_INFORMATION {
     UCHAR DiskId[DISK_IDENTIFIER_SIZE];
 } PARTITION_DEVICE_INFORMATION, *PPARTITION_DEVICE_INFORMATION;
 
+/*++
+
+Structure Description:
+
+    This structure stores the I/O queue information published by the raw disk
+    device. Only the flags and maximum in-flight count can be set.
+
+Members:
+
+    Version - Stores the table version. Future revisions will be backwards
+        compatible. Set to DISK_QUEUE_INFORMATION_VERSION.
+
+    Flags - Stores a bitfield of flags. See DISK_QUEUE_FLAG_* definitions.
+
+    MaxInFlight - Stores the maximum number of requests the queue will have
+        outstanding at the disk at once.
+
+    InFlight - Stores the number of requests currently outstanding at the disk.
+
+    QueueDepth - Stores the number of requests currently waiting in the queue.
+
+    MaxQueueDepth - Stores the largest number of requests ever seen waiting in
+        the queue.
+
+    RequestCount - Stores the total number of requests that have passed
+        through the queue.
+
+    MergeCount - Stores the number of requests that were merged into an
+        adjacent request rather than being sent to the disk on their own.
+
+    DispatchCount - Stores the number of requests sent down to the disk.
+
+    DeadlineCount - Stores the number of times a request was dispatched out
+        of order because its deadline expired.
+
+--*/
+
+typedef struct _DISK_QUEUE_INFORMATION {
+    ULONG Version;
+    ULONG Flags;
+    ULONG MaxInFlight;
+    ULONG InFlight;
+    ULONG QueueDepth;
+    ULONG MaxQueueDepth;
+    ULONGLONG RequestCount;
+    ULONGLONG MergeCount;
+    ULONGLONG DispatchCount;
+    ULONGLONG DeadlineCount;
+} DISK_QUEUE_INFORMATION, *PDISK_QUEUE_INFORMATION;
+
 //
 // -------------------------------------------------------------------- Globals
 //
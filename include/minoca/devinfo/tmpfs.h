@@ -0,0 +1,83 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    tmpfs.h
+
+Abstract:
+
+    This header contains definitions for the memory-backed file system device
+    information structure.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define TMPFS_DEVICE_INFORMATION_UUID \
+    {{0x7A3E51C4, 0x0B9F4D62, 0x9C1D58E7, 0x2F64A0B3}}
+
+#define TMPFS_DEVICE_INFORMATION_VERSION 0x00010000
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure stores the information published by a memory-backed file
+    system. Every mount of a tmpfs device is a separate file system on a
+    volume of its own, and each volume publishes this information for itself.
+    The raw device publishes it too: there the maximum size is the limit new
+    mounts start out with, and the usage is the total across all its mounts.
+    Only the maximum size can be set.
+
+Members:
+
+    Version - Stores the table version. Future revisions will be backwards
+        compatible. Set to TMPFS_DEVICE_INFORMATION_VERSION.
+
+    MaxSize - Stores the maximum number of bytes of file data the file system
+        will hold. This is counted in whole pages.
+
+    UsedSize - Stores the number of bytes of file data currently charged
+        against the maximum.
+
+    FileCount - Stores the number of files and directories in the file
+        system, including the root.
+
+--*/
+
+typedef struct _TMPFS_DEVICE_INFORMATION {
+    ULONG Version;
+    ULONGLONG MaxSize;
+    ULONGLONG UsedSize;
+    ULONGLONG FileCount;
+} TMPFS_DEVICE_INFORMATION, *PTMPFS_DEVICE_INFORMATION;
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
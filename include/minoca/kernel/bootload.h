@@ -354,6 +354,9 @@ Structure Description:
     SwapPage - Stores a pointer to the virtual address reservation the
         processor should use for quick dispatch level mappings.
 
+    PhysicalPageCache - Stores a pointer to the per-processor physical page
+        cache the processor should use.
+
 --*/
 
 struct _PROCESSOR_START_BLOCK {
@@ -364,6 +367,7 @@ struct _PROCESSOR_START_BLOCK {
     ULONG ProcessorNumber;
     PVOID ProcessorStructures;
     PVOID SwapPage;
+    PVOID PhysicalPageCache;
 } PACKED;
 
 //
@@ -244,6 +244,16 @@ Module Name:
 
 #define OPEN_FLAG_ASYNCHRONOUS 0x00000800
 
+//
+// Set this flag to transfer data for regular files and block devices directly
+// between the caller's buffer and the backing device, bypassing the page
+// cache. The offset, size, and buffer of each I/O must be aligned to the
+// device block size (or the page size for files). Unlike the non-cached flag,
+// this only affects I/O through the handle that set it.
+//
+
+#define OPEN_FLAG_DIRECT 0x00001000
+
 //
 // Set this flag if mount points should not be followed on the final component.
 //
@@ -325,6 +335,15 @@ Module Name:
 
 #define IO_FLAG_HARD_FLUSH_ALLOWED 0x10000000
 
+//
+// This flag is reserved for use only by the memory manager. It indicates that
+// a read should only be satisfied from pages already resident in the page
+// cache. The read stops at the first page that misses the cache without
+// issuing any I/O, and the bytes completed reflect the resident pages found.
+//
+
+#define IO_FLAG_CACHE_ONLY 0x08000000
+
 //
 // This flag indicates that a write I/O operation should flush all the file
 // data provided before returning.
@@ -862,11 +881,22 @@ Module Name:
 
 #define LOOKUP_FLAG_NON_CACHED 0x00000001
 
+//
+// Set this flag in lookup if the page cache holds the only copy of the file's
+// data. Writes are acknowledged without being stored until the page cache is
+// about to release a page, at which point a hard flush is sent (see
+// IO_FLAG_HARD_FLUSH). Cached writes that grow the file send a truncate to the
+// new size first, so the driver can refuse space it does not have. It is
+// intended for memory-backed file systems.
+//
+
+#define LOOKUP_FLAG_HARD_FLUSH_REQUIRED 0x00000002
+
 //
 // Define the version number for the I/O cache statistics.
 //
 
-#define IO_CACHE_STATISTICS_VERSION 0x1
+#define IO_CACHE_STATISTICS_VERSION 0x2
 #define IO_CACHE_STATISTICS_MAX_VERSION 0x10000000
 
 //
@@ -2600,6 +2630,12 @@ Structure Description:
     LastCleanTime - Stores a time counter value for the last time the page
         cache was cleaned.
 
+    EvictedPages - Stores the total number of pages the page cache has
+        evicted to free up memory.
+
+    RefaultedPages - Stores the total number of evicted pages that were read
+        back into the cache shortly after being evicted.
+
 --*/
 
 typedef struct _IO_CACHE_STATISTICS {
@@ -2611,6 +2647,8 @@ typedef struct _IO_CACHE_STATISTICS {
     UINTN PhysicalPageCount;
     UINTN DirtyPageCount;
     ULONGLONG LastCleanTime;
+    UINTN EvictedPages;
+    UINTN RefaultedPages;
 } IO_CACHE_STATISTICS, *PIO_CACHE_STATISTICS;
 
 /*++
@@ -2973,6 +3011,32 @@ Return Value:
 
 --*/
 
+KERNEL_API
+VOID
+IoSetDeviceVolumePerMount (
+    PDEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine indicates that every mount of the given device should get a
+    new volume of its own, rather than sharing one volume. No volume is
+    created for the device until it is mounted, and each volume goes away when
+    its mount does. This must be called before the device is marked mountable,
+    and cannot be undone. This routine is not thread safe.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    None.
+
+--*/
+
 KERNEL_API
 BOOL
 IoAreDeviceIdsEqual (
@@ -6340,6 +6404,59 @@ Return Value:
 
 --*/
 
+INTN
+IoSysCreateIoRing (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for creating or destroying the
+    current process' I/O submission and completion ring.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+INTN
+IoSysEnterIoRing (
+    PVOID SystemCallParameter
+    );
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for submitting work to the current
+    process' I/O ring and optionally waiting for completions.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    Returns the number of submissions consumed (a non-negative integer) on
+    success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
 VOID
 IoIoHandleAddReference (
     PIO_HANDLE IoHandle
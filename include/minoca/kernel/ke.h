@@ -140,6 +140,13 @@ Module Name:
 
 #define X86_FEATURE_FXSAVE   0x00000008
 
+//
+// This bit is set if the processor supports SSE2 and the kernel preserves the
+// XMM registers across context switches.
+//
+
+#define X86_FEATURE_SSE2     0x00000010
+
 //
 // This bit is set if the kernel is ARMv7.
 //
@@ -651,6 +658,14 @@ Structure Description:
 
     CpuVersion - Stores the processor identification information for this CPU.
 
+    AddressSpace - Stores a pointer to the address space currently loaded on
+        this processor. This is used to direct TLB invalidation IPIs only to
+        processors that might have the translations cached.
+
+    PhysicalPageCache - Stores a pointer to this processor's cache of free
+        physical pages, used to satisfy single page allocations without
+        acquiring the global physical page lock.
+
 --*/
 
 typedef struct _PROCESSOR_BLOCK PROCESSOR_BLOCK, *PPROCESSOR_BLOCK;
@@ -686,6 +701,8 @@ struct _PROCESSOR_BLOCK {
     PVOID SwapPage;
     UINTN NmiCount;
     PROCESSOR_IDENTIFICATION CpuVersion;
+    PVOID AddressSpace;
+    PVOID PhysicalPageCache;
 };
 
 /*++
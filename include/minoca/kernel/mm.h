@@ -72,7 +72,7 @@ Module Name:
 
 #define USER_STACK_HEADROOM (128 * _1MB)
 #define USER_STACK_MAX (((UINTN)MAX_USER_ADDRESS + 1) * 3 / 4)
-#define MM_STATISTICS_VERSION 1
+#define MM_STATISTICS_VERSION 3
 #define MM_STATISTICS_MAX_VERSION 0x10000000
 
 //
@@ -638,6 +638,31 @@ Structure Description:
     NonPagedPhysicalPages - Stores the number of physical pages that are
         pinned in memory and cannot be paged out to disk.
 
+    PagedOutPages - Stores the total number of pages the pager has evicted
+        from memory.
+
+    RefaultedPages - Stores the total number of pages that had to be read back
+        in from a page file after being paged out.
+
+    ReactivatedPages - Stores the total number of page out candidates that
+        were spared because they had been referenced since they were last
+        checked.
+
+    CompressedSwapCapacity - Stores the size of the compressed swap store in
+        bytes, or zero if it is not in use.
+
+    CompressedSwapPages - Stores the number of swapped out pages currently
+        held compressed in memory.
+
+    CompressedSwapBytes - Stores the number of bytes of the compressed swap
+        store those pages occupy.
+
+    CompressedSwapWrittenBackPages - Stores the total number of compressed
+        pages that were later written out to a page file to make room.
+
+    CompressedSwapRejectedPages - Stores the total number of pages that were
+        sent straight to a page file because they did not compress well.
+
 --*/
 
 typedef struct _MM_STATISTICS {
@@ -648,6 +673,14 @@ typedef struct _MM_STATISTICS {
     UINTN PhysicalPages;
     UINTN AllocatedPhysicalPages;
     UINTN NonPagedPhysicalPages;
+    UINTN PagedOutPages;
+    UINTN RefaultedPages;
+    UINTN ReactivatedPages;
+    UINTN CompressedSwapCapacity;
+    UINTN CompressedSwapPages;
+    UINTN CompressedSwapBytes;
+    UINTN CompressedSwapWrittenBackPages;
+    UINTN CompressedSwapRejectedPages;
 } MM_STATISTICS, *PMM_STATISTICS;
 
 /*++
@@ -699,6 +732,9 @@ Structure Description:
 
     BreakEnd - Stores the end address of the program break.
 
+    ActiveProcessorCount - Stores the number of processors that currently have
+        this address space loaded.
+
 --*/
 
 typedef struct _ADDRESS_SPACE {
@@ -710,6 +746,7 @@ typedef struct _ADDRESS_SPACE {
     PVOID MaxMemoryMap;
     PVOID BreakStart;
     PVOID BreakEnd;
+    volatile ULONG ActiveProcessorCount;
 } ADDRESS_SPACE, *PADDRESS_SPACE;
 
 /*++
@@ -3334,6 +3371,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 KSTATUS
 MmAllocatePageFileSpace (
     PIMAGE_BACKING ImageBacking,
@@ -3362,6 +3400,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 VOID
 MmFreePageFileSpace (
     PIMAGE_BACKING ImageBacking,
@@ -3416,6 +3455,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 KSTATUS
 MmPageFilePerformIo (
     PIMAGE_BACKING ImageBacking,
@@ -3911,6 +3951,7 @@ Return Value:
 
 --*/
 
+KERNEL_API
 UINTN
 MmGetTotalPhysicalPages (
     VOID
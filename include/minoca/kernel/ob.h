@@ -225,8 +225,10 @@ VOID
 
 Routine Description:
 
-    This routine is called whenever a handle is looked up. It is called with
-    the handle table lock still held.
+    This routine is called whenever a handle is looked up. It is called
+    without the handle table lock held, but before the handle can be closed
+    out from under the lookup, so it may safely take a reference on the value.
+    It must not block.
 
 Arguments:
 
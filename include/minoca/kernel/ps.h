@@ -466,6 +466,7 @@ Module Name:
 //
 
 #define PROCESS_FLAG_EXECUTED_IMAGE 0x000000001
+#define PROCESS_FLAG_VFORK_CLEANUP_PENDING 0x000000002
 
 //
 // Define the user lock operation flags and masks.
@@ -525,6 +526,15 @@ Module Name:
 
 #define FORK_FLAG_REALM_UTS 0x00000001
 
+//
+// Set this flag to have the child borrow the parent's address space instead
+// of getting a copy of it. The child starts at the supplied routine on the
+// supplied stack, and the calling thread is suspended until the child either
+// executes a new image or exits.
+//
+
+#define FORK_FLAG_SHARE_ADDRESS_SPACE 0x00000002
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -1419,6 +1429,27 @@ Structure Description:
 
     Realm - Stores the set of realms the process belongs to.
 
+    VforkAddressSpace - Stores the process' own address space while it is
+        borrowing its parent's address space. This is NULL if the process is
+        not sharing its parent's address space.
+
+    VforkEvent - Stores a pointer to the event to signal when the process
+        stops borrowing its parent's address space, releasing the suspended
+        parent thread.
+
+    VforkParent - Stores a referenced pointer to the process whose address
+        space this process is borrowing, or NULL if it is not borrowing one.
+
+    VforkBorrowerCount - Stores the number of child processes currently
+        borrowing this process' address space. The address space is not torn
+        down while this is non-zero. If the process terminates before it drops
+        to zero, the last borrower to leave tears it down. Decrements are
+        synchronized with termination by the process queued lock.
+
+    IoRing - Stores an opaque pointer to the process' I/O submission and
+        completion ring, or NULL if the process has not created one. This is
+        protected by the process queued lock.
+
 --*/
 
 struct _KPROCESS {
@@ -1465,6 +1496,11 @@ struct _KPROCESS {
     ULONG Umask;
     PVOID ControllingTerminal;
     PROCESS_REALMS Realm;
+    PADDRESS_SPACE VforkAddressSpace;
+    PVOID VforkEvent;
+    PKPROCESS VforkParent;
+    volatile ULONG VforkBorrowerCount;
+    PVOID IoRing;
 };
 
 /*++
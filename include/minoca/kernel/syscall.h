@@ -93,6 +93,7 @@ Module Name:
 #define SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL 0x00000200
 #define SYS_OPEN_FLAG_NO_ACCESS_TIME          0x00000400
 #define SYS_OPEN_FLAG_ASYNCHRONOUS            0x00000800
+#define SYS_OPEN_FLAG_DIRECT                  0x00001000
 
 #define SYS_OPEN_ACCESS_SHIFT 29
 #define SYS_OPEN_FLAG_READ    (IO_ACCESS_READ << SYS_OPEN_ACCESS_SHIFT)
@@ -118,14 +119,16 @@ Module Name:
      SYS_OPEN_FLAG_SYNCHRONIZED |               \
      SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL |    \
      SYS_OPEN_FLAG_NO_ACCESS_TIME |             \
-     SYS_OPEN_FLAG_ASYNCHRONOUS)
+     SYS_OPEN_FLAG_ASYNCHRONOUS |               \
+     SYS_OPEN_FLAG_DIRECT)
 
 #define SYS_FILE_CONTROL_EDITABLE_STATUS_FLAGS \
     (SYS_OPEN_FLAG_APPEND |                    \
      SYS_OPEN_FLAG_NON_BLOCKING |              \
      SYS_OPEN_FLAG_SYNCHRONIZED |              \
      SYS_OPEN_FLAG_NO_ACCESS_TIME |            \
-     SYS_OPEN_FLAG_ASYNCHRONOUS)
+     SYS_OPEN_FLAG_ASYNCHRONOUS |              \
+     SYS_OPEN_FLAG_DIRECT)
 
 //
 // Define delete flags.
@@ -172,6 +175,7 @@ Module Name:
 #define SYS_MAP_FLAG_SHARED    0x00000008
 #define SYS_MAP_FLAG_FIXED     0x00000010
 #define SYS_MAP_FLAG_ANONYMOUS 0x00000020
+#define SYS_MAP_FLAG_POPULATE  0x00000040
 
 //
 // Define memory mapping flush flags.
@@ -274,6 +278,40 @@ Module Name:
 #define TIMER_CONTROL_FLAG_USE_TIMER_NUMBER 0x00000001
 #define TIMER_CONTROL_FLAG_SIGNAL_THREAD    0x00000002
 
+//
+// Define the limits on I/O ring sizes. The submission and completion counts
+// must each be a power of two.
+//
+
+#define IO_RING_MAX_ENTRIES 0x8000
+#define IO_RING_MAX_WORKERS 64
+
+//
+// Define I/O ring header flags.
+//
+
+//
+// This flag is set by the kernel if a completion had to be discarded because
+// user mode did not leave room for it in the completion ring.
+//
+
+#define IO_RING_FLAG_COMPLETION_OVERFLOW 0x00000001
+
+//
+// Define the size of the shared memory region needed for an I/O ring with the
+// given number of submission and completion entries. The header comes first,
+// followed by the submission entries and then the completion entries.
+//
+
+#define IO_RING_SUBMISSIONS_OFFSET sizeof(IO_RING_HEADER)
+#define IO_RING_COMPLETIONS_OFFSET(_SubmissionCount) \
+    (IO_RING_SUBMISSIONS_OFFSET +                   \
+     ((_SubmissionCount) * sizeof(IO_RING_SUBMISSION)))
+
+#define IO_RING_SIZE(_SubmissionCount, _CompletionCount) \
+    (IO_RING_COMPLETIONS_OFFSET(_SubmissionCount) +      \
+     ((_CompletionCount) * sizeof(IO_RING_COMPLETION)))
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -350,6 +388,8 @@ typedef enum _SYSTEM_CALL_NUMBER {
     SystemCallSetITimer,
     SystemCallSetResourceLimit,
     SystemCallSetBreak,
+    SystemCallCreateIoRing,
+    SystemCallEnterIoRing,
     SystemCallCount
 } SYSTEM_CALL_NUMBER, *PSYSTEM_CALL_NUMBER;
 
@@ -403,6 +443,9 @@ typedef enum _FILE_CONTROL_COMMAND {
     FileControlCommandSetDirectoryFlag,
     FileControlCommandCloseFrom,
     FileControlCommandGetPath,
+    FileControlCommandGetHandleLock,
+    FileControlCommandSetHandleLock,
+    FileControlCommandBlockingSetHandleLock,
     FileControlCommandCount
 } FILE_CONTROL_COMMAND, *PFILE_CONTROL_COMMAND;
 
@@ -428,6 +471,128 @@ typedef enum _RESOURCE_USAGE_REQUEST {
     ResourceUsageRequestThread,
 } RESOURCE_USAGE_REQUEST, *PRESOURCE_USAGE_REQUEST;
 
+typedef enum _IO_RING_OPERATION {
+    IoRingOperationNop,
+    IoRingOperationRead,
+    IoRingOperationWrite,
+    IoRingOperationSend,
+    IoRingOperationReceive,
+    IoRingOperationPoll,
+    IoRingOperationFlush,
+    IoRingOperationCount
+} IO_RING_OPERATION, *PIO_RING_OPERATION;
+
+/*++
+
+Structure Description:
+
+    This structure defines the header at the start of an I/O ring's shared
+    memory region. The head and tail values are free-running counters; the
+    entry they refer to is the counter modulo the ring's entry count.
+
+Members:
+
+    SubmissionHead - Stores the count of submissions the kernel has consumed.
+        Only the kernel writes this value.
+
+    SubmissionTail - Stores the count of submissions user mode has published.
+        Only user mode writes this value.
+
+    CompletionHead - Stores the count of completions user mode has reaped.
+        Only user mode writes this value.
+
+    CompletionTail - Stores the count of completions the kernel has posted.
+        Only the kernel writes this value.
+
+    SubmissionCount - Stores the number of entries in the submission array.
+
+    CompletionCount - Stores the number of entries in the completion array.
+
+    Flags - Stores a bitfield of flags set by the kernel. See IO_RING_FLAG_*
+        definitions.
+
+    Reserved - Stores padding.
+
+--*/
+
+typedef struct _IO_RING_HEADER {
+    volatile ULONG SubmissionHead;
+    volatile ULONG SubmissionTail;
+    volatile ULONG CompletionHead;
+    volatile ULONG CompletionTail;
+    ULONG SubmissionCount;
+    ULONG CompletionCount;
+    volatile ULONG Flags;
+    ULONG Reserved;
+} SYSCALL_STRUCT IO_RING_HEADER, *PIO_RING_HEADER;
+
+/*++
+
+Structure Description:
+
+    This structure defines an I/O ring submission entry.
+
+Members:
+
+    Operation - Stores the operation to perform. See IO_RING_OPERATION.
+
+    OperationFlags - Stores operation-specific flags: the poll events to wait
+        for (POLL_EVENT_*) for poll operations, and the socket I/O flags
+        (SOCKET_IO_*) for send and receive operations.
+
+    Handle - Stores the handle to perform the operation on.
+
+    Buffer - Stores the user mode buffer to read into or write from.
+
+    Size - Stores the size of the buffer in bytes.
+
+    Offset - Stores the file offset for read and write operations. Supply -1
+        to use the current file position.
+
+    TimeoutInMilliseconds - Stores the number of milliseconds the operation
+        may wait. Use SYS_WAIT_TIME_INDEFINITE to wait forever.
+
+    UserData - Stores an opaque value that is returned in the completion.
+
+--*/
+
+typedef struct _IO_RING_SUBMISSION {
+    ULONG Operation;
+    ULONG OperationFlags;
+    HANDLE Handle;
+    PVOID Buffer;
+    UINTN Size;
+    IO_OFFSET Offset;
+    ULONG TimeoutInMilliseconds;
+    ULONGLONG UserData;
+} SYSCALL_STRUCT IO_RING_SUBMISSION, *PIO_RING_SUBMISSION;
+
+/*++
+
+Structure Description:
+
+    This structure defines an I/O ring completion entry.
+
+Members:
+
+    UserData - Stores the user data value from the submission.
+
+    BytesCompleted - Stores the number of bytes transferred.
+
+    Status - Stores the final status of the operation.
+
+    ReturnedEvents - Stores the poll events that were signaled, for poll
+        operations.
+
+--*/
+
+typedef struct _IO_RING_COMPLETION {
+    ULONGLONG UserData;
+    UINTN BytesCompleted;
+    KSTATUS Status;
+    ULONG ReturnedEvents;
+} SYSCALL_STRUCT IO_RING_COMPLETION, *PIO_RING_COMPLETION;
+
 //
 // System call parameter structures
 //
@@ -664,11 +829,27 @@ Structure Description:
 Members:
 
     Flags - Supplies a bitfield of flags governing the behavior of the child.
+        See FORK_FLAG_* definitions.
+
+    ThreadRoutine - Supplies the routine the child should start executing if
+        FORK_FLAG_SHARE_ADDRESS_SPACE is set. This is ignored otherwise.
+
+    Parameter - Supplies the parameter to pass to the thread routine.
+
+    StackBase - Supplies the base of the user mode stack the child should run
+        on if FORK_FLAG_SHARE_ADDRESS_SPACE is set. This memory is owned by the
+        caller, and must not be in use by the calling thread.
+
+    StackSize - Supplies the size of the child's stack in bytes.
 
 --*/
 
 typedef struct _SYSTEM_CALL_FORK {
     ULONG Flags;
+    PTHREAD_ENTRY_ROUTINE ThreadRoutine;
+    PVOID Parameter;
+    PVOID StackBase;
+    ULONG StackSize;
 } SYSCALL_STRUCT SYSTEM_CALL_FORK, *PSYSTEM_CALL_FORK;
 
 /*++
@@ -1176,7 +1357,7 @@ Structure Description:
 
     ProcessId - Stores the process ID of the process that owns the lock. This
         is returned when getting the lock, and is ignored when setting the
-        lock.
+        lock. It is -1 for locks owned by an open I/O handle.
 
 --*/
 
@@ -2499,6 +2680,66 @@ typedef struct _SYSTEM_CALL_SET_RESOURCE_LIMIT {
 
 /*++
 
+Structure Description:
+
+    This structure defines the system call parameters for creating or
+    destroying the current process' I/O ring.
+
+Members:
+
+    Buffer - Stores a pointer to the shared memory region to use for the ring.
+        This must be at least IO_RING_SIZE bytes long, and is locked in memory
+        for the lifetime of the ring. Supply NULL to destroy the process' ring.
+
+    Size - Stores the size of the buffer in bytes.
+
+    SubmissionCount - Stores the number of submission entries. This must be a
+        power of two.
+
+    CompletionCount - Stores the number of completion entries. This must be a
+        power of two.
+
+    WorkerCount - Stores the number of kernel threads that should service the
+        ring. Supply zero to use a default.
+
+--*/
+
+typedef struct _SYSTEM_CALL_CREATE_IO_RING {
+    PVOID Buffer;
+    UINTN Size;
+    ULONG SubmissionCount;
+    ULONG CompletionCount;
+    ULONG WorkerCount;
+} SYSCALL_STRUCT SYSTEM_CALL_CREATE_IO_RING, *PSYSTEM_CALL_CREATE_IO_RING;
+
+/*++
+
+Structure Description:
+
+    This structure defines the system call parameters for submitting work to
+    and waiting on the current process' I/O ring.
+
+Members:
+
+    SubmitCount - Stores the maximum number of published submissions to
+        consume.
+
+    MinimumCompleteCount - Stores the number of unreaped completions to wait
+        for before returning. Supply zero to return without waiting.
+
+    TimeoutInMilliseconds - Stores the maximum number of milliseconds to wait
+        for completions. Use SYS_WAIT_TIME_INDEFINITE to wait forever.
+
+--*/
+
+typedef struct _SYSTEM_CALL_ENTER_IO_RING {
+    ULONG SubmitCount;
+    ULONG MinimumCompleteCount;
+    ULONG TimeoutInMilliseconds;
+} SYSCALL_STRUCT SYSTEM_CALL_ENTER_IO_RING, *PSYSTEM_CALL_ENTER_IO_RING;
+
+/*++
+
 Structure Description:
 
     This structure defines a union of all possible system call parameter
@@ -2576,6 +2817,8 @@ typedef union _SYSTEM_CALL_PARAMETER_UNION {
     SYSTEM_CALL_SET_ITIMER SetITimer;
     SYSTEM_CALL_SET_RESOURCE_LIMIT SetResourceLimit;
     SYSTEM_CALL_SET_BREAK SetBreak;
+    SYSTEM_CALL_CREATE_IO_RING CreateIoRing;
+    SYSTEM_CALL_ENTER_IO_RING EnterIoRing;
 } SYSCALL_STRUCT SYSTEM_CALL_PARAMETER_UNION, *PSYSTEM_CALL_PARAMETER_UNION;
 
 typedef
@@ -104,6 +104,13 @@ Module Name:
 
 #define CK_CONFIGURATION_DEBUG_COMPILER 0x00000002
 
+//
+// Define this flag to skip the bytecode optimizer, leaving the compiled
+// bytecode exactly as the compiler emitted it.
+//
+
+#define CK_CONFIGURATION_NO_OPTIMIZE 0x00000004
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
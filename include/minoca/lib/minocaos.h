@@ -92,6 +92,7 @@ typedef enum _OS_X86_PROCESSOR_FEATURE {
     OsX86Sysenter,
     OsX86I686,
     OsX86FxSave,
+    OsX86Sse2,
     OsX86FeatureCount
 } OS_X86_PROCESSOR_FEATURE, *POS_X86_PROCESSOR_FEATURE;
 
@@ -245,6 +246,36 @@ typedef struct _OS_IMAGE_SYMBOL {
     PVOID SymbolAddress;
 } OS_IMAGE_SYMBOL, *POS_IMAGE_SYMBOL;
 
+/*++
+
+Structure Description:
+
+    This structure defines the user mode view of the process' I/O submission
+    and completion ring.
+
+Members:
+
+    Header - Stores a pointer to the shared ring header.
+
+    Submissions - Stores a pointer to the shared submission array.
+
+    Completions - Stores a pointer to the shared completion array.
+
+    Size - Stores the size of the shared region in bytes.
+
+    SubmissionTail - Stores the count of submission entries handed out, some
+        of which may not have been published to the kernel yet.
+
+--*/
+
+typedef struct _OS_IO_RING {
+    PIO_RING_HEADER Header;
+    PIO_RING_SUBMISSION Submissions;
+    PIO_RING_COMPLETION Completions;
+    UINTN Size;
+    ULONG SubmissionTail;
+} OS_IO_RING, *POS_IO_RING;
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -681,6 +712,55 @@ Return Value:
 
 --*/
 
+OS_API
+KSTATUS
+OsVforkProcess (
+    ULONG Flags,
+    PTHREAD_ENTRY_ROUTINE ThreadRoutine,
+    PVOID Parameter,
+    PVOID StackBase,
+    ULONG StackSize,
+    PPROCESS_ID NewProcessId
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates a child process that borrows the current process'
+    address space rather than getting a copy of it. The child starts
+    executing the given routine on the given stack, and the calling thread is
+    suspended until the child either executes a new image or exits. The child
+    must not return from the thread routine.
+
+Arguments:
+
+    Flags - Supplies a bitfield of flags governing the behavior of the new
+        process. See FORK_FLAG_* definitions. The share address space flag is
+        implied.
+
+    ThreadRoutine - Supplies a pointer to the routine the child runs.
+
+    Parameter - Supplies a pointer that will be passed directly to the thread
+        routine.
+
+    StackBase - Supplies a pointer to the base of the stack the child runs on.
+        This memory must stay mapped until this routine returns.
+
+    StackSize - Supplies the size of the child's stack in bytes.
+
+    NewProcessId - Supplies a pointer that on success contains the process ID
+        of the child process. This value contains -1 if the new process failed
+        to spawn.
+
+Return Value:
+
+    STATUS_SUCCESS once the child has executed a new image or exited.
+
+    Other status codes if the child failed to spawn.
+
+--*/
+
 OS_API
 KSTATUS
 OsExecuteImage (
@@ -3067,6 +3147,167 @@ Return Value:
 
 --*/
 
+//
+// I/O ring functions
+//
+
+OS_API
+KSTATUS
+OsCreateIoRing (
+    ULONG SubmissionCount,
+    ULONG CompletionCount,
+    ULONG WorkerCount,
+    POS_IO_RING Ring
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates the I/O submission and completion ring for the
+    current process. A process can have only one ring at a time.
+
+Arguments:
+
+    SubmissionCount - Supplies the number of submission entries. This must be
+        a power of two.
+
+    CompletionCount - Supplies the number of completion entries. This must be
+        a power of two, and is usually at least the submission count.
+
+    WorkerCount - Supplies the number of kernel threads to service the ring,
+        which bounds how many blocking operations can be in progress at once.
+        Supply zero to use the default.
+
+    Ring - Supplies a pointer where the ring will be initialized.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+OS_API
+VOID
+OsDestroyIoRing (
+    POS_IO_RING Ring
+    );
+
+/*++
+
+Routine Description:
+
+    This routine destroys the current process' I/O ring. Operations that have
+    not completed are abandoned.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+Return Value:
+
+    None.
+
+--*/
+
+OS_API
+PIO_RING_SUBMISSION
+OsIoRingGetSubmission (
+    POS_IO_RING Ring
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the next free submission entry. The entry is not
+    seen by the kernel until the next call to submit. This routine is not
+    thread safe; callers sharing a ring must serialize their submissions.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+Return Value:
+
+    Returns a pointer to a zeroed submission entry for the caller to fill in.
+
+    NULL if the submission array is full.
+
+--*/
+
+OS_API
+KSTATUS
+OsIoRingSubmit (
+    POS_IO_RING Ring,
+    ULONG MinimumCompleteCount,
+    ULONG TimeoutInMilliseconds,
+    PULONG SubmittedCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine publishes all submission entries handed out since the last
+    call and enters the kernel once to start them, optionally waiting for
+    completions. The kernel will not consume more submissions than there is
+    room for in the completion array; anything left over stays published and
+    is picked up by the next call.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    MinimumCompleteCount - Supplies the number of unreaped completions to wait
+        for before returning. Supply zero to not wait.
+
+    TimeoutInMilliseconds - Supplies the maximum time to wait for completions.
+        Use SYS_WAIT_TIME_INDEFINITE to wait forever.
+
+    SubmittedCount - Supplies an optional pointer where the number of entries
+        the kernel consumed will be returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_TIMEOUT or STATUS_INTERRUPTED if nothing was submitted and the wait
+    did not complete.
+
+    Other error codes on failure.
+
+--*/
+
+OS_API
+BOOL
+OsIoRingReapCompletion (
+    POS_IO_RING Ring,
+    PIO_RING_COMPLETION Completion
+    );
+
+/*++
+
+Routine Description:
+
+    This routine removes the oldest completion from the ring without entering
+    the kernel. This routine is not thread safe; callers sharing a ring must
+    serialize their reaping.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Completion - Supplies a pointer where the completion will be copied.
+
+Return Value:
+
+    TRUE if a completion was returned.
+
+    FALSE if the completion array is empty.
+
+--*/
+
 //
 // Timekeeping functions
 //
@@ -1113,6 +1113,45 @@ typedef struct _CALENDAR_TIME {
     PCSTR TimeZone;
 } CALENDAR_TIME, *PCALENDAR_TIME;
 
+/*++
+
+Structure Description:
+
+    This structure caches the span of system time around the most recent
+    local time conversion during which the local time zone offset does not
+    change. Callers typically keep one per thread so that repeated conversions
+    of nearby times need not consult the shared time zone data at all. The
+    structure should be zero-initialized before its first use.
+
+Members:
+
+    Generation - Stores the time zone data generation the span was computed
+        from. The span is discarded if the time zone data changes.
+
+    Start - Stores the first system time second covered by the span.
+
+    End - Stores the system time second immediately after the span.
+
+    GmtOffset - Stores the offset from Greenwich Mean Time in seconds during
+        the span, including any daylight saving.
+
+    IsDaylightSaving - Stores whether or not daylight saving time is in effect
+        during the span.
+
+    TimeZone - Stores a pointer to the time zone name in effect during the
+        span.
+
+--*/
+
+typedef struct _TIME_ZONE_TRANSITION_CACHE {
+    ULONG Generation;
+    LONGLONG Start;
+    LONGLONG End;
+    LONG GmtOffset;
+    LONG IsDaylightSaving;
+    PCSTR TimeZone;
+} TIME_ZONE_TRANSITION_CACHE, *PTIME_ZONE_TRANSITION_CACHE;
+
 typedef struct _MEMORY_HEAP MEMORY_HEAP, *PMEMORY_HEAP;
 
 typedef
@@ -3297,6 +3336,183 @@ Return Value:
 
 --*/
 
+RTL_API
+PVOID
+RtlVectorCopyMemory (
+    PVOID Destination,
+    PCVOID Source,
+    UINTN ByteCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine copies a section of memory using vector instructions. The
+    caller must ensure the processor supports the required vector extension
+    and that vector register state is preserved across context switches, so
+    this routine must not be called from kernel mode.
+
+Arguments:
+
+    Destination - Supplies a pointer to the buffer where the memory will be
+        copied to.
+
+    Source - Supplies a pointer to the buffer to be copied.
+
+    ByteCount - Supplies the number of bytes to copy.
+
+Return Value:
+
+    Returns the destination pointer.
+
+--*/
+
+RTL_API
+VOID
+RtlVectorSetMemory (
+    PVOID Buffer,
+    INT Byte,
+    UINTN Count
+    );
+
+/*++
+
+Routine Description:
+
+    This routine writes the given byte value repeatedly into a region of memory
+    using vector instructions. This routine must not be called from kernel
+    mode.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the buffer to set.
+
+    Byte - Supplies the byte to set.
+
+    Count - Supplies the number of bytes to set.
+
+Return Value:
+
+    None.
+
+--*/
+
+RTL_API
+UINTN
+RtlVectorFindMemoryDifference (
+    PCVOID FirstBuffer,
+    PCVOID SecondBuffer,
+    UINTN Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine compares two buffers using vector instructions, and finds the
+    first byte where they differ. This routine must not be called from kernel
+    mode.
+
+Arguments:
+
+    FirstBuffer - Supplies a pointer to the first buffer to compare.
+
+    SecondBuffer - Supplies a pointer to the second buffer to compare.
+
+    Size - Supplies the number of bytes to compare.
+
+Return Value:
+
+    Returns the offset of the first byte that differs between the two buffers.
+
+    Returns the size if the buffers are equal.
+
+--*/
+
+RTL_API
+UINTN
+RtlVectorStringLength (
+    PCSTR String
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines the length of the given string, not including its
+    null terminator, using vector instructions. This routine must not be
+    called from kernel mode.
+
+Arguments:
+
+    String - Supplies a pointer to the beginning of the string.
+
+Return Value:
+
+    Returns the length of the string, not including the null terminator.
+
+--*/
+
+RTL_API
+PVOID
+RtlVectorFindMemoryCharacter (
+    PCVOID Buffer,
+    INT Character,
+    UINTN Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds the first occurrence of a byte in a buffer using vector
+    instructions. This routine must not be called from kernel mode.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the buffer to search.
+
+    Character - Supplies the byte to search for.
+
+    Size - Supplies the size of the buffer in bytes.
+
+Return Value:
+
+    Returns a pointer to the first occurrence of the byte on success.
+
+    NULL if the byte does not occur in the buffer.
+
+--*/
+
+RTL_API
+PSTR
+RtlVectorStringFindCharacter (
+    PCSTR String,
+    INT Character
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds the first occurrence of a character or the null
+    terminator in a string, using vector instructions. This routine must not
+    be called from kernel mode.
+
+Arguments:
+
+    String - Supplies a pointer to the string to search.
+
+    Character - Supplies the character to search for.
+
+Return Value:
+
+    Returns a pointer to the first occurrence of the character, or to the null
+    terminator if the character does not occur in the string.
+
+--*/
+
 RTL_API
 BOOL
 RtlAreUuidsEqual (
@@ -6053,6 +6269,41 @@ Return Value:
 
 --*/
 
+RTL_API
+KSTATUS
+RtlSystemTimeToLocalCalendarTimeCached (
+    PSYSTEM_TIME SystemTime,
+    PCALENDAR_TIME CalendarTime,
+    PTIME_ZONE_TRANSITION_CACHE Cache
+    );
+
+/*++
+
+Routine Description:
+
+    This routine converts the given system time into calendar time in the
+    current local time zone, consulting and updating the given transition
+    cache along the way.
+
+Arguments:
+
+    SystemTime - Supplies a pointer to the system time to convert.
+
+    CalendarTime - Supplies a pointer to the calendar time to initialize based
+        on the given system time.
+
+    Cache - Supplies an optional pointer to the caller's transition cache. The
+        caller is responsible for ensuring that the cache is not used by more
+        than one thread at a time.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_OUT_OF_BOUNDS if the given system time is too funky.
+
+--*/
+
 RTL_API
 KSTATUS
 RtlLocalCalendarTimeToSystemTime (
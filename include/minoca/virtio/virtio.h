@@ -0,0 +1,607 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    virtio.h
+
+Abstract:
+
+    This header contains definitions for the virtio core library, which
+    implements the virtio PCI transport and split virtqueues on behalf of
+    virtio device drivers.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#ifndef VIRTIO_API
+
+#define VIRTIO_API __DLLIMPORT
+
+#endif
+
+//
+// Define the PCI vendor ID shared by all virtio devices.
+//
+
+#define VIRTIO_PCI_VENDOR_ID 0x1AF4
+
+//
+// Define the device status bits.
+//
+
+#define VIRTIO_STATUS_ACKNOWLEDGE        0x01
+#define VIRTIO_STATUS_DRIVER             0x02
+#define VIRTIO_STATUS_DRIVER_OK          0x04
+#define VIRTIO_STATUS_FEATURES_OK        0x08
+#define VIRTIO_STATUS_DEVICE_NEEDS_RESET 0x40
+#define VIRTIO_STATUS_FAILED             0x80
+
+//
+// Define the transport and ring feature bits common to all devices. Device
+// specific feature bits live below bit 24.
+//
+
+#define VIRTIO_FEATURE_NOTIFY_ON_EMPTY      (1ULL << 24)
+#define VIRTIO_FEATURE_ANY_LAYOUT           (1ULL << 27)
+#define VIRTIO_FEATURE_INDIRECT_DESCRIPTORS (1ULL << 28)
+#define VIRTIO_FEATURE_EVENT_INDEX          (1ULL << 29)
+#define VIRTIO_FEATURE_VERSION_1            (1ULL << 32)
+#define VIRTIO_FEATURE_ACCESS_PLATFORM      (1ULL << 33)
+
+//
+// Define the bits returned when reading the interrupt status.
+//
+
+#define VIRTIO_INTERRUPT_QUEUE                0x00000001
+#define VIRTIO_INTERRUPT_CONFIGURATION_CHANGE 0x00000002
+
+//
+// Set this flag in a segment if the device writes to it rather than reads
+// from it. Within a buffer, all device readable segments must come before
+// all device writable ones.
+//
+
+#define VIRTIO_SEGMENT_FLAG_DEVICE_WRITE 0x00000001
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef struct _VIRTIO_DEVICE VIRTIO_DEVICE, *PVIRTIO_DEVICE;
+typedef struct _VIRTIO_QUEUE VIRTIO_QUEUE, *PVIRTIO_QUEUE;
+
+/*++
+
+Structure Description:
+
+    This structure describes one physically contiguous piece of a buffer
+    handed to a virtqueue.
+
+Members:
+
+    Address - Stores the physical address of the segment.
+
+    Length - Stores the length of the segment in bytes.
+
+    Flags - Stores a bitmask of flags. See VIRTIO_SEGMENT_FLAG_* for
+        definitions.
+
+--*/
+
+typedef struct _VIRTIO_SEGMENT {
+    PHYSICAL_ADDRESS Address;
+    ULONG Length;
+    ULONG Flags;
+} VIRTIO_SEGMENT, *PVIRTIO_SEGMENT;
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// -------------------------------------------------------- Function Prototypes
+//
+
+VIRTIO_API
+KSTATUS
+VirtioCreateDevice (
+    PDEVICE OsDevice,
+    PVIRTIO_DEVICE *Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine creates the virtio transport state for a virtio PCI device.
+    This is usually called from a driver's add device routine.
+
+Arguments:
+
+    OsDevice - Supplies a pointer to the OS device the driver is attaching to.
+
+    Device - Supplies a pointer where a pointer to the new virtio device will
+        be returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VIRTIO_API
+VOID
+VirtioDestroyDevice (
+    PVIRTIO_DEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine resets and destroys a virtio device, including all of its
+    queues. The interrupt is disconnected first if it was connected.
+
+Arguments:
+
+    Device - Supplies a pointer to the device to destroy.
+
+Return Value:
+
+    None.
+
+--*/
+
+VIRTIO_API
+KSTATUS
+VirtioProcessResourceRequirements (
+    PVIRTIO_DEVICE Device,
+    PIRP Irp
+    );
+
+/*++
+
+Routine Description:
+
+    This routine handles a query resources IRP on its way back up for a virtio
+    device. It acquires access to PCI configuration space and adds an
+    interrupt vector requirement for the device's interrupt line.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    Irp - Supplies a pointer to the query resources IRP.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VIRTIO_API
+KSTATUS
+VirtioStartDevice (
+    PVIRTIO_DEVICE Device,
+    PRESOURCE_ALLOCATION_LIST AllocationList
+    );
+
+/*++
+
+Routine Description:
+
+    This routine locates and maps the device's registers, using the modern
+    interface if the device advertises one and the legacy I/O port interface
+    otherwise. It then resets the device and acknowledges it.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    AllocationList - Supplies a pointer to the processor local resources
+        allocated to the device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VIRTIO_API
+KSTATUS
+VirtioNegotiateFeatures (
+    PVIRTIO_DEVICE Device,
+    ULONGLONG DriverFeatures,
+    PULONGLONG AcceptedFeatures
+    );
+
+/*++
+
+Routine Description:
+
+    This routine negotiates the feature set with the device. The transport
+    and ring features the core library implements are added automatically.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    DriverFeatures - Supplies the device specific features the driver would
+        like to use.
+
+    AcceptedFeatures - Supplies a pointer where the negotiated features will be
+        returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_SUPPORTED if the device rejected the feature set.
+
+--*/
+
+VIRTIO_API
+KSTATUS
+VirtioReadDeviceConfiguration (
+    PVIRTIO_DEVICE Device,
+    ULONG Offset,
+    PVOID Buffer,
+    ULONG Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads from the device specific configuration space. The read
+    is retried if the device changes the configuration midway through.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    Offset - Supplies the offset within the device configuration to read.
+
+    Buffer - Supplies a pointer where the data will be returned.
+
+    Size - Supplies the number of bytes to read.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VIRTIO_API
+KSTATUS
+VirtioCreateQueue (
+    PVIRTIO_DEVICE Device,
+    USHORT Index,
+    USHORT MaxSize,
+    PVIRTIO_QUEUE *Queue
+    );
+
+/*++
+
+Routine Description:
+
+    This routine allocates and programs a virtqueue. Features must have been
+    negotiated first. The queue starts with interrupts enabled.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    Index - Supplies the index of the queue on the device.
+
+    MaxSize - Supplies the maximum number of descriptors the caller wants in
+        the queue. Modern devices are given the smaller of this and their own
+        maximum. Legacy devices dictate the size themselves.
+
+    Queue - Supplies a pointer where a pointer to the queue will be returned.
+        The queue is destroyed along with the device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VIRTIO_API
+KSTATUS
+VirtioSetDriverReady (
+    PVIRTIO_DEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine tells the device the driver is done setting it up. Queues
+    are live once this returns.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VIRTIO_API
+KSTATUS
+VirtioReinitializeDevice (
+    PVIRTIO_DEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine resets the device and brings it back up with the same
+    features and queues, discarding anything that was in flight. It neither
+    allocates memory nor acquires locks, so it is suitable for use at high
+    run level when preparing for a crash dump.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VIRTIO_API
+KSTATUS
+VirtioConnectInterrupt (
+    PVIRTIO_DEVICE Device,
+    PINTERRUPT_SERVICE_ROUTINE DispatchServiceRoutine,
+    PINTERRUPT_SERVICE_ROUTINE LowLevelServiceRoutine,
+    PVOID Context
+    );
+
+/*++
+
+Routine Description:
+
+    This routine connects the device's interrupt. The core library services
+    the interrupt itself and then runs the given routine at dispatch or low
+    level, which should collect the reasons with
+    VirtioGetPendingInterrupts.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+    DispatchServiceRoutine - Supplies an optional routine to run at dispatch
+        level after an interrupt.
+
+    LowLevelServiceRoutine - Supplies an optional routine to run at low level
+        after an interrupt.
+
+    Context - Supplies the context passed to the service routine.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+VIRTIO_API
+ULONG
+VirtioGetPendingInterrupts (
+    PVIRTIO_DEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine collects and clears the interrupt reasons gathered since the
+    last call.
+
+Arguments:
+
+    Device - Supplies a pointer to the virtio device.
+
+Return Value:
+
+    Returns a bitmask of VIRTIO_INTERRUPT_* values.
+
+--*/
+
+VIRTIO_API
+KSTATUS
+VirtioQueueAddBuffer (
+    PVIRTIO_QUEUE Queue,
+    PVIRTIO_SEGMENT Segments,
+    ULONG SegmentCount,
+    PVOID Cookie
+    );
+
+/*++
+
+Routine Description:
+
+    This routine chains the given segments together into one buffer and makes
+    it available to the device. The device is not notified until
+    VirtioQueueNotify is called, so several buffers can be batched into one
+    notification. The caller must synchronize access to the queue.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Segments - Supplies an array of segments making up the buffer. All device
+        readable segments must come first.
+
+    SegmentCount - Supplies the number of segments in the array.
+
+    Cookie - Supplies a non-null value returned when the device is done with
+        the buffer.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_RESOURCE_IN_USE if there are not enough free descriptors.
+
+--*/
+
+VIRTIO_API
+ULONG
+VirtioQueueGetFreeCount (
+    PVIRTIO_QUEUE Queue
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the number of descriptors currently free in a queue,
+    which is the largest number of segments a new buffer can have.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    Returns the number of free descriptors.
+
+--*/
+
+VIRTIO_API
+VOID
+VirtioQueueNotify (
+    PVIRTIO_QUEUE Queue
+    );
+
+/*++
+
+Routine Description:
+
+    This routine tells the device about buffers added since the last
+    notification, skipping the register write if the device has said it does
+    not need one.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    None.
+
+--*/
+
+VIRTIO_API
+BOOL
+VirtioQueueGetUsed (
+    PVIRTIO_QUEUE Queue,
+    PVOID *Cookie,
+    PULONG Length
+    );
+
+/*++
+
+Routine Description:
+
+    This routine takes the next buffer the device has finished with off the
+    queue and frees its descriptors. The caller must synchronize access to the
+    queue.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Cookie - Supplies a pointer where the cookie the buffer was added with is
+        returned.
+
+    Length - Supplies a pointer where the number of bytes the device wrote
+        into the buffer is returned.
+
+Return Value:
+
+    TRUE if a buffer was returned.
+
+    FALSE if the device has not finished with any more buffers.
+
+--*/
+
+VIRTIO_API
+VOID
+VirtioQueueDisableInterrupts (
+    PVIRTIO_QUEUE Queue
+    );
+
+/*++
+
+Routine Description:
+
+    This routine asks the device not to interrupt when it finishes with
+    buffers in this queue. This is only a hint, and spurious interrupts may
+    still arrive.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+Return Value:
+
+    None.
+
+--*/
+
+VIRTIO_API
+BOOL
+VirtioQueueEnableInterrupts (
+    PVIRTIO_QUEUE Queue,
+    ULONG Threshold
+    );
+
+/*++
+
+Routine Description:
+
+    This routine asks the device to interrupt again when it finishes with
+    buffers in this queue.
+
+Arguments:
+
+    Queue - Supplies a pointer to the queue.
+
+    Threshold - Supplies the number of additional buffers that should finish
+        before interrupting. Zero interrupts on the next one. Devices without
+        event index support interrupt on the next one regardless.
+
+Return Value:
+
+    TRUE if buffers finished while interrupts were off and the caller should
+    process the queue again rather than wait for an interrupt.
+
+    FALSE if the queue is idle.
+
+--*/
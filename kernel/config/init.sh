@@ -99,6 +99,15 @@ rm -rf "$WORLD/tmp" "$WORLD/dev"
 mkdir -p "$WORLD/dev"
 mkdir -p -m1777 "$WORLD/tmp"
 
+##
+## Keep temporary files in memory if the memory-backed file system is there.
+##
+
+if test -b /Device/tmpfs; then
+    mount /Device/tmpfs "$WORLD/tmp"
+    chmod 1777 "$WORLD/tmp"
+fi
+
 ##
 ## Symlink swiss binaries.
 ##
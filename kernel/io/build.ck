@@ -55,11 +55,13 @@ function build() {
         "intrupt.c",
         "iobase.c",
         "iohandle.c",
+        "ioring.c",
         "irp.c",
         "mount.c",
         "obfs.c",
         "pagecach.c",
         "path.c",
+        "pcradix.c",
         "perm.c",
         "pipe.c",
         "pminfo.c",
@@ -72,7 +74,8 @@ function build() {
         "stream.c",
         "testhook.c",
         "unsocket.c",
-        "userio.c"
+        "userio.c",
+        "writebk.c"
     ];
 
     if ((arch == "armv7") || (arch == "armv6")) {
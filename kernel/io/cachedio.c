@@ -113,6 +113,12 @@ IopPerformCachedWrite (
     PIO_CONTEXT IoContext
     );
 
+KSTATUS
+IopResizeHardFlushFile (
+    PFILE_OBJECT FileObject,
+    ULONGLONG NewSize
+    );
+
 KSTATUS
 IopHandleCacheWriteMiss (
     PFILE_OBJECT FileObject,
@@ -161,6 +167,13 @@ IopPerformDefaultPartialWrite (
     UINTN IoBufferOffset
     );
 
+KSTATUS
+IopPerformDirectIo (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext,
+    PVOID DeviceContext
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -198,6 +211,7 @@ Return Value:
 
 {
 
+    BOOL Direct;
     PFILE_OBJECT FileObject;
     UINTN FlushCount;
     BOOL LockHeldExclusive;
@@ -217,6 +231,26 @@ Return Value:
     OriginalOffset = IoContext->Offset;
     StartOffset = OriginalOffset;
 
+    //
+    // Handles opened for direct I/O go around the page cache. Write out
+    // anything dirty first so that direct reads see earlier buffered writes.
+    // Direct writes update whatever is still resident once they land. File
+    // objects whose only copy of the data is the page cache cannot skip it.
+    //
+
+    Direct = FALSE;
+    if (((Handle->OpenFlags & OPEN_FLAG_DIRECT) != 0) &&
+        (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) &&
+        ((FileObject->Flags & FILE_OBJECT_FLAG_HARD_FLUSH_REQUIRED) == 0) &&
+        ((IoContext->Flags & IO_FLAG_CACHE_ONLY) == 0)) {
+
+        Direct = TRUE;
+        Status = IopFlushFileObject(FileObject, 0, -1ULL, 0, FALSE, NULL);
+        if (!KSUCCESS(Status)) {
+            return Status;
+        }
+    }
+
     //
     // Assuming this call is going to generate more pages, ask this thread to
     // do some trimming if things are too big. If this is the file system
@@ -225,7 +259,10 @@ Return Value:
     // trimming.
     //
 
-    if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
+    if ((Direct == FALSE) &&
+        (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) &&
+        ((IoContext->Flags & IO_FLAG_CACHE_ONLY) == 0)) {
+
         TimidTrim = FALSE;
         if ((IoContext->Flags & IO_FLAG_FS_DATA) != 0) {
             TimidTrim = TRUE;
@@ -244,30 +281,43 @@ Return Value:
         //
         // It's important to prevent runaway writers from making things
         // overwhelmingly dirty.
-        // 1) If it's a write to a block device, make it synchronized. This
-        //    covers the case of the file system writing tons of zeros to catch
-        //    up to a far offset.
+        // 1) If it's a write to a block device and the cache is too dirty,
+        //    make it synchronized. This covers the case of the file system
+        //    writing tons of zeros to catch up to a far offset.
         // 2) Otherwise if the FS flags are set, let the write go through
         //    unimpeded.
-        // 3) Otherwise go clean some entries.
+        // 3) Otherwise if the data is backed by a device with its own
+        //    writeback thread, pause if that device holds more than its
+        //    share of the dirty pages. This happens before the file object
+        //    lock is acquired so that the pause does not hold up the
+        //    writeback of this very file.
+        // 4) Otherwise if the cache is too dirty, go clean some entries.
         //
 
-        if ((IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) &&
-            (IopIsPageCacheTooDirty() != FALSE)) {
+        if ((Direct == FALSE) &&
+            (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE)) {
 
             if (FileObject->Properties.Type == IoObjectBlockDevice) {
-                IoContext->Flags |= IO_FLAG_DATA_SYNCHRONIZED;
-
-            } else if ((IoContext->Flags & IO_FLAG_FS_DATA) == 0) {
-                PageShift = MmPageShift();
-                FlushCount = PAGE_CACHE_DIRTY_PENANCE_PAGES;
-                if ((IoContext->SizeInBytes >> PageShift) >= FlushCount) {
-                    FlushCount = (IoContext->SizeInBytes >> PageShift) + 1;
+                if (IopIsPageCacheTooDirty() != FALSE) {
+                    IoContext->Flags |= IO_FLAG_DATA_SYNCHRONIZED;
                 }
 
-                Status = IopFlushFileObjects(0, 0, &FlushCount);
-                if (!KSUCCESS(Status)) {
-                    return Status;
+            } else if ((IoContext->Flags & IO_FLAG_FS_DATA) == 0) {
+                if (FileObject->Writeback != NULL) {
+                    IopThrottleDirtyWriter(FileObject->Writeback,
+                                           IoContext->SizeInBytes);
+
+                } else if (IopIsPageCacheTooDirty() != FALSE) {
+                    PageShift = MmPageShift();
+                    FlushCount = PAGE_CACHE_DIRTY_PENANCE_PAGES;
+                    if ((IoContext->SizeInBytes >> PageShift) >= FlushCount) {
+                        FlushCount = (IoContext->SizeInBytes >> PageShift) + 1;
+                    }
+
+                    Status = IopFlushFileObjects(0, 0, &FlushCount);
+                    if (!KSUCCESS(Status)) {
+                        return Status;
+                    }
                 }
             }
         }
@@ -289,7 +339,12 @@ Return Value:
             IoContext->Offset = FileObject->Properties.Size;
         }
 
-        if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
+        if (Direct != FALSE) {
+            Status = IopPerformDirectIo(FileObject,
+                                        IoContext,
+                                        Handle->DeviceContext);
+
+        } else if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
             Status = IopPerformCachedWrite(FileObject, IoContext);
 
         } else {
@@ -315,11 +370,25 @@ Return Value:
         }
 
         LockHeldExclusive = FALSE;
-        if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
+        if (Direct != FALSE) {
+            Status = IopPerformDirectIo(FileObject,
+                                        IoContext,
+                                        Handle->DeviceContext);
+
+        } else if (IO_IS_FILE_OBJECT_CACHEABLE(FileObject) != FALSE) {
             Status = IopPerformCachedRead(FileObject,
                                           IoContext,
                                           &LockHeldExclusive);
 
+        //
+        // A non-cached object has nothing resident to hand back to a cache
+        // only read.
+        //
+
+        } else if ((IoContext->Flags & IO_FLAG_CACHE_ONLY) != 0) {
+            IoContext->BytesCompleted = 0;
+            Status = STATUS_SUCCESS;
+
         } else {
             Status = IopPerformNonCachedRead(FileObject,
                                              IoContext,
@@ -705,6 +774,16 @@ Return Value:
             PageCacheEntry = NULL;
             TotalBytesRead += BytesThisRound;
 
+        //
+        // A cache only read stops at the first page that is not resident.
+        //
+
+        } else if ((IoContext->Flags & IO_FLAG_CACHE_ONLY) != 0) {
+
+            ASSERT(CacheMiss == FALSE);
+
+            break;
+
         //
         // If there was no page cache entry and this is a new cache miss, then
         // mark the start of the miss.
@@ -765,18 +844,26 @@ Return Value:
     //
 
     if (DestinationIoBuffer != PageAlignedIoBuffer) {
-        TotalBytesRead -= DestinationByteOffset;
+        if (TotalBytesRead > DestinationByteOffset) {
+            TotalBytesRead -= DestinationByteOffset;
+
+        } else {
+            TotalBytesRead = 0;
+        }
 
-        ASSERT(TotalBytesRead == SizeInBytes);
+        ASSERT((TotalBytesRead == SizeInBytes) ||
+               ((IoContext->Flags & IO_FLAG_CACHE_ONLY) != 0));
 
-        Status = MmCopyIoBuffer(DestinationIoBuffer,
-                                0,
-                                PageAlignedIoBuffer,
-                                DestinationByteOffset,
-                                TotalBytesRead);
+        if (TotalBytesRead != 0) {
+            Status = MmCopyIoBuffer(DestinationIoBuffer,
+                                    0,
+                                    PageAlignedIoBuffer,
+                                    DestinationByteOffset,
+                                    TotalBytesRead);
 
-        if (!KSUCCESS(Status)) {
-            goto PerformCachedReadEnd;
+            if (!KSUCCESS(Status)) {
+                goto PerformCachedReadEnd;
+            }
         }
     }
 
@@ -849,6 +936,7 @@ Return Value:
     ULONG PageByteOffset;
     PPAGE_CACHE_ENTRY PageCacheEntry;
     ULONG PageSize;
+    BOOL Reserved;
     UINTN SizeInBytes;
     KSTATUS Status;
     IO_WRITE_CONTEXT WriteContext;
@@ -875,6 +963,7 @@ Return Value:
     WriteContext.IoFlags = IoContext->Flags;
     PageByteOffset = 0;
     PageSize = MmPageSize();
+    Reserved = FALSE;
     SizeInBytes = IoContext->SizeInBytes;
     WriteOutNow = FALSE;
     if ((IoContext->Flags & IO_FLAG_DATA_SYNCHRONIZED) != 0) {
@@ -962,6 +1051,28 @@ Return Value:
 
     FileSize = FileObject->Properties.Size;
 
+    //
+    // The driver of a file whose only copy of the data is the page cache does
+    // not see writes until the page cache releases the pages, which is too
+    // late to refuse them. Grow the file through the driver first so it can
+    // charge for the space, and fail the write if there isn't room. The
+    // write context keeps the old size, as there is nothing to read past it.
+    //
+
+    if (((FileObject->Flags & FILE_OBJECT_FLAG_HARD_FLUSH_REQUIRED) != 0) &&
+        (FileObject->Properties.Type != IoObjectSharedMemoryObject)) {
+
+        EndOffset = IoContext->Offset + SizeInBytes;
+        if (EndOffset > FileSize) {
+            Status = IopResizeHardFlushFile(FileObject, EndOffset);
+            if (!KSUCCESS(Status)) {
+                goto PerformCachedWriteEnd;
+            }
+
+            Reserved = TRUE;
+        }
+    }
+
     //
     // Iterate over each page, searching for page cache entries to copy into.
     //
@@ -1092,11 +1203,21 @@ Return Value:
 PerformCachedWriteEnd:
 
     //
-    // On failure, evict any page cache entries that may have been inserted
-    // above the file size.
+    // On failure, give back the space reserved past what was written, then
+    // evict any page cache entries that may have been inserted above the file
+    // size.
     //
 
     if (!KSUCCESS(Status)) {
+        if (Reserved != FALSE) {
+            NewFileSize = IoContext->Offset + WriteContext.BytesCompleted;
+            if (NewFileSize < FileSize) {
+                NewFileSize = FileSize;
+            }
+
+            IopResizeHardFlushFile(FileObject, NewFileSize);
+        }
+
         FileSize = FileObject->Properties.Size;
         IopEvictFileObject(FileObject, FileSize, EVICTION_FLAG_TRUNCATE);
     }
@@ -1119,6 +1240,59 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+IopResizeHardFlushFile (
+    PFILE_OBJECT FileObject,
+    ULONGLONG NewSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the size of a file whose only copy of the data is the
+    page cache by sending a truncate to its driver. This gives the driver a
+    chance to charge for (or release) the space as the file changes size. This
+    routine assumes the file object lock is held exclusively.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object.
+
+    NewSize - Supplies the new file size.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    SYSTEM_CONTROL_TRUNCATE Request;
+    KSTATUS Status;
+
+    ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock) != FALSE);
+    ASSERT((FileObject->Flags & FILE_OBJECT_FLAG_HARD_FLUSH_REQUIRED) != 0);
+
+    if (NewSize == FileObject->Properties.Size) {
+        return STATUS_SUCCESS;
+    }
+
+    Request.FileProperties = &(FileObject->Properties);
+    Request.DeviceContext = FileObject->DeviceContext;
+    Request.NewSize = NewSize;
+    Status = IopSendSystemControlIrp(FileObject->Device,
+                                     IrpMinorSystemControlTruncate,
+                                     &Request);
+
+    if (KSUCCESS(Status)) {
+        IopMarkFileObjectPropertiesDirty(FileObject);
+    }
+
+    return Status;
+}
+
 KSTATUS
 IopHandleCacheWriteMiss (
     PFILE_OBJECT FileObject,
@@ -1564,8 +1738,11 @@ Return Value:
     ULONG BlockSize;
     UINTN BytesCopied;
     UINTN CopySize;
+    IO_OFFSET FileEnd;
     ULONGLONG FileSize;
     ULONG PageSize;
+    IO_OFFSET ReadAheadEnd;
+    UINTN ReadAheadSize;
     PIO_BUFFER ReadIoBuffer;
     IO_CONTEXT ReadIoContext;
     KSTATUS Status;
@@ -1600,18 +1777,38 @@ Return Value:
     ASSERT(IS_ALIGNED(BlockAlignedOffset, PageSize) != FALSE);
 
     //
-    // If this is a miss for a device, read ahead some amount in anticipation
-    // of accessing the next pages of the device in the near future. Don't read
-    // ahead if system memory is low.
+    // Read ahead some amount in anticipation of accessing the next pages in
+    // the near future. Devices always read ahead, but files only do once
+    // misses turn out to be sequential. Each miss that picks up where the
+    // last one ended doubles the window, so large sequential reads end up in
+    // big physically contiguous runs. Don't read ahead if system memory is
+    // low.
     //
 
+    ReadAheadSize = 0;
+    if (BlockAlignedOffset == FileObject->ReadAheadOffset) {
+        ReadAheadSize = FileObject->ReadAheadSize << 1;
+        if (ReadAheadSize < IO_READ_AHEAD_SIZE) {
+            ReadAheadSize = IO_READ_AHEAD_SIZE;
+
+        } else if (ReadAheadSize > IO_READ_AHEAD_MAX_SIZE) {
+            ReadAheadSize = IO_READ_AHEAD_MAX_SIZE;
+        }
+
+    } else if (FileObject->Properties.Type == IoObjectBlockDevice) {
+        ReadAheadSize = IO_READ_AHEAD_SIZE;
+    }
+
+    if (MmGetPhysicalMemoryWarningLevel() != MemoryWarningLevelNone) {
+        ReadAheadSize = 0;
+    }
+
+    ASSERT(IS_ALIGNED(ReadAheadSize, PageSize));
+
     if (FileObject->Properties.Type == IoObjectBlockDevice) {
         FileSize = FileObject->Properties.Size;
-        if (MmGetPhysicalMemoryWarningLevel() == MemoryWarningLevelNone) {
-            BlockAlignedSize = ALIGN_RANGE_UP(BlockAlignedSize,
-                                              IO_READ_AHEAD_SIZE);
-
-            ASSERT(IS_ALIGNED(IO_READ_AHEAD_SIZE, PageSize));
+        if (ReadAheadSize != 0) {
+            BlockAlignedSize = ALIGN_RANGE_UP(BlockAlignedSize, ReadAheadSize);
         }
 
         if (((BlockAlignedOffset + BlockAlignedSize) < BlockAlignedOffset) ||
@@ -1620,8 +1817,30 @@ Return Value:
             BlockAlignedSize = FileSize - BlockAlignedOffset;
             BlockAlignedSize = ALIGN_RANGE_UP(BlockAlignedSize, PageSize);
         }
+
+    //
+    // Files only read ahead up to the block that holds the end of the file,
+    // but never less than what was asked for.
+    //
+
+    } else if (ReadAheadSize != 0) {
+        FileEnd = ALIGN_RANGE_UP(FileObject->Properties.Size, BlockSize);
+        FileEnd = ALIGN_RANGE_UP(FileEnd, PageSize);
+        ReadAheadEnd = BlockAlignedOffset +
+                       ALIGN_RANGE_UP(BlockAlignedSize, ReadAheadSize);
+
+        if (ReadAheadEnd > FileEnd) {
+            ReadAheadEnd = FileEnd;
+        }
+
+        if (ReadAheadEnd > (BlockAlignedOffset + BlockAlignedSize)) {
+            BlockAlignedSize = ReadAheadEnd - BlockAlignedOffset;
+        }
     }
 
+    FileObject->ReadAheadOffset = BlockAlignedOffset + BlockAlignedSize;
+    FileObject->ReadAheadSize = ReadAheadSize;
+
     //
     // Allocate an I/O buffer that is not backed by any pages. The read will
     // either hit a caching layer and fill in the I/O buffer with page cache
@@ -2427,3 +2646,93 @@ Return Value:
     return Status;
 }
 
+KSTATUS
+IopPerformDirectIo (
+    PFILE_OBJECT FileObject,
+    PIO_CONTEXT IoContext,
+    PVOID DeviceContext
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a read or write for a handle opened for direct I/O.
+    The request must be block aligned in offset, size, and buffer, so that the
+    non-cached path hands the caller's buffer straight to the driver, which
+    locks it down and transfers into it. It is assumed that the file lock is
+    held, exclusively for writes.
+
+Arguments:
+
+    FileObject - Supplies a pointer to a cacheable file object.
+
+    IoContext - Supplies a pointer to the I/O context.
+
+    DeviceContext - Supplies a pointer to the device context to use when
+        accessing the backing device.
+
+Return Value:
+
+    STATUS_INVALID_PARAMETER if the request is not block aligned.
+
+    Other status codes as returned by the non-cached I/O routines.
+
+--*/
+
+{
+
+    UINTN Address;
+    ULONG BlockSize;
+    PIO_BUFFER_FRAGMENT Fragment;
+    UINTN FragmentIndex;
+    PIO_BUFFER IoBuffer;
+    KSTATUS Status;
+
+    IoContext->BytesCompleted = 0;
+    if (FileObject->Properties.Type == IoObjectBlockDevice) {
+        BlockSize = FileObject->Properties.BlockSize;
+
+    } else {
+        BlockSize = MmPageSize();
+    }
+
+    if ((IS_ALIGNED(IoContext->Offset, BlockSize) == FALSE) ||
+        (IS_ALIGNED(IoContext->SizeInBytes, BlockSize) == FALSE)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    IoBuffer = IoContext->IoBuffer;
+    for (FragmentIndex = 0;
+         FragmentIndex < IoBuffer->FragmentCount;
+         FragmentIndex += 1) {
+
+        Fragment = &(IoBuffer->Fragment[FragmentIndex]);
+        Address = (UINTN)(Fragment->VirtualAddress);
+        if ((IS_ALIGNED(Address, BlockSize) == FALSE) ||
+            (IS_ALIGNED(Fragment->Size, BlockSize) == FALSE)) {
+
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    if (IoContext->SizeInBytes == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    if (IoContext->Write == FALSE) {
+        return IopPerformNonCachedRead(FileObject, IoContext, DeviceContext);
+    }
+
+    Status = IopPerformNonCachedWrite(FileObject, IoContext, DeviceContext);
+    if (IoContext->BytesCompleted != 0) {
+        IopRefreshPageCacheEntries(FileObject,
+                                   IoContext->Offset,
+                                   IoBuffer,
+                                   IoContext->BytesCompleted);
+    }
+
+    return Status;
+}
+
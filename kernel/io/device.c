@@ -488,16 +488,52 @@ Return Value:
 
     //
     // This device is being marked mountable after it's fully started. Create
-    // the volume for it now.
+    // the volume for it now, unless volumes are only created by mounts.
     //
 
-    if ((Device->Flags & DEVICE_FLAG_MOUNTED) == 0) {
+    if ((Device->Flags &
+         (DEVICE_FLAG_MOUNTED | DEVICE_FLAG_VOLUME_PER_MOUNT)) == 0) {
+
         IoCreateVolume(Device, NULL);
     }
 
     return;
 }
 
+KERNEL_API
+VOID
+IoSetDeviceVolumePerMount (
+    PDEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine indicates that every mount of the given device should get a
+    new volume of its own, rather than sharing one volume. No volume is
+    created for the device until it is mounted, and each volume goes away when
+    its mount does. This must be called before the device is marked mountable,
+    and cannot be undone. This routine is not thread safe.
+
+Arguments:
+
+    Device - Supplies a pointer to the device.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT((Device->Flags & DEVICE_FLAG_MOUNTABLE) == 0);
+
+    Device->Flags |= DEVICE_FLAG_VOLUME_PER_MOUNT;
+    return;
+}
+
 KERNEL_API
 BOOL
 IoAreDeviceIdsEqual (
@@ -2475,7 +2511,8 @@ Return Value:
         case DeviceEnumerated:
             IopSetDeviceState(Device, DeviceStarted);
             if (((Device->Flags & DEVICE_FLAG_MOUNTABLE) != 0) &&
-                ((Device->Flags & DEVICE_FLAG_MOUNTED) == 0)) {
+                ((Device->Flags & DEVICE_FLAG_MOUNTED) == 0) &&
+                ((Device->Flags & DEVICE_FLAG_VOLUME_PER_MOUNT) == 0)) {
 
                 IoCreateVolume(Device, NULL);
             }
@@ -680,6 +680,13 @@ Return Value:
         ObReleaseReference(Device->TargetDevice);
     }
 
+    //
+    // Tear down the writeback state. All file objects backed by the device
+    // are gone.
+    //
+
+    IopDestroyDeviceWriteback(Device);
+
     //
     // The device's work queue should be empty.
     //
@@ -40,14 +40,91 @@ Module Name:
 #define FILE_OBJECT_ALLOCATION_TAG 0x624F6946 // 'bOiF'
 #define FILE_OBJECT_MAX_REFERENCE_COUNT 0x10000000
 
+//
+// Define the number of independently locked shards the file objects are
+// spread across. This must be a power of two.
+//
+
+#define FILE_OBJECT_SHARD_COUNT 64
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines one shard of the global file object index. A file
+    object always lives in the shard selected by its device and file IDs.
+
+Members:
+
+    Tree - Stores the tree of file objects in this shard.
+
+    OrphanedList - Stores the list of file objects in this shard that failed
+        to close and are waiting to be released again.
+
+    Lock - Stores a pointer to the lock protecting both the tree and the
+        orphaned list, and serializing reference count transitions on the
+        file objects in this shard.
+
+--*/
+
+typedef struct _FILE_OBJECT_SHARD {
+    RED_BLACK_TREE Tree;
+    LIST_ENTRY OrphanedList;
+    PQUEUED_LOCK Lock;
+} FILE_OBJECT_SHARD, *PFILE_OBJECT_SHARD;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+KSTATUS
+IopFlushDirtyFileObjects (
+    DEVICE_ID DeviceId,
+    PDEVICE_WRITEBACK Writeback,
+    BOOL MatchWriteback,
+    ULONG Flags,
+    PUINTN PageCount
+    );
+
+PFILE_OBJECT
+IopGetNextDirtyFileObject (
+    PFILE_OBJECT CurrentObject,
+    DEVICE_ID DeviceId,
+    PDEVICE_WRITEBACK Writeback,
+    BOOL MatchWriteback,
+    BOOL BlockDevices
+    );
+
+PFILE_OBJECT
+IopFindDirtyFileObject (
+    PLIST_ENTRY ListHead,
+    PLIST_ENTRY StartEntry,
+    DEVICE_ID DeviceId,
+    PDEVICE_WRITEBACK Writeback,
+    BOOL MatchWriteback,
+    BOOL BlockDevices
+    );
+
+VOID
+IopGetDirtyFileObjectList (
+    PDEVICE_WRITEBACK Writeback,
+    PLIST_ENTRY *ListHead,
+    PQUEUED_LOCK *Lock
+    );
+
+BOOL
+IopIsFileObjectFlushTarget (
+    PFILE_OBJECT FileObject,
+    DEVICE_ID DeviceId,
+    PDEVICE_WRITEBACK Writeback,
+    BOOL MatchWriteback,
+    BOOL BlockDevices
+    );
+
 KSTATUS
 IopFlushFileObjectProperties (
     PFILE_OBJECT FileObject,
@@ -61,8 +138,14 @@ IopCompareFileObjectNodes (
     PRED_BLACK_TREE_NODE SecondNode
     );
 
+PFILE_OBJECT_SHARD
+IopGetFileObjectShard (
+    PFILE_PROPERTIES Properties
+    );
+
 PFILE_OBJECT
 IopLookupFileObjectByProperties (
+    PFILE_OBJECT_SHARD Shard,
     PFILE_PROPERTIES Properties
     );
 
@@ -83,35 +166,24 @@ IopSendIoSignal (
 //
 
 //
-// Store the global tree of file objects.
+// Store the shards of the global file object index.
 //
 
-RED_BLACK_TREE IoFileObjectsTree;
+FILE_OBJECT_SHARD IoFileObjectShards[FILE_OBJECT_SHARD_COUNT];
 
 //
-// Store the global list of dirty file objects.
+// Store the list of dirty file objects that have no device writeback state.
+// Those that do are kept on the dirty list of their device's writeback state.
 //
 
 LIST_ENTRY IoFileObjectsDirtyList;
 
 //
-// Store the lock synchronizing access to the dirty file objects list.
+// Store the lock synchronizing access to the global dirty file objects list.
 //
 
 PQUEUED_LOCK IoFileObjectsDirtyListLock;
 
-//
-// Store the global list of orphaned file objects.
-//
-
-LIST_ENTRY IoFileObjectsOrphanedList;
-
-//
-// Store a queued lock that protects both the tree and the list.
-//
-
-PQUEUED_LOCK IoFileObjectsLock;
-
 //
 // Store a lock that can serialize flush operations.
 //
@@ -683,14 +755,21 @@ Return Value:
 
 {
 
-    RtlRedBlackTreeInitialize(&IoFileObjectsTree, 0, IopCompareFileObjectNodes);
-    INITIALIZE_LIST_HEAD(&IoFileObjectsDirtyList);
-    INITIALIZE_LIST_HEAD(&IoFileObjectsOrphanedList);
-    IoFileObjectsLock = KeCreateQueuedLock();
-    if (IoFileObjectsLock == NULL) {
-        return STATUS_INSUFFICIENT_RESOURCES;
+    ULONG Index;
+    PFILE_OBJECT_SHARD Shard;
+
+    for (Index = 0; Index < FILE_OBJECT_SHARD_COUNT; Index += 1) {
+        Shard = &(IoFileObjectShards[Index]);
+        RtlRedBlackTreeInitialize(&(Shard->Tree), 0, IopCompareFileObjectNodes);
+        INITIALIZE_LIST_HEAD(&(Shard->OrphanedList));
+        Shard->Lock = KeCreateQueuedLock();
+        if (Shard->Lock == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
     }
 
+    INITIALIZE_LIST_HEAD(&IoFileObjectsDirtyList);
+
     IoFileObjectsDirtyListLock = KeCreateQueuedLock();
     if (IoFileObjectsDirtyListLock == NULL) {
         return STATUS_INSUFFICIENT_RESOURCES;
@@ -719,7 +798,7 @@ Routine Description:
 
     This routine attempts to look up a file object with the given properties
     (specifically the I-Node number and volume). If one does not exist, it
-    is created and inserted in the global list. If a special file object is
+    is created and inserted in the global index. If a special file object is
     created, the ready event is left unsignaled so the remainder of the state
     can be created.
 
@@ -753,6 +832,7 @@ Return Value:
     BOOL LockHeld;
     PFILE_OBJECT NewObject;
     PFILE_OBJECT Object;
+    PFILE_OBJECT_SHARD Shard;
     KSTATUS Status;
 
     ASSERT(Properties->DeviceId != 0);
@@ -762,22 +842,23 @@ Return Value:
     LockHeld = FALSE;
     NewObject = NULL;
     Object = NULL;
+    Shard = IopGetFileObjectShard(Properties);
     while (TRUE) {
 
         //
         // See if the file object already exists.
         //
 
-        KeAcquireQueuedLock(IoFileObjectsLock);
+        KeAcquireQueuedLock(Shard->Lock);
         LockHeld = TRUE;
-        Object = IopLookupFileObjectByProperties(Properties);
+        Object = IopLookupFileObjectByProperties(Shard, Properties);
         if (Object == NULL) {
 
             //
             // There's no object, so drop the lock and go allocate one.
             //
 
-            KeReleaseQueuedLock(IoFileObjectsLock);
+            KeReleaseQueuedLock(Shard->Lock);
             LockHeld = FALSE;
             if (NewObject == NULL) {
                 NewObject = MmAllocatePagedPool(sizeof(FILE_OBJECT),
@@ -789,11 +870,8 @@ Return Value:
                 }
 
                 RtlZeroMemory(NewObject, sizeof(FILE_OBJECT));
-                INITIALIZE_LIST_HEAD(&(NewObject->FileLockList));
                 INITIALIZE_LIST_HEAD(&(NewObject->DirtyPageList));
-                RtlRedBlackTreeInitialize(&(NewObject->PageCacheTree),
-                                          0,
-                                          IopComparePageCacheEntries);
+                IopInitializePageCacheIndex(&(NewObject->PageCacheIndex));
 
                 NewObject->Lock = KeCreateSharedExclusiveLock();
                 if (NewObject->Lock == NULL) {
@@ -819,6 +897,16 @@ Return Value:
                 NewObject->Device = Device;
                 ObAddReference(Device);
 
+                //
+                // Cached data gets written back by the thread belonging to
+                // the device it lives on. Objects with no backing device are
+                // left to the page cache thread.
+                //
+
+                if (IO_IS_CACHEABLE_TYPE(Properties->Type) != FALSE) {
+                    NewObject->Writeback = IopGetDeviceWriteback(Device);
+                }
+
                 //
                 // If the device is a special device, then more state needs to
                 // be set up. Don't let additional lookups come in and use the
@@ -859,12 +947,11 @@ Return Value:
             // added this entry since the lock was dropped, so check once more.
             //
 
-            KeAcquireQueuedLock(IoFileObjectsLock);
+            KeAcquireQueuedLock(Shard->Lock);
             LockHeld = TRUE;
-            Object = IopLookupFileObjectByProperties(Properties);
+            Object = IopLookupFileObjectByProperties(Shard, Properties);
             if (Object == NULL) {
-                RtlRedBlackTreeInsert(&IoFileObjectsTree,
-                                      &(NewObject->TreeEntry));
+                RtlRedBlackTreeInsert(&(Shard->Tree), &(NewObject->TreeEntry));
 
                 ASSERT(NewObject->ListEntry.Next == NULL);
 
@@ -874,7 +961,7 @@ Return Value:
             }
         }
 
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Shard->Lock);
         LockHeld = FALSE;
 
         //
@@ -912,7 +999,7 @@ Return Value:
 
 CreateOrLookupFileObjectEnd:
     if (LockHeld != FALSE) {
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Shard->Lock);
     }
 
     if (!KSUCCESS(Status)) {
@@ -1021,22 +1108,24 @@ Return Value:
     PDEVICE Device;
     IRP_MINOR_CODE MinorCode;
     ULONG OldCount;
+    PFILE_OBJECT_SHARD Shard;
     KSTATUS Status;
 
     Status = STATUS_SUCCESS;
 
     //
-    // Acquire the lock before decrementing the reference count. This is needed
-    // to make the "decrement reference count, signal event, set closing"
-    // operation atomic. If it weren't, people could increment the reference
-    // count thinking the file object was good to use, and then this function
-    // would close it down on them. It's assumed that people calling add
-    // reference on the file object already had some other valid reference,
-    // otherwise the global lock would have to be acquired in the add reference
-    // routine as well.
+    // Acquire the shard lock before decrementing the reference count. This is
+    // needed to make the "decrement reference count, signal event, set
+    // closing" operation atomic. If it weren't, people could increment the
+    // reference count thinking the file object was good to use, and then this
+    // function would close it down on them. It's assumed that people calling
+    // add reference on the file object already had some other valid
+    // reference, otherwise the shard lock would have to be acquired in the add
+    // reference routine as well.
     //
 
-    KeAcquireQueuedLock(IoFileObjectsLock);
+    Shard = IopGetFileObjectShard(&(Object->Properties));
+    KeAcquireQueuedLock(Shard->Lock);
     OldCount = RtlAtomicAdd32(&(Object->ReferenceCount), -1);
 
     ASSERT((OldCount != 0) && (OldCount < FILE_OBJECT_MAX_REFERENCE_COUNT));
@@ -1056,7 +1145,7 @@ Return Value:
         //
 
         if ((Object->Flags & FILE_OBJECT_FLAG_CLOSING) != 0) {
-            KeReleaseQueuedLock(IoFileObjectsLock);
+            KeReleaseQueuedLock(Shard->Lock);
             goto FileObjectReleaseReferenceEnd;
         }
 
@@ -1090,7 +1179,7 @@ Return Value:
         //      deadlock with the failed file clean-up.
         //
 
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Shard->Lock);
 
         //
         // As dirty file objects sit on the dirty file object list with a
@@ -1146,13 +1235,13 @@ Return Value:
 
         //
         // The file system is officially disengaged from this file object,
-        // remove the file object from the global tree, allowing new callers to
-        // recreate the file object.
+        // remove the file object from the global index, allowing new callers
+        // to recreate the file object.
         //
 
-        KeAcquireQueuedLock(IoFileObjectsLock);
-        RtlRedBlackTreeRemove(&IoFileObjectsTree, &(Object->TreeEntry));
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeAcquireQueuedLock(Shard->Lock);
+        RtlRedBlackTreeRemove(&(Shard->Tree), &(Object->TreeEntry));
+        KeReleaseQueuedLock(Shard->Lock);
 
         //
         // Now release everyone who got stuck while trying to open this closing
@@ -1169,12 +1258,12 @@ Return Value:
     //
 
     } else if (OldCount == 1) {
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Shard->Lock);
 
         ASSERT(Object->ListEntry.Next == NULL);
         ASSERT((Object->Flags & FILE_OBJECT_FLAG_CLOSING) != 0);
         ASSERT(Object->PathEntryCount == 0);
-        ASSERT(LIST_EMPTY(&(Object->FileLockList)) != FALSE);
+        ASSERT(Object->FileLockTree == NULL);
 
         //
         // If this was an object manager object, release the reference on the
@@ -1218,9 +1307,11 @@ Return Value:
             MmDestroyImageSectionList(Object->ImageSectionList);
         }
 
-        ASSERT(RED_BLACK_TREE_EMPTY(&(Object->PageCacheTree)));
+        ASSERT(Object->PageCacheIndex.EntryCount == 0);
         ASSERT(LIST_EMPTY(&(Object->DirtyPageList)));
 
+        IopDestroyPageCacheIndex(&(Object->PageCacheIndex));
+
         if (Object->Lock != NULL) {
             KeDestroySharedExclusiveLock(Object->Lock);
         }
@@ -1248,7 +1339,7 @@ Return Value:
     //
 
     } else {
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Shard->Lock);
     }
 
 FileObjectReleaseReferenceEnd:
@@ -1269,12 +1360,12 @@ Return Value:
         // orphaned objects.
         //
 
-        KeAcquireQueuedLock(IoFileObjectsLock);
+        KeAcquireQueuedLock(Shard->Lock);
         if (Object->ReferenceCount == 1) {
-            INSERT_BEFORE(&(Object->ListEntry), &IoFileObjectsOrphanedList);
+            INSERT_BEFORE(&(Object->ListEntry), &(Shard->OrphanedList));
         }
 
-        KeReleaseQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Shard->Lock);
 
         //
         // The signal event acts as a memory barrier still protecting this
@@ -1476,9 +1567,9 @@ IopFlushFileObjects (
 
 Routine Description:
 
-    This routine iterates over file objects in the global dirty file objects
-    list, flushing each one that belongs to the given device or to all entries
-    if a device ID of 0 is specified.
+    This routine iterates over the dirty file objects lists, flushing each
+    file object that belongs to the given device or to all entries if a device
+    ID of 0 is specified.
 
 Arguments:
 
@@ -1504,196 +1595,44 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
-    PFILE_OBJECT CurrentObject;
-    ULONG FlushCount;
-    BOOL FlushExclusive;
-    ULONG FlushIndex;
-    PFILE_OBJECT NextObject;
-    KSTATUS Status;
-    KSTATUS TotalStatus;
-
-    CurrentObject = NULL;
-    TotalStatus = STATUS_SUCCESS;
-
-    //
-    // Synchronized flushes need to guarantee that all the data is out to disk
-    // before returning.
-    //
-
-    FlushCount = 1;
-    FlushExclusive = FALSE;
-    if ((Flags & IO_FLAG_DATA_SYNCHRONIZED) != 0) {
-        FlushExclusive = TRUE;
-
-        //
-        // If the goal is to flush the entire cache, then don't actually
-        // perform the flush synchronized. Just loop twice so that the first
-        // round gets all dirty data from the upper layers to the disk layer
-        // and the second loop will flush it to disk. This allows for larger,
-        // faster writes to disk.
-        //
-
-        if (DeviceId == 0) {
-            Flags &= ~(IO_FLAG_DATA_SYNCHRONIZED |
-                       IO_FLAG_METADATA_SYNCHRONIZED);
-
-            FlushCount = 2;
-        }
-
-    //
-    // Non-synchronized flushes that encounter an empty list can just exit. Any
-    // necessary work is already being done. But if a specific device is
-    // supplied acquire the lock to make sure any other thread has finished
-    // flushing the device's data.
-    //
-
-    } else if ((DeviceId == 0) &&
-               (LIST_EMPTY(&IoFileObjectsDirtyList) != FALSE)) {
-
-        return STATUS_SUCCESS;
-    }
-
-    //
-    // Now make several attempts at performing the requested clean operation.
-    //
-
-    Status = STATUS_SUCCESS;
-    for (FlushIndex = 0; FlushIndex < FlushCount; FlushIndex += 1) {
-
-        //
-        // Get the first entry on the list, or the first file object for the
-        // specific device in question.
-        //
-
-        KeAcquireQueuedLock(IoFileObjectsDirtyListLock);
-        CurrentEntry = IoFileObjectsDirtyList.Next;
-        if (DeviceId == 0) {
-            CurrentObject = LIST_VALUE(CurrentEntry, FILE_OBJECT, ListEntry);
-
-        } else {
-            while (CurrentEntry != &IoFileObjectsDirtyList) {
-                CurrentObject = LIST_VALUE(CurrentEntry,
-                                           FILE_OBJECT,
-                                           ListEntry);
-
-                if (CurrentObject->Properties.DeviceId == DeviceId) {
-                    break;
-                }
-
-                CurrentEntry = CurrentEntry->Next;
-            }
-        }
-
-        if (CurrentEntry == &IoFileObjectsDirtyList) {
-            CurrentObject = NULL;
-
-        } else {
-            IopFileObjectAddReference(CurrentObject);
-        }
-
-        KeReleaseQueuedLock(IoFileObjectsDirtyListLock);
-
-        //
-        // If a device ID was supplied, but no file objects were found to
-        // belong to that device, then the flush was successful!
-        //
-
-        if ((CurrentObject == NULL) && (DeviceId != 0)) {
-            TotalStatus = STATUS_SUCCESS;
-            break;
-        }
-
-        //
-        // Loop cleaning file objects.
-        //
-
-        while (CurrentObject != NULL) {
-            Status = IopFlushFileObject(CurrentObject,
-                                        0,
-                                        -1,
-                                        Flags,
-                                        FlushExclusive,
-                                        PageCount);
-
-            if (!KSUCCESS(Status)) {
-                if (KSUCCESS(TotalStatus)) {
-                    TotalStatus = Status;
-                }
-            }
-
-            if ((PageCount != NULL) && (*PageCount == 0)) {
-                break;
-            }
-
-            //
-            // Re-lock the list, and get the next object.
-            //
+    return IopFlushDirtyFileObjects(DeviceId, NULL, FALSE, Flags, PageCount);
+}
 
-            NextObject = NULL;
-            KeAcquireQueuedLock(IoFileObjectsDirtyListLock);
-            if (CurrentObject->ListEntry.Next != NULL) {
-                CurrentEntry = CurrentObject->ListEntry.Next;
+KSTATUS
+IopFlushWritebackFileObjects (
+    PDEVICE_WRITEBACK Writeback,
+    ULONG Flags
+    )
 
-            } else {
-                CurrentEntry = IoFileObjectsDirtyList.Next;
-            }
+/*++
 
-            if (DeviceId == 0) {
-                if (CurrentEntry != &IoFileObjectsDirtyList) {
-                    NextObject = LIST_VALUE(CurrentEntry,
-                                            FILE_OBJECT,
-                                            ListEntry);
-                }
+Routine Description:
 
-            } else {
-                while (CurrentEntry != &IoFileObjectsDirtyList) {
-                    NextObject = LIST_VALUE(CurrentEntry,
-                                            FILE_OBJECT,
-                                            ListEntry);
+    This routine iterates over the dirty file objects list of the given
+    device, flushing each file object on it.
 
-                    if (NextObject->Properties.DeviceId == DeviceId) {
-                        break;
-                    }
+Arguments:
 
-                    CurrentEntry = CurrentEntry->Next;
-                }
+    Writeback - Supplies a pointer to the writeback state of the device whose
+        file objects should be flushed. Supply NULL to flush the file objects
+        that have no device writeback thread.
 
-                if (CurrentEntry == &IoFileObjectsDirtyList) {
-                    NextObject = NULL;
-                }
-            }
+    Flags - Supplies a bitmask of I/O flags. See IO_FLAG_* for definitions.
 
-            //
-            // Remove the file object from the list if it is clean now.
-            //
+Return Value:
 
-            if (IS_FILE_OBJECT_CLEAN(CurrentObject)) {
-                if (CurrentObject->ListEntry.Next != NULL) {
-                    LIST_REMOVE(&(CurrentObject->ListEntry));
-                    CurrentObject->ListEntry.Next = NULL;
-                    IopFileObjectReleaseReference(CurrentObject);
-                }
-            }
+    STATUS_SUCCESS if all file object were successfully iterated.
 
-            if (NextObject != NULL) {
-                IopFileObjectAddReference(NextObject);
-            }
+    STATUS_TRY_AGAIN if the iteration quit early for some reason (i.e. the page
+    cache was found to be too dirty when flushing file objects).
 
-            KeReleaseQueuedLock(IoFileObjectsDirtyListLock);
-            IopFileObjectReleaseReference(CurrentObject);
-            CurrentObject = NextObject;
-        }
+    Other status codes for other errors.
 
-        if (CurrentObject != NULL) {
-            IopFileObjectReleaseReference(CurrentObject);
-            CurrentObject = NULL;
-        }
-    }
+--*/
 
-    ASSERT(CurrentObject == NULL);
+{
 
-    return TotalStatus;
+    return IopFlushDirtyFileObjects(0, Writeback, TRUE, Flags, NULL);
 }
 
 VOID
@@ -1801,88 +1740,85 @@ Return Value:
 {
 
     PFILE_OBJECT CurrentObject;
+    ULONG Index;
     PRED_BLACK_TREE_NODE Node;
     PFILE_OBJECT ReleaseObject;
+    PFILE_OBJECT_SHARD Shard;
 
     ASSERT(DeviceId != 0);
 
     ReleaseObject = NULL;
 
     //
-    // Grab the global file objects lock and iterate over the file objects that
+    // Grab each shard's lock in turn and iterate over the file objects that
     // belong to the given device.
     //
 
-    KeAcquireQueuedLock(IoFileObjectsLock);
-    Node = RtlRedBlackTreeGetLowestNode(&IoFileObjectsTree);
-    while (Node != NULL) {
-        CurrentObject = RED_BLACK_TREE_VALUE(Node, FILE_OBJECT, TreeEntry);
-
-        //
-        // Skip file objects that do not match the device ID. Also skip any
-        // file objects that only have 1 reference. This means that they are
-        // about to get removed from the tree if close/delete are successful.
-        // As such, they don't have any page cache entries, as a page cache
-        // entry takes a reference on the file object.
-        //
+    for (Index = 0; Index < FILE_OBJECT_SHARD_COUNT; Index += 1) {
+        Shard = &(IoFileObjectShards[Index]);
+        KeAcquireQueuedLock(Shard->Lock);
+        Node = RtlRedBlackTreeGetLowestNode(&(Shard->Tree));
+        while (Node != NULL) {
+            CurrentObject = RED_BLACK_TREE_VALUE(Node, FILE_OBJECT, TreeEntry);
 
-        if ((CurrentObject->Properties.DeviceId != DeviceId) ||
-            (CurrentObject->ReferenceCount == 1)) {
+            //
+            // Skip file objects that do not match the device ID. Also skip
+            // any file objects that only have 1 reference. This means that
+            // they are about to get removed from the tree if close/delete are
+            // successful. As such, they don't have any page cache entries, as
+            // a page cache entry takes a reference on the file object.
+            //
 
-            Node = RtlRedBlackTreeGetNextNode(&(IoFileObjectsTree),
-                                              FALSE,
-                                              Node);
+            if ((CurrentObject->Properties.DeviceId != DeviceId) ||
+                (CurrentObject->ReferenceCount == 1)) {
 
-            CurrentObject = NULL;
-            continue;
-        }
+                Node = RtlRedBlackTreeGetNextNode(&(Shard->Tree), FALSE, Node);
+                continue;
+            }
 
-        //
-        // Take a reference on this object so it does not disappear when the
-        // lock is released.
-        //
+            //
+            // Take a reference on this object so it does not disappear when
+            // the lock is released.
+            //
 
-        IopFileObjectAddReference(CurrentObject);
-        KeReleaseQueuedLock(IoFileObjectsLock);
-        KeAcquireSharedExclusiveLockExclusive(CurrentObject->Lock);
+            IopFileObjectAddReference(CurrentObject);
+            KeReleaseQueuedLock(Shard->Lock);
+            KeAcquireSharedExclusiveLockExclusive(CurrentObject->Lock);
 
-        //
-        // Call the eviction routine for the current file object.
-        //
+            //
+            // Call the eviction routine for the current file object.
+            //
 
-        IopEvictFileObject(CurrentObject, 0, Flags);
+            IopEvictFileObject(CurrentObject, 0, Flags);
 
-        //
-        // Release the reference taken on the release object.
-        //
+            //
+            // Release the reference taken on the release object.
+            //
 
-        if (ReleaseObject != NULL) {
+            if (ReleaseObject != NULL) {
 
-            ASSERT(ReleaseObject->ReferenceCount >= 2);
+                ASSERT(ReleaseObject->ReferenceCount >= 2);
 
-            IopFileObjectReleaseReference(ReleaseObject);
-            ReleaseObject = NULL;
-        }
+                IopFileObjectReleaseReference(ReleaseObject);
+                ReleaseObject = NULL;
+            }
 
-        KeReleaseSharedExclusiveLockExclusive(CurrentObject->Lock);
-        KeAcquireQueuedLock(IoFileObjectsLock);
+            KeReleaseSharedExclusiveLockExclusive(CurrentObject->Lock);
+            KeAcquireQueuedLock(Shard->Lock);
 
-        //
-        // The current object and node should match.
-        //
+            //
+            // The current object and node should match.
+            //
 
-        ASSERT(&(CurrentObject->TreeEntry) == Node);
+            ASSERT(&(CurrentObject->TreeEntry) == Node);
 
-        Node = RtlRedBlackTreeGetNextNode(&(IoFileObjectsTree),
-                                          FALSE,
-                                          Node);
+            Node = RtlRedBlackTreeGetNextNode(&(Shard->Tree), FALSE, Node);
+            ReleaseObject = CurrentObject;
+        }
 
-        ReleaseObject = CurrentObject;
-        CurrentObject = NULL;
+        KeReleaseQueuedLock(Shard->Lock);
     }
 
-    KeReleaseQueuedLock(IoFileObjectsLock);
-
     //
     // Release any lingering references.
     //
@@ -1894,13 +1830,6 @@ Return Value:
         IopFileObjectReleaseReference(ReleaseObject);
     }
 
-    if (CurrentObject != NULL) {
-
-        ASSERT(ReleaseObject->ReferenceCount >= 2);
-
-        IopFileObjectReleaseReference(CurrentObject);
-    }
-
     return;
 }
 
@@ -2206,44 +2135,52 @@ Return Value:
 {
 
     PFILE_OBJECT CurrentObject;
+    ULONG Index;
     LIST_ENTRY LocalList;
+    PFILE_OBJECT_SHARD Shard;
 
-    //
-    // Exit immediately if there are no orphaned file objects.
-    //
+    for (Index = 0; Index < FILE_OBJECT_SHARD_COUNT; Index += 1) {
+        Shard = &(IoFileObjectShards[Index]);
 
-    if (LIST_EMPTY(&IoFileObjectsOrphanedList) != FALSE) {
-        return;
-    }
+        //
+        // Skip shards that have no orphaned file objects.
+        //
 
-    //
-    // Grab the global file objects lock, migrate the global orphaned file
-    // object list to a local list head and iterate over it. All objects on the
-    // list should have only 1 reference. If another thread resurrects any
-    // object during iteration, it will remove it from the local list and this
-    // routine will not see it. For those file objects processed, just add an
-    // extra reference with the lock held and release it with the lock released.
-    // This should kick off another attempt at closing out the file object.
-    //
+        if (LIST_EMPTY(&(Shard->OrphanedList)) != FALSE) {
+            continue;
+        }
+
+        //
+        // Grab the shard lock, migrate the shard's orphaned file object list
+        // to a local list head and iterate over it. All objects on the list
+        // should have only 1 reference. If another thread resurrects any
+        // object during iteration, it will remove it from the local list and
+        // this routine will not see it. For those file objects processed,
+        // just add an extra reference with the lock held and release it with
+        // the lock released. This should kick off another attempt at closing
+        // out the file object.
+        //
 
-    INITIALIZE_LIST_HEAD(&LocalList);
-    KeAcquireQueuedLock(IoFileObjectsLock);
-    MOVE_LIST(&IoFileObjectsOrphanedList, &LocalList);
-    INITIALIZE_LIST_HEAD(&IoFileObjectsOrphanedList);
-    while (LIST_EMPTY(&LocalList) == FALSE) {
-        CurrentObject = LIST_VALUE(LocalList.Next, FILE_OBJECT, ListEntry);
-        LIST_REMOVE(&(CurrentObject->ListEntry));
-        CurrentObject->ListEntry.Next = NULL;
+        INITIALIZE_LIST_HEAD(&LocalList);
+        KeAcquireQueuedLock(Shard->Lock);
+        MOVE_LIST(&(Shard->OrphanedList), &LocalList);
+        INITIALIZE_LIST_HEAD(&(Shard->OrphanedList));
+        while (LIST_EMPTY(&LocalList) == FALSE) {
+            CurrentObject = LIST_VALUE(LocalList.Next, FILE_OBJECT, ListEntry);
+            LIST_REMOVE(&(CurrentObject->ListEntry));
+            CurrentObject->ListEntry.Next = NULL;
 
-        ASSERT(CurrentObject->ReferenceCount == 1);
+            ASSERT(CurrentObject->ReferenceCount == 1);
+
+            IopFileObjectAddReference(CurrentObject);
+            KeReleaseQueuedLock(Shard->Lock);
+            IopFileObjectReleaseReference(CurrentObject);
+            KeAcquireQueuedLock(Shard->Lock);
+        }
 
-        IopFileObjectAddReference(CurrentObject);
-        KeReleaseQueuedLock(IoFileObjectsLock);
-        IopFileObjectReleaseReference(CurrentObject);
-        KeAcquireQueuedLock(IoFileObjectsLock);
+        KeReleaseQueuedLock(Shard->Lock);
     }
 
-    KeReleaseQueuedLock(IoFileObjectsLock);
     return;
 }
 
@@ -2372,8 +2309,8 @@ IopMarkFileObjectDirty (
 
 Routine Description:
 
-    This routine marks the given file object as dirty, moving it to the list of
-    dirty file objects if it is not already on a list.
+    This routine marks the given file object as dirty, moving it to the dirty
+    file objects list of its device if it is not already on a list.
 
 Arguments:
 
@@ -2387,28 +2324,19 @@ Return Value:
 
 {
 
+    PLIST_ENTRY ListHead;
+    PQUEUED_LOCK Lock;
+
     if ((FileObject->Flags & FILE_OBJECT_FLAG_DIRTY_DATA) == 0) {
-        KeAcquireQueuedLock(IoFileObjectsDirtyListLock);
+        IopGetDirtyFileObjectList(FileObject->Writeback, &ListHead, &Lock);
+        KeAcquireQueuedLock(Lock);
         RtlAtomicOr32(&(FileObject->Flags), FILE_OBJECT_FLAG_DIRTY_DATA);
         if (FileObject->ListEntry.Next == NULL) {
             IopFileObjectAddReference(FileObject);
-
-            //
-            // The lower layer file objects go at the end of the list. This
-            // allows flush to only traverse the list once to get all the data
-            // out to the block devices.
-            //
-
-            if (FileObject->Properties.Type == IoObjectBlockDevice) {
-                INSERT_BEFORE(&(FileObject->ListEntry),
-                              &IoFileObjectsDirtyList);
-
-            } else {
-                INSERT_AFTER(&(FileObject->ListEntry), &IoFileObjectsDirtyList);
-            }
+            INSERT_BEFORE(&(FileObject->ListEntry), ListHead);
         }
 
-        KeReleaseQueuedLock(IoFileObjectsDirtyListLock);
+        KeReleaseQueuedLock(Lock);
         IopSchedulePageCacheThread();
     }
 
@@ -2489,63 +2417,127 @@ Return Value:
 {
 
     PFILE_OBJECT FileObject;
+    ULONG Index;
+    PLIST_ENTRY ListHead;
+    PQUEUED_LOCK Lock;
     PRED_BLACK_TREE_NODE Node;
+    PFILE_OBJECT_SHARD Shard;
+
+    for (Index = 0; Index < FILE_OBJECT_SHARD_COUNT; Index += 1) {
+        Shard = &(IoFileObjectShards[Index]);
+        KeAcquireQueuedLock(Shard->Lock);
+        Node = RtlRedBlackTreeGetLowestNode(&(Shard->Tree));
+        while (Node != NULL) {
+            FileObject = RED_BLACK_TREE_VALUE(Node, FILE_OBJECT, TreeEntry);
+            if (!LIST_EMPTY(&(FileObject->DirtyPageList))) {
+                if (IS_FILE_OBJECT_CLEAN(FileObject)) {
+                    RtlDebugPrint("FILE_OBJECT 0x%x marked as clean with "
+                                  "non-empty dirty list.\n",
+                                  FileObject);
+                }
 
-    KeAcquireQueuedLock(IoFileObjectsLock);
-    KeAcquireQueuedLock(IoFileObjectsDirtyListLock);
-    Node = RtlRedBlackTreeGetLowestNode(&IoFileObjectsTree);
-    while (Node != NULL) {
-        FileObject = RED_BLACK_TREE_VALUE(Node, FILE_OBJECT, TreeEntry);
-        if (!LIST_EMPTY(&(FileObject->DirtyPageList))) {
-            if (IS_FILE_OBJECT_CLEAN(FileObject)) {
-                RtlDebugPrint("FILE_OBJECT 0x%x marked as clean with "
-                              "non-empty dirty list.\n",
-                              FileObject);
-            }
+                IopGetDirtyFileObjectList(FileObject->Writeback,
+                                          &ListHead,
+                                          &Lock);
+
+                KeAcquireQueuedLock(Lock);
+                if (FileObject->ListEntry.Next == NULL) {
+                    RtlDebugPrint("FILE_OBJECT 0x%x dirty but not in dirty "
+                                  "list.\n",
+                                  FileObject);
+                }
 
-            if (FileObject->ListEntry.Next == NULL) {
-                RtlDebugPrint("FILE_OBJECT 0x%x dirty but not in dirty list.\n",
-                              FileObject);
+                KeReleaseQueuedLock(Lock);
             }
+
+            Node = RtlRedBlackTreeGetNextNode(&(Shard->Tree), FALSE, Node);
         }
 
-        Node = RtlRedBlackTreeGetNextNode(&IoFileObjectsTree, FALSE, Node);
+        KeReleaseQueuedLock(Shard->Lock);
     }
 
-    KeReleaseQueuedLock(IoFileObjectsDirtyListLock);
-    KeReleaseQueuedLock(IoFileObjectsLock);
     return;
 }
 
-PIO_ASYNC_STATE
-IopGetAsyncState (
-    PIO_OBJECT_STATE State
+BOOL
+IopAreFileObjectsDirty (
+    VOID
     )
 
 /*++
 
 Routine Description:
 
-    This routine returns or attempts to create the asynchronous state for an
-    I/O object state.
+    This routine determines whether any of the dirty file objects lists have
+    file objects on them.
 
 Arguments:
 
-    State - Supplies a pointer to the I/O object state.
+    None.
 
 Return Value:
 
-    Returns a pointer to the async state on success. This may have just been
-    created.
+    TRUE if there are dirty file objects.
 
-    NULL if no async state exists and none could be created.
+    FALSE if all the dirty file objects lists are empty.
 
 --*/
 
 {
 
-    PIO_ASYNC_STATE Async;
-    PIO_ASYNC_STATE OldValue;
+    PLIST_ENTRY CurrentEntry;
+    BOOL Dirty;
+    PDEVICE_WRITEBACK Writeback;
+
+    if (LIST_EMPTY(&IoFileObjectsDirtyList) == FALSE) {
+        return TRUE;
+    }
+
+    Dirty = FALSE;
+    KeAcquireQueuedLock(IoWritebackListLock);
+    CurrentEntry = IoWritebackList.Next;
+    while (CurrentEntry != &IoWritebackList) {
+        Writeback = LIST_VALUE(CurrentEntry, DEVICE_WRITEBACK, ListEntry);
+        CurrentEntry = CurrentEntry->Next;
+        if (LIST_EMPTY(&(Writeback->DirtyList)) == FALSE) {
+            Dirty = TRUE;
+            break;
+        }
+    }
+
+    KeReleaseQueuedLock(IoWritebackListLock);
+    return Dirty;
+}
+
+PIO_ASYNC_STATE
+IopGetAsyncState (
+    PIO_OBJECT_STATE State
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns or attempts to create the asynchronous state for an
+    I/O object state.
+
+Arguments:
+
+    State - Supplies a pointer to the I/O object state.
+
+Return Value:
+
+    Returns a pointer to the async state on success. This may have just been
+    created.
+
+    NULL if no async state exists and none could be created.
+
+--*/
+
+{
+
+    PIO_ASYNC_STATE Async;
+    PIO_ASYNC_STATE OldValue;
 
     if (State->Async != NULL) {
         return State->Async;
@@ -2590,6 +2582,496 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+KSTATUS
+IopFlushDirtyFileObjects (
+    DEVICE_ID DeviceId,
+    PDEVICE_WRITEBACK Writeback,
+    BOOL MatchWriteback,
+    ULONG Flags,
+    PUINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine iterates over the dirty file objects lists, flushing each
+    file object that passes the given filters.
+
+Arguments:
+
+    DeviceId - Supplies an optional device ID filter. Supply 0 to not filter
+        by device ID.
+
+    Writeback - Supplies the writeback state to filter by, if the match
+        writeback parameter is set.
+
+    MatchWriteback - Supplies a boolean indicating whether to only flush file
+        objects whose writeback state is the given one. Only that writeback
+        state's dirty list is searched.
+
+    Flags - Supplies a bitmask of I/O flags. See IO_FLAG_* for definitions.
+
+    PageCount - Supplies an optional pointer describing how many pages to flush.
+        On output this value will be decreased by the number of pages actually
+        flushed. Supply NULL to flush all pages.
+
+Return Value:
+
+    STATUS_SUCCESS if all file object were successfully iterated.
+
+    STATUS_TRY_AGAIN if the iteration quit early for some reason (i.e. the page
+    cache was found to be too dirty when flushing file objects).
+
+    Other status codes for other errors.
+
+--*/
+
+{
+
+    BOOL BlockDevices;
+    PFILE_OBJECT CurrentObject;
+    BOOL Filtered;
+    ULONG FlushCount;
+    BOOL FlushExclusive;
+    ULONG FlushIndex;
+    PFILE_OBJECT NextObject;
+    ULONG Pass;
+    KSTATUS Status;
+    KSTATUS TotalStatus;
+
+    CurrentObject = NULL;
+    TotalStatus = STATUS_SUCCESS;
+    Filtered = FALSE;
+    if ((DeviceId != 0) || (MatchWriteback != FALSE)) {
+        Filtered = TRUE;
+    }
+
+    //
+    // Synchronized flushes need to guarantee that all the data is out to disk
+    // before returning.
+    //
+
+    FlushCount = 1;
+    FlushExclusive = FALSE;
+    if ((Flags & IO_FLAG_DATA_SYNCHRONIZED) != 0) {
+        FlushExclusive = TRUE;
+
+        //
+        // If the goal is to flush the entire cache, then don't actually
+        // perform the flush synchronized. Just loop twice so that the first
+        // round gets all dirty data from the upper layers to the disk layer
+        // and the second loop will flush it to disk. This allows for larger,
+        // faster writes to disk.
+        //
+
+        if (Filtered == FALSE) {
+            Flags &= ~(IO_FLAG_DATA_SYNCHRONIZED |
+                       IO_FLAG_METADATA_SYNCHRONIZED);
+
+            FlushCount = 2;
+        }
+
+    //
+    // Non-synchronized flushes that encounter no dirty file objects can just
+    // exit. Any necessary work is already being done. But if a specific device
+    // is supplied acquire the lock to make sure any other thread has finished
+    // flushing the device's data.
+    //
+
+    } else if ((Filtered == FALSE) && (IopAreFileObjectsDirty() == FALSE)) {
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Now make several attempts at performing the requested clean operation.
+    // Each attempt walks the dirty lists twice: first for the upper layer
+    // file objects and then for the block devices, so that a single attempt
+    // gets all the data out to the block devices.
+    //
+
+    Status = STATUS_SUCCESS;
+    for (FlushIndex = 0; FlushIndex < FlushCount; FlushIndex += 1) {
+        for (Pass = 0; Pass < 2; Pass += 1) {
+            BlockDevices = FALSE;
+            if (Pass != 0) {
+                BlockDevices = TRUE;
+            }
+
+            CurrentObject = IopGetNextDirtyFileObject(NULL,
+                                                      DeviceId,
+                                                      Writeback,
+                                                      MatchWriteback,
+                                                      BlockDevices);
+
+            //
+            // Loop cleaning file objects.
+            //
+
+            while (CurrentObject != NULL) {
+                Status = IopFlushFileObject(CurrentObject,
+                                            0,
+                                            -1,
+                                            Flags,
+                                            FlushExclusive,
+                                            PageCount);
+
+                if (!KSUCCESS(Status)) {
+                    if (KSUCCESS(TotalStatus)) {
+                        TotalStatus = Status;
+                    }
+                }
+
+                if ((PageCount != NULL) && (*PageCount == 0)) {
+                    IopFileObjectReleaseReference(CurrentObject);
+                    CurrentObject = NULL;
+                    goto FlushDirtyFileObjectsEnd;
+                }
+
+                NextObject = IopGetNextDirtyFileObject(CurrentObject,
+                                                       DeviceId,
+                                                       Writeback,
+                                                       MatchWriteback,
+                                                       BlockDevices);
+
+                IopFileObjectReleaseReference(CurrentObject);
+                CurrentObject = NextObject;
+            }
+        }
+    }
+
+FlushDirtyFileObjectsEnd:
+
+    ASSERT(CurrentObject == NULL);
+
+    return TotalStatus;
+}
+
+PFILE_OBJECT
+IopGetNextDirtyFileObject (
+    PFILE_OBJECT CurrentObject,
+    DEVICE_ID DeviceId,
+    PDEVICE_WRITEBACK Writeback,
+    BOOL MatchWriteback,
+    BOOL BlockDevices
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the next dirty file object to flush. The global dirty
+    list is searched first, followed by the dirty list of each device
+    writeback state in turn. If the current file object is clean, it is
+    removed from its dirty list.
+
+Arguments:
+
+    CurrentObject - Supplies an optional pointer to the file object that was
+        just flushed. The caller must hold a reference on it, which keeps its
+        writeback state alive. Supply NULL to start from the beginning.
+
+    DeviceId - Supplies an optional device ID filter. Supply 0 to not filter
+        by device ID.
+
+    Writeback - Supplies the writeback state to filter by, if the match
+        writeback parameter is set.
+
+    MatchWriteback - Supplies a boolean indicating whether to only search the
+        dirty list of the given writeback state.
+
+    BlockDevices - Supplies a boolean indicating whether to find block device
+        file objects (TRUE) or all other file objects (FALSE).
+
+Return Value:
+
+    Returns a pointer to the next file object to flush, with a reference
+    added.
+
+    NULL if the walk is done.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PDEVICE_WRITEBACK CurrentWriteback;
+    PLIST_ENTRY ListHead;
+    PQUEUED_LOCK Lock;
+    PFILE_OBJECT NextObject;
+
+    if (MatchWriteback != FALSE) {
+        CurrentWriteback = Writeback;
+
+    } else if (CurrentObject != NULL) {
+        CurrentWriteback = CurrentObject->Writeback;
+
+    } else {
+        CurrentWriteback = NULL;
+    }
+
+    //
+    // Continue in the list holding the current object. If the object fell off
+    // the list, start over at the beginning of the list.
+    //
+
+    IopGetDirtyFileObjectList(CurrentWriteback, &ListHead, &Lock);
+    KeAcquireQueuedLock(Lock);
+    CurrentEntry = ListHead->Next;
+    if ((CurrentObject != NULL) && (CurrentObject->ListEntry.Next != NULL)) {
+        CurrentEntry = CurrentObject->ListEntry.Next;
+    }
+
+    NextObject = IopFindDirtyFileObject(ListHead,
+                                        CurrentEntry,
+                                        DeviceId,
+                                        Writeback,
+                                        MatchWriteback,
+                                        BlockDevices);
+
+    //
+    // Remove the file object from the list if it is clean now.
+    //
+
+    if ((CurrentObject != NULL) && (IS_FILE_OBJECT_CLEAN(CurrentObject))) {
+        if (CurrentObject->ListEntry.Next != NULL) {
+            LIST_REMOVE(&(CurrentObject->ListEntry));
+            CurrentObject->ListEntry.Next = NULL;
+            IopFileObjectReleaseReference(CurrentObject);
+        }
+    }
+
+    if (NextObject != NULL) {
+        IopFileObjectAddReference(NextObject);
+    }
+
+    KeReleaseQueuedLock(Lock);
+    if ((NextObject != NULL) || (MatchWriteback != FALSE)) {
+        return NextObject;
+    }
+
+    //
+    // Move on to the lists of the writeback states following the current
+    // one. The current one is still in the global list, as either nothing has
+    // been flushed yet or the caller's reference on the current object keeps
+    // its device alive.
+    //
+
+    KeAcquireQueuedLock(IoWritebackListLock);
+    if (CurrentWriteback == NULL) {
+        CurrentEntry = IoWritebackList.Next;
+
+    } else {
+        CurrentEntry = CurrentWriteback->ListEntry.Next;
+    }
+
+    while (CurrentEntry != &IoWritebackList) {
+        CurrentWriteback = LIST_VALUE(CurrentEntry,
+                                      DEVICE_WRITEBACK,
+                                      ListEntry);
+
+        CurrentEntry = CurrentEntry->Next;
+        if (LIST_EMPTY(&(CurrentWriteback->DirtyList)) != FALSE) {
+            continue;
+        }
+
+        KeAcquireQueuedLock(CurrentWriteback->DirtyListLock);
+        NextObject = IopFindDirtyFileObject(&(CurrentWriteback->DirtyList),
+                                            CurrentWriteback->DirtyList.Next,
+                                            DeviceId,
+                                            Writeback,
+                                            MatchWriteback,
+                                            BlockDevices);
+
+        if (NextObject != NULL) {
+            IopFileObjectAddReference(NextObject);
+        }
+
+        KeReleaseQueuedLock(CurrentWriteback->DirtyListLock);
+        if (NextObject != NULL) {
+            break;
+        }
+    }
+
+    KeReleaseQueuedLock(IoWritebackListLock);
+    return NextObject;
+}
+
+PFILE_OBJECT
+IopFindDirtyFileObject (
+    PLIST_ENTRY ListHead,
+    PLIST_ENTRY StartEntry,
+    DEVICE_ID DeviceId,
+    PDEVICE_WRITEBACK Writeback,
+    BOOL MatchWriteback,
+    BOOL BlockDevices
+    )
+
+/*++
+
+Routine Description:
+
+    This routine searches a dirty file objects list for the first file object
+    that passes the given filters. The list's lock must be held.
+
+Arguments:
+
+    ListHead - Supplies a pointer to the head of the dirty list.
+
+    StartEntry - Supplies a pointer to the list entry to start searching at.
+
+    DeviceId - Supplies an optional device ID filter. Supply 0 to not filter
+        by device ID.
+
+    Writeback - Supplies the writeback state to filter by, if the match
+        writeback parameter is set.
+
+    MatchWriteback - Supplies a boolean indicating whether to only match file
+        objects whose writeback state is the given one.
+
+    BlockDevices - Supplies a boolean indicating whether to match block device
+        file objects (TRUE) or all other file objects (FALSE).
+
+Return Value:
+
+    Returns a pointer to the file object found. No reference is added.
+
+    NULL if no file object in the rest of the list passes the filters.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PFILE_OBJECT FileObject;
+
+    CurrentEntry = StartEntry;
+    while (CurrentEntry != ListHead) {
+        FileObject = LIST_VALUE(CurrentEntry, FILE_OBJECT, ListEntry);
+        if (IopIsFileObjectFlushTarget(FileObject,
+                                       DeviceId,
+                                       Writeback,
+                                       MatchWriteback,
+                                       BlockDevices) != FALSE) {
+
+            return FileObject;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    return NULL;
+}
+
+VOID
+IopGetDirtyFileObjectList (
+    PDEVICE_WRITEBACK Writeback,
+    PLIST_ENTRY *ListHead,
+    PQUEUED_LOCK *Lock
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the dirty file objects list for file objects with the
+    given writeback state.
+
+Arguments:
+
+    Writeback - Supplies an optional pointer to the writeback state. Supply
+        NULL to get the global list for file objects with no writeback state.
+
+    ListHead - Supplies a pointer where the head of the dirty list will be
+        returned.
+
+    Lock - Supplies a pointer where a pointer to the lock protecting the list
+        will be returned.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Writeback != NULL) {
+        *ListHead = &(Writeback->DirtyList);
+        *Lock = Writeback->DirtyListLock;
+
+    } else {
+        *ListHead = &IoFileObjectsDirtyList;
+        *Lock = IoFileObjectsDirtyListLock;
+    }
+
+    return;
+}
+
+BOOL
+IopIsFileObjectFlushTarget (
+    PFILE_OBJECT FileObject,
+    DEVICE_ID DeviceId,
+    PDEVICE_WRITEBACK Writeback,
+    BOOL MatchWriteback,
+    BOOL BlockDevices
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether a dirty file object passes the filters of
+    a flush of the dirty file objects lists.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the dirty file object.
+
+    DeviceId - Supplies an optional device ID filter. Supply 0 to not filter
+        by device ID.
+
+    Writeback - Supplies the writeback state to filter by, if the match
+        writeback parameter is set.
+
+    MatchWriteback - Supplies a boolean indicating whether to only match file
+        objects whose writeback state is the given one.
+
+    BlockDevices - Supplies a boolean indicating whether to match block device
+        file objects (TRUE) or all other file objects (FALSE).
+
+Return Value:
+
+    TRUE if the file object should be flushed.
+
+    FALSE if the file object should be skipped.
+
+--*/
+
+{
+
+    BOOL BlockDevice;
+
+    BlockDevice = FALSE;
+    if (FileObject->Properties.Type == IoObjectBlockDevice) {
+        BlockDevice = TRUE;
+    }
+
+    if (BlockDevice != BlockDevices) {
+        return FALSE;
+    }
+
+    if ((DeviceId != 0) && (FileObject->Properties.DeviceId != DeviceId)) {
+        return FALSE;
+    }
+
+    if ((MatchWriteback != FALSE) && (FileObject->Writeback != Writeback)) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 KSTATUS
 IopFlushFileObjectProperties (
     PFILE_OBJECT FileObject,
@@ -2729,8 +3211,47 @@ Return Value:
     return ComparisonResultSame;
 }
 
+PFILE_OBJECT_SHARD
+IopGetFileObjectShard (
+    PFILE_PROPERTIES Properties
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the file object index shard that holds file objects
+    with the given device and file IDs.
+
+Arguments:
+
+    Properties - Supplies a pointer to the file object properties.
+
+Return Value:
+
+    Returns a pointer to the shard.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    //
+    // File IDs tend to be handed out sequentially, so the low bits spread
+    // well on their own. Mix in the device ID so that the same file ID on
+    // different volumes lands in different shards.
+    //
+
+    Index = (ULONG)Properties->FileId ^ (ULONG)(Properties->FileId >> 32);
+    Index += (ULONG)Properties->DeviceId * 31;
+    Index &= FILE_OBJECT_SHARD_COUNT - 1;
+    return &(IoFileObjectShards[Index]);
+}
+
 PFILE_OBJECT
 IopLookupFileObjectByProperties (
+    PFILE_OBJECT_SHARD Shard,
     PFILE_PROPERTIES Properties
     )
 
@@ -2739,11 +3260,13 @@ IopLookupFileObjectByProperties (
 Routine Description:
 
     This routine attempts to look up a file object with the given properties
-    (specifically the device and file IDs). It assumes the global file objects
-    lock is already held.
+    (specifically the device and file IDs). It assumes the shard lock is
+    already held.
 
 Arguments:
 
+    Shard - Supplies a pointer to the shard the properties map to.
+
     Properties - Supplies a pointer to the file object properties.
 
 Return Value:
@@ -2767,7 +3290,7 @@ Return Value:
     Object = NULL;
     SearchObject.Properties.FileId = Properties->FileId;
     SearchObject.Properties.DeviceId = Properties->DeviceId;
-    FoundNode = RtlRedBlackTreeSearch(&IoFileObjectsTree,
+    FoundNode = RtlRedBlackTreeSearch(&(Shard->Tree),
                                       &(SearchObject.TreeEntry));
 
     if (FoundNode != NULL) {
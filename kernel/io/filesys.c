@@ -367,10 +367,13 @@ Return Value:
     }
 
     //
-    // Only allow one volume to be mounted per device.
+    // Only allow one volume to be mounted per device, unless each mount gets
+    // its own.
     //
 
-    if ((Device->Flags & DEVICE_FLAG_MOUNTED) != 0) {
+    if (((Device->Flags & DEVICE_FLAG_MOUNTED) != 0) &&
+        ((Device->Flags & DEVICE_FLAG_VOLUME_PER_MOUNT) == 0)) {
+
         Status = STATUS_TOO_LATE;
         goto CreateVolumeEnd;
     }
@@ -524,10 +527,12 @@ Return Value:
 
         //
         // If the OS has not already mounted a volume on the device, then try
-        // to create a volume.
+        // to create a volume. Devices that give each mount its own volume
+        // always get a new one.
         //
 
-        if ((Device->Flags & DEVICE_FLAG_MOUNTED) == 0) {
+        if (((Device->Flags & DEVICE_FLAG_MOUNTED) == 0) ||
+            ((Device->Flags & DEVICE_FLAG_VOLUME_PER_MOUNT) != 0)) {
 
             //
             // Create a volume on the device. If this successfully creates a
@@ -817,8 +822,17 @@ Return Value:
     //
     // Mount the device on the volume. During this call, the mount code should
     // look up and find this volume as an active child of the given device.
+    // A volume made for a single mount is only reachable through that mount.
+    // Mounting it here too would both create another volume and keep this
+    // one alive after its mount goes away. Such a volume never holds the
+    // system directory or a page file either, so it needs no further work.
     //
 
+    if ((TargetDevice->Flags & DEVICE_FLAG_VOLUME_PER_MOUNT) != 0) {
+        Status = STATUS_SUCCESS;
+        goto VolumeArrivalEnd;
+    }
+
     Status = IoMount(TRUE,
                      VolumeName,
                      VolumeNameLength,
@@ -14,6 +14,8 @@ Module Name:
 Abstract:
 
     This module implements support for user mode file locking in the kernel.
+    Locks are indexed per file object in an interval tree, and are owned
+    either by a process or by an open I/O handle.
 
 Author:
 
@@ -36,6 +38,44 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// This value is used as the end of a lock that runs to the end of the file.
+//
+
+#define FILE_LOCK_END_OF_FILE MAX_ULONGLONG
+
+//
+// This macro computes the exclusive end offset of a lock, given its offset
+// and size. A size of zero or a range that wraps runs to the end of the file.
+//
+
+#define FILE_LOCK_END(_Offset, _Size)                          \
+    ((((_Size) == 0) || ((_Offset) + (_Size) < (_Offset))) ?  \
+     FILE_LOCK_END_OF_FILE :                                  \
+     ((_Offset) + (_Size)))
+
+//
+// This macro returns the height of a possibly NULL interval tree node.
+//
+
+#define FILE_LOCK_HEIGHT(_Entry) (((_Entry) == NULL) ? 0 : (_Entry)->Height)
+
+//
+// Define the number of buckets in the table of blocked lock owners, and the
+// hash that picks a bucket for an owner.
+//
+
+#define FILE_LOCK_WAITER_HASH_SIZE 64
+#define FILE_LOCK_WAITER_HASH(_Owner) \
+    ((((UINTN)(_Owner)) >> 6) % FILE_LOCK_WAITER_HASH_SIZE)
+
+//
+// Define the maximum length of a waits-for chain followed when looking for a
+// deadlock. Longer chains are assumed not to be deadlocks.
+//
+
+#define FILE_LOCK_MAX_DEADLOCK_DEPTH 16
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -44,63 +84,221 @@ Module Name:
 
 Structure Description:
 
-    This structure defines an active file lock.
+    This structure defines an active file lock. Each lock is a node in an
+    interval tree keyed by the starting offset, where every node also tracks
+    the largest end offset within its subtree.
 
 Members:
 
-    ListEntry - Stores pointers to the next and previous lock entries in the
-        file object.
+    ListEntry - Stores pointers to the next and previous lock entries in a
+        list of locks being modified or freed. Entries in the tree are not on
+        any list.
+
+    Parent - Stores a pointer to the parent node in the interval tree.
+
+    LeftChild - Stores a pointer to the subtree of locks that start at or
+        before this one.
+
+    RightChild - Stores a pointer to the subtree of locks that start at or
+        after this one.
+
+    Height - Stores the height of the subtree rooted at this node.
 
     Type - Stores the lock type.
 
-    Process - Stores a pointer to the process that owns the file lock.
+    Owner - Stores the owner of the lock. This is either the process that
+        created it, or the I/O handle for open file description locks.
+
+    Process - Stores a pointer to the process that owns the file lock, or
+        NULL if the lock is owned by an I/O handle.
 
     Offset - Stores the offset into the file where the lock begins.
 
-    Size - Stores the size of the lock. If zero, then the lock extends to the
-        end of the file.
+    End - Stores the offset into the file just beyond the lock, or
+        FILE_LOCK_END_OF_FILE if the lock extends to the end of the file.
+
+    MaxEnd - Stores the largest end offset of any lock in the subtree rooted
+        at this node.
 
 --*/
 
-typedef struct _FILE_LOCK_ENTRY {
+struct _FILE_LOCK_ENTRY {
     LIST_ENTRY ListEntry;
+    PFILE_LOCK_ENTRY Parent;
+    PFILE_LOCK_ENTRY LeftChild;
+    PFILE_LOCK_ENTRY RightChild;
+    ULONG Height;
     FILE_LOCK_TYPE Type;
+    PVOID Owner;
     PKPROCESS Process;
     ULONGLONG Offset;
-    ULONGLONG Size;
-} FILE_LOCK_ENTRY, *PFILE_LOCK_ENTRY;
+    ULONGLONG End;
+    ULONGLONG MaxEnd;
+};
+
+/*++
+
+Structure Description:
+
+    This structure defines a process blocked waiting for a file lock. It
+    forms one edge of the waits-for graph used to detect deadlocks.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous waiters in the hash
+        bucket.
+
+    Owner - Stores the lock owner that is blocked.
+
+    BlockingOwner - Stores the owner of the lock being waited on.
+
+--*/
+
+typedef struct _FILE_LOCK_WAITER {
+    LIST_ENTRY ListEntry;
+    PVOID Owner;
+    PVOID BlockingOwner;
+} FILE_LOCK_WAITER, *PFILE_LOCK_WAITER;
 
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
 
-KSTATUS
-IopTryToSetFileLock (
+VOID
+IopApplyFileLock (
     PFILE_OBJECT FileObject,
     PFILE_LOCK_ENTRY NewEntry,
-    PLIST_ENTRY FreeList,
-    BOOL DryRun
+    PLIST_ENTRY FreeList
+    );
+
+PFILE_LOCK_ENTRY
+IopFindConflictingFileLock (
+    PFILE_OBJECT FileObject,
+    FILE_LOCK_TYPE Type,
+    PVOID Owner,
+    ULONGLONG Offset,
+    ULONGLONG End
+    );
+
+KSTATUS
+IopQueueFileLockWaiter (
+    PFILE_LOCK_WAITER Waiter,
+    PVOID BlockingOwner
+    );
+
+VOID
+IopDequeueFileLockWaiter (
+    PFILE_LOCK_WAITER Waiter
+    );
+
+VOID
+IopInsertFileLockEntry (
+    PFILE_OBJECT FileObject,
+    PFILE_LOCK_ENTRY Entry
+    );
+
+VOID
+IopRemoveFileLockEntry (
+    PFILE_OBJECT FileObject,
+    PFILE_LOCK_ENTRY Entry
+    );
+
+PFILE_LOCK_ENTRY
+IopFindFirstOverlappingFileLock (
+    PFILE_OBJECT FileObject,
+    ULONGLONG Offset,
+    ULONGLONG End
+    );
+
+PFILE_LOCK_ENTRY
+IopGetNextFileLockEntry (
+    PFILE_LOCK_ENTRY Entry
     );
 
-BOOL
-IopDoFileLocksOverlap (
-    ULONGLONG IncomingOffset,
-    ULONGLONG IncomingSize,
-    PFILE_LOCK_ENTRY LockEntry
+VOID
+IopRebalanceFileLockTree (
+    PFILE_OBJECT FileObject,
+    PFILE_LOCK_ENTRY Entry
+    );
+
+PFILE_LOCK_ENTRY
+IopRotateFileLockTree (
+    PFILE_OBJECT FileObject,
+    PFILE_LOCK_ENTRY Entry,
+    BOOL Left
+    );
+
+VOID
+IopReplaceFileLockChild (
+    PFILE_OBJECT FileObject,
+    PFILE_LOCK_ENTRY Parent,
+    PFILE_LOCK_ENTRY OldChild,
+    PFILE_LOCK_ENTRY NewChild
+    );
+
+VOID
+IopUpdateFileLockNode (
+    PFILE_LOCK_ENTRY Entry
     );
 
 //
 // -------------------------------------------------------------------- Globals
 //
 
+//
+// Store the table of process lock owners currently blocked on a file lock,
+// hashed by owner, along with the lock that protects it.
+//
+
+LIST_ENTRY IoFileLockWaiters[FILE_LOCK_WAITER_HASH_SIZE];
+PQUEUED_LOCK IoFileLockWaiterLock;
+
 //
 // ------------------------------------------------------------------ Functions
 //
 
+KSTATUS
+IopInitializeFileLockSupport (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs global initialization for user mode file locks.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    for (Index = 0; Index < FILE_LOCK_WAITER_HASH_SIZE; Index += 1) {
+        INITIALIZE_LIST_HEAD(&(IoFileLockWaiters[Index]));
+    }
+
+    IoFileLockWaiterLock = KeCreateQueuedLock();
+    if (IoFileLockWaiterLock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
 KSTATUS
 IopGetFileLock (
     PIO_HANDLE IoHandle,
-    PFILE_LOCK Lock
+    PFILE_LOCK Lock,
+    BOOL HandleOwned
     )
 
 /*++
@@ -110,7 +308,7 @@ Routine Description:
     This routine gets information about a file lock. Existing locks are not
     reported if they are compatible with making a new lock in the given region.
     So set the lock type to write if both read and write locks should be
-    reported.
+    reported. Locks held by the caller's own lock owner are never reported.
 
 Arguments:
 
@@ -118,6 +316,10 @@ Routine Description:
 
     Lock - Supplies a pointer to the lock information.
 
+    HandleOwned - Supplies a boolean indicating if the lock would be owned by
+        the I/O handle (an open file description lock) rather than by the
+        current process.
+
 Return Value:
 
     Status code.
@@ -126,11 +328,9 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
     PFILE_OBJECT FileObject;
     PFILE_LOCK_ENTRY FoundEntry;
-    PFILE_LOCK_ENTRY LockEntry;
-    BOOL Overlap;
+    PVOID Owner;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
@@ -139,39 +339,45 @@ Return Value:
     }
 
     FileObject = IoHandle->FileObject;
-    FoundEntry = NULL;
-    KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
-    CurrentEntry = FileObject->FileLockList.Next;
-    while (CurrentEntry != &(FileObject->FileLockList)) {
-        LockEntry = LIST_VALUE(CurrentEntry, FILE_LOCK_ENTRY, ListEntry);
-        CurrentEntry = CurrentEntry->Next;
-
-        //
-        // If the caller only wants write locks, then skip read locks.
-        //
+    if (HandleOwned != FALSE) {
+        Owner = IoHandle;
 
-        if ((Lock->Type == FileLockRead) && (LockEntry->Type == FileLockRead)) {
-            continue;
-        }
-
-        Overlap = IopDoFileLocksOverlap(Lock->Offset, Lock->Size, LockEntry);
-        if (Overlap != FALSE) {
-            FoundEntry = LockEntry;
-            break;
-        }
+    } else {
+        Owner = PsGetCurrentProcess();
     }
 
+    KeAcquireSharedExclusiveLockShared(FileObject->Lock);
+    FoundEntry = IopFindConflictingFileLock(
+                                       FileObject,
+                                       Lock->Type,
+                                       Owner,
+                                       Lock->Offset,
+                                       FILE_LOCK_END(Lock->Offset, Lock->Size));
+
     if (FoundEntry != NULL) {
         Lock->Type = FoundEntry->Type;
         Lock->Offset = FoundEntry->Offset;
-        Lock->Size = FoundEntry->Size;
-        Lock->ProcessId = FoundEntry->Process->Identifiers.ProcessId;
+        Lock->Size = 0;
+        if (FoundEntry->End != FILE_LOCK_END_OF_FILE) {
+            Lock->Size = FoundEntry->End - FoundEntry->Offset;
+        }
+
+        //
+        // Open file description locks do not belong to any one process.
+        //
+
+        if (FoundEntry->Process != NULL) {
+            Lock->ProcessId = FoundEntry->Process->Identifiers.ProcessId;
+
+        } else {
+            Lock->ProcessId = -1;
+        }
 
     } else {
         Lock->Type = FileLockUnlock;
     }
 
-    KeReleaseSharedExclusiveLockExclusive(FileObject->Lock);
+    KeReleaseSharedExclusiveLockShared(FileObject->Lock);
     return STATUS_SUCCESS;
 }
 
@@ -179,6 +385,7 @@ KSTATUS
 IopSetFileLock (
     PIO_HANDLE IoHandle,
     PFILE_LOCK Lock,
+    BOOL HandleOwned,
     BOOL Blocking
     )
 
@@ -186,9 +393,9 @@ IopSetFileLock (
 
 Routine Description:
 
-    This routine locks or unlocks a portion of a file. If the process already
-    has a lock on any part of the region, the old lock is replaced with this
-    new region. Remove a lock by specifying a lock type of unlock.
+    This routine locks or unlocks a portion of a file. If the lock owner
+    already has a lock on any part of the region, the old lock is replaced
+    with this new region. Remove a lock by specifying a lock type of unlock.
 
 Arguments:
 
@@ -196,6 +403,12 @@ Routine Description:
 
     Lock - Supplies a pointer to the lock information.
 
+    HandleOwned - Supplies a boolean indicating if the lock is owned by the
+        I/O handle (an open file description lock) rather than by the current
+        process. Handle owned locks are shared by every descriptor and process
+        referring to the handle, and are released when the handle is
+        destroyed.
+
     Blocking - Supplies a boolean indicating if this should block until a
         determination is made.
 
@@ -207,6 +420,7 @@ Return Value:
 
 {
 
+    PFILE_LOCK_ENTRY ConflictingEntry;
     PFILE_LOCK_ENTRY Entry;
     PFILE_OBJECT FileObject;
     LIST_ENTRY FreeList;
@@ -217,6 +431,7 @@ Return Value:
     FILE_LOCK_ENTRY RemoveEntry;
     PFILE_LOCK_ENTRY SplitEntry;
     KSTATUS Status;
+    FILE_LOCK_WAITER Waiter;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
@@ -270,8 +485,17 @@ Return Value:
 
     NewEntry->Type = Lock->Type;
     NewEntry->Offset = Lock->Offset;
-    NewEntry->Size = Lock->Size;
-    NewEntry->Process = PsGetCurrentProcess();
+    NewEntry->End = FILE_LOCK_END(Lock->Offset, Lock->Size);
+    if (HandleOwned != FALSE) {
+        NewEntry->Owner = IoHandle;
+        NewEntry->Process = NULL;
+
+    } else {
+        NewEntry->Process = PsGetCurrentProcess();
+        NewEntry->Owner = NewEntry->Process;
+    }
+
+    Waiter.Owner = NewEntry->Owner;
     SplitEntry = MmAllocateNonPagedPool(sizeof(FILE_LOCK_ENTRY),
                                         FILE_LOCK_ALLOCATION_TAG);
 
@@ -310,63 +534,84 @@ Return Value:
         }
 
         //
-        // If this really is setting a lock, do a dry run to see if this would
-        // work.
+        // If this really is setting a lock, look for a lock held by another
+        // owner that stands in the way.
         //
 
         if (Lock->Type != FileLockUnlock) {
-            Status = IopTryToSetFileLock(FileObject,
-                                         NewEntry,
-                                         NULL,
-                                         TRUE);
+            ConflictingEntry = IopFindConflictingFileLock(FileObject,
+                                                          NewEntry->Type,
+                                                          NewEntry->Owner,
+                                                          NewEntry->Offset,
+                                                          NewEntry->End);
 
-            if (!KSUCCESS(Status)) {
+            if (ConflictingEntry != NULL) {
+                Status = STATUS_RESOURCE_IN_USE;
 
                 //
-                // Wait for something to unlock.
+                // Not blocking, the check was the only attempt.
                 //
 
-                if (Blocking != FALSE) {
-                    KeReleaseSharedExclusiveLockExclusive(FileObject->Lock);
-                    LockHeld = FALSE;
-                    Status = KeWaitForEvent(FileObject->FileLockEvent,
-                                            TRUE,
-                                            WAIT_TIME_INDEFINITE);
+                if (Blocking == FALSE) {
+                    break;
+                }
+
+                //
+                // Record what this process is waiting on, failing if that
+                // would complete a cycle. Open file description locks are not
+                // tied to a single process, so they are not tracked.
+                //
 
-                    //
-                    // The thread was interrupted.
-                    //
+                if (HandleOwned == FALSE) {
+                    Status = IopQueueFileLockWaiter(&Waiter,
+                                                    ConflictingEntry->Owner);
 
                     if (!KSUCCESS(Status)) {
-                        if (Status == STATUS_INTERRUPTED) {
-                            Status = STATUS_RESTART_AFTER_SIGNAL;
-                        }
-
-                        goto SetFileLockEnd;
+                        break;
                     }
+                }
+
+                //
+                // Wait for something to unlock. The event is only signaled
+                // with the file object lock held, so unsignaling it here
+                // cannot lose a wake up.
+                //
 
-                    continue;
+                KeSignalEvent(FileObject->FileLockEvent, SignalOptionUnsignal);
+                KeReleaseSharedExclusiveLockExclusive(FileObject->Lock);
+                LockHeld = FALSE;
+                Status = KeWaitForEvent(FileObject->FileLockEvent,
+                                        TRUE,
+                                        WAIT_TIME_INDEFINITE);
+
+                if (HandleOwned == FALSE) {
+                    IopDequeueFileLockWaiter(&Waiter);
+                }
 
                 //
-                // Not blocking, the dry run was the only attempt.
+                // The thread was interrupted.
                 //
 
-                } else {
-                    break;
+                if (!KSUCCESS(Status)) {
+                    if (Status == STATUS_INTERRUPTED) {
+                        Status = STATUS_RESTART_AFTER_SIGNAL;
+                    }
+
+                    goto SetFileLockEnd;
                 }
+
+                continue;
             }
         }
 
         //
-        // Do this for real. This should not fail, as any failures should
-        // have happened during the dry run.
+        // Do this for real. This cannot fail, as conflicts were ruled out
+        // above with the lock held.
         //
 
-        Status = IopTryToSetFileLock(FileObject, NewEntry, &FreeList, FALSE);
-
-        ASSERT(KSUCCESS(Status));
-
+        IopApplyFileLock(FileObject, NewEntry, &FreeList);
         NewEntry = NULL;
+        Status = STATUS_SUCCESS;
         break;
     }
 
@@ -407,7 +652,8 @@ Routine Description:
 
     IoHandle - Supplies a pointer to the I/O handle being closed.
 
-    Process - Supplies the process closing the handle.
+    Process - Supplies the process closing the handle, or NULL to destroy the
+        locks owned by the I/O handle itself because it is being destroyed.
 
 Return Value:
 
@@ -417,10 +663,12 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
+    PFILE_LOCK_ENTRY CurrentEntry;
     PFILE_OBJECT FileObject;
     LIST_ENTRY FreeList;
+    PLIST_ENTRY ListEntry;
     PFILE_LOCK_ENTRY LockEntry;
+    PVOID Owner;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
@@ -429,25 +677,34 @@ Return Value:
     //
 
     FileObject = IoHandle->FileObject;
-    if (LIST_EMPTY(&(FileObject->FileLockList)) != FALSE) {
+    if (FileObject->FileLockTree == NULL) {
         return;
     }
 
+    Owner = Process;
+    if (Owner == NULL) {
+        Owner = IoHandle;
+    }
+
     INITIALIZE_LIST_HEAD(&FreeList);
     KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
 
     //
-    // Loop through and remove any active locks belonging to this process.
+    // Collect the active locks belonging to this owner. They cannot be pulled
+    // out of the tree during the walk, as that would reshape it.
     //
 
-    CurrentEntry = FileObject->FileLockList.Next;
-    while (CurrentEntry != &(FileObject->FileLockList)) {
-        LockEntry = LIST_VALUE(CurrentEntry, FILE_LOCK_ENTRY, ListEntry);
-        CurrentEntry = CurrentEntry->Next;
-        if (LockEntry->Process == Process) {
-            LIST_REMOVE(&(LockEntry->ListEntry));
-            INSERT_BEFORE(&(LockEntry->ListEntry), &FreeList);
+    CurrentEntry = FileObject->FileLockTree;
+    while ((CurrentEntry != NULL) && (CurrentEntry->LeftChild != NULL)) {
+        CurrentEntry = CurrentEntry->LeftChild;
+    }
+
+    while (CurrentEntry != NULL) {
+        if (CurrentEntry->Owner == Owner) {
+            INSERT_BEFORE(&(CurrentEntry->ListEntry), &FreeList);
         }
+
+        CurrentEntry = IopGetNextFileLockEntry(CurrentEntry);
     }
 
     //
@@ -458,6 +715,13 @@ Return Value:
         KeSignalEvent(FileObject->FileLockEvent, SignalOptionSignalAll);
     }
 
+    ListEntry = FreeList.Next;
+    while (ListEntry != &FreeList) {
+        LockEntry = LIST_VALUE(ListEntry, FILE_LOCK_ENTRY, ListEntry);
+        ListEntry = ListEntry->Next;
+        IopRemoveFileLockEntry(FileObject, LockEntry);
+    }
+
     KeReleaseSharedExclusiveLockExclusive(FileObject->Lock);
 
     //
@@ -477,22 +741,22 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
-KSTATUS
-IopTryToSetFileLock (
+VOID
+IopApplyFileLock (
     PFILE_OBJECT FileObject,
     PFILE_LOCK_ENTRY NewEntry,
-    PLIST_ENTRY FreeList,
-    BOOL DryRun
+    PLIST_ENTRY FreeList
     )
 
 /*++
 
 Routine Description:
 
-    This routine attempts to lock or unlocks a portion of a file. If the
-    process already has a lock on any part of the region, the old lock is
-    replaced with this new region. Remove a lock by specifying a lock type of
-    unlock. This routine assumes the file properties lock is already held.
+    This routine locks or unlocks a portion of a file. Any locks the owner
+    already holds in the region are trimmed, split, or removed, and then the
+    new lock is added unless it is an unlock. This routine assumes the file
+    object lock is held exclusively, and that the caller has already checked
+    that no other owner's lock conflicts with the new one.
 
 Arguments:
 
@@ -504,242 +768,732 @@ Routine Description:
         free entry, needed to potentially split an entry. On output, entries
         that need to be freed will be put on this list.
 
-    DryRun - Supplies a pointer indicating if the lock should actually be
-        created/destroyed or just checked.
-
 Return Value:
 
-    Status code.
+    None.
 
 --*/
 
 {
 
-    PLIST_ENTRY CurrentEntry;
     PFILE_LOCK_ENTRY LockEntry;
-    BOOL LocksRemoved;
-    ULONGLONG NewEnd;
-    BOOL Overlap;
-    PKPROCESS Process;
+    PFILE_LOCK_ENTRY NextEntry;
     PFILE_LOCK_ENTRY SplitEntry;
-    KSTATUS Status;
+    LIST_ENTRY WorkList;
 
-    LocksRemoved = FALSE;
-    NewEnd = NewEntry->Offset + NewEntry->Size;
-    Process = PsGetCurrentProcess();
-    Status = STATUS_SUCCESS;
-    CurrentEntry = FileObject->FileLockList.Next;
-    while (CurrentEntry != &(FileObject->FileLockList)) {
-        LockEntry = LIST_VALUE(CurrentEntry, FILE_LOCK_ENTRY, ListEntry);
-        CurrentEntry = CurrentEntry->Next;
+    //
+    // Gather this owner's locks that overlap the new region. The owner's own
+    // locks never overlap each other, so at most one of them needs a split.
+    //
 
-        //
-        // If the lock belongs to the current process and overlaps the given
-        // region, it is to be removed.
-        //
+    INITIALIZE_LIST_HEAD(&WorkList);
+    LockEntry = IopFindFirstOverlappingFileLock(FileObject,
+                                                NewEntry->Offset,
+                                                NewEntry->End);
 
-        if (LockEntry->Process == Process) {
-            Overlap = IopDoFileLocksOverlap(NewEntry->Offset,
-                                            NewEntry->Size,
-                                            LockEntry);
+    while ((LockEntry != NULL) && (LockEntry->Offset < NewEntry->End)) {
+        NextEntry = IopGetNextFileLockEntry(LockEntry);
+        if ((LockEntry->Owner == NewEntry->Owner) &&
+            (LockEntry->End > NewEntry->Offset)) {
 
-            if ((Overlap != FALSE) && (DryRun == FALSE)) {
-                LocksRemoved = TRUE;
+            INSERT_BEFORE(&(LockEntry->ListEntry), &WorkList);
+        }
 
-                //
-                // If the existing entry starts before the new one, it needs to
-                // be shrunk or split.
-                //
+        LockEntry = NextEntry;
+    }
 
-                if (LockEntry->Offset < NewEntry->Offset) {
+    if (LIST_EMPTY(&WorkList) == FALSE) {
+        KeSignalEvent(FileObject->FileLockEvent, SignalOptionSignalAll);
+    }
 
-                    //
-                    // If it ends after the new one, split it.
-                    //
+    while (LIST_EMPTY(&WorkList) == FALSE) {
+        LockEntry = LIST_VALUE(WorkList.Next, FILE_LOCK_ENTRY, ListEntry);
+        LIST_REMOVE(&(LockEntry->ListEntry));
+        IopRemoveFileLockEntry(FileObject, LockEntry);
 
-                    if ((NewEntry->Size != 0) &&
-                        ((LockEntry->Offset + LockEntry->Size > NewEnd) ||
-                         (LockEntry->Size == 0))) {
+        //
+        // If the existing entry starts before the new one, it needs to be
+        // shrunk, and split if it also ends after the new one.
+        //
 
-                        ASSERT(LIST_EMPTY(FreeList) == FALSE);
+        if (LockEntry->Offset < NewEntry->Offset) {
+            if (LockEntry->End > NewEntry->End) {
 
-                        SplitEntry = LIST_VALUE(FreeList->Next,
-                                                FILE_LOCK_ENTRY,
-                                                ListEntry);
+                ASSERT(LIST_EMPTY(FreeList) == FALSE);
 
-                        LIST_REMOVE(&(SplitEntry->ListEntry));
-                        SplitEntry->Type = LockEntry->Type;
-                        SplitEntry->Offset = NewEnd;
-                        if (LockEntry->Size == 0) {
-                            SplitEntry->Size = 0;
+                SplitEntry = LIST_VALUE(FreeList->Next,
+                                        FILE_LOCK_ENTRY,
+                                        ListEntry);
 
-                        } else {
-                            SplitEntry->Size = LockEntry->Offset +
-                                               LockEntry->Size - NewEnd;
-                        }
+                LIST_REMOVE(&(SplitEntry->ListEntry));
+                SplitEntry->Type = LockEntry->Type;
+                SplitEntry->Owner = LockEntry->Owner;
+                SplitEntry->Process = LockEntry->Process;
+                SplitEntry->Offset = NewEntry->End;
+                SplitEntry->End = LockEntry->End;
+                IopInsertFileLockEntry(FileObject, SplitEntry);
+            }
 
-                        INSERT_AFTER(&(SplitEntry->ListEntry),
-                                     &(LockEntry->ListEntry));
-                    }
+            LockEntry->End = NewEntry->Offset;
+            IopInsertFileLockEntry(FileObject, LockEntry);
 
-                    //
-                    // Shrink its length.
-                    //
+        //
+        // The current entry starts within the new entry. If it ends after the
+        // new entry, move its start up.
+        //
 
-                    LockEntry->Size = NewEntry->Offset - LockEntry->Offset;
+        } else if (LockEntry->End > NewEntry->End) {
+            LockEntry->Offset = NewEntry->End;
+            IopInsertFileLockEntry(FileObject, LockEntry);
 
-                //
-                // The current entry starts within the new entry. If it
-                // ends after the new entry, shrink it.
-                //
+        //
+        // The new entry completely swallows the existing one.
+        //
 
-                } else if ((NewEntry->Size != 0) &&
-                           ((LockEntry->Offset + LockEntry->Size > NewEnd) ||
-                            (LockEntry->Size == 0))) {
+        } else {
+            INSERT_BEFORE(&(LockEntry->ListEntry), FreeList);
+        }
+    }
 
-                    if (LockEntry->Size != 0) {
-                        LockEntry->Size = LockEntry->Offset + LockEntry->Size -
-                                          NewEnd;
-                    }
+    if (NewEntry->Type != FileLockUnlock) {
+        IopInsertFileLockEntry(FileObject, NewEntry);
+    }
 
-                    LockEntry->Offset = NewEnd;
+    return;
+}
 
-                //
-                // The new entry completely swallows the existing one.
-                //
+PFILE_LOCK_ENTRY
+IopFindConflictingFileLock (
+    PFILE_OBJECT FileObject,
+    FILE_LOCK_TYPE Type,
+    PVOID Owner,
+    ULONGLONG Offset,
+    ULONGLONG End
+    )
 
-                } else {
-                    LIST_REMOVE(&(LockEntry->ListEntry));
-                    INSERT_BEFORE(&(LockEntry->ListEntry), FreeList);
-                }
-            }
+/*++
 
-        //
-        // Another process owns this lock.
-        //
+Routine Description:
 
-        } else if (NewEntry->Type != FileLockUnlock) {
+    This routine finds the first lock in the given region that would prevent
+    a lock of the given type from being taken by the given owner. This
+    routine assumes the file object lock is held.
 
-            //
-            // Read locks can coexist.
-            //
+Arguments:
 
-            if ((NewEntry->Type == FileLockRead) &&
-                (LockEntry->Type == FileLockRead)) {
+    FileObject - Supplies a pointer to the file object.
 
-                continue;
-            }
+    Type - Supplies the type of lock being requested.
 
-            //
-            // If the file lock overlaps with the incoming one, then fail.
-            //
+    Owner - Supplies the owner requesting the lock. Locks belonging to this
+        owner never conflict.
 
-            Overlap = IopDoFileLocksOverlap(NewEntry->Offset,
-                                            NewEntry->Size,
-                                            LockEntry);
+    Offset - Supplies the starting offset of the region.
 
-            //
-            // This routine should not be discovering overlaps on the real
-            // deal.
-            //
+    End - Supplies the offset just beyond the region.
 
-            ASSERT((Overlap == FALSE) || (DryRun != FALSE));
+Return Value:
 
-            if (Overlap != FALSE) {
-                Status = STATUS_RESOURCE_IN_USE;
-                KeSignalEvent(FileObject->FileLockEvent, SignalOptionUnsignal);
-                break;
-            }
-        }
-    }
+    Returns a pointer to the conflicting lock on success.
 
-    //
-    // Add the new entry if conditions are right.
-    //
+    NULL if the lock can be taken.
 
-    if ((KSUCCESS(Status)) && (DryRun == FALSE) &&
-        (NewEntry->Type != FileLockUnlock)) {
+--*/
 
-        INSERT_AFTER(&(NewEntry->ListEntry), &(FileObject->FileLockList));
-    }
+{
 
-    if (LocksRemoved != FALSE) {
-        KeSignalEvent(FileObject->FileLockEvent, SignalOptionSignalAll);
+    PFILE_LOCK_ENTRY LockEntry;
+
+    LockEntry = IopFindFirstOverlappingFileLock(FileObject, Offset, End);
+    while ((LockEntry != NULL) && (LockEntry->Offset < End)) {
+        if ((LockEntry->End > Offset) &&
+            (LockEntry->Owner != Owner) &&
+            ((Type == FileLockReadWrite) ||
+             (LockEntry->Type == FileLockReadWrite))) {
+
+            return LockEntry;
+        }
+
+        LockEntry = IopGetNextFileLockEntry(LockEntry);
     }
 
-    return Status;
+    return NULL;
 }
 
-BOOL
-IopDoFileLocksOverlap (
-    ULONGLONG IncomingOffset,
-    ULONGLONG IncomingSize,
-    PFILE_LOCK_ENTRY LockEntry
+KSTATUS
+IopQueueFileLockWaiter (
+    PFILE_LOCK_WAITER Waiter,
+    PVOID BlockingOwner
     )
 
 /*++
 
 Routine Description:
 
-    This routine checks to see if the given lock entry overlaps with the
-    incoming lock. The lock types are not checked by this routine, only the
-    regions.
+    This routine records that a lock owner is about to block on a lock held
+    by another owner. Before doing so, it follows the chain of owners the
+    blocking owner is itself waiting on, and fails if that chain leads back
+    to the waiter.
 
 Arguments:
 
-    IncomingOffset - Supplies the file offset of the incoming lock.
+    Waiter - Supplies a pointer to the waiter, with the owner filled in.
 
-    IncomingSize - Supplies the file size of the incoming lock.
-
-    LockEntry - Supplies a pointer to the existing lock entry.
+    BlockingOwner - Supplies the owner of the lock that is being waited on.
 
 Return Value:
 
-    TRUE if the lock entry overlaps the incoming lock.
+    STATUS_SUCCESS if the waiter was queued.
 
-    FALSE if the lock entry does not overlap.
+    STATUS_DEADLOCK if waiting would deadlock.
 
 --*/
 
 {
 
-    //
-    // If the incoming lock goes to the end of the file, then this lock
-    // overlaps if it has an offset greater than the incoming one or its
-    // size is also zero.
-    //
+    PLIST_ENTRY Bucket;
+    PLIST_ENTRY CurrentEntry;
+    ULONG Depth;
+    PVOID Owner;
+    PFILE_LOCK_WAITER Search;
+    KSTATUS Status;
 
-    if (IncomingSize == 0) {
-        if ((LockEntry->Size == 0) || (LockEntry->Offset >= IncomingOffset)) {
-            return TRUE;
+    Owner = BlockingOwner;
+    Status = STATUS_SUCCESS;
+    KeAcquireQueuedLock(IoFileLockWaiterLock);
+    for (Depth = 0; Depth < FILE_LOCK_MAX_DEADLOCK_DEPTH; Depth += 1) {
+        if (Owner == Waiter->Owner) {
+            Status = STATUS_DEADLOCK;
+            goto QueueFileLockWaiterEnd;
         }
 
-    //
-    // The incoming lock spans a specific region. This lock overlaps if
-    // one of these conditions is met:
-    // 1. Size == 0 and the offset starts before the incoming lock's end.
-    // 2. Offset <= IncomingOffset and Offset + Size > IncomingOffset.
-    // 3. Offset > IncomingOffset and Offset < IncomingOffset + IncomingSize.
-    //
+        //
+        // Find what the current owner in the chain is waiting on. If it is
+        // not blocked, then there is no cycle.
+        //
 
-    } else {
-        if (LockEntry->Size == 0) {
-            if (LockEntry->Offset < IncomingOffset + IncomingSize) {
-                return TRUE;
+        Bucket = &(IoFileLockWaiters[FILE_LOCK_WAITER_HASH(Owner)]);
+        CurrentEntry = Bucket->Next;
+        while (CurrentEntry != Bucket) {
+            Search = LIST_VALUE(CurrentEntry, FILE_LOCK_WAITER, ListEntry);
+            if (Search->Owner == Owner) {
+                break;
             }
 
-        } else if (LockEntry->Offset <= IncomingOffset) {
-            if (LockEntry->Offset + LockEntry->Size > IncomingOffset) {
-                return TRUE;
-            }
+            CurrentEntry = CurrentEntry->Next;
+        }
 
-        } else {
-            if (LockEntry->Offset < IncomingOffset + IncomingSize) {
-                return TRUE;
-            }
+        if (CurrentEntry == Bucket) {
+            break;
         }
+
+        Owner = Search->BlockingOwner;
     }
 
-    return FALSE;
+    Waiter->BlockingOwner = BlockingOwner;
+    Bucket = &(IoFileLockWaiters[FILE_LOCK_WAITER_HASH(Waiter->Owner)]);
+    INSERT_BEFORE(&(Waiter->ListEntry), Bucket);
+
+QueueFileLockWaiterEnd:
+    KeReleaseQueuedLock(IoFileLockWaiterLock);
+    return Status;
 }
 
+VOID
+IopDequeueFileLockWaiter (
+    PFILE_LOCK_WAITER Waiter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a waiter that is no longer blocked on a file lock.
+
+Arguments:
+
+    Waiter - Supplies a pointer to the waiter queued earlier.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    KeAcquireQueuedLock(IoFileLockWaiterLock);
+    LIST_REMOVE(&(Waiter->ListEntry));
+    KeReleaseQueuedLock(IoFileLockWaiterLock);
+    return;
+}
+
+VOID
+IopInsertFileLockEntry (
+    PFILE_OBJECT FileObject,
+    PFILE_LOCK_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine inserts a lock into the file object's interval tree. The file
+    object lock must be held exclusively.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object.
+
+    Entry - Supplies a pointer to the lock entry, with its offset and end
+        filled in.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFILE_LOCK_ENTRY Parent;
+
+    Entry->LeftChild = NULL;
+    Entry->RightChild = NULL;
+    Entry->Height = 1;
+    Entry->MaxEnd = Entry->End;
+    Parent = FileObject->FileLockTree;
+    if (Parent == NULL) {
+        Entry->Parent = NULL;
+        FileObject->FileLockTree = Entry;
+        return;
+    }
+
+    while (TRUE) {
+        if (Entry->Offset < Parent->Offset) {
+            if (Parent->LeftChild == NULL) {
+                Parent->LeftChild = Entry;
+                break;
+            }
+
+            Parent = Parent->LeftChild;
+
+        } else {
+            if (Parent->RightChild == NULL) {
+                Parent->RightChild = Entry;
+                break;
+            }
+
+            Parent = Parent->RightChild;
+        }
+    }
+
+    Entry->Parent = Parent;
+    IopRebalanceFileLockTree(FileObject, Parent);
+    return;
+}
+
+VOID
+IopRemoveFileLockEntry (
+    PFILE_OBJECT FileObject,
+    PFILE_LOCK_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a lock from the file object's interval tree. The file
+    object lock must be held exclusively.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object.
+
+    Entry - Supplies a pointer to the lock entry to remove.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFILE_LOCK_ENTRY Child;
+    PFILE_LOCK_ENTRY RebalanceStart;
+    PFILE_LOCK_ENTRY Successor;
+
+    //
+    // With two children, the in-order successor (which has no left child)
+    // takes the entry's place in the tree.
+    //
+
+    if ((Entry->LeftChild != NULL) && (Entry->RightChild != NULL)) {
+        Successor = Entry->RightChild;
+        while (Successor->LeftChild != NULL) {
+            Successor = Successor->LeftChild;
+        }
+
+        if (Successor->Parent == Entry) {
+            RebalanceStart = Successor;
+
+        } else {
+            RebalanceStart = Successor->Parent;
+            Child = Successor->RightChild;
+            RebalanceStart->LeftChild = Child;
+            if (Child != NULL) {
+                Child->Parent = RebalanceStart;
+            }
+
+            Successor->RightChild = Entry->RightChild;
+            Successor->RightChild->Parent = Successor;
+        }
+
+        Successor->LeftChild = Entry->LeftChild;
+        Successor->LeftChild->Parent = Successor;
+        IopReplaceFileLockChild(FileObject, Entry->Parent, Entry, Successor);
+        Successor->Parent = Entry->Parent;
+
+    } else {
+        Child = Entry->LeftChild;
+        if (Child == NULL) {
+            Child = Entry->RightChild;
+        }
+
+        IopReplaceFileLockChild(FileObject, Entry->Parent, Entry, Child);
+        if (Child != NULL) {
+            Child->Parent = Entry->Parent;
+        }
+
+        RebalanceStart = Entry->Parent;
+    }
+
+    Entry->Parent = NULL;
+    Entry->LeftChild = NULL;
+    Entry->RightChild = NULL;
+    IopRebalanceFileLockTree(FileObject, RebalanceStart);
+    return;
+}
+
+PFILE_LOCK_ENTRY
+IopFindFirstOverlappingFileLock (
+    PFILE_OBJECT FileObject,
+    ULONGLONG Offset,
+    ULONGLONG End
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the lock with the lowest starting offset that overlaps
+    the given region. A subtree whose largest end is beyond the region's start
+    either holds the first overlap or proves there is none to its right, so
+    the search only ever descends one path.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object.
+
+    Offset - Supplies the starting offset of the region.
+
+    End - Supplies the offset just beyond the region.
+
+Return Value:
+
+    Returns a pointer to the first overlapping lock on success.
+
+    NULL if no lock overlaps the region.
+
+--*/
+
+{
+
+    PFILE_LOCK_ENTRY Entry;
+
+    Entry = FileObject->FileLockTree;
+    while (Entry != NULL) {
+        if ((Entry->LeftChild != NULL) &&
+            (Entry->LeftChild->MaxEnd > Offset)) {
+
+            Entry = Entry->LeftChild;
+            continue;
+        }
+
+        if (Entry->Offset >= End) {
+            return NULL;
+        }
+
+        if (Entry->End > Offset) {
+            return Entry;
+        }
+
+        Entry = Entry->RightChild;
+    }
+
+    return NULL;
+}
+
+PFILE_LOCK_ENTRY
+IopGetNextFileLockEntry (
+    PFILE_LOCK_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the lock that follows the given one in offset order.
+
+Arguments:
+
+    Entry - Supplies a pointer to the current lock entry.
+
+Return Value:
+
+    Returns a pointer to the next lock entry, or NULL if this is the last.
+
+--*/
+
+{
+
+    PFILE_LOCK_ENTRY Next;
+
+    if (Entry->RightChild != NULL) {
+        Next = Entry->RightChild;
+        while (Next->LeftChild != NULL) {
+            Next = Next->LeftChild;
+        }
+
+        return Next;
+    }
+
+    while ((Entry->Parent != NULL) && (Entry == Entry->Parent->RightChild)) {
+        Entry = Entry->Parent;
+    }
+
+    return Entry->Parent;
+}
+
+VOID
+IopRebalanceFileLockTree (
+    PFILE_OBJECT FileObject,
+    PFILE_LOCK_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks from the given node up to the root, refreshing each
+    node's height and largest end, and rotating wherever the heights of the
+    two subtrees differ by more than one.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object.
+
+    Entry - Supplies a pointer to the lowest node whose subtree changed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PFILE_LOCK_ENTRY Child;
+    ULONG LeftHeight;
+    ULONG RightHeight;
+
+    while (Entry != NULL) {
+        IopUpdateFileLockNode(Entry);
+        LeftHeight = FILE_LOCK_HEIGHT(Entry->LeftChild);
+        RightHeight = FILE_LOCK_HEIGHT(Entry->RightChild);
+        if (LeftHeight > RightHeight + 1) {
+            Child = Entry->LeftChild;
+            if (FILE_LOCK_HEIGHT(Child->LeftChild) <
+                FILE_LOCK_HEIGHT(Child->RightChild)) {
+
+                IopRotateFileLockTree(FileObject, Child, TRUE);
+            }
+
+            Entry = IopRotateFileLockTree(FileObject, Entry, FALSE);
+
+        } else if (RightHeight > LeftHeight + 1) {
+            Child = Entry->RightChild;
+            if (FILE_LOCK_HEIGHT(Child->RightChild) <
+                FILE_LOCK_HEIGHT(Child->LeftChild)) {
+
+                IopRotateFileLockTree(FileObject, Child, FALSE);
+            }
+
+            Entry = IopRotateFileLockTree(FileObject, Entry, TRUE);
+        }
+
+        Entry = Entry->Parent;
+    }
+
+    return;
+}
+
+PFILE_LOCK_ENTRY
+IopRotateFileLockTree (
+    PFILE_OBJECT FileObject,
+    PFILE_LOCK_ENTRY Entry,
+    BOOL Left
+    )
+
+/*++
+
+Routine Description:
+
+    This routine rotates the subtree rooted at the given node.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object.
+
+    Entry - Supplies a pointer to the root of the subtree to rotate.
+
+    Left - Supplies a boolean indicating whether to rotate left (the right
+        child becomes the root) or right (the left child becomes the root).
+
+Return Value:
+
+    Returns a pointer to the new root of the subtree.
+
+--*/
+
+{
+
+    PFILE_LOCK_ENTRY Pivot;
+
+    if (Left != FALSE) {
+        Pivot = Entry->RightChild;
+        Entry->RightChild = Pivot->LeftChild;
+        if (Entry->RightChild != NULL) {
+            Entry->RightChild->Parent = Entry;
+        }
+
+        Pivot->LeftChild = Entry;
+
+    } else {
+        Pivot = Entry->LeftChild;
+        Entry->LeftChild = Pivot->RightChild;
+        if (Entry->LeftChild != NULL) {
+            Entry->LeftChild->Parent = Entry;
+        }
+
+        Pivot->RightChild = Entry;
+    }
+
+    IopReplaceFileLockChild(FileObject, Entry->Parent, Entry, Pivot);
+    Pivot->Parent = Entry->Parent;
+    Entry->Parent = Pivot;
+    IopUpdateFileLockNode(Entry);
+    IopUpdateFileLockNode(Pivot);
+    return Pivot;
+}
+
+VOID
+IopReplaceFileLockChild (
+    PFILE_OBJECT FileObject,
+    PFILE_LOCK_ENTRY Parent,
+    PFILE_LOCK_ENTRY OldChild,
+    PFILE_LOCK_ENTRY NewChild
+    )
+
+/*++
+
+Routine Description:
+
+    This routine points the link that referred to one child at another.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object, whose root is updated
+        if the parent is NULL.
+
+    Parent - Supplies a pointer to the parent node, or NULL for the root.
+
+    OldChild - Supplies a pointer to the child being replaced.
+
+    NewChild - Supplies a pointer to the replacement, which may be NULL.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Parent == NULL) {
+        FileObject->FileLockTree = NewChild;
+
+    } else if (Parent->LeftChild == OldChild) {
+        Parent->LeftChild = NewChild;
+
+    } else {
+
+        ASSERT(Parent->RightChild == OldChild);
+
+        Parent->RightChild = NewChild;
+    }
+
+    return;
+}
+
+VOID
+IopUpdateFileLockNode (
+    PFILE_LOCK_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine recomputes a node's height and largest end from its
+    children.
+
+Arguments:
+
+    Entry - Supplies a pointer to the node to update.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Height;
+    ULONGLONG MaxEnd;
+
+    Height = 0;
+    MaxEnd = Entry->End;
+    if (Entry->LeftChild != NULL) {
+        Height = Entry->LeftChild->Height;
+        if (Entry->LeftChild->MaxEnd > MaxEnd) {
+            MaxEnd = Entry->LeftChild->MaxEnd;
+        }
+    }
+
+    if (Entry->RightChild != NULL) {
+        if (Entry->RightChild->Height > Height) {
+            Height = Entry->RightChild->Height;
+        }
+
+        if (Entry->RightChild->MaxEnd > MaxEnd) {
+            MaxEnd = Entry->RightChild->MaxEnd;
+        }
+    }
+
+    Entry->Height = Height + 1;
+    Entry->MaxEnd = MaxEnd;
+    return;
+}
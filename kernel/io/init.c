@@ -298,6 +298,11 @@ Return Value:
         goto InitializeEnd;
     }
 
+    Status = IopInitializeFileLockSupport();
+    if (!KSUCCESS(Status)) {
+        goto InitializeEnd;
+    }
+
     //
     // Initialize support for path traversal.
     //
@@ -317,9 +322,14 @@ Return Value:
     }
 
     //
-    // Initialize support for the page cache.
+    // Initialize support for per-device writeback and the page cache.
     //
 
+    Status = IopInitializeWriteback();
+    if (!KSUCCESS(Status)) {
+        goto InitializeEnd;
+    }
+
     Status = IopInitializePageCache();
     if (!KSUCCESS(Status)) {
         goto InitializeEnd;
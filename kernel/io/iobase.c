@@ -2329,10 +2329,7 @@ Return Value:
                                        SourceFileObject);
 
             if (NewPathEntry != NULL) {
-                INSERT_BEFORE(
-                        &(NewPathEntry->SiblingListEntry),
-                        &(DestinationDirectoryPathPoint.PathEntry->ChildList));
-
+                IopPathLink(NewPathEntry);
                 IopFileObjectAddReference(SourceFileObject);
             }
         }
@@ -3783,6 +3780,12 @@ Return Value:
         if (!KSUCCESS(Status)) {
             goto CloseEnd;
         }
+
+        //
+        // Release any open file description locks owned by this handle.
+        //
+
+        IopRemoveFileLocks(IoHandle, NULL);
     }
 
     //
@@ -4272,6 +4275,10 @@ Return Value:
         *Flags |= FILE_OBJECT_FLAG_NON_CACHED;
     }
 
+    if ((Request.Flags & LOOKUP_FLAG_HARD_FLUSH_REQUIRED) != 0) {
+        *Flags |= FILE_OBJECT_FLAG_HARD_FLUSH_REQUIRED;
+    }
+
     return Status;
 }
 
@@ -164,6 +164,13 @@ Module Name:
 
 #define DEVICE_FLAG_NOT_USING_BOOT_RESOURCES 0x00000010
 
+//
+// This flag is set when every mount of the device gets a volume of its own,
+// rather than all mounts sharing the device's one volume.
+//
+
+#define DEVICE_FLAG_VOLUME_PER_MOUNT 0x00000020
+
 //
 // This flag is set when a volume is in the process of being removed.
 //
@@ -227,10 +234,12 @@ Module Name:
 #define IoResourceAllocationWorkQueue NULL
 
 //
-// Define the size of read-aheads.
+// Define the size of read-aheads. Block devices always read ahead at least
+// the base amount, and sequential misses double the window up to the maximum.
 //
 
 #define IO_READ_AHEAD_SIZE _128KB
+#define IO_READ_AHEAD_MAX_SIZE (2 * _1MB)
 
 //
 // This flag is set to indicate that the eviction operation is executing as a
@@ -334,6 +343,32 @@ typedef enum _FILE_OBJECT_TIME_TYPE {
 } FILE_OBJECT_TIME_TYPE, *PFILE_OBJECT_TIME_TYPE;
 
 typedef struct _DEVICE_POWER DEVICE_POWER, *PDEVICE_POWER;
+typedef struct _DEVICE_WRITEBACK DEVICE_WRITEBACK, *PDEVICE_WRITEBACK;
+typedef struct _PAGE_CACHE_RADIX_NODE
+    PAGE_CACHE_RADIX_NODE, *PPAGE_CACHE_RADIX_NODE;
+typedef struct _FILE_LOCK_ENTRY FILE_LOCK_ENTRY, *PFILE_LOCK_ENTRY;
+
+/*++
+
+Structure Description:
+
+    This structure defines the index of a file object's page cache entries. It
+    is a radix tree keyed by page number. Lookups may walk it without any
+    lock, so nodes are only freed when the file object is destroyed.
+
+Members:
+
+    Root - Stores a pointer to the top node of the tree, or NULL if no entry
+        has ever been inserted.
+
+    EntryCount - Stores the number of page cache entries in the index.
+
+--*/
+
+typedef struct _PAGE_CACHE_INDEX {
+    volatile PPAGE_CACHE_RADIX_NODE Root;
+    UINTN EntryCount;
+} PAGE_CACHE_INDEX, *PPAGE_CACHE_INDEX;
 
 /*++
 
@@ -346,10 +381,12 @@ Structure Description:
     TreeEntry - Stores the Red-Black tree node information for this file object,
         used internally. Never access these members directly.
 
-    ListEntry - Stores an entry into the list of file objects.
+    ListEntry - Stores an entry into the dirty file objects list of the
+        writeback state (or the global dirty list if there is none), or into
+        the orphaned list of the file object's shard.
 
-    PageCacheTree - Stores a tree root for the page cache entries that
-        belong to this file object.
+    PageCacheIndex - Stores the index of the page cache entries that belong
+        to this file object.
 
     DirtyPageList - Stores the head of the list of dirty page cache entries
         in this file object. This list is synchronized by the global page
@@ -366,6 +403,10 @@ Structure Description:
     Device - Stores a pointer to the device or volume that owns the file serial
         number.
 
+    Writeback - Stores a pointer to the writeback state of the device backing
+        this file's data, or NULL if dirty data for this file object is
+        flushed by the page cache thread.
+
     Directory - Stores a pointer to an open handle to the file's directory,
         which is used to synchronize deletes, opens, and metadata updates.
 
@@ -392,23 +433,36 @@ Structure Description:
 
     Properties - Stores the characteristics for this file.
 
-    FileLockList - Stores the head of the list of file locks held on this
-        file object. This is a user mode thing.
+    FileLockTree - Stores a pointer to the root of the interval tree of file
+        locks held on this file object. This is a user mode thing, and is
+        protected by the file object lock.
 
     FileLockEvent - Stores a pointer to the event that's signalled when a file
         object lock is released.
 
+    ReadAheadOffset - Stores the offset just past the last cache miss read,
+        used to spot sequential reads. This is updated on every cache miss,
+        and is protected by this file object's lock held exclusively, which
+        every cache miss path converts to or acquires before reading. For a
+        block device this is the lock of the device's own file object, so
+        misses from every file system reading through the device's cache are
+        serialized by it, not by the locks of the files being read.
+
+    ReadAheadSize - Stores the size of the last read-ahead window, in bytes.
+        This is protected the same way as the read-ahead offset.
+
 --*/
 
 typedef struct _FILE_OBJECT FILE_OBJECT, *PFILE_OBJECT;
 struct _FILE_OBJECT {
     RED_BLACK_TREE_NODE TreeEntry;
     LIST_ENTRY ListEntry;
-    RED_BLACK_TREE PageCacheTree;
+    PAGE_CACHE_INDEX PageCacheIndex;
     LIST_ENTRY DirtyPageList;
     volatile ULONG ReferenceCount;
     volatile ULONG PathEntryCount;
     PDEVICE Device;
+    PDEVICE_WRITEBACK Writeback;
     PSHARED_EXCLUSIVE_LOCK Lock;
     PIO_OBJECT_STATE IoState;
     PVOID SpecialIo;
@@ -417,8 +471,10 @@ struct _FILE_OBJECT {
     volatile PVOID DeviceContext;
     volatile ULONG Flags;
     FILE_PROPERTIES Properties;
-    LIST_ENTRY FileLockList;
+    PFILE_LOCK_ENTRY FileLockTree;
     PKEVENT FileLockEvent;
+    IO_OFFSET ReadAheadOffset;
+    UINTN ReadAheadSize;
 };
 
 /*++
@@ -435,6 +491,9 @@ Structure Description:
     CacheListEntry - Stores pointers to the next and previous entries in the
         LRU list of the path entry cache.
 
+    HashListEntry - Stores pointers to the next and previous entries in the
+        path entry hash table bucket, which is keyed by parent and name hash.
+
     ReferenceCount - Stores the reference count of the entry.
 
     MountCount - Stores the number of mount points mounted on this path entry.
@@ -470,6 +529,7 @@ Structure Description:
 struct _PATH_ENTRY {
     LIST_ENTRY SiblingListEntry;
     LIST_ENTRY CacheListEntry;
+    LIST_ENTRY HashListEntry;
     volatile ULONG ReferenceCount;
     volatile ULONG MountCount;
     BOOL Negative;
@@ -977,6 +1037,10 @@ Structure Description:
 
     Power - Stores the power management information for the device.
 
+    Writeback - Stores a pointer to the writeback state for dirty data backed
+        by this device. This is created when the first cacheable file object
+        backed by the device is created.
+
 --*/
 
 struct _DEVICE {
@@ -1008,6 +1072,7 @@ struct _DEVICE {
     PRESOURCE_ALLOCATION_LIST ProcessorLocalResources;
     PRESOURCE_ALLOCATION_LIST BootResources;
     PDEVICE_POWER Power;
+    volatile PDEVICE_WRITEBACK Writeback;
 };
 
 /*++
@@ -2602,9 +2667,9 @@ IopFlushFileObjects (
 
 Routine Description:
 
-    This routine iterates over file objects in the global dirty file objects
-    list, flushing each one that belongs to the given device or to all entries
-    if a device ID of 0 is specified.
+    This routine iterates over the dirty file objects lists, flushing each
+    file object that belongs to the given device or to all entries if a device
+    ID of 0 is specified.
 
 Arguments:
 
@@ -2628,6 +2693,38 @@ Return Value:
 
 --*/
 
+KSTATUS
+IopFlushWritebackFileObjects (
+    PDEVICE_WRITEBACK Writeback,
+    ULONG Flags
+    );
+
+/*++
+
+Routine Description:
+
+    This routine iterates over the dirty file objects list of the given
+    device, flushing each file object on it.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the writeback state of the device whose
+        file objects should be flushed. Supply NULL to flush the file objects
+        that have no device writeback thread.
+
+    Flags - Supplies a bitmask of I/O flags. See IO_FLAG_* for definitions.
+
+Return Value:
+
+    STATUS_SUCCESS if all file object were successfully iterated.
+
+    STATUS_TRY_AGAIN if the iteration quit early for some reason (i.e. the page
+    cache was found to be too dirty when flushing file objects).
+
+    Other status codes for other errors.
+
+--*/
+
 VOID
 IopEvictFileObject (
     PFILE_OBJECT FileObject,
@@ -2958,8 +3055,8 @@ IopMarkFileObjectDirty (
 
 Routine Description:
 
-    This routine marks the given file object as dirty, moving it to the list of
-    dirty file objects if it is not already on a list.
+    This routine marks the given file object as dirty, moving it to the dirty
+    file objects list of its device if it is not already on a list.
 
 Arguments:
 
@@ -3017,6 +3114,30 @@ Return Value:
 
 --*/
 
+BOOL
+IopAreFileObjectsDirty (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether any of the dirty file objects lists have
+    file objects on them.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    TRUE if there are dirty file objects.
+
+    FALSE if all the dirty file objects lists are empty.
+
+--*/
+
 PIO_ASYNC_STATE
 IopGetAsyncState (
     PIO_OBJECT_STATE State
@@ -3980,6 +4101,30 @@ Return Value:
 
 --*/
 
+VOID
+IopPathLink (
+    PPATH_ENTRY Entry
+    );
+
+/*++
+
+Routine Description:
+
+    This routine links the given path entry into its parent's list of children
+    and into the path entry hash table. This assumes the caller holds the
+    parent path entry's file object lock exclusively.
+
+Arguments:
+
+    Entry - Supplies a pointer to the path entry that is to be linked into
+        the path hierarchy.
+
+Return Value:
+
+    None.
+
+--*/
+
 VOID
 IopPathUnlink (
     PPATH_ENTRY Entry
@@ -4632,10 +4777,32 @@ Return Value:
 
 --*/
 
+KSTATUS
+IopInitializeFileLockSupport (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine performs global initialization for user mode file locks.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 KSTATUS
 IopGetFileLock (
     PIO_HANDLE IoHandle,
-    PFILE_LOCK Lock
+    PFILE_LOCK Lock,
+    BOOL HandleOwned
     );
 
 /*++
@@ -4645,7 +4812,7 @@ Routine Description:
     This routine gets information about a file lock. Existing locks are not
     reported if they are compatible with making a new lock in the given region.
     So set the lock type to write if both read and write locks should be
-    reported.
+    reported. Locks held by the caller's own lock owner are never reported.
 
 Arguments:
 
@@ -4653,6 +4820,10 @@ Routine Description:
 
     Lock - Supplies a pointer to the lock information.
 
+    HandleOwned - Supplies a boolean indicating if the lock would be owned by
+        the I/O handle (an open file description lock) rather than by the
+        current process.
+
 Return Value:
 
     Status code.
@@ -4663,6 +4834,7 @@ KSTATUS
 IopSetFileLock (
     PIO_HANDLE IoHandle,
     PFILE_LOCK Lock,
+    BOOL HandleOwned,
     BOOL Blocking
     );
 
@@ -4670,9 +4842,9 @@ IopSetFileLock (
 
 Routine Description:
 
-    This routine locks or unlocks a portion of a file. If the process already
-    has a lock on any part of the region, the old lock is replaced with this
-    new region. Remove a lock by specifying a lock type of unlock.
+    This routine locks or unlocks a portion of a file. If the lock owner
+    already has a lock on any part of the region, the old lock is replaced
+    with this new region. Remove a lock by specifying a lock type of unlock.
 
 Arguments:
 
@@ -4680,6 +4852,12 @@ Routine Description:
 
     Lock - Supplies a pointer to the lock information.
 
+    HandleOwned - Supplies a boolean indicating if the lock is owned by the
+        I/O handle (an open file description lock) rather than by the current
+        process. Handle owned locks are shared by every descriptor and process
+        referring to the handle, and are released when the handle is
+        destroyed.
+
     Blocking - Supplies a boolean indicating if this should block until a
         determination is made.
 
@@ -4708,7 +4886,8 @@ Routine Description:
 
     IoHandle - Supplies a pointer to the I/O handle being closed.
 
-    Process - Supplies the process closing the handle.
+    Process - Supplies the process closing the handle, or NULL to destroy the
+        locks owned by the I/O handle itself because it is being destroyed.
 
 Return Value:
 
@@ -4739,3 +4918,26 @@ Return Value:
 
 --*/
 
+VOID
+IopDestroyIoRing (
+    PKPROCESS Process
+    );
+
+/*++
+
+Routine Description:
+
+    This routine tears down the given process' I/O ring, if it has one. Any
+    operations in progress are abandoned at their next wait slice, and
+    operations that have not started are discarded.
+
+Arguments:
+
+    Process - Supplies a pointer to the process whose ring should be destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
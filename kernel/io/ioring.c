@@ -0,0 +1,1512 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    ioring.c
+
+Abstract:
+
+    This module implements per-process I/O submission and completion rings.
+    User mode publishes batches of operations in a shared memory submission
+    array and enters the kernel once to hand them all off. A pool of kernel
+    threads performs the operations and posts results to a shared completion
+    array, which user mode reaps without entering the kernel.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define IO_RING_ALLOCATION_TAG 0x52496F49 // 'IoIR'
+
+//
+// Define the number of worker threads a ring gets if user mode doesn't say.
+//
+
+#define IO_RING_DEFAULT_WORKER_COUNT 4
+
+//
+// Define the longest a worker will block in a single wait, in milliseconds.
+// Operations with longer timeouts are retried in slices of this size so that
+// a ring being destroyed never waits on a blocked operation for long.
+//
+
+#define IO_RING_WAIT_SLICE 100
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines an I/O ring.
+
+Members:
+
+    ReferenceCount - Stores the reference count on the ring. The owning
+        process holds one, each worker thread holds one, and system calls in
+        progress hold one.
+
+    Process - Stores a pointer to the process that owns the ring. This is not
+        referenced; the ring is always destroyed before the process is.
+
+    IoBuffer - Stores a pointer to the locked and mapped I/O buffer describing
+        the shared memory region.
+
+    Header - Stores a pointer to the kernel mapping of the shared header.
+
+    Submissions - Stores a pointer to the kernel mapping of the shared
+        submission array.
+
+    Completions - Stores a pointer to the kernel mapping of the shared
+        completion array.
+
+    SubmissionCount - Stores the number of entries in the submission array.
+
+    CompletionCount - Stores the number of entries in the completion array.
+
+    SubmissionHead - Stores the kernel's copy of the submission head. User
+        mode can scribble on the shared copy, so it is never read back.
+
+    CompletionTail - Stores the kernel's copy of the completion tail.
+
+    SubmitLock - Stores a pointer to a lock serializing consumption of the
+        submission array.
+
+    Lock - Stores a pointer to a lock protecting the request list, in-flight
+        count, completion tail, and destroying flag.
+
+    RequestList - Stores the head of the list of requests waiting for a
+        worker.
+
+    InFlight - Stores the number of requests that have been consumed from the
+        submission array but have not yet posted a completion.
+
+    Destroying - Stores a boolean indicating whether the ring is being torn
+        down.
+
+    WorkerCount - Stores the number of worker threads still running.
+
+    WorkEvent - Stores a pointer to the event workers wait on for requests.
+
+    CompletionEvent - Stores a pointer to the event signaled whenever a
+        completion is posted.
+
+    ExitEvent - Stores a pointer to the event signaled when the last worker
+        exits.
+
+--*/
+
+typedef struct _IO_RING {
+    volatile ULONG ReferenceCount;
+    PKPROCESS Process;
+    PIO_BUFFER IoBuffer;
+    PIO_RING_HEADER Header;
+    PIO_RING_SUBMISSION Submissions;
+    PIO_RING_COMPLETION Completions;
+    ULONG SubmissionCount;
+    ULONG CompletionCount;
+    ULONG SubmissionHead;
+    ULONG CompletionTail;
+    PQUEUED_LOCK SubmitLock;
+    PQUEUED_LOCK Lock;
+    LIST_ENTRY RequestList;
+    ULONG InFlight;
+    BOOL Destroying;
+    volatile ULONG WorkerCount;
+    PKEVENT WorkEvent;
+    PKEVENT CompletionEvent;
+    PKEVENT ExitEvent;
+} IO_RING, *PIO_RING;
+
+/*++
+
+Structure Description:
+
+    This structure defines a consumed submission waiting for or being serviced
+    by a worker.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous requests in the
+        ring's request list.
+
+    Submission - Stores a private copy of the submission entry.
+
+    IoHandle - Stores a pointer to the referenced I/O handle to operate on.
+
+    IoBuffer - Stores a pointer to the locked I/O buffer describing the user
+        mode data buffer, if the operation has one.
+
+--*/
+
+typedef struct _IO_RING_REQUEST {
+    LIST_ENTRY ListEntry;
+    IO_RING_SUBMISSION Submission;
+    PIO_HANDLE IoHandle;
+    PIO_BUFFER IoBuffer;
+} IO_RING_REQUEST, *PIO_RING_REQUEST;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+IopCreateIoRing (
+    PKPROCESS Process,
+    PSYSTEM_CALL_CREATE_IO_RING Parameters,
+    PIO_RING *NewRing
+    );
+
+VOID
+IopShutDownIoRing (
+    PIO_RING Ring
+    );
+
+VOID
+IopIoRingAddReference (
+    PIO_RING Ring
+    );
+
+VOID
+IopIoRingReleaseReference (
+    PIO_RING Ring
+    );
+
+KSTATUS
+IopIoRingPinBuffer (
+    PVOID Buffer,
+    UINTN Size,
+    BOOL Write,
+    PIO_BUFFER *IoBuffer
+    );
+
+ULONG
+IopIoRingSubmit (
+    PIO_RING Ring,
+    ULONG SubmitCount
+    );
+
+VOID
+IopIoRingQueueSubmission (
+    PIO_RING Ring,
+    PIO_RING_SUBMISSION Submission
+    );
+
+KSTATUS
+IopIoRingWaitForCompletions (
+    PIO_RING Ring,
+    ULONG MinimumCompleteCount,
+    ULONG TimeoutInMilliseconds
+    );
+
+VOID
+IopIoRingWorkerThread (
+    PVOID Parameter
+    );
+
+KSTATUS
+IopIoRingPerformRequest (
+    PIO_RING Ring,
+    PIO_RING_REQUEST Request,
+    PUINTN BytesCompleted,
+    PULONG ReturnedEvents
+    );
+
+VOID
+IopIoRingPostCompletion (
+    PIO_RING Ring,
+    ULONGLONG UserData,
+    KSTATUS Status,
+    UINTN BytesCompleted,
+    ULONG ReturnedEvents
+    );
+
+VOID
+IopIoRingDestroyRequest (
+    PIO_RING_REQUEST Request
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+INTN
+IoSysCreateIoRing (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for creating or destroying the
+    current process' I/O submission and completion ring.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    STATUS_SUCCESS or positive integer on success.
+
+    Error status code on failure.
+
+--*/
+
+{
+
+    PSYSTEM_CALL_CREATE_IO_RING Parameters;
+    PKPROCESS Process;
+    PIO_RING Ring;
+    KSTATUS Status;
+
+    Parameters = SystemCallParameter;
+    Process = PsGetCurrentProcess();
+
+    ASSERT(Process != PsGetKernelProcess());
+
+    if (Parameters->Buffer == NULL) {
+        IopDestroyIoRing(Process);
+        return STATUS_SUCCESS;
+    }
+
+    if (Process->IoRing != NULL) {
+        return STATUS_RESOURCE_IN_USE;
+    }
+
+    Status = IopCreateIoRing(Process, Parameters, &Ring);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    KeAcquireQueuedLock(Process->QueuedLock);
+    if (Process->IoRing == NULL) {
+        Process->IoRing = Ring;
+        Ring = NULL;
+    }
+
+    KeReleaseQueuedLock(Process->QueuedLock);
+
+    //
+    // Another thread raced in and created a ring first.
+    //
+
+    if (Ring != NULL) {
+        IopShutDownIoRing(Ring);
+        return STATUS_RESOURCE_IN_USE;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+INTN
+IoSysEnterIoRing (
+    PVOID SystemCallParameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements the system call for submitting work to the current
+    process' I/O ring and optionally waiting for completions.
+
+Arguments:
+
+    SystemCallParameter - Supplies a pointer to the parameters supplied with
+        the system call. This structure will be a stack-local copy of the
+        actual parameters passed from user-mode.
+
+Return Value:
+
+    Returns the number of submissions consumed (a non-negative integer) on
+    success.
+
+    Error status code (a negative integer) on failure.
+
+--*/
+
+{
+
+    PSYSTEM_CALL_ENTER_IO_RING Parameters;
+    PKPROCESS Process;
+    PIO_RING Ring;
+    KSTATUS Status;
+    ULONG Submitted;
+
+    Parameters = SystemCallParameter;
+    Process = PsGetCurrentProcess();
+    KeAcquireQueuedLock(Process->QueuedLock);
+    Ring = Process->IoRing;
+    if (Ring != NULL) {
+        IopIoRingAddReference(Ring);
+    }
+
+    KeReleaseQueuedLock(Process->QueuedLock);
+    if (Ring == NULL) {
+        return STATUS_NOT_INITIALIZED;
+    }
+
+    Submitted = 0;
+    if (Parameters->SubmitCount != 0) {
+        Submitted = IopIoRingSubmit(Ring, Parameters->SubmitCount);
+    }
+
+    Status = STATUS_SUCCESS;
+    if (Parameters->MinimumCompleteCount != 0) {
+        Status = IopIoRingWaitForCompletions(
+                                         Ring,
+                                         Parameters->MinimumCompleteCount,
+                                         Parameters->TimeoutInMilliseconds);
+    }
+
+    IopIoRingReleaseReference(Ring);
+
+    //
+    // Having handed off work, the call succeeded even if the wait did not.
+    // User mode finds out what actually completed from the completion array.
+    //
+
+    if ((Submitted != 0) || (KSUCCESS(Status))) {
+        return Submitted;
+    }
+
+    return Status;
+}
+
+VOID
+IopDestroyIoRing (
+    PKPROCESS Process
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tears down the given process' I/O ring, if it has one. Any
+    operations in progress are abandoned at their next wait slice, and
+    operations that have not started are discarded.
+
+Arguments:
+
+    Process - Supplies a pointer to the process whose ring should be destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING Ring;
+
+    if (Process->IoRing == NULL) {
+        return;
+    }
+
+    KeAcquireQueuedLock(Process->QueuedLock);
+    Ring = Process->IoRing;
+    Process->IoRing = NULL;
+    KeReleaseQueuedLock(Process->QueuedLock);
+    if (Ring != NULL) {
+        IopShutDownIoRing(Ring);
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+IopCreateIoRing (
+    PKPROCESS Process,
+    PSYSTEM_CALL_CREATE_IO_RING Parameters,
+    PIO_RING *NewRing
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates an I/O ring on the given shared memory and starts its
+    worker threads.
+
+Arguments:
+
+    Process - Supplies a pointer to the process creating the ring. This must
+        be the current process.
+
+    Parameters - Supplies a pointer to the create parameters.
+
+    NewRing - Supplies a pointer where a pointer to the new ring will be
+        returned on success.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PIO_RING_HEADER Header;
+    PIO_RING Ring;
+    UINTN Size;
+    KSTATUS Status;
+    ULONG WorkerCount;
+    ULONG WorkerIndex;
+
+    *NewRing = NULL;
+    if ((Parameters->SubmissionCount == 0) ||
+        (Parameters->SubmissionCount > IO_RING_MAX_ENTRIES) ||
+        (POWER_OF_2(Parameters->SubmissionCount) == FALSE) ||
+        (Parameters->CompletionCount == 0) ||
+        (Parameters->CompletionCount > IO_RING_MAX_ENTRIES) ||
+        (POWER_OF_2(Parameters->CompletionCount) == FALSE) ||
+        (Parameters->WorkerCount > IO_RING_MAX_WORKERS)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Size = IO_RING_SIZE(Parameters->SubmissionCount,
+                        Parameters->CompletionCount);
+
+    if ((Parameters->Size < Size) ||
+        (IS_POINTER_ALIGNED(Parameters->Buffer, sizeof(ULONGLONG)) == FALSE)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WorkerCount = Parameters->WorkerCount;
+    if (WorkerCount == 0) {
+        WorkerCount = IO_RING_DEFAULT_WORKER_COUNT;
+    }
+
+    Ring = MmAllocateNonPagedPool(sizeof(IO_RING), IO_RING_ALLOCATION_TAG);
+    if (Ring == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Ring, sizeof(IO_RING));
+    Ring->ReferenceCount = 1;
+    Ring->Process = Process;
+    Ring->SubmissionCount = Parameters->SubmissionCount;
+    Ring->CompletionCount = Parameters->CompletionCount;
+    INITIALIZE_LIST_HEAD(&(Ring->RequestList));
+    Ring->SubmitLock = KeCreateQueuedLock();
+    Ring->Lock = KeCreateQueuedLock();
+    Ring->WorkEvent = KeCreateEvent(NULL);
+    Ring->CompletionEvent = KeCreateEvent(NULL);
+    Ring->ExitEvent = KeCreateEvent(NULL);
+    if ((Ring->SubmitLock == NULL) || (Ring->Lock == NULL) ||
+        (Ring->WorkEvent == NULL) || (Ring->CompletionEvent == NULL) ||
+        (Ring->ExitEvent == NULL)) {
+
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto CreateIoRingEnd;
+    }
+
+    //
+    // Lock the shared region down and map it so that workers running in the
+    // kernel process can post completions to it.
+    //
+
+    Status = IopIoRingPinBuffer(Parameters->Buffer,
+                                Size,
+                                TRUE,
+                                &(Ring->IoBuffer));
+
+    if (!KSUCCESS(Status)) {
+        goto CreateIoRingEnd;
+    }
+
+    Status = MmMapIoBuffer(Ring->IoBuffer, FALSE, FALSE, TRUE);
+    if (!KSUCCESS(Status)) {
+        goto CreateIoRingEnd;
+    }
+
+    Header = Ring->IoBuffer->Fragment[0].VirtualAddress;
+    Ring->Header = Header;
+    Ring->Submissions = (PVOID)Header + IO_RING_SUBMISSIONS_OFFSET;
+    Ring->Completions = (PVOID)Header +
+                        IO_RING_COMPLETIONS_OFFSET(Ring->SubmissionCount);
+
+    RtlZeroMemory(Header, sizeof(IO_RING_HEADER));
+    Header->SubmissionCount = Ring->SubmissionCount;
+    Header->CompletionCount = Ring->CompletionCount;
+
+    //
+    // Fire up the workers. Each one holds a reference on the ring.
+    //
+
+    for (WorkerIndex = 0; WorkerIndex < WorkerCount; WorkerIndex += 1) {
+        IopIoRingAddReference(Ring);
+        RtlAtomicAdd32(&(Ring->WorkerCount), 1);
+        Status = PsCreateKernelThread(IopIoRingWorkerThread,
+                                      Ring,
+                                      "IopIoRingWorkerThread");
+
+        if (!KSUCCESS(Status)) {
+            RtlAtomicAdd32(&(Ring->WorkerCount), -1);
+            IopIoRingReleaseReference(Ring);
+            goto CreateIoRingEnd;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+CreateIoRingEnd:
+    if (!KSUCCESS(Status)) {
+        IopShutDownIoRing(Ring);
+        Ring = NULL;
+    }
+
+    *NewRing = Ring;
+    return Status;
+}
+
+VOID
+IopShutDownIoRing (
+    PIO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine stops an I/O ring's workers, discards any requests that have
+    not started, and releases the caller's reference on the ring.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring, which must no longer be reachable
+        from its process.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_REQUEST Request;
+
+    if (Ring->Lock != NULL) {
+        KeAcquireQueuedLock(Ring->Lock);
+        Ring->Destroying = TRUE;
+        if (Ring->WorkEvent != NULL) {
+            KeSignalEvent(Ring->WorkEvent, SignalOptionSignalAll);
+        }
+
+        KeReleaseQueuedLock(Ring->Lock);
+    }
+
+    if (Ring->WorkerCount != 0) {
+        KeWaitForEvent(Ring->ExitEvent, FALSE, WAIT_TIME_INDEFINITE);
+    }
+
+    //
+    // With the workers gone and the destroying flag set nothing else touches
+    // the request list.
+    //
+
+    while (LIST_EMPTY(&(Ring->RequestList)) == FALSE) {
+        Request = LIST_VALUE(Ring->RequestList.Next,
+                             IO_RING_REQUEST,
+                             ListEntry);
+
+        LIST_REMOVE(&(Request->ListEntry));
+        Ring->InFlight -= 1;
+        IopIoRingDestroyRequest(Request);
+    }
+
+    IopIoRingReleaseReference(Ring);
+    return;
+}
+
+VOID
+IopIoRingAddReference (
+    PIO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a reference to an I/O ring.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+
+    OldReferenceCount = RtlAtomicAdd32(&(Ring->ReferenceCount), 1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+
+    return;
+}
+
+VOID
+IopIoRingReleaseReference (
+    PIO_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a reference on an I/O ring, destroying it if this
+    was the last reference.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG OldReferenceCount;
+
+    OldReferenceCount = RtlAtomicAdd32(&(Ring->ReferenceCount), -1);
+
+    ASSERT((OldReferenceCount != 0) && (OldReferenceCount < 0x10000000));
+
+    if (OldReferenceCount != 1) {
+        return;
+    }
+
+    ASSERT((Ring->InFlight == 0) && (Ring->WorkerCount == 0));
+
+    if (Ring->IoBuffer != NULL) {
+        MmFreeIoBuffer(Ring->IoBuffer);
+    }
+
+    if (Ring->SubmitLock != NULL) {
+        KeDestroyQueuedLock(Ring->SubmitLock);
+    }
+
+    if (Ring->Lock != NULL) {
+        KeDestroyQueuedLock(Ring->Lock);
+    }
+
+    if (Ring->WorkEvent != NULL) {
+        KeDestroyEvent(Ring->WorkEvent);
+    }
+
+    if (Ring->CompletionEvent != NULL) {
+        KeDestroyEvent(Ring->CompletionEvent);
+    }
+
+    if (Ring->ExitEvent != NULL) {
+        KeDestroyEvent(Ring->ExitEvent);
+    }
+
+    MmFreeNonPagedPool(Ring);
+    return;
+}
+
+KSTATUS
+IopIoRingPinBuffer (
+    PVOID Buffer,
+    UINTN Size,
+    BOOL Write,
+    PIO_BUFFER *IoBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine locks a user mode buffer of the current process in memory so
+    that it can be accessed from any thread, independent of the address space
+    it runs in.
+
+Arguments:
+
+    Buffer - Supplies the user mode address of the buffer.
+
+    Size - Supplies the size of the buffer in bytes.
+
+    Write - Supplies a boolean indicating whether the kernel will write to the
+        buffer (TRUE) or only read from it (FALSE).
+
+    IoBuffer - Supplies a pointer where the locked I/O buffer will be returned.
+        The caller must free this with MmFreeIoBuffer.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    BOOL LockedCopy;
+    PIO_BUFFER LockedBuffer;
+    KSTATUS Status;
+    PIO_BUFFER UserBuffer;
+
+    *IoBuffer = NULL;
+
+    //
+    // Fault the pages in first. For buffers the kernel writes to, this also
+    // breaks any copy-on-write sharing, so that the pages locked are the ones
+    // this process will actually see.
+    //
+
+    Status = MmTouchUserModeBuffer(Buffer, Size, Write);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Status = MmCreateIoBuffer(Buffer, Size, 0, &UserBuffer);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    LockedBuffer = UserBuffer;
+    Status = MmValidateIoBuffer(0,
+                                MAX_ULONGLONG,
+                                0,
+                                Size,
+                                FALSE,
+                                &LockedBuffer,
+                                &LockedCopy);
+
+    if ((KSUCCESS(Status)) && (LockedCopy == FALSE)) {
+        if (LockedBuffer != UserBuffer) {
+            MmFreeIoBuffer(LockedBuffer);
+        }
+
+        Status = STATUS_INVALID_PARAMETER;
+    }
+
+    MmFreeIoBuffer(UserBuffer);
+    if (KSUCCESS(Status)) {
+        *IoBuffer = LockedBuffer;
+    }
+
+    return Status;
+}
+
+ULONG
+IopIoRingSubmit (
+    PIO_RING Ring,
+    ULONG SubmitCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine consumes published entries from a ring's submission array.
+    Submissions are only consumed while there is guaranteed room in the
+    completion array for their results.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    SubmitCount - Supplies the maximum number of entries to consume.
+
+Return Value:
+
+    Returns the number of entries consumed.
+
+--*/
+
+{
+
+    ULONG Available;
+    PIO_RING_HEADER Header;
+    ULONG Outstanding;
+    IO_RING_SUBMISSION Submission;
+    ULONG Submitted;
+
+    Header = Ring->Header;
+    Submitted = 0;
+    KeAcquireQueuedLock(Ring->SubmitLock);
+    Available = Header->SubmissionTail - Ring->SubmissionHead;
+    if (Available > Ring->SubmissionCount) {
+        Available = 0;
+    }
+
+    if (SubmitCount > Available) {
+        SubmitCount = Available;
+    }
+
+    //
+    // Read the tail before any of the entries it covers.
+    //
+
+    RtlMemoryBarrier();
+    while (Submitted < SubmitCount) {
+
+        //
+        // Reserve a completion slot. If user mode has moved the completion
+        // head somewhere nonsensical, treat the completion array as full.
+        //
+
+        KeAcquireQueuedLock(Ring->Lock);
+        Outstanding = Ring->CompletionTail - Header->CompletionHead;
+        if (Outstanding <= Ring->CompletionCount) {
+            Outstanding += Ring->InFlight;
+        }
+
+        if ((Ring->Destroying != FALSE) ||
+            (Outstanding >= Ring->CompletionCount)) {
+
+            KeReleaseQueuedLock(Ring->Lock);
+            break;
+        }
+
+        Ring->InFlight += 1;
+        KeReleaseQueuedLock(Ring->Lock);
+        RtlCopyMemory(
+            &Submission,
+            &(Ring->Submissions[Ring->SubmissionHead &
+                                (Ring->SubmissionCount - 1)]),
+            sizeof(IO_RING_SUBMISSION));
+
+        Ring->SubmissionHead += 1;
+        Header->SubmissionHead = Ring->SubmissionHead;
+        IopIoRingQueueSubmission(Ring, &Submission);
+        Submitted += 1;
+    }
+
+    KeReleaseQueuedLock(Ring->SubmitLock);
+    return Submitted;
+}
+
+VOID
+IopIoRingQueueSubmission (
+    PIO_RING Ring,
+    PIO_RING_SUBMISSION Submission
+    )
+
+/*++
+
+Routine Description:
+
+    This routine validates a consumed submission, takes references on its
+    handle and buffer, and hands it to the ring's workers. Submissions that
+    fail validation or need no work are completed immediately. A completion
+    slot must already have been reserved for the submission.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Submission - Supplies a pointer to a private copy of the submission.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    BOOL KernelWrites;
+    PKPROCESS Process;
+    BOOL Queued;
+    PIO_RING_REQUEST Request;
+    KSTATUS Status;
+
+    Process = Ring->Process;
+    Queued = FALSE;
+    Request = NULL;
+    switch (Submission->Operation) {
+    case IoRingOperationNop:
+        Status = STATUS_SUCCESS;
+        goto QueueSubmissionEnd;
+
+    case IoRingOperationRead:
+    case IoRingOperationWrite:
+    case IoRingOperationSend:
+    case IoRingOperationReceive:
+    case IoRingOperationPoll:
+    case IoRingOperationFlush:
+        break;
+
+    default:
+        Status = STATUS_INVALID_PARAMETER;
+        goto QueueSubmissionEnd;
+    }
+
+    Request = MmAllocatePagedPool(sizeof(IO_RING_REQUEST),
+                                  IO_RING_ALLOCATION_TAG);
+
+    if (Request == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto QueueSubmissionEnd;
+    }
+
+    RtlZeroMemory(Request, sizeof(IO_RING_REQUEST));
+    RtlCopyMemory(&(Request->Submission),
+                  Submission,
+                  sizeof(IO_RING_SUBMISSION));
+
+    Request->IoHandle = ObGetHandleValue(Process->HandleTable,
+                                         Submission->Handle,
+                                         NULL);
+
+    if (Request->IoHandle == NULL) {
+        Status = STATUS_INVALID_HANDLE;
+        goto QueueSubmissionEnd;
+    }
+
+    //
+    // Data transfers need their buffers pinned now, while the submitting
+    // process' address space is current. Zero-sized transfers are done.
+    //
+
+    if ((Submission->Operation != IoRingOperationPoll) &&
+        (Submission->Operation != IoRingOperationFlush)) {
+
+        if ((INTN)Submission->Size <= 0) {
+            Status = STATUS_SUCCESS;
+            goto QueueSubmissionEnd;
+        }
+
+        KernelWrites = FALSE;
+        if ((Submission->Operation == IoRingOperationRead) ||
+            (Submission->Operation == IoRingOperationReceive)) {
+
+            KernelWrites = TRUE;
+        }
+
+        Status = IopIoRingPinBuffer(Submission->Buffer,
+                                    Submission->Size,
+                                    KernelWrites,
+                                    &(Request->IoBuffer));
+
+        if (!KSUCCESS(Status)) {
+            goto QueueSubmissionEnd;
+        }
+    }
+
+    KeAcquireQueuedLock(Ring->Lock);
+    if (Ring->Destroying != FALSE) {
+        Status = STATUS_OPERATION_CANCELLED;
+
+    } else {
+        INSERT_BEFORE(&(Request->ListEntry), &(Ring->RequestList));
+        KeSignalEvent(Ring->WorkEvent, SignalOptionSignalAll);
+        Queued = TRUE;
+    }
+
+    KeReleaseQueuedLock(Ring->Lock);
+
+QueueSubmissionEnd:
+    if (Queued == FALSE) {
+        IopIoRingPostCompletion(Ring, Submission->UserData, Status, 0, 0);
+        if (Request != NULL) {
+            IopIoRingDestroyRequest(Request);
+        }
+    }
+
+    return;
+}
+
+KSTATUS
+IopIoRingWaitForCompletions (
+    PIO_RING Ring,
+    ULONG MinimumCompleteCount,
+    ULONG TimeoutInMilliseconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits until the ring's completion array holds at least the
+    given number of unreaped entries.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    MinimumCompleteCount - Supplies the number of unreaped completions to wait
+        for. This is capped at the size of the completion array.
+
+    TimeoutInMilliseconds - Supplies the maximum time to wait, or
+        WAIT_TIME_INDEFINITE.
+
+Return Value:
+
+    STATUS_SUCCESS if the completions are available.
+
+    STATUS_TIMEOUT if the timeout expired first.
+
+    STATUS_INTERRUPTED if a signal arrived first.
+
+--*/
+
+{
+
+    ULONGLONG CurrentTime;
+    ULONGLONG EndTime;
+    ULONGLONG Frequency;
+    ULONG Pending;
+    KSTATUS Status;
+    ULONG WaitTime;
+
+    ASSERT(SYS_WAIT_TIME_INDEFINITE == WAIT_TIME_INDEFINITE);
+
+    if (MinimumCompleteCount > Ring->CompletionCount) {
+        MinimumCompleteCount = Ring->CompletionCount;
+    }
+
+    EndTime = 0;
+    Frequency = 0;
+    if (TimeoutInMilliseconds != WAIT_TIME_INDEFINITE) {
+        Frequency = HlQueryTimeCounterFrequency();
+        EndTime = KeGetRecentTimeCounter() +
+                  KeConvertMicrosecondsToTimeTicks(
+                       TimeoutInMilliseconds * MICROSECONDS_PER_MILLISECOND);
+    }
+
+    WaitTime = TimeoutInMilliseconds;
+    while (TRUE) {
+
+        //
+        // Unsignal the event under the lock so that a completion posted after
+        // the check is guaranteed to wake this thread.
+        //
+
+        KeAcquireQueuedLock(Ring->Lock);
+        Pending = Ring->CompletionTail - Ring->Header->CompletionHead;
+        if (Pending >= MinimumCompleteCount) {
+            KeReleaseQueuedLock(Ring->Lock);
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        KeSignalEvent(Ring->CompletionEvent, SignalOptionUnsignal);
+        KeReleaseQueuedLock(Ring->Lock);
+        if (TimeoutInMilliseconds != WAIT_TIME_INDEFINITE) {
+            CurrentTime = KeGetRecentTimeCounter();
+            if (CurrentTime >= EndTime) {
+                Status = STATUS_TIMEOUT;
+                break;
+            }
+
+            WaitTime = ((EndTime - CurrentTime) * MILLISECONDS_PER_SECOND) /
+                       Frequency;
+
+            if (WaitTime == 0) {
+                WaitTime = 1;
+            }
+        }
+
+        Status = KeWaitForEvent(Ring->CompletionEvent, TRUE, WaitTime);
+        if ((Status == STATUS_INTERRUPTED) || (Status == STATUS_TIMEOUT)) {
+            break;
+        }
+    }
+
+    return Status;
+}
+
+VOID
+IopIoRingWorkerThread (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine implements an I/O ring worker thread, which performs queued
+    requests and posts their completions until the ring is destroyed.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the ring. The thread owns a reference on
+        it.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BytesCompleted;
+    PIO_RING_REQUEST Request;
+    ULONG ReturnedEvents;
+    PIO_RING Ring;
+    KSTATUS Status;
+
+    Ring = Parameter;
+    while (TRUE) {
+        KeAcquireQueuedLock(Ring->Lock);
+        if (Ring->Destroying != FALSE) {
+            KeReleaseQueuedLock(Ring->Lock);
+            break;
+        }
+
+        if (LIST_EMPTY(&(Ring->RequestList)) != FALSE) {
+            KeSignalEvent(Ring->WorkEvent, SignalOptionUnsignal);
+            KeReleaseQueuedLock(Ring->Lock);
+            KeWaitForEvent(Ring->WorkEvent, FALSE, WAIT_TIME_INDEFINITE);
+            continue;
+        }
+
+        Request = LIST_VALUE(Ring->RequestList.Next,
+                             IO_RING_REQUEST,
+                             ListEntry);
+
+        LIST_REMOVE(&(Request->ListEntry));
+        KeReleaseQueuedLock(Ring->Lock);
+        BytesCompleted = 0;
+        ReturnedEvents = 0;
+        Status = IopIoRingPerformRequest(Ring,
+                                         Request,
+                                         &BytesCompleted,
+                                         &ReturnedEvents);
+
+        IopIoRingPostCompletion(Ring,
+                                Request->Submission.UserData,
+                                Status,
+                                BytesCompleted,
+                                ReturnedEvents);
+
+        IopIoRingDestroyRequest(Request);
+    }
+
+    if (RtlAtomicAdd32(&(Ring->WorkerCount), -1) == 1) {
+        KeSignalEvent(Ring->ExitEvent, SignalOptionSignalAll);
+    }
+
+    IopIoRingReleaseReference(Ring);
+    return;
+}
+
+KSTATUS
+IopIoRingPerformRequest (
+    PIO_RING Ring,
+    PIO_RING_REQUEST Request,
+    PUINTN BytesCompleted,
+    PULONG ReturnedEvents
+    )
+
+/*++
+
+Routine Description:
+
+    This routine performs a single I/O ring request on a worker thread.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    Request - Supplies a pointer to the request.
+
+    BytesCompleted - Supplies a pointer where the number of bytes transferred
+        will be returned.
+
+    ReturnedEvents - Supplies a pointer where the signaled poll events will be
+        returned for poll requests.
+
+Return Value:
+
+    Status code of the operation.
+
+--*/
+
+{
+
+    PIO_OBJECT_STATE IoState;
+    SOCKET_IO_PARAMETERS Parameters;
+    ULONG Remaining;
+    ULONG Slice;
+    KSTATUS Status;
+    PIO_RING_SUBMISSION Submission;
+
+    Submission = &(Request->Submission);
+    Remaining = Submission->TimeoutInMilliseconds;
+    while (TRUE) {
+        Slice = Remaining;
+        if (Slice > IO_RING_WAIT_SLICE) {
+            Slice = IO_RING_WAIT_SLICE;
+        }
+
+        switch (Submission->Operation) {
+        case IoRingOperationRead:
+            Status = IoReadAtOffset(Request->IoHandle,
+                                    Request->IoBuffer,
+                                    Submission->Offset,
+                                    Submission->Size,
+                                    0,
+                                    Slice,
+                                    BytesCompleted,
+                                    NULL);
+
+            break;
+
+        case IoRingOperationWrite:
+            Status = IoWriteAtOffset(Request->IoHandle,
+                                     Request->IoBuffer,
+                                     Submission->Offset,
+                                     Submission->Size,
+                                     0,
+                                     Slice,
+                                     BytesCompleted,
+                                     NULL);
+
+            break;
+
+        case IoRingOperationSend:
+        case IoRingOperationReceive:
+            RtlZeroMemory(&Parameters, sizeof(SOCKET_IO_PARAMETERS));
+            Parameters.Size = Submission->Size;
+            Parameters.SocketIoFlags = Submission->OperationFlags;
+            Parameters.TimeoutInMilliseconds = Slice;
+            if (Submission->Operation == IoRingOperationSend) {
+                Status = IoSocketSendData(TRUE,
+                                          Request->IoHandle,
+                                          &Parameters,
+                                          Request->IoBuffer);
+
+            } else {
+                Status = IoSocketReceiveData(TRUE,
+                                             Request->IoHandle,
+                                             &Parameters,
+                                             Request->IoBuffer);
+            }
+
+            *BytesCompleted = Parameters.BytesCompleted;
+            break;
+
+        case IoRingOperationPoll:
+            IoState = Request->IoHandle->FileObject->IoState;
+
+            //
+            // Objects without I/O state are regular files, which are always
+            // ready.
+            //
+
+            if (IoState == NULL) {
+                *ReturnedEvents = Submission->OperationFlags &
+                                  POLL_NONMASKABLE_FILE_EVENTS;
+
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            Status = IoWaitForIoObjectState(IoState,
+                                            Submission->OperationFlags,
+                                            FALSE,
+                                            Slice,
+                                            ReturnedEvents);
+
+            break;
+
+        case IoRingOperationFlush:
+            Status = IoFlush(Request->IoHandle, 0, -1, 0);
+            break;
+
+        default:
+
+            ASSERT(FALSE);
+
+            Status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        if ((Status != STATUS_TIMEOUT) ||
+            (*BytesCompleted != 0) ||
+            (Ring->Destroying != FALSE)) {
+
+            break;
+        }
+
+        if (Remaining != WAIT_TIME_INDEFINITE) {
+            if (Remaining <= Slice) {
+                break;
+            }
+
+            Remaining -= Slice;
+        }
+    }
+
+    if ((Status == STATUS_BROKEN_PIPE) &&
+        ((Submission->Operation == IoRingOperationWrite) ||
+         (Submission->Operation == IoRingOperationSend))) {
+
+        PsSignalProcess(Ring->Process, SIGNAL_BROKEN_PIPE, NULL);
+    }
+
+    return Status;
+}
+
+VOID
+IopIoRingPostCompletion (
+    PIO_RING Ring,
+    ULONGLONG UserData,
+    KSTATUS Status,
+    UINTN BytesCompleted,
+    ULONG ReturnedEvents
+    )
+
+/*++
+
+Routine Description:
+
+    This routine posts a completion to a ring's completion array and releases
+    the slot reserved for it when the submission was consumed.
+
+Arguments:
+
+    Ring - Supplies a pointer to the ring.
+
+    UserData - Supplies the user data from the submission.
+
+    Status - Supplies the final status of the operation.
+
+    BytesCompleted - Supplies the number of bytes transferred.
+
+    ReturnedEvents - Supplies the signaled poll events.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PIO_RING_COMPLETION Completion;
+    PIO_RING_HEADER Header;
+    ULONG Pending;
+
+    Header = Ring->Header;
+    KeAcquireQueuedLock(Ring->Lock);
+
+    ASSERT(Ring->InFlight != 0);
+
+    Ring->InFlight -= 1;
+    Pending = Ring->CompletionTail - Header->CompletionHead;
+
+    //
+    // A slot was reserved for this completion, so the array can only be full
+    // if user mode has been playing games with the completion head.
+    //
+
+    if (Pending >= Ring->CompletionCount) {
+        RtlAtomicOr32(&(Header->Flags), IO_RING_FLAG_COMPLETION_OVERFLOW);
+
+    } else {
+        Completion = &(Ring->Completions[Ring->CompletionTail &
+                                         (Ring->CompletionCount - 1)]);
+
+        Completion->UserData = UserData;
+        Completion->BytesCompleted = BytesCompleted;
+        Completion->Status = Status;
+        Completion->ReturnedEvents = ReturnedEvents;
+
+        //
+        // Make sure the entry is visible before the tail that covers it.
+        //
+
+        RtlMemoryBarrier();
+        Ring->CompletionTail += 1;
+        Header->CompletionTail = Ring->CompletionTail;
+    }
+
+    KeReleaseQueuedLock(Ring->Lock);
+    KeSignalEvent(Ring->CompletionEvent, SignalOptionSignalAll);
+    return;
+}
+
+VOID
+IopIoRingDestroyRequest (
+    PIO_RING_REQUEST Request
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases the resources held by an I/O ring request and frees
+    it.
+
+Arguments:
+
+    Request - Supplies a pointer to the request.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Request->IoBuffer != NULL) {
+        MmFreeIoBuffer(Request->IoBuffer);
+    }
+
+    if (Request->IoHandle != NULL) {
+        IoIoHandleReleaseReference(Request->IoHandle);
+    }
+
+    MmFreePagedPool(Request);
+    return;
+}
+
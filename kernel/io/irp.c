@@ -843,7 +843,10 @@ Return Value:
             break;
         }
 
-        ASSERT((InternalIrp->Flags & IRP_COMPLETE) != 0);
+        //
+        // The pending driver either completed the IRP or continued it. Either
+        // way, resume pumping from where it left off.
+        //
 
         InternalIrp->Flags &= ~IRP_PENDING;
     }
@@ -124,6 +124,20 @@ Module Name:
 
 #define PAGE_CACHE_ENTRY_FLAG_HARD_FLUSH_REQUESTED 0x00000040
 
+//
+// Set this flag when the page cache entry is looked up. Eviction clears it and
+// gives the entry another trip through the clean list instead of removing it.
+//
+
+#define PAGE_CACHE_ENTRY_FLAG_REFERENCED 0x00000080
+
+//
+// Set this flag while the page cache entry is in its file object's index.
+// It is only changed with the file object lock held exclusively.
+//
+
+#define PAGE_CACHE_ENTRY_FLAG_INDEXED 0x00000100
+
 //
 // If any of the dirty mask bits are set, then the page cache entry needs to
 // be cleaned and flushed.
@@ -157,6 +171,14 @@ Module Name:
 
 #define PAGE_CACHE_FLUSH_MAX_CLEAN_STREAK 4
 
+//
+// Define the number of slots in the table remembering recently evicted pages.
+// A page read back in while its slot still remembers it counts as a refault.
+// This must be a power of two.
+//
+
+#define PAGE_CACHE_SHADOW_ENTRY_COUNT 1024
+
 //
 // Define the block expansion count for the page cache entry block allocator.
 //
@@ -192,6 +214,24 @@ Module Name:
 
 #define PAGE_CACHE_CLEAN_DELAY_MIN (5000 * MICROSECONDS_PER_MILLISECOND)
 
+//
+// Define the number of lookup phases and the number of per-processor counter
+// slots that lockless lookups count themselves in. Destroying page cache
+// entries waits for lookups that started in the old phase to finish.
+//
+
+#define PAGE_CACHE_LOOKUP_PHASES 2
+#define PAGE_CACHE_LOOKUP_SLOT_COUNT 16
+
+//
+// Define the number of per-processor batches of newly created page cache
+// entries, and the number of entries each batch holds before it is moved onto
+// the clean list all at once.
+//
+
+#define PAGE_CACHE_LIST_BATCH_COUNT 16
+#define PAGE_CACHE_LIST_BATCH_SIZE 15
+
 //
 // --------------------------------------------------------------------- Macros
 //
@@ -240,12 +280,54 @@ typedef enum _PAGE_CACHE_STATE {
 
 Structure Description:
 
-    This structure defines a page cache entry.
+    This structure defines a set of lockless lookup counters. Each one sits in
+    its own cache line so that processors do not fight over them.
 
 Members:
 
-    Node - Stores the Red-Black tree node information for this page cache
-        entry.
+    Lookups - Stores the number of lookups in flight for each phase.
+
+    Padding - Stores padding out to a cache line.
+
+--*/
+
+typedef struct _PAGE_CACHE_LOOKUP_SLOT {
+    volatile ULONG Lookups[PAGE_CACHE_LOOKUP_PHASES];
+    ULONG Padding[16 - PAGE_CACHE_LOOKUP_PHASES];
+} PAGE_CACHE_LOOKUP_SLOT, *PPAGE_CACHE_LOOKUP_SLOT;
+
+/*++
+
+Structure Description:
+
+    This structure defines a batch of newly created page cache entries waiting
+    to be put on the clean list. Batching them means creating an entry does
+    not take the global list lock every time.
+
+Members:
+
+    Lock - Stores the spin lock protecting the batch.
+
+    Count - Stores the number of entries in the batch.
+
+    Entries - Stores the entries, each of which holds a reference for the
+        batch.
+
+--*/
+
+typedef struct _PAGE_CACHE_LIST_BATCH {
+    KSPIN_LOCK Lock;
+    ULONG Count;
+    PPAGE_CACHE_ENTRY Entries[PAGE_CACHE_LIST_BATCH_SIZE];
+} PAGE_CACHE_LIST_BATCH, *PPAGE_CACHE_LIST_BATCH;
+
+/*++
+
+Structure Description:
+
+    This structure defines a page cache entry.
+
+Members:
 
     ListEntry - Stores this page cache entry's list entry in an LRU list, local
         list, or dirty list. This list entry is protected by the global page
@@ -273,7 +355,6 @@ Structure Description:
 --*/
 
 struct _PAGE_CACHE_ENTRY {
-    RED_BLACK_TREE_NODE Node;
     LIST_ENTRY ListEntry;
     PFILE_OBJECT FileObject;
     IO_OFFSET Offset;
@@ -306,12 +387,17 @@ IopDestroyPageCacheEntry (
     PPAGE_CACHE_ENTRY Entry
     );
 
-VOID
+KSTATUS
 IopInsertPageCacheEntry (
     PPAGE_CACHE_ENTRY NewEntry,
     PPAGE_CACHE_ENTRY LinkEntry
     );
 
+VOID
+IopSynchronizePageCacheLookups (
+    VOID
+    );
+
 PPAGE_CACHE_ENTRY
 IopLookupPageCacheEntryHelper (
     PFILE_OBJECT FileObject,
@@ -378,6 +464,17 @@ IopUpdatePageCacheEntryList (
     BOOL Created
     );
 
+VOID
+IopDrainPageCacheListBatches (
+    VOID
+    );
+
+VOID
+IopDrainPageCacheListBatch (
+    PPAGE_CACHE_ENTRY *Entries,
+    ULONG Count
+    );
+
 BOOL
 IopIsPageCacheTooBig (
     PUINTN FreePhysicalPages
@@ -393,6 +490,12 @@ IopCheckFileObjectPageCache (
     PFILE_OBJECT FileObject
     );
 
+ULONG
+IopGetPageCacheShadowKey (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -570,6 +673,29 @@ PKTHREAD IoPageCacheThread;
 
 BOOL IoPageCacheDisableVirtualAddresses;
 
+//
+// Store a table of keys for recently evicted page cache entries, and the
+// number of pages evicted and read back in while still remembered there.
+//
+
+volatile ULONG IoPageCacheShadowTable[PAGE_CACHE_SHADOW_ENTRY_COUNT];
+volatile UINTN IoPageCacheEvictedPageCount = 0;
+volatile UINTN IoPageCacheRefaultedPageCount = 0;
+
+//
+// Store the phase new lockless lookups count themselves in, and the counters
+// they count themselves in.
+//
+
+volatile ULONG IoPageCacheLookupPhase;
+PAGE_CACHE_LOOKUP_SLOT IoPageCacheLookupSlots[PAGE_CACHE_LOOKUP_SLOT_COUNT];
+
+//
+// Store the batches of new page cache entries headed for the clean list.
+//
+
+PAGE_CACHE_LIST_BATCH IoPageCacheListBatches[PAGE_CACHE_LIST_BATCH_COUNT];
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -641,6 +767,8 @@ Return Value:
     Statistics->PhysicalPageCount = IoPageCachePhysicalPageCount;
     Statistics->DirtyPageCount = IoPageCacheDirtyPageCount;
     Statistics->LastCleanTime = LastCleanTime;
+    Statistics->EvictedPages = IoPageCacheEvictedPageCount;
+    Statistics->RefaultedPages = IoPageCacheRefaultedPageCount;
     return STATUS_SUCCESS;
 }
 
@@ -1041,6 +1169,7 @@ Return Value:
 
 {
 
+    ULONG BatchIndex;
     PBLOCK_ALLOCATOR BlockAllocator;
     ULONGLONG CurrentTime;
     ULONG PageShift;
@@ -1052,6 +1181,13 @@ Return Value:
     INITIALIZE_LIST_HEAD(&IoPageCacheCleanList);
     INITIALIZE_LIST_HEAD(&IoPageCacheCleanUnmappedList);
     INITIALIZE_LIST_HEAD(&IoPageCacheRemovalList);
+    for (BatchIndex = 0;
+         BatchIndex < PAGE_CACHE_LIST_BATCH_COUNT;
+         BatchIndex += 1) {
+
+        KeInitializeSpinLock(&(IoPageCacheListBatches[BatchIndex].Lock));
+    }
+
     IoPageCacheListLock = KeCreateQueuedLock();
     if (IoPageCacheListLock == NULL) {
         Status = STATUS_INSUFFICIENT_RESOURCES;
@@ -1232,6 +1368,8 @@ Routine Description:
 
     This routine searches for a page cache entry based on the file object and
     offset. If found, this routine takes a reference on the page cache entry.
+    The lookup itself takes no locks, but callers that need the result to
+    stay consistent with truncation must hold the file object lock.
 
 Arguments:
 
@@ -1249,12 +1387,58 @@ Return Value:
 {
 
     PPAGE_CACHE_ENTRY FoundEntry;
+    ULONGLONG Key;
+    ULONG Phase;
+    PPAGE_CACHE_LOOKUP_SLOT Slot;
+
+    //
+    // Count this lookup as in flight so that the entry it finds cannot be
+    // freed underneath it, even if it is removed from the index meanwhile.
+    //
+
+    Key = Offset >> MmPageShift();
+    Slot = &(IoPageCacheLookupSlots[KeGetCurrentProcessorNumber() %
+                                    PAGE_CACHE_LOOKUP_SLOT_COUNT]);
+
+    Phase = IoPageCacheLookupPhase % PAGE_CACHE_LOOKUP_PHASES;
+    RtlAtomicAdd32(&(Slot->Lookups[Phase]), 1);
+    while (TRUE) {
+        FoundEntry = IopLookupPageCacheIndex(&(FileObject->PageCacheIndex),
+                                             Key);
+
+        if (FoundEntry == NULL) {
+            break;
+        }
+
+        //
+        // Take the reference and then make sure the entry was not removed
+        // before the reference landed. If it was, drop the reference without
+        // putting the entry back on a list and look again.
+        //
+
+        IoPageCacheEntryAddReference(FoundEntry);
+        RtlMemoryBarrier();
+        if (IopLookupPageCacheIndex(&(FileObject->PageCacheIndex), Key) ==
+            FoundEntry) {
+
+            break;
+        }
+
+        RtlAtomicAdd32(&(FoundEntry->ReferenceCount), -1);
+    }
+
+    RtlAtomicAdd32(&(Slot->Lookups[Phase]), -1);
+
+    //
+    // Rather than taking the list lock to move the entry to the end of the
+    // clean list, just mark it referenced. Eviction will give it a second
+    // chance.
+    //
 
-    ASSERT(KeIsSharedExclusiveLockHeld(FileObject->Lock));
+    if ((FoundEntry != NULL) &&
+        ((FoundEntry->Flags & PAGE_CACHE_ENTRY_FLAG_REFERENCED) == 0)) {
 
-    FoundEntry = IopLookupPageCacheEntryHelper(FileObject, Offset);
-    if (FoundEntry != NULL) {
-        IopUpdatePageCacheEntryList(FoundEntry, FALSE);
+        RtlAtomicOr32(&(FoundEntry->Flags), PAGE_CACHE_ENTRY_FLAG_REFERENCED);
     }
 
     if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_LOOKUP) != 0) {
@@ -1328,7 +1512,11 @@ Return Value:
 {
 
     BOOL Created;
+    ULONG Index;
+    ULONG Key;
     PPAGE_CACHE_ENTRY NewEntry;
+    ULONG OldKey;
+    KSTATUS Status;
 
     ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock));
     ASSERT((LinkEntry == NULL) ||
@@ -1357,15 +1545,51 @@ Return Value:
         // sneak into the cache. Insert this new entry.
         //
 
-        IopInsertPageCacheEntry(NewEntry, LinkEntry);
+        Status = IopInsertPageCacheEntry(NewEntry, LinkEntry);
+        if (!KSUCCESS(Status)) {
+            NewEntry->ReferenceCount = 0;
+            IopDestroyPageCacheEntry(NewEntry);
+            NewEntry = NULL;
+            goto CreateOrLookupPageCacheEntryEnd;
+        }
+
         Created = TRUE;
+
+        //
+        // If this page was evicted recently, the cache was too eager to let
+        // it go. Count the refault and start the entry off as referenced so
+        // it survives the next pass of eviction.
+        //
+
+        Key = IopGetPageCacheShadowKey(FileObject, Offset);
+        Index = Key & (PAGE_CACHE_SHADOW_ENTRY_COUNT - 1);
+        if (IoPageCacheShadowTable[Index] == Key) {
+            OldKey = RtlAtomicCompareExchange32(
+                                             &(IoPageCacheShadowTable[Index]),
+                                             0,
+                                             Key);
+
+            if (OldKey == Key) {
+                RtlAtomicAdd(&IoPageCacheRefaultedPageCount, 1);
+                RtlAtomicOr32(&(NewEntry->Flags),
+                              PAGE_CACHE_ENTRY_FLAG_REFERENCED);
+            }
+        }
     }
 
     //
-    // Put the page cache entry on the appropriate list.
+    // Put a new page cache entry on the clean list. An existing one is just
+    // marked referenced rather than moved, so that hits do not need the list
+    // lock.
     //
 
-    IopUpdatePageCacheEntryList(NewEntry, Created);
+    if (Created != FALSE) {
+        IopUpdatePageCacheEntryList(NewEntry, TRUE);
+
+    } else if ((NewEntry->Flags & PAGE_CACHE_ENTRY_FLAG_REFERENCED) == 0) {
+        RtlAtomicOr32(&(NewEntry->Flags), PAGE_CACHE_ENTRY_FLAG_REFERENCED);
+    }
+
     if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_INSERTION) != 0) {
         if (Created != FALSE) {
             RtlDebugPrint("PAGE CACHE: Inserted new entry for file object "
@@ -1443,6 +1667,7 @@ Return Value:
 {
 
     PPAGE_CACHE_ENTRY NewEntry;
+    KSTATUS Status;
 
     ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock) != FALSE);
     ASSERT((LinkEntry == NULL) ||
@@ -1467,7 +1692,13 @@ Return Value:
 
     ASSERT(IopLookupPageCacheEntryHelper(FileObject, Offset) == NULL);
 
-    IopInsertPageCacheEntry(NewEntry, LinkEntry);
+    Status = IopInsertPageCacheEntry(NewEntry, LinkEntry);
+    if (!KSUCCESS(Status)) {
+        NewEntry->ReferenceCount = 0;
+        IopDestroyPageCacheEntry(NewEntry);
+        NewEntry = NULL;
+        goto CreateAndInsertPageCacheEntryEnd;
+    }
 
     //
     // Add the newly created page cach entry to the appropriate list.
@@ -1729,17 +1960,16 @@ Return Value:
     BOOL BytesFlushed;
     PPAGE_CACHE_ENTRY CacheEntry;
     UINTN CleanStreak;
+    PPAGE_CACHE_ENTRY Cursor;
     PIO_BUFFER FlushBuffer;
     IO_OFFSET FlushNextOffset;
     UINTN FlushSize;
     BOOL GetNextNode;
     LIST_ENTRY LocalList;
-    PRED_BLACK_TREE_NODE Node;
     BOOL PageCacheThread;
     UINTN PagesFlushed;
     ULONG PageShift;
     ULONG PageSize;
-    PAGE_CACHE_ENTRY SearchEntry;
     BOOL SkipEntry;
     KSTATUS Status;
     KSTATUS TotalStatus;
@@ -1823,13 +2053,10 @@ Return Value:
     // Determine which page cache entry the flush should start on.
     //
 
-    SearchEntry.FileObject = FileObject;
     FlushNextOffset = Offset;
     FlushSize = 0;
     CleanStreak = 0;
-    SearchEntry.Offset = Offset;
-    SearchEntry.Flags = 0;
-    Node = NULL;
+    Cursor = NULL;
 
     //
     // Loop over page cache entries. For non-synchronized flush-all operations,
@@ -1840,9 +2067,8 @@ Return Value:
     //
 
     if (UseDirtyPageList == FALSE) {
-        Node = RtlRedBlackTreeSearchClosest(&(FileObject->PageCacheTree),
-                                            &(SearchEntry.Node),
-                                            TRUE);
+        Cursor = IopFindPageCacheIndex(&(FileObject->PageCacheIndex),
+                                       Offset >> PageShift);
 
     //
     // Move all dirty entries over to a local list to avoid processing them
@@ -1871,31 +2097,30 @@ Return Value:
         // Get the next greatest node in the tree if necessary.
         //
 
-        if ((Node != NULL) && (GetNextNode != FALSE)) {
-            Node = RtlRedBlackTreeGetNextNode(&(FileObject->PageCacheTree),
-                                              FALSE,
-                                              Node);
+        if ((Cursor != NULL) && (GetNextNode != FALSE)) {
+            Cursor = IopFindPageCacheIndex(&(FileObject->PageCacheIndex),
+                                           (Cursor->Offset >> PageShift) + 1);
         }
 
-        if ((Node == NULL) && (UseDirtyPageList != FALSE)) {
+        if ((Cursor == NULL) && (UseDirtyPageList != FALSE)) {
             KeAcquireQueuedLock(IoPageCacheListLock);
             while (!LIST_EMPTY(&LocalList)) {
                 CacheEntry = LIST_VALUE(LocalList.Next,
                                         PAGE_CACHE_ENTRY,
                                         ListEntry);
 
-                Node = &(CacheEntry->Node);
+                Cursor = CacheEntry;
 
                 //
-                // The node might have been pulled from the tree while the file
-                // object lock was dropped, but that routine didn't yet get
+                // The entry might have been pulled from the index while the
+                // file object lock was dropped, but that routine didn't yet get
                 // far enough to pull it off the list. Do it for them.
                 //
 
-                if (Node->Parent == NULL) {
+                if ((Cursor->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0) {
                     LIST_REMOVE(&(CacheEntry->ListEntry));
                     CacheEntry->ListEntry.Next = NULL;
-                    Node = NULL;
+                    Cursor = NULL;
                     continue;
                 }
 
@@ -1909,11 +2134,11 @@ Return Value:
         // Stop if there's nothing left.
         //
 
-        if (Node == NULL) {
+        if (Cursor == NULL) {
             break;
         }
 
-        CacheEntry = RED_BLACK_TREE_VALUE(Node, PAGE_CACHE_ENTRY, Node);
+        CacheEntry = Cursor;
         if ((Size != -1ULL) && (CacheEntry->Offset >= (Offset + Size))) {
             break;
         }
@@ -1992,7 +2217,7 @@ Return Value:
 
         if (SkipEntry != FALSE) {
             if (UseDirtyPageList != FALSE) {
-                Node = NULL;
+                Cursor = NULL;
             }
 
             continue;
@@ -2075,10 +2300,13 @@ Return Value:
         //
         // If this cache entry has not been dealt with, add it to the buffer
         // now. As the flush routine may release the lock (for block devices),
-        // also check to make sure the cache entry is still in the tree.
+        // also check to make sure the cache entry is still in the index.
         //
 
-        if ((CacheEntry != NULL) && (CacheEntry->Node.Parent != NULL)) {
+        if ((CacheEntry != NULL) &&
+            ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0)) {
+
+
             MmIoBufferAppendPage(FlushBuffer,
                                  CacheEntry,
                                  NULL,
@@ -2092,25 +2320,24 @@ Return Value:
         //
 
         } else if (UseDirtyPageList != FALSE) {
-            Node = NULL;
+            Cursor = NULL;
 
         //
-        // If the node was ripped out of the tree while the lock was dropped
-        // during the flush, search for the next closest node. Make sure not to
-        // get the next node on the next loop, or else this one would be
+        // If the entry was ripped out of the index while the lock was dropped
+        // during the flush, search for the next closest entry. Make sure not
+        // to get the next entry on the next loop, or else this one would be
         // skipped.
         //
 
-        } else if (Node->Parent == NULL) {
+        } else if ((Cursor->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0) {
             if (CacheEntry == NULL) {
-                CacheEntry = RED_BLACK_TREE_VALUE(Node, PAGE_CACHE_ENTRY, Node);
+                CacheEntry = Cursor;
             }
 
-            ASSERT(&(CacheEntry->Node) == Node);
+            ASSERT(CacheEntry == Cursor);
 
-            Node = RtlRedBlackTreeSearchClosest(&(FileObject->PageCacheTree),
-                                                &(CacheEntry->Node),
-                                                TRUE);
+            Cursor = IopFindPageCacheIndex(&(FileObject->PageCacheIndex),
+                                           Cursor->Offset >> PageShift);
 
             GetNextNode = FALSE;
         }
@@ -2275,11 +2502,11 @@ Return Value:
     PPAGE_CACHE_ENTRY CacheEntry;
     BOOL Destroyed;
     LIST_ENTRY DestroyListHead;
-    PRED_BLACK_TREE_NODE Node;
-    PAGE_CACHE_ENTRY SearchEntry;
+    PPAGE_CACHE_ENTRY NextEntry;
+    ULONG PageShift;
 
     //
-    // The tree is being modified, so the file object lock must be held
+    // The index is being modified, so the file object lock must be held
     // exclusively.
     //
 
@@ -2304,33 +2531,38 @@ Return Value:
     // Quickly exit if there is nothing to evict.
     //
 
-    if (RED_BLACK_TREE_EMPTY(&(FileObject->PageCacheTree)) != FALSE) {
+    if (FileObject->PageCacheIndex.EntryCount == 0) {
         return;
     }
 
     //
-    // Iterate over the file object's tree of page cache entries.
+    // New entries still waiting in a batch hold references that would keep
+    // them from being destroyed right away. Put them on the clean list first.
+    //
+
+    IopDrainPageCacheListBatches();
+
+    //
+    // Iterate over the file object's index of page cache entries.
     //
 
     INITIALIZE_LIST_HEAD(&DestroyListHead);
 
     //
-    // Find the page cache entry in the file object's tree that is closest (but
-    // greater than or equal) to the given eviction offset.
+    // Find the page cache entry in the file object's index that is closest
+    // (but greater than or equal) to the given eviction offset.
     //
 
-    SearchEntry.FileObject = FileObject;
-    SearchEntry.Offset = Offset;
-    SearchEntry.Flags = 0;
-    Node = RtlRedBlackTreeSearchClosest(&(FileObject->PageCacheTree),
-                                        &(SearchEntry.Node),
-                                        TRUE);
+    PageShift = MmPageShift();
+    NextEntry = IopFindPageCacheIndex(
+                        &(FileObject->PageCacheIndex),
+                        (Offset + MmPageSize() - 1) >> PageShift);
 
-    while (Node != NULL) {
-        CacheEntry = LIST_VALUE(Node, PAGE_CACHE_ENTRY, Node);
-        Node = RtlRedBlackTreeGetNextNode(&(FileObject->PageCacheTree),
-                                          FALSE,
-                                          Node);
+    while (NextEntry != NULL) {
+        CacheEntry = NextEntry;
+        NextEntry = IopFindPageCacheIndex(
+                            &(FileObject->PageCacheIndex),
+                            (CacheEntry->Offset >> PageShift) + 1);
 
         //
         // Assert this is a cache entry after the eviction offset.
@@ -2339,11 +2571,11 @@ Return Value:
         ASSERT(CacheEntry->Offset >= Offset);
 
         //
-        // Remove the node from the page cache tree. It should not be found on
+        // Remove the entry from the page cache index. It should not be found on
         // look-up again.
         //
 
-        ASSERT(CacheEntry->Node.Parent != NULL);
+        ASSERT((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0);
 
         IopRemovePageCacheEntryFromTree(CacheEntry);
 
@@ -2407,6 +2639,124 @@ Return Value:
     return;
 }
 
+VOID
+IopRefreshPageCacheEntries (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset,
+    PIO_BUFFER SourceBuffer,
+    UINTN SizeInBytes
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies data that was just written around the page cache into
+    any page cache entries already resident over that range, so that cached
+    readers and shared mappings of the file see it. Entries are not created,
+    and the dirty state of the refreshed entries is left alone. The file
+    object lock must be held exclusively.
+
+Arguments:
+
+    FileObject - Supplies a pointer to a file object for the device or file.
+
+    Offset - Supplies the file or device offset where the write began.
+
+    SourceBuffer - Supplies a pointer to the I/O buffer that was written.
+
+    SizeInBytes - Supplies the number of bytes that were written.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG ByteCount;
+    PPAGE_CACHE_ENTRY CacheEntry;
+    IO_OFFSET EndOffset;
+    IO_OFFSET EntryOffset;
+    IO_BUFFER PageCacheBuffer;
+    ULONG PageOffset;
+    ULONG PageSize;
+    UINTN SourceOffset;
+    KSTATUS Status;
+
+    ASSERT(KeIsSharedExclusiveLockHeldExclusive(FileObject->Lock) != FALSE);
+
+    if ((IO_IS_FILE_OBJECT_CACHEABLE(FileObject) == FALSE) ||
+        (FileObject->PageCacheIndex.EntryCount == 0)) {
+
+        return;
+    }
+
+    PageSize = MmPageSize();
+    EndOffset = Offset + SizeInBytes;
+    EntryOffset = ALIGN_RANGE_DOWN(Offset, PageSize);
+    while (EntryOffset < EndOffset) {
+        CacheEntry = IopLookupPageCacheEntryHelper(FileObject, EntryOffset);
+        if (CacheEntry == NULL) {
+            EntryOffset += PageSize;
+            continue;
+        }
+
+        //
+        // Work out which part of this page the write covered.
+        //
+
+        PageOffset = 0;
+        SourceOffset = EntryOffset - Offset;
+        if (EntryOffset < Offset) {
+            PageOffset = Offset - EntryOffset;
+            SourceOffset = 0;
+        }
+
+        ByteCount = PageSize - PageOffset;
+        if (ByteCount > SizeInBytes - SourceOffset) {
+            ByteCount = SizeInBytes - SourceOffset;
+        }
+
+        Status = MmInitializeIoBuffer(&PageCacheBuffer,
+                                      NULL,
+                                      INVALID_PHYSICAL_ADDRESS,
+                                      0,
+                                      IO_BUFFER_FLAG_KERNEL_MODE_DATA);
+
+        if (KSUCCESS(Status)) {
+            MmIoBufferAppendPage(&PageCacheBuffer,
+                                 CacheEntry,
+                                 NULL,
+                                 INVALID_PHYSICAL_ADDRESS);
+
+            Status = MmCopyIoBuffer(&PageCacheBuffer,
+                                    PageOffset,
+                                    SourceBuffer,
+                                    SourceOffset,
+                                    ByteCount);
+
+            MmFreeIoBuffer(&PageCacheBuffer);
+        }
+
+        //
+        // The cached copy cannot be trusted if it could not be updated. Unmap
+        // and evict everything from here on.
+        //
+
+        IoPageCacheEntryReleaseReference(CacheEntry);
+        if (!KSUCCESS(Status)) {
+            IopEvictFileObject(FileObject, EntryOffset, 0);
+            break;
+        }
+
+        EntryOffset += PageSize;
+    }
+
+    return;
+}
+
 BOOL
 IopIsIoBufferPageCacheBacked (
     PFILE_OBJECT FileObject,
@@ -2591,6 +2941,7 @@ Return Value:
 
     BOOL MarkedClean;
     ULONG OldFlags;
+    PDEVICE_WRITEBACK Writeback;
 
     //
     // The file object lock must be held to synchronize with marking the cache
@@ -2621,6 +2972,11 @@ Return Value:
             ASSERT((OldFlags & PAGE_CACHE_ENTRY_FLAG_OWNER) != 0);
 
             RtlAtomicAdd(&IoPageCacheDirtyPageCount, (UINTN)-1);
+            Writeback = Entry->FileObject->Writeback;
+            if (Writeback != NULL) {
+                RtlAtomicAdd(&(Writeback->DirtyPageCount), (UINTN)-1);
+            }
+
             if ((OldFlags & PAGE_CACHE_ENTRY_FLAG_MAPPED) != 0) {
                 RtlAtomicAdd(&IoPageCacheMappedDirtyPageCount, (UINTN)-1);
             }
@@ -2758,6 +3114,10 @@ Return Value:
                (Entry->VirtualAddress == NULL));
 
         RtlAtomicAdd(&IoPageCacheDirtyPageCount, 1);
+        if (FileObject->Writeback != NULL) {
+            RtlAtomicAdd(&(FileObject->Writeback->DirtyPageCount), 1);
+        }
+
         if ((OldFlags & PAGE_CACHE_ENTRY_FLAG_MAPPED) != 0) {
             RtlAtomicAdd(&IoPageCacheMappedDirtyPageCount, 1);
         }
@@ -3220,6 +3580,7 @@ Return Value:
     // reached.
     //
 
+    IopDrainPageCacheListBatches();
     INITIALIZE_LIST_HEAD(&DestroyListHead);
     if (!LIST_EMPTY(&IoPageCacheCleanUnmappedList)) {
         IopRemovePageCacheEntriesFromList(&IoPageCacheCleanUnmappedList,
@@ -3235,6 +3596,19 @@ Return Value:
                                           &TargetRemoveCount);
     }
 
+    //
+    // The first pass cleared the referenced flag of every entry it skipped.
+    // If that was everything, go around once more to evict the entries that
+    // have not been touched since.
+    //
+
+    if (TargetRemoveCount != 0) {
+        IopRemovePageCacheEntriesFromList(&IoPageCacheCleanList,
+                                          &DestroyListHead,
+                                          TimidEffort,
+                                          &TargetRemoveCount);
+    }
+
     //
     // Destroy the evicted page cache entries. This will reduce the page
     // cache's physical page count for any page that it ends up releasing.
@@ -3305,89 +3679,65 @@ Return Value:
 
 {
 
-    UINTN DirtyPages;
-    UINTN FreePages;
-    UINTN IdealSize;
-    UINTN MaxDirty;
-
-    DirtyPages = IoPageCacheDirtyPageCount;
-    if (DirtyPages >= IoPageCacheMaxDirtyPages) {
-        return TRUE;
-    }
-
-    //
-    // Determine the ideal page cache size.
-    //
-
-    FreePages = MmGetTotalFreePhysicalPages();
-    if (FreePages < IoPageCacheHeadroomPagesRetreat) {
-        IdealSize = IoPageCachePhysicalPageCount -
-                    (IoPageCacheHeadroomPagesRetreat - FreePages);
-
-    } else {
-        IdealSize = IoPageCachePhysicalPageCount +
-                    (FreePages - IoPageCacheHeadroomPagesRetreat);
-    }
-
-    //
-    // Only a portion of that ideal size should be dirty.
-    //
-
-    MaxDirty = IdealSize >> PAGE_CACHE_MAX_DIRTY_SHIFT;
-    if (DirtyPages >= MaxDirty) {
+    if (IoPageCacheDirtyPageCount >= IopGetPageCacheDirtyLimit()) {
         return TRUE;
     }
 
     return FALSE;
 }
 
-COMPARISON_RESULT
-IopComparePageCacheEntries (
-    PRED_BLACK_TREE Tree,
-    PRED_BLACK_TREE_NODE FirstNode,
-    PRED_BLACK_TREE_NODE SecondNode
+UINTN
+IopGetPageCacheDirtyLimit (
+    VOID
     )
 
 /*++
 
 Routine Description:
 
-    This routine compares two Red-Black tree nodes contained inside file
-    objects.
+    This routine determines the number of dirty pages the page cache can hold
+    given the current memory situation.
 
 Arguments:
 
-    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
-
-    FirstNode - Supplies a pointer to the left side of the comparison.
-
-    SecondNode - Supplies a pointer to the second side of the comparison.
+    None.
 
 Return Value:
 
-    Same if the two nodes have the same value.
-
-    Ascending if the first node is less than the second node.
-
-    Descending if the second node is less than the first node.
+    Returns the maximum number of dirty pages, across all devices.
 
 --*/
 
 {
 
-    PPAGE_CACHE_ENTRY FirstEntry;
-    PPAGE_CACHE_ENTRY SecondEntry;
+    UINTN FreePages;
+    UINTN IdealSize;
+    UINTN MaxDirty;
+
+    //
+    // Determine the ideal page cache size.
+    //
+
+    FreePages = MmGetTotalFreePhysicalPages();
+    if (FreePages < IoPageCacheHeadroomPagesRetreat) {
+        IdealSize = IoPageCachePhysicalPageCount -
+                    (IoPageCacheHeadroomPagesRetreat - FreePages);
+
+    } else {
+        IdealSize = IoPageCachePhysicalPageCount +
+                    (FreePages - IoPageCacheHeadroomPagesRetreat);
+    }
 
-    FirstEntry = RED_BLACK_TREE_VALUE(FirstNode, PAGE_CACHE_ENTRY, Node);
-    SecondEntry = RED_BLACK_TREE_VALUE(SecondNode, PAGE_CACHE_ENTRY, Node);
-    if (FirstEntry->Offset < SecondEntry->Offset) {
-        return ComparisonResultAscending;
+    //
+    // Only a portion of that ideal size should be dirty.
+    //
 
-    } else if (FirstEntry->Offset > SecondEntry->Offset) {
-        return ComparisonResultDescending;
+    MaxDirty = IdealSize >> PAGE_CACHE_MAX_DIRTY_SHIFT;
+    if (MaxDirty > IoPageCacheMaxDirtyPages) {
+        MaxDirty = IoPageCacheMaxDirtyPages;
     }
 
-    return ComparisonResultSame;
+    return MaxDirty;
 }
 
 //
@@ -3497,6 +3847,15 @@ Return Value:
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
+    //
+    // Lockless lookups may still be looking at entries that were just taken
+    // out of their index. Wait for them before freeing anything.
+    //
+
+    if (LIST_EMPTY(ListHead) == FALSE) {
+        IopSynchronizePageCacheLookups();
+    }
+
     RemovedCount = 0;
     while (LIST_EMPTY(ListHead) == FALSE) {
         CurrentEntry = ListHead->Next;
@@ -3505,7 +3864,7 @@ Return Value:
         CurrentEntry->Next = NULL;
 
         ASSERT(CacheEntry->ReferenceCount == 0);
-        ASSERT(CacheEntry->Node.Parent == NULL);
+        ASSERT((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0);
 
         if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_EVICTION) != 0) {
             RtlDebugPrint("PAGE CACHE: Destroy entry 0x%08x: file object "
@@ -3572,7 +3931,7 @@ Return Value:
     ASSERT((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_WAS_DIRTY) == 0);
     ASSERT(Entry->ListEntry.Next == NULL);
     ASSERT(Entry->ReferenceCount == 0);
-    ASSERT(Entry->Node.Parent == NULL);
+    ASSERT((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0);
 
     //
     // If this is the page owner, then free the physical page.
@@ -3629,7 +3988,7 @@ Return Value:
     return;
 }
 
-VOID
+KSTATUS
 IopInsertPageCacheEntry (
     PPAGE_CACHE_ENTRY NewEntry,
     PPAGE_CACHE_ENTRY LinkEntry
@@ -3641,8 +4000,8 @@ Routine Description:
 
     This routine inserts the new page cache entry into the page cache and links
     it to the link entry once it is inserted. This routine assumes that the
-    page cache tree lock is held exclusively and that there is not already an
-    entry for the same file and offset in the tree.
+    file object lock is held exclusively and that there is not already an
+    entry for the same file and offset in the index.
 
 Arguments:
 
@@ -3654,26 +4013,37 @@ Routine Description:
 
 Return Value:
 
-    None.
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if the index could not grow to hold the
+    entry. Nothing is changed in that case.
 
 --*/
 
 {
 
     ULONG ClearFlags;
+    PPAGE_CACHE_INDEX Index;
+    ULONGLONG Key;
     IO_OBJECT_TYPE LinkType;
     IO_OBJECT_TYPE NewType;
     ULONG OldFlags;
+    KSTATUS Status;
     PVOID VirtualAddress;
 
     ASSERT(KeIsSharedExclusiveLockHeldExclusive(NewEntry->FileObject->Lock));
 
     //
-    // Insert the new entry into its file object's tree.
+    // Make room in the file object's index first, as that is the only thing
+    // that can fail.
     //
 
-    RtlRedBlackTreeInsert(&(NewEntry->FileObject->PageCacheTree),
-                          &(NewEntry->Node));
+    Index = &(NewEntry->FileObject->PageCacheIndex);
+    Key = NewEntry->Offset >> MmPageShift();
+    Status = IopPreparePageCacheIndexSlot(Index, Key);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
 
     //
     // Now link the new entry to the supplied link entry based on their I/O
@@ -3763,6 +4133,64 @@ Return Value:
                                               NewEntry);
     }
 
+    //
+    // Publish the entry in the index last, once it is completely set up, as
+    // lookups may find it without the file object lock.
+    //
+
+    RtlAtomicOr32(&(NewEntry->Flags), PAGE_CACHE_ENTRY_FLAG_INDEXED);
+    IopSetPageCacheIndexSlot(Index, Key, NewEntry);
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopSynchronizePageCacheLookups (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits until every lockless page cache lookup that started
+    before this call has finished.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Pass;
+    ULONG Phase;
+    ULONG SlotIndex;
+
+    //
+    // As with handle tables, a lookup may count itself in the old phase just
+    // after it drains, so switch and drain twice.
+    //
+
+    for (Pass = 0; Pass < PAGE_CACHE_LOOKUP_PHASES; Pass += 1) {
+        Phase = IoPageCacheLookupPhase % PAGE_CACHE_LOOKUP_PHASES;
+        RtlAtomicExchange32(&IoPageCacheLookupPhase,
+                            (Phase + 1) % PAGE_CACHE_LOOKUP_PHASES);
+
+        for (SlotIndex = 0;
+             SlotIndex < PAGE_CACHE_LOOKUP_SLOT_COUNT;
+             SlotIndex += 1) {
+
+            while (IoPageCacheLookupSlots[SlotIndex].Lookups[Phase] != 0) {
+                KeYield();
+            }
+        }
+    }
+
     return;
 }
 
@@ -3777,8 +4205,8 @@ IopLookupPageCacheEntryHelper (
 Routine Description:
 
     This routine searches for a page cache entry based on the file object and
-    offset. This routine assumes the page cache lock is held. If found, this
-    routine takes a reference on the page cache entry.
+    offset. This routine assumes the file object lock is held. If found,
+    this routine takes a reference on the page cache entry.
 
 Arguments:
 
@@ -3796,20 +4224,14 @@ Return Value:
 {
 
     PPAGE_CACHE_ENTRY FoundEntry;
-    PRED_BLACK_TREE_NODE FoundNode;
-    PAGE_CACHE_ENTRY SearchEntry;
 
-    SearchEntry.FileObject = FileObject;
-    SearchEntry.Offset = Offset;
-    SearchEntry.Flags = 0;
-    FoundNode = RtlRedBlackTreeSearch(&(FileObject->PageCacheTree),
-                                      &(SearchEntry.Node));
+    FoundEntry = IopLookupPageCacheIndex(&(FileObject->PageCacheIndex),
+                                         Offset >> MmPageShift());
 
-    if (FoundNode == NULL) {
+    if (FoundEntry == NULL) {
         return NULL;
     }
 
-    FoundEntry = RED_BLACK_TREE_VALUE(FoundNode, PAGE_CACHE_ENTRY, Node);
     IoPageCacheEntryAddReference(FoundEntry);
     return FoundEntry;
 }
@@ -3920,10 +4342,14 @@ Return Value:
             IopTrimPageCache(FALSE);
 
             //
-            // Flush some dirty file objects.
+            // Kick the per-device writeback threads, and flush the dirty file
+            // objects that are not backed by a device directly.
             //
 
-            Status = IopFlushFileObjects(0, IO_FLAG_HARD_FLUSH_ALLOWED, NULL);
+            IopScheduleWriteback(NULL);
+            Status = IopFlushWritebackFileObjects(NULL,
+                                                  IO_FLAG_HARD_FLUSH_ALLOWED);
+
             if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_DIRTY_LISTS) != 0) {
                 IopCheckDirtyFileObjectsList();
             }
@@ -3942,7 +4368,7 @@ Return Value:
 
             KeCancelTimer(IoPageCacheWorkTimer);
             RtlAtomicExchange32(&IoPageCacheState, PageCacheStateClean);
-            if ((!LIST_EMPTY(&IoFileObjectsDirtyList)) ||
+            if ((IopAreFileObjectsDirty() != FALSE) ||
                 (IoPageCacheDirtyPageCount != 0)) {
 
                 IopSchedulePageCacheThread();
@@ -3999,6 +4425,7 @@ Return Value:
     BOOL MarkedClean;
     ULONG OldFlags;
     ULONG PageSize;
+    ULONGLONG StartTime;
     KSTATUS Status;
 
     CacheEntry = MmGetIoBufferPageCacheEntry(FlushBuffer, 0);
@@ -4033,7 +4460,7 @@ Return Value:
         // Evicted entries should never be in a flush buffer.
         //
 
-        ASSERT(CacheEntry->Node.Parent != NULL);
+        ASSERT((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0);
 
         MarkedClean = IopMarkPageCacheEntryClean(CacheEntry, TRUE);
         if (MarkedClean != FALSE) {
@@ -4109,7 +4536,21 @@ Return Value:
     IoContext.Flags = Flags;
     IoContext.TimeoutInMilliseconds = WAIT_TIME_INDEFINITE;
     IoContext.Write = TRUE;
+    StartTime = HlQueryTimeCounter();
     Status = IopPerformNonCachedWrite(FileObject, &IoContext, NULL);
+
+    //
+    // Let the device's writeback state know how long the write took, to feed
+    // its bandwidth estimate and wake any writers waiting on it.
+    //
+
+    if ((FileObject->Writeback != NULL) && (KSUCCESS(Status))) {
+        IopCompleteWriteback(FileObject->Writeback,
+                             FileObject,
+                             IoContext.BytesCompleted,
+                             HlQueryTimeCounter() - StartTime);
+    }
+
     if (FileObject->Properties.Type == IoObjectBlockDevice) {
         KeAcquireSharedExclusiveLockShared(FileObject->Lock);
     }
@@ -4285,6 +4726,8 @@ Return Value:
     PPAGE_CACHE_ENTRY CacheEntry;
     PFILE_OBJECT FileObject;
     ULONG Flags;
+    ULONG Index;
+    ULONG Key;
     LIST_ENTRY LocalList;
     PSHARED_EXCLUSIVE_LOCK Lock;
     PLIST_ENTRY MoveList;
@@ -4317,7 +4760,7 @@ Return Value:
         // If the page cache entry has not been evicted, potentially skip it.
         //
 
-        if (CacheEntry->Node.Parent != NULL) {
+        if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0) {
 
             //
             // Remove anything with a reference to avoid iterating through it
@@ -4356,6 +4799,22 @@ Return Value:
                 CacheEntry->ListEntry.Next = NULL;
                 continue;
             }
+
+            //
+            // When trimming, entries that were referenced since the last pass
+            // get moved to the back of the clean list instead of evicted.
+            //
+
+            if ((TargetRemoveCount != NULL) &&
+                ((Flags & PAGE_CACHE_ENTRY_FLAG_REFERENCED) != 0)) {
+
+                RtlAtomicAnd32(&(CacheEntry->Flags),
+                               ~PAGE_CACHE_ENTRY_FLAG_REFERENCED);
+
+                LIST_REMOVE(&(CacheEntry->ListEntry));
+                INSERT_BEFORE(&(CacheEntry->ListEntry), &IoPageCacheCleanList);
+                continue;
+            }
         }
 
         //
@@ -4369,7 +4828,7 @@ Return Value:
         if (TimidEffort != FALSE) {
             if (KeTryToAcquireSharedExclusiveLockExclusive(Lock) == FALSE) {
                 LIST_REMOVE(&(CacheEntry->ListEntry));
-                if (CacheEntry->Node.Parent != NULL) {
+                if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0) {
                     INSERT_BEFORE(&(CacheEntry->ListEntry),
                                   &IoPageCacheCleanList);
 
@@ -4406,7 +4865,7 @@ Return Value:
             // just mark it clean and grab the flags.
             //
 
-            if (CacheEntry->Node.Parent == NULL) {
+            if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0) {
                 IopMarkPageCacheEntryClean(CacheEntry, FALSE);
                 RtlAtomicAnd32(&(CacheEntry->Flags),
                                ~PAGE_CACHE_ENTRY_FLAG_WAS_DIRTY);
@@ -4461,6 +4920,12 @@ Return Value:
 
                 if (TargetRemoveCount != NULL) {
                     *TargetRemoveCount -= 1;
+                    Key = IopGetPageCacheShadowKey(FileObject,
+                                                   CacheEntry->Offset);
+
+                    Index = Key & (PAGE_CACHE_SHADOW_ENTRY_COUNT - 1);
+                    IoPageCacheShadowTable[Index] = Key;
+                    RtlAtomicAdd(&IoPageCacheEvictedPageCount, 1);
                 }
             }
         }
@@ -4490,7 +4955,7 @@ Return Value:
         // If the page cache has been evicted, move it to the removal list.
         //
 
-        } else if (CacheEntry->Node.Parent == NULL) {
+        } else if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0) {
             MoveList = &IoPageCacheRemovalList;
 
         //
@@ -4776,7 +5241,7 @@ Return Value:
         //
 
         MoveList = NULL;
-        if (CacheEntry->Node.Parent == NULL) {
+        if ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0) {
             MoveList = &IoPageCacheRemovalList;
 
         } else {
@@ -4893,7 +5358,7 @@ Return Value:
         CacheEntry = MmGetIoBufferPageCacheEntry(IoBuffer, BufferOffset);
         if ((CacheEntry == NULL) ||
             (CacheEntry->FileObject != FileObject) ||
-            (CacheEntry->Node.Parent == NULL) ||
+            ((CacheEntry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) == 0) ||
             (CacheEntry->Offset != Offset)) {
 
             return FALSE;
@@ -5101,8 +5566,8 @@ IopRemovePageCacheEntryFromTree (
 
 Routine Description:
 
-    This routine removes a page cache entry from the page cache tree. This
-    routine assumes that the page cache's tree lock is held exclusively.
+    This routine removes a page cache entry from its file object's index. This
+    routine assumes that the file object lock is held exclusively.
 
 Arguments:
 
@@ -5117,7 +5582,7 @@ Return Value:
 {
 
     ASSERT(KeIsSharedExclusiveLockHeldExclusive(Entry->FileObject->Lock));
-    ASSERT(Entry->Node.Parent != NULL);
+    ASSERT((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_INDEXED) != 0);
 
     //
     // If a backing entry exists, then MM needs to know that the backing entry
@@ -5129,8 +5594,11 @@ Return Value:
                                               Entry->BackingEntry);
     }
 
-    RtlRedBlackTreeRemove(&(Entry->FileObject->PageCacheTree), &(Entry->Node));
-    Entry->Node.Parent = NULL;
+    IopSetPageCacheIndexSlot(&(Entry->FileObject->PageCacheIndex),
+                             Entry->Offset >> MmPageShift(),
+                             NULL);
+
+    RtlAtomicAnd32(&(Entry->Flags), ~PAGE_CACHE_ENTRY_FLAG_INDEXED);
     if ((IoPageCacheDebugFlags & PAGE_CACHE_DEBUG_EVICTION) != 0) {
         RtlDebugPrint("PAGE CACHE: Remove PAGE_CACHE_ENTRY 0x%08x: FILE_OBJECT "
                       "0x%08x, offset 0x%I64x, physical address "
@@ -5158,7 +5626,8 @@ Routine Description:
 
     This routine updates a page cache entry's list entry by putting it on the
     appropriate list. This should be used when a page cache entry is looked up
-    or when it is created.
+    or when it is created. New entries are gathered in per-processor batches
+    and put on the clean list several at a time.
 
 Arguments:
 
@@ -5176,7 +5645,48 @@ Return Value:
 
 {
 
-    KeAcquireQueuedLock(IoPageCacheListLock);
+    PPAGE_CACHE_LIST_BATCH Batch;
+    ULONG Count;
+    PPAGE_CACHE_ENTRY Entries[PAGE_CACHE_LIST_BATCH_SIZE];
+    RUNLEVEL OldRunLevel;
+
+    //
+    // New pages do not start on a list. Add them to this processor's batch,
+    // which holds a reference on each until it goes onto the back of the
+    // clean list. Whoever fills the batch moves the whole thing.
+    //
+
+    if (Created != FALSE) {
+
+        ASSERT(Entry->ListEntry.Next == NULL);
+        ASSERT((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0);
+
+        IoPageCacheEntryAddReference(Entry);
+        Count = 0;
+        Batch = &(IoPageCacheListBatches[KeGetCurrentProcessorNumber() %
+                                         PAGE_CACHE_LIST_BATCH_COUNT]);
+
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Batch->Lock));
+        Batch->Entries[Batch->Count] = Entry;
+        Batch->Count += 1;
+        if (Batch->Count == PAGE_CACHE_LIST_BATCH_SIZE) {
+            Count = Batch->Count;
+            RtlCopyMemory(Entries,
+                          Batch->Entries,
+                          Count * sizeof(PPAGE_CACHE_ENTRY));
+
+            Batch->Count = 0;
+        }
+
+        KeReleaseSpinLock(&(Batch->Lock));
+        KeLowerRunLevel(OldRunLevel);
+        if (Count != 0) {
+            IopDrainPageCacheListBatch(Entries, Count);
+        }
+
+        return;
+    }
 
     //
     // If the page cache entry is not new, then it might already be on a
@@ -5185,36 +5695,136 @@ Return Value:
     // there are references on it.
     //
 
-    if (Created == FALSE) {
+    KeAcquireQueuedLock(IoPageCacheListLock);
 
-        //
-        // If it's dirty, it should always be on the dirty list.
-        //
+    //
+    // If it's dirty, it should always be on the dirty list.
+    //
 
-        ASSERT(((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0) ||
-               (Entry->ListEntry.Next != NULL));
+    ASSERT(((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0) ||
+           (Entry->ListEntry.Next != NULL));
 
-        if (((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0) &&
-            (Entry->ListEntry.Next != NULL)) {
+    if (((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0) &&
+        (Entry->ListEntry.Next != NULL)) {
 
-            LIST_REMOVE(&(Entry->ListEntry));
-            INSERT_BEFORE(&(Entry->ListEntry), &IoPageCacheCleanList);
+        LIST_REMOVE(&(Entry->ListEntry));
+        INSERT_BEFORE(&(Entry->ListEntry), &IoPageCacheCleanList);
+    }
+
+    KeReleaseQueuedLock(IoPageCacheListLock);
+    return;
+}
+
+VOID
+IopDrainPageCacheListBatches (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves every batched new page cache entry onto the clean list.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPAGE_CACHE_LIST_BATCH Batch;
+    ULONG BatchIndex;
+    ULONG Count;
+    PPAGE_CACHE_ENTRY Entries[PAGE_CACHE_LIST_BATCH_SIZE];
+    RUNLEVEL OldRunLevel;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    for (BatchIndex = 0;
+         BatchIndex < PAGE_CACHE_LIST_BATCH_COUNT;
+         BatchIndex += 1) {
+
+        Batch = &(IoPageCacheListBatches[BatchIndex]);
+        if (Batch->Count == 0) {
+            continue;
         }
 
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Batch->Lock));
+        Count = Batch->Count;
+        RtlCopyMemory(Entries,
+                      Batch->Entries,
+                      Count * sizeof(PPAGE_CACHE_ENTRY));
+
+        Batch->Count = 0;
+        KeReleaseSpinLock(&(Batch->Lock));
+        KeLowerRunLevel(OldRunLevel);
+        if (Count != 0) {
+            IopDrainPageCacheListBatch(Entries, Count);
+        }
+    }
+
+    return;
+}
+
+VOID
+IopDrainPageCacheListBatch (
+    PPAGE_CACHE_ENTRY *Entries,
+    ULONG Count
+    )
+
+/*++
+
+Routine Description:
+
+    This routine puts a batch of new page cache entries on the back of the
+    clean list and releases the references the batch held on them.
+
+Arguments:
+
+    Entries - Supplies an array of the batched page cache entries.
+
+    Count - Supplies the number of entries in the array.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPAGE_CACHE_ENTRY Entry;
+    ULONG Index;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
     //
-    // New pages do not start on a list. Stick it on the back of the clean
-    // list.
+    // An entry may have been dirtied, or evicted onto the removal list, while
+    // it waited. Leave those where they are.
     //
 
-    } else {
-
-        ASSERT(Entry->ListEntry.Next == NULL);
-        ASSERT((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0);
+    KeAcquireQueuedLock(IoPageCacheListLock);
+    for (Index = 0; Index < Count; Index += 1) {
+        Entry = Entries[Index];
+        if ((Entry->ListEntry.Next == NULL) &&
+            ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) == 0)) {
 
-        INSERT_BEFORE(&(Entry->ListEntry), &IoPageCacheCleanList);
+            INSERT_BEFORE(&(Entry->ListEntry), &IoPageCacheCleanList);
+        }
     }
 
     KeReleaseQueuedLock(IoPageCacheListLock);
+    for (Index = 0; Index < Count; Index += 1) {
+        IoPageCacheEntryReleaseReference(Entries[Index]);
+    }
+
     return;
 }
 
@@ -5360,7 +5970,7 @@ Return Value:
 
     PLIST_ENTRY CurrentEntry;
     PPAGE_CACHE_ENTRY Entry;
-    PRED_BLACK_TREE_NODE TreeNode;
+    ULONG PageShift;
 
     //
     // This routine produces a lot of false negatives for block devices because
@@ -5373,9 +5983,9 @@ Return Value:
 
     KeAcquireSharedExclusiveLockExclusive(FileObject->Lock);
     KeAcquireQueuedLock(IoPageCacheListLock);
-    TreeNode = RtlRedBlackTreeGetLowestNode(&(FileObject->PageCacheTree));
-    while (TreeNode != NULL) {
-        Entry = RED_BLACK_TREE_VALUE(TreeNode, PAGE_CACHE_ENTRY, Node);
+    PageShift = MmPageShift();
+    Entry = IopFindPageCacheIndex(&(FileObject->PageCacheIndex), 0);
+    while (Entry != NULL) {
         if ((Entry->Flags & PAGE_CACHE_ENTRY_FLAG_DIRTY_MASK) != 0) {
             if (Entry->ListEntry.Next == NULL) {
                 RtlDebugPrint("PAGE_CACHE_ENTRY 0x%x for FILE_OBJECT 0x%x "
@@ -5403,9 +6013,8 @@ Return Value:
             }
         }
 
-        TreeNode = RtlRedBlackTreeGetNextNode(&(FileObject->PageCacheTree),
-                                              FALSE,
-                                              TreeNode);
+        Entry = IopFindPageCacheIndex(&(FileObject->PageCacheIndex),
+                                      (Entry->Offset >> PageShift) + 1);
     }
 
     KeReleaseQueuedLock(IoPageCacheListLock);
@@ -5413,3 +6022,44 @@ Return Value:
     return;
 }
 
+
+ULONG
+IopGetPageCacheShadowKey (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine computes the key used to remember an evicted page in the
+    shadow table. The low bits of the key select the table slot.
+
+Arguments:
+
+    FileObject - Supplies a pointer to the file object the page belongs to.
+
+    Offset - Supplies the offset of the page within the file object.
+
+Return Value:
+
+    Returns a non-zero key for the page.
+
+--*/
+
+{
+
+    ULONG Key;
+
+    Key = (ULONG)((UINTN)FileObject >> 4) +
+          (ULONG)(Offset >> MmPageShift());
+
+    Key *= 0x9E3779B1;
+    Key ^= Key >> 16;
+    if (Key == 0) {
+        Key = 1;
+    }
+
+    return Key;
+}
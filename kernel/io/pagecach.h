@@ -37,19 +37,94 @@ Module Name:
 
 #define PAGE_CACHE_DIRTY_PENANCE_PAGES 128
 
+//
+// Set this flag to tell a device's writeback thread to exit.
+//
+
+#define DEVICE_WRITEBACK_FLAG_EXITING 0x00000001
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines the writeback state for a device that backs cached
+    data. Each such device gets its own thread to flush its dirty data, so
+    that a slow device does not hold up writeback to the others.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous writeback states in
+        the global list.
+
+    Device - Stores a pointer to the device, which owns this structure.
+
+    Lock - Stores a pointer to a queued lock that protects the bandwidth
+        sample.
+
+    DirtyList - Stores the head of the list of dirty file objects backed by
+        this device.
+
+    DirtyListLock - Stores a pointer to the queued lock that protects the
+        dirty list. It is acquired after the global writeback list lock.
+
+    WorkEvent - Stores a pointer to the event signaled to ask the writeback
+        thread to flush the device's dirty file objects.
+
+    ProgressEvent - Stores a pointer to the event pulsed whenever a write to
+        the device completes. Throttled writers wait on it.
+
+    DirtyPageCount - Stores the number of dirty page cache pages whose file
+        objects are backed by this device.
+
+    Bandwidth - Stores the estimated write bandwidth of the device, in bytes
+        per second.
+
+    SampleBytes - Stores the number of bytes written in the bandwidth sample
+        being gathered.
+
+    SampleTime - Stores the number of time counter ticks spent writing in the
+        bandwidth sample being gathered.
+
+    Flags - Stores a bitmask of flags. See DEVICE_WRITEBACK_FLAG_* for
+        definitions.
+
+--*/
+
+struct _DEVICE_WRITEBACK {
+    LIST_ENTRY ListEntry;
+    PDEVICE Device;
+    PQUEUED_LOCK Lock;
+    LIST_ENTRY DirtyList;
+    PQUEUED_LOCK DirtyListLock;
+    PKEVENT WorkEvent;
+    PKEVENT ProgressEvent;
+    volatile UINTN DirtyPageCount;
+    volatile UINTN Bandwidth;
+    ULONGLONG SampleBytes;
+    ULONGLONG SampleTime;
+    volatile ULONG Flags;
+};
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 //
-// Store the global list of dirty file objects.
+// Store the list of device writeback states, and the lock that protects it.
 //
 
-extern LIST_ENTRY IoFileObjectsDirtyList;
+extern LIST_ENTRY IoWritebackList;
+extern PQUEUED_LOCK IoWritebackListLock;
+
+//
+// Stores the number of pages in the cache that are dirty.
+//
+
+extern volatile UINTN IoPageCacheDirtyPageCount;
 
 //
 // -------------------------------------------------------- Function Prototypes
@@ -309,6 +384,40 @@ Return Value:
 
 --*/
 
+VOID
+IopRefreshPageCacheEntries (
+    PFILE_OBJECT FileObject,
+    IO_OFFSET Offset,
+    PIO_BUFFER SourceBuffer,
+    UINTN SizeInBytes
+    );
+
+/*++
+
+Routine Description:
+
+    This routine copies data that was just written around the page cache into
+    any page cache entries already resident over that range, so that cached
+    readers and shared mappings of the file see it. Entries are not created,
+    and the dirty state of the refreshed entries is left alone. The file
+    object lock must be held exclusively.
+
+Arguments:
+
+    FileObject - Supplies a pointer to a file object for the device or file.
+
+    Offset - Supplies the file or device offset where the write began.
+
+    SourceBuffer - Supplies a pointer to the I/O buffer that was written.
+
+    SizeInBytes - Supplies the number of bytes that were written.
+
+Return Value:
+
+    None.
+
+--*/
+
 BOOL
 IopIsIoBufferPageCacheBacked (
     PFILE_OBJECT FileObject,
@@ -583,35 +692,331 @@ Return Value:
 
 --*/
 
-COMPARISON_RESULT
-IopComparePageCacheEntries (
-    PRED_BLACK_TREE Tree,
-    PRED_BLACK_TREE_NODE FirstNode,
-    PRED_BLACK_TREE_NODE SecondNode
+UINTN
+IopGetPageCacheDirtyLimit (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines the number of dirty pages the page cache can hold
+    given the current memory situation.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the maximum number of dirty pages, across all devices.
+
+--*/
+
+VOID
+IopInitializePageCacheIndex (
+    PPAGE_CACHE_INDEX Index
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes an empty page cache index.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to initialize.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+IopDestroyPageCacheIndex (
+    PPAGE_CACHE_INDEX Index
+    );
+
+/*++
+
+Routine Description:
+
+    This routine frees the nodes of an empty page cache index. Nothing may
+    still be looking up entries in it.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to tear down.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+IopPreparePageCacheIndexSlot (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    );
+
+/*++
+
+Routine Description:
+
+    This routine makes sure the nodes needed to hold the given key exist, so
+    that setting the slot afterwards cannot fail. The file object lock must be
+    held exclusively.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number about to be inserted.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if a node could not be allocated.
+
+--*/
+
+VOID
+IopSetPageCacheIndexSlot (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PVOID Value
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets or clears the slot for the given key. The slot must have
+    been prepared if a value is being set. The file object lock must be held
+    exclusively.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number of the slot.
+
+    Value - Supplies the page cache entry to store, which must be completely
+        initialized, or NULL to clear the slot.
+
+Return Value:
+
+    None.
+
+--*/
+
+PVOID
+IopLookupPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds the value stored for the given key. It takes no locks.
+    Without the file object lock, the result may be stale by the time it is
+    returned.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number to look up.
+
+Return Value:
+
+    Returns the stored page cache entry, or NULL if there is none.
+
+--*/
+
+PVOID
+IopFindPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    );
+
+/*++
+
+Routine Description:
+
+    This routine finds the value with the lowest key greater than or equal to
+    the given key. The file object lock must be held for the result to be
+    stable.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number to start searching from.
+
+Return Value:
+
+    Returns the first page cache entry at or after the given key, or NULL if
+    there is none.
+
+--*/
+
+KSTATUS
+IopInitializeWriteback (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes support for per-device writeback.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+PDEVICE_WRITEBACK
+IopGetDeviceWriteback (
+    PDEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine returns the writeback state for the device backing the given
+    device or volume, creating it and its thread if needed.
+
+Arguments:
+
+    Device - Supplies a pointer to the device, volume, or object directory
+        that owns a file object.
+
+Return Value:
+
+    Returns a pointer to the writeback state.
+
+    NULL if the device has no backing device, or the state could not be
+    created. Dirty data is then flushed by the page cache thread.
+
+--*/
+
+VOID
+IopDestroyDeviceWriteback (
+    PDEVICE Device
+    );
+
+/*++
+
+Routine Description:
+
+    This routine tears down a device's writeback state and tells its thread
+    to exit. No file objects may still refer to it.
+
+Arguments:
+
+    Device - Supplies a pointer to the device being destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+IopScheduleWriteback (
+    PDEVICE_WRITEBACK Writeback
+    );
+
+/*++
+
+Routine Description:
+
+    This routine asks a device's writeback thread to flush the device's dirty
+    file objects.
+
+Arguments:
+
+    Writeback - Supplies an optional pointer to the writeback state to kick.
+        Supply NULL to kick the writeback thread of every device with dirty
+        file objects.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+IopCompleteWriteback (
+    PDEVICE_WRITEBACK Writeback,
+    PFILE_OBJECT FileObject,
+    UINTN BytesWritten,
+    ULONGLONG Ticks
     );
 
 /*++
 
 Routine Description:
 
-    This routine compares two Red-Black tree nodes contained inside file
-    objects.
+    This routine records that a flush to a device completed. Writes to the
+    block device itself feed the bandwidth estimate, and any throttled writers
+    are woken to re-check their limit.
 
 Arguments:
 
-    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+    Writeback - Supplies a pointer to the device's writeback state.
+
+    FileObject - Supplies a pointer to the file object that was written.
 
-    FirstNode - Supplies a pointer to the left side of the comparison.
+    BytesWritten - Supplies the number of bytes written.
 
-    SecondNode - Supplies a pointer to the second side of the comparison.
+    Ticks - Supplies the number of time counter ticks the write took.
 
 Return Value:
 
-    Same if the two nodes have the same value.
+    None.
 
-    Ascending if the first node is less than the second node.
+--*/
 
-    Descending if the second node is less than the first node.
+VOID
+IopThrottleDirtyWriter (
+    PDEVICE_WRITEBACK Writeback,
+    UINTN SizeInBytes
+    );
+
+/*++
+
+Routine Description:
+
+    This routine makes a thread about to dirty cached data wait if the device
+    backing the data has more than its share of the dirty pages. The share is
+    proportional to the device's estimated bandwidth among the devices with
+    dirty data. No file object locks may be held.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the writeback state of the device.
+
+    SizeInBytes - Supplies the number of bytes about to be written.
+
+Return Value:
+
+    None.
 
 --*/
 
@@ -58,10 +58,39 @@ Module Name:
 
 #define PATH_UNREACHABLE_PATH_PREFIX "(unreachable)/"
 
+//
+// Define the bounds on the number of buckets in the path entry hash table,
+// and how many path entries the table aims to put in each bucket when the
+// cache is at its maximum size.
+//
+
+#define PATH_ENTRY_HASH_MIN_BUCKETS 256
+#define PATH_ENTRY_HASH_MAX_BUCKETS 16384
+#define PATH_ENTRY_HASH_BUCKET_DEPTH 16
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines a bucket in the path entry hash table.
+
+Members:
+
+    ListHead - Stores the head of the list of path entries in this bucket.
+
+    Lock - Stores a pointer to the lock protecting the bucket's list.
+
+--*/
+
+typedef struct _PATH_ENTRY_HASH_BUCKET {
+    LIST_ENTRY ListHead;
+    PSHARED_EXCLUSIVE_LOCK Lock;
+} PATH_ENTRY_HASH_BUCKET, *PPATH_ENTRY_HASH_BUCKET;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -114,9 +143,21 @@ IopFindPathPoint (
     PCSTR Name,
     ULONG NameSize,
     ULONG Hash,
+    BOOL ParentLockHeld,
     PPATH_POINT Result
     );
 
+PPATH_ENTRY_HASH_BUCKET
+IopGetPathEntryHashBucket (
+    PPATH_ENTRY Parent,
+    ULONG Hash
+    );
+
+KSTATUS
+IopInitializePathEntryHashTable (
+    VOID
+    );
+
 VOID
 IopPathEntryReleaseReference (
     PPATH_ENTRY Entry,
@@ -159,6 +200,14 @@ LIST_ENTRY IoPathEntryList;
 UINTN IoPathEntryListSize;
 UINTN IoPathEntryListMaxSize;
 
+//
+// Store the hash table of linked path entries, keyed by the parent path entry
+// and the hash of the name. The bucket count is always a power of two.
+//
+
+PPATH_ENTRY_HASH_BUCKET IoPathEntryHashTable;
+ULONG IoPathEntryHashBucketCount;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -473,6 +522,11 @@ Return Value:
                                PATH_ENTRY_CACHE_MAX_MEMORY_PERCENT) / 100) /
                              sizeof(PATH_ENTRY);
 
+    Status = IopInitializePathEntryHashTable();
+    if (!KSUCCESS(Status)) {
+        goto InitializePathSupportEnd;
+    }
+
     RootObject = ObGetRootObject();
     IopFillOutFilePropertiesForObject(&Properties, RootObject);
     Status = IopCreateOrLookupFileObject(&Properties,
@@ -1024,6 +1078,53 @@ Return Value:
     return FALSE;
 }
 
+VOID
+IopPathLink (
+    PPATH_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine links the given path entry into its parent's list of children
+    and into the path entry hash table. This assumes the caller holds the
+    parent path entry's file object lock exclusively.
+
+Arguments:
+
+    Entry - Supplies a pointer to the path entry that is to be linked into
+        the path hierarchy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPATH_ENTRY_HASH_BUCKET Bucket;
+    PPATH_ENTRY Parent;
+
+    Parent = Entry->Parent;
+
+    ASSERT(Parent != NULL);
+    ASSERT(KeIsSharedExclusiveLockHeldExclusive(Parent->FileObject->Lock));
+    ASSERT((Entry->SiblingListEntry.Next == NULL) &&
+           (Entry->HashListEntry.Next == NULL));
+
+    INSERT_BEFORE(&(Entry->SiblingListEntry), &(Parent->ChildList));
+    if (Entry->Name != NULL) {
+        Bucket = IopGetPathEntryHashBucket(Parent, Entry->Hash);
+        KeAcquireSharedExclusiveLockExclusive(Bucket->Lock);
+        INSERT_BEFORE(&(Entry->HashListEntry), &(Bucket->ListHead));
+        KeReleaseSharedExclusiveLockExclusive(Bucket->Lock);
+    }
+
+    return;
+}
+
 VOID
 IopPathUnlink (
     PPATH_ENTRY Entry
@@ -1050,6 +1151,8 @@ Return Value:
 
 {
 
+    PPATH_ENTRY_HASH_BUCKET Bucket;
+
     ASSERT(Entry->Parent != NULL);
 
     //
@@ -1063,6 +1166,20 @@ Return Value:
         Entry->SiblingListEntry.Next = NULL;
     }
 
+    //
+    // Pull it out of the hash table too. Lookups that skip the parent's lock
+    // hold the bucket lock while looking at the entry, so once this is done
+    // no new lookups can find it.
+    //
+
+    if (Entry->HashListEntry.Next != NULL) {
+        Bucket = IopGetPathEntryHashBucket(Entry->Parent, Entry->Hash);
+        KeAcquireSharedExclusiveLockExclusive(Bucket->Lock);
+        LIST_REMOVE(&(Entry->HashListEntry));
+        Entry->HashListEntry.Next = NULL;
+        KeReleaseSharedExclusiveLockExclusive(Bucket->Lock);
+    }
+
     return;
 }
 
@@ -1477,24 +1594,44 @@ Return Value:
     }
 
     //
-    // First cruise through the cached list looking for this entry. Successful
-    // return adds a reference to the found entry.
+    // First look in the path entry cache for this entry. Successful return
+    // adds a reference to the found entry. Try without the directory lock
+    // first, which finds entries that are already in use (like most
+    // directories along a path walk). Fall back to looking under the lock,
+    // which can also pull unused and negative entries back out of the cache.
     //
 
-    if (DirectoryLockHeld == FALSE) {
-        KeAcquireSharedExclusiveLockShared(DirectoryFileObject->Lock);
-    }
-
     Hash = IopHashPathString(Name, NameSize);
-    FoundPathPoint = IopFindPathPoint(Directory,
-                                      OpenFlags,
-                                      Name,
-                                      NameSize,
-                                      Hash,
-                                      Result);
-
     if (DirectoryLockHeld == FALSE) {
-        KeReleaseSharedExclusiveLockShared(DirectoryFileObject->Lock);
+        FoundPathPoint = IopFindPathPoint(Directory,
+                                          OpenFlags,
+                                          Name,
+                                          NameSize,
+                                          Hash,
+                                          FALSE,
+                                          Result);
+
+        if (FoundPathPoint == FALSE) {
+            KeAcquireSharedExclusiveLockShared(DirectoryFileObject->Lock);
+            FoundPathPoint = IopFindPathPoint(Directory,
+                                              OpenFlags,
+                                              Name,
+                                              NameSize,
+                                              Hash,
+                                              TRUE,
+                                              Result);
+
+            KeReleaseSharedExclusiveLockShared(DirectoryFileObject->Lock);
+        }
+
+    } else {
+        FoundPathPoint = IopFindPathPoint(Directory,
+                                          OpenFlags,
+                                          Name,
+                                          NameSize,
+                                          Hash,
+                                          TRUE,
+                                          Result);
     }
 
     if (FoundPathPoint != FALSE) {
@@ -2310,6 +2447,7 @@ Return Value:
                                       Name,
                                       NameSize,
                                       Hash,
+                                      TRUE,
                                       Result);
 
     if (FoundPathPoint != FALSE) {
@@ -2419,6 +2557,14 @@ Return Value:
                     FileObjectFlags |= FILE_OBJECT_FLAG_NON_CACHED;
                 }
 
+                //
+                // Files created on a file system whose data lives only in the
+                // page cache need the same treatment as their directory.
+                //
+
+                FileObjectFlags |= DirectoryFileObject->Flags &
+                                   FILE_OBJECT_FLAG_HARD_FLUSH_REQUIRED;
+
                 switch (Properties.Type) {
                 case IoObjectRegularFile:
                 case IoObjectRegularDirectory:
@@ -2873,14 +3019,20 @@ Return Value:
                (FileObject->Device == PathRoot) &&
                (Result->MountPoint == Directory->MountPoint));
 
-        Result->PathEntry->Negative = FALSE;
-        Result->PathEntry->DoNotCache = DoNotCache;
-
         ASSERT(FileObject != NULL);
         ASSERT(FileObject->ReferenceCount >= 2);
 
+        //
+        // Lookups that skip the directory lock can see this entry, so make
+        // sure the file object is visible before the entry stops being
+        // negative.
+        //
+
+        Result->PathEntry->DoNotCache = DoNotCache;
         Result->PathEntry->FileObject = FileObject;
         IopFileObjectAddPathEntryReference(Result->PathEntry->FileObject);
+        RtlMemoryBarrier();
+        Result->PathEntry->Negative = FALSE;
 
     //
     // Create and insert a new path entry.
@@ -2911,8 +3063,7 @@ Return Value:
         ASSERT((FileObject == NULL) ||
                (FileObject->Properties.HardLinkCount != 0));
 
-        INSERT_BEFORE(&(PathEntry->SiblingListEntry),
-                      &(DirectoryEntry->ChildList));
+        IopPathLink(PathEntry);
 
         Result->PathEntry = PathEntry;
         IoMountPointAddReference(Directory->MountPoint);
@@ -3115,6 +3266,7 @@ IopFindPathPoint (
     PCSTR Name,
     ULONG NameSize,
     ULONG Hash,
+    BOOL ParentLockHeld,
     PPATH_POINT Result
     )
 
@@ -3122,15 +3274,14 @@ IopFindPathPoint (
 
 Routine Description:
 
-    This routine loops through the given path point's child path entries
-    looking for a child with the given name. It follows any mount points it
-    encounters unless the open flags specify otherwise. This routine assumes
-    the parent's file object lock is held.
+    This routine looks in the path entry hash table for a child of the given
+    path point with the given name. It follows any mount points it encounters
+    unless the open flags specify otherwise.
 
 Arguments:
 
     Parent - Supplies a pointer to the parent path point whose children should
-        be searched. The parent's file object lock should already be held.
+        be searched.
 
     OpenFlags - Supplies a bitfield of flags governing the behavior of the
         search. See OPEN_FLAG_* definitions.
@@ -3143,6 +3294,11 @@ Routine Description:
 
     Hash - Supplies the hash of the name query string.
 
+    ParentLockHeld - Supplies a boolean indicating whether or not the caller
+        holds the parent's file object lock. If it does not, only positive
+        path entries that already have references on them are found, as
+        unreferenced entries can be destroyed out from under the lookup.
+
     Result - Supplies a pointer to a path point that receives the found path
         entry and associated mount point on success. References are taken on
         both elements if found.
@@ -3155,82 +3311,250 @@ Return Value:
 
 {
 
+    PPATH_ENTRY_HASH_BUCKET Bucket;
+    PPATH_ENTRY Candidate;
     PLIST_ENTRY CurrentEntry;
     PPATH_ENTRY Entry;
     PMOUNT_POINT FoundMountPoint;
     PPATH_ENTRY FoundPathEntry;
-    PFILE_OBJECT ParentFileObject;
-    BOOL ResultValid;
+    ULONG OldReferenceCount;
+    PPATH_ENTRY ParentEntry;
+    ULONG ReferenceCount;
 
-    ResultValid = FALSE;
-    ParentFileObject = Parent->PathEntry->FileObject;
+    ParentEntry = Parent->PathEntry;
 
     ASSERT(NameSize != 0);
-    ASSERT(KeIsSharedExclusiveLockHeld(ParentFileObject->Lock) != FALSE);
+    ASSERT((ParentLockHeld == FALSE) ||
+           (KeIsSharedExclusiveLockHeld(ParentEntry->FileObject->Lock)));
 
     //
-    // Cruise through the cached list looking for this entry.
+    // Cruise through the bucket looking for this entry. The bucket lock keeps
+    // the entries in it from being destroyed.
     //
 
-    CurrentEntry = Parent->PathEntry->ChildList.Next;
-    while (CurrentEntry != &(Parent->PathEntry->ChildList)) {
-        Entry = LIST_VALUE(CurrentEntry, PATH_ENTRY, SiblingListEntry);
+    Entry = NULL;
+    Bucket = IopGetPathEntryHashBucket(ParentEntry, Hash);
+    KeAcquireSharedExclusiveLockShared(Bucket->Lock);
+    CurrentEntry = Bucket->ListHead.Next;
+    while (CurrentEntry != &(Bucket->ListHead)) {
+        Candidate = LIST_VALUE(CurrentEntry, PATH_ENTRY, HashListEntry);
         CurrentEntry = CurrentEntry->Next;
 
         //
-        // Quickly skip entries without a name or with the wrong hash.
+        // Quickly skip entries with the wrong hash or another parent.
         //
 
-        if ((Entry->Hash != Hash) || (Entry->Name == NULL)) {
+        if ((Candidate->Hash != Hash) || (Candidate->Parent != ParentEntry)) {
             continue;
         }
 
+        ASSERT(Candidate->Name != NULL);
+
         //
         // If the names are not equal, this isn't the winner.
         //
 
-        if (IopArePathsEqual(Entry->Name, Name, NameSize) == FALSE) {
+        if (IopArePathsEqual(Candidate->Name, Name, NameSize) == FALSE) {
             continue;
         }
 
         //
-        // If the found entry is a mount point, then the parent mount point's
-        // children are searched for a matching mount point. Note that this
-        // search may fail as the path entry is not necessarily a mount point
-        // under the current mount tree. It takes a reference on success. Skip
-        // this if the open flags dictate that the final mount point should not
-        // be followed.
+        // With the parent's lock held, the entry cannot be destroyed once the
+        // bucket lock is released. Without it, the entry is only safe to use
+        // if a reference can be added while another one is still held.
+        // Negative entries are left for the locked lookup, since they may be
+        // in the middle of being converted.
         //
 
-        FoundMountPoint = NULL;
-        if ((Entry->MountCount != 0) &&
-            ((OpenFlags & OPEN_FLAG_NO_MOUNT_POINT) == 0)) {
+        if (ParentLockHeld != FALSE) {
+            Entry = Candidate;
 
-            FoundMountPoint = IopFindMountPoint(Parent->MountPoint, Entry);
-            if (FoundMountPoint != NULL) {
-                FoundPathEntry = FoundMountPoint->TargetEntry;
+        } else if (Candidate->Negative == FALSE) {
+            ReferenceCount = Candidate->ReferenceCount;
+            while (ReferenceCount != 0) {
+
+                ASSERT(ReferenceCount < 0x10000000);
+
+                OldReferenceCount = RtlAtomicCompareExchange32(
+                                                &(Candidate->ReferenceCount),
+                                                ReferenceCount + 1,
+                                                ReferenceCount);
+
+                if (OldReferenceCount == ReferenceCount) {
+                    Entry = Candidate;
+                    break;
+                }
+
+                ReferenceCount = OldReferenceCount;
             }
         }
 
-        //
-        // Use the found entry and the same mount point as the parent if the
-        // entry was found to not be a mount point.
-        //
+        break;
+    }
 
-        if (FoundMountPoint == NULL) {
-            FoundPathEntry = Entry;
-            FoundMountPoint = Parent->MountPoint;
-            IoMountPointAddReference(FoundMountPoint);
+    KeReleaseSharedExclusiveLockShared(Bucket->Lock);
+    if (Entry == NULL) {
+        return FALSE;
+    }
+
+    //
+    // If the found entry is a mount point, then the parent mount point's
+    // children are searched for a matching mount point. Note that this search
+    // may fail as the path entry is not necessarily a mount point under the
+    // current mount tree. It takes a reference on success. Skip this if the
+    // open flags dictate that the final mount point should not be followed.
+    //
+
+    FoundMountPoint = NULL;
+    if ((Entry->MountCount != 0) &&
+        ((OpenFlags & OPEN_FLAG_NO_MOUNT_POINT) == 0)) {
+
+        FoundMountPoint = IopFindMountPoint(Parent->MountPoint, Entry);
+    }
+
+    //
+    // Use the found entry and the same mount point as the parent if the entry
+    // was found to not be a mount point. The unlocked search already took its
+    // reference.
+    //
+
+    if (FoundMountPoint == NULL) {
+        FoundPathEntry = Entry;
+        FoundMountPoint = Parent->MountPoint;
+        IoMountPointAddReference(FoundMountPoint);
+        if (ParentLockHeld != FALSE) {
+            IoPathEntryAddReference(FoundPathEntry);
         }
 
+    } else {
+        FoundPathEntry = FoundMountPoint->TargetEntry;
         IoPathEntryAddReference(FoundPathEntry);
-        Result->PathEntry = FoundPathEntry;
-        Result->MountPoint = FoundMountPoint;
-        ResultValid = TRUE;
-        break;
+        if (ParentLockHeld == FALSE) {
+            IoPathEntryReleaseReference(Entry);
+        }
     }
 
-    return ResultValid;
+    Result->PathEntry = FoundPathEntry;
+    Result->MountPoint = FoundMountPoint;
+    return TRUE;
+}
+
+PPATH_ENTRY_HASH_BUCKET
+IopGetPathEntryHashBucket (
+    PPATH_ENTRY Parent,
+    ULONG Hash
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the path entry hash table bucket for a child of the
+    given parent with the given name hash.
+
+Arguments:
+
+    Parent - Supplies a pointer to the parent path entry.
+
+    Hash - Supplies the hash of the child's name.
+
+Return Value:
+
+    Returns a pointer to the hash bucket.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    //
+    // The low bits of the parent pointer are the same for every allocation,
+    // so shift them out before mixing the parent in with the name hash.
+    //
+
+    Index = Hash ^ (ULONG)((UINTN)Parent >> 4);
+    Index &= IoPathEntryHashBucketCount - 1;
+    return &(IoPathEntryHashTable[Index]);
+}
+
+KSTATUS
+IopInitializePathEntryHashTable (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates the path entry hash table, sizing it based on the
+    maximum size of the path entry cache.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    PPATH_ENTRY_HASH_BUCKET Bucket;
+    ULONG BucketCount;
+    ULONG Index;
+    KSTATUS Status;
+
+    BucketCount = PATH_ENTRY_HASH_MIN_BUCKETS;
+    while ((BucketCount < PATH_ENTRY_HASH_MAX_BUCKETS) &&
+           (((UINTN)BucketCount * PATH_ENTRY_HASH_BUCKET_DEPTH) <
+            IoPathEntryListMaxSize)) {
+
+        BucketCount <<= 1;
+    }
+
+    AllocationSize = BucketCount * sizeof(PATH_ENTRY_HASH_BUCKET);
+    IoPathEntryHashTable = MmAllocatePagedPool(AllocationSize,
+                                               PATH_ALLOCATION_TAG);
+
+    if (IoPathEntryHashTable == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializePathEntryHashTableEnd;
+    }
+
+    RtlZeroMemory(IoPathEntryHashTable, AllocationSize);
+    for (Index = 0; Index < BucketCount; Index += 1) {
+        Bucket = &(IoPathEntryHashTable[Index]);
+        INITIALIZE_LIST_HEAD(&(Bucket->ListHead));
+        Bucket->Lock = KeCreateSharedExclusiveLock();
+        if (Bucket->Lock == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto InitializePathEntryHashTableEnd;
+        }
+    }
+
+    IoPathEntryHashBucketCount = BucketCount;
+    Status = STATUS_SUCCESS;
+
+InitializePathEntryHashTableEnd:
+    if (!KSUCCESS(Status)) {
+        if (IoPathEntryHashTable != NULL) {
+            for (Index = 0; Index < BucketCount; Index += 1) {
+                Bucket = &(IoPathEntryHashTable[Index]);
+                if (Bucket->Lock != NULL) {
+                    KeDestroySharedExclusiveLock(Bucket->Lock);
+                }
+            }
+
+            MmFreePagedPool(IoPathEntryHashTable);
+            IoPathEntryHashTable = NULL;
+        }
+    }
+
+    return Status;
 }
 
 VOID
@@ -3504,10 +3828,7 @@ Return Value:
         // entries.
         //
 
-        if (Entry->SiblingListEntry.Next != NULL) {
-            LIST_REMOVE(&(Entry->SiblingListEntry));
-            Entry->SiblingListEntry.Next = NULL;
-        }
+        IopPathUnlink(Entry);
 
         ASSERT(ParentFileObject != NULL);
 
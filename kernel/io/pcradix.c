@@ -0,0 +1,613 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    pcradix.c
+
+Abstract:
+
+    This module implements the radix tree that indexes a file object's page
+    cache entries by page number. Changes to the tree are serialized by the
+    file object lock, but lookups need no lock at all: every node and slot is
+    fully initialized before it is published, and nodes are never freed until
+    the file object itself is destroyed.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+#include "pagecach.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define PAGE_CACHE_RADIX_ALLOCATION_TAG 0x78645250 // 'xdRP'
+
+//
+// Define the number of key bits each level of the tree consumes.
+//
+
+#define PAGE_CACHE_RADIX_SHIFT 6
+#define PAGE_CACHE_RADIX_SLOTS (1 << PAGE_CACHE_RADIX_SHIFT)
+#define PAGE_CACHE_RADIX_MASK (PAGE_CACHE_RADIX_SLOTS - 1)
+
+//
+// Define the number of bits in a key.
+//
+
+#define PAGE_CACHE_RADIX_KEY_BITS (sizeof(ULONGLONG) * BITS_PER_BYTE)
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// This macro determines whether a node at the given shift can hold the given
+// key when it sits at the top of the tree.
+//
+
+#define PAGE_CACHE_RADIX_COVERS(_Shift, _Key)                              \
+    ((((_Shift) + PAGE_CACHE_RADIX_SHIFT) >= PAGE_CACHE_RADIX_KEY_BITS) || \
+     (((_Key) >> ((_Shift) + PAGE_CACHE_RADIX_SHIFT)) == 0))
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines a node in the page cache radix tree.
+
+Members:
+
+    Slots - Stores the node's children. In a leaf node these are the page
+        cache entries themselves.
+
+    Shift - Stores the number of low key bits below this node's level. Leaf
+        nodes have a shift of zero.
+
+    Count - Stores the number of page cache entries in the subtree below
+        this node. Interior nodes stay in place even when this drops to zero.
+
+--*/
+
+struct _PAGE_CACHE_RADIX_NODE {
+    PVOID volatile Slots[PAGE_CACHE_RADIX_SLOTS];
+    ULONG Shift;
+    ULONG Count;
+};
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+PPAGE_CACHE_RADIX_NODE
+IopCreatePageCacheRadixNode (
+    ULONG Shift
+    );
+
+VOID
+IopDestroyPageCacheRadixNode (
+    PPAGE_CACHE_RADIX_NODE Node
+    );
+
+PVOID
+IopFindPageCacheRadixNode (
+    PPAGE_CACHE_RADIX_NODE Node,
+    ULONGLONG Key
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+VOID
+IopInitializePageCacheIndex (
+    PPAGE_CACHE_INDEX Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes an empty page cache index.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to initialize.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Index->Root = NULL;
+    Index->EntryCount = 0;
+    return;
+}
+
+VOID
+IopDestroyPageCacheIndex (
+    PPAGE_CACHE_INDEX Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the nodes of an empty page cache index. Nothing may
+    still be looking up entries in it.
+
+Arguments:
+
+    Index - Supplies a pointer to the index to tear down.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ASSERT(Index->EntryCount == 0);
+
+    if (Index->Root != NULL) {
+        IopDestroyPageCacheRadixNode(Index->Root);
+        Index->Root = NULL;
+    }
+
+    return;
+}
+
+KSTATUS
+IopPreparePageCacheIndexSlot (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes sure the nodes needed to hold the given key exist, so
+    that setting the slot afterwards cannot fail. The file object lock must be
+    held exclusively.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number about to be inserted.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if a node could not be allocated.
+
+--*/
+
+{
+
+    PPAGE_CACHE_RADIX_NODE Child;
+    PPAGE_CACHE_RADIX_NODE Node;
+    ULONG Shift;
+    ULONG Slot;
+
+    //
+    // Create the first node just tall enough for the key.
+    //
+
+    Node = Index->Root;
+    if (Node == NULL) {
+        Shift = 0;
+        while (PAGE_CACHE_RADIX_COVERS(Shift, Key) == FALSE) {
+            Shift += PAGE_CACHE_RADIX_SHIFT;
+        }
+
+        Node = IopCreatePageCacheRadixNode(Shift);
+        if (Node == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlMemoryBarrier();
+        Index->Root = Node;
+    }
+
+    //
+    // Grow the tree upwards until the top covers the key. The old top always
+    // becomes the first child of the new one, so lookups that already read
+    // the old top still find everything they could before.
+    //
+
+    while (PAGE_CACHE_RADIX_COVERS(Node->Shift, Key) == FALSE) {
+        Child = Node;
+        Node = IopCreatePageCacheRadixNode(Child->Shift +
+                                           PAGE_CACHE_RADIX_SHIFT);
+
+        if (Node == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        Node->Slots[0] = Child;
+        Node->Count = Child->Count;
+        RtlMemoryBarrier();
+        Index->Root = Node;
+    }
+
+    //
+    // Walk down, filling in any missing interior nodes.
+    //
+
+    while (Node->Shift != 0) {
+        Slot = (Key >> Node->Shift) & PAGE_CACHE_RADIX_MASK;
+        Child = Node->Slots[Slot];
+        if (Child == NULL) {
+            Child = IopCreatePageCacheRadixNode(Node->Shift -
+                                                PAGE_CACHE_RADIX_SHIFT);
+
+            if (Child == NULL) {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            RtlMemoryBarrier();
+            Node->Slots[Slot] = Child;
+        }
+
+        Node = Child;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+IopSetPageCacheIndexSlot (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key,
+    PVOID Value
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets or clears the slot for the given key. The slot must have
+    been prepared if a value is being set. The file object lock must be held
+    exclusively.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number of the slot.
+
+    Value - Supplies the page cache entry to store, which must be completely
+        initialized, or NULL to clear the slot.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Delta;
+    PPAGE_CACHE_RADIX_NODE Node;
+    ULONG Slot;
+
+    Node = Index->Root;
+
+    ASSERT((Node != NULL) && (PAGE_CACHE_RADIX_COVERS(Node->Shift, Key)));
+
+    Delta = 1;
+    if (Value == NULL) {
+        Delta = (ULONG)-1;
+    }
+
+    //
+    // Update the counts along the path down to the leaf.
+    //
+
+    while (TRUE) {
+        Node->Count += Delta;
+        if (Node->Shift == 0) {
+            break;
+        }
+
+        Node = Node->Slots[(Key >> Node->Shift) & PAGE_CACHE_RADIX_MASK];
+
+        ASSERT(Node != NULL);
+    }
+
+    Slot = Key & PAGE_CACHE_RADIX_MASK;
+    if (Value != NULL) {
+
+        ASSERT(Node->Slots[Slot] == NULL);
+
+        Index->EntryCount += 1;
+
+        //
+        // Make sure the entry is fully visible before lookups can find it.
+        //
+
+        RtlMemoryBarrier();
+
+    } else {
+
+        ASSERT(Node->Slots[Slot] != NULL);
+
+        Index->EntryCount -= 1;
+    }
+
+    Node->Slots[Slot] = Value;
+    return;
+}
+
+PVOID
+IopLookupPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the value stored for the given key. It takes no locks.
+    Without the file object lock, the result may be stale by the time it is
+    returned.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number to look up.
+
+Return Value:
+
+    Returns the stored page cache entry, or NULL if there is none.
+
+--*/
+
+{
+
+    PPAGE_CACHE_RADIX_NODE Node;
+    PVOID Value;
+
+    Node = Index->Root;
+    if ((Node == NULL) ||
+        (PAGE_CACHE_RADIX_COVERS(Node->Shift, Key) == FALSE)) {
+
+        return NULL;
+    }
+
+    while (TRUE) {
+        Value = Node->Slots[(Key >> Node->Shift) & PAGE_CACHE_RADIX_MASK];
+        if ((Value == NULL) || (Node->Shift == 0)) {
+            break;
+        }
+
+        Node = Value;
+    }
+
+    return Value;
+}
+
+PVOID
+IopFindPageCacheIndex (
+    PPAGE_CACHE_INDEX Index,
+    ULONGLONG Key
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the value with the lowest key greater than or equal to
+    the given key. The file object lock must be held for the result to be
+    stable.
+
+Arguments:
+
+    Index - Supplies a pointer to the index.
+
+    Key - Supplies the page number to start searching from.
+
+Return Value:
+
+    Returns the first page cache entry at or after the given key, or NULL if
+    there is none.
+
+--*/
+
+{
+
+    PPAGE_CACHE_RADIX_NODE Node;
+
+    Node = Index->Root;
+    if ((Node == NULL) ||
+        (PAGE_CACHE_RADIX_COVERS(Node->Shift, Key) == FALSE)) {
+
+        return NULL;
+    }
+
+    return IopFindPageCacheRadixNode(Node, Key);
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+PPAGE_CACHE_RADIX_NODE
+IopCreatePageCacheRadixNode (
+    ULONG Shift
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates an empty radix tree node.
+
+Arguments:
+
+    Shift - Supplies the level of the node, as the number of key bits below
+        it.
+
+Return Value:
+
+    Returns a pointer to the new node, or NULL on allocation failure.
+
+--*/
+
+{
+
+    PPAGE_CACHE_RADIX_NODE Node;
+
+    Node = MmAllocatePagedPool(sizeof(PAGE_CACHE_RADIX_NODE),
+                               PAGE_CACHE_RADIX_ALLOCATION_TAG);
+
+    if (Node == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(Node, sizeof(PAGE_CACHE_RADIX_NODE));
+    Node->Shift = Shift;
+    return Node;
+}
+
+VOID
+IopDestroyPageCacheRadixNode (
+    PPAGE_CACHE_RADIX_NODE Node
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a radix tree node and all the interior nodes below it.
+
+Arguments:
+
+    Node - Supplies a pointer to the node to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Slot;
+
+    if (Node->Shift != 0) {
+        for (Slot = 0; Slot < PAGE_CACHE_RADIX_SLOTS; Slot += 1) {
+            if (Node->Slots[Slot] != NULL) {
+                IopDestroyPageCacheRadixNode(Node->Slots[Slot]);
+            }
+        }
+    }
+
+    MmFreePagedPool(Node);
+    return;
+}
+
+PVOID
+IopFindPageCacheRadixNode (
+    PPAGE_CACHE_RADIX_NODE Node,
+    ULONGLONG Key
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the value with the lowest key greater than or equal to
+    the given key within a subtree. The key must fall within the range the
+    node covers.
+
+Arguments:
+
+    Node - Supplies a pointer to the root of the subtree.
+
+    Key - Supplies the page number to start searching from.
+
+Return Value:
+
+    Returns the first value at or after the given key, or NULL if there is
+    none in the subtree.
+
+--*/
+
+{
+
+    PVOID Child;
+    ULONGLONG NextKey;
+    ULONG Slot;
+    PVOID Value;
+
+    Slot = (Key >> Node->Shift) & PAGE_CACHE_RADIX_MASK;
+    while (Slot < PAGE_CACHE_RADIX_SLOTS) {
+        Child = Node->Slots[Slot];
+        if (Child != NULL) {
+            if (Node->Shift == 0) {
+                return Child;
+            }
+
+            if (((PPAGE_CACHE_RADIX_NODE)Child)->Count != 0) {
+                Value = IopFindPageCacheRadixNode(Child, Key);
+                if (Value != NULL) {
+                    return Value;
+                }
+            }
+        }
+
+        //
+        // Move to the start of the next slot's range. Stop if the key space
+        // runs out.
+        //
+
+        NextKey = (Key | ((1ULL << Node->Shift) - 1)) + 1;
+        if (NextKey == 0) {
+            break;
+        }
+
+        Key = NextKey;
+        Slot += 1;
+    }
+
+    return NULL;
+}
+
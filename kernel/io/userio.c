@@ -50,7 +50,8 @@ Module Name:
            (SYS_OPEN_FLAG_NO_CONTROLLING_TERMINAL == \
             OPEN_FLAG_NO_CONTROLLING_TERMINAL) && \
            (SYS_OPEN_FLAG_NO_ACCESS_TIME == OPEN_FLAG_NO_ACCESS_TIME)  && \
-           (SYS_OPEN_FLAG_ASYNCHRONOUS == OPEN_FLAG_ASYNCHRONOUS))
+           (SYS_OPEN_FLAG_ASYNCHRONOUS == OPEN_FLAG_ASYNCHRONOUS) && \
+           (SYS_OPEN_FLAG_DIRECT == OPEN_FLAG_DIRECT))
 
 //
 // ---------------------------------------------------------------- Definitions
@@ -1899,6 +1900,7 @@ Return Value:
     PSYSTEM_CALL_FILE_CONTROL FileControl;
     PFILE_OBJECT FileObject;
     ULONG Flags;
+    BOOL HandleOwned;
     PIO_HANDLE IoHandle;
     PIO_OBJECT_STATE IoState;
     FILE_CONTROL_PARAMETERS_UNION LocalParameters;
@@ -1912,6 +1914,7 @@ Return Value:
     Blocking = FALSE;
     CopyOutSize = 0;
     Flags = 0;
+    HandleOwned = FALSE;
     FileControl = (PSYSTEM_CALL_FILE_CONTROL)SystemCallParameter;
     Process = PsGetCurrentProcess();
     IoHandle = NULL;
@@ -2130,23 +2133,54 @@ Return Value:
         Status = STATUS_SUCCESS;
         break;
 
+    //
+    // Lock commands on the handle itself behave like the process lock
+    // commands, except that the lock is owned by the open I/O handle.
+    //
+
+    case FileControlCommandGetHandleLock:
+        HandleOwned = TRUE;
+
     case FileControlCommandGetLock:
-        RtlZeroMemory(&(LocalParameters.FileLock), sizeof(FILE_LOCK));
-        Status = IopGetFileLock(IoHandle, &(LocalParameters.FileLock));
+        if (FileControl->Parameters == NULL) {
+            Status = STATUS_INVALID_PARAMETER;
+            goto SysFileControlEnd;
+        }
+
+        Status = MmCopyFromUserMode(&LocalParameters,
+                                    FileControl->Parameters,
+                                    sizeof(FILE_LOCK));
+
+        if (!KSUCCESS(Status)) {
+            goto SysFileControlEnd;
+        }
+
+        Status = IopGetFileLock(IoHandle,
+                                &(LocalParameters.FileLock),
+                                HandleOwned);
+
         if (KSUCCESS(Status)) {
             CopyOutSize = sizeof(FILE_LOCK);
         }
 
         break;
 
-    //
-    // Toggle the blocking local and fall through to the set lock command.
-    //
-
+    case FileControlCommandSetLock:
     case FileControlCommandBlockingSetLock:
-        Blocking = TRUE;
+    case FileControlCommandSetHandleLock:
+    case FileControlCommandBlockingSetHandleLock:
+        if ((FileControl->Command == FileControlCommandBlockingSetLock) ||
+            (FileControl->Command == FileControlCommandBlockingSetHandleLock)) {
+
+            Blocking = TRUE;
+        }
+
+        if ((FileControl->Command == FileControlCommandSetHandleLock) ||
+            (FileControl->Command == FileControlCommandBlockingSetHandleLock)) {
+
+            HandleOwned = TRUE;
+        }
 
-    case FileControlCommandSetLock:
         if (FileControl->Parameters == NULL) {
             Status = STATUS_INVALID_PARAMETER;
             goto SysFileControlEnd;
@@ -2162,6 +2196,7 @@ Return Value:
 
         Status = IopSetFileLock(IoHandle,
                                 &(LocalParameters.FileLock),
+                                HandleOwned,
                                 Blocking);
 
         break;
@@ -3432,6 +3467,15 @@ Return Value:
     KSTATUS Status;
     KSTATUS TotalStatus;
 
+    //
+    // Tear down the I/O ring first so that its workers let go of their handle
+    // references.
+    //
+
+    if (MinimumHandle == 0) {
+        IopDestroyIoRing(Process);
+    }
+
     //
     // Loop getting the highest numbered handle and closing it until there are
     // no more open handles.
@@ -3549,6 +3593,12 @@ Return Value:
     ULONG HandleIndex;
     KSTATUS Status;
 
+    //
+    // The I/O ring lives in the old image's memory, so it does not survive.
+    //
+
+    IopDestroyIoRing(Process);
+
     //
     // Get the array of handles to be closed. This can't be done in the
     // iterate routine because the iterate routine needs the tree to stay
@@ -0,0 +1,703 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    writebk.c
+
+Abstract:
+
+    This module implements per-device writeback of dirty page cache data. Each
+    device that backs cached data gets its own writeback thread and an
+    estimate of its write bandwidth. Threads dirtying the cache are throttled
+    against a share of the dirty limit proportional to that bandwidth, so a
+    slow device only slows down its own writers.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "iop.h"
+#include "pagecach.h"
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define WRITEBACK_ALLOCATION_TAG 0x6B427257 // 'kBrW'
+
+//
+// Define the bandwidth a device is assumed to have before any of its writes
+// have been measured, in bytes per second.
+//
+
+#define WRITEBACK_INITIAL_BANDWIDTH (4 * _1MB)
+
+//
+// Define the lowest bandwidth estimate allowed, in bytes per second. This
+// keeps a stalled device from being given no share at all.
+//
+
+#define WRITEBACK_MINIMUM_BANDWIDTH (64 * _1KB)
+
+//
+// Define the fraction of a second of write time gathered into a bandwidth
+// sample before the estimate is updated.
+//
+
+#define WRITEBACK_SAMPLE_DIVISOR 10
+
+//
+// Define the number of dirty pages every device with dirty data is allowed,
+// regardless of how slow it is.
+//
+
+#define WRITEBACK_MINIMUM_DIRTY_PAGES 64
+
+//
+// Define the bounds of a single throttling pause, in milliseconds.
+//
+
+#define WRITEBACK_MINIMUM_PAUSE 10
+#define WRITEBACK_MAXIMUM_PAUSE 200
+
+//
+// Define the number of pauses a writer takes before it is let through anyway.
+// This bounds how long a writer can be held up by a device that is making no
+// progress.
+//
+
+#define WRITEBACK_MAXIMUM_PAUSE_COUNT 10
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+VOID
+IopWritebackThread (
+    PVOID Parameter
+    );
+
+UINTN
+IopGetWritebackDirtyLimit (
+    PDEVICE_WRITEBACK Writeback,
+    UINTN GlobalLimit
+    );
+
+VOID
+IopDestroyWritebackState (
+    PDEVICE_WRITEBACK Writeback
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store the list of device writeback states, and the lock that protects it.
+//
+
+LIST_ENTRY IoWritebackList;
+PQUEUED_LOCK IoWritebackListLock;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+IopInitializeWriteback (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes support for per-device writeback.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    INITIALIZE_LIST_HEAD(&IoWritebackList);
+    IoWritebackListLock = KeCreateQueuedLock();
+    if (IoWritebackListLock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+PDEVICE_WRITEBACK
+IopGetDeviceWriteback (
+    PDEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the writeback state for the device backing the given
+    device or volume, creating it and its thread if needed.
+
+Arguments:
+
+    Device - Supplies a pointer to the device, volume, or object directory
+        that owns a file object.
+
+Return Value:
+
+    Returns a pointer to the writeback state.
+
+    NULL if the device has no backing device, or the state could not be
+    created. Dirty data is then flushed by the page cache thread.
+
+--*/
+
+{
+
+    PDEVICE_WRITEBACK NewWriteback;
+    PDEVICE_WRITEBACK OldWriteback;
+    KSTATUS Status;
+
+    if ((Device->Header.Type != ObjectVolume) &&
+        (Device->Header.Type != ObjectDevice)) {
+
+        return NULL;
+    }
+
+    //
+    // Find the device at the bottom of the stack. A volume and the block
+    // device it is mounted on end up sharing the same writeback state.
+    //
+
+    while (Device->TargetDevice != NULL) {
+        Device = Device->TargetDevice;
+    }
+
+    if (Device->Writeback != NULL) {
+        return Device->Writeback;
+    }
+
+    NewWriteback = MmAllocateNonPagedPool(sizeof(DEVICE_WRITEBACK),
+                                          WRITEBACK_ALLOCATION_TAG);
+
+    if (NewWriteback == NULL) {
+        return NULL;
+    }
+
+    RtlZeroMemory(NewWriteback, sizeof(DEVICE_WRITEBACK));
+    NewWriteback->Device = Device;
+    NewWriteback->Bandwidth = WRITEBACK_INITIAL_BANDWIDTH;
+    NewWriteback->Lock = KeCreateQueuedLock();
+    INITIALIZE_LIST_HEAD(&(NewWriteback->DirtyList));
+    NewWriteback->DirtyListLock = KeCreateQueuedLock();
+    NewWriteback->WorkEvent = KeCreateEvent(NULL);
+    NewWriteback->ProgressEvent = KeCreateEvent(NULL);
+    if ((NewWriteback->Lock == NULL) ||
+        (NewWriteback->DirtyListLock == NULL) ||
+        (NewWriteback->WorkEvent == NULL) ||
+        (NewWriteback->ProgressEvent == NULL)) {
+
+        IopDestroyWritebackState(NewWriteback);
+        return NULL;
+    }
+
+    //
+    // Start the thread before publishing the state. The thread just waits
+    // for work until the state is installed.
+    //
+
+    Status = PsCreateKernelThread(IopWritebackThread,
+                                  NewWriteback,
+                                  "IopWritebackThread");
+
+    if (!KSUCCESS(Status)) {
+        IopDestroyWritebackState(NewWriteback);
+        return NULL;
+    }
+
+    //
+    // Race to install the state. The loser tells its thread to exit, and the
+    // thread frees the state.
+    //
+
+    OldWriteback = (PDEVICE_WRITEBACK)RtlAtomicCompareExchange(
+                                                (PUINTN)&(Device->Writeback),
+                                                (UINTN)NewWriteback,
+                                                (UINTN)NULL);
+
+    if (OldWriteback != NULL) {
+        RtlAtomicOr32(&(NewWriteback->Flags), DEVICE_WRITEBACK_FLAG_EXITING);
+        KeSignalEvent(NewWriteback->WorkEvent, SignalOptionSignalAll);
+        return OldWriteback;
+    }
+
+    KeAcquireQueuedLock(IoWritebackListLock);
+    INSERT_BEFORE(&(NewWriteback->ListEntry), &IoWritebackList);
+    KeReleaseQueuedLock(IoWritebackListLock);
+    return NewWriteback;
+}
+
+VOID
+IopDestroyDeviceWriteback (
+    PDEVICE Device
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tears down a device's writeback state and tells its thread
+    to exit. No file objects may still refer to it.
+
+Arguments:
+
+    Device - Supplies a pointer to the device being destroyed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PDEVICE_WRITEBACK Writeback;
+
+    Writeback = Device->Writeback;
+    if (Writeback == NULL) {
+        return;
+    }
+
+    Device->Writeback = NULL;
+    KeAcquireQueuedLock(IoWritebackListLock);
+    LIST_REMOVE(&(Writeback->ListEntry));
+    KeReleaseQueuedLock(IoWritebackListLock);
+
+    //
+    // The thread frees the state on its way out.
+    //
+
+    RtlAtomicOr32(&(Writeback->Flags), DEVICE_WRITEBACK_FLAG_EXITING);
+    KeSignalEvent(Writeback->WorkEvent, SignalOptionSignalAll);
+    return;
+}
+
+VOID
+IopScheduleWriteback (
+    PDEVICE_WRITEBACK Writeback
+    )
+
+/*++
+
+Routine Description:
+
+    This routine asks a device's writeback thread to flush the device's dirty
+    file objects.
+
+Arguments:
+
+    Writeback - Supplies an optional pointer to the writeback state to kick.
+        Supply NULL to kick the writeback thread of every device with dirty
+        file objects.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PDEVICE_WRITEBACK CurrentWriteback;
+
+    if (Writeback != NULL) {
+        KeSignalEvent(Writeback->WorkEvent, SignalOptionSignalAll);
+        return;
+    }
+
+    KeAcquireQueuedLock(IoWritebackListLock);
+    CurrentEntry = IoWritebackList.Next;
+    while (CurrentEntry != &IoWritebackList) {
+        CurrentWriteback = LIST_VALUE(CurrentEntry,
+                                      DEVICE_WRITEBACK,
+                                      ListEntry);
+
+        CurrentEntry = CurrentEntry->Next;
+        if ((CurrentWriteback->DirtyPageCount != 0) ||
+            (LIST_EMPTY(&(CurrentWriteback->DirtyList)) == FALSE)) {
+
+            KeSignalEvent(CurrentWriteback->WorkEvent, SignalOptionSignalAll);
+        }
+    }
+
+    KeReleaseQueuedLock(IoWritebackListLock);
+    return;
+}
+
+VOID
+IopCompleteWriteback (
+    PDEVICE_WRITEBACK Writeback,
+    PFILE_OBJECT FileObject,
+    UINTN BytesWritten,
+    ULONGLONG Ticks
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records that a flush to a device completed. Writes to the
+    block device itself feed the bandwidth estimate, and any throttled writers
+    are woken to re-check their limit.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the device's writeback state.
+
+    FileObject - Supplies a pointer to the file object that was written.
+
+    BytesWritten - Supplies the number of bytes written.
+
+    Ticks - Supplies the number of time counter ticks the write took.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG Bandwidth;
+    ULONGLONG Frequency;
+    ULONGLONG Milliseconds;
+
+    //
+    // Only writes that reach the block device measure the device. Flushes of
+    // regular files mostly just move data into the block device's cache.
+    //
+
+    if (FileObject->Properties.Type == IoObjectBlockDevice) {
+        Frequency = HlQueryTimeCounterFrequency();
+        KeAcquireQueuedLock(Writeback->Lock);
+        Writeback->SampleBytes += BytesWritten;
+        Writeback->SampleTime += Ticks;
+        if (Writeback->SampleTime >= Frequency / WRITEBACK_SAMPLE_DIVISOR) {
+            Milliseconds = (Writeback->SampleTime * MILLISECONDS_PER_SECOND) /
+                           Frequency;
+
+            if (Milliseconds == 0) {
+                Milliseconds = 1;
+            }
+
+            Bandwidth = (Writeback->SampleBytes * MILLISECONDS_PER_SECOND) /
+                        Milliseconds;
+
+            //
+            // Blend the new sample into the running estimate so that one odd
+            // sample does not swing the limits around.
+            //
+
+            Bandwidth = ((Writeback->Bandwidth * 3ULL) + Bandwidth) / 4;
+            if (Bandwidth < WRITEBACK_MINIMUM_BANDWIDTH) {
+                Bandwidth = WRITEBACK_MINIMUM_BANDWIDTH;
+
+            } else if (Bandwidth > MAX_UINTN) {
+                Bandwidth = MAX_UINTN;
+            }
+
+            Writeback->Bandwidth = (UINTN)Bandwidth;
+            Writeback->SampleBytes = 0;
+            Writeback->SampleTime = 0;
+        }
+
+        KeReleaseQueuedLock(Writeback->Lock);
+    }
+
+    KeSignalEvent(Writeback->ProgressEvent, SignalOptionPulse);
+    return;
+}
+
+VOID
+IopThrottleDirtyWriter (
+    PDEVICE_WRITEBACK Writeback,
+    UINTN SizeInBytes
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes a thread about to dirty cached data wait if the device
+    backing the data has more than its share of the dirty pages. The share is
+    proportional to the device's estimated bandwidth among the devices with
+    dirty data. No file object locks may be held.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the writeback state of the device.
+
+    SizeInBytes - Supplies the number of bytes about to be written.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN GlobalLimit;
+    UINTN Limit;
+    UINTN PageShift;
+    ULONGLONG Pause;
+    ULONG PauseCount;
+
+    //
+    // Writers run free until the cache as a whole is half way to its limit.
+    //
+
+    GlobalLimit = IopGetPageCacheDirtyLimit();
+    if (IoPageCacheDirtyPageCount < (GlobalLimit >> 1)) {
+        return;
+    }
+
+    IopScheduleWriteback(Writeback);
+    Limit = IopGetWritebackDirtyLimit(Writeback, GlobalLimit);
+    if (Writeback->DirtyPageCount <= Limit) {
+        return;
+    }
+
+    //
+    // The device is over its share. Pause for about as long as the device
+    // takes to write out what this thread is about to add, and re-check
+    // whenever the device makes progress.
+    //
+
+    PageShift = MmPageShift();
+    SizeInBytes = ALIGN_RANGE_UP(SizeInBytes, MmPageSize());
+    for (PauseCount = 0;
+         PauseCount < WRITEBACK_MAXIMUM_PAUSE_COUNT;
+         PauseCount += 1) {
+
+        Pause = ((ULONGLONG)SizeInBytes * MILLISECONDS_PER_SECOND) /
+                Writeback->Bandwidth;
+
+        if (Pause < WRITEBACK_MINIMUM_PAUSE) {
+            Pause = WRITEBACK_MINIMUM_PAUSE;
+
+        } else if (Pause > WRITEBACK_MAXIMUM_PAUSE) {
+            Pause = WRITEBACK_MAXIMUM_PAUSE;
+        }
+
+        KeWaitForEvent(Writeback->ProgressEvent, FALSE, (ULONG)Pause);
+        if ((Writeback->DirtyPageCount + (SizeInBytes >> PageShift)) <=
+            Limit) {
+
+            break;
+        }
+
+        IopScheduleWriteback(Writeback);
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+VOID
+IopWritebackThread (
+    PVOID Parameter
+    )
+
+/*++
+
+Routine Description:
+
+    This routine flushes the dirty file objects backed by one device whenever
+    it is asked to.
+
+Arguments:
+
+    Parameter - Supplies a pointer to the device's writeback state.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PDEVICE_WRITEBACK Writeback;
+
+    Writeback = Parameter;
+    while (TRUE) {
+        KeWaitForEvent(Writeback->WorkEvent, FALSE, WAIT_TIME_INDEFINITE);
+        if ((Writeback->Flags & DEVICE_WRITEBACK_FLAG_EXITING) != 0) {
+            break;
+        }
+
+        KeSignalEvent(Writeback->WorkEvent, SignalOptionUnsignal);
+        IopFlushWritebackFileObjects(Writeback, IO_FLAG_HARD_FLUSH_ALLOWED);
+
+        //
+        // Now that some pages may be clean, let the cache shrink if it is too
+        // big, and let throttled writers re-check their limits.
+        //
+
+        IopTrimPageCache(FALSE);
+        KeSignalEvent(Writeback->ProgressEvent, SignalOptionPulse);
+    }
+
+    IopDestroyWritebackState(Writeback);
+    return;
+}
+
+UINTN
+IopGetWritebackDirtyLimit (
+    PDEVICE_WRITEBACK Writeback,
+    UINTN GlobalLimit
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines how many dirty pages the given device may have.
+    Each device with dirty data gets a share of the global limit proportional
+    to its estimated bandwidth.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the writeback state of the device.
+
+    GlobalLimit - Supplies the number of dirty pages allowed across all
+        devices.
+
+Return Value:
+
+    Returns the maximum number of dirty pages for the device.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PDEVICE_WRITEBACK CurrentWriteback;
+    ULONGLONG Limit;
+    ULONGLONG TotalBandwidth;
+
+    TotalBandwidth = 0;
+    KeAcquireQueuedLock(IoWritebackListLock);
+    CurrentEntry = IoWritebackList.Next;
+    while (CurrentEntry != &IoWritebackList) {
+        CurrentWriteback = LIST_VALUE(CurrentEntry,
+                                      DEVICE_WRITEBACK,
+                                      ListEntry);
+
+        CurrentEntry = CurrentEntry->Next;
+        if ((CurrentWriteback == Writeback) ||
+            (CurrentWriteback->DirtyPageCount != 0)) {
+
+            TotalBandwidth += CurrentWriteback->Bandwidth;
+        }
+    }
+
+    KeReleaseQueuedLock(IoWritebackListLock);
+    if (TotalBandwidth == 0) {
+        return GlobalLimit;
+    }
+
+    Limit = ((ULONGLONG)GlobalLimit * Writeback->Bandwidth) / TotalBandwidth;
+    if (Limit < WRITEBACK_MINIMUM_DIRTY_PAGES) {
+        Limit = WRITEBACK_MINIMUM_DIRTY_PAGES;
+    }
+
+    if (Limit > GlobalLimit) {
+        Limit = GlobalLimit;
+    }
+
+    return (UINTN)Limit;
+}
+
+VOID
+IopDestroyWritebackState (
+    PDEVICE_WRITEBACK Writeback
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a writeback state structure and its resources.
+
+Arguments:
+
+    Writeback - Supplies a pointer to the writeback state to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (Writeback->ProgressEvent != NULL) {
+        KeDestroyEvent(Writeback->ProgressEvent);
+    }
+
+    if (Writeback->WorkEvent != NULL) {
+        KeDestroyEvent(Writeback->WorkEvent);
+    }
+
+    if (Writeback->Lock != NULL) {
+        KeDestroyQueuedLock(Writeback->Lock);
+    }
+
+    if (Writeback->DirtyListLock != NULL) {
+
+        ASSERT(LIST_EMPTY(&(Writeback->DirtyList)) != FALSE);
+
+        KeDestroyQueuedLock(Writeback->DirtyListLock);
+    }
+
+    MmFreeNonPagedPool(Writeback);
+    return;
+}
+
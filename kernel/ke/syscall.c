@@ -221,6 +221,8 @@ SYSTEM_CALL_TABLE_ENTRY KeSystemCallTable[SystemCallCount] = {
     {MmSysSetBreak,
         sizeof(SYSTEM_CALL_SET_BREAK),
         sizeof(SYSTEM_CALL_SET_BREAK)},
+    {IoSysCreateIoRing, sizeof(SYSTEM_CALL_CREATE_IO_RING), 0},
+    {IoSysEnterIoRing, sizeof(SYSTEM_CALL_ENTER_IO_RING), 0},
 };
 
 //
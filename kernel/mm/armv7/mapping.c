@@ -835,6 +835,7 @@ Return Value:
         MmUpdatePageDirectory(AddressSpace, CurrentStack, PAGE_SIZE);
     }
 
+    MmpUpdateProcessorAddressSpace(Processor, AddressSpace);
     ArSwitchTtbr0(Space->PageDirectoryPhysical);
     return;
 }
@@ -1899,6 +1900,114 @@ Return Value:
     return PhysicalAddress;
 }
 
+BOOL
+MmpTestAndClearAccessedBit (
+    PADDRESS_SPACE AddressSpace,
+    PVOID VirtualAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not the hardware has marked the given
+    page as accessed since the last time it was checked, and clears the
+    accessed state so that the next check can find out whether the page was
+    touched again in the meantime. This routine assumes the lock of the image
+    section owning the mapping is held.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space that owns the
+        mapping.
+
+    VirtualAddress - Supplies the virtual address of the page to check.
+
+Return Value:
+
+    TRUE if the page is mapped and was accessed since the last check.
+
+    FALSE if the page was not accessed, is not mapped, or the architecture
+    does not track accesses in hardware.
+
+--*/
+
+{
+
+    BOOL Accessed;
+    ULONG FirstIndex;
+    volatile FIRST_LEVEL_TABLE *FirstLevelTable;
+    ULONG Offset;
+    RUNLEVEL OldRunLevel;
+    PHYSICAL_ADDRESS PageTablePhysical;
+    PPROCESSOR_BLOCK ProcessorBlock;
+    ULONG SecondIndex;
+    volatile SECOND_LEVEL_TABLE *SecondLevelTable;
+    PADDRESS_SPACE_ARM Space;
+
+    //
+    // The short descriptor format only has an access flag when the access
+    // flag enable bit is set in SCTLR, which turns AP[0] into that flag and
+    // takes away the access permission encodings used here. Emulate it
+    // instead: a page is marked old by switching its entry to the fault
+    // format while keeping the physical address, just like a page that has
+    // been made inaccessible. The next touch takes a page fault, which finds
+    // the existing mapping under the section lock and makes it present again.
+    // So a present entry means the page was accessed since the last check.
+    // The caller holds the section lock, so nothing else changes the entry.
+    //
+
+    Space = (PADDRESS_SPACE_ARM)AddressSpace;
+    FirstIndex = FLT_INDEX(VirtualAddress);
+    if (VirtualAddress >= KERNEL_VA_START) {
+        FirstLevelTable = MmKernelFirstLevelTable;
+
+    } else {
+        FirstLevelTable = Space->PageDirectory;
+    }
+
+    if ((FirstLevelTable == NULL) ||
+        (FirstLevelTable[FirstIndex].Format == FLT_UNMAPPED)) {
+
+        return FALSE;
+    }
+
+    PageTablePhysical = (ULONG)(FirstLevelTable[FirstIndex].Entry <<
+                                SLT_ALIGNMENT) & (~PAGE_MASK);
+
+    FirstIndex = ALIGN_RANGE_DOWN(FirstIndex, 4);
+    SecondIndex = SLT_INDEX(VirtualAddress);
+    Offset = (FLT_INDEX(VirtualAddress) - FirstIndex) * SLT_SIZE;
+    Accessed = FALSE;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    ProcessorBlock = KeGetCurrentProcessorBlock();
+    MmpMapPage(PageTablePhysical,
+               ProcessorBlock->SwapPage,
+               MAP_FLAG_PRESENT | MAP_FLAG_GLOBAL);
+
+    SecondLevelTable = (PSECOND_LEVEL_TABLE)(ProcessorBlock->SwapPage);
+    SecondLevelTable = (PSECOND_LEVEL_TABLE)((UINTN)SecondLevelTable + Offset);
+    if ((SecondLevelTable[SecondIndex].Entry != 0) &&
+        (SecondLevelTable[SecondIndex].Format != SLT_UNMAPPED)) {
+
+        SecondLevelTable[SecondIndex].Format = SLT_UNMAPPED;
+        MmpCleanPageTableCacheLine((PVOID)&(SecondLevelTable[SecondIndex]));
+
+        //
+        // Unlike the x86 accessed bit, the TLB entry must go. Unmap only
+        // invalidates entries that are present, so a stale translation left
+        // behind here could outlive the page it points at.
+        //
+
+        MmpSendTlbInvalidateIpi(AddressSpace, VirtualAddress, 1);
+        Accessed = TRUE;
+    }
+
+    MmpUnmapPages(ProcessorBlock->SwapPage, 1, 0, NULL);
+    KeLowerRunLevel(OldRunLevel);
+    return Accessed;
+}
+
 VOID
 MmpUnmapPageInOtherProcess (
     PADDRESS_SPACE AddressSpace,
@@ -2260,7 +2369,8 @@ MmpChangeMemoryRegionAccess (
     PVOID VirtualAddress,
     ULONG PageCount,
     ULONG MapFlags,
-    ULONG MapFlagsMask
+    ULONG MapFlagsMask,
+    PMM_TLB_BATCH TlbBatch
     )
 
 /*++
@@ -2283,6 +2393,11 @@ Routine Description:
     MapFlagsMask - Supplies the bitfield of supplied MAP_FLAG_* values that are
         valid. If in doubt, use MAP_FLAG_ALL_MASK to make all values valid.
 
+    TlbBatch - Supplies an optional pointer to a TLB invalidation batch for
+        the address space owning the range. If supplied, changed translations
+        that other processors may hold are added to the batch rather than
+        being shot down before this routine returns.
+
 Return Value:
 
     None.
@@ -2472,10 +2587,18 @@ Return Value:
     // Invalidate the TLB if any mappings were changed. This also serializes
     // execution to make the page table updates visible to page table walks.
     // These TLB invalidations must happen after the page table cache cleans.
+    // If the caller is batching invalidations, the batch flush takes care of
+    // it.
     //
 
     if (ChangedSomething != FALSE) {
-        if (SendInvalidateIpi != FALSE) {
+        if ((SendInvalidateIpi != FALSE) && (TlbBatch != NULL)) {
+
+            ASSERT(TlbBatch->AddressSpace == &(AddressSpace->Common));
+
+            MmpAddTlbBatchRange(TlbBatch, VirtualAddress, PageCount);
+
+        } else if (SendInvalidateIpi != FALSE) {
             MmpSendTlbInvalidateIpi(&(AddressSpace->Common),
                                     VirtualAddress,
                                     PageCount);
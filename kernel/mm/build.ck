@@ -47,6 +47,7 @@ function build() {
 
     baseSources = [
         "block.c",
+        "compswap.c",
         "imgsec.c",
         "info.c",
         "init.c",
@@ -0,0 +1,1706 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    compswap.c
+
+Abstract:
+
+    This module implements the compressed swap store, a pool of memory that
+    holds compressed copies of pages bound for a page file. Pages that
+    compress well are kept here instead of being written to disk, and only
+    the oldest ones are written out to their page files when the pool fills
+    up.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "mmp.h"
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// This macro reads a little endian 32-bit value from a potentially unaligned
+// byte pointer.
+//
+
+#define COMPRESSION_READ32(_Bytes)                  \
+    ((ULONG)(_Bytes)[0] |                           \
+     ((ULONG)(_Bytes)[1] << 8) |                    \
+     ((ULONG)(_Bytes)[2] << 16) |                   \
+     ((ULONG)(_Bytes)[3] << 24))
+
+//
+// This macro hashes a 32-bit sequence down to an index in the compression
+// hash table.
+//
+
+#define COMPRESSION_HASH(_Sequence) \
+    (((_Sequence) * 2654435761U) >> (32 - COMPRESSION_HASH_TABLE_BITS))
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define COMPRESSED_SWAP_ALLOCATION_TAG 0x7753634D // 'wScM'
+
+//
+// Define the granularity of the compressed swap arena.
+//
+
+#define COMPRESSED_SWAP_BLOCK_SHIFT 6
+#define COMPRESSED_SWAP_BLOCK_SIZE (1 << COMPRESSED_SWAP_BLOCK_SHIFT)
+
+//
+// Define the fraction of physical memory given to the compressed swap store,
+// and the limits on its size.
+//
+
+#define COMPRESSED_SWAP_SIZE_DIVISOR 16
+#define COMPRESSED_SWAP_MAXIMUM_SIZE (64 * _1MB)
+#define COMPRESSED_SWAP_MINIMUM_SIZE _1MB
+
+//
+// Define the number of entries allocated per page of arena. Pages compressing
+// better than this ratio are limited by entries rather than arena space.
+//
+
+#define COMPRESSED_SWAP_ENTRIES_PER_PAGE 4
+
+//
+// Define the largest compressed size worth keeping, as a fraction of a page.
+//
+
+#define COMPRESSED_SWAP_MAXIMUM_RATIO_NUMERATOR 3
+#define COMPRESSED_SWAP_MAXIMUM_RATIO_DENOMINATOR 4
+
+//
+// Define the fraction of blocks and entries that write back tries to free
+// once the store fills up.
+//
+
+#define COMPRESSED_SWAP_LOW_WATER_DIVISOR 8
+
+//
+// Define the parameters of the compressed format. Matches are at least four
+// bytes, the last five bytes are always literals, and the last match must
+// start at least twelve bytes before the end of the input.
+//
+
+#define COMPRESSION_MINIMUM_MATCH 4
+#define COMPRESSION_LAST_LITERALS 5
+#define COMPRESSION_MATCH_FIND_LIMIT 12
+#define COMPRESSION_MAXIMUM_OFFSET 0xFFFF
+#define COMPRESSION_RUN_MASK 0xF
+#define COMPRESSION_EXTENSION_BYTE 0xFF
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+/*++
+
+Structure Description:
+
+    This structure defines a page held in the compressed swap store.
+
+Members:
+
+    TreeNode - Stores the node in the tree of stored pages, sorted by page
+        file and page index.
+
+    ListEntry - Stores pointers to the next and previous entries in the list
+        of stored pages, oldest first. Free entries are kept on the free entry
+        list through this member instead.
+
+    PageFile - Stores a pointer to the page file this page belongs to.
+
+    PageIndex - Stores the index of the page within the page file.
+
+    Sequence - Stores a number unique to this particular store of the page,
+        used to notice that the page was replaced while unlocked.
+
+    Block - Stores the index of the first arena block holding the compressed
+        data.
+
+    Size - Stores the size of the compressed data in bytes. Zero indicates a
+        page of zeros, which occupies no blocks.
+
+--*/
+
+typedef struct _COMPRESSED_SWAP_ENTRY {
+    RED_BLACK_TREE_NODE TreeNode;
+    LIST_ENTRY ListEntry;
+    PPAGE_FILE PageFile;
+    UINTN PageIndex;
+    ULONG Sequence;
+    ULONG Block;
+    ULONG Size;
+} COMPRESSED_SWAP_ENTRY, *PCOMPRESSED_SWAP_ENTRY;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+MmpCompressedSwapStorePage (
+    PPAGE_FILE PageFile,
+    UINTN PageIndex
+    );
+
+PCOMPRESSED_SWAP_ENTRY
+MmpCompressedSwapLookup (
+    PPAGE_FILE PageFile,
+    UINTN PageIndex
+    );
+
+VOID
+MmpCompressedSwapRemoveRange (
+    PPAGE_FILE PageFile,
+    UINTN PageIndex,
+    UINTN PageCount
+    );
+
+VOID
+MmpCompressedSwapFreeEntry (
+    PCOMPRESSED_SWAP_ENTRY Entry
+    );
+
+BOOL
+MmpCompressedSwapAllocateBlocks (
+    ULONG BlockCount,
+    PULONG Block
+    );
+
+VOID
+MmpCompressedSwapFreeBlocks (
+    ULONG Block,
+    ULONG BlockCount
+    );
+
+COMPARISON_RESULT
+MmpCompressedSwapCompareEntries (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Set this boolean to prevent the compressed swap store from being created.
+//
+
+BOOL MmCompressedSwapDisable = FALSE;
+
+//
+// Store whether or not the compressed swap store is ready for use. This is
+// set once and never cleared.
+//
+
+BOOL MmCompressedSwapEnabled = FALSE;
+
+//
+// Store a count that is incremented every time a page leaves the store
+// because it was written back to its page file. Readers that combine page
+// file data with store data use this to notice that they raced with write
+// back.
+//
+
+volatile ULONG MmCompressedSwapGeneration;
+
+//
+// Store the lock that protects the store, and the lock that serializes write
+// back. The write back lock is acquired before any page file lock, which is
+// acquired before the store lock.
+//
+
+PQUEUED_LOCK MmCompressedSwapLock;
+PQUEUED_LOCK MmCompressedSwapWriteBackLock;
+
+//
+// Store the tree of stored pages, the list of stored pages oldest first, and
+// the list of free entries.
+//
+
+RED_BLACK_TREE MmCompressedSwapTree;
+LIST_ENTRY MmCompressedSwapListHead;
+LIST_ENTRY MmCompressedSwapFreeListHead;
+ULONG MmCompressedSwapSequence;
+
+//
+// Store the arena and the bitmap of blocks in use within it.
+//
+
+PUCHAR MmCompressedSwapArena;
+PULONG MmCompressedSwapBitmap;
+ULONG MmCompressedSwapBlockCount;
+ULONG MmCompressedSwapFreeBlockCount;
+ULONG MmCompressedSwapNextBlock;
+ULONG MmCompressedSwapEntryCount;
+ULONG MmCompressedSwapFreeEntryCount;
+
+//
+// Store the scratch buffers used while holding the store lock, and the
+// buffer used to write pages back, which is protected by the write back lock.
+// These are all allocated up front, as the paging thread is not allowed to
+// allocate memory.
+//
+
+PVOID MmCompressedSwapPage;
+PVOID MmCompressedSwapOutput;
+PUSHORT MmCompressedSwapHashTable;
+PIO_BUFFER MmCompressedSwapWriteBackBuffer;
+
+//
+// Store statistics about the compressed swap store.
+//
+
+UINTN MmCompressedSwapStoredPages;
+UINTN MmCompressedSwapStoredBytes;
+UINTN MmCompressedSwapWrittenBackPages;
+UINTN MmCompressedSwapRejectedPages;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+VOID
+MmpInitializeCompressedSwap (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets up the compressed swap store that sits in front of the
+    page files. It is called when the first page file arrives. Failure is not
+    fatal: paging then simply goes straight to the page files.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    PVOID Arena;
+    UINTN ArenaSize;
+    UINTN BitmapSize;
+    ULONG BlockCount;
+    PCOMPRESSED_SWAP_ENTRY Entries;
+    ULONG EntryCount;
+    ULONG EntryIndex;
+    PUCHAR Extra;
+    ULONG PageShift;
+    ULONG PageSize;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    if ((MmCompressedSwapDisable != FALSE) ||
+        (MmCompressedSwapEnabled != FALSE)) {
+
+        return;
+    }
+
+    Arena = NULL;
+    Extra = NULL;
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    ArenaSize = (MmTotalPhysicalPages / COMPRESSED_SWAP_SIZE_DIVISOR) <<
+                PageShift;
+
+    if (ArenaSize > COMPRESSED_SWAP_MAXIMUM_SIZE) {
+        ArenaSize = COMPRESSED_SWAP_MAXIMUM_SIZE;
+    }
+
+    //
+    // Back off on the size of the arena if memory is tight.
+    //
+
+    while (ArenaSize >= COMPRESSED_SWAP_MINIMUM_SIZE) {
+        Arena = MmAllocateNonPagedPool(ArenaSize,
+                                       COMPRESSED_SWAP_ALLOCATION_TAG);
+
+        if (Arena != NULL) {
+            break;
+        }
+
+        ArenaSize >>= 1;
+    }
+
+    if (Arena == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializeCompressedSwapEnd;
+    }
+
+    //
+    // Allocate the bitmap, entries, and scratch buffers together.
+    //
+
+    BlockCount = ArenaSize >> COMPRESSED_SWAP_BLOCK_SHIFT;
+    EntryCount = (ArenaSize >> PageShift) * COMPRESSED_SWAP_ENTRIES_PER_PAGE;
+    BitmapSize = ALIGN_RANGE_UP(BlockCount, 32) / BITS_PER_BYTE;
+    BitmapSize = ALIGN_RANGE_UP(BitmapSize, sizeof(PVOID));
+    AllocationSize = BitmapSize +
+                     (EntryCount * sizeof(COMPRESSED_SWAP_ENTRY)) +
+                     (COMPRESSION_HASH_TABLE_SIZE * sizeof(USHORT)) +
+                     (2 * PageSize);
+
+    Extra = MmAllocateNonPagedPool(AllocationSize,
+                                   COMPRESSED_SWAP_ALLOCATION_TAG);
+
+    if (Extra == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializeCompressedSwapEnd;
+    }
+
+    RtlZeroMemory(Extra, BitmapSize);
+    MmCompressedSwapBitmap = (PULONG)Extra;
+    Entries = (PCOMPRESSED_SWAP_ENTRY)(Extra + BitmapSize);
+    MmCompressedSwapHashTable = (PUSHORT)(Entries + EntryCount);
+    MmCompressedSwapPage = MmCompressedSwapHashTable +
+                           COMPRESSION_HASH_TABLE_SIZE;
+
+    MmCompressedSwapOutput = (PUCHAR)MmCompressedSwapPage + PageSize;
+    MmCompressedSwapLock = KeCreateQueuedLock();
+    MmCompressedSwapWriteBackLock = KeCreateQueuedLock();
+    if ((MmCompressedSwapLock == NULL) ||
+        (MmCompressedSwapWriteBackLock == NULL)) {
+
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializeCompressedSwapEnd;
+    }
+
+    MmCompressedSwapWriteBackBuffer = MmAllocateNonPagedIoBuffer(
+                                                 0,
+                                                 MAX_ULONGLONG,
+                                                 0,
+                                                 PageSize,
+                                                 IO_BUFFER_FLAG_MEMORY_LOCKED);
+
+    if (MmCompressedSwapWriteBackBuffer == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto InitializeCompressedSwapEnd;
+    }
+
+    RtlRedBlackTreeInitialize(&MmCompressedSwapTree,
+                              0,
+                              MmpCompressedSwapCompareEntries);
+
+    INITIALIZE_LIST_HEAD(&MmCompressedSwapListHead);
+    INITIALIZE_LIST_HEAD(&MmCompressedSwapFreeListHead);
+    for (EntryIndex = 0; EntryIndex < EntryCount; EntryIndex += 1) {
+        INSERT_BEFORE(&(Entries[EntryIndex].ListEntry),
+                      &MmCompressedSwapFreeListHead);
+    }
+
+    MmCompressedSwapArena = Arena;
+    MmCompressedSwapBlockCount = BlockCount;
+    MmCompressedSwapFreeBlockCount = BlockCount;
+    MmCompressedSwapNextBlock = 0;
+    MmCompressedSwapEntryCount = EntryCount;
+    MmCompressedSwapFreeEntryCount = EntryCount;
+
+    //
+    // Make sure everything is visible before the store is, as the enabled
+    // flag is checked without the lock.
+    //
+
+    RtlMemoryBarrier();
+    MmCompressedSwapEnabled = TRUE;
+    Status = STATUS_SUCCESS;
+
+InitializeCompressedSwapEnd:
+    if (!KSUCCESS(Status)) {
+        if (MmCompressedSwapWriteBackBuffer != NULL) {
+            MmFreeIoBuffer(MmCompressedSwapWriteBackBuffer);
+            MmCompressedSwapWriteBackBuffer = NULL;
+        }
+
+        if (MmCompressedSwapLock != NULL) {
+            KeDestroyQueuedLock(MmCompressedSwapLock);
+            MmCompressedSwapLock = NULL;
+        }
+
+        if (MmCompressedSwapWriteBackLock != NULL) {
+            KeDestroyQueuedLock(MmCompressedSwapWriteBackLock);
+            MmCompressedSwapWriteBackLock = NULL;
+        }
+
+        if (Extra != NULL) {
+            MmFreeNonPagedPool(Extra);
+        }
+
+        if (Arena != NULL) {
+            MmFreeNonPagedPool(Arena);
+        }
+
+        RtlDebugPrint("Compressed swap disabled: %d\n", Status);
+    }
+
+    return;
+}
+
+KSTATUS
+MmpCompressedSwapWrite (
+    PPAGE_FILE PageFile,
+    UINTN PageIndex,
+    UINTN PageCount,
+    PIO_BUFFER IoBuffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to store a run of page file pages in compressed
+    memory instead of writing them to the page file. Either every page is
+    stored, or none of them are and any older copies are discarded.
+
+Arguments:
+
+    PageFile - Supplies a pointer to the page file the pages belong to.
+
+    PageIndex - Supplies the index of the first page within the page file.
+
+    PageCount - Supplies the number of pages to store.
+
+    IoBuffer - Supplies a pointer to the I/O buffer containing the data,
+        starting at its current offset.
+
+Return Value:
+
+    STATUS_SUCCESS if all pages were stored.
+
+    STATUS_INSUFFICIENT_RESOURCES if the store is full.
+
+    STATUS_NOT_SUPPORTED if the store is disabled or the data does not
+    compress well enough to be worth keeping.
+
+    Other errors if the I/O buffer could not be read.
+
+--*/
+
+{
+
+    UINTN Index;
+    ULONG PageShift;
+    KSTATUS Status;
+
+    if (MmCompressedSwapEnabled == FALSE) {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    PageShift = MmPageShift();
+    Status = STATUS_SUCCESS;
+    KeAcquireQueuedLock(MmCompressedSwapLock);
+    for (Index = 0; Index < PageCount; Index += 1) {
+        Status = MmCopyIoBufferData(IoBuffer,
+                                    MmCompressedSwapPage,
+                                    Index << PageShift,
+                                    1 << PageShift,
+                                    FALSE);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        Status = MmpCompressedSwapStorePage(PageFile, PageIndex + Index);
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+    }
+
+    //
+    // On failure the whole run goes to the page file, so the store must not
+    // keep any copies of it, old or new.
+    //
+
+    if (!KSUCCESS(Status)) {
+        MmpCompressedSwapRemoveRange(PageFile, PageIndex, PageCount);
+        if (Status == STATUS_NOT_SUPPORTED) {
+            MmCompressedSwapRejectedPages += PageCount;
+        }
+    }
+
+    KeReleaseQueuedLock(MmCompressedSwapLock);
+    return Status;
+}
+
+KSTATUS
+MmpCompressedSwapRead (
+    PPAGE_FILE PageFile,
+    UINTN PageIndex,
+    UINTN PageCount,
+    PIO_BUFFER IoBuffer,
+    BOOL Partial
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads a run of page file pages out of the compressed store.
+
+Arguments:
+
+    PageFile - Supplies a pointer to the page file the pages belong to.
+
+    PageIndex - Supplies the index of the first page within the page file.
+
+    PageCount - Supplies the number of pages to read.
+
+    IoBuffer - Supplies a pointer to the I/O buffer to decompress into,
+        starting at its current offset.
+
+    Partial - Supplies a boolean indicating whether to copy out whichever
+        pages are present (TRUE) or to copy nothing unless every page is
+        present (FALSE).
+
+Return Value:
+
+    STATUS_SUCCESS if every page was found and copied.
+
+    STATUS_NOT_FOUND if at least one page is not in the store.
+
+    Other errors if the I/O buffer could not be written or the compressed
+    data is corrupt.
+
+--*/
+
+{
+
+    PCOMPRESSED_SWAP_ENTRY Entry;
+    UINTN Index;
+    ULONG PageShift;
+    ULONG PageSize;
+    KSTATUS Result;
+    KSTATUS Status;
+    BOOL Valid;
+
+    if (MmCompressedSwapEnabled == FALSE) {
+        return STATUS_NOT_FOUND;
+    }
+
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    Result = STATUS_SUCCESS;
+    KeAcquireQueuedLock(MmCompressedSwapLock);
+    if (Partial == FALSE) {
+        for (Index = 0; Index < PageCount; Index += 1) {
+            Entry = MmpCompressedSwapLookup(PageFile, PageIndex + Index);
+            if (Entry == NULL) {
+                Result = STATUS_NOT_FOUND;
+                goto CompressedSwapReadEnd;
+            }
+        }
+    }
+
+    for (Index = 0; Index < PageCount; Index += 1) {
+        Entry = MmpCompressedSwapLookup(PageFile, PageIndex + Index);
+        if (Entry == NULL) {
+            Result = STATUS_NOT_FOUND;
+            continue;
+        }
+
+        if (Entry->Size == 0) {
+            RtlZeroMemory(MmCompressedSwapPage, PageSize);
+
+        } else {
+            Valid = MmpDecompressPage(
+                MmCompressedSwapArena +
+                (Entry->Block << COMPRESSED_SWAP_BLOCK_SHIFT),
+                Entry->Size,
+                MmCompressedSwapPage,
+                PageSize);
+
+            if (Valid == FALSE) {
+
+                ASSERT(FALSE);
+
+                Result = STATUS_FILE_CORRUPT;
+                goto CompressedSwapReadEnd;
+            }
+        }
+
+        Status = MmCopyIoBufferData(IoBuffer,
+                                    MmCompressedSwapPage,
+                                    Index << PageShift,
+                                    PageSize,
+                                    TRUE);
+
+        if (!KSUCCESS(Status)) {
+            Result = Status;
+            goto CompressedSwapReadEnd;
+        }
+    }
+
+CompressedSwapReadEnd:
+    KeReleaseQueuedLock(MmCompressedSwapLock);
+    return Result;
+}
+
+VOID
+MmpCompressedSwapInvalidate (
+    PPAGE_FILE PageFile,
+    UINTN PageIndex,
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine discards any compressed copies of the given page file pages.
+
+Arguments:
+
+    PageFile - Supplies a pointer to the page file the pages belong to.
+
+    PageIndex - Supplies the index of the first page within the page file.
+
+    PageCount - Supplies the number of pages to discard.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (MmCompressedSwapEnabled == FALSE) {
+        return;
+    }
+
+    KeAcquireQueuedLock(MmCompressedSwapLock);
+    MmpCompressedSwapRemoveRange(PageFile, PageIndex, PageCount);
+    KeReleaseQueuedLock(MmCompressedSwapLock);
+    return;
+}
+
+VOID
+MmpCompressedSwapWriteBack (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes the least recently stored compressed pages out to
+    their page files until the store has a reasonable amount of space free.
+    This routine must be called at low level without any page file locks
+    held.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID Buffer;
+    UINTN BytesCompleted;
+    PCOMPRESSED_SWAP_ENTRY Entry;
+    BOOL Fits;
+    ULONG PageShift;
+    ULONG PageSize;
+    PPAGE_FILE PageFile;
+    UINTN PageIndex;
+    ULONG Sequence;
+    KSTATUS Status;
+    BOOL Valid;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    if (MmCompressedSwapEnabled == FALSE) {
+        return;
+    }
+
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    Buffer = MmCompressedSwapWriteBackBuffer->Fragment[0].VirtualAddress;
+    KeAcquireQueuedLock(MmCompressedSwapWriteBackLock);
+    while (TRUE) {
+        KeAcquireQueuedLock(MmCompressedSwapLock);
+        Fits = FALSE;
+        if ((MmCompressedSwapFreeBlockCount >=
+             (MmCompressedSwapBlockCount /
+              COMPRESSED_SWAP_LOW_WATER_DIVISOR)) &&
+            (MmCompressedSwapFreeEntryCount >=
+             (MmCompressedSwapEntryCount /
+              COMPRESSED_SWAP_LOW_WATER_DIVISOR))) {
+
+            Fits = TRUE;
+        }
+
+        if ((Fits != FALSE) || (LIST_EMPTY(&MmCompressedSwapListHead))) {
+            KeReleaseQueuedLock(MmCompressedSwapLock);
+            break;
+        }
+
+        //
+        // Decompress the oldest page into the write back buffer.
+        //
+
+        Entry = LIST_VALUE(MmCompressedSwapListHead.Next,
+                           COMPRESSED_SWAP_ENTRY,
+                           ListEntry);
+
+        PageFile = Entry->PageFile;
+        PageIndex = Entry->PageIndex;
+        Sequence = Entry->Sequence;
+        Valid = TRUE;
+        if (Entry->Size == 0) {
+            RtlZeroMemory(Buffer, PageSize);
+
+        } else {
+            Valid = MmpDecompressPage(
+                MmCompressedSwapArena +
+                (Entry->Block << COMPRESSED_SWAP_BLOCK_SHIFT),
+                Entry->Size,
+                Buffer,
+                PageSize);
+        }
+
+        KeReleaseQueuedLock(MmCompressedSwapLock);
+        if (Valid == FALSE) {
+
+            ASSERT(FALSE);
+
+            break;
+        }
+
+        //
+        // Write the page out under the page file lock, but only if it was not
+        // replaced or freed while the store was unlocked. A replacement
+        // arriving after this check is fine, as the store copy wins. A page
+        // file write arriving after this check waits for the page file lock,
+        // and so lands after this stale copy.
+        //
+
+        BytesCompleted = 0;
+        Status = STATUS_SUCCESS;
+        KeAcquireQueuedLock(PageFile->Lock);
+        KeAcquireQueuedLock(MmCompressedSwapLock);
+        Entry = MmpCompressedSwapLookup(PageFile, PageIndex);
+        Valid = FALSE;
+        if ((Entry != NULL) && (Entry->Sequence == Sequence)) {
+            Valid = TRUE;
+        }
+
+        KeReleaseQueuedLock(MmCompressedSwapLock);
+        if (Valid != FALSE) {
+            Status = IoWriteAtOffset(PageFile->Handle,
+                                     MmCompressedSwapWriteBackBuffer,
+                                     (IO_OFFSET)PageIndex << PageShift,
+                                     PageSize,
+                                     IO_FLAG_NO_ALLOCATE,
+                                     WAIT_TIME_INDEFINITE,
+                                     &BytesCompleted,
+                                     PageFile->PagingOutIrp);
+        }
+
+        KeReleaseQueuedLock(PageFile->Lock);
+        if (Valid == FALSE) {
+            continue;
+        }
+
+        if ((!KSUCCESS(Status)) || (BytesCompleted != PageSize)) {
+            RtlDebugPrint("Compressed swap write back failed: %d\n", Status);
+            break;
+        }
+
+        //
+        // Now that the page file has the data, drop the compressed copy,
+        // unless it was replaced during the write.
+        //
+
+        KeAcquireQueuedLock(MmCompressedSwapLock);
+        Entry = MmpCompressedSwapLookup(PageFile, PageIndex);
+        if ((Entry != NULL) && (Entry->Sequence == Sequence)) {
+            MmpCompressedSwapFreeEntry(Entry);
+            MmCompressedSwapWrittenBackPages += 1;
+            MmCompressedSwapGeneration += 1;
+        }
+
+        KeReleaseQueuedLock(MmCompressedSwapLock);
+    }
+
+    KeReleaseQueuedLock(MmCompressedSwapWriteBackLock);
+    return;
+}
+
+VOID
+MmpGetCompressedSwapStatistics (
+    PMM_STATISTICS Statistics
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills out the compressed swap portion of the given memory
+    statistics structure.
+
+Arguments:
+
+    Statistics - Supplies a pointer to the statistics to fill in.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    if (MmCompressedSwapEnabled == FALSE) {
+        return;
+    }
+
+    Statistics->CompressedSwapCapacity =
+               (UINTN)MmCompressedSwapBlockCount << COMPRESSED_SWAP_BLOCK_SHIFT;
+
+    Statistics->CompressedSwapPages = MmCompressedSwapStoredPages;
+    Statistics->CompressedSwapBytes = MmCompressedSwapStoredBytes;
+    Statistics->CompressedSwapWrittenBackPages =
+                                              MmCompressedSwapWrittenBackPages;
+
+    Statistics->CompressedSwapRejectedPages = MmCompressedSwapRejectedPages;
+    return;
+}
+
+ULONG
+MmpCompressPage (
+    PVOID Source,
+    ULONG SourceSize,
+    PVOID Destination,
+    ULONG DestinationSize,
+    PUSHORT HashTable
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compresses a buffer with a fast LZ77 codec that uses the LZ4
+    block format.
+
+Arguments:
+
+    Source - Supplies a pointer to the data to compress.
+
+    SourceSize - Supplies the size of the data in bytes. This must be less
+        than 64 kilobytes.
+
+    Destination - Supplies a pointer where the compressed data is returned.
+
+    DestinationSize - Supplies the size of the destination buffer in bytes.
+
+    HashTable - Supplies a pointer to scratch space of
+        COMPRESSION_HASH_TABLE_SIZE entries used to find matches.
+
+Return Value:
+
+    Returns the size of the compressed data in bytes.
+
+    0 if the compressed data did not fit in the destination buffer.
+
+--*/
+
+{
+
+    PUCHAR Anchor;
+    PUCHAR Candidate;
+    ULONG Hash;
+    PUCHAR Input;
+    PUCHAR InputEnd;
+    PUCHAR InputStart;
+    UINTN Length;
+    PUCHAR MatchLimit;
+    UINTN MatchLength;
+    UINTN Offset;
+    PUCHAR Output;
+    PUCHAR OutputEnd;
+    UINTN Remaining;
+    PUCHAR SearchLimit;
+    ULONG Sequence;
+    PUCHAR Token;
+
+    ASSERT(SourceSize <= COMPRESSION_MAXIMUM_OFFSET + 1);
+
+    RtlZeroMemory(HashTable, COMPRESSION_HASH_TABLE_SIZE * sizeof(USHORT));
+    InputStart = Source;
+    Input = InputStart;
+    Anchor = InputStart;
+    InputEnd = InputStart + SourceSize;
+    Output = Destination;
+    OutputEnd = Output + DestinationSize;
+    SearchLimit = InputStart;
+    MatchLimit = InputStart;
+    if (SourceSize > COMPRESSION_MATCH_FIND_LIMIT) {
+        SearchLimit = InputEnd - COMPRESSION_MATCH_FIND_LIMIT;
+        MatchLimit = InputEnd - COMPRESSION_LAST_LITERALS;
+    }
+
+    while (Input < SearchLimit) {
+        Sequence = COMPRESSION_READ32(Input);
+        Hash = COMPRESSION_HASH(Sequence);
+        Candidate = InputStart + HashTable[Hash];
+        HashTable[Hash] = Input - InputStart;
+        if ((Candidate >= Input) ||
+            (COMPRESSION_READ32(Candidate) != Sequence)) {
+
+            Input += 1;
+            continue;
+        }
+
+        MatchLength = COMPRESSION_MINIMUM_MATCH;
+        while ((Input + MatchLength < MatchLimit) &&
+               (Candidate[MatchLength] == Input[MatchLength])) {
+
+            MatchLength += 1;
+        }
+
+        //
+        // Make sure the whole sequence fits: a token, the literal length
+        // extension, the literals, an offset, and the match length extension.
+        //
+
+        Length = Input - Anchor;
+        Remaining = 1 + (Length / COMPRESSION_EXTENSION_BYTE) + 1 + Length +
+                    2 + (MatchLength / COMPRESSION_EXTENSION_BYTE) + 1;
+
+        if (Remaining > (UINTN)(OutputEnd - Output)) {
+            return 0;
+        }
+
+        Token = Output;
+        Output += 1;
+        if (Length >= COMPRESSION_RUN_MASK) {
+            *Token = COMPRESSION_RUN_MASK << 4;
+            Remaining = Length - COMPRESSION_RUN_MASK;
+            while (Remaining >= COMPRESSION_EXTENSION_BYTE) {
+                *Output = COMPRESSION_EXTENSION_BYTE;
+                Output += 1;
+                Remaining -= COMPRESSION_EXTENSION_BYTE;
+            }
+
+            *Output = Remaining;
+            Output += 1;
+
+        } else {
+            *Token = Length << 4;
+        }
+
+        RtlCopyMemory(Output, Anchor, Length);
+        Output += Length;
+        Offset = Input - Candidate;
+
+        ASSERT((Offset != 0) && (Offset <= COMPRESSION_MAXIMUM_OFFSET));
+
+        *Output = (UCHAR)Offset;
+        Output += 1;
+        *Output = (UCHAR)(Offset >> 8);
+        Output += 1;
+        Length = MatchLength - COMPRESSION_MINIMUM_MATCH;
+        if (Length >= COMPRESSION_RUN_MASK) {
+            *Token |= COMPRESSION_RUN_MASK;
+            Remaining = Length - COMPRESSION_RUN_MASK;
+            while (Remaining >= COMPRESSION_EXTENSION_BYTE) {
+                *Output = COMPRESSION_EXTENSION_BYTE;
+                Output += 1;
+                Remaining -= COMPRESSION_EXTENSION_BYTE;
+            }
+
+            *Output = Remaining;
+            Output += 1;
+
+        } else {
+            *Token |= Length;
+        }
+
+        Input += MatchLength;
+        Anchor = Input;
+    }
+
+    //
+    // Emit the remaining input as a final run of literals with no match.
+    //
+
+    Length = InputEnd - Anchor;
+    Remaining = 1 + (Length / COMPRESSION_EXTENSION_BYTE) + 1 + Length;
+    if (Remaining > (UINTN)(OutputEnd - Output)) {
+        return 0;
+    }
+
+    Token = Output;
+    Output += 1;
+    if (Length >= COMPRESSION_RUN_MASK) {
+        *Token = COMPRESSION_RUN_MASK << 4;
+        Remaining = Length - COMPRESSION_RUN_MASK;
+        while (Remaining >= COMPRESSION_EXTENSION_BYTE) {
+            *Output = COMPRESSION_EXTENSION_BYTE;
+            Output += 1;
+            Remaining -= COMPRESSION_EXTENSION_BYTE;
+        }
+
+        *Output = Remaining;
+        Output += 1;
+
+    } else {
+        *Token = Length << 4;
+    }
+
+    RtlCopyMemory(Output, Anchor, Length);
+    Output += Length;
+    return Output - (PUCHAR)Destination;
+}
+
+BOOL
+MmpDecompressPage (
+    PVOID Source,
+    ULONG SourceSize,
+    PVOID Destination,
+    ULONG DestinationSize
+    )
+
+/*++
+
+Routine Description:
+
+    This routine decompresses data produced by the compress page routine.
+
+Arguments:
+
+    Source - Supplies a pointer to the compressed data.
+
+    SourceSize - Supplies the size of the compressed data in bytes.
+
+    Destination - Supplies a pointer where the decompressed data is returned.
+
+    DestinationSize - Supplies the exact size of the decompressed data.
+
+Return Value:
+
+    TRUE if the data decompressed to exactly the destination size.
+
+    FALSE if the compressed data is corrupt.
+
+--*/
+
+{
+
+    UCHAR Byte;
+    PUCHAR Input;
+    PUCHAR InputEnd;
+    UINTN Length;
+    PUCHAR Match;
+    UINTN Offset;
+    PUCHAR Output;
+    PUCHAR OutputEnd;
+    PUCHAR OutputStart;
+    UCHAR Token;
+
+    Input = Source;
+    InputEnd = Input + SourceSize;
+    OutputStart = Destination;
+    Output = OutputStart;
+    OutputEnd = Output + DestinationSize;
+    while (Input < InputEnd) {
+        Token = *Input;
+        Input += 1;
+
+        //
+        // Copy the literals.
+        //
+
+        Length = Token >> 4;
+        if (Length == COMPRESSION_RUN_MASK) {
+            do {
+                if (Input >= InputEnd) {
+                    return FALSE;
+                }
+
+                Byte = *Input;
+                Input += 1;
+                Length += Byte;
+
+            } while (Byte == COMPRESSION_EXTENSION_BYTE);
+        }
+
+        if ((Length > (UINTN)(InputEnd - Input)) ||
+            (Length > (UINTN)(OutputEnd - Output))) {
+
+            return FALSE;
+        }
+
+        RtlCopyMemory(Output, Input, Length);
+        Input += Length;
+        Output += Length;
+
+        //
+        // The last sequence has literals only.
+        //
+
+        if (Input == InputEnd) {
+            break;
+        }
+
+        //
+        // Copy the match, which may overlap the output being produced.
+        //
+
+        if ((InputEnd - Input) < 2) {
+            return FALSE;
+        }
+
+        Offset = Input[0] | (Input[1] << 8);
+        Input += 2;
+        if ((Offset == 0) || (Offset > (UINTN)(Output - OutputStart))) {
+            return FALSE;
+        }
+
+        Length = Token & COMPRESSION_RUN_MASK;
+        if (Length == COMPRESSION_RUN_MASK) {
+            do {
+                if (Input >= InputEnd) {
+                    return FALSE;
+                }
+
+                Byte = *Input;
+                Input += 1;
+                Length += Byte;
+
+            } while (Byte == COMPRESSION_EXTENSION_BYTE);
+        }
+
+        Length += COMPRESSION_MINIMUM_MATCH;
+        if (Length > (UINTN)(OutputEnd - Output)) {
+            return FALSE;
+        }
+
+        Match = Output - Offset;
+        while (Length != 0) {
+            *Output = *Match;
+            Output += 1;
+            Match += 1;
+            Length -= 1;
+        }
+    }
+
+    if (Output != OutputEnd) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+MmpCompressedSwapStorePage (
+    PPAGE_FILE PageFile,
+    UINTN PageIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compresses the page in the scratch page buffer and stores it
+    as the given page file page, replacing any existing copy. This routine
+    assumes the store lock is held.
+
+Arguments:
+
+    PageFile - Supplies a pointer to the page file the page belongs to.
+
+    PageIndex - Supplies the index of the page within the page file.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_NOT_SUPPORTED if the page does not compress well enough.
+
+    STATUS_INSUFFICIENT_RESOURCES if the store is full.
+
+--*/
+
+{
+
+    ULONG Block;
+    ULONG BlockCount;
+    PCOMPRESSED_SWAP_ENTRY Entry;
+    UINTN Index;
+    ULONG Limit;
+    PUINTN Page;
+    ULONG PageSize;
+    ULONG Size;
+
+    PageSize = MmPageSize();
+
+    //
+    // Pages of zeros are common enough to be worth spotting up front, and
+    // take no space at all.
+    //
+
+    Page = MmCompressedSwapPage;
+    for (Index = 0; Index < PageSize / sizeof(UINTN); Index += 1) {
+        if (Page[Index] != 0) {
+            break;
+        }
+    }
+
+    Size = 0;
+    if (Index != PageSize / sizeof(UINTN)) {
+        Limit = (PageSize * COMPRESSED_SWAP_MAXIMUM_RATIO_NUMERATOR) /
+                COMPRESSED_SWAP_MAXIMUM_RATIO_DENOMINATOR;
+
+        Size = MmpCompressPage(MmCompressedSwapPage,
+                               PageSize,
+                               MmCompressedSwapOutput,
+                               Limit,
+                               MmCompressedSwapHashTable);
+
+        if (Size == 0) {
+            return STATUS_NOT_SUPPORTED;
+        }
+    }
+
+    //
+    // Drop the old copy first so that its space can be reused.
+    //
+
+    Entry = MmpCompressedSwapLookup(PageFile, PageIndex);
+    if (Entry != NULL) {
+        MmpCompressedSwapFreeEntry(Entry);
+    }
+
+    if (LIST_EMPTY(&MmCompressedSwapFreeListHead)) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Block = 0;
+    BlockCount = ALIGN_RANGE_UP(Size, COMPRESSED_SWAP_BLOCK_SIZE) >>
+                 COMPRESSED_SWAP_BLOCK_SHIFT;
+
+    if (BlockCount != 0) {
+        if (MmpCompressedSwapAllocateBlocks(BlockCount, &Block) == FALSE) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlCopyMemory(MmCompressedSwapArena +
+                      (Block << COMPRESSED_SWAP_BLOCK_SHIFT),
+                      MmCompressedSwapOutput,
+                      Size);
+    }
+
+    Entry = LIST_VALUE(MmCompressedSwapFreeListHead.Next,
+                       COMPRESSED_SWAP_ENTRY,
+                       ListEntry);
+
+    LIST_REMOVE(&(Entry->ListEntry));
+    MmCompressedSwapFreeEntryCount -= 1;
+    MmCompressedSwapSequence += 1;
+    Entry->PageFile = PageFile;
+    Entry->PageIndex = PageIndex;
+    Entry->Sequence = MmCompressedSwapSequence;
+    Entry->Block = Block;
+    Entry->Size = Size;
+    RtlRedBlackTreeInsert(&MmCompressedSwapTree, &(Entry->TreeNode));
+    INSERT_BEFORE(&(Entry->ListEntry), &MmCompressedSwapListHead);
+    MmCompressedSwapStoredPages += 1;
+    MmCompressedSwapStoredBytes += Size;
+    return STATUS_SUCCESS;
+}
+
+PCOMPRESSED_SWAP_ENTRY
+MmpCompressedSwapLookup (
+    PPAGE_FILE PageFile,
+    UINTN PageIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the stored copy of a page file page. This routine
+    assumes the store lock is held.
+
+Arguments:
+
+    PageFile - Supplies a pointer to the page file the page belongs to.
+
+    PageIndex - Supplies the index of the page within the page file.
+
+Return Value:
+
+    Returns a pointer to the entry for the page on success.
+
+    NULL if the page is not in the store.
+
+--*/
+
+{
+
+    PRED_BLACK_TREE_NODE FoundNode;
+    COMPRESSED_SWAP_ENTRY Search;
+
+    Search.PageFile = PageFile;
+    Search.PageIndex = PageIndex;
+    FoundNode = RtlRedBlackTreeSearch(&MmCompressedSwapTree,
+                                      &(Search.TreeNode));
+
+    if (FoundNode == NULL) {
+        return NULL;
+    }
+
+    return RED_BLACK_TREE_VALUE(FoundNode, COMPRESSED_SWAP_ENTRY, TreeNode);
+}
+
+VOID
+MmpCompressedSwapRemoveRange (
+    PPAGE_FILE PageFile,
+    UINTN PageIndex,
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees any stored copies of the given page file pages. This
+    routine assumes the store lock is held.
+
+Arguments:
+
+    PageFile - Supplies a pointer to the page file the pages belong to.
+
+    PageIndex - Supplies the index of the first page within the page file.
+
+    PageCount - Supplies the number of pages to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PCOMPRESSED_SWAP_ENTRY Entry;
+    PRED_BLACK_TREE_NODE NextNode;
+    PRED_BLACK_TREE_NODE Node;
+    COMPRESSED_SWAP_ENTRY Search;
+
+    Search.PageFile = PageFile;
+    Search.PageIndex = PageIndex;
+    Node = RtlRedBlackTreeSearchClosest(&MmCompressedSwapTree,
+                                        &(Search.TreeNode),
+                                        TRUE);
+
+    while (Node != NULL) {
+        Entry = RED_BLACK_TREE_VALUE(Node, COMPRESSED_SWAP_ENTRY, TreeNode);
+        if ((Entry->PageFile != PageFile) ||
+            (Entry->PageIndex >= PageIndex + PageCount)) {
+
+            break;
+        }
+
+        NextNode = RtlRedBlackTreeGetNextNode(&MmCompressedSwapTree,
+                                              FALSE,
+                                              Node);
+
+        MmpCompressedSwapFreeEntry(Entry);
+        Node = NextNode;
+    }
+
+    return;
+}
+
+VOID
+MmpCompressedSwapFreeEntry (
+    PCOMPRESSED_SWAP_ENTRY Entry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a page from the store and releases its space. This
+    routine assumes the store lock is held.
+
+Arguments:
+
+    Entry - Supplies a pointer to the entry to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG BlockCount;
+
+    RtlRedBlackTreeRemove(&MmCompressedSwapTree, &(Entry->TreeNode));
+    LIST_REMOVE(&(Entry->ListEntry));
+    BlockCount = ALIGN_RANGE_UP(Entry->Size, COMPRESSED_SWAP_BLOCK_SIZE) >>
+                 COMPRESSED_SWAP_BLOCK_SHIFT;
+
+    if (BlockCount != 0) {
+        MmpCompressedSwapFreeBlocks(Entry->Block, BlockCount);
+    }
+
+    MmCompressedSwapStoredPages -= 1;
+    MmCompressedSwapStoredBytes -= Entry->Size;
+    Entry->PageFile = NULL;
+    INSERT_BEFORE(&(Entry->ListEntry), &MmCompressedSwapFreeListHead);
+    MmCompressedSwapFreeEntryCount += 1;
+    return;
+}
+
+BOOL
+MmpCompressedSwapAllocateBlocks (
+    ULONG BlockCount,
+    PULONG Block
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a run of contiguous arena blocks, searching onward
+    from where the last allocation left off. This routine assumes the store
+    lock is held.
+
+Arguments:
+
+    BlockCount - Supplies the number of blocks to allocate.
+
+    Block - Supplies a pointer where the index of the first block is returned.
+
+Return Value:
+
+    TRUE on success.
+
+    FALSE if no run of free blocks is large enough.
+
+--*/
+
+{
+
+    ULONG Current;
+    ULONG Index;
+    ULONG RunLength;
+    ULONG RunStart;
+    ULONG Searched;
+    ULONG Total;
+
+    Total = MmCompressedSwapBlockCount;
+    if (MmCompressedSwapFreeBlockCount < BlockCount) {
+        return FALSE;
+    }
+
+    //
+    // Scan one lap of the arena. Runs cannot wrap around the end, so the
+    // run restarts there.
+    //
+
+    Current = MmCompressedSwapNextBlock;
+    if (Current >= Total) {
+        Current = 0;
+    }
+
+    RunLength = 0;
+    RunStart = Current;
+    Searched = 0;
+    while (Searched < Total + BlockCount) {
+        if (Current == Total) {
+            Current = 0;
+            RunLength = 0;
+            RunStart = 0;
+        }
+
+        //
+        // Skip over completely full words quickly.
+        //
+
+        if (((Current % 32) == 0) &&
+            (MmCompressedSwapBitmap[Current / 32] == MAX_ULONG)) {
+
+            Current += 32;
+            Searched += 32;
+            RunLength = 0;
+            RunStart = Current;
+            continue;
+        }
+
+        if ((MmCompressedSwapBitmap[Current / 32] &
+             (1 << (Current % 32))) != 0) {
+
+            RunLength = 0;
+            RunStart = Current + 1;
+
+        } else {
+            RunLength += 1;
+            if (RunLength == BlockCount) {
+                for (Index = RunStart; Index <= Current; Index += 1) {
+                    MmCompressedSwapBitmap[Index / 32] |= 1 << (Index % 32);
+                }
+
+                MmCompressedSwapFreeBlockCount -= BlockCount;
+                MmCompressedSwapNextBlock = Current + 1;
+                *Block = RunStart;
+                return TRUE;
+            }
+        }
+
+        Current += 1;
+        Searched += 1;
+    }
+
+    return FALSE;
+}
+
+VOID
+MmpCompressedSwapFreeBlocks (
+    ULONG Block,
+    ULONG BlockCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a run of arena blocks. This routine assumes the store
+    lock is held.
+
+Arguments:
+
+    Block - Supplies the index of the first block to free.
+
+    BlockCount - Supplies the number of blocks to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+
+    for (Index = Block; Index < Block + BlockCount; Index += 1) {
+
+        ASSERT((MmCompressedSwapBitmap[Index / 32] &
+                (1 << (Index % 32))) != 0);
+
+        MmCompressedSwapBitmap[Index / 32] &= ~(1 << (Index % 32));
+    }
+
+    MmCompressedSwapFreeBlockCount += BlockCount;
+    return;
+}
+
+COMPARISON_RESULT
+MmpCompressedSwapCompareEntries (
+    PRED_BLACK_TREE Tree,
+    PRED_BLACK_TREE_NODE FirstNode,
+    PRED_BLACK_TREE_NODE SecondNode
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares two compressed swap entries by page file and then
+    by page index.
+
+Arguments:
+
+    Tree - Supplies a pointer to the Red-Black tree that owns both nodes.
+
+    FirstNode - Supplies a pointer to the left side of the comparison.
+
+    SecondNode - Supplies a pointer to the second side of the comparison.
+
+Return Value:
+
+    Same if the two nodes have the same value.
+
+    Ascending if the first node is less than the second node.
+
+    Descending if the second node is less than the first node.
+
+--*/
+
+{
+
+    PCOMPRESSED_SWAP_ENTRY First;
+    PCOMPRESSED_SWAP_ENTRY Second;
+
+    First = RED_BLACK_TREE_VALUE(FirstNode, COMPRESSED_SWAP_ENTRY, TreeNode);
+    Second = RED_BLACK_TREE_VALUE(SecondNode, COMPRESSED_SWAP_ENTRY, TreeNode);
+    if (First->PageFile < Second->PageFile) {
+        return ComparisonResultAscending;
+
+    } else if (First->PageFile > Second->PageFile) {
+        return ComparisonResultDescending;
+    }
+
+    if (First->PageIndex < Second->PageIndex) {
+        return ComparisonResultAscending;
+
+    } else if (First->PageIndex > Second->PageIndex) {
+        return ComparisonResultDescending;
+    }
+
+    return ComparisonResultSame;
+}
+
@@ -254,6 +254,15 @@ Return Value:
                               Status);
             }
 
+            //
+            // Map any neighboring pages that are already sitting in the page
+            // cache to save the faults that sequential access would take.
+            //
+
+            if (KSUCCESS(Status)) {
+                MmpFaultAroundSection(ImageSection, PageOffset);
+            }
+
         //
         // The page was there and the access was not in violation, so this must
         // be a write on a read only page.
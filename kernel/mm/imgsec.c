@@ -98,13 +98,15 @@ MmpClipImageSection (
     PLIST_ENTRY SectionListHead,
     PVOID Address,
     UINTN Size,
-    PIMAGE_SECTION Section
+    PIMAGE_SECTION Section,
+    PMM_TLB_BATCH TlbBatch
     );
 
 VOID
 MmpRemoveImageSection (
     PIMAGE_SECTION Section,
-    BOOL AddressSpaceLockHeld
+    BOOL AddressSpaceLockHeld,
+    PMM_TLB_BATCH TlbBatch
     );
 
 VOID
@@ -115,7 +117,8 @@ MmpDeleteImageSection (
 KSTATUS
 MmpChangeImageSectionAccess (
     PIMAGE_SECTION Section,
-    ULONG NewAccess
+    ULONG NewAccess,
+    PMM_TLB_BATCH TlbBatch
     );
 
 KSTATUS
@@ -123,7 +126,8 @@ MmpUnmapImageSection (
     PIMAGE_SECTION Section,
     UINTN PageOffset,
     UINTN PageCount,
-    ULONG Flags
+    ULONG Flags,
+    PMM_TLB_BATCH TlbBatch
     );
 
 BOOL
@@ -135,7 +139,8 @@ MmpIsImageSectionMapped (
 
 VOID
 MmpDestroyImageSectionMappings (
-    PIMAGE_SECTION Section
+    PIMAGE_SECTION Section,
+    PMM_TLB_BATCH TlbBatch
     );
 
 //
@@ -490,7 +495,8 @@ Return Value:
         Status = MmpUnmapImageSection(CurrentSection,
                                       PageOffset,
                                       PageCount,
-                                      Flags);
+                                      Flags,
+                                      NULL);
 
         KeReleaseQueuedLock(CurrentSection->Lock);
         if (!KSUCCESS(Status)) {
@@ -582,6 +588,7 @@ Return Value:
     PIMAGE_SECTION Section;
     PVOID SectionEnd;
     KSTATUS Status;
+    MM_TLB_BATCH TlbBatch;
 
     PageSize = MmPageSize();
 
@@ -591,6 +598,13 @@ Return Value:
     Process = PsGetCurrentProcess();
     AddressSpace = Process->AddressSpace;
     MmAcquireAddressSpaceLock(AddressSpace);
+
+    //
+    // Collect the changed translations of every section in the region so
+    // they can be shot down together.
+    //
+
+    MmpInitializeTlbBatch(&TlbBatch, AddressSpace);
     Status = STATUS_SUCCESS;
     End = Address + Size;
     CurrentEntry = AddressSpace->SectionListHead.Next;
@@ -635,7 +649,8 @@ Return Value:
                                               &(AddressSpace->SectionListHead),
                                               Address,
                                               0,
-                                              Section);
+                                              Section,
+                                              &TlbBatch);
 
                     if (!KSUCCESS(Status)) {
                         break;
@@ -655,7 +670,8 @@ Return Value:
                 Status = MmpClipImageSection(&(AddressSpace->SectionListHead),
                                              End,
                                              0,
-                                             Section);
+                                             Section,
+                                             &TlbBatch);
 
                 if (!KSUCCESS(Status)) {
                     break;
@@ -669,13 +685,17 @@ Return Value:
             ASSERT((Section->VirtualAddress >= Address) &&
                    ((Section->VirtualAddress + Section->Size) <= End));
 
-            Status = MmpChangeImageSectionAccess(Section, NewAccess);
+            Status = MmpChangeImageSectionAccess(Section,
+                                                 NewAccess,
+                                                 &TlbBatch);
+
             if (!KSUCCESS(Status)) {
                 break;
             }
         }
     }
 
+    MmpFlushTlbBatch(&TlbBatch);
     MmReleaseAddressSpaceLock(AddressSpace);
     return Status;
 }
@@ -883,7 +903,7 @@ Return Value:
         NewAccess = (Section->Flags | IMAGE_SECTION_WRITABLE) &
                     IMAGE_SECTION_ACCESS_MASK;
 
-        Status = MmpChangeImageSectionAccess(Section, NewAccess);
+        Status = MmpChangeImageSectionAccess(Section, NewAccess, NULL);
         MmpImageSectionReleaseReference(Section);
         if (!KSUCCESS(Status)) {
             return Status;
@@ -1047,6 +1067,7 @@ Return Value:
     ULONG PageShift;
     ULONG PageSize;
     KSTATUS Status;
+    MM_TLB_BATCH TlbBatch;
 
     ImageSectionList = NULL;
     NewSection = NULL;
@@ -1080,11 +1101,14 @@ Return Value:
     //
 
     MmAcquireAddressSpaceLock(AddressSpace);
+    MmpInitializeTlbBatch(&TlbBatch, AddressSpace);
     Status = MmpClipImageSections(&(AddressSpace->SectionListHead),
                                   VirtualAddress,
                                   Size,
-                                  &EntryBefore);
+                                  &EntryBefore,
+                                  &TlbBatch);
 
+    MmpFlushTlbBatch(&TlbBatch);
     if (!KSUCCESS(Status)) {
 
         ASSERT(FALSE);
@@ -1127,7 +1151,7 @@ Return Value:
 
             ASSERT(LIST_EMPTY(&(NewSection->ChildList)) != FALSE);
 
-            MmpDestroyImageSectionMappings(NewSection);
+            MmpDestroyImageSectionMappings(NewSection, NULL);
             KeReleaseQueuedLock(NewSection->Lock);
             goto AddImageSectionEnd;
         }
@@ -1169,7 +1193,8 @@ Return Value:
 KSTATUS
 MmpCopyImageSection (
     PIMAGE_SECTION SectionToCopy,
-    PADDRESS_SPACE DestinationAddressSpace
+    PADDRESS_SPACE DestinationAddressSpace,
+    PMM_TLB_BATCH TlbBatch
     )
 
 /*++
@@ -1185,6 +1210,10 @@ Routine Description:
     DestinationAddressSpace - Supplies a pointer to the address space to copy
         the image section to.
 
+    TlbBatch - Supplies a pointer to the TLB invalidation batch for the source
+        address space. The source range is added to this batch when its
+        mappings are made read-only. The caller must flush the batch.
+
 Return Value:
 
     STATUS_SUCCESS on success.
@@ -1403,6 +1432,18 @@ Return Value:
                         SectionToCopy->MinTouched,
                         SectionToCopy->MaxTouched - SectionToCopy->MinTouched);
 
+        //
+        // The source mappings may have been downgraded even on failure, so
+        // always queue them for invalidation. The caller flushes all of the
+        // sections at once.
+        //
+
+        MmpAddTlbBatchRange(
+                 TlbBatch,
+                 SectionToCopy->MinTouched,
+                 (SectionToCopy->MaxTouched - SectionToCopy->MinTouched) >>
+                 MmPageShift());
+
         if (!KSUCCESS(Status)) {
             goto CopyImageSectionEnd;
         }
@@ -1501,6 +1542,7 @@ Return Value:
     UINTN PageOffset;
     PIMAGE_SECTION Section;
     KSTATUS Status;
+    MM_TLB_BATCH TlbBatch;
 
     //
     // For kernel mode, get the whole sections and destroy them.
@@ -1533,21 +1575,26 @@ Return Value:
 
             SectionAddress += Section->Size;
             Size -= Section->Size;
-            MmpRemoveImageSection(Section, FALSE);
+            MmpRemoveImageSection(Section, FALSE, NULL);
             MmpImageSectionReleaseReference(Section);
         }
 
     //
-    // For user mode, unmap whatever crazy region they're specifying.
+    // For user mode, unmap whatever crazy region they're specifying. Shoot
+    // down everything unmapped with as few rounds of IPIs as possible, and
+    // before the range can be reused.
     //
 
     } else {
         MmAcquireAddressSpaceLock(AddressSpace);
+        MmpInitializeTlbBatch(&TlbBatch, AddressSpace);
         Status = MmpClipImageSections(&(AddressSpace->SectionListHead),
                                       SectionAddress,
                                       Size,
-                                      NULL);
+                                      NULL,
+                                      &TlbBatch);
 
+        MmpFlushTlbBatch(&TlbBatch);
         MmReleaseAddressSpaceLock(AddressSpace);
     }
 
@@ -2264,7 +2311,8 @@ Return Value:
                                 ChildPhysicalAddress,
                                 TRUE,
                                 NULL,
-                                TRUE);
+                                TRUE,
+                                NULL);
 
         MmpEnablePagingOnPhysicalAddress(ChildPhysicalAddress,
                                          1,
@@ -2370,7 +2418,8 @@ Return Value:
             MmpChangeMemoryRegionAccess(VirtualAddress,
                                         1,
                                         MapFlags,
-                                        MAP_FLAG_ALL_MASK);
+                                        MAP_FLAG_ALL_MASK,
+                                        NULL);
         }
 
     //
@@ -2482,7 +2531,8 @@ MmpClipImageSections (
     PLIST_ENTRY SectionListHead,
     PVOID Address,
     UINTN Size,
-    PLIST_ENTRY *ListEntryBefore
+    PLIST_ENTRY *ListEntryBefore,
+    PMM_TLB_BATCH TlbBatch
     )
 
 /*++
@@ -2506,6 +2556,11 @@ Routine Description:
     ListEntryBefore - Supplies an optional pointer to the list entry
         immediately before where the given address range starts.
 
+    TlbBatch - Supplies an optional pointer to a TLB invalidation batch for
+        the address space. If supplied, pages unmapped from the address space
+        are invalidated and freed when the caller flushes the batch, which
+        must happen before the address space lock is released.
+
 Return Value:
 
     Status code.
@@ -2538,7 +2593,8 @@ Return Value:
             Status = MmpClipImageSection(SectionListHead,
                                          Address,
                                          Size,
-                                         Section);
+                                         Section,
+                                         TlbBatch);
 
             if (!KSUCCESS(Status)) {
                 break;
@@ -2876,7 +2932,8 @@ MmpClipImageSection (
     PLIST_ENTRY SectionListHead,
     PVOID Address,
     UINTN Size,
-    PIMAGE_SECTION Section
+    PIMAGE_SECTION Section,
+    PMM_TLB_BATCH TlbBatch
     )
 
 /*++
@@ -2900,6 +2957,9 @@ Routine Description:
 
     Section - Supplies a pointer to the image section to clip.
 
+    TlbBatch - Supplies an optional pointer to a TLB invalidation batch for
+        the address space to add unmapped pages to.
+
 Return Value:
 
     Status code.
@@ -2951,7 +3011,7 @@ Return Value:
     //
 
     if ((Address <= Section->VirtualAddress) && (RegionEnd >= SectionEnd)) {
-        MmpRemoveImageSection(Section, TRUE);
+        MmpRemoveImageSection(Section, TRUE, TlbBatch);
         return STATUS_SUCCESS;
     }
 
@@ -3126,7 +3186,11 @@ Return Value:
                          PageShift;
 
         HolePageCount = ((UINTN)HoleEnd - (UINTN)HoleBegin) >> PageShift;
-        MmpUnmapImageSection(Section, HolePageOffset, HolePageCount, 0);
+        MmpUnmapImageSection(Section,
+                             HolePageOffset,
+                             HolePageCount,
+                             0,
+                             TlbBatch);
 
         ASSERT(HolePageOffset + HolePageCount <= (Section->Size >> PageShift));
 
@@ -3171,7 +3235,7 @@ Return Value:
     //
 
     if (Section->Size == 0) {
-        MmpRemoveImageSection(Section, TRUE);
+        MmpRemoveImageSection(Section, TRUE, TlbBatch);
     }
 
     Status = STATUS_SUCCESS;
@@ -3189,7 +3253,8 @@ Return Value:
 VOID
 MmpRemoveImageSection (
     PIMAGE_SECTION Section,
-    BOOL AddressSpaceLockHeld
+    BOOL AddressSpaceLockHeld,
+    PMM_TLB_BATCH TlbBatch
     )
 
 /*++
@@ -3206,6 +3271,9 @@ Routine Description:
     AddressSpaceLockHeld - Supplies a boolean indicating whether or not the
         address space lock is already held.
 
+    TlbBatch - Supplies an optional pointer to a TLB invalidation batch for
+        the section's address space to add unmapped pages to.
+
 Return Value:
 
     None.
@@ -3362,7 +3430,7 @@ Return Value:
     // Destroy the mappings for this image section.
     //
 
-    MmpDestroyImageSectionMappings(Section);
+    MmpDestroyImageSectionMappings(Section, TlbBatch);
 
     //
     // Now that all the pages have been unmapped and it has been detached from
@@ -3469,7 +3537,8 @@ Return Value:
 KSTATUS
 MmpChangeImageSectionAccess (
     PIMAGE_SECTION Section,
-    ULONG NewAccess
+    ULONG NewAccess,
+    PMM_TLB_BATCH TlbBatch
     )
 
 /*++
@@ -3484,6 +3553,9 @@ Routine Description:
 
     NewAccess - Supplies the new access attributes.
 
+    TlbBatch - Supplies an optional pointer to a TLB invalidation batch for
+        the section's address space to add changed pages to.
+
 Return Value:
 
     Status code.
@@ -3583,7 +3655,8 @@ Return Value:
         MmpChangeMemoryRegionAccess(Section->VirtualAddress,
                                     Section->Size >> MmPageShift(),
                                     MapFlags,
-                                    MAP_FLAG_ALL_MASK);
+                                    MAP_FLAG_ALL_MASK,
+                                    TlbBatch);
     }
 
     Status = STATUS_SUCCESS;
@@ -3598,7 +3671,8 @@ MmpUnmapImageSection (
     PIMAGE_SECTION Section,
     UINTN PageOffset,
     UINTN PageCount,
-    ULONG Flags
+    ULONG Flags,
+    PMM_TLB_BATCH TlbBatch
     )
 
 /*++
@@ -3622,6 +3696,12 @@ Routine Description:
     Flags - Supplies a bitmask of flags for the unmap. See
         IMAGE_SECTION_UNMAP_FLAG_* for definitions.
 
+    TlbBatch - Supplies an optional pointer to a TLB invalidation batch for
+        the section's address space. If supplied, pages unmapped from the
+        section are added to the batch rather than invalidated one at a time.
+        Pages freed by the unmap are held until the batch is flushed, which
+        this routine does before returning if it freed any.
+
 Return Value:
 
     Status code.
@@ -3801,7 +3881,8 @@ Return Value:
                                 INVALID_PHYSICAL_ADDRESS,
                                 FALSE,
                                 &PageWasDirty,
-                                TRUE);
+                                TRUE,
+                                TlbBatch);
 
         //
         // If this is a shared, writable image section and the mapping was
@@ -3826,14 +3907,19 @@ Return Value:
 
         //
         // If it was determined above that the phyiscal page could be released,
-        // free it now.
+        // free it now, or once the batch has shot it down.
         //
 
         if (FreePhysicalPage != FALSE) {
 
             ASSERT((Flags & IMAGE_SECTION_UNMAP_FLAG_PAGE_CACHE_ONLY) == 0);
 
-            MmFreePhysicalPage(PhysicalAddress);
+            if (TlbBatch != NULL) {
+                MmpAddTlbBatchFreePages(TlbBatch, PhysicalAddress, 1);
+
+            } else {
+                MmFreePhysicalPage(PhysicalAddress);
+            }
         }
 
         //
@@ -3851,6 +3937,15 @@ Return Value:
     Status = STATUS_SUCCESS;
 
 UnmapImageSectionEnd:
+
+    //
+    // Freed pages have to go back while the section lock is still held.
+    //
+
+    if ((TlbBatch != NULL) && (TlbBatch->FreeRunCount != 0)) {
+        MmpFlushTlbBatch(TlbBatch);
+    }
+
     return Status;
 }
 
@@ -3935,7 +4030,8 @@ Return Value:
 
 VOID
 MmpDestroyImageSectionMappings (
-    PIMAGE_SECTION Section
+    PIMAGE_SECTION Section,
+    PMM_TLB_BATCH TlbBatch
     )
 
 /*++
@@ -3950,6 +4046,11 @@ Routine Description:
     Section - Supplies a pointer to the image section whose mappings are to be
         destroyed.
 
+    TlbBatch - Supplies an optional pointer to a TLB invalidation batch for
+        the section's address space. If supplied, pages are unmapped without
+        individual shootdowns and added to the batch. The batch is flushed
+        before returning if any pages were freed.
+
 Return Value:
 
     None.
@@ -3996,6 +4097,9 @@ Return Value:
 
     CurrentProcess = PsGetCurrentProcess();
     AddressSpace = Section->AddressSpace;
+    if ((TlbBatch != NULL) && (TlbBatch->AddressSpace != AddressSpace)) {
+        TlbBatch = NULL;
+    }
 
     //
     // Record the first virtual address of the section.
@@ -4051,6 +4155,16 @@ Return Value:
             MultipleIpisRequired = FALSE;
         }
 
+        //
+        // If the caller is batching shootdowns, unmap each page without an
+        // IPI and let the batch cover them. A section that frees no pages
+        // then costs no IPIs of its own.
+        //
+
+        if (TlbBatch != NULL) {
+            MultipleIpisRequired = FALSE;
+        }
+
         //
         // If multiple IPIs would be required during the unmap phase, get it
         // over with now. Set the whole section to not present and send 1 IPI.
@@ -4060,7 +4174,8 @@ Return Value:
             MmpChangeMemoryRegionAccess(CurrentAddress,
                                         PageCount,
                                         0,
-                                        MAP_FLAG_PRESENT);
+                                        MAP_FLAG_PRESENT,
+                                        NULL);
         }
 
         OtherProcess = FALSE;
@@ -4154,6 +4269,13 @@ Return Value:
                     PageWasDirty = TRUE;
                 }
 
+            } else if (TlbBatch != NULL) {
+                MmpUnmapPages(CurrentAddress, 1, 0, &PageWasDirty);
+                MmpAddTlbBatchRange(TlbBatch, CurrentAddress, 1);
+                if ((UnmapFlags & UNMAP_FLAG_FREE_PHYSICAL_PAGES) != 0) {
+                    MmpAddTlbBatchFreePages(TlbBatch, PhysicalAddress, 1);
+                }
+
             } else {
                 MmpUnmapPages(CurrentAddress, 1, UnmapFlags, &PageWasDirty);
             }
@@ -4212,6 +4334,14 @@ Return Value:
         MmFreePhysicalPages(RunPhysicalAddress, RunSize >> PageShift);
     }
 
+    //
+    // Freed pages have to go back while the section lock is still held.
+    //
+
+    if ((TlbBatch != NULL) && (TlbBatch->FreeRunCount != 0)) {
+        MmpFlushTlbBatch(TlbBatch);
+    }
+
     //
     // When handling a section for the current process or kernel process that
     // would have required multiple IPIs, all pages have been set to
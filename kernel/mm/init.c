@@ -179,18 +179,22 @@ Return Value:
     } else if (Phase == 1) {
 
         //
-        // Set the swap virtual address used by this processor.
+        // Set the swap virtual address and physical page cache used by this
+        // processor.
         //
 
         ProcessorBlock = KeGetCurrentProcessorBlock();
         if (Parameters != NULL) {
             ProcessorBlock->SwapPage = Parameters->PageTableStage;
+            ProcessorBlock->PhysicalPageCache = &MmBootPhysicalPageCache;
 
         } else {
             ProcessorBlock->SwapPage = StartBlock->SwapPage;
+            ProcessorBlock->PhysicalPageCache = StartBlock->PhysicalPageCache;
         }
 
         ASSERT(ProcessorBlock->SwapPage != NULL);
+        ASSERT(ProcessorBlock->PhysicalPageCache != NULL);
 
         //
         // Perform phase 1 architecture specific initialization.
@@ -207,6 +211,7 @@ Return Value:
 
         if (KeGetCurrentProcessorNumber() == 0) {
             KeInitializeSpinLock(&MmInvalidateIpiLock);
+            KeInitializeSpinLock(&(MmBootPhysicalPageCache.Lock));
             KeInitializeSpinLock(&MmNonPagedPoolLock);
 
             //
@@ -388,6 +393,7 @@ Return Value:
 
 {
 
+    PPHYSICAL_PAGE_CACHE PageCache;
     UINTN PageSize;
     KSTATUS Status;
     VM_ALLOCATION_PARAMETERS VaRequest;
@@ -421,6 +427,23 @@ Return Value:
     }
 
     StartBlock->SwapPage = VaRequest.Address;
+
+    //
+    // Allocate the processor's cache of free physical pages. It starts out
+    // empty and fills as the processor allocates and frees single pages.
+    //
+
+    PageCache = MmAllocateNonPagedPool(sizeof(PHYSICAL_PAGE_CACHE),
+                                       MM_ALLOCATION_TAG);
+
+    if (PageCache == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto PrepareForProcessorLaunchEnd;
+    }
+
+    KeInitializeSpinLock(&(PageCache->Lock));
+    PageCache->Count = 0;
+    StartBlock->PhysicalPageCache = PageCache;
     Status = STATUS_SUCCESS;
 
 PrepareForProcessorLaunchEnd:
@@ -473,6 +496,19 @@ Return Value:
         StartBlock->SwapPage = NULL;
     }
 
+    //
+    // The processor never ran, so its physical page cache is still empty.
+    //
+
+    if (StartBlock->PhysicalPageCache != NULL) {
+
+        ASSERT(((PPHYSICAL_PAGE_CACHE)StartBlock->PhysicalPageCache)->Count ==
+               0);
+
+        MmFreeNonPagedPool(StartBlock->PhysicalPageCache);
+        StartBlock->PhysicalPageCache = NULL;
+    }
+
     return;
 }
 
@@ -44,19 +44,23 @@ Module Name:
 // ----------------------------------------------- Internal Function Prototypes
 //
 
+VOID
+MmpInvalidateTlbBatch (
+    PMM_TLB_BATCH Batch
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
 
 //
-// Store the global containing the address to invalidate and the number of
-// processors that have yet to respond to the IPI.
+// Store the global containing the batch to invalidate and the number of
+// processors that have yet to respond to the IPI. The lock is only needed
+// when IPIs are actually sent.
 //
 
 KSPIN_LOCK MmInvalidateIpiLock;
-volatile PADDRESS_SPACE MmInvalidateIpiAddressSpace = NULL;
-volatile PVOID MmInvalidateIpiAddress = NULL;
-volatile ULONG MmInvalidateIpiPageCount = 0;
+volatile PMM_TLB_BATCH MmInvalidateIpiBatch = NULL;
 volatile ULONG MmInvalidateIpiProcessorsRemaining = 0;
 
 //
@@ -86,23 +90,23 @@ Return Value:
 
 {
 
-    PVOID Address;
-    ULONG Index;
+    PMM_TLB_BATCH Batch;
     RUNLEVEL OldRunLevel;
-    ULONG PageSize;
-    PKPROCESS Process;
+    PPROCESSOR_BLOCK ProcessorBlock;
 
     OldRunLevel = KeRaiseRunLevel(RunLevelIpi);
-    PageSize = MmPageSize();
-    Process = PsGetCurrentProcess();
-    if ((MmInvalidateIpiAddress >= KERNEL_VA_START) ||
-        (Process->AddressSpace == MmInvalidateIpiAddressSpace)) {
+    Batch = MmInvalidateIpiBatch;
+    ProcessorBlock = KeGetCurrentProcessorBlock();
 
-        Address = MmInvalidateIpiAddress;
-        for (Index = 0; Index < MmInvalidateIpiPageCount; Index += 1) {
-            ArInvalidateTlbEntry(Address);
-            Address = (PVOID)((UINTN)Address + PageSize);
-        }
+    //
+    // The processor may have switched away from the address space since the
+    // IPI was sent, in which case the switch already flushed the TLB.
+    //
+
+    if ((Batch->KernelRange != FALSE) ||
+        (ProcessorBlock->AddressSpace == Batch->AddressSpace)) {
+
+        MmpInvalidateTlbBatch(Batch);
     }
 
     RtlAtomicAdd32(&MmInvalidateIpiProcessorsRemaining, -1);
@@ -121,7 +125,8 @@ MmpSendTlbInvalidateIpi (
 
 Routine Description:
 
-    This routine invalidates the given TLB entry on all active processors.
+    This routine invalidates the given TLB entries on all processors that may
+    have them cached.
 
 Arguments:
 
@@ -139,55 +144,427 @@ Return Value:
 
 {
 
+    MM_TLB_BATCH Batch;
+
+    MmpInitializeTlbBatch(&Batch, AddressSpace);
+    MmpAddTlbBatchRange(&Batch, VirtualAddress, PageCount);
+    MmpFlushTlbBatch(&Batch);
+    return;
+}
+
+VOID
+MmpInitializeTlbBatch (
+    PMM_TLB_BATCH Batch,
+    PADDRESS_SPACE AddressSpace
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes an empty TLB invalidation batch.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch to initialize.
+
+    AddressSpace - Supplies a pointer to the address space whose translations
+        will be invalidated.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    Batch->AddressSpace = AddressSpace;
+    Batch->RangeCount = 0;
+    Batch->PageCount = 0;
+    Batch->KernelRange = FALSE;
+    Batch->FullFlush = FALSE;
+    Batch->FreeRunCount = 0;
+    return;
+}
+
+VOID
+MmpAddTlbBatchRange (
+    PMM_TLB_BATCH Batch,
+    PVOID VirtualAddress,
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a range of pages to a TLB invalidation batch. The
+    translations are not invalidated until the batch is flushed.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch.
+
+    VirtualAddress - Supplies the first page-aligned virtual address of the
+        range.
+
+    PageCount - Supplies the number of pages in the range.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID EndAddress;
+    PMM_TLB_BATCH_RANGE Range;
+
+    if (PageCount == 0) {
+        return;
+    }
+
+    //
+    // A batch covers a single address space, so it should never mix kernel
+    // and user mode ranges.
+    //
+
+    ASSERT((Batch->RangeCount == 0) ||
+           ((VirtualAddress >= KERNEL_VA_START) == Batch->KernelRange));
+
+    if (VirtualAddress >= KERNEL_VA_START) {
+        Batch->KernelRange = TRUE;
+    }
+
+    //
+    // Extend the previous range if this one picks up where it left off.
+    //
+
+    if (Batch->RangeCount != 0) {
+        Range = &(Batch->Ranges[Batch->RangeCount - 1]);
+        EndAddress = Range->VirtualAddress +
+                     (Range->PageCount << MmPageShift());
+
+        if (EndAddress == VirtualAddress) {
+            Range->PageCount += PageCount;
+            Batch->PageCount += PageCount;
+            goto AddTlbBatchRangeEnd;
+        }
+    }
+
+    //
+    // Kernel translations are global and survive a full TLB flush, so they
+    // must always be invalidated individually. Send out what has accumulated
+    // so far to make room.
+    //
+
+    if (Batch->RangeCount == MM_TLB_BATCH_RANGE_COUNT) {
+        if (Batch->KernelRange != FALSE) {
+            MmpFlushTlbBatch(Batch);
+            if (VirtualAddress >= KERNEL_VA_START) {
+                Batch->KernelRange = TRUE;
+            }
+
+        } else {
+            Batch->FullFlush = TRUE;
+            Batch->PageCount += PageCount;
+            return;
+        }
+    }
+
+    Range = &(Batch->Ranges[Batch->RangeCount]);
+    Range->VirtualAddress = VirtualAddress;
+    Range->PageCount = PageCount;
+    Batch->RangeCount += 1;
+    Batch->PageCount += PageCount;
+
+AddTlbBatchRangeEnd:
+    if ((Batch->KernelRange == FALSE) &&
+        (Batch->PageCount > MM_TLB_FULL_FLUSH_THRESHOLD)) {
+
+        Batch->FullFlush = TRUE;
+    }
+
+    return;
+}
+
+VOID
+MmpAddTlbBatchFreePages (
+    PMM_TLB_BATCH Batch,
+    PHYSICAL_ADDRESS PhysicalAddress,
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine queues a run of physical pages to be freed once the given
+    batch has been flushed. The pages must already be unmapped, and their
+    translations added to the batch. If the batch has no room for the run, it
+    is flushed first. The caller must flush the batch before releasing the
+    lock of the image section that owns the pages.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch.
+
+    PhysicalAddress - Supplies the physical address of the first page to free.
+
+    PageCount - Supplies the number of contiguous pages to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PMM_TLB_BATCH_FREE_RUN Run;
+
+    if (PageCount == 0) {
+        return;
+    }
+
+    //
+    // Extend the previous run if this one picks up where it left off.
+    //
+
+    if (Batch->FreeRunCount != 0) {
+        Run = &(Batch->FreeRuns[Batch->FreeRunCount - 1]);
+        if (Run->PhysicalAddress + (Run->PageCount << MmPageShift()) ==
+            PhysicalAddress) {
+
+            Run->PageCount += PageCount;
+            return;
+        }
+    }
+
+    //
+    // Every page queued so far is unmapped and in the batch, so flushing
+    // the batch makes it safe to free them and frees up the array.
+    //
+
+    if (Batch->FreeRunCount == MM_TLB_BATCH_FREE_RUN_COUNT) {
+        MmpFlushTlbBatch(Batch);
+    }
+
+    Run = &(Batch->FreeRuns[Batch->FreeRunCount]);
+    Run->PhysicalAddress = PhysicalAddress;
+    Run->PageCount = PageCount;
+    Batch->FreeRunCount += 1;
+    return;
+}
+
+VOID
+MmpFlushTlbBatch (
+    PMM_TLB_BATCH Batch
+    )
+
+/*++
+
+Routine Description:
+
+    This routine invalidates every range in the given batch on all processors
+    that may have them cached, using a single round of IPIs, frees any
+    physical pages queued on the batch, and then resets the batch to empty.
+    This routine must be called at or below dispatch level, and at low level
+    if physical pages were queued on the batch.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch to flush.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PADDRESS_SPACE AddressSpace;
+    PPROCESSOR_BLOCK CurrentProcessor;
     RUNLEVEL OldRunLevel;
-    ULONG PageIndex;
-    ULONG PageSize;
+    ULONG OtherCount;
+    PPROCESSOR_BLOCK Processor;
+    ULONG ProcessorCount;
+    ULONG ProcessorIndex;
     PROCESSOR_SET ProcessorSet;
+    ULONG RunIndex;
     KSTATUS Status;
 
+    if ((Batch->RangeCount == 0) && (Batch->FullFlush == FALSE)) {
+        goto FlushTlbBatchFreePages;
+    }
+
+    AddressSpace = Batch->AddressSpace;
+    ProcessorCount = KeGetActiveProcessorCount();
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    CurrentProcessor = KeGetCurrentProcessorBlock();
+
     //
     // If there is only one processor in the system, do the invalidate
     // directly.
     //
 
-    if (KeGetActiveProcessorCount() == 1) {
-        PageSize = MmPageSize();
-        for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
-            ArInvalidateTlbEntry(VirtualAddress);
-            VirtualAddress = (PVOID)((UINTN)VirtualAddress + PageSize);
+    if (ProcessorCount == 1) {
+        MmpInvalidateTlbBatch(Batch);
+        goto FlushTlbBatchEnd;
+    }
+
+    //
+    // Kernel translations may be cached on any processor, regardless of what
+    // it is running.
+    //
+
+    if (Batch->KernelRange != FALSE) {
+        MmpInvalidateTlbBatch(Batch);
+        KeAcquireSpinLock(&MmInvalidateIpiLock);
+        MmInvalidateIpiBatch = Batch;
+        MmInvalidateIpiProcessorsRemaining = ProcessorCount - 1;
+        RtlMemoryBarrier();
+        ProcessorSet.Target = ProcessorTargetAllExcludingSelf;
+        Status = HlSendIpi(IpiTypeTlbFlush, &ProcessorSet);
+        if (!KSUCCESS(Status)) {
+            KeCrashSystem(CRASH_IPI_FAILURE, Status, 0, 0, 0);
         }
 
-        return;
+        goto FlushTlbBatchWait;
+    }
+
+    //
+    // User mode translations can only be cached by processors that have the
+    // address space loaded. The page table changes must be visible before
+    // looking at which processors those are. A processor that loads the
+    // address space after this point sees the new page tables, as loading
+    // the address space flushes its TLB.
+    //
+
+    if (CurrentProcessor->AddressSpace == AddressSpace) {
+        MmpInvalidateTlbBatch(Batch);
     }
 
-    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
-    KeAcquireSpinLock(&MmInvalidateIpiLock);
-    MmInvalidateIpiAddressSpace = AddressSpace;
-    MmInvalidateIpiAddress = VirtualAddress;
-    MmInvalidateIpiPageCount = PageCount;
-    MmInvalidateIpiProcessorsRemaining = KeGetActiveProcessorCount();
     RtlMemoryBarrier();
+    OtherCount = AddressSpace->ActiveProcessorCount;
+    if (CurrentProcessor->AddressSpace == AddressSpace) {
+        OtherCount -= 1;
+    }
+
+    if (OtherCount == 0) {
+        goto FlushTlbBatchEnd;
+    }
 
     //
-    // Send out the IPI.
+    // There is no way to target an arbitrary set of processors with a single
+    // IPI, so send one to each processor running in the address space.
     //
 
-    ProcessorSet.Target = ProcessorTargetAll;
-    Status = HlSendIpi(IpiTypeTlbFlush, &ProcessorSet);
-    if (!KSUCCESS(Status)) {
-        KeCrashSystem(CRASH_IPI_FAILURE, Status, 0, 0, 0);
+    KeAcquireSpinLock(&MmInvalidateIpiLock);
+    MmInvalidateIpiBatch = Batch;
+    MmInvalidateIpiProcessorsRemaining = 0;
+    RtlMemoryBarrier();
+    ProcessorSet.Target = ProcessorTargetSingleProcessor;
+    for (ProcessorIndex = 0;
+         ProcessorIndex < ProcessorCount;
+         ProcessorIndex += 1) {
+
+        Processor = KeGetProcessorBlock(ProcessorIndex);
+        if ((Processor == CurrentProcessor) ||
+            (Processor->AddressSpace != AddressSpace)) {
+
+            continue;
+        }
+
+        RtlAtomicAdd32(&MmInvalidateIpiProcessorsRemaining, 1);
+        ProcessorSet.U.Number = ProcessorIndex;
+        Status = HlSendIpi(IpiTypeTlbFlush, &ProcessorSet);
+        if (!KSUCCESS(Status)) {
+            KeCrashSystem(CRASH_IPI_FAILURE, Status, 0, 0, 0);
+        }
     }
 
     //
     // Spin waiting for the IPI to complete on all processors before returning.
     //
 
+FlushTlbBatchWait:
     while (MmInvalidateIpiProcessorsRemaining != 0) {
         ArProcessorYield();
     }
 
     KeReleaseSpinLock(&MmInvalidateIpiLock);
+
+FlushTlbBatchEnd:
     KeLowerRunLevel(OldRunLevel);
+
+    //
+    // No processor can reach the queued pages anymore, so release them.
+    //
+
+FlushTlbBatchFreePages:
+    for (RunIndex = 0; RunIndex < Batch->FreeRunCount; RunIndex += 1) {
+        MmFreePhysicalPages(Batch->FreeRuns[RunIndex].PhysicalAddress,
+                            Batch->FreeRuns[RunIndex].PageCount);
+    }
+
+    MmpInitializeTlbBatch(Batch, Batch->AddressSpace);
+    return;
+}
+
+VOID
+MmpUpdateProcessorAddressSpace (
+    PVOID Processor,
+    PADDRESS_SPACE AddressSpace
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records that the given processor is about to load the given
+    address space, so that TLB shootdowns for that address space reach it.
+    This must be called with interrupts disabled before the hardware
+    translation base is switched.
+
+Arguments:
+
+    Processor - Supplies a pointer to the current processor block.
+
+    AddressSpace - Supplies a pointer to the address space being switched to.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PADDRESS_SPACE OldAddressSpace;
+    PPROCESSOR_BLOCK ProcessorBlock;
+
+    ProcessorBlock = Processor;
+    OldAddressSpace = ProcessorBlock->AddressSpace;
+    if (OldAddressSpace == AddressSpace) {
+        return;
+    }
+
+    //
+    // Publish the new address space before counting it, and count it before
+    // loading it. The atomic operations act as full barriers, pairing with
+    // the barrier in the flush routine.
+    //
+
+    ProcessorBlock->AddressSpace = AddressSpace;
+    RtlAtomicAdd32(&(AddressSpace->ActiveProcessorCount), 1);
+    if (OldAddressSpace != NULL) {
+        RtlAtomicAdd32(&(OldAddressSpace->ActiveProcessorCount), (ULONG)-1);
+    }
+
     return;
 }
 
@@ -195,3 +572,54 @@ Return Value:
 // --------------------------------------------------------- Internal Functions
 //
 
+VOID
+MmpInvalidateTlbBatch (
+    PMM_TLB_BATCH Batch
+    )
+
+/*++
+
+Routine Description:
+
+    This routine invalidates the ranges in the given batch on the current
+    processor.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch to invalidate.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PVOID Address;
+    UINTN PageIndex;
+    ULONG PageSize;
+    PMM_TLB_BATCH_RANGE Range;
+    ULONG RangeIndex;
+
+    if (Batch->FullFlush != FALSE) {
+
+        ASSERT(Batch->KernelRange == FALSE);
+
+        ArInvalidateEntireTlb();
+        return;
+    }
+
+    PageSize = MmPageSize();
+    for (RangeIndex = 0; RangeIndex < Batch->RangeCount; RangeIndex += 1) {
+        Range = &(Batch->Ranges[RangeIndex]);
+        Address = Range->VirtualAddress;
+        for (PageIndex = 0; PageIndex < Range->PageCount; PageIndex += 1) {
+            ArInvalidateTlbEntry(Address);
+            Address = (PVOID)((UINTN)Address + PageSize);
+        }
+    }
+
+    return;
+}
+
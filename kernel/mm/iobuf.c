@@ -50,6 +50,16 @@ Module Name:
 
 #define MM_MAP_IO_BUFFER_LOCAL_VIRTUAL_PAGES 0x20
 
+//
+// Define the range of physically contiguous run sizes that extending an I/O
+// buffer tries for before settling for single pages. Larger runs mean fewer
+// fragments and bigger device transfers, especially for read-ahead into the
+// page cache.
+//
+
+#define IO_BUFFER_MINIMUM_RUN_SIZE (16 * _1KB)
+#define IO_BUFFER_MAXIMUM_RUN_SIZE (2 * _1MB)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -3628,14 +3638,16 @@ Return Value:
 
 {
 
+    UINTN AllocationCount;
+    UINTN AllocationSize;
     UINTN AvailableFragments;
     PIO_BUFFER_FRAGMENT Fragment;
     UINTN FragmentIndex;
     UINTN PageCount;
     UINTN PageIndex;
     ULONG PageShift;
-    ULONG PageSize;
     PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN RunPageCount;
     KSTATUS Status;
 
     ASSERT((IoBuffer->Internal.Flags &
@@ -3657,7 +3669,6 @@ Return Value:
                IO_BUFFER_INTERNAL_FLAG_CACHE_BACKED) != 0))));
 
     PageShift = MmPageShift();
-    PageSize = MmPageSize();
 
     //
     // Convert the byte alignment to pages.
@@ -3682,7 +3693,7 @@ Return Value:
     AvailableFragments = IoBuffer->Internal.MaxFragmentCount -
                          IoBuffer->FragmentCount;
 
-    PageCount = ALIGN_RANGE_UP(Size, PageSize) >> PageShift;
+    PageCount = ALIGN_RANGE_UP(Size, MmPageSize()) >> PageShift;
     if (PageCount > AvailableFragments) {
         return STATUS_BUFFER_TOO_SMALL;
     }
@@ -3741,19 +3752,57 @@ Return Value:
     //
     // Otherwise extend the I/O buffer by allocating enough pages to cover the
     // requested size and appending them to the end of the fragment array.
+    // Physically contiguous runs are used where they are free for the taking,
+    // unless memory is already tight.
     //
 
     } else {
-        for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
-            PhysicalAddress = MmpAllocatePhysicalPages(1, Alignment);
+        RunPageCount = 0;
+        if (MmGetPhysicalMemoryWarningLevel() == MemoryWarningLevelNone) {
+            RunPageCount = IO_BUFFER_MAXIMUM_RUN_SIZE >> PageShift;
+        }
+
+        PageIndex = 0;
+        while (PageIndex < PageCount) {
+
+            //
+            // Try the largest power of two run that fits in what is left,
+            // halving on failure. A size that failed is not tried again for
+            // this extension, so fragmented memory quickly drops to single
+            // pages.
+            //
+
+            while (RunPageCount > (PageCount - PageIndex)) {
+                RunPageCount >>= 1;
+            }
+
+            AllocationCount = 1;
+            PhysicalAddress = INVALID_PHYSICAL_ADDRESS;
+            while ((RunPageCount << PageShift) >= IO_BUFFER_MINIMUM_RUN_SIZE) {
+                PhysicalAddress = MmpTryAllocatePhysicalPages(RunPageCount,
+                                                              Alignment);
+
+                if (PhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
+                    AllocationCount = RunPageCount;
+                    break;
+                }
+
+                RunPageCount >>= 1;
+            }
+
             if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
-                Status = STATUS_NO_MEMORY;
-                goto ExtendIoBufferEnd;
+                PhysicalAddress = MmpAllocatePhysicalPages(1, Alignment);
+                if (PhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
+                    Status = STATUS_NO_MEMORY;
+                    goto ExtendIoBufferEnd;
+                }
             }
 
+            AllocationSize = AllocationCount << PageShift;
+
             //
-            // Check to see if the physical page can be attached to the current
-            // fragment.
+            // Check to see if the physical pages can be attached to the
+            // current fragment.
             //
 
             if ((Fragment->VirtualAddress == NULL) &&
@@ -3762,7 +3811,7 @@ Return Value:
 
                 ASSERT(Fragment->Size != 0);
 
-                Fragment->Size += PageSize;
+                Fragment->Size += AllocationSize;
 
             } else {
                 if (IoBuffer->FragmentCount != 0) {
@@ -3776,11 +3825,12 @@ Return Value:
                 ASSERT(Fragment->Size == 0);
 
                 Fragment->PhysicalAddress = PhysicalAddress;
-                Fragment->Size = PageSize;
+                Fragment->Size = AllocationSize;
                 IoBuffer->FragmentCount += 1;
             }
 
-            IoBuffer->Internal.TotalSize += PageSize;
+            IoBuffer->Internal.TotalSize += AllocationSize;
+            PageIndex += AllocationCount;
         }
     }
 
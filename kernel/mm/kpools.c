@@ -671,6 +671,7 @@ Return Value:
 
     KeReleaseQueuedLock(MmPagedPoolLock);
     MmpGetPhysicalPageStatistics(Statistics);
+    MmpGetCompressedSwapStatistics(Statistics);
     return STATUS_SUCCESS;
 }
 
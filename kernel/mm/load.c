@@ -690,6 +690,18 @@ Return Value:
         Parameters->Address = VaRequest.Address;
         Parameters->Size = VaRequest.Size;
 
+        //
+        // Fault in the whole range now if requested. This is only a hint, so
+        // failures (such as pages beyond the end of the file) leave the rest
+        // of the range to be faulted in on demand.
+        //
+
+        if (KSUCCESS(Status) && ((MapFlags & SYS_MAP_FLAG_POPULATE) != 0)) {
+            MmpPopulateAddressRange(CurrentProcess->AddressSpace,
+                                    Parameters->Address,
+                                    Parameters->Size);
+        }
+
     //
     // Otherwise search through the current process' list of image sections and
     // destroy any sections that overlap with the specified address region.
@@ -44,6 +44,7 @@ Module Name:
 
 #define PAGING_ENTRY_FLAG_PAGING_OUT 0x0001
 #define PAGING_ENTRY_FLAG_FREED      0x0002
+#define PAGING_ENTRY_FLAG_REFERENCED 0x0004
 
 //
 // Define flags for flushing image sections.
@@ -132,6 +133,53 @@ Module Name:
 
 #define IO_BUFFER_INTERNAL_FLAG_LOCK_OWNED 0x00000400
 
+//
+// Define the number of distinct ranges a TLB invalidation batch can hold
+// before it collapses into a flush of the entire TLB.
+//
+
+#define MM_TLB_BATCH_RANGE_COUNT 8
+
+//
+// Define the number of user mode pages above which it is cheaper to flush the
+// entire TLB than to invalidate each page individually. Kernel pages are
+// mapped global, and are always invalidated individually.
+//
+
+#define MM_TLB_FULL_FLUSH_THRESHOLD 32
+
+//
+// Define the number of distinct physical runs a TLB invalidation batch can
+// hold for freeing after the invalidation. The batch is flushed early when
+// this fills up.
+//
+
+#define MM_TLB_BATCH_FREE_RUN_COUNT 16
+
+//
+// Define the number of free pages each processor's physical page cache can
+// hold, and the number of pages moved between a processor's cache and the
+// global allocator at once.
+//
+
+#define PHYSICAL_PAGE_CACHE_SIZE 32
+#define PHYSICAL_PAGE_CACHE_BATCH 16
+
+//
+// Define the number of pages following a faulting page that are mapped from
+// the page cache in the same fault, if they are already resident.
+//
+
+#define MM_FAULT_AROUND_PAGE_COUNT 16
+
+//
+// Define the number of entries in the hash table the page compressor uses to
+// find matches. This must be a power of two.
+//
+
+#define COMPRESSION_HASH_TABLE_BITS 12
+#define COMPRESSION_HASH_TABLE_SIZE (1 << COMPRESSION_HASH_TABLE_BITS)
+
 //
 // --------------------------------------------------------------------- Macros
 //
@@ -288,6 +336,163 @@ typedef struct _PAGING_ENTRY {
 
 } PAGING_ENTRY, *PPAGING_ENTRY;
 
+/*++
+
+Structure Description:
+
+    This structure embodies a memory page backing store.
+
+Members:
+
+    ListEntry - Stores pointers to the next and previous paging store entries.
+
+    Handle - Stores the open handle to the backing store.
+
+    Lock - Stores a pointer to the lock that synchronizes access to this
+        structure.
+
+    Bitmap - Stores a pointer to the bitmap indicating which pages are free
+        and which are in use.
+
+    PagingOutIrp - Stores a pointer to an IRP used for paging out to this page
+        file.
+
+    PageCount - Stores the number of pages this backing store can hold.
+
+    FreePages - Stores the number of free pages in this backing store.
+
+    LastAllocatedPage - Stores the index into the backing store of the most
+        recently allocated backing store.
+
+    FailedAllocations - Stores the number of times this page file has failed
+        to meet a request for page file space.
+
+--*/
+
+typedef struct _PAGE_FILE {
+    LIST_ENTRY ListEntry;
+    PIO_HANDLE Handle;
+    PQUEUED_LOCK Lock;
+    PULONG Bitmap;
+    PIRP PagingOutIrp;
+    UINTN PageCount;
+    UINTN FreePages;
+    UINTN LastAllocatedPage;
+    UINTN FailedAllocations;
+} PAGE_FILE, *PPAGE_FILE;
+
+/*++
+
+Structure Description:
+
+    This structure defines a contiguous range of virtual addresses within a
+    TLB invalidation batch.
+
+Members:
+
+    VirtualAddress - Stores the first page-aligned virtual address to
+        invalidate.
+
+    PageCount - Stores the number of pages to invalidate.
+
+--*/
+
+typedef struct _MM_TLB_BATCH_RANGE {
+    PVOID VirtualAddress;
+    UINTN PageCount;
+} MM_TLB_BATCH_RANGE, *PMM_TLB_BATCH_RANGE;
+
+/*++
+
+Structure Description:
+
+    This structure defines a contiguous run of physical pages that are freed
+    once a TLB invalidation batch has been flushed.
+
+Members:
+
+    PhysicalAddress - Stores the first physical address of the run.
+
+    PageCount - Stores the number of pages in the run.
+
+--*/
+
+typedef struct _MM_TLB_BATCH_FREE_RUN {
+    PHYSICAL_ADDRESS PhysicalAddress;
+    UINTN PageCount;
+} MM_TLB_BATCH_FREE_RUN, *PMM_TLB_BATCH_FREE_RUN;
+
+/*++
+
+Structure Description:
+
+    This structure defines a set of virtual address ranges in a single address
+    space that are invalidated together with one TLB shootdown.
+
+Members:
+
+    AddressSpace - Stores a pointer to the address space the ranges belong to.
+
+    RangeCount - Stores the number of valid elements in the range array.
+
+    PageCount - Stores the total number of pages across all ranges.
+
+    KernelRange - Stores a boolean indicating whether any of the ranges are in
+        kernel space, in which case every processor must be interrupted and
+        the entire TLB can never be flushed in place of individual entries.
+
+    FullFlush - Stores a boolean indicating that the batch has grown large
+        enough that the entire TLB should be flushed rather than the
+        individual ranges.
+
+    Ranges - Stores the array of ranges to invalidate.
+
+    FreeRunCount - Stores the number of valid elements in the free run array.
+
+    FreeRuns - Stores the array of physical pages that were unmapped from the
+        ranges and can only be freed once no processor can reach them. Paged
+        pages may only be freed with their image section lock held, so a
+        batch with free runs must be flushed before that lock is released.
+
+--*/
+
+typedef struct _MM_TLB_BATCH {
+    PADDRESS_SPACE AddressSpace;
+    ULONG RangeCount;
+    UINTN PageCount;
+    BOOL KernelRange;
+    BOOL FullFlush;
+    MM_TLB_BATCH_RANGE Ranges[MM_TLB_BATCH_RANGE_COUNT];
+    ULONG FreeRunCount;
+    MM_TLB_BATCH_FREE_RUN FreeRuns[MM_TLB_BATCH_FREE_RUN_COUNT];
+} MM_TLB_BATCH, *PMM_TLB_BATCH;
+
+/*++
+
+Structure Description:
+
+    This structure defines a processor's cache of free physical pages. Pages
+    in the cache are accounted as allocated non-paged pages in the global
+    statistics.
+
+Members:
+
+    Lock - Stores the spin lock serializing access to the cache. It is
+        acquired at dispatch level by the owning processor, and by other
+        processors draining the cache when memory is low.
+
+    Count - Stores the number of valid pages in the array.
+
+    Pages - Stores the physical addresses of the cached free pages.
+
+--*/
+
+typedef struct _PHYSICAL_PAGE_CACHE {
+    KSPIN_LOCK Lock;
+    UINTN Count;
+    PHYSICAL_ADDRESS Pages[PHYSICAL_PAGE_CACHE_SIZE];
+} PHYSICAL_PAGE_CACHE, *PPHYSICAL_PAGE_CACHE;
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -324,6 +529,19 @@ extern PHYSICAL_ADDRESS MmMaximumPhysicalAddress;
 
 extern PQUEUED_LOCK MmPhysicalPageLock;
 
+//
+// Stores the number of pages read back in from a page file.
+//
+
+extern UINTN MmRefaultedPageCount;
+
+//
+// Stores a count incremented whenever a page leaves the compressed swap store
+// because it was written back to its page file.
+//
+
+extern volatile ULONG MmCompressedSwapGeneration;
+
 //
 // Store a boolean indicating whether or not physical page zero is available.
 //
@@ -386,6 +604,12 @@ extern PKEVENT MmPagingFreePagesEvent;
 
 extern KSPIN_LOCK MmInvalidateIpiLock;
 
+//
+// Store the physical page cache used by the boot processor.
+//
+
+extern PHYSICAL_PAGE_CACHE MmBootPhysicalPageCache;
+
 //
 // Define cache line sizes for the CPU L1 caches.
 //
@@ -488,6 +712,38 @@ Return Value:
 
 --*/
 
+PHYSICAL_ADDRESS
+MmpTryAllocatePhysicalPages (
+    UINTN PageCount,
+    UINTN Alignment
+    );
+
+/*++
+
+Routine Description:
+
+    This routine allocates a run of physical pages only if a free buddy block
+    can satisfy it right away. It never pages out, waits, or scans the page
+    array, and it fails rather than dip into the minimum free page reserve.
+    Callers use it to opportunistically get larger runs and fall back to
+    smaller allocations when memory is fragmented. All allocated pages start
+    out as non-paged.
+
+Arguments:
+
+    PageCount - Supplies the number of consecutive physical pages required.
+
+    Alignment - Supplies the alignment requirement of the allocation, in pages.
+        Valid values are powers of 2. Values of 1 or 0 indicate no alignment
+        requirement.
+
+Return Value:
+
+    Returns the physical address of the first page of allocated memory on
+    success, or INVALID_PHYSICAL_ADDRESS on failure.
+
+--*/
+
 PHYSICAL_ADDRESS
 MmpAllocateIdentityMappablePhysicalPages (
     UINTN PageCount,
@@ -918,6 +1174,38 @@ Return Value:
 
 --*/
 
+BOOL
+MmpTestAndClearAccessedBit (
+    PADDRESS_SPACE AddressSpace,
+    PVOID VirtualAddress
+    );
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not the hardware has marked the given
+    page as accessed since the last time it was checked, and clears the
+    accessed state so that the next check can find out whether the page was
+    touched again in the meantime. This routine assumes the lock of the image
+    section owning the mapping is held.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space that owns the
+        mapping.
+
+    VirtualAddress - Supplies the virtual address of the page to check.
+
+Return Value:
+
+    TRUE if the page is mapped and was accessed since the last check.
+
+    FALSE if the page was not accessed, is not mapped, or the architecture
+    does not track accesses in hardware.
+
+--*/
+
 VOID
 MmpUnmapPageInOtherProcess (
     PADDRESS_SPACE AddressSpace,
@@ -994,7 +1282,8 @@ MmpChangeMemoryRegionAccess (
     PVOID VirtualAddress,
     ULONG PageCount,
     ULONG MapFlags,
-    ULONG MapFlagsMask
+    ULONG MapFlagsMask,
+    PMM_TLB_BATCH TlbBatch
     );
 
 /*++
@@ -1017,6 +1306,11 @@ Routine Description:
     MapFlagsMask - Supplies the bitfield of supplied MAP_FLAG_* values that are
         valid. If in doubt, use MAP_FLAG_ALL_MASK to make all values valid.
 
+    TlbBatch - Supplies an optional pointer to a TLB invalidation batch for
+        the address space owning the range. If supplied, changed translations
+        that other processors may hold are added to the batch rather than
+        being shot down before this routine returns.
+
 Return Value:
 
     None.
@@ -1569,7 +1863,8 @@ Return Value:
 KSTATUS
 MmpCopyImageSection (
     PIMAGE_SECTION SectionToCopy,
-    PADDRESS_SPACE DestinationAddressSpace
+    PADDRESS_SPACE DestinationAddressSpace,
+    PMM_TLB_BATCH TlbBatch
     );
 
 /*++
@@ -1585,6 +1880,10 @@ Routine Description:
     DestinationAddressSpace - Supplies a pointer to the address space to copy
         the image section to.
 
+    TlbBatch - Supplies a pointer to the TLB invalidation batch for the source
+        address space. The source range is added to this batch when its
+        mappings are made read-only. The caller must flush the batch.
+
 Return Value:
 
     STATUS_SUCCESS on success.
@@ -1832,7 +2131,8 @@ MmpClipImageSections (
     PLIST_ENTRY SectionListHead,
     PVOID Address,
     UINTN Size,
-    PLIST_ENTRY *ListEntryBefore
+    PLIST_ENTRY *ListEntryBefore,
+    PMM_TLB_BATCH TlbBatch
     );
 
 /*++
@@ -1856,6 +2156,11 @@ Routine Description:
     ListEntryBefore - Supplies an optional pointer to the list entry
         immediately before where the given address range starts.
 
+    TlbBatch - Supplies an optional pointer to a TLB invalidation batch for
+        the address space. If supplied, pages unmapped from the address space
+        are invalidated and freed when the caller flushes the batch, which
+        must happen before the address space lock is released.
+
 Return Value:
 
     Status code.
@@ -2061,7 +2366,8 @@ MmpSendTlbInvalidateIpi (
 
 Routine Description:
 
-    This routine invalidates the given TLB entry on all active processors.
+    This routine invalidates the given TLB entries on all processors that may
+    have them cached.
 
 Arguments:
 
@@ -2077,6 +2383,143 @@ Return Value:
 
 --*/
 
+VOID
+MmpInitializeTlbBatch (
+    PMM_TLB_BATCH Batch,
+    PADDRESS_SPACE AddressSpace
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes an empty TLB invalidation batch.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch to initialize.
+
+    AddressSpace - Supplies a pointer to the address space whose translations
+        will be invalidated.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+MmpAddTlbBatchRange (
+    PMM_TLB_BATCH Batch,
+    PVOID VirtualAddress,
+    UINTN PageCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine adds a range of pages to a TLB invalidation batch. The
+    translations are not invalidated until the batch is flushed.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch.
+
+    VirtualAddress - Supplies the first page-aligned virtual address of the
+        range.
+
+    PageCount - Supplies the number of pages in the range.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+MmpAddTlbBatchFreePages (
+    PMM_TLB_BATCH Batch,
+    PHYSICAL_ADDRESS PhysicalAddress,
+    UINTN PageCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine queues a run of physical pages to be freed once the given
+    batch has been flushed. The pages must already be unmapped, and their
+    translations added to the batch. If the batch has no room for the run, it
+    is flushed first. The caller must flush the batch before releasing the
+    lock of the image section that owns the pages.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch.
+
+    PhysicalAddress - Supplies the physical address of the first page to free.
+
+    PageCount - Supplies the number of contiguous pages to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+MmpFlushTlbBatch (
+    PMM_TLB_BATCH Batch
+    );
+
+/*++
+
+Routine Description:
+
+    This routine invalidates every range in the given batch on all processors
+    that may have them cached, using a single round of IPIs, frees any
+    physical pages queued on the batch, and then resets the batch to empty.
+    This routine must be called at or below dispatch level, and at low level
+    if physical pages were queued on the batch.
+
+Arguments:
+
+    Batch - Supplies a pointer to the batch to flush.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+MmpUpdateProcessorAddressSpace (
+    PVOID Processor,
+    PADDRESS_SPACE AddressSpace
+    );
+
+/*++
+
+Routine Description:
+
+    This routine records that the given processor is about to load the given
+    address space, so that TLB shootdowns for that address space reach it.
+    This must be called with interrupts disabled before the hardware
+    translation base is switched.
+
+Arguments:
+
+    Processor - Supplies a pointer to the current processor block.
+
+    AddressSpace - Supplies a pointer to the address space being switched to.
+
+Return Value:
+
+    None.
+
+--*/
+
 KSTATUS
 MmpInitializePaging (
     VOID
@@ -2166,6 +2609,65 @@ Return Value:
 
 --*/
 
+VOID
+MmpFaultAroundSection (
+    PIMAGE_SECTION ImageSection,
+    UINTN PageOffset
+    );
+
+/*++
+
+Routine Description:
+
+    This routine maps the pages that follow a freshly paged in page of a page
+    cache backed section, so long as they are already resident in the page
+    cache. No I/O is issued; the window stops at the first page that is not
+    cached. This routine must be called at low level.
+
+Arguments:
+
+    ImageSection - Supplies a pointer to the image section that took the
+        fault.
+
+    PageOffset - Supplies the offset, in pages, of the page that was just
+        paged in.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+MmpPopulateAddressRange (
+    PADDRESS_SPACE AddressSpace,
+    PVOID Address,
+    UINTN Size
+    );
+
+/*++
+
+Routine Description:
+
+    This routine pages in every page of the given range of mapped virtual
+    memory, so that later accesses do not take page faults. This routine must
+    be called at low level.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space the range belongs
+        to. This must be the current address space.
+
+    Address - Supplies the page aligned starting virtual address.
+
+    Size - Supplies the size of the range in bytes.
+
+Return Value:
+
+    Status code.
+
+--*/
+
 KSTATUS
 MmpPageOut (
     PPAGING_ENTRY PagingEntry,
@@ -2220,7 +2722,8 @@ MmpModifySectionMapping (
     PHYSICAL_ADDRESS PhysicalAddress,
     BOOL CreateMapping,
     PBOOL PageWasDirty,
-    BOOL SendTlbInvalidateIpi
+    BOOL SendTlbInvalidateIpi,
+    PMM_TLB_BATCH TlbBatch
     );
 
 /*++
@@ -2254,6 +2757,10 @@ Routine Description:
         invalidate IPI needs to be sent out for this mapping. If in doubt,
         specify TRUE.
 
+    TlbBatch - Supplies an optional pointer to a TLB invalidation batch. If
+        supplied, unmapping the page from a section in the batch's address
+        space adds the page to the batch instead of sending an IPI.
+
 Return Value:
 
     None.
@@ -2366,6 +2873,257 @@ Return Value:
 
 --*/
 
+//
+// Compressed swap functions.
+//
+
+VOID
+MmpInitializeCompressedSwap (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets up the compressed swap store that sits in front of the
+    page files. It is called when the first page file arrives. Failure is not
+    fatal: paging then simply goes straight to the page files.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+KSTATUS
+MmpCompressedSwapWrite (
+    PPAGE_FILE PageFile,
+    UINTN PageIndex,
+    UINTN PageCount,
+    PIO_BUFFER IoBuffer
+    );
+
+/*++
+
+Routine Description:
+
+    This routine attempts to store a run of page file pages in compressed
+    memory instead of writing them to the page file. Either every page is
+    stored, or none of them are and any older copies are discarded.
+
+Arguments:
+
+    PageFile - Supplies a pointer to the page file the pages belong to.
+
+    PageIndex - Supplies the index of the first page within the page file.
+
+    PageCount - Supplies the number of pages to store.
+
+    IoBuffer - Supplies a pointer to the I/O buffer containing the data,
+        starting at its current offset.
+
+Return Value:
+
+    STATUS_SUCCESS if all pages were stored.
+
+    STATUS_INSUFFICIENT_RESOURCES if the store is full.
+
+    STATUS_NOT_SUPPORTED if the store is disabled or the data does not
+    compress well enough to be worth keeping.
+
+    Other errors if the I/O buffer could not be read.
+
+--*/
+
+KSTATUS
+MmpCompressedSwapRead (
+    PPAGE_FILE PageFile,
+    UINTN PageIndex,
+    UINTN PageCount,
+    PIO_BUFFER IoBuffer,
+    BOOL Partial
+    );
+
+/*++
+
+Routine Description:
+
+    This routine reads a run of page file pages out of the compressed store.
+
+Arguments:
+
+    PageFile - Supplies a pointer to the page file the pages belong to.
+
+    PageIndex - Supplies the index of the first page within the page file.
+
+    PageCount - Supplies the number of pages to read.
+
+    IoBuffer - Supplies a pointer to the I/O buffer to decompress into,
+        starting at its current offset.
+
+    Partial - Supplies a boolean indicating whether to copy out whichever
+        pages are present (TRUE) or to copy nothing unless every page is
+        present (FALSE).
+
+Return Value:
+
+    STATUS_SUCCESS if every page was found and copied.
+
+    STATUS_NOT_FOUND if at least one page is not in the store.
+
+    Other errors if the I/O buffer could not be written or the compressed
+    data is corrupt.
+
+--*/
+
+VOID
+MmpCompressedSwapInvalidate (
+    PPAGE_FILE PageFile,
+    UINTN PageIndex,
+    UINTN PageCount
+    );
+
+/*++
+
+Routine Description:
+
+    This routine discards any compressed copies of the given page file pages.
+
+Arguments:
+
+    PageFile - Supplies a pointer to the page file the pages belong to.
+
+    PageIndex - Supplies the index of the first page within the page file.
+
+    PageCount - Supplies the number of pages to discard.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+MmpCompressedSwapWriteBack (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine writes the least recently stored compressed pages out to
+    their page files until the store has a reasonable amount of space free.
+    This routine must be called at low level without any page file locks
+    held.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+MmpGetCompressedSwapStatistics (
+    PMM_STATISTICS Statistics
+    );
+
+/*++
+
+Routine Description:
+
+    This routine fills out the compressed swap portion of the given memory
+    statistics structure.
+
+Arguments:
+
+    Statistics - Supplies a pointer to the statistics to fill in.
+
+Return Value:
+
+    None.
+
+--*/
+
+ULONG
+MmpCompressPage (
+    PVOID Source,
+    ULONG SourceSize,
+    PVOID Destination,
+    ULONG DestinationSize,
+    PUSHORT HashTable
+    );
+
+/*++
+
+Routine Description:
+
+    This routine compresses a buffer with a fast LZ77 codec that uses the LZ4
+    block format.
+
+Arguments:
+
+    Source - Supplies a pointer to the data to compress.
+
+    SourceSize - Supplies the size of the data in bytes. This must be less
+        than 64 kilobytes.
+
+    Destination - Supplies a pointer where the compressed data is returned.
+
+    DestinationSize - Supplies the size of the destination buffer in bytes.
+
+    HashTable - Supplies a pointer to scratch space of
+        COMPRESSION_HASH_TABLE_SIZE entries used to find matches.
+
+Return Value:
+
+    Returns the size of the compressed data in bytes.
+
+    0 if the compressed data did not fit in the destination buffer.
+
+--*/
+
+BOOL
+MmpDecompressPage (
+    PVOID Source,
+    ULONG SourceSize,
+    PVOID Destination,
+    ULONG DestinationSize
+    );
+
+/*++
+
+Routine Description:
+
+    This routine decompresses data produced by the compress page routine.
+
+Arguments:
+
+    Source - Supplies a pointer to the compressed data.
+
+    SourceSize - Supplies the size of the compressed data in bytes.
+
+    Destination - Supplies a pointer where the decompressed data is returned.
+
+    DestinationSize - Supplies the exact size of the decompressed data.
+
+Return Value:
+
+    TRUE if the data decompressed to exactly the destination size.
+
+    FALSE if the compressed data is corrupt.
+
+--*/
+
 BOOL
 MmpCheckUserModeCopyRoutines (
     PTRAP_FRAME TrapFrame
@@ -162,51 +162,6 @@ typedef struct _PAGE_FILE_IO_CONTEXT {
     BOOL Write;
 } PAGE_FILE_IO_CONTEXT, *PPAGE_FILE_IO_CONTEXT;
 
-/*++
-
-Structure Description:
-
-    This structure embodies a memory page backing store.
-
-Members:
-
-    ListEntry - Stores pointers to the next and previous paging store entries.
-
-    Handle - Stores the open handle to the backing store.
-
-    Lock - Stores a pointer to the lock that synchronizes access to this
-        structure.
-
-    Bitmap - Stores a pointer to the bitmap indicating which pages are free
-        and which are in use.
-
-    PagingOutIrp - Stores a pointer to an IRP used for paging out to this page
-        file.
-
-    PageCount - Stores the number of pages this backing store can hold.
-
-    FreePages - Stores the number of free pages in this backing store.
-
-    LastAllocatedPage - Stores the index into the backing store of the most
-        recently allocated backing store.
-
-    FailedAllocations - Stores the number of times this page file has failed
-        to meet a request for page file space.
-
---*/
-
-typedef struct _PAGE_FILE {
-    LIST_ENTRY ListEntry;
-    PIO_HANDLE Handle;
-    PQUEUED_LOCK Lock;
-    PULONG Bitmap;
-    PIRP PagingOutIrp;
-    UINTN PageCount;
-    UINTN FreePages;
-    UINTN LastAllocatedPage;
-    UINTN FailedAllocations;
-} PAGE_FILE, *PPAGE_FILE;
-
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -315,6 +270,13 @@ MmpMapPageInSection (
     BOOL LockPage
     );
 
+VOID
+MmpRestoreAccessedMapping (
+    PIMAGE_SECTION Section,
+    PVOID VirtualAddress,
+    ULONG Attributes
+    );
+
 KSTATUS
 MmpAllocatePageInStructures (
     PIMAGE_SECTION Section,
@@ -800,6 +762,7 @@ Return Value:
     return Status;
 }
 
+KERNEL_API
 KSTATUS
 MmAllocatePageFileSpace (
     PIMAGE_BACKING ImageBacking,
@@ -916,6 +879,7 @@ Return Value:
     return Status;
 }
 
+KERNEL_API
 VOID
 MmFreePageFileSpace (
     PIMAGE_BACKING ImageBacking,
@@ -1016,6 +980,7 @@ Return Value:
     return;
 }
 
+KERNEL_API
 KSTATUS
 MmPageFilePerformIo (
     PIMAGE_BACKING ImageBacking,
@@ -1250,6 +1215,313 @@ Return Value:
     return Status;
 }
 
+VOID
+MmpFaultAroundSection (
+    PIMAGE_SECTION ImageSection,
+    UINTN PageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps the pages that follow a freshly paged in page of a page
+    cache backed section, so long as they are already resident in the page
+    cache. No I/O is issued; the window stops at the first page that is not
+    cached. This routine must be called at low level.
+
+Arguments:
+
+    ImageSection - Supplies a pointer to the image section that took the
+        fault.
+
+    PageOffset - Supplies the offset, in pages, of the page that was just
+        paged in.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BitmapIndex;
+    ULONG BitmapMask;
+    UINTN BytesRead;
+    UINTN Index;
+    PIO_BUFFER IoBuffer;
+    IO_BUFFER IoBufferData;
+    ULONG IoFlags;
+    UINTN PageCount;
+    PPAGE_CACHE_ENTRY PageCacheEntry;
+    ULONG PageShift;
+    UINTN PageSize;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    IO_OFFSET ReadOffset;
+    PIMAGE_SECTION OwningSection;
+    UINTN SectionPageCount;
+    KSTATUS Status;
+    ULONG TruncateCount;
+    PVOID VirtualAddress;
+    UINTN WindowOffset;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    //
+    // Only private sections aligned with the page cache can map page cache
+    // pages directly. Non-paged sections are fully populated when created.
+    //
+
+    if ((ImageSection->Flags &
+         (IMAGE_SECTION_BACKED | IMAGE_SECTION_SHARED |
+          IMAGE_SECTION_NO_IMAGE_BACKING | IMAGE_SECTION_NON_PAGED)) !=
+        IMAGE_SECTION_BACKED) {
+
+        return;
+    }
+
+    PageShift = MmPageShift();
+    PageSize = MmPageSize();
+    WindowOffset = PageOffset + 1;
+    VirtualAddress = ImageSection->VirtualAddress + (WindowOffset << PageShift);
+
+    //
+    // Clip the window to the section while the lock is held. If the page
+    // right after the faulting one is already mapped, assume the window was
+    // handled by an earlier fault.
+    //
+
+    KeAcquireQueuedLock(ImageSection->Lock);
+    SectionPageCount = ImageSection->Size >> PageShift;
+    if (((ImageSection->Flags & IMAGE_SECTION_DESTROYED) != 0) ||
+        (ImageSection->ImageBacking.DeviceHandle == INVALID_HANDLE) ||
+        (WindowOffset >= SectionPageCount) ||
+        (MmpVirtualToPhysical(VirtualAddress, NULL) !=
+         INVALID_PHYSICAL_ADDRESS)) {
+
+        KeReleaseQueuedLock(ImageSection->Lock);
+        return;
+    }
+
+    PageCount = SectionPageCount - WindowOffset;
+    if (PageCount > MM_FAULT_AROUND_PAGE_COUNT) {
+        PageCount = MM_FAULT_AROUND_PAGE_COUNT;
+    }
+
+    MmpImageSectionAddImageBackingReference(ImageSection);
+    TruncateCount = ImageSection->TruncateCount;
+    KeReleaseQueuedLock(ImageSection->Lock);
+
+    //
+    // Collect whatever part of the window is resident in the page cache.
+    //
+
+    IoBuffer = &IoBufferData;
+    Status = MmInitializeIoBuffer(IoBuffer,
+                                  NULL,
+                                  INVALID_PHYSICAL_ADDRESS,
+                                  0,
+                                  IO_BUFFER_FLAG_KERNEL_MODE_DATA);
+
+    if (!KSUCCESS(Status)) {
+        MmpImageSectionReleaseImageBackingReference(ImageSection);
+        return;
+    }
+
+    ReadOffset = ImageSection->ImageBacking.Offset +
+                 (WindowOffset << PageShift);
+
+    IoFlags = IO_FLAG_SERVICING_FAULT | IO_FLAG_CACHE_ONLY;
+    Status = IoReadAtOffset(ImageSection->ImageBacking.DeviceHandle,
+                            IoBuffer,
+                            ReadOffset,
+                            PageCount << PageShift,
+                            IoFlags,
+                            WAIT_TIME_INDEFINITE,
+                            &BytesRead,
+                            NULL);
+
+    MmpImageSectionReleaseImageBackingReference(ImageSection);
+    if ((!KSUCCESS(Status)) || (BytesRead == 0)) {
+        goto FaultAroundSectionEnd;
+    }
+
+    PageCount = ALIGN_RANGE_UP(BytesRead, PageSize) >> PageShift;
+
+    //
+    // Map each resident page that is still clean and unmapped. If the section
+    // was truncated while the lock was released, the pages read may have
+    // been evicted, so give up on the window.
+    //
+
+    KeAcquireQueuedLock(ImageSection->Lock);
+    if (((ImageSection->Flags & IMAGE_SECTION_DESTROYED) != 0) ||
+        (ImageSection->TruncateCount != TruncateCount)) {
+
+        KeReleaseQueuedLock(ImageSection->Lock);
+        goto FaultAroundSectionEnd;
+    }
+
+    SectionPageCount = ImageSection->Size >> PageShift;
+    for (Index = 0; Index < PageCount; Index += 1) {
+        PageOffset = WindowOffset + Index;
+        if (PageOffset >= SectionPageCount) {
+            break;
+        }
+
+        VirtualAddress = ImageSection->VirtualAddress +
+                         (PageOffset << PageShift);
+
+        PhysicalAddress = MmpVirtualToPhysical(VirtualAddress, NULL);
+        if (PhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
+            continue;
+        }
+
+        PageCacheEntry = MmGetIoBufferPageCacheEntry(IoBuffer,
+                                                     Index << PageShift);
+
+        if (PageCacheEntry == NULL) {
+            continue;
+        }
+
+        PhysicalAddress = MmGetIoBufferPhysicalAddress(IoBuffer,
+                                                       Index << PageShift);
+
+        ASSERT(PhysicalAddress ==
+               IoGetPageCacheEntryPhysicalAddress(PageCacheEntry));
+
+        //
+        // A dirty page belongs in the page file, not the page cache. Leave it
+        // for a real fault. The owning section is either this section or one
+        // of its ancestors, which the inheritance chain keeps alive, so the
+        // reference can be dropped with the lock held.
+        //
+
+        BitmapIndex = IMAGE_SECTION_BITMAP_INDEX(PageOffset);
+        BitmapMask = IMAGE_SECTION_BITMAP_MASK(PageOffset);
+        OwningSection = MmpGetOwningSection(ImageSection, PageOffset);
+        if (((OwningSection->Flags & IMAGE_SECTION_DESTROYED) == 0) &&
+            ((OwningSection->DirtyPageBitmap[BitmapIndex] & BitmapMask) == 0)) {
+
+            MmpMapPageInSection(OwningSection,
+                                PageOffset,
+                                PhysicalAddress,
+                                NULL,
+                                FALSE);
+        }
+
+        MmpImageSectionReleaseReference(OwningSection);
+    }
+
+    KeReleaseQueuedLock(ImageSection->Lock);
+
+FaultAroundSectionEnd:
+    MmFreeIoBuffer(IoBuffer);
+    return;
+}
+
+KSTATUS
+MmpPopulateAddressRange (
+    PADDRESS_SPACE AddressSpace,
+    PVOID Address,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pages in every page of the given range of mapped virtual
+    memory, so that later accesses do not take page faults. This routine must
+    be called at low level.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space the range belongs
+        to. This must be the current address space.
+
+    Address - Supplies the page aligned starting virtual address.
+
+    Size - Supplies the size of the range in bytes.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    PVOID CurrentAddress;
+    PVOID EndAddress;
+    PIMAGE_SECTION ImageSection;
+    UINTN PageOffset;
+    ULONG PageSize;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    PageSize = MmPageSize();
+
+    ASSERT(IS_ALIGNED((UINTN)Address, PageSize) != FALSE);
+
+    CurrentAddress = Address;
+    EndAddress = Address + Size;
+    Status = STATUS_SUCCESS;
+    while (CurrentAddress < EndAddress) {
+        if (MmpVirtualToPhysical(CurrentAddress, NULL) !=
+            INVALID_PHYSICAL_ADDRESS) {
+
+            CurrentAddress += PageSize;
+            continue;
+        }
+
+        Status = MmpLookupSection(CurrentAddress,
+                                  AddressSpace,
+                                  &ImageSection,
+                                  &PageOffset);
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        //
+        // Skip over sections that cannot be accessed at all, as touching them
+        // would fault anyway.
+        //
+
+        if ((ImageSection->Flags & IMAGE_SECTION_ACCESS_MASK) == 0) {
+            CurrentAddress = ImageSection->VirtualAddress + ImageSection->Size;
+            MmpImageSectionReleaseReference(ImageSection);
+            continue;
+        }
+
+        Status = MmpPageIn(ImageSection, PageOffset, NULL);
+        if (KSUCCESS(Status)) {
+            MmpFaultAroundSection(ImageSection, PageOffset);
+        }
+
+        MmpImageSectionReleaseReference(ImageSection);
+
+        //
+        // If the section shrunk in the meantime, look it up again.
+        //
+
+        if (Status == STATUS_TRY_AGAIN) {
+            continue;
+        }
+
+        if (!KSUCCESS(Status)) {
+            break;
+        }
+
+        CurrentAddress += PageSize;
+    }
+
+    return Status;
+}
+
 KSTATUS
 MmpPageOut (
     PPAGING_ENTRY PagingEntry,
@@ -1480,7 +1752,8 @@ Return Value:
                                 INVALID_PHYSICAL_ADDRESS,
                                 FALSE,
                                 &Dirty,
-                                TRUE);
+                                TRUE,
+                                NULL);
 
         //
         // If the page is dirty, it will need to be written out to disk. Ignore
@@ -1631,7 +1904,8 @@ MmpModifySectionMapping (
     PHYSICAL_ADDRESS PhysicalAddress,
     BOOL CreateMapping,
     PBOOL PageWasDirty,
-    BOOL SendTlbInvalidateIpi
+    BOOL SendTlbInvalidateIpi,
+    PMM_TLB_BATCH TlbBatch
     )
 
 /*++
@@ -1665,6 +1939,10 @@ Routine Description:
         invalidate IPI needs to be sent out for this mapping. If in doubt,
         specify TRUE.
 
+    TlbBatch - Supplies an optional pointer to a TLB invalidation batch. If
+        supplied, unmapping the page from a section in the batch's address
+        space adds the page to the batch instead of sending an IPI.
+
 Return Value:
 
     None.
@@ -1791,9 +2069,24 @@ Return Value:
                         MmpMapPage(PhysicalAddress, VirtualAddress, MapFlags);
 
                     //
-                    // Unmap the page in the current process.
+                    // Unmap the page in the current process, leaving the
+                    // shootdown to the batch if there is one.
                     //
 
+                    } else if ((TlbBatch != NULL) &&
+                               (TlbBatch->AddressSpace ==
+                                CurrentSection->AddressSpace)) {
+
+                        MmpUnmapPages(VirtualAddress,
+                                      1,
+                                      0,
+                                      &ThisPageWasDirty);
+
+                        MmpAddTlbBatchRange(TlbBatch, VirtualAddress, 1);
+                        if (ThisPageWasDirty != FALSE) {
+                            Dirty = TRUE;
+                        }
+
                     } else {
                         MmpUnmapPages(VirtualAddress,
                                       1,
@@ -1953,6 +2246,7 @@ Return Value:
         MmpImageSectionAddReference(ImageSection);
         PagingEntry->Section = ImageSection;
         PagingEntry->U.SectionOffset = SectionOffset;
+        PagingEntry->U.Flags = PAGING_ENTRY_FLAG_REFERENCED;
     }
 
 CreatePagingEntryEnd:
@@ -1995,6 +2289,7 @@ Return Value:
     MmpImageSectionAddReference(ImageSection);
     PagingEntry->Section = ImageSection;
     PagingEntry->U.SectionOffset = SectionOffset;
+    PagingEntry->U.Flags |= PAGING_ENTRY_FLAG_REFERENCED;
     return;
 }
 
@@ -2208,6 +2503,7 @@ Return Value:
         }
 
         MmPagingThreadCreated = TRUE;
+        MmpInitializeCompressedSwap();
     }
 
     //
@@ -2516,6 +2812,7 @@ Return Value:
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
+    MmpCompressedSwapInvalidate(PageFile, Allocation, PageCount);
     KeAcquireQueuedLock(PageFile->Lock);
     for (CurrentIndex = Allocation;
          CurrentIndex < Allocation + PageCount;
@@ -2771,9 +3068,7 @@ Return Value:
                                                        &Attributes);
 
         if (ExistingPhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
-
-            ASSERT((Attributes & MAP_FLAG_PRESENT) != 0);
-
+            MmpRestoreAccessedMapping(ImageSection, VirtualAddress, Attributes);
             Status = STATUS_SUCCESS;
             break;
         }
@@ -3137,9 +3432,7 @@ Return Value:
                                                        &Attributes);
 
         if (ExistingPhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
-
-            ASSERT((Attributes & MAP_FLAG_PRESENT) != 0);
-
+            MmpRestoreAccessedMapping(ImageSection, VirtualAddress, Attributes);
             Status = STATUS_SUCCESS;
             goto PageInSharedSectionEnd;
         }
@@ -3233,9 +3526,7 @@ Return Value:
 
         if ((LockedIoBuffer == NULL) &&
             (ExistingPhysicalAddress != INVALID_PHYSICAL_ADDRESS)) {
-
-            ASSERT((Attributes & MAP_FLAG_PRESENT) != 0);
-
+            MmpRestoreAccessedMapping(ImageSection, VirtualAddress, Attributes);
             Status = STATUS_SUCCESS;
             break;
         }
@@ -4128,6 +4419,7 @@ Return Value:
 
 {
 
+    ULONG Attributes;
     UINTN BitmapIndex;
     ULONG BitmapMask;
     PHYSICAL_ADDRESS LockedPhysicalAddress;
@@ -4148,12 +4440,16 @@ Return Value:
     // fault.
     //
 
-    *ExistingPhysicalAddress = MmpVirtualToPhysical(VirtualAddress, NULL);
+    *ExistingPhysicalAddress = MmpVirtualToPhysical(VirtualAddress,
+                                                    &Attributes);
+
     if (*ExistingPhysicalAddress == INVALID_PHYSICAL_ADDRESS) {
         Status = STATUS_NOT_FOUND;
         goto CheckExistingMappingEnd;
     }
 
+    MmpRestoreAccessedMapping(Section, VirtualAddress, Attributes);
+
     //
     // If there is no request to lock the page, then return successfully.
     //
@@ -4307,9 +4603,7 @@ Return Value:
                                                        &Attributes);
 
         if (ExistingPhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
-
-            ASSERT((Attributes & MAP_FLAG_PRESENT) != 0);
-
+            MmpRestoreAccessedMapping(ImageSection, VirtualAddress, Attributes);
             Status = STATUS_SUCCESS;
             break;
         }
@@ -4494,9 +4788,7 @@ Return Value:
                                                        &Attributes);
 
         if (ExistingPhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
-
-            ASSERT((Attributes & MAP_FLAG_PRESENT) != 0);
-
+            MmpRestoreAccessedMapping(ImageSection, VirtualAddress, Attributes);
             Status = STATUS_SUCCESS;
             break;
         }
@@ -4989,6 +5281,10 @@ Return Value:
         MmpSyncSwapPage(SwapSpace, PageSize);
     }
 
+    if (KSUCCESS(Status)) {
+        RtlAtomicAdd(&MmRefaultedPageCount, 1);
+    }
+
 ReadPageFileEnd:
     MmpUnmapPages(SwapSpace, 1, UNMAP_FLAG_SEND_INVALIDATE_IPI, NULL);
     return Status;
@@ -5022,24 +5318,55 @@ Return Value:
 {
 
     PDEVICE Device;
+    ULONG Generation;
     PIRP Irp;
+    UINTN PageCount;
     PPAGE_FILE PageFile;
+    UINTN PageIndex;
+    ULONG PageShift;
     KSTATUS Status;
 
     PageFile = (PPAGE_FILE)ImageBacking->DeviceHandle;
     IoContext->Offset = ImageBacking->Offset + IoContext->Offset;
+    PageShift = MmPageShift();
+    PageIndex = IoContext->Offset >> PageShift;
+    PageCount = IoContext->SizeInBytes >> PageShift;
 
     ASSERT(IS_ALIGNED(IoContext->SizeInBytes, MmPageSize()) != FALSE);
     ASSERT(IS_ALIGNED(IoContext->Offset, MmPageSize()) != FALSE);
 
-    //
-    // All page file writes must be serialized. If the file system's block size
-    // is greater than a page, it may perform a read-modify-write operation. If
-    // multiple read-modify-write operations were not synchronized, the page
-    // file could be corrupted.
-    //
-
     if (IoContext->Write != FALSE) {
+
+        //
+        // Try to keep the pages compressed in memory first. If the store is
+        // full, push its oldest pages out to disk and try once more.
+        //
+
+        Status = MmpCompressedSwapWrite(PageFile,
+                                        PageIndex,
+                                        PageCount,
+                                        IoContext->IoBuffer);
+
+        if (Status == STATUS_INSUFFICIENT_RESOURCES) {
+            MmpCompressedSwapWriteBack();
+            Status = MmpCompressedSwapWrite(PageFile,
+                                            PageIndex,
+                                            PageCount,
+                                            IoContext->IoBuffer);
+        }
+
+        if (KSUCCESS(Status)) {
+            IoContext->BytesCompleted = IoContext->SizeInBytes;
+            goto PageFilePerformIoEnd;
+        }
+
+        //
+        // All page file writes must be serialized. If the file system's block
+        // size is greater than a page, it may perform a read-modify-write
+        // operation. If multiple read-modify-write operations were not
+        // synchronized, the page file could be corrupted.
+        //
+
         KeAcquireQueuedLock(PageFile->Lock);
         Status = IoWriteAtOffset(PageFile->Handle,
                                  IoContext->IoBuffer,
@@ -5053,30 +5380,82 @@ Return Value:
         KeReleaseQueuedLock(PageFile->Lock);
 
     } else {
+
+        //
+        // Pages still held in the compressed swap store are newer than
+        // anything in the page file. If only some of the pages are there, read
+        // the page file and then lay the stored pages over the top. Write
+        // back may move a page from the store to the page file in between, in
+        // which case the read is simply tried again.
+        //
+
         Irp = IoContext->Irp;
-        if (Irp == NULL) {
-            Status = IoGetDevice(PageFile->Handle, &Device);
-            if (!KSUCCESS(Status)) {
-                goto PageFilePerformIoEnd;
+        while (TRUE) {
+            Generation = MmCompressedSwapGeneration;
+            RtlMemoryBarrier();
+            Status = MmpCompressedSwapRead(PageFile,
+                                           PageIndex,
+                                           PageCount,
+                                           IoContext->IoBuffer,
+                                           FALSE);
+
+            if (KSUCCESS(Status)) {
+                IoContext->BytesCompleted = IoContext->SizeInBytes;
+                break;
+            }
+
+            if (Status != STATUS_NOT_FOUND) {
+                break;
             }
 
-            Irp = IoCreateIrp(Device, IrpMajorIo, IRP_CREATE_FLAG_NO_ALLOCATE);
             if (Irp == NULL) {
-                Status = STATUS_INSUFFICIENT_RESOURCES;
-                goto PageFilePerformIoEnd;
+                Status = IoGetDevice(PageFile->Handle, &Device);
+                if (!KSUCCESS(Status)) {
+                    break;
+                }
+
+                Irp = IoCreateIrp(Device,
+                                  IrpMajorIo,
+                                  IRP_CREATE_FLAG_NO_ALLOCATE);
+
+                if (Irp == NULL) {
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                    break;
+                }
+            }
+
+            Status = IoReadAtOffset(PageFile->Handle,
+                                    IoContext->IoBuffer,
+                                    IoContext->Offset,
+                                    IoContext->SizeInBytes,
+                                    IoContext->Flags | IO_FLAG_NO_ALLOCATE,
+                                    IoContext->TimeoutInMilliseconds,
+                                    &(IoContext->BytesCompleted),
+                                    Irp);
+
+            if (!KSUCCESS(Status)) {
+                break;
+            }
+
+            Status = MmpCompressedSwapRead(PageFile,
+                                           PageIndex,
+                                           PageCount,
+                                           IoContext->IoBuffer,
+                                           TRUE);
+
+            if (Status == STATUS_NOT_FOUND) {
+                Status = STATUS_SUCCESS;
             }
-        }
 
-        Status = IoReadAtOffset(PageFile->Handle,
-                                IoContext->IoBuffer,
-                                IoContext->Offset,
-                                IoContext->SizeInBytes,
-                                IoContext->Flags | IO_FLAG_NO_ALLOCATE,
-                                IoContext->TimeoutInMilliseconds,
-                                &(IoContext->BytesCompleted),
-                                Irp);
+            RtlMemoryBarrier();
+            if ((!KSUCCESS(Status)) ||
+                (Generation == MmCompressedSwapGeneration)) {
 
-        if (Irp != IoContext->Irp) {
+                break;
+            }
+        }
+
+        if ((Irp != NULL) && (Irp != IoContext->Irp)) {
             IoDestroyIrp(Irp);
         }
     }
@@ -5218,7 +5597,8 @@ Return Value:
                             PhysicalAddress,
                             TRUE,
                             NULL,
-                            FALSE);
+                            FALSE,
+                            NULL);
 
     //
     // If a paging entry was supplied, then mark the page as pageable,
@@ -5241,6 +5621,61 @@ Return Value:
     return;
 }
 
+VOID
+MmpRestoreAccessedMapping (
+    PIMAGE_SECTION Section,
+    PVOID VirtualAddress,
+    ULONG Attributes
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes an existing mapping present again if it was only made
+    inaccessible to catch the next access to the page. Architectures that
+    emulate the accessed bit do this when the paging thread samples the page.
+    This routine assumes the section lock is held.
+
+Arguments:
+
+    Section - Supplies a pointer to the faulting image section.
+
+    VirtualAddress - Supplies the virtual address of the existing mapping.
+
+    Attributes - Supplies the attributes of the existing mapping. See MAP_FLAG_*
+        for definitions.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG MapFlags;
+
+    ASSERT(KeIsQueuedLockHeld(Section->Lock) != FALSE);
+
+    if ((Attributes & MAP_FLAG_PRESENT) != 0) {
+        return;
+    }
+
+    MapFlags = MAP_FLAG_PRESENT;
+    if ((Section->Flags & IMAGE_SECTION_EXECUTABLE) != 0) {
+        MapFlags |= MAP_FLAG_EXECUTE;
+    }
+
+    MmpChangeMemoryRegionAccess(VirtualAddress,
+                                1,
+                                MapFlags,
+                                MAP_FLAG_PRESENT,
+                                NULL);
+
+    return;
+}
+
 KSTATUS
 MmpAllocatePageInStructures (
     PIMAGE_SECTION Section,
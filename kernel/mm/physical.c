@@ -101,6 +101,29 @@ Module Name:
 
 #define PAGING_EVENT_SIGNAL_PAGE_COUNT 0x10
 
+//
+// Define the distance between the two hands of the paging clock, as a
+// fraction of physical memory. The front hand clears the referenced state of
+// pages and the back hand evicts pages that have not been referenced again by
+// the time it gets to them.
+//
+
+#define PAGING_CLOCK_HAND_SPREAD_DIVISOR 4
+
+//
+// Define the number of block orders tracked by each segment's buddy bitmaps.
+// The largest block is 2^(count - 1) pages. Requests larger than that fall
+// back to a linear scan of the physical page array.
+//
+
+#define PHYSICAL_BUDDY_ORDER_COUNT 11
+
+//
+// Define the number of bits in one word of a buddy bitmap.
+//
+
+#define PHYSICAL_BUDDY_MAP_BITS (sizeof(ULONG) * BITS_PER_BYTE)
+
 //
 // --------------------------------------------------------------------- Macros
 //
@@ -120,6 +143,15 @@ Module Name:
      ((_Type) == MemoryTypeFirmwareTemporary) ||                \
      ((_Type) == MemoryTypeBootPageTables))
 
+//
+// These macros return the word index and bit mask within a buddy bitmap for
+// the given block index.
+//
+
+#define PHYSICAL_BUDDY_MAP_WORD(_Index) ((_Index) / PHYSICAL_BUDDY_MAP_BITS)
+#define PHYSICAL_BUDDY_MAP_MASK(_Index) \
+    ((ULONG)1 << ((_Index) % PHYSICAL_BUDDY_MAP_BITS))
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -177,6 +209,24 @@ Structure Description:
 
     FreePages - Stores the number of unallocated pages in the segment.
 
+    StartPage - Stores the page frame number of the first page in the segment.
+
+    BuddyMap - Stores an array of bitmaps, one per block order. A set bit
+        indicates that the corresponding naturally aligned block of
+        2^order pages is entirely free and not part of a larger free block.
+
+    FirstBlock - Stores the index (page frame number shifted right by the
+        order) of the first block of each order that lies entirely within the
+        segment. Bit zero of each bitmap corresponds to this block.
+
+    BlockCount - Stores the number of blocks of each order that lie entirely
+        within the segment.
+
+    FreeBlocks - Stores the number of bits set in each order's bitmap.
+
+    SearchHint - Stores the bitmap word index at which to start the next
+        search for a free block of each order.
+
 --*/
 
 typedef struct _PHYSICAL_MEMORY_SEGMENT {
@@ -184,6 +234,12 @@ typedef struct _PHYSICAL_MEMORY_SEGMENT {
     PHYSICAL_ADDRESS StartAddress;
     PHYSICAL_ADDRESS EndAddress;
     UINTN FreePages;
+    UINTN StartPage;
+    PULONG BuddyMap[PHYSICAL_BUDDY_ORDER_COUNT];
+    UINTN FirstBlock[PHYSICAL_BUDDY_ORDER_COUNT];
+    UINTN BlockCount[PHYSICAL_BUDDY_ORDER_COUNT];
+    UINTN FreeBlocks[PHYSICAL_BUDDY_ORDER_COUNT];
+    UINTN SearchHint[PHYSICAL_BUDDY_ORDER_COUNT];
 } PHYSICAL_MEMORY_SEGMENT, *PPHYSICAL_MEMORY_SEGMENT;
 
 /*++
@@ -249,6 +305,96 @@ MmpUpdatePhysicalMemoryStatistics (
     BOOL Allocation
     );
 
+PPHYSICAL_MEMORY_SEGMENT
+MmpGetPhysicalMemorySegment (
+    PHYSICAL_ADDRESS PhysicalAddress
+    );
+
+PPHYSICAL_MEMORY_SEGMENT
+MmpAllocateFreePhysicalPages (
+    UINTN PageCount,
+    UINTN PageAlignment,
+    PUINTN SelectedPageOffset
+    );
+
+PPHYSICAL_MEMORY_SEGMENT
+MmpAllocateFreeBuddyPages (
+    UINTN PageCount,
+    UINTN PageAlignment,
+    PUINTN SelectedPageOffset
+    );
+
+UINTN
+MmpInitializePhysicalBuddy (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    PULONG Buffer
+    );
+
+BOOL
+MmpPhysicalBuddyAllocate (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    ULONG Order,
+    PUINTN Page
+    );
+
+VOID
+MmpPhysicalBuddyInsert (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    ULONG Order,
+    UINTN Block
+    );
+
+VOID
+MmpPhysicalBuddyFreeRange (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    UINTN Page,
+    UINTN PageCount
+    );
+
+VOID
+MmpPhysicalBuddyRemoveRange (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    UINTN Page,
+    UINTN PageCount
+    );
+
+PHYSICAL_ADDRESS
+MmpAllocateCachedPhysicalPage (
+    VOID
+    );
+
+BOOL
+MmpFreeCachedPhysicalPage (
+    PHYSICAL_ADDRESS PhysicalAddress
+    );
+
+VOID
+MmpInsertCachedPhysicalPages (
+    PPHYSICAL_ADDRESS Pages,
+    UINTN PageCount
+    );
+
+VOID
+MmpReleaseCachedPhysicalPages (
+    PPHYSICAL_ADDRESS Pages,
+    UINTN PageCount
+    );
+
+VOID
+MmpDrainPhysicalPageCaches (
+    VOID
+    );
+
+VOID
+MmpAdvancePagingClockFrontHand (
+    UINTN PageCount
+    );
+
+BOOL
+MmpTestAndClearPageReferenced (
+    PPAGING_ENTRY PagingEntry
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -308,6 +454,23 @@ UINTN MmLastAllocatedSegmentOffset;
 PPHYSICAL_MEMORY_SEGMENT MmLastPagedSegment;
 UINTN MmLastPagedSegmentOffset;
 
+//
+// Store the position of the front hand of the paging clock, which runs ahead
+// of the last paged position clearing the referenced state of pages.
+//
+
+PPHYSICAL_MEMORY_SEGMENT MmPagingClockFrontSegment;
+UINTN MmPagingClockFrontOffset;
+
+//
+// Store paging statistics: the number of pages paged out, read back in from a
+// page file, and spared by the pager because they were recently referenced.
+//
+
+UINTN MmPagedOutPageCount;
+UINTN MmRefaultedPageCount;
+UINTN MmReactivatedPageCount;
+
 //
 // Stores the lock protecting access to physical page data structures.
 //
@@ -368,6 +531,16 @@ UINTN MmPhysicalMemoryFreeCount;
 
 BOOL MmPhysicalPageZeroAvailable = FALSE;
 
+//
+// Store the physical page cache used by the boot processor, and the total
+// number of pages sitting in all processors' caches. Cached pages are counted
+// as allocated non-paged pages, so this count is subtracted back out when
+// reporting.
+//
+
+PHYSICAL_PAGE_CACHE MmBootPhysicalPageCache;
+volatile UINTN MmPhysicalPageCacheCount;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -430,6 +603,7 @@ Return Value:
     return MmPhysicalMemoryWarningLevel;
 }
 
+KERNEL_API
 UINTN
 MmGetTotalPhysicalPages (
     VOID
@@ -479,7 +653,8 @@ Return Value:
 
 {
 
-    return MmTotalPhysicalPages - MmTotalAllocatedPhysicalPages;
+    return MmTotalPhysicalPages - MmTotalAllocatedPhysicalPages +
+           MmPhysicalPageCacheCount;
 }
 
 VOID
@@ -522,6 +697,17 @@ Return Value:
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
+    //
+    // Single non-paged pages go back to the current processor's cache rather
+    // than contending for the physical page lock.
+    //
+
+    if ((PageCount == 1) && (MmPhysicalPageLock != NULL)) {
+        if (MmpFreeCachedPhysicalPage(PhysicalAddress) != FALSE) {
+            return;
+        }
+    }
+
     PageShift = MmPageShift();
     PagingEntry = NULL;
     INITIALIZE_LIST_HEAD(&PagingEntryList);
@@ -570,6 +756,10 @@ Return Value:
 
             if ((PhysicalPage->U.Flags & PHYSICAL_PAGE_FLAG_NON_PAGED) != 0) {
                 PhysicalPage->U.Free = PHYSICAL_PAGE_FREE;
+                MmpPhysicalBuddyFreeRange(Segment,
+                                          Segment->StartPage + Offset + Index,
+                                          1);
+
                 MmNonPagedPhysicalPages -= 1;
                 ReleasedCount += 1;
 
@@ -589,6 +779,11 @@ Return Value:
 
                     if (PagingEntry->U.LockCount == 0) {
                         PhysicalPage->U.Free = PHYSICAL_PAGE_FREE;
+                        MmpPhysicalBuddyFreeRange(
+                                           Segment,
+                                           Segment->StartPage + Offset + Index,
+                                           1);
+
                         ReleasedCount += 1;
                         INSERT_BEFORE(&(PagingEntry->U.ListEntry),
                                       &PagingEntryList);
@@ -777,12 +972,15 @@ Return Value:
 {
 
     UINTN AllocationSize;
+    PULONG BuddyBuffer;
     INIT_PHYSICAL_MEMORY_ITERATOR Context;
     UINTN Count;
+    PLIST_ENTRY CurrentEntry;
     ULONG LastBitIndex;
     ULONG LeadingZeros;
     ULONG PageShift;
     PUCHAR RawBuffer;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
     KSTATUS Status;
 
     PageShift = MmPageShift();
@@ -847,6 +1045,36 @@ Return Value:
         MmMaximumPhysicalAddress = Context.LastEnd;
     }
 
+    //
+    // Now that the extent of each segment is known, carve out the buddy
+    // bitmaps and seed them with the free pages.
+    //
+
+    AllocationSize = 0;
+    CurrentEntry = MmPhysicalSegmentListHead.Next;
+    while (CurrentEntry != &MmPhysicalSegmentListHead) {
+        Segment = LIST_VALUE(CurrentEntry, PHYSICAL_MEMORY_SEGMENT, ListEntry);
+        AllocationSize += MmpInitializePhysicalBuddy(Segment, NULL);
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    if (*InitMemorySize < AllocationSize) {
+        Status = STATUS_NO_MEMORY;
+        goto InitializePhysicalPageAllocatorEnd;
+    }
+
+    BuddyBuffer = *InitMemory;
+    *InitMemory += AllocationSize;
+    *InitMemorySize -= AllocationSize;
+    RtlZeroMemory(BuddyBuffer, AllocationSize);
+    CurrentEntry = MmPhysicalSegmentListHead.Next;
+    while (CurrentEntry != &MmPhysicalSegmentListHead) {
+        Segment = LIST_VALUE(CurrentEntry, PHYSICAL_MEMORY_SEGMENT, ListEntry);
+        AllocationSize = MmpInitializePhysicalBuddy(Segment, BuddyBuffer);
+        BuddyBuffer = (PULONG)((PUCHAR)BuddyBuffer + AllocationSize);
+        CurrentEntry = CurrentEntry->Next;
+    }
+
     MmLastAllocatedSegment = LIST_VALUE(MmPhysicalSegmentListHead.Next,
                                         PHYSICAL_MEMORY_SEGMENT,
                                         ListEntry);
@@ -855,6 +1083,13 @@ Return Value:
     MmLastPagedSegment = MmLastAllocatedSegment;
     MmLastPagedSegmentOffset = 0;
     MmTotalPhysicalPages = Context.TotalMemoryPages;
+    MmPagingClockFrontSegment = MmLastPagedSegment;
+    MmPagingClockFrontOffset = 0;
+    if (MmTotalPhysicalPages != 0) {
+        MmpAdvancePagingClockFrontHand(MmTotalPhysicalPages /
+                                       PAGING_CLOCK_HAND_SPREAD_DIVISOR);
+    }
+
     MmMinimumFreePhysicalPages =
                 (MmTotalPhysicalPages * MIN_FREE_PHYSICAL_PAGES_PERCENT) / 100;
 
@@ -920,9 +1155,17 @@ Return Value:
 
 {
 
+    UINTN CachedPages;
+
+    CachedPages = MmPhysicalPageCacheCount;
     Statistics->PhysicalPages = MmTotalPhysicalPages;
-    Statistics->AllocatedPhysicalPages = MmTotalAllocatedPhysicalPages;
-    Statistics->NonPagedPhysicalPages = MmNonPagedPhysicalPages;
+    Statistics->AllocatedPhysicalPages = MmTotalAllocatedPhysicalPages -
+                                         CachedPages;
+
+    Statistics->NonPagedPhysicalPages = MmNonPagedPhysicalPages - CachedPages;
+    Statistics->PagedOutPages = MmPagedOutPageCount;
+    Statistics->RefaultedPages = MmRefaultedPageCount;
+    Statistics->ReactivatedPages = MmReactivatedPageCount;
     return;
 }
 
@@ -958,11 +1201,15 @@ Return Value:
 
 {
 
+    BOOL CacheDrained;
+    UINTN FreePages;
     UINTN FreePageTarget;
     BOOL LockHeld;
     UINTN PageIndex;
     ULONG PageShift;
     volatile PPHYSICAL_PAGE PhysicalPage;
+    PHYSICAL_ADDRESS RefillPages[PHYSICAL_PAGE_CACHE_BATCH];
+    UINTN RefillCount;
     PPHYSICAL_MEMORY_SEGMENT Segment;
     UINTN SegmentOffset;
     BOOL SignalEvent;
@@ -973,13 +1220,31 @@ Return Value:
     ASSERT((MmPagingThread == NULL) ||
            (KeGetCurrentThread() != MmPagingThread));
 
+    if (Alignment == 0) {
+        Alignment = 1;
+    }
+
+    //
+    // Single page allocations are satisfied from the current processor's
+    // cache if possible, avoiding the physical page lock entirely.
+    //
+
+    if ((PageCount == 1) &&
+        (Alignment == 1) &&
+        (MmPhysicalPageLock != NULL)) {
+
+        WorkingAllocation = MmpAllocateCachedPhysicalPage();
+        if (WorkingAllocation != INVALID_PHYSICAL_ADDRESS) {
+            return WorkingAllocation;
+        }
+    }
+
+    CacheDrained = FALSE;
     LockHeld = FALSE;
     PageShift = MmPageShift();
+    RefillCount = 0;
     SignalEvent = FALSE;
     WorkingAllocation = INVALID_PHYSICAL_ADDRESS;
-    if (Alignment == 0) {
-        Alignment = 1;
-    }
 
     //
     // Loop continuously looking for free pages.
@@ -996,11 +1261,9 @@ Return Value:
         // Attempt to find some free pages.
         //
 
-        Segment = MmpFindPhysicalPages(PageCount,
-                                       Alignment,
-                                       PhysicalMemoryFindFree,
-                                       &SegmentOffset,
-                                       NULL);
+        Segment = MmpAllocateFreePhysicalPages(PageCount,
+                                               Alignment,
+                                               &SegmentOffset);
 
         //
         // If a section of free memory was available, grab it up!
@@ -1021,10 +1284,73 @@ Return Value:
             }
 
             Segment->FreePages -= PageCount;
-            SignalEvent = MmpUpdatePhysicalMemoryStatistics(PageCount, TRUE);
+
+            //
+            // The processor cache was empty if this is a single page request.
+            // Take a batch of pages for it while the lock is held, as long as
+            // doing so does not dip into the minimum free page reserve.
+            //
+
+            if ((PageCount == 1) &&
+                (Alignment == 1) &&
+                (MmPhysicalPageLock != NULL)) {
+
+                FreePages = MmTotalPhysicalPages -
+                            MmTotalAllocatedPhysicalPages - PageCount;
+
+                while ((RefillCount < PHYSICAL_PAGE_CACHE_BATCH) &&
+                       (FreePages > MmMinimumFreePhysicalPages)) {
+
+                    Segment = MmpAllocateFreePhysicalPages(1,
+                                                           1,
+                                                           &SegmentOffset);
+
+                    if (Segment == NULL) {
+                        break;
+                    }
+
+                    PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+                    PhysicalPage += SegmentOffset;
+
+                    ASSERT(PhysicalPage->U.Free == PHYSICAL_PAGE_FREE);
+
+                    PhysicalPage->U.Flags = PHYSICAL_PAGE_FLAG_NON_PAGED;
+                    Segment->FreePages -= 1;
+                    RefillPages[RefillCount] = Segment->StartAddress +
+                                               (SegmentOffset << PageShift);
+
+                    RefillCount += 1;
+                    FreePages -= 1;
+                }
+
+                if (RefillCount != 0) {
+                    RtlAtomicAdd(&MmPhysicalPageCacheCount, RefillCount);
+                }
+            }
+
+            SignalEvent = MmpUpdatePhysicalMemoryStatistics(
+                                                     PageCount + RefillCount,
+                                                     TRUE);
+
             goto AllocatePhysicalPagesEnd;
         }
 
+        if (LockHeld != FALSE) {
+            KeReleaseQueuedLock(MmPhysicalPageLock);
+            LockHeld = FALSE;
+        }
+
+        //
+        // Before resorting to paging, pull back any free pages sitting in
+        // processor caches, which may be enough to satisfy the request.
+        //
+
+        if ((CacheDrained == FALSE) && (MmPhysicalPageCacheCount != 0)) {
+            CacheDrained = TRUE;
+            MmpDrainPhysicalPageCaches();
+            continue;
+        }
+
         //
         // Page out to try to get back to the minimum free count, or at least
         // enough to hopefully satisfy the request.
@@ -1035,11 +1361,6 @@ Return Value:
             FreePageTarget = PageCount + Alignment;
         }
 
-        if (LockHeld != FALSE) {
-            KeReleaseQueuedLock(MmPhysicalPageLock);
-            LockHeld = FALSE;
-        }
-
         //
         // Not enough free memory could be found laying around. Schedule the
         // paging worker to notify it that memory is a little tight. If it gets
@@ -1085,6 +1406,10 @@ Return Value:
 
     ASSERT(WorkingAllocation != INVALID_PHYSICAL_ADDRESS);
 
+    if (RefillCount != 0) {
+        MmpInsertCachedPhysicalPages(RefillPages, RefillCount);
+    }
+
     //
     // Signal the physical memory change event if it was determined above.
     //
@@ -1099,6 +1424,101 @@ Return Value:
     return WorkingAllocation;
 }
 
+PHYSICAL_ADDRESS
+MmpTryAllocatePhysicalPages (
+    UINTN PageCount,
+    UINTN Alignment
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a run of physical pages only if a free buddy block
+    can satisfy it right away. It never pages out, waits, or scans the page
+    array, and it fails rather than dip into the minimum free page reserve.
+    Callers use it to opportunistically get larger runs and fall back to
+    smaller allocations when memory is fragmented. All allocated pages start
+    out as non-paged.
+
+Arguments:
+
+    PageCount - Supplies the number of consecutive physical pages required.
+
+    Alignment - Supplies the alignment requirement of the allocation, in pages.
+        Valid values are powers of 2. Values of 1 or 0 indicate no alignment
+        requirement.
+
+Return Value:
+
+    Returns the physical address of the first page of allocated memory on
+    success, or INVALID_PHYSICAL_ADDRESS on failure.
+
+--*/
+
+{
+
+    UINTN FreePages;
+    UINTN PageIndex;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    UINTN SegmentOffset;
+    BOOL SignalEvent;
+    PHYSICAL_ADDRESS WorkingAllocation;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    if (Alignment == 0) {
+        Alignment = 1;
+    }
+
+    if (MmPhysicalPageLock == NULL) {
+        return INVALID_PHYSICAL_ADDRESS;
+    }
+
+    SignalEvent = FALSE;
+    WorkingAllocation = INVALID_PHYSICAL_ADDRESS;
+    KeAcquireQueuedLock(MmPhysicalPageLock);
+    FreePages = MmTotalPhysicalPages - MmTotalAllocatedPhysicalPages;
+    if ((FreePages <= PageCount) ||
+        ((FreePages - PageCount) <= MmMinimumFreePhysicalPages)) {
+
+        goto TryAllocatePhysicalPagesEnd;
+    }
+
+    Segment = MmpAllocateFreeBuddyPages(PageCount, Alignment, &SegmentOffset);
+    if (Segment == NULL) {
+        goto TryAllocatePhysicalPagesEnd;
+    }
+
+    WorkingAllocation = Segment->StartAddress +
+                        (SegmentOffset << MmPageShift());
+
+    PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+    PhysicalPage += SegmentOffset;
+    for (PageIndex = 0; PageIndex < PageCount; PageIndex += 1) {
+
+        ASSERT(PhysicalPage->U.Free == PHYSICAL_PAGE_FREE);
+
+        PhysicalPage->U.Flags = PHYSICAL_PAGE_FLAG_NON_PAGED;
+        PhysicalPage += 1;
+    }
+
+    Segment->FreePages -= PageCount;
+    SignalEvent = MmpUpdatePhysicalMemoryStatistics(PageCount, TRUE);
+
+TryAllocatePhysicalPagesEnd:
+    KeReleaseQueuedLock(MmPhysicalPageLock);
+    if (SignalEvent != FALSE) {
+
+        ASSERT(MmPhysicalMemoryWarningEvent != NULL);
+
+        KeSignalEvent(MmPhysicalMemoryWarningEvent, SignalOptionPulse);
+    }
+
+    return WorkingAllocation;
+}
+
 PHYSICAL_ADDRESS
 MmpAllocateIdentityMappablePhysicalPages (
     UINTN PageCount,
@@ -1160,6 +1580,10 @@ Return Value:
     if (Segment != NULL) {
         WorkingAllocation = Segment->StartAddress +
                             (SegmentOffset << PageShift);
+
+        MmpPhysicalBuddyRemoveRange(Segment,
+                                    Segment->StartPage + SegmentOffset,
+                                    PageCount);
     }
 
     if (WorkingAllocation != INVALID_PHYSICAL_ADDRESS) {
@@ -1624,6 +2048,11 @@ Return Value:
                 MmNonPagedPhysicalPages -= 1;
                 if ((PagingEntry->U.Flags & PAGING_ENTRY_FLAG_FREED) != 0) {
                     PhysicalPage[PageIndex].U.Free = PHYSICAL_PAGE_FREE;
+                    MmpPhysicalBuddyFreeRange(
+                                       Segment,
+                                       Segment->StartPage + Offset + PageIndex,
+                                       1);
+
                     ReleasedCount += 1;
                     INSERT_BEFORE(&(PagingEntry->U.ListEntry),
                                   &PagingEntryList);
@@ -1917,6 +2346,8 @@ Return Value:
 
 {
 
+    UINTN AvailablePages;
+    UINTN CachedPages;
     BOOL Failure;
     ULONG FailureCount;
     UINTN FreePages;
@@ -1957,8 +2388,12 @@ Return Value:
         // Keep the goal realistic.
         //
 
-        if (FreePagesTarget > MmTotalPhysicalPages - MmNonPagedPhysicalPages) {
-            FreePagesTarget = MmTotalPhysicalPages - MmNonPagedPhysicalPages;
+        CachedPages = MmPhysicalPageCacheCount;
+        AvailablePages = MmTotalPhysicalPages - MmNonPagedPhysicalPages +
+                         CachedPages;
+
+        if (FreePagesTarget > AvailablePages) {
+            FreePagesTarget = AvailablePages;
         }
 
         //
@@ -1970,7 +2405,9 @@ Return Value:
         // is too ambitious (with page in paging everything right back in).
         //
 
-        FreePages = MmTotalPhysicalPages - MmTotalAllocatedPhysicalPages;
+        FreePages = MmTotalPhysicalPages - MmTotalAllocatedPhysicalPages +
+                    CachedPages;
+
         if ((FreePages >= FreePagesTarget) ||
             (TotalPagesPaged >= FreePagesTarget)) {
 
@@ -1987,8 +2424,22 @@ Return Value:
                                        &SegmentOffset,
                                        &PagesFound);
 
-        if (Segment == NULL) {
-            break;
+        //
+        // If every pagable page had been referenced, the search cleared them
+        // all on its way around. Go around once more to pick the first one
+        // that has not been touched since.
+        //
+
+        if (Segment == NULL) {
+            Segment = MmpFindPhysicalPages(1,
+                                           1,
+                                           PhysicalMemoryFindPagable,
+                                           &SegmentOffset,
+                                           &PagesFound);
+
+            if (Segment == NULL) {
+                break;
+            }
         }
 
         ASSERT(PagesFound == 1);
@@ -2045,6 +2496,7 @@ Return Value:
         }
 
         TotalPagesPaged += PagesPaged;
+        MmPagedOutPageCount += PagesPaged;
 
         //
         // If the physical page run failed to be completely paged out, then
@@ -2286,6 +2738,7 @@ Return Value:
                 break;
 
             case PhysicalMemoryFindPagable:
+                MmpAdvancePagingClockFrontHand(1);
                 Flags = PhysicalPage->U.Flags;
 
                 //
@@ -2310,6 +2763,17 @@ Return Value:
                     if (PagingEntry->U.LockCount != 0) {
                         ExitCheck = TRUE;
 
+                    //
+                    // If the page has been referenced since the front hand
+                    // went by, give it another trip around the clock.
+                    //
+
+                    } else if (MmpTestAndClearPageReferenced(PagingEntry) !=
+                               FALSE) {
+
+                        MmReactivatedPageCount += 1;
+                        ExitCheck = TRUE;
+
                     //
                     // Otherwise mark that the page is being paged out so that
                     // it does not get released in the middle of use.
@@ -2878,3 +3342,1122 @@ Return Value:
     return SignalEvent;
 }
 
+PPHYSICAL_MEMORY_SEGMENT
+MmpGetPhysicalMemorySegment (
+    PHYSICAL_ADDRESS PhysicalAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the physical memory segment containing the given
+    address. The segment list does not change once the physical allocator is
+    initialized, so the physical page lock is not required.
+
+Arguments:
+
+    PhysicalAddress - Supplies the physical address to look up.
+
+Return Value:
+
+    Returns a pointer to the segment containing the address.
+
+    NULL if the address is not described by any segment.
+
+--*/
+
+{
+
+    PLIST_ENTRY CurrentEntry;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+
+    CurrentEntry = MmPhysicalSegmentListHead.Next;
+    while (CurrentEntry != &MmPhysicalSegmentListHead) {
+        Segment = LIST_VALUE(CurrentEntry, PHYSICAL_MEMORY_SEGMENT, ListEntry);
+        if ((PhysicalAddress >= Segment->StartAddress) &&
+            (PhysicalAddress < Segment->EndAddress)) {
+
+            return Segment;
+        }
+
+        CurrentEntry = CurrentEntry->Next;
+    }
+
+    return NULL;
+}
+
+PPHYSICAL_MEMORY_SEGMENT
+MmpAllocateFreePhysicalPages (
+    UINTN PageCount,
+    UINTN PageAlignment,
+    PUINTN SelectedPageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a run of free physical pages from the buddy
+    allocator. Requests that fit in a buddy block are satisfied from the
+    smallest free block of sufficient size and alignment, with the unused tail
+    of the block handed back. Larger requests, or requests for which no block
+    is free even though a suitable unaligned run may exist, fall back to
+    scanning the physical page array. The caller must hold the physical page
+    lock if it exists, and is responsible for marking the pages allocated and
+    updating the segment free count.
+
+Arguments:
+
+    PageCount - Supplies the number of consecutive pages needed.
+
+    PageAlignment - Supplies the alignment of the allocation, in pages. This
+        must be a power of two.
+
+    SelectedPageOffset - Supplies a pointer where the index of the first page
+        of the allocation within the segment's physical page array will be
+        returned on success.
+
+Return Value:
+
+    Returns a pointer to the memory segment containing the allocation.
+
+    NULL if no suitable run of free pages exists.
+
+--*/
+
+{
+
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+
+    Segment = MmpAllocateFreeBuddyPages(PageCount,
+                                        PageAlignment,
+                                        SelectedPageOffset);
+
+    if (Segment != NULL) {
+        return Segment;
+    }
+
+    //
+    // Fall back to a linear scan, and then pull whatever was found out of the
+    // buddy bitmaps.
+    //
+
+    Segment = MmpFindPhysicalPages(PageCount,
+                                   PageAlignment,
+                                   PhysicalMemoryFindFree,
+                                   SelectedPageOffset,
+                                   NULL);
+
+    if (Segment != NULL) {
+        MmpPhysicalBuddyRemoveRange(Segment,
+                                    Segment->StartPage + *SelectedPageOffset,
+                                    PageCount);
+    }
+
+    return Segment;
+}
+
+PPHYSICAL_MEMORY_SEGMENT
+MmpAllocateFreeBuddyPages (
+    UINTN PageCount,
+    UINTN PageAlignment,
+    PUINTN SelectedPageOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a run of free physical pages from the buddy
+    allocator, using the smallest free block of sufficient size and alignment
+    and handing back the unused tail of the block. Unlike
+    MmpAllocateFreePhysicalPages it never falls back to scanning the physical
+    page array. The caller must hold the physical page lock if it exists, and
+    is responsible for marking the pages allocated and updating the segment
+    free count.
+
+Arguments:
+
+    PageCount - Supplies the number of consecutive pages needed.
+
+    PageAlignment - Supplies the alignment of the allocation, in pages. This
+        must be a power of two.
+
+    SelectedPageOffset - Supplies a pointer where the index of the first page
+        of the allocation within the segment's physical page array will be
+        returned on success.
+
+Return Value:
+
+    Returns a pointer to the memory segment containing the allocation.
+
+    NULL if no free buddy block is large enough.
+
+--*/
+
+{
+
+    UINTN BlockSize;
+    ULONG Order;
+    UINTN Page;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    UINTN SegmentOffset;
+    BOOL Success;
+
+    ASSERT(PageAlignment != 0);
+    ASSERT((MmPhysicalPageLock == NULL) ||
+           (KeIsQueuedLockHeld(MmPhysicalPageLock) != FALSE));
+
+    //
+    // Determine the order of block that satisfies both the size and the
+    // alignment. Blocks are naturally aligned to their size.
+    //
+
+    Order = 0;
+    BlockSize = 1;
+    while ((BlockSize < PageCount) || (BlockSize < PageAlignment)) {
+        Order += 1;
+        BlockSize <<= 1;
+    }
+
+    if (Order < PHYSICAL_BUDDY_ORDER_COUNT) {
+        Segment = MmLastAllocatedSegment;
+        do {
+            if (Segment->FreePages >= PageCount) {
+                Success = MmpPhysicalBuddyAllocate(Segment, Order, &Page);
+                if (Success != FALSE) {
+                    if (BlockSize > PageCount) {
+                        MmpPhysicalBuddyFreeRange(Segment,
+                                                  Page + PageCount,
+                                                  BlockSize - PageCount);
+                    }
+
+                    SegmentOffset = Page - Segment->StartPage;
+                    MmLastAllocatedSegment = Segment;
+                    MmLastAllocatedSegmentOffset = SegmentOffset + PageCount;
+                    *SelectedPageOffset = SegmentOffset;
+                    return Segment;
+                }
+            }
+
+            if (Segment->ListEntry.Next == &MmPhysicalSegmentListHead) {
+                Segment = LIST_VALUE(MmPhysicalSegmentListHead.Next,
+                                     PHYSICAL_MEMORY_SEGMENT,
+                                     ListEntry);
+
+            } else {
+                Segment = LIST_VALUE(Segment->ListEntry.Next,
+                                     PHYSICAL_MEMORY_SEGMENT,
+                                     ListEntry);
+            }
+
+        } while (Segment != MmLastAllocatedSegment);
+    }
+
+    return NULL;
+}
+
+UINTN
+MmpInitializePhysicalBuddy (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    PULONG Buffer
+    )
+
+/*++
+
+Routine Description:
+
+    This routine computes the buddy bitmap layout for a physical memory
+    segment, and optionally initializes the bitmaps from the segment's
+    physical page array.
+
+Arguments:
+
+    Segment - Supplies a pointer to the segment, whose start and end addresses
+        must be final.
+
+    Buffer - Supplies an optional pointer to zeroed memory to use for the
+        bitmaps. If NULL, only the required size is computed.
+
+Return Value:
+
+    Returns the number of bytes of bitmap storage the segment requires.
+
+--*/
+
+{
+
+    UINTN EndPage;
+    UINTN FirstBlock;
+    UINTN LastBlock;
+    ULONG Order;
+    UINTN PageCount;
+    UINTN PageIndex;
+    ULONG PageShift;
+    PPHYSICAL_PAGE PhysicalPage;
+    UINTN RunStart;
+    UINTN Size;
+    UINTN WordCount;
+
+    PageShift = MmPageShift();
+    Segment->StartPage = (UINTN)(Segment->StartAddress >> PageShift);
+    EndPage = (UINTN)(Segment->EndAddress >> PageShift);
+    Size = 0;
+    for (Order = 0; Order < PHYSICAL_BUDDY_ORDER_COUNT; Order += 1) {
+        FirstBlock = ALIGN_RANGE_UP(Segment->StartPage, (UINTN)1 << Order) >>
+                     Order;
+
+        LastBlock = EndPage >> Order;
+        Segment->FirstBlock[Order] = FirstBlock;
+        Segment->BlockCount[Order] = 0;
+        if (LastBlock > FirstBlock) {
+            Segment->BlockCount[Order] = LastBlock - FirstBlock;
+        }
+
+        Segment->FreeBlocks[Order] = 0;
+        Segment->SearchHint[Order] = 0;
+        WordCount = (Segment->BlockCount[Order] + PHYSICAL_BUDDY_MAP_BITS - 1) /
+                    PHYSICAL_BUDDY_MAP_BITS;
+
+        Segment->BuddyMap[Order] = NULL;
+        if (Buffer != NULL) {
+            Segment->BuddyMap[Order] = Buffer;
+            Buffer += WordCount;
+        }
+
+        Size += WordCount * sizeof(ULONG);
+    }
+
+    if (Buffer == NULL) {
+        return Size;
+    }
+
+    //
+    // Hand each run of free pages to the buddy allocator.
+    //
+
+    PageCount = EndPage - Segment->StartPage;
+    PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+    RunStart = PageCount;
+    for (PageIndex = 0; PageIndex <= PageCount; PageIndex += 1) {
+        if ((PageIndex < PageCount) &&
+            (PhysicalPage[PageIndex].U.Free == PHYSICAL_PAGE_FREE)) {
+
+            if (RunStart == PageCount) {
+                RunStart = PageIndex;
+            }
+
+        } else if (RunStart != PageCount) {
+            MmpPhysicalBuddyFreeRange(Segment,
+                                      Segment->StartPage + RunStart,
+                                      PageIndex - RunStart);
+
+            RunStart = PageCount;
+        }
+    }
+
+    return Size;
+}
+
+BOOL
+MmpPhysicalBuddyAllocate (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    ULONG Order,
+    PUINTN Page
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a free block of the given order from a segment's
+    buddy bitmaps, splitting a larger block if necessary.
+
+Arguments:
+
+    Segment - Supplies a pointer to the segment to allocate from.
+
+    Order - Supplies the order of the block to allocate.
+
+    Page - Supplies a pointer where the page frame number of the first page of
+        the block will be returned on success.
+
+Return Value:
+
+    TRUE if a block was allocated.
+
+    FALSE if the segment has no free block of the given order or larger.
+
+--*/
+
+{
+
+    UINTN Block;
+    ULONG Current;
+    UINTN Index;
+    UINTN Iteration;
+    PULONG Map;
+    UINTN Word;
+    UINTN WordCount;
+
+    for (Current = Order; Current < PHYSICAL_BUDDY_ORDER_COUNT; Current += 1) {
+        if (Segment->FreeBlocks[Current] != 0) {
+            break;
+        }
+    }
+
+    if (Current == PHYSICAL_BUDDY_ORDER_COUNT) {
+        return FALSE;
+    }
+
+    //
+    // Find a set bit, starting where the last search left off.
+    //
+
+    Map = Segment->BuddyMap[Current];
+    WordCount = (Segment->BlockCount[Current] + PHYSICAL_BUDDY_MAP_BITS - 1) /
+                PHYSICAL_BUDDY_MAP_BITS;
+
+    Word = Segment->SearchHint[Current];
+    for (Iteration = 0; Iteration < WordCount; Iteration += 1) {
+        if (Word >= WordCount) {
+            Word = 0;
+        }
+
+        if (Map[Word] != 0) {
+            break;
+        }
+
+        Word += 1;
+    }
+
+    ASSERT((Word < WordCount) && (Map[Word] != 0));
+
+    Index = (Word * PHYSICAL_BUDDY_MAP_BITS) +
+            RtlCountTrailingZeros32(Map[Word]);
+
+    Map[Word] &= ~PHYSICAL_BUDDY_MAP_MASK(Index);
+    Segment->FreeBlocks[Current] -= 1;
+    Segment->SearchHint[Current] = Word;
+    Block = Segment->FirstBlock[Current] + Index;
+
+    //
+    // Split the block down to the requested order, freeing the upper half at
+    // each step. The upper half is always within the segment since its
+    // parent was.
+    //
+
+    while (Current > Order) {
+        Current -= 1;
+        Block <<= 1;
+        Index = Block + 1 - Segment->FirstBlock[Current];
+
+        ASSERT(Index < Segment->BlockCount[Current]);
+
+        Map = Segment->BuddyMap[Current];
+        Map[PHYSICAL_BUDDY_MAP_WORD(Index)] |= PHYSICAL_BUDDY_MAP_MASK(Index);
+        Segment->FreeBlocks[Current] += 1;
+    }
+
+    *Page = Block << Order;
+    return TRUE;
+}
+
+VOID
+MmpPhysicalBuddyInsert (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    ULONG Order,
+    UINTN Block
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a free block to a segment's buddy bitmaps, merging it
+    with its buddy as long as the buddy is also free.
+
+Arguments:
+
+    Segment - Supplies a pointer to the segment that owns the block.
+
+    Order - Supplies the order of the block.
+
+    Block - Supplies the block index, which is the page frame number of its
+        first page shifted right by the order.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN Buddy;
+    UINTN Index;
+    PULONG Map;
+
+    while (Order < PHYSICAL_BUDDY_ORDER_COUNT - 1) {
+        Buddy = Block ^ 1;
+        if ((Buddy < Segment->FirstBlock[Order]) ||
+            (Buddy >= Segment->FirstBlock[Order] + Segment->BlockCount[Order])) {
+
+            break;
+        }
+
+        Index = Buddy - Segment->FirstBlock[Order];
+        Map = Segment->BuddyMap[Order];
+        if ((Map[PHYSICAL_BUDDY_MAP_WORD(Index)] &
+             PHYSICAL_BUDDY_MAP_MASK(Index)) == 0) {
+
+            break;
+        }
+
+        Map[PHYSICAL_BUDDY_MAP_WORD(Index)] &= ~PHYSICAL_BUDDY_MAP_MASK(Index);
+        Segment->FreeBlocks[Order] -= 1;
+        Block >>= 1;
+        Order += 1;
+    }
+
+    Index = Block - Segment->FirstBlock[Order];
+
+    ASSERT(Index < Segment->BlockCount[Order]);
+
+    Map = Segment->BuddyMap[Order];
+
+    ASSERT((Map[PHYSICAL_BUDDY_MAP_WORD(Index)] &
+            PHYSICAL_BUDDY_MAP_MASK(Index)) == 0);
+
+    Map[PHYSICAL_BUDDY_MAP_WORD(Index)] |= PHYSICAL_BUDDY_MAP_MASK(Index);
+    Segment->FreeBlocks[Order] += 1;
+    return;
+}
+
+VOID
+MmpPhysicalBuddyFreeRange (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    UINTN Page,
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a run of free pages to a segment's buddy bitmaps by
+    breaking it into the largest naturally aligned blocks that fit.
+
+Arguments:
+
+    Segment - Supplies a pointer to the segment that owns the pages.
+
+    Page - Supplies the page frame number of the first free page.
+
+    PageCount - Supplies the number of free pages.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN BlockSize;
+    ULONG Order;
+
+    while (PageCount != 0) {
+        Order = 0;
+        BlockSize = 1;
+        while ((Order < PHYSICAL_BUDDY_ORDER_COUNT - 1) &&
+               ((Page & ((BlockSize << 1) - 1)) == 0) &&
+               ((BlockSize << 1) <= PageCount)) {
+
+            Order += 1;
+            BlockSize <<= 1;
+        }
+
+        MmpPhysicalBuddyInsert(Segment, Order, Page >> Order);
+        Page += BlockSize;
+        PageCount -= BlockSize;
+    }
+
+    return;
+}
+
+VOID
+MmpPhysicalBuddyRemoveRange (
+    PPHYSICAL_MEMORY_SEGMENT Segment,
+    UINTN Page,
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes an arbitrary run of free pages from a segment's buddy
+    bitmaps. Each free block overlapping the run is removed, and the portions
+    of it outside the run are handed back.
+
+Arguments:
+
+    Segment - Supplies a pointer to the segment that owns the pages.
+
+    Page - Supplies the page frame number of the first page to remove.
+
+    PageCount - Supplies the number of pages to remove. Every page must
+        currently be free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN Block;
+    UINTN BlockEnd;
+    UINTN BlockStart;
+    UINTN End;
+    UINTN Index;
+    PULONG Map;
+    ULONG Order;
+
+    End = Page + PageCount;
+    while (Page < End) {
+
+        //
+        // Find the free block containing this page.
+        //
+
+        Map = NULL;
+        Block = 0;
+        Index = 0;
+        for (Order = 0; Order < PHYSICAL_BUDDY_ORDER_COUNT; Order += 1) {
+            Block = Page >> Order;
+            if ((Block < Segment->FirstBlock[Order]) ||
+                (Block >= Segment->FirstBlock[Order] +
+                          Segment->BlockCount[Order])) {
+
+                break;
+            }
+
+            Index = Block - Segment->FirstBlock[Order];
+            Map = Segment->BuddyMap[Order];
+            if ((Map[PHYSICAL_BUDDY_MAP_WORD(Index)] &
+                 PHYSICAL_BUDDY_MAP_MASK(Index)) != 0) {
+
+                break;
+            }
+
+            Map = NULL;
+        }
+
+        ASSERT(Map != NULL);
+
+        if (Map == NULL) {
+            return;
+        }
+
+        Map[PHYSICAL_BUDDY_MAP_WORD(Index)] &= ~PHYSICAL_BUDDY_MAP_MASK(Index);
+        Segment->FreeBlocks[Order] -= 1;
+        BlockStart = Block << Order;
+        BlockEnd = BlockStart + ((UINTN)1 << Order);
+        if (BlockStart < Page) {
+            MmpPhysicalBuddyFreeRange(Segment, BlockStart, Page - BlockStart);
+        }
+
+        if (BlockEnd > End) {
+            MmpPhysicalBuddyFreeRange(Segment, End, BlockEnd - End);
+            BlockEnd = End;
+        }
+
+        Page = BlockEnd;
+    }
+
+    return;
+}
+
+PHYSICAL_ADDRESS
+MmpAllocateCachedPhysicalPage (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to take a free page from the current processor's
+    physical page cache.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the physical address of the page on success. The page is already
+    marked as allocated and non-paged.
+
+    INVALID_PHYSICAL_ADDRESS if the cache is empty.
+
+--*/
+
+{
+
+    PPHYSICAL_PAGE_CACHE Cache;
+    RUNLEVEL OldRunLevel;
+    PHYSICAL_ADDRESS PhysicalAddress;
+
+    PhysicalAddress = INVALID_PHYSICAL_ADDRESS;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Cache = KeGetCurrentProcessorBlock()->PhysicalPageCache;
+    if (Cache != NULL) {
+        KeAcquireSpinLock(&(Cache->Lock));
+        if (Cache->Count != 0) {
+            Cache->Count -= 1;
+            PhysicalAddress = Cache->Pages[Cache->Count];
+        }
+
+        KeReleaseSpinLock(&(Cache->Lock));
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    if (PhysicalAddress != INVALID_PHYSICAL_ADDRESS) {
+        RtlAtomicAdd(&MmPhysicalPageCacheCount, -1);
+    }
+
+    return PhysicalAddress;
+}
+
+BOOL
+MmpFreeCachedPhysicalPage (
+    PHYSICAL_ADDRESS PhysicalAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine attempts to release a single non-paged page into the current
+    processor's physical page cache. If the cache is full, half of it is
+    returned to the global allocator.
+
+Arguments:
+
+    PhysicalAddress - Supplies the physical address of the page to free.
+
+Return Value:
+
+    TRUE if the page was released into the cache.
+
+    FALSE if the page is not a non-paged page and must be freed through the
+    global allocator.
+
+--*/
+
+{
+
+    PPHYSICAL_PAGE_CACHE Cache;
+    PHYSICAL_ADDRESS DrainPages[PHYSICAL_PAGE_CACHE_BATCH];
+    UINTN DrainCount;
+    UINTN Offset;
+    RUNLEVEL OldRunLevel;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+
+    Segment = MmpGetPhysicalMemorySegment(PhysicalAddress);
+    if (Segment == NULL) {
+        return FALSE;
+    }
+
+    //
+    // The caller owns the page, so its entry can be inspected without the
+    // physical page lock. Pagable pages need the lock to coordinate with the
+    // pager.
+    //
+
+    Offset = (PhysicalAddress - Segment->StartAddress) >> MmPageShift();
+    PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+    PhysicalPage += Offset;
+    if ((PhysicalPage->U.Flags & PHYSICAL_PAGE_FLAG_NON_PAGED) == 0) {
+        return FALSE;
+    }
+
+    DrainCount = 0;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Cache = KeGetCurrentProcessorBlock()->PhysicalPageCache;
+    if (Cache == NULL) {
+        KeLowerRunLevel(OldRunLevel);
+        return FALSE;
+    }
+
+    //
+    // Clear out any page cache entry association. The page remains accounted
+    // as allocated and non-paged while it sits in the cache.
+    //
+
+    PhysicalPage->U.Flags = PHYSICAL_PAGE_FLAG_NON_PAGED;
+    RtlAtomicAdd(&MmPhysicalPageCacheCount, 1);
+    KeAcquireSpinLock(&(Cache->Lock));
+    if (Cache->Count == PHYSICAL_PAGE_CACHE_SIZE) {
+        DrainCount = PHYSICAL_PAGE_CACHE_BATCH;
+        Cache->Count -= DrainCount;
+        RtlCopyMemory(DrainPages,
+                      &(Cache->Pages[Cache->Count]),
+                      DrainCount * sizeof(PHYSICAL_ADDRESS));
+    }
+
+    Cache->Pages[Cache->Count] = PhysicalAddress;
+    Cache->Count += 1;
+    KeReleaseSpinLock(&(Cache->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    if (DrainCount != 0) {
+        MmpReleaseCachedPhysicalPages(DrainPages, DrainCount);
+    }
+
+    return TRUE;
+}
+
+VOID
+MmpInsertCachedPhysicalPages (
+    PPHYSICAL_ADDRESS Pages,
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a batch of freshly allocated pages to the current
+    processor's physical page cache. Pages that do not fit are returned to the
+    global allocator. The pages must already be counted in the cached page
+    count.
+
+Arguments:
+
+    Pages - Supplies an array of physical addresses of the pages.
+
+    PageCount - Supplies the number of elements in the array.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPHYSICAL_PAGE_CACHE Cache;
+    RUNLEVEL OldRunLevel;
+
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    Cache = KeGetCurrentProcessorBlock()->PhysicalPageCache;
+    if (Cache != NULL) {
+        KeAcquireSpinLock(&(Cache->Lock));
+        while ((PageCount != 0) && (Cache->Count < PHYSICAL_PAGE_CACHE_SIZE)) {
+            PageCount -= 1;
+            Cache->Pages[Cache->Count] = Pages[PageCount];
+            Cache->Count += 1;
+        }
+
+        KeReleaseSpinLock(&(Cache->Lock));
+    }
+
+    KeLowerRunLevel(OldRunLevel);
+    if (PageCount != 0) {
+        MmpReleaseCachedPhysicalPages(Pages, PageCount);
+    }
+
+    return;
+}
+
+VOID
+MmpReleaseCachedPhysicalPages (
+    PPHYSICAL_ADDRESS Pages,
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns pages removed from a physical page cache to the
+    global allocator, updating the statistics and warning levels.
+
+Arguments:
+
+    Pages - Supplies an array of physical addresses of the pages.
+
+    PageCount - Supplies the number of elements in the array.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN Index;
+    UINTN Offset;
+    ULONG PageShift;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    BOOL SignalEvent;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    PageShift = MmPageShift();
+    KeAcquireQueuedLock(MmPhysicalPageLock);
+    for (Index = 0; Index < PageCount; Index += 1) {
+        Segment = MmpGetPhysicalMemorySegment(Pages[Index]);
+
+        ASSERT(Segment != NULL);
+
+        Offset = (Pages[Index] - Segment->StartAddress) >> PageShift;
+        PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+        PhysicalPage += Offset;
+
+        ASSERT(PhysicalPage->U.Flags == PHYSICAL_PAGE_FLAG_NON_PAGED);
+
+        PhysicalPage->U.Free = PHYSICAL_PAGE_FREE;
+        MmpPhysicalBuddyFreeRange(Segment, Segment->StartPage + Offset, 1);
+        Segment->FreePages += 1;
+    }
+
+    MmNonPagedPhysicalPages -= PageCount;
+    SignalEvent = MmpUpdatePhysicalMemoryStatistics(PageCount, FALSE);
+    RtlAtomicAdd(&MmPhysicalPageCacheCount, -PageCount);
+    KeReleaseQueuedLock(MmPhysicalPageLock);
+    if (SignalEvent != FALSE) {
+
+        ASSERT(MmPhysicalMemoryWarningEvent != NULL);
+
+        KeSignalEvent(MmPhysicalMemoryWarningEvent, SignalOptionPulse);
+    }
+
+    return;
+}
+
+VOID
+MmpDrainPhysicalPageCaches (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the contents of every processor's physical page cache
+    to the global allocator. It is used when memory is low so that cached
+    pages are not stranded.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPHYSICAL_PAGE_CACHE Cache;
+    UINTN Count;
+    RUNLEVEL OldRunLevel;
+    PHYSICAL_ADDRESS Pages[PHYSICAL_PAGE_CACHE_SIZE];
+    PPROCESSOR_BLOCK ProcessorBlock;
+    ULONG ProcessorCount;
+    ULONG ProcessorIndex;
+
+    ProcessorCount = KeGetActiveProcessorCount();
+    for (ProcessorIndex = 0;
+         ProcessorIndex < ProcessorCount;
+         ProcessorIndex += 1) {
+
+        ProcessorBlock = KeGetProcessorBlock(ProcessorIndex);
+        if ((ProcessorBlock == NULL) ||
+            (ProcessorBlock->PhysicalPageCache == NULL)) {
+
+            continue;
+        }
+
+        Cache = ProcessorBlock->PhysicalPageCache;
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Cache->Lock));
+        Count = Cache->Count;
+        RtlCopyMemory(Pages, Cache->Pages, Count * sizeof(PHYSICAL_ADDRESS));
+        Cache->Count = 0;
+        KeReleaseSpinLock(&(Cache->Lock));
+        KeLowerRunLevel(OldRunLevel);
+        if (Count != 0) {
+            MmpReleaseCachedPhysicalPages(Pages, Count);
+        }
+    }
+
+    return;
+}
+
+
+VOID
+MmpAdvancePagingClockFrontHand (
+    UINTN PageCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves the front hand of the paging clock forward, clearing
+    the referenced state of each pagable page it passes over. The page out
+    search then only evicts pages that have not been referenced again by the
+    time it catches up. This routine assumes the physical page lock is held
+    if it exists.
+
+Arguments:
+
+    PageCount - Supplies the number of pages to advance the hand by.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN Flags;
+    UINTN Offset;
+    PPAGING_ENTRY PagingEntry;
+    ULONG PageShift;
+    PPHYSICAL_PAGE PhysicalPage;
+    PPHYSICAL_MEMORY_SEGMENT Segment;
+    UINTN SegmentPageCount;
+
+    ASSERT((MmPhysicalPageLock == NULL) ||
+           (KeIsQueuedLockHeld(MmPhysicalPageLock) != FALSE));
+
+    PageShift = MmPageShift();
+    Segment = MmPagingClockFrontSegment;
+    Offset = MmPagingClockFrontOffset;
+    SegmentPageCount = (Segment->EndAddress - Segment->StartAddress) >>
+                       PageShift;
+
+    while (PageCount != 0) {
+        Offset += 1;
+        while (Offset >= SegmentPageCount) {
+            if (Segment->ListEntry.Next == &MmPhysicalSegmentListHead) {
+                Segment = LIST_VALUE(MmPhysicalSegmentListHead.Next,
+                                     PHYSICAL_MEMORY_SEGMENT,
+                                     ListEntry);
+
+            } else {
+                Segment = LIST_VALUE(Segment->ListEntry.Next,
+                                     PHYSICAL_MEMORY_SEGMENT,
+                                     ListEntry);
+            }
+
+            SegmentPageCount = (Segment->EndAddress - Segment->StartAddress) >>
+                               PageShift;
+
+            Offset = 0;
+        }
+
+        PhysicalPage = (PPHYSICAL_PAGE)(Segment + 1);
+        PhysicalPage += Offset;
+        Flags = PhysicalPage->U.Flags;
+        if ((PhysicalPage->U.Free != PHYSICAL_PAGE_FREE) &&
+            ((Flags & PHYSICAL_PAGE_FLAG_NON_PAGED) == 0)) {
+
+            PagingEntry = PhysicalPage->U.PagingEntry;
+            if (PagingEntry->U.LockCount == 0) {
+                MmpTestAndClearPageReferenced(PagingEntry);
+            }
+        }
+
+        PageCount -= 1;
+    }
+
+    MmPagingClockFrontSegment = Segment;
+    MmPagingClockFrontOffset = Offset;
+    return;
+}
+
+BOOL
+MmpTestAndClearPageReferenced (
+    PPAGING_ENTRY PagingEntry
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not the given pagable page has been
+    referenced since it was last checked, and clears its referenced state. A
+    page counts as referenced if it was recently paged in or if its mapping in
+    the owning section was marked accessed. This routine assumes the physical
+    page lock is held if it exists, and must only be called by the paging
+    thread since it modifies the paging entry flags.
+
+Arguments:
+
+    PagingEntry - Supplies a pointer to the paging entry of the page.
+
+Return Value:
+
+    TRUE if the page was referenced.
+
+    FALSE if the page has not been referenced since the last check.
+
+--*/
+
+{
+
+    BOOL Referenced;
+    PIMAGE_SECTION Section;
+    PVOID VirtualAddress;
+
+    Referenced = FALSE;
+    if ((PagingEntry->U.Flags & PAGING_ENTRY_FLAG_REFERENCED) != 0) {
+        PagingEntry->U.Flags &= ~PAGING_ENTRY_FLAG_REFERENCED;
+        Referenced = TRUE;
+    }
+
+    //
+    // Only the owning section's mapping is sampled. Other sections sharing
+    // the page just lose their vote, which at worst gets the page paged out
+    // a little early.
+    //
+
+    Section = PagingEntry->Section;
+    VirtualAddress = Section->VirtualAddress +
+                     (PagingEntry->U.SectionOffset << MmPageShift());
+
+    //
+    // Sampling may change the mapping on architectures that emulate the
+    // accessed bit, so hold the section lock to keep it from racing with an
+    // unmap. That lock ranks above the physical page lock and cannot be waited
+    // on here. If it is busy, the section is in use, so call the page
+    // referenced and look again next time around.
+    //
+
+    if (KeTryToAcquireQueuedLock(Section->Lock) == FALSE) {
+        return TRUE;
+    }
+
+    if (MmpTestAndClearAccessedBit(Section->AddressSpace, VirtualAddress) !=
+        FALSE) {
+
+        Referenced = TRUE;
+    }
+
+    KeReleaseQueuedLock(Section->Lock);
+    return Referenced;
+}
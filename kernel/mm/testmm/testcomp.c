@@ -0,0 +1,388 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    testcomp.c
+
+Abstract:
+
+    This module contains tests for the page compressor used by the compressed
+    swap store.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Test
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "../mmp.h"
+#include "testmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+#define TEST_COMPRESSION_PAGE_SIZE 0x1000
+#define TEST_COMPRESSION_RANDOM_ITERATIONS 200
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef enum _TEST_PAGE_PATTERN {
+    TestPageZero,
+    TestPageRepeating,
+    TestPageText,
+    TestPageRandom,
+    TestPageMixed,
+    TestPageSparse,
+    TestPagePatternCount
+} TEST_PAGE_PATTERN, *PTEST_PAGE_PATTERN;
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+ULONG
+TestCompressionRoundTrip (
+    PUCHAR Page,
+    ULONG Size,
+    BOOL ExpectFit
+    );
+
+VOID
+TestCompressionFillPage (
+    PUCHAR Page,
+    ULONG Size,
+    TEST_PAGE_PATTERN Pattern
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+USHORT TestCompressionHashTable[COMPRESSION_HASH_TABLE_SIZE];
+UCHAR TestCompressionPage[TEST_COMPRESSION_PAGE_SIZE];
+UCHAR TestCompressionOutput[TEST_COMPRESSION_PAGE_SIZE * 2];
+UCHAR TestCompressionResult[TEST_COMPRESSION_PAGE_SIZE];
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+ULONG
+TestCompression (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests the page compressor and decompressor.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Failures;
+    ULONG Iteration;
+    TEST_PAGE_PATTERN Pattern;
+    ULONG Size;
+
+    Failures = 0;
+
+    //
+    // Each of the fixed patterns, apart from random data, should shrink.
+    //
+
+    for (Pattern = 0; Pattern < TestPagePatternCount; Pattern += 1) {
+        TestCompressionFillPage(TestCompressionPage,
+                                TEST_COMPRESSION_PAGE_SIZE,
+                                Pattern);
+
+        Failures += TestCompressionRoundTrip(TestCompressionPage,
+                                             TEST_COMPRESSION_PAGE_SIZE,
+                                             Pattern != TestPageRandom);
+    }
+
+    //
+    // Try assorted sizes, including ones too small to hold a match.
+    //
+
+    for (Iteration = 0;
+         Iteration < TEST_COMPRESSION_RANDOM_ITERATIONS;
+         Iteration += 1) {
+
+        Size = rand() % TEST_COMPRESSION_PAGE_SIZE + 1;
+        Pattern = rand() % TestPagePatternCount;
+        TestCompressionFillPage(TestCompressionPage, Size, Pattern);
+        Failures += TestCompressionRoundTrip(TestCompressionPage, Size, FALSE);
+    }
+
+    //
+    // Compressing into a buffer that is too small should fail cleanly rather
+    // than overrun it.
+    //
+
+    TestCompressionFillPage(TestCompressionPage,
+                            TEST_COMPRESSION_PAGE_SIZE,
+                            TestPageRandom);
+
+    memset(TestCompressionOutput, 0xA5, sizeof(TestCompressionOutput));
+    Size = MmpCompressPage(TestCompressionPage,
+                           TEST_COMPRESSION_PAGE_SIZE,
+                           TestCompressionOutput,
+                           TEST_COMPRESSION_PAGE_SIZE / 2,
+                           TestCompressionHashTable);
+
+    if (Size != 0) {
+        printf("Compress: Random page fit in half a page (%d bytes).\n", Size);
+        Failures += 1;
+    }
+
+    for (Size = TEST_COMPRESSION_PAGE_SIZE / 2;
+         Size < sizeof(TestCompressionOutput);
+         Size += 1) {
+
+        if (TestCompressionOutput[Size] != 0xA5) {
+            printf("Compress: Wrote past the output at offset %d.\n", Size);
+            Failures += 1;
+            break;
+        }
+    }
+
+    //
+    // Corrupt data must be rejected, not overrun the output.
+    //
+
+    TestCompressionFillPage(TestCompressionPage,
+                            TEST_COMPRESSION_PAGE_SIZE,
+                            TestPageText);
+
+    Size = MmpCompressPage(TestCompressionPage,
+                           TEST_COMPRESSION_PAGE_SIZE,
+                           TestCompressionOutput,
+                           TEST_COMPRESSION_PAGE_SIZE,
+                           TestCompressionHashTable);
+
+    if (Size > 1) {
+        if (MmpDecompressPage(TestCompressionOutput,
+                              Size - 1,
+                              TestCompressionResult,
+                              TEST_COMPRESSION_PAGE_SIZE) != FALSE) {
+
+            printf("Compress: Truncated data decompressed.\n");
+            Failures += 1;
+        }
+
+        if (MmpDecompressPage(TestCompressionOutput,
+                              Size,
+                              TestCompressionResult,
+                              TEST_COMPRESSION_PAGE_SIZE - 1) != FALSE) {
+
+            printf("Compress: Data decompressed into a short buffer.\n");
+            Failures += 1;
+        }
+    }
+
+    return Failures;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+ULONG
+TestCompressionRoundTrip (
+    PUCHAR Page,
+    ULONG Size,
+    BOOL ExpectFit
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compresses and decompresses the given data and makes sure it
+    comes back the same.
+
+Arguments:
+
+    Page - Supplies a pointer to the data.
+
+    Size - Supplies the size of the data in bytes.
+
+    ExpectFit - Supplies a boolean indicating whether the data is expected to
+        compress into less than its own size.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG CompressedSize;
+
+    CompressedSize = MmpCompressPage(Page,
+                                     Size,
+                                     TestCompressionOutput,
+                                     Size,
+                                     TestCompressionHashTable);
+
+    if (CompressedSize == 0) {
+        if (ExpectFit != FALSE) {
+            printf("Compress: %d bytes did not compress.\n", Size);
+            return 1;
+        }
+
+        //
+        // Incompressible data still has to round trip given enough room.
+        //
+
+        CompressedSize = MmpCompressPage(Page,
+                                         Size,
+                                         TestCompressionOutput,
+                                         sizeof(TestCompressionOutput),
+                                         TestCompressionHashTable);
+
+        if (CompressedSize == 0) {
+            printf("Compress: %d bytes did not fit in %d.\n",
+                   Size,
+                   (ULONG)sizeof(TestCompressionOutput));
+
+            return 1;
+        }
+    }
+
+    memset(TestCompressionResult, 0xA5, sizeof(TestCompressionResult));
+    if (MmpDecompressPage(TestCompressionOutput,
+                          CompressedSize,
+                          TestCompressionResult,
+                          Size) == FALSE) {
+
+        printf("Compress: Failed to decompress %d bytes from %d.\n",
+               Size,
+               CompressedSize);
+
+        return 1;
+    }
+
+    if (memcmp(Page, TestCompressionResult, Size) != 0) {
+        printf("Compress: %d bytes came back different.\n", Size);
+        return 1;
+    }
+
+    return 0;
+}
+
+VOID
+TestCompressionFillPage (
+    PUCHAR Page,
+    ULONG Size,
+    TEST_PAGE_PATTERN Pattern
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills a buffer with test data.
+
+Arguments:
+
+    Page - Supplies a pointer to the buffer to fill.
+
+    Size - Supplies the size of the buffer in bytes.
+
+    Pattern - Supplies the kind of data to fill it with.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+    PSTR Text;
+    ULONG TextLength;
+
+    Text = "The quick brown fox jumps over the lazy dog. ";
+    TextLength = strlen(Text);
+    for (Index = 0; Index < Size; Index += 1) {
+        switch (Pattern) {
+        case TestPageZero:
+            Page[Index] = 0;
+            break;
+
+        case TestPageRepeating:
+            Page[Index] = Index % 7;
+            break;
+
+        case TestPageText:
+            Page[Index] = Text[(Index * 3 / 2) % TextLength];
+            break;
+
+        case TestPageRandom:
+            Page[Index] = rand();
+            break;
+
+        case TestPageMixed:
+            if ((Index / 512) % 2 == 0) {
+                Page[Index] = rand();
+
+            } else {
+                Page[Index] = Text[Index % TextLength];
+            }
+
+            break;
+
+        case TestPageSparse:
+            Page[Index] = 0;
+            if ((rand() % 64) == 0) {
+                Page[Index] = rand();
+            }
+
+            break;
+
+        default:
+            Page[Index] = 0;
+            break;
+        }
+    }
+
+    return;
+}
+
@@ -105,6 +105,12 @@ Return Value:
         printf("\nUser VA test had %d failures.\n", Failures);
     }
 
+    TotalTestsFailed += Failures;
+    Failures = TestCompression();
+    if (Failures != 0) {
+        printf("\nCompression test had %d failures.\n", Failures);
+    }
+
     TotalTestsFailed += Failures;
 
     //
@@ -106,3 +106,24 @@ Return Value:
 
 --*/
 
+ULONG
+TestCompression (
+    VOID
+    );
+
+/*++
+
+Routine Description:
+
+    This routine tests the page compressor and decompressor.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
@@ -1121,6 +1121,7 @@ Return Value:
     PHYSICAL_ADDRESS PhysicalAddress;
     PIMAGE_SECTION SourceSection;
     KSTATUS Status;
+    MM_TLB_BATCH TlbBatch;
 
     //
     // This routine must be called at low level, and neither process can be
@@ -1141,6 +1142,7 @@ Return Value:
     MmpLockAccountant(Source->Accountant, FALSE);
     MmpLockAccountant(Destination->Accountant, TRUE);
     MmAcquireAddressSpaceLock(Source);
+    MmpInitializeTlbBatch(&TlbBatch, Source);
     Destination->MaxMemoryMap = Source->MaxMemoryMap;
     Destination->BreakStart = Source->BreakStart;
     Destination->BreakEnd = Source->BreakEnd;
@@ -1166,19 +1168,12 @@ Return Value:
                                    AddressListEntry);
 
         CurrentEntry = CurrentEntry->Next;
-        Status = MmpCopyImageSection(SourceSection, Destination);
+        Status = MmpCopyImageSection(SourceSection, Destination, &TlbBatch);
         if (!KSUCCESS(Status)) {
             goto CloneProcessAddressSpaceEnd;
         }
     }
 
-    //
-    // Invalidate the entire TLB as all the source process's writable image
-    // sections were converted to read-only image sections.
-    //
-
-    ArInvalidateEntireTlb();
-
     //
     // Map the user shared data page. The accounting descriptor will get copied
     // in the next step.
@@ -1210,6 +1205,14 @@ Return Value:
     Status = STATUS_SUCCESS;
 
 CloneProcessAddressSpaceEnd:
+
+    //
+    // Invalidate the source process's writable image sections, which were
+    // converted to read-only, with a single shootdown. Other threads of the
+    // source may be running on other processors.
+    //
+
+    MmpFlushTlbBatch(&TlbBatch);
     MmpUnlockAccountant(Destination->Accountant, TRUE);
     MmpUnlockAccountant(Source->Accountant, FALSE);
     MmReleaseAddressSpaceLock(Source);
@@ -2666,7 +2669,8 @@ Return Value:
         MmpChangeMemoryRegionAccess(VirtualAddress,
                                     1,
                                     MAP_FLAG_PRESENT | MAP_FLAG_READ_ONLY,
-                                    MAP_FLAG_ALL_MASK);
+                                    MAP_FLAG_ALL_MASK,
+                                    NULL);
     }
 
     //
@@ -2683,7 +2687,8 @@ Return Value:
         MmpChangeMemoryRegionAccess(VirtualAddress,
                                     1,
                                     Attributes,
-                                    MAP_FLAG_ALL_MASK);
+                                    MAP_FLAG_ALL_MASK,
+                                    NULL);
     }
 
     if ((Section->Flags & IMAGE_SECTION_EXECUTABLE) != 0) {
@@ -577,6 +577,7 @@ Return Value:
     // whatever is in the TSS.
     //
 
+    MmpUpdateProcessorAddressSpace(ProcessorBlock, AddressSpace);
     Tss->Cr3 = Space->PageDirectoryPhysical;
     ArSetCurrentPageDirectory(Space->PageDirectoryPhysical);
     return;
@@ -1557,6 +1558,94 @@ Return Value:
     return PhysicalAddress;
 }
 
+BOOL
+MmpTestAndClearAccessedBit (
+    PADDRESS_SPACE AddressSpace,
+    PVOID VirtualAddress
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines whether or not the hardware has marked the given
+    page as accessed since the last time it was checked, and clears the
+    accessed state so that the next check can find out whether the page was
+    touched again in the meantime. This routine assumes the lock of the image
+    section owning the mapping is held.
+
+Arguments:
+
+    AddressSpace - Supplies a pointer to the address space that owns the
+        mapping.
+
+    VirtualAddress - Supplies the virtual address of the page to check.
+
+Return Value:
+
+    TRUE if the page is mapped and was accessed since the last check.
+
+    FALSE if the page was not accessed, is not mapped, or the architecture
+    does not track accesses in hardware.
+
+--*/
+
+{
+
+    BOOL Accessed;
+    volatile PTE *Directory;
+    ULONG DirectoryIndex;
+    RUNLEVEL OldRunLevel;
+    volatile PTE *PageTable;
+    ULONG PageTableIndex;
+    PHYSICAL_ADDRESS PageTablePhysical;
+    PPROCESSOR_BLOCK ProcessorBlock;
+    PADDRESS_SPACE_X86 Space;
+
+    Space = (PADDRESS_SPACE_X86)AddressSpace;
+    DirectoryIndex = (UINTN)VirtualAddress >> PAGE_DIRECTORY_SHIFT;
+    if (VirtualAddress >= KERNEL_VA_START) {
+        Directory = MmKernelPageDirectory;
+
+    } else {
+        Directory = Space->PageDirectory;
+    }
+
+    if ((Directory == NULL) || (Directory[DirectoryIndex].Present == 0)) {
+        return FALSE;
+    }
+
+    PageTablePhysical = (ULONG)(Directory[DirectoryIndex].Entry << PAGE_SHIFT);
+    PageTableIndex = ((UINTN)VirtualAddress & PTE_INDEX_MASK) >> PAGE_SHIFT;
+    Accessed = FALSE;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    ProcessorBlock = KeGetCurrentProcessorBlock();
+    MmpMapPage(PageTablePhysical,
+               ProcessorBlock->SwapPage,
+               MAP_FLAG_PRESENT | MAP_FLAG_GLOBAL);
+
+    PageTable = (volatile PTE *)(ProcessorBlock->SwapPage);
+    if ((PageTable[PageTableIndex].Present != 0) &&
+        (PageTable[PageTableIndex].Accessed != 0)) {
+
+        //
+        // Clear the bit atomically, as the processor may be setting the dirty
+        // bit in the same entry concurrently. No TLB invalidate is sent: a
+        // stale TLB entry just means further accesses go unnoticed until the
+        // entry is evicted, which only makes the page look colder than it is.
+        //
+
+        RtlAtomicAnd32((PULONG)&(PageTable[PageTableIndex]),
+                       ~PTE_FLAG_ACCESSED);
+
+        Accessed = TRUE;
+    }
+
+    MmpUnmapPages(ProcessorBlock->SwapPage, 1, 0, NULL);
+    KeLowerRunLevel(OldRunLevel);
+    return Accessed;
+}
+
 VOID
 MmpUnmapPageInOtherProcess (
     PADDRESS_SPACE AddressSpace,
@@ -1854,7 +1943,8 @@ MmpChangeMemoryRegionAccess (
     PVOID VirtualAddress,
     ULONG PageCount,
     ULONG MapFlags,
-    ULONG MapFlagsMask
+    ULONG MapFlagsMask,
+    PMM_TLB_BATCH TlbBatch
     )
 
 /*++
@@ -1877,6 +1967,11 @@ Routine Description:
     MapFlagsMask - Supplies the bitfield of supplied MAP_FLAG_* values that are
         valid. If in doubt, use MAP_FLAG_ALL_MASK to make all values valid.
 
+    TlbBatch - Supplies an optional pointer to a TLB invalidation batch for
+        the address space owning the range. If supplied, changed translations
+        that other processors may hold are added to the batch rather than
+        being shot down before this routine returns.
+
 Return Value:
 
     None.
@@ -2000,16 +2095,25 @@ Return Value:
     }
 
     //
-    // Send an invalidate IPI if any mappings were changed.
+    // Send an invalidate IPI if any mappings were changed, or leave it to
+    // the caller's batch.
     //
 
     if (ChangedSomething != FALSE) {
 
         ASSERT(SendInvalidateIpi != FALSE);
 
-        MmpSendTlbInvalidateIpi(&(AddressSpace->Common),
-                                VirtualAddress,
-                                PageCount);
+        if (TlbBatch != NULL) {
+
+            ASSERT(TlbBatch->AddressSpace == &(AddressSpace->Common));
+
+            MmpAddTlbBatchRange(TlbBatch, VirtualAddress, PageCount);
+
+        } else {
+            MmpSendTlbInvalidateIpi(&(AddressSpace->Common),
+                                    VirtualAddress,
+                                    PageCount);
+        }
     }
 
     return;
@@ -53,6 +53,13 @@ Module Name:
 
 #define HANDLE_FLAG_ALLOCATED 0x80000000
 
+//
+// Define the number of lookup phases. Lookups count themselves in the current
+// phase so that writers can wait for lookups that started before a change.
+//
+
+#define HANDLE_TABLE_LOOKUP_PHASES 2
+
 //
 // --------------------------------------------------------------------- Macros
 //
@@ -110,25 +117,35 @@ Structure Description:
 
     MaxDescriptor - Stores the maximum valid descriptor number.
 
-    Entries - Stores the actual array of handles.
+    Entries - Stores the actual array of handles. Lookups read this without
+        the lock, so a replaced array is only freed once no lookup can still
+        be using it.
 
-    ArraySize - Stores the number of elements in the array.
+    ArraySize - Stores the number of elements in the array. This is never
+        larger than the array currently published in the entries member.
 
-    Lock - Stores a pointer to a lock protecting access to the handle table.
+    Lock - Stores a pointer to a lock protecting changes to the handle table.
+        Lookups do not acquire it.
 
     LookupCallback - Stores an optional pointer to a routine that is called
         whenever a handle is looked up.
 
+    LookupPhase - Stores the phase new lookups count themselves in.
+
+    Lookups - Stores the number of lookups in flight for each phase.
+
 --*/
 
 struct _HANDLE_TABLE {
     PKPROCESS Process;
     ULONG NextDescriptor;
     ULONG MaxDescriptor;
-    PHANDLE_TABLE_ENTRY Entries;
-    ULONG ArraySize;
+    PHANDLE_TABLE_ENTRY volatile Entries;
+    volatile ULONG ArraySize;
     PQUEUED_LOCK Lock;
     PHANDLE_TABLE_LOOKUP_CALLBACK LookupCallback;
+    volatile ULONG LookupPhase;
+    volatile ULONG Lookups[HANDLE_TABLE_LOOKUP_PHASES];
 };
 
 //
@@ -141,6 +158,11 @@ ObpExpandHandleTable (
     ULONG Descriptor
     );
 
+VOID
+ObpSynchronizeHandleLookups (
+    PHANDLE_TABLE Table
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -199,10 +221,8 @@ Return Value:
         ObAddReference(Process);
     }
 
+    RtlZeroMemory(HandleTable, sizeof(HANDLE_TABLE));
     HandleTable->Process = Process;
-    HandleTable->Lock = NULL;
-    HandleTable->NextDescriptor = 0;
-    HandleTable->MaxDescriptor = 0;
     HandleTable->LookupCallback = LookupCallbackRoutine;
     AllocationSize = HANDLE_TABLE_INITIAL_SIZE * sizeof(HANDLE_TABLE_ENTRY);
     HandleTable->Entries = MmAllocatePagedPool(AllocationSize,
@@ -399,10 +419,11 @@ Return Value:
 
     ASSERT(HandleValue != NULL);
 
+    Table->Entries[Descriptor].HandleValue = HandleValue;
+    RtlMemoryBarrier();
     Table->Entries[Descriptor].Flags = HANDLE_FLAG_ALLOCATED |
                                        (Flags & HANDLE_FLAG_MASK);
 
-    Table->Entries[Descriptor].HandleValue = HandleValue;
     *NewHandle = (HANDLE)Descriptor;
     if (Descriptor > Table->MaxDescriptor) {
         Table->MaxDescriptor = Descriptor;
@@ -463,6 +484,13 @@ Return Value:
         Table->NextDescriptor = Descriptor;
     }
 
+    //
+    // The caller is about to release the value. Wait out any lookup that may
+    // have seen it and not yet taken its reference.
+    //
+
+    ObpSynchronizeHandleLookups(Table);
+
 DestroyHandleEnd:
     OB_RELEASE_HANDLE_TABLE_LOCK(Table);
     return;
@@ -515,6 +543,7 @@ Return Value:
 {
 
     ULONG Descriptor;
+    PVOID OldValue;
     KSTATUS Status;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
@@ -540,18 +569,29 @@ Return Value:
         *OldFlags = Table->Entries[Descriptor].Flags & HANDLE_FLAG_MASK;
     }
 
+    OldValue = Table->Entries[Descriptor].HandleValue;
     if (OldHandleValue != NULL) {
-        *OldHandleValue = Table->Entries[Descriptor].HandleValue;
+        *OldHandleValue = OldValue;
     }
 
+    Table->Entries[Descriptor].HandleValue = NewHandleValue;
+    RtlMemoryBarrier();
     Table->Entries[Descriptor].Flags = HANDLE_FLAG_ALLOCATED |
                                        (NewFlags & HANDLE_FLAG_MASK);
 
-    Table->Entries[Descriptor].HandleValue = NewHandleValue;
     if (Descriptor > Table->MaxDescriptor) {
         Table->MaxDescriptor = Descriptor;
     }
 
+    //
+    // Make sure no lookup is still taking a reference on the old value before
+    // handing it back to the caller to release.
+    //
+
+    if (OldValue != NULL) {
+        ObpSynchronizeHandleLookups(Table);
+    }
+
     Status = STATUS_SUCCESS;
 
 ReplaceHandleValueEnd:
@@ -592,34 +632,59 @@ Return Value:
 
 {
 
+    ULONG ArraySize;
     ULONG Descriptor;
+    PHANDLE_TABLE_ENTRY Entries;
     ULONG LocalFlags;
+    ULONG Phase;
     PVOID Value;
 
     ASSERT((Table->Process == NULL) ||
            (Table->Process->ThreadCount == 0) ||
            (Table->Process == PsGetCurrentProcess()));
 
+    //
+    // Lookups do not take the table lock. Instead they count themselves as
+    // in flight, which holds off anyone freeing the entry array or releasing
+    // a value that this lookup might see until it is done.
+    //
+
     Descriptor = (ULONG)Handle;
     LocalFlags = 0;
     Value = NULL;
-    OB_ACQUIRE_HANDLE_TABLE_LOCK(Table);
-    if (Descriptor >= Table->ArraySize) {
+    Phase = Table->LookupPhase % HANDLE_TABLE_LOOKUP_PHASES;
+    RtlAtomicAdd32(&(Table->Lookups[Phase]), 1);
+
+    //
+    // The array is published before its size, so reading the size first
+    // guarantees the array read afterwards is at least that large.
+    //
+
+    ArraySize = Table->ArraySize;
+    RtlMemoryBarrier();
+    Entries = Table->Entries;
+    if (Descriptor >= ArraySize) {
         goto GetHandleValueEnd;
     }
 
-    LocalFlags = Table->Entries[Descriptor].Flags;
+    Value = Entries[Descriptor].HandleValue;
+    if (Value == NULL) {
+        goto GetHandleValueEnd;
+    }
+
+    RtlMemoryBarrier();
+    LocalFlags = Entries[Descriptor].Flags;
     if ((LocalFlags & HANDLE_FLAG_ALLOCATED) == 0) {
+        Value = NULL;
         goto GetHandleValueEnd;
     }
 
-    Value = Table->Entries[Descriptor].HandleValue;
     if (Table->LookupCallback != NULL) {
         Table->LookupCallback(Table, (HANDLE)Descriptor, Value);
     }
 
 GetHandleValueEnd:
-    OB_RELEASE_HANDLE_TABLE_LOCK(Table);
+    RtlAtomicAdd32(&(Table->Lookups[Phase]), -1);
     if ((Flags != NULL) && (Value != NULL)) {
         *Flags = LocalFlags & HANDLE_FLAG_MASK;
     }
@@ -849,6 +914,7 @@ Return Value:
     UINTN AllocationSize;
     PVOID NewBuffer;
     UINTN NewCapacity;
+    PVOID OldBuffer;
     KSTATUS Status;
 
     if (Descriptor >= OB_MAX_HANDLES) {
@@ -896,9 +962,18 @@ Return Value:
                 NewBuffer + (Table->ArraySize * sizeof(HANDLE_TABLE_ENTRY)),
                 (NewCapacity - Table->ArraySize) * sizeof(HANDLE_TABLE_ENTRY));
 
-        MmFreePagedPool(Table->Entries);
+        //
+        // Publish the new array before its size so that lookups never index
+        // past the end of whichever array they see. Then wait for lookups
+        // still reading the old array before freeing it.
+        //
+
+        OldBuffer = Table->Entries;
         Table->Entries = NewBuffer;
+        RtlMemoryBarrier();
         Table->ArraySize = NewCapacity;
+        ObpSynchronizeHandleLookups(Table);
+        MmFreePagedPool(OldBuffer);
     }
 
     Status = STATUS_SUCCESS;
@@ -907,3 +982,50 @@ Return Value:
     return Status;
 }
 
+VOID
+ObpSynchronizeHandleLookups (
+    PHANDLE_TABLE Table
+    )
+
+/*++
+
+Routine Description:
+
+    This routine waits until every handle lookup that started before this call
+    has finished. The caller must hold the handle table lock if there is one.
+
+Arguments:
+
+    Table - Supplies a pointer to the handle table.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Pass;
+    ULONG Phase;
+
+    //
+    // A lookup may read the phase just before it is switched and count itself
+    // in the old phase just after that phase drains. Switching and draining
+    // twice catches that straggler on the second pass. Lookups are short and
+    // never block, so the waits are brief.
+    //
+
+    for (Pass = 0; Pass < HANDLE_TABLE_LOOKUP_PHASES; Pass += 1) {
+        Phase = Table->LookupPhase % HANDLE_TABLE_LOOKUP_PHASES;
+        RtlAtomicExchange32(&(Table->LookupPhase),
+                            (Phase + 1) % HANDLE_TABLE_LOOKUP_PHASES);
+
+        while (Table->Lookups[Phase] != 0) {
+            KeYield();
+        }
+    }
+
+    return;
+}
+
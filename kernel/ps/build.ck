@@ -38,6 +38,7 @@ function build() {
 
     baseSources = [
         "env.c",
+        "idtable.c",
         "info.c",
         "init.c",
         "perm.c",
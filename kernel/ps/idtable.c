@@ -0,0 +1,504 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    idtable.c
+
+Abstract:
+
+    This module implements the tables that allocate process and thread IDs
+    and map them back to their objects.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Kernel
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#include <minoca/kernel/kernel.h>
+#include "psp.h"
+
+//
+// --------------------------------------------------------------------- Macros
+//
+
+//
+// This macro evaluates to the leaf slot in the directory covering an ID.
+//
+
+#define PS_ID_TABLE_LEAF(_Table, _Id) \
+    ((_Table)->Directory[(_Id) >> PS_ID_TABLE_LEAF_SHIFT])
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+KSTATUS
+PspFindFreeId (
+    PPS_ID_TABLE Table,
+    PPS_ID_TABLE_LEAF *NewLeaf,
+    PPROCESS_ID Id
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Store the tables of process and thread IDs.
+//
+
+PS_ID_TABLE PsProcessIdTable;
+PS_ID_TABLE PsThreadIdTable;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+KSTATUS
+PspInitializeIdTable (
+    PPS_ID_TABLE Table
+    )
+
+/*++
+
+Routine Description:
+
+    This routine initializes an ID table.
+
+Arguments:
+
+    Table - Supplies a pointer to the table to initialize.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+{
+
+    UINTN Size;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    RtlZeroMemory(Table, sizeof(PS_ID_TABLE));
+    KeInitializeSpinLock(&(Table->Lock));
+    Size = PS_ID_TABLE_DIRECTORY_SIZE * sizeof(PPS_ID_TABLE_LEAF);
+    Table->Directory = MmAllocateNonPagedPool(Size, PS_ALLOCATION_TAG);
+    if (Table->Directory == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Table->Directory, Size);
+    return STATUS_SUCCESS;
+}
+
+KSTATUS
+PspAllocateId (
+    PPS_ID_TABLE Table,
+    PPROCESS_ID Id
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates an unused ID from the given table. The search picks
+    up where the last allocation left off, so recently freed IDs are not
+    handed out again right away. The new ID starts with one hold and no
+    object.
+
+Arguments:
+
+    Table - Supplies a pointer to the table.
+
+    Id - Supplies a pointer where the new ID is returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if every ID is in use or a leaf could not be
+    allocated.
+
+--*/
+
+{
+
+    PPS_ID_TABLE_LEAF NewLeaf;
+    RUNLEVEL OldRunLevel;
+    KSTATUS Status;
+
+    ASSERT(KeGetRunLevel() <= RunLevelDispatch);
+
+    NewLeaf = NULL;
+    while (TRUE) {
+        OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+        KeAcquireSpinLock(&(Table->Lock));
+        Status = PspFindFreeId(Table, &NewLeaf, Id);
+        KeReleaseSpinLock(&(Table->Lock));
+        KeLowerRunLevel(OldRunLevel);
+        if (Status != STATUS_MORE_PROCESSING_REQUIRED) {
+            break;
+        }
+
+        //
+        // The search ran into a range with no leaf yet. Allocate one outside
+        // the lock and try again.
+        //
+
+        ASSERT(NewLeaf == NULL);
+
+        NewLeaf = MmAllocateNonPagedPool(sizeof(PS_ID_TABLE_LEAF),
+                                         PS_ALLOCATION_TAG);
+
+        if (NewLeaf == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        RtlZeroMemory(NewLeaf, sizeof(PS_ID_TABLE_LEAF));
+    }
+
+    //
+    // Someone else may have filled in the missing leaf in the meantime.
+    //
+
+    if (NewLeaf != NULL) {
+        MmFreeNonPagedPool(NewLeaf);
+    }
+
+    return Status;
+}
+
+VOID
+PspReferenceId (
+    PPS_ID_TABLE Table,
+    PROCESS_ID Id
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a hold to an allocated ID, preventing it from being
+    reused until the hold is released.
+
+Arguments:
+
+    Table - Supplies a pointer to the table.
+
+    Id - Supplies the allocated ID to hold.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+    PPS_ID_TABLE_LEAF Leaf;
+    RUNLEVEL OldRunLevel;
+
+    ASSERT((ULONG)Id < PS_ID_TABLE_MAX_ID);
+
+    Index = Id & PS_ID_TABLE_LEAF_MASK;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Table->Lock));
+    Leaf = PS_ID_TABLE_LEAF(Table, Id);
+
+    ASSERT((Leaf != NULL) && (Leaf->References[Index] != 0));
+
+    Leaf->References[Index] += 1;
+    KeReleaseSpinLock(&(Table->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    return;
+}
+
+VOID
+PspReleaseId (
+    PPS_ID_TABLE Table,
+    PROCESS_ID Id
+    )
+
+/*++
+
+Routine Description:
+
+    This routine releases a hold on an ID. The ID is freed when the last hold
+    is released.
+
+Arguments:
+
+    Table - Supplies a pointer to the table.
+
+    Id - Supplies the ID to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+    PPS_ID_TABLE_LEAF Leaf;
+    RUNLEVEL OldRunLevel;
+
+    ASSERT((ULONG)Id < PS_ID_TABLE_MAX_ID);
+
+    Index = Id & PS_ID_TABLE_LEAF_MASK;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Table->Lock));
+    Leaf = PS_ID_TABLE_LEAF(Table, Id);
+
+    ASSERT((Leaf != NULL) && (Leaf->References[Index] != 0));
+
+    Leaf->References[Index] -= 1;
+    if (Leaf->References[Index] == 0) {
+        Leaf->Objects[Index] = NULL;
+        Leaf->Count -= 1;
+        Table->Count -= 1;
+    }
+
+    KeReleaseSpinLock(&(Table->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    return;
+}
+
+VOID
+PspSetIdObject (
+    PPS_ID_TABLE Table,
+    PROCESS_ID Id,
+    PVOID Object
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the object an allocated ID refers to, making it visible
+    to lookups, or removes it so that lookups no longer find it.
+
+Arguments:
+
+    Table - Supplies a pointer to the table.
+
+    Id - Supplies the allocated ID.
+
+    Object - Supplies a pointer to the object to publish, or NULL to remove
+        the current one.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG Index;
+    PPS_ID_TABLE_LEAF Leaf;
+    RUNLEVEL OldRunLevel;
+
+    ASSERT((ULONG)Id < PS_ID_TABLE_MAX_ID);
+
+    Index = Id & PS_ID_TABLE_LEAF_MASK;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Table->Lock));
+    Leaf = PS_ID_TABLE_LEAF(Table, Id);
+
+    ASSERT((Leaf != NULL) && (Leaf->References[Index] != 0));
+
+    Leaf->Objects[Index] = Object;
+    KeReleaseSpinLock(&(Table->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    return;
+}
+
+PVOID
+PspLookupId (
+    PPS_ID_TABLE Table,
+    PROCESS_ID Id
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks up the object for the given ID and adds a reference to
+    it.
+
+Arguments:
+
+    Table - Supplies a pointer to the table.
+
+    Id - Supplies the ID to look up.
+
+Return Value:
+
+    Returns a pointer to the object with an added reference, or NULL if the
+    ID does not currently refer to an object.
+
+--*/
+
+{
+
+    PPS_ID_TABLE_LEAF Leaf;
+    PVOID Object;
+    RUNLEVEL OldRunLevel;
+
+    if ((ULONG)Id >= PS_ID_TABLE_MAX_ID) {
+        return NULL;
+    }
+
+    //
+    // The lock is only held long enough to index two arrays and bump the
+    // reference count. Objects are removed from the table before their last
+    // reference goes away, so the reference taken here keeps the object
+    // alive.
+    //
+
+    Object = NULL;
+    OldRunLevel = KeRaiseRunLevel(RunLevelDispatch);
+    KeAcquireSpinLock(&(Table->Lock));
+    Leaf = PS_ID_TABLE_LEAF(Table, Id);
+    if (Leaf != NULL) {
+        Object = Leaf->Objects[Id & PS_ID_TABLE_LEAF_MASK];
+        if (Object != NULL) {
+            ObAddReference(Object);
+        }
+    }
+
+    KeReleaseSpinLock(&(Table->Lock));
+    KeLowerRunLevel(OldRunLevel);
+    return Object;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+KSTATUS
+PspFindFreeId (
+    PPS_ID_TABLE Table,
+    PPS_ID_TABLE_LEAF *NewLeaf,
+    PPROCESS_ID Id
+    )
+
+/*++
+
+Routine Description:
+
+    This routine searches for and claims a free ID. This routine assumes the
+    table lock is held.
+
+Arguments:
+
+    Table - Supplies a pointer to the table.
+
+    NewLeaf - Supplies a pointer that on input contains an optional leaf to
+        install if the search reaches a range without one. On output, this is
+        set to NULL if the leaf was consumed.
+
+    Id - Supplies a pointer where the claimed ID is returned.
+
+Return Value:
+
+    STATUS_SUCCESS if an ID was claimed.
+
+    STATUS_MORE_PROCESSING_REQUIRED if a new leaf is needed to continue.
+
+    STATUS_INSUFFICIENT_RESOURCES if every ID is in use.
+
+--*/
+
+{
+
+    ULONG Candidate;
+    ULONG Index;
+    PPS_ID_TABLE_LEAF Leaf;
+    ULONG Scanned;
+    ULONG Skip;
+
+    if (Table->Count >= PS_ID_TABLE_MAX_ID) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Candidate = Table->NextId;
+    Scanned = 0;
+    while (Scanned < PS_ID_TABLE_MAX_ID + PS_ID_TABLE_LEAF_SIZE) {
+        Leaf = PS_ID_TABLE_LEAF(Table, Candidate);
+        if (Leaf == NULL) {
+            if (*NewLeaf == NULL) {
+                return STATUS_MORE_PROCESSING_REQUIRED;
+            }
+
+            Leaf = *NewLeaf;
+            *NewLeaf = NULL;
+            PS_ID_TABLE_LEAF(Table, Candidate) = Leaf;
+        }
+
+        Index = Candidate & PS_ID_TABLE_LEAF_MASK;
+
+        //
+        // Skip straight over full leaves.
+        //
+
+        if (Leaf->Count == PS_ID_TABLE_LEAF_SIZE) {
+            Skip = PS_ID_TABLE_LEAF_SIZE - Index;
+
+        } else if (Leaf->References[Index] != 0) {
+            Skip = 1;
+
+        } else {
+            Leaf->References[Index] = 1;
+            Leaf->Objects[Index] = NULL;
+            Leaf->Count += 1;
+            Table->Count += 1;
+            Table->NextId = Candidate + 1;
+            if (Table->NextId >= PS_ID_TABLE_MAX_ID) {
+                Table->NextId = 0;
+            }
+
+            *Id = Candidate;
+            return STATUS_SUCCESS;
+        }
+
+        Candidate += Skip;
+        Scanned += Skip;
+        if (Candidate >= PS_ID_TABLE_MAX_ID) {
+            Candidate = 0;
+        }
+    }
+
+    return STATUS_INSUFFICIENT_RESOURCES;
+}
+
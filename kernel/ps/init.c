@@ -174,6 +174,16 @@ Return Value:
                 goto InitializeEnd;
             }
 
+            Status = PspInitializeIdTable(&PsProcessIdTable);
+            if (!KSUCCESS(Status)) {
+                goto InitializeEnd;
+            }
+
+            Status = PspInitializeIdTable(&PsThreadIdTable);
+            if (!KSUCCESS(Status)) {
+                goto InitializeEnd;
+            }
+
             Status = PspInitializeProcessGroupSupport();
             if (!KSUCCESS(Status)) {
                 goto InitializeEnd;
@@ -628,8 +638,12 @@ Return Value:
     // Initialize pieces of the thread.
     //
 
+    Status = PspAllocateId(&PsThreadIdTable, &(CurrentThread->ThreadId));
+    if (!KSUCCESS(Status)) {
+        goto AddIdleThreadEnd;
+    }
+
     CurrentThread->OwningProcess = KernelProcess;
-    CurrentThread->ThreadId = RtlAtomicAdd32((PULONG)&PsNextThreadId, 1);
     CurrentThread->KernelStack = IdleThreadStackBase;
     CurrentThread->KernelStackSize = IdleThreadStackSize;
     CurrentThread->State = ThreadStateRunning;
@@ -646,6 +660,7 @@ Return Value:
                   &(KernelProcess->ThreadListHead));
 
     KernelProcess->ThreadCount += 1;
+    PspSetIdObject(&PsThreadIdTable, CurrentThread->ThreadId, CurrentThread);
 
     //
     // Make this initial thread all-powerful.
@@ -579,11 +579,14 @@ Return Value:
 
     //
     // If this is a new process group, add it to the global list and the
-    // session.
+    // session. The group holds its own ID and its session's ID so that
+    // neither is handed to a new process while the group is around.
     //
 
     if (ProcessGroup->ListEntry.Next == NULL) {
         INSERT_BEFORE(&(ProcessGroup->ListEntry), &PsProcessGroupList);
+        PspReferenceId(&PsProcessIdTable, ProcessGroup->Identifier);
+        PspReferenceId(&PsProcessIdTable, ProcessGroup->SessionId);
     }
 
     //
@@ -829,6 +832,8 @@ Return Value:
             KeAcquireQueuedLock(PsProcessGroupListLock);
             if (ProcessGroup->ListEntry.Next != NULL) {
                 LIST_REMOVE(&(ProcessGroup->ListEntry));
+                PspReleaseId(&PsProcessIdTable, ProcessGroup->Identifier);
+                PspReleaseId(&PsProcessIdTable, ProcessGroup->SessionId);
             }
 
             KeReleaseQueuedLock(PsProcessGroupListLock);
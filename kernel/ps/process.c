@@ -72,6 +72,11 @@ PspProcessChildrenOfTerminatingProcess (
     PKPROCESS Process
     );
 
+VOID
+PspWaitForVforkChild (
+    PKEVENT Event
+    );
+
 VOID
 PspLoaderThread (
     PVOID Context
@@ -174,7 +179,6 @@ POBJECT_HEADER PsProcessDirectory = NULL;
 PQUEUED_LOCK PsProcessListLock;
 LIST_ENTRY PsProcessListHead;
 ULONG PsProcessCount;
-volatile PROCESS_ID PsNextProcessId = 0;
 PKPROCESS PsKernelProcess;
 
 //
@@ -397,18 +401,48 @@ Return Value:
     PKPROCESS NewProcess;
     INTN NewProcessId;
     PSYSTEM_CALL_FORK Parameters;
+    PVOID StackEnd;
     KSTATUS Status;
+    VFORK_PARAMETERS Vfork;
 
     CurrentThread = KeGetCurrentThread();
     NewProcess = NULL;
     Parameters = (PSYSTEM_CALL_FORK)SystemCallParameter;
+    RtlZeroMemory(&Vfork, sizeof(VFORK_PARAMETERS));
+    if ((Parameters->Flags & FORK_FLAG_SHARE_ADDRESS_SPACE) != 0) {
+        Vfork.ThreadRoutine = Parameters->ThreadRoutine;
+        Vfork.Parameter = Parameters->Parameter;
+        Vfork.StackBase = Parameters->StackBase;
+        Vfork.StackSize = Parameters->StackSize;
+        StackEnd = Vfork.StackBase + Vfork.StackSize;
+        if ((Vfork.ThreadRoutine == NULL) ||
+            (Vfork.StackBase == NULL) ||
+            (Vfork.StackSize < (sizeof(PVOID) * 2)) ||
+            ((PVOID)(Vfork.ThreadRoutine) >= KERNEL_VA_START) ||
+            (StackEnd <= Vfork.StackBase) ||
+            (StackEnd > KERNEL_VA_START)) {
+
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        Vfork.Event = KeCreateEvent(NULL);
+        if (Vfork.Event == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
     Status = PspCopyProcess(CurrentThread->OwningProcess,
                             CurrentThread,
                             CurrentThread->TrapFrame,
                             Parameters->Flags,
+                            &Vfork,
                             &NewProcess);
 
     if (!KSUCCESS(Status)) {
+        if (Vfork.Event != NULL) {
+            KeDestroyEvent(Vfork.Event);
+        }
+
         RtlDebugPrint("Failed to fork %d\n", Status);
         return Status;
     }
@@ -416,6 +450,17 @@ Return Value:
     NewProcessId = NewProcess->Identifiers.ProcessId;
     ObReleaseReference(NewProcess);
 
+    //
+    // If the child is borrowing this address space, wait for it to execute a
+    // new image or exit before letting this thread touch memory again.
+    //
+
+    if (Vfork.Event != NULL) {
+        PspWaitForVforkChild(Vfork.Event);
+        KeDestroyEvent(Vfork.Event);
+        return NewProcessId;
+    }
+
     //
     // Yield to the child. This alleviates extra work during image section
     // isolation that the parent must do if it triggers copy-on-write before
@@ -547,6 +592,7 @@ Return Value:
 
     Process->SignalHandlerRoutine = NULL;
     INITIALIZE_SIGNAL_SET(Process->HandledSignals);
+    PspEndVfork(Process);
     PspSetThreadUserStackSize(Thread, 0);
     PspImUnloadAllImages(Process);
     MmCleanUpProcessMemory(Process);
@@ -1679,6 +1725,7 @@ PspCopyProcess (
     PKTHREAD MainThread,
     PTRAP_FRAME TrapFrame,
     ULONG Flags,
+    PVFORK_PARAMETERS Vfork,
     PKPROCESS *CreatedProcess
     )
 
@@ -1703,6 +1750,9 @@ Routine Description:
     Flags - Supplies a bitfield of flags governing the creation of the new
         process. See FORK_FLAG_* definitions.
 
+    Vfork - Supplies a pointer to the starting state of the child if the
+        share address space flag is set. This is ignored otherwise.
+
     CreatedProcess - Supplies an optional pointer that will receive a pointer to
         the created process on success.
 
@@ -1854,30 +1904,44 @@ Return Value:
     }
 
     //
-    // Copy the process address space.
+    // Either borrow the parent's address space, setting the child's own aside
+    // until it executes a new image or exits, or copy the process address
+    // space and image list. The borrowing child never looks at the image list
+    // before it gets its own address space back.
     //
 
-    Status = MmCloneAddressSpace(Process->AddressSpace,
-                                 NewProcess->AddressSpace);
+    if ((Flags & FORK_FLAG_SHARE_ADDRESS_SPACE) != 0) {
 
-    if (!KSUCCESS(Status)) {
-        goto CopyProcessEnd;
-    }
+        ASSERT((Vfork != NULL) && (Vfork->Event != NULL));
 
-    //
-    // Copy the image list.
-    //
+        ObAddReference(Vfork->Event);
+        NewProcess->VforkEvent = Vfork->Event;
+        ObAddReference(Process);
+        NewProcess->VforkParent = Process;
+        RtlAtomicAdd32(&(Process->VforkBorrowerCount), 1);
+        NewProcess->VforkAddressSpace = NewProcess->AddressSpace;
+        NewProcess->AddressSpace = Process->AddressSpace;
 
-    Status = PspImCloneProcessImages(Process, NewProcess);
-    if (!KSUCCESS(Status)) {
-        goto CopyProcessEnd;
+    } else {
+        Vfork = NULL;
+        Status = MmCloneAddressSpace(Process->AddressSpace,
+                                     NewProcess->AddressSpace);
+
+        if (!KSUCCESS(Status)) {
+            goto CopyProcessEnd;
+        }
+
+        Status = PspImCloneProcessImages(Process, NewProcess);
+        if (!KSUCCESS(Status)) {
+            goto CopyProcessEnd;
+        }
     }
 
     //
     // Clone the main thread, which will kick off the new process.
     //
 
-    NewMainThread = PspCloneThread(NewProcess, MainThread, TrapFrame);
+    NewMainThread = PspCloneThread(NewProcess, MainThread, TrapFrame, Vfork);
     if (NewMainThread == NULL) {
         Status = STATUS_UNSUCCESSFUL;
         goto CopyProcessEnd;
@@ -1892,6 +1956,7 @@ Return Value:
             // nothing will clean up the new process. "Terminate" it now.
             //
 
+            PspEndVfork(NewProcess);
             PspRemoveProcessFromLists(NewProcess);
             PspProcessTermination(NewProcess);
             ObReleaseReference(NewProcess);
@@ -1906,6 +1971,186 @@ Return Value:
     return Status;
 }
 
+VOID
+PspEndVfork (
+    PKPROCESS Process
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hands a process' own address space back to it if it was
+    borrowing its parent's address space, and releases the suspended parent
+    thread. If the process is the current process, the current thread is
+    switched over to the process' own address space. If the parent has already
+    terminated and this was the last borrower, the parent's address space is
+    torn down first. This routine must be called at low level.
+
+Arguments:
+
+    Process - Supplies a pointer to the process that is done borrowing its
+        parent's address space.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG BorrowerCount;
+    BOOL CleanUpParent;
+    BOOL Enabled;
+    PKEVENT Event;
+    PADDRESS_SPACE OwnAddressSpace;
+    PKPROCESS Parent;
+    PKTHREAD Thread;
+
+    ASSERT(KeGetRunLevel() == RunLevelLow);
+
+    OwnAddressSpace = Process->VforkAddressSpace;
+    if (OwnAddressSpace == NULL) {
+        return;
+    }
+
+    Thread = KeGetCurrentThread();
+
+    //
+    // If the parent terminated while this process was still borrowing its
+    // address space, the last borrower out tears that address space down.
+    // Do it now, while it is still the current address space.
+    //
+
+    Parent = Process->VforkParent;
+    Process->VforkParent = NULL;
+    if (Parent != NULL) {
+        CleanUpParent = FALSE;
+        KeAcquireQueuedLock(Parent->QueuedLock);
+        BorrowerCount = RtlAtomicAdd32(&(Parent->VforkBorrowerCount), -1);
+        if ((BorrowerCount == 1) &&
+            ((Parent->Flags & PROCESS_FLAG_VFORK_CLEANUP_PENDING) != 0)) {
+
+            Parent->Flags &= ~PROCESS_FLAG_VFORK_CLEANUP_PENDING;
+            CleanUpParent = TRUE;
+        }
+
+        KeReleaseQueuedLock(Parent->QueuedLock);
+        if (CleanUpParent != FALSE) {
+
+            ASSERT(Thread->OwningProcess == Process);
+
+            PspImUnloadAllImages(Parent);
+            MmCleanUpProcessMemory(Parent);
+        }
+    }
+
+    if (Thread->OwningProcess != Process) {
+        Process->AddressSpace = OwnAddressSpace;
+
+    } else {
+
+        //
+        // The thread and its kernel stack were only made visible in the
+        // borrowed address space when the thread was created.
+        //
+
+        MmUpdatePageDirectory(OwnAddressSpace, Thread, sizeof(KTHREAD));
+        MmUpdatePageDirectory(OwnAddressSpace,
+                              Thread->KernelStack,
+                              Thread->KernelStackSize);
+
+        //
+        // Swap the address space with interrupts disabled so that a context
+        // switch never sees the process pointer and the loaded address space
+        // disagree.
+        //
+
+        Enabled = ArDisableInterrupts();
+        Process->AddressSpace = OwnAddressSpace;
+        MmSwitchAddressSpace(KeGetCurrentProcessorBlock(),
+                             Thread->KernelStack,
+                             OwnAddressSpace);
+
+        if (Enabled != FALSE) {
+            ArEnableInterrupts();
+        }
+
+        //
+        // The user mode stack the thread was running on belongs to the
+        // parent, so make sure it never gets unmapped on the child's behalf.
+        //
+
+        Thread->UserStack = NULL;
+        Thread->UserStackSize = 0;
+    }
+
+    Process->VforkAddressSpace = NULL;
+    Event = Process->VforkEvent;
+    Process->VforkEvent = NULL;
+    if (Event != NULL) {
+        KeSignalEvent(Event, SignalOptionSignalAll);
+        ObReleaseReference(Event);
+    }
+
+    //
+    // The reference on the parent kept its address space alive until now.
+    //
+
+    if (Parent != NULL) {
+        ObReleaseReference(Parent);
+    }
+
+    return;
+}
+
+VOID
+PspWaitForVforkChild (
+    PKEVENT Event
+    )
+
+/*++
+
+Routine Description:
+
+    This routine suspends the current thread until a child borrowing its
+    process' address space executes a new image or exits. Only a kill signal
+    ends the wait early. In that case the thread detaches from the child and
+    returns only to exit, and the process keeps its address space alive until
+    the child is done with it.
+
+Arguments:
+
+    Event - Supplies a pointer to the event the child signals when it stops
+        borrowing the address space.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    SIGNAL_SET BlockedSignals;
+    SIGNAL_SET OriginalSignals;
+
+    //
+    // Handlers cannot run until the child is done with the address space, and
+    // a stop or continue cannot be acted upon from in here either. Block
+    // everything but kill for the wait, so that it ends only when the child
+    // signals the event or the process is killed. Anything that arrived in
+    // the meantime is dispatched once the original mask is back.
+    //
+
+    FILL_SIGNAL_SET(BlockedSignals);
+    PspSetKernelSignalMask(&BlockedSignals, &OriginalSignals);
+    KeWaitForEvent(Event, TRUE, WAIT_TIME_INDEFINITE);
+    PsSetSignalMask(&OriginalSignals, NULL);
+    return;
+}
+
 PKPROCESS
 PspCreateProcess (
     PCSTR CommandLine,
@@ -2010,16 +2255,17 @@ Return Value:
     }
 
     //
-    // Create the object name using the next process ID. If any future steps
-    // fail, then the process ID is lost. So be it. If allocations are failing,
-    // then the process was doomed even if it got created. The hexidecimal
-    // string is cheaper to calculate (the formatter gets to shift rather than
-    // divide).
-    //
-    // TODO: Prevent colliding with existing process and process group IDs.
+    // Allocate a process ID and create the object name from it. Process groups
+    // and sessions hold their IDs in the same table, so a new process never
+    // collides with one of those either. The hexidecimal string is cheaper to
+    // calculate (the formatter gets to shift rather than divide).
     //
 
-    ProcessId = RtlAtomicAdd32((PULONG)&PsNextProcessId, 1);
+    Status = PspAllocateId(&PsProcessIdTable, &ProcessId);
+    if (!KSUCCESS(Status)) {
+        goto CreateProcessEnd;
+    }
+
     ObjectNameLength = RtlPrintToString(ObjectName,
                                         MAX_PROCESS_NAME_LENGTH,
                                         CharacterEncodingDefault,
@@ -2040,10 +2286,16 @@ Return Value:
                                 PS_ALLOCATION_TAG);
 
     if (NewProcess == NULL) {
+        PspReleaseId(&PsProcessIdTable, ProcessId);
         Status = STATUS_INSUFFICIENT_RESOURCES;
         goto CreateProcessEnd;
     }
 
+    //
+    // The process owns its ID from here on, and gives it back when destroyed.
+    //
+
+    NewProcess->Identifiers.ProcessId = ProcessId;
     INITIALIZE_LIST_HEAD(&(NewProcess->ImageListHead));
     INITIALIZE_LIST_HEAD(&(NewProcess->ChildListHead));
     INITIALIZE_LIST_HEAD(&(NewProcess->SignalListHead));
@@ -2169,11 +2421,11 @@ Return Value:
 
     NewProcess->Environment = Environment;
     Environment = NULL;
-    NewProcess->Identifiers.ProcessId = ProcessId;
     NewProcess->StartTime = HlQueryTimeCounter();
     KeAcquireQueuedLock(PsProcessListLock);
     INSERT_AFTER(&(NewProcess->ListEntry), &PsProcessListHead);
     PsProcessCount += 1;
+    PspSetIdObject(&PsProcessIdTable, ProcessId, NewProcess);
     KeReleaseQueuedLock(PsProcessListLock);
     SpProcessNewProcess(NewProcess->Identifiers.ProcessId);
     Status = STATUS_SUCCESS;
@@ -2230,28 +2482,9 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
-    PKPROCESS FoundProcess;
-    PKPROCESS Process;
-
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
-    FoundProcess = NULL;
-    KeAcquireQueuedLock(PsProcessListLock);
-    CurrentEntry = PsProcessListHead.Next;
-    while (CurrentEntry != &(PsProcessListHead)) {
-        Process = LIST_VALUE(CurrentEntry, KPROCESS, ListEntry);
-        if (Process->Identifiers.ProcessId == ProcessId) {
-            FoundProcess = Process;
-            ObAddReference(FoundProcess);
-            break;
-        }
-
-        CurrentEntry = CurrentEntry->Next;
-    }
-
-    KeReleaseQueuedLock(PsProcessListLock);
-    return FoundProcess;
+    return PspLookupId(&PsProcessIdTable, ProcessId);
 }
 
 PKPROCESS
@@ -2846,6 +3079,7 @@ Return Value:
 
 {
 
+    BOOL BorrowersRemain;
     PPATH_POINT PathPoint;
 
     //
@@ -2853,9 +3087,31 @@ Return Value:
     //
 
     PspDestroyProcessTimers(Process);
-    PspImUnloadAllImages(Process);
+
+    //
+    // A child vforked by a thread that was killed while waiting may still be
+    // running on this address space, and may stay stopped for as long as it
+    // likes. Rather than wait for it, leave the images and memory for the
+    // last borrower to clean up when it executes an image or exits.
+    //
+
+    BorrowersRemain = FALSE;
+    KeAcquireQueuedLock(Process->QueuedLock);
+    if (Process->VforkBorrowerCount != 0) {
+        Process->Flags |= PROCESS_FLAG_VFORK_CLEANUP_PENDING;
+        BorrowersRemain = TRUE;
+    }
+
+    KeReleaseQueuedLock(Process->QueuedLock);
+    if (BorrowersRemain == FALSE) {
+        PspImUnloadAllImages(Process);
+    }
+
     IoCloseProcessHandles(Process, 0);
-    MmCleanUpProcessMemory(Process);
+    if (BorrowersRemain == FALSE) {
+        MmCleanUpProcessMemory(Process);
+    }
+
     if (PsIsSessionLeader(Process)) {
         IoTerminalDisassociate(Process);
     }
@@ -2907,10 +3163,11 @@ Return Value:
 
     //
     // There should only be one remaining page mapped: the shared user data
-    // page.
+    // page. That is, unless a borrower is still using the address space.
     //
 
-    ASSERT(Process->AddressSpace->ResidentSet <= 1);
+    ASSERT((BorrowersRemain != FALSE) ||
+           (Process->AddressSpace->ResidentSet <= 1));
 
     return;
 }
@@ -3028,6 +3285,7 @@ Return Value:
         LIST_REMOVE(&(Process->ListEntry));
         Process->ListEntry.Next = NULL;
         PsProcessCount -= 1;
+        PspSetIdObject(&PsProcessIdTable, Process->Identifiers.ProcessId, NULL);
     }
 
     KeReleaseQueuedLock(PsProcessListLock);
@@ -3263,6 +3521,7 @@ Return Value:
         KeDestroyQueuedLock(Process->Paths.Lock);
     }
 
+    PspReleaseId(&PsProcessIdTable, Process->Identifiers.ProcessId);
     return;
 }
 
@@ -3593,8 +3852,8 @@ PspHandleTableLookupCallback (
 
 Routine Description:
 
-    This routine is called whenever a handle is looked up. It is called with
-    the handle table lock still held.
+    This routine is called whenever a handle is looked up. It is called
+    before the handle can be closed out from under the lookup.
 
 Arguments:
 
@@ -63,10 +63,103 @@ Module Name:
 
 #define OS_BASE_LIBRARY "libminocaos.so.1"
 
+//
+// Define the geometry of the process and thread ID tables. Each leaf covers a
+// contiguous run of IDs, and the directory of leaves bounds the largest ID.
+//
+
+#define PS_ID_TABLE_LEAF_SHIFT 8
+#define PS_ID_TABLE_LEAF_SIZE (1 << PS_ID_TABLE_LEAF_SHIFT)
+#define PS_ID_TABLE_LEAF_MASK (PS_ID_TABLE_LEAF_SIZE - 1)
+#define PS_ID_TABLE_DIRECTORY_SIZE 1024
+#define PS_ID_TABLE_MAX_ID \
+    (PS_ID_TABLE_LEAF_SIZE * PS_ID_TABLE_DIRECTORY_SIZE)
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure defines the parameters used to start a child process that
+    borrows its parent's address space.
+
+Members:
+
+    ThreadRoutine - Stores the user mode routine the child starts at.
+
+    Parameter - Stores the parameter to pass to the thread routine.
+
+    StackBase - Stores the base of the user mode stack the child runs on.
+
+    StackSize - Stores the size of the user mode stack in bytes.
+
+    Event - Stores a pointer to the event to signal when the child stops
+        borrowing the parent's address space.
+
+--*/
+
+typedef struct _VFORK_PARAMETERS {
+    PTHREAD_ENTRY_ROUTINE ThreadRoutine;
+    PVOID Parameter;
+    PVOID StackBase;
+    ULONG StackSize;
+    PKEVENT Event;
+} VFORK_PARAMETERS, *PVFORK_PARAMETERS;
+
+/*++
+
+Structure Description:
+
+    This structure defines one leaf of an ID table.
+
+Members:
+
+    Count - Stores the number of IDs in this leaf that are allocated.
+
+    References - Stores the number of holds on each ID. An ID is free when
+        its count is zero.
+
+    Objects - Stores the object each ID currently refers to, or NULL if the
+        ID is allocated but cannot be looked up.
+
+--*/
+
+typedef struct _PS_ID_TABLE_LEAF {
+    ULONG Count;
+    ULONG References[PS_ID_TABLE_LEAF_SIZE];
+    PVOID Objects[PS_ID_TABLE_LEAF_SIZE];
+} PS_ID_TABLE_LEAF, *PPS_ID_TABLE_LEAF;
+
+/*++
+
+Structure Description:
+
+    This structure defines a table that hands out process or thread IDs and
+    maps them back to their objects in constant time.
+
+Members:
+
+    Lock - Stores the spin lock protecting the table.
+
+    Directory - Stores a pointer to the array of leaves. Leaves are created
+        on demand and are never freed.
+
+    NextId - Stores the ID at which the next allocation starts searching.
+
+    Count - Stores the number of allocated IDs.
+
+--*/
+
+typedef struct _PS_ID_TABLE {
+    KSPIN_LOCK Lock;
+    PPS_ID_TABLE_LEAF *Directory;
+    ULONG NextId;
+    ULONG Count;
+} PS_ID_TABLE, *PPS_ID_TABLE;
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -79,7 +172,7 @@ extern POBJECT_HEADER PsProcessDirectory;
 extern PQUEUED_LOCK PsProcessListLock;
 extern LIST_ENTRY PsProcessListHead;
 extern ULONG PsProcessCount;
-extern volatile PROCESS_ID PsNextProcessId;
+extern PS_ID_TABLE PsProcessIdTable;
 extern PKPROCESS PsKernelProcess;
 
 //
@@ -90,10 +183,10 @@ extern PKPROCESS PsKernelProcess;
 extern ULONGLONG PsInitialThreadPointer;
 
 //
-// Stores the ID for the next thread to be created.
+// Stores the table of thread IDs.
 //
 
-extern volatile THREAD_ID PsNextThreadId;
+extern PS_ID_TABLE PsThreadIdTable;
 
 //
 // Stores handles to frequently used locations.
@@ -178,7 +271,8 @@ PKTHREAD
 PspCloneThread (
     PKPROCESS DestinationProcess,
     PKTHREAD Thread,
-    PTRAP_FRAME TrapFrame
+    PTRAP_FRAME TrapFrame,
+    PVFORK_PARAMETERS Vfork
     );
 
 /*++
@@ -197,7 +291,12 @@ Routine Description:
     Thread - Supplies a pointer to the thread to clone.
 
     TrapFrame - Supplies a pointer to the trap frame to set initial thread
-        state to. A copy of this trap frame will be made.
+        state to. A copy of this trap frame will be made. This is ignored if
+        vfork parameters are supplied.
+
+    Vfork - Supplies an optional pointer to the routine and stack the new
+        thread should start on, if the destination process is borrowing the
+        source process' address space.
 
 Return Value:
 
@@ -408,6 +507,7 @@ PspCopyProcess (
     PKTHREAD MainThread,
     PTRAP_FRAME TrapFrame,
     ULONG Flags,
+    PVFORK_PARAMETERS Vfork,
     PKPROCESS *CreatedProcess
     );
 
@@ -432,6 +532,9 @@ Routine Description:
     Flags - Supplies a bitfield of flags governing the creation of the new
         process. See FORK_FLAG_* definitions.
 
+    Vfork - Supplies a pointer to the starting state of the child if the
+        share address space flag is set. This is ignored otherwise.
+
     CreatedProcess - Supplies an optional pointer that will receive a pointer to
         the created process on success.
 
@@ -441,6 +544,33 @@ Return Value:
 
 --*/
 
+VOID
+PspEndVfork (
+    PKPROCESS Process
+    );
+
+/*++
+
+Routine Description:
+
+    This routine hands a process' own address space back to it if it was
+    borrowing its parent's address space, and releases the suspended parent
+    thread. If the process is the current process, the current thread is
+    switched over to the process' own address space. If the parent has already
+    terminated and this was the last borrower, the parent's address space is
+    torn down first. This routine must be called at low level.
+
+Arguments:
+
+    Process - Supplies a pointer to the process that is done borrowing its
+        parent's address space.
+
+Return Value:
+
+    None.
+
+--*/
+
 PKPROCESS
 PspCreateProcess (
     PCSTR CommandLine,
@@ -1199,6 +1329,33 @@ Return Value:
 
 --*/
 
+VOID
+PspSetKernelSignalMask (
+    PSIGNAL_SET NewMask,
+    PSIGNAL_SET OriginalMask
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets the blocked signal mask for the current thread on behalf
+    of the kernel. Unlike the mask user mode can set, stop and continue may be
+    blocked here, which lets a kernel wait be interrupted by nothing but a
+    kill. The kill signal is never blocked.
+
+Arguments:
+
+    NewMask - Supplies a pointer to the new mask to set.
+
+    OriginalMask - Supplies an optional pointer to the previous mask.
+
+Return Value:
+
+    None.
+
+--*/
+
 KSTATUS
 PspInitializeProcessGroupSupport (
     VOID
@@ -1560,3 +1717,160 @@ Return Value:
     None.
 
 --*/
+
+KSTATUS
+PspInitializeIdTable (
+    PPS_ID_TABLE Table
+    );
+
+/*++
+
+Routine Description:
+
+    This routine initializes an ID table.
+
+Arguments:
+
+    Table - Supplies a pointer to the table to initialize.
+
+Return Value:
+
+    Status code.
+
+--*/
+
+KSTATUS
+PspAllocateId (
+    PPS_ID_TABLE Table,
+    PPROCESS_ID Id
+    );
+
+/*++
+
+Routine Description:
+
+    This routine allocates an unused ID from the given table. The search picks
+    up where the last allocation left off, so recently freed IDs are not
+    handed out again right away. The new ID starts with one hold and no
+    object.
+
+Arguments:
+
+    Table - Supplies a pointer to the table.
+
+    Id - Supplies a pointer where the new ID is returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES if every ID is in use or a leaf could not be
+    allocated.
+
+--*/
+
+VOID
+PspReferenceId (
+    PPS_ID_TABLE Table,
+    PROCESS_ID Id
+    );
+
+/*++
+
+Routine Description:
+
+    This routine adds a hold to an allocated ID, preventing it from being
+    reused until the hold is released.
+
+Arguments:
+
+    Table - Supplies a pointer to the table.
+
+    Id - Supplies the allocated ID to hold.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+PspReleaseId (
+    PPS_ID_TABLE Table,
+    PROCESS_ID Id
+    );
+
+/*++
+
+Routine Description:
+
+    This routine releases a hold on an ID. The ID is freed when the last hold
+    is released.
+
+Arguments:
+
+    Table - Supplies a pointer to the table.
+
+    Id - Supplies the ID to release.
+
+Return Value:
+
+    None.
+
+--*/
+
+VOID
+PspSetIdObject (
+    PPS_ID_TABLE Table,
+    PROCESS_ID Id,
+    PVOID Object
+    );
+
+/*++
+
+Routine Description:
+
+    This routine sets the object an allocated ID refers to, making it visible
+    to lookups, or removes it so that lookups no longer find it.
+
+Arguments:
+
+    Table - Supplies a pointer to the table.
+
+    Id - Supplies the allocated ID.
+
+    Object - Supplies a pointer to the object to publish, or NULL to remove
+        the current one.
+
+Return Value:
+
+    None.
+
+--*/
+
+PVOID
+PspLookupId (
+    PPS_ID_TABLE Table,
+    PROCESS_ID Id
+    );
+
+/*++
+
+Routine Description:
+
+    This routine looks up the object for the given ID and adds a reference to
+    it.
+
+Arguments:
+
+    Table - Supplies a pointer to the table.
+
+    Id - Supplies the ID to look up.
+
+Return Value:
+
+    Returns a pointer to the object with an added reference, or NULL if the
+    ID does not currently refer to an object.
+
+--*/
+
@@ -236,6 +236,44 @@ Return Value:
 
 --*/
 
+{
+
+    SIGNAL_SET NewMaskLocal;
+
+    NewMaskLocal = *NewMask;
+    REMOVE_SIGNAL(NewMaskLocal, SIGNAL_STOP);
+    REMOVE_SIGNAL(NewMaskLocal, SIGNAL_CONTINUE);
+    PspSetKernelSignalMask(&NewMaskLocal, OriginalMask);
+    return;
+}
+
+VOID
+PspSetKernelSignalMask (
+    PSIGNAL_SET NewMask,
+    PSIGNAL_SET OriginalMask
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets the blocked signal mask for the current thread on behalf
+    of the kernel. Unlike the mask user mode can set, stop and continue may be
+    blocked here, which lets a kernel wait be interrupted by nothing but a
+    kill. The kill signal is never blocked.
+
+Arguments:
+
+    NewMask - Supplies a pointer to the new mask to set.
+
+    OriginalMask - Supplies an optional pointer to the previous mask.
+
+Return Value:
+
+    None.
+
+--*/
+
 {
 
     SIGNAL_SET NewBlockedSet;
@@ -249,9 +287,7 @@ Return Value:
     ASSERT(Process != PsGetKernelProcess());
 
     NewMaskLocal = *NewMask;
-    REMOVE_SIGNAL(NewMaskLocal, SIGNAL_STOP);
     REMOVE_SIGNAL(NewMaskLocal, SIGNAL_KILL);
-    REMOVE_SIGNAL(NewMaskLocal, SIGNAL_CONTINUE);
     KeAcquireQueuedLock(Process->QueuedLock);
     if (OriginalMask != NULL) {
         *OriginalMask = Thread->BlockedSignals;
@@ -125,12 +125,6 @@ PspGetThreadInformation (
 // Globals related to thread manipulation.
 //
 
-//
-// Stores the ID for the next thread to be created.
-//
-
-volatile THREAD_ID PsNextThreadId = 0;
-
 //
 // Stores the list of exited threads waiting to be cleaned up.
 //
@@ -337,6 +331,7 @@ Return Value:
             LIST_REMOVE(&(NewThread->ProcessEntry));
             NewThread->ProcessEntry.Next = NULL;
             NewThread->OwningProcess->ThreadCount -= 1;
+            PspSetIdObject(&PsThreadIdTable, NewThread->ThreadId, NULL);
 
             ASSERT(NewThread->OwningProcess->ThreadCount != 0);
 
@@ -556,6 +551,17 @@ Return Value:
 
     Name = NULL;
     Parameters = (PSYSTEM_CALL_CREATE_THREAD)SystemCallParameter;
+
+    //
+    // A process borrowing its parent's address space may only execute an
+    // image or exit.
+    //
+
+    if (CurrentProcess->VforkAddressSpace != NULL) {
+        Status = STATUS_INVALID_CONFIGURATION;
+        goto SysCreateThreadEnd;
+    }
+
     if ((Parameters->Name != NULL) && (Parameters->NameBufferLength != 0)) {
         Status = MmCreateCopyOfUserModeString(Parameters->Name,
                                               Parameters->NameBufferLength,
@@ -1069,7 +1075,8 @@ PKTHREAD
 PspCloneThread (
     PKPROCESS DestinationProcess,
     PKTHREAD Thread,
-    PTRAP_FRAME TrapFrame
+    PTRAP_FRAME TrapFrame,
+    PVFORK_PARAMETERS Vfork
     )
 
 /*++
@@ -1088,7 +1095,12 @@ Routine Description:
     Thread - Supplies a pointer to the thread to clone.
 
     TrapFrame - Supplies a pointer to the trap frame to set initial thread
-        state to. A copy of this trap frame will be made.
+        state to. A copy of this trap frame will be made. This is ignored if
+        vfork parameters are supplied.
+
+    Vfork - Supplies an optional pointer to the routine and stack the new
+        thread should start on, if the destination process is borrowing the
+        source process' address space.
 
 Return Value:
 
@@ -1099,12 +1111,21 @@ Return Value:
 {
 
     PKTHREAD NewThread;
+    PVOID Parameter;
+    PTHREAD_ENTRY_ROUTINE Routine;
     KSTATUS Status;
 
+    Routine = Thread->ThreadRoutine;
+    Parameter = Thread->ThreadParameter;
+    if (Vfork != NULL) {
+        Routine = Vfork->ThreadRoutine;
+        Parameter = Vfork->Parameter;
+    }
+
     NewThread = PspCreateThread(DestinationProcess,
                                 Thread->KernelStackSize,
-                                Thread->ThreadRoutine,
-                                Thread->ThreadParameter,
+                                Routine,
+                                Parameter,
                                 Thread->Header.Name,
                                 Thread->Flags & THREAD_FLAG_CREATION_MASK);
 
@@ -1133,11 +1154,24 @@ Return Value:
     //
 
     NewThread->BlockedSignals = Thread->BlockedSignals;
-    NewThread->UserStack = Thread->UserStack;
-    NewThread->UserStackSize = Thread->UserStackSize;
-    PspPrepareThreadForFirstRun(NewThread, TrapFrame, FALSE);
     NewThread->ThreadPointer = Thread->ThreadPointer;
-    NewThread->ThreadIdPointer = Thread->ThreadIdPointer;
+    if (Vfork == NULL) {
+        NewThread->UserStack = Thread->UserStack;
+        NewThread->UserStackSize = Thread->UserStackSize;
+        PspPrepareThreadForFirstRun(NewThread, TrapFrame, FALSE);
+        NewThread->ThreadIdPointer = Thread->ThreadIdPointer;
+
+    //
+    // A thread borrowing the parent's address space runs on the stack it was
+    // handed. The thread ID address belongs to the parent thread, so don't
+    // clear it when the child exits.
+    //
+
+    } else {
+        NewThread->UserStack = Vfork->StackBase;
+        NewThread->UserStackSize = Vfork->StackSize;
+        PspPrepareThreadForFirstRun(NewThread, NULL, FALSE);
+    }
 
     //
     // Insert the thread onto the ready list.
@@ -1264,28 +1298,17 @@ Return Value:
 
 {
 
-    PLIST_ENTRY CurrentEntry;
-    PKTHREAD FoundThread;
     PKTHREAD Thread;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
 
-    FoundThread = NULL;
-    KeAcquireQueuedLock(Process->QueuedLock);
-    CurrentEntry = Process->ThreadListHead.Next;
-    while (CurrentEntry != &(Process->ThreadListHead)) {
-        Thread = LIST_VALUE(CurrentEntry, KTHREAD, ProcessEntry);
-        if (Thread->ThreadId == ThreadId) {
-            FoundThread = Thread;
-            ObAddReference(FoundThread);
-            break;
-        }
-
-        CurrentEntry = CurrentEntry->Next;
+    Thread = PspLookupId(&PsThreadIdTable, ThreadId);
+    if ((Thread != NULL) && (Thread->OwningProcess != Process)) {
+        ObReleaseReference(Thread);
+        Thread = NULL;
     }
 
-    KeReleaseQueuedLock(Process->QueuedLock);
-    return FoundThread;
+    return Thread;
 }
 
 VOID
@@ -1330,6 +1353,13 @@ Return Value:
 
     Thread->Flags |= THREAD_FLAG_EXITING;
 
+    //
+    // If the process was borrowing its parent's address space, give it back
+    // and release the parent. The user mode stack belongs to the parent.
+    //
+
+    PspEndVfork(Process);
+
     //
     // Free the user mode stack before decrementing the thread count.
     //
@@ -1487,6 +1517,7 @@ Return Value:
     PKTHREAD NewThread;
     ULONG ObjectFlags;
     KSTATUS Status;
+    THREAD_ID ThreadId;
     BOOL UserMode;
 
     ASSERT(KeGetRunLevel() == RunLevelLow);
@@ -1528,6 +1559,16 @@ Return Value:
         NameLength = RtlStringLength(Name) + 1;
     }
 
+    //
+    // Give the thread a unique ID.
+    //
+
+    NewThread = NULL;
+    Status = PspAllocateId(&PsThreadIdTable, &ThreadId);
+    if (!KSUCCESS(Status)) {
+        goto CreateThreadEnd;
+    }
+
     //
     // Allocate the new thread's structure.
     //
@@ -1543,10 +1584,16 @@ Return Value:
                                PS_ALLOCATION_TAG);
 
     if (NewThread == NULL) {
+        PspReleaseId(&PsThreadIdTable, ThreadId);
         Status = STATUS_INSUFFICIENT_RESOURCES;
         goto CreateThreadEnd;
     }
 
+    //
+    // The thread owns its ID from here on, and gives it back when destroyed.
+    //
+
+    NewThread->ThreadId = ThreadId;
     INITIALIZE_LIST_HEAD(&(NewThread->SignalListHead));
     NewThread->OwningProcess = OwningProcess;
     NewThread->State = ThreadStateFirstTime;
@@ -1611,12 +1658,6 @@ Return Value:
                               sizeof(KTHREAD));
     }
 
-    //
-    // Give the thread a unique ID.
-    //
-
-    NewThread->ThreadId = RtlAtomicAdd32((PULONG)&PsNextThreadId, 1);
-
     //
     // Add the thread to the process.
     //
@@ -1624,6 +1665,7 @@ Return Value:
     KeAcquireQueuedLock(OwningProcess->QueuedLock);
     INSERT_BEFORE(&(NewThread->ProcessEntry), &(OwningProcess->ThreadListHead));
     OwningProcess->ThreadCount += 1;
+    PspSetIdObject(&PsThreadIdTable, NewThread->ThreadId, NewThread);
     KeReleaseQueuedLock(OwningProcess->QueuedLock);
     SpProcessNewThread(OwningProcess->Identifiers.ProcessId,
                        NewThread->ThreadId);
@@ -1763,6 +1805,7 @@ Return Value:
         KeAcquireQueuedLock(Thread->OwningProcess->QueuedLock);
         LIST_REMOVE(&(Thread->ProcessEntry));
         Thread->ProcessEntry.Next = NULL;
+        PspSetIdObject(&PsThreadIdTable, Thread->ThreadId, NULL);
 
         //
         // The thread has been removed from the process's thread list. Add
@@ -1880,6 +1923,7 @@ Return Value:
         if (Thread->ProcessEntry.Next != NULL) {
             KeAcquireQueuedLock(Process->QueuedLock);
             LIST_REMOVE(&(Thread->ProcessEntry));
+            PspSetIdObject(&PsThreadIdTable, Thread->ThreadId, NULL);
             Process->ThreadCount -= 1;
             if (Process->ThreadCount == 0) {
                 LastThread = TRUE;
@@ -1920,6 +1964,12 @@ Return Value:
         KeUnlinkSchedulerEntry(&(Thread->SchedulerEntry));
     }
 
+    //
+    // Give the thread ID back so it can be reused.
+    //
+
+    PspReleaseId(&PsThreadIdTable, Thread->ThreadId);
+
     //
     // Potentially clean up the process if the last thread just exited. This
     // will clean up all blocked signals.
@@ -59,9 +59,11 @@ Structure Description:
     TreeNode - Stores the accounting structure for keeping the entry in a
         Red-Black tree.
 
-    Object - Stores a pointer to the object this lock is tied to. This is a
-        process for a process local lock, an image section for a lock in a
-        private memory region, or a file object in a shared memory region.
+    Object - Stores a pointer to the object this lock is tied to. This is an
+        address space for a process local lock, an image section for a lock in
+        a private memory region, or a file object in a shared memory region.
+        Keying on the address space lets a child borrowing its parent's
+        address space contend on the same locks as the parent.
 
     Offset - Stores either 1) the offset into the file object, 2) the offset
         into the image section, or 3) the user mode address in the process
@@ -464,7 +466,7 @@ Return Value:
     BOOL Shared;
 
     if (Private != FALSE) {
-        Lock->Object = PsGetCurrentProcess();
+        Lock->Object = PsGetCurrentProcess()->AddressSpace;
         Lock->Offset = (UINTN)Address;
         Lock->Type = UserLockTypeProcess;
 
@@ -495,7 +497,7 @@ PspReleaseUserLockObject (
 Routine Description:
 
     This routine releases the reference on a user lock backing object, which
-    is either a process, image section, or file object.
+    is either an address space, image section, or file object.
 
 Arguments:
 
@@ -105,6 +105,20 @@ Return Value:
         Data->ProcessorFeatures |= X86_FEATURE_I686;
     }
 
+    //
+    // Remember if the processor supports the fxsave instruction. This is
+    // checked here since the syscall detection below clobbers the basic
+    // feature bits. SSE2 is only reported if fxsave is also present, since
+    // that's what the kernel uses to preserve the XMM registers.
+    //
+
+    if ((Edx & X86_CPUID_BASIC_EDX_FX_SAVE_RESTORE) != 0) {
+        Data->ProcessorFeatures |= X86_FEATURE_FXSAVE;
+        if ((Edx & X86_CPUID_BASIC_EDX_SSE2) != 0) {
+            Data->ProcessorFeatures |= X86_FEATURE_SSE2;
+        }
+    }
+
     //
     // In 32-bit mode, shoot for sysenter, and then syscall. (Note that in
     // long mode, syscall is just assumed to be present architecturally).
@@ -157,14 +171,6 @@ Return Value:
         }
     }
 
-    //
-    // Remember if the processor supports the fxsave instruction.
-    //
-
-    if ((Edx & X86_CPUID_BASIC_EDX_FX_SAVE_RESTORE) != 0) {
-        Data->ProcessorFeatures |= X86_FEATURE_FXSAVE;
-    }
-
     return;
 }
 
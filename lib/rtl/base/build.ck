@@ -78,7 +78,8 @@ function build() {
 
     x86Sources = x86Intrinsics + [
         "x86/rtlarch.S",
-        "x86/rtlmem.S"
+        "x86/rtlmem.S",
+        "x86/rtlvec.S"
     ];
 
     armv7Intrinsics = [
@@ -89,6 +90,7 @@ function build() {
     armv7Sources = armv7Intrinsics + [
         "armv7/rtlarch.S",
         "armv7/rtlmem.S",
+        "armv7/rtlvec.S",
         "fp2int.c"
     ];
 
@@ -107,7 +109,8 @@ function build() {
 
     x64Sources = [
         "x64/rtlarch.S",
-        "x64/rtlmem.S"
+        "x64/rtlmem.S",
+        "x64/rtlvec.S"
     ];
 
     //
@@ -36,6 +36,19 @@ Module Name:
 // ---------------------------------------------------------------- Definitions
 //
 
+//
+// Define constants used to scan a natural word for a zero byte. The ones
+// constant has 0x01 in every byte, and the highs constant has 0x80 in every
+// byte. A word minus the ones constant borrows into the high bit of each byte
+// that was zero, and masking with the inverted word filters out bytes whose
+// high bit was already set.
+//
+
+#define RTL_WORD_ONES ((UINTN)-1 / 0xFF)
+#define RTL_WORD_HIGHS (RTL_WORD_ONES * 0x80)
+#define RTL_WORD_HAS_ZERO(_Word) \
+    ((((_Word) - RTL_WORD_ONES) & ~(_Word) & RTL_WORD_HIGHS) != 0)
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -184,15 +197,34 @@ Return Value:
 
 {
 
-    ULONG Length;
+    PCSTR Current;
+    PUINTN Word;
 
-    Length = 0;
-    while (*String != STRING_TERMINATOR) {
-        Length += 1;
-        String += 1;
+    //
+    // Scan bytes until the pointer is word aligned, then scan a word at a
+    // time. Aligned reads never cross into a page the string doesn't touch.
+    //
+
+    Current = String;
+    while (((UINTN)Current & (sizeof(UINTN) - 1)) != 0) {
+        if (*Current == STRING_TERMINATOR) {
+            return Current - String;
+        }
+
+        Current += 1;
+    }
+
+    Word = (PUINTN)Current;
+    while (RTL_WORD_HAS_ZERO(*Word) == FALSE) {
+        Word += 1;
+    }
+
+    Current = (PCSTR)Word;
+    while (*Current != STRING_TERMINATOR) {
+        Current += 1;
     }
 
-    return Length;
+    return Current - String;
 }
 
 RTL_API
@@ -45,10 +45,131 @@ Module Name:
 
 #define LOCAL_TIME_TO_SYSTEM_TIME_RETRY_MAX 4
 
+//
+// Define the number of years on either side of the requested year that a new
+// transition table covers, and the number of years a table can span before
+// it is rebuilt around the requested year rather than extended.
+//
+
+#define TIME_ZONE_TRANSITION_YEAR_MARGIN 1
+#define TIME_ZONE_TRANSITION_YEAR_SPAN_MAX 128
+
+//
+// Define the number of UTC offsets through which a rule time is viewed that
+// come from the zone entry itself rather than from its rules: UTC, standard
+// time, and the entry's fixed save.
+//
+
+#define TIME_ZONE_ENTRY_OFFSET_COUNT 3
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
 
+/*++
+
+Structure Description:
+
+    This structure stores a single time zone transition: the instant at which
+    the local time zone offset changes and the state that takes effect then.
+
+Members:
+
+    Instant - Stores the system time second at which this transition occurs.
+
+    GmtOffset - Stores the offset from GMT in seconds starting at this
+        transition, including any daylight saving.
+
+    IsDaylightSaving - Stores whether or not daylight saving time is in effect
+        starting at this transition.
+
+    TimeZone - Stores a pointer to the cached time zone name that applies
+        starting at this transition.
+
+--*/
+
+typedef struct _TIME_ZONE_TRANSITION {
+    LONGLONG Instant;
+    LONG GmtOffset;
+    LONG IsDaylightSaving;
+    PCSTR TimeZone;
+} TIME_ZONE_TRANSITION, *PTIME_ZONE_TRANSITION;
+
+/*++
+
+Structure Description:
+
+    This structure stores the transitions of the current time zone over a
+    range of years, sorted by instant. Once published a table is never
+    modified, so it can be searched without the time zone lock.
+
+Members:
+
+    Next - Stores a pointer to the next retired table awaiting destruction.
+
+    Generation - Stores the time zone data generation this table was built
+        from.
+
+    FirstYear - Stores the first year covered by the table.
+
+    LastYear - Stores the last year (inclusive) covered by the table.
+
+    Start - Stores the first system time second covered by the table. The
+        first transition is always at this instant.
+
+    End - Stores the system time second immediately after the table.
+
+    Count - Stores the number of valid transitions in the array.
+
+    Capacity - Stores the number of transitions the array has room for.
+
+    Transitions - Stores the array of transitions.
+
+--*/
+
+typedef struct _TIME_ZONE_TRANSITION_TABLE {
+    struct _TIME_ZONE_TRANSITION_TABLE *Next;
+    ULONG Generation;
+    LONG FirstYear;
+    LONG LastYear;
+    LONGLONG Start;
+    LONGLONG End;
+    ULONG Count;
+    ULONG Capacity;
+    TIME_ZONE_TRANSITION Transitions[ANYSIZE_ARRAY];
+} TIME_ZONE_TRANSITION_TABLE, *PTIME_ZONE_TRANSITION_TABLE;
+
+/*++
+
+Structure Description:
+
+    This structure stores a sorted array of instants at which the time zone
+    rules may produce a different outcome.
+
+Members:
+
+    Instants - Stores the sorted array of candidate instants.
+
+    Count - Stores the number of valid candidates.
+
+    Capacity - Stores the number of candidates the array has room for.
+
+    Start - Stores the first instant of interest. Earlier candidates are
+        dropped.
+
+    End - Stores the instant after the last instant of interest. Candidates
+        at or after this are dropped.
+
+--*/
+
+typedef struct _TIME_ZONE_CANDIDATES {
+    PLONGLONG Instants;
+    ULONG Count;
+    ULONG Capacity;
+    LONGLONG Start;
+    LONGLONG End;
+} TIME_ZONE_CANDIDATES, *PTIME_ZONE_CANDIDATES;
+
 //
 // ----------------------------------------------- Internal Function Prototypes
 //
@@ -148,6 +269,61 @@ RtlpTimeZoneCacheString (
     PCSTR String
     );
 
+KSTATUS
+RtlpComputeLocalCalendarTime (
+    PSYSTEM_TIME SystemTime,
+    PCALENDAR_TIME CalendarTime
+    );
+
+KSTATUS
+RtlpComputeOccasionMonthDay (
+    LONG Year,
+    LONG Month,
+    PTIME_ZONE_OCCASION Occasion,
+    PLONG MonthDay
+    );
+
+BOOL
+RtlpLookupTimeZoneTransition (
+    LONGLONG Seconds,
+    PTIME_ZONE_TRANSITION_CACHE Span
+    );
+
+VOID
+RtlpExtendTimeZoneTransitions (
+    LONG Year
+    );
+
+KSTATUS
+RtlpBuildTimeZoneTransitions (
+    LONG FirstYear,
+    LONG LastYear,
+    PTIME_ZONE_TRANSITION_TABLE *NewTable
+    );
+
+KSTATUS
+RtlpAddTimeZoneTransitions (
+    PTIME_ZONE_HEADER Header,
+    PTIME_ZONE_TRANSITION_TABLE *Table,
+    LONG Year
+    );
+
+KSTATUS
+RtlpAddTimeZoneCandidate (
+    PTIME_ZONE_CANDIDATES Candidates,
+    LONGLONG Instant
+    );
+
+VOID
+RtlpReplaceTimeZoneTransitions (
+    PTIME_ZONE_TRANSITION_TABLE NewTable
+    );
+
+VOID
+RtlpInvalidateTimeZoneTransitions (
+    VOID
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -248,6 +424,17 @@ LONG RtlDaylightTimeZoneOffset;
 PSTR *RtlTimeZoneNameCache;
 ULONG RtlTimeZoneNameCacheSize;
 
+//
+// Store the transition table for the current time zone, the list of replaced
+// tables that may still be in use by lock-free readers, the number of such
+// readers, and the generation number of the current time zone selection.
+//
+
+PTIME_ZONE_TRANSITION_TABLE volatile RtlTimeZoneTransitions;
+PTIME_ZONE_TRANSITION_TABLE RtlRetiredTimeZoneTransitions;
+volatile ULONG RtlTimeZoneTransitionReaders;
+volatile ULONG RtlTimeZoneGeneration;
+
 //
 // ------------------------------------------------------------------ Functions
 //
@@ -799,6 +986,7 @@ Return Value:
 
     } else {
         RtlpSetTimeZoneNames();
+        RtlpInvalidateTimeZoneTransitions();
     }
 
 SetTimeZoneDataEnd:
@@ -1108,363 +1296,140 @@ Return Value:
 
 {
 
-    PTIME_ZONE_RULE CurrentRules[2];
-    LONG DaysInMonth;
-    PTIME_ZONE_RULE EffectiveRule;
-    ULONG EntryIndex;
-    PCSTR Format;
-    CALENDAR_TIME GmtTime;
-    PTIME_ZONE_HEADER Header;
-    LONG Leap;
-    LONG LocalStandardTime;
-    PTIME_ZONE_OCCASION Occasion;
-    BOOL RuleApplies;
-    LONG RuleMonthDay;
-    KSTATUS Status;
-    LONG Time;
-    LONG Weekday;
-    PTIME_ZONE Zone;
-    PTIME_ZONE_ENTRY ZoneEntries;
-    CHAR ZoneNameBuffer[TIME_ZONE_NAME_MAX];
+    return RtlSystemTimeToLocalCalendarTimeCached(SystemTime,
+                                                  CalendarTime,
+                                                  NULL);
+}
 
-    EffectiveRule = NULL;
-    Format = NULL;
-    Status = RtlSystemTimeToGmtCalendarTime(SystemTime, CalendarTime);
-    if (!KSUCCESS(Status)) {
-        return Status;
-    }
+RTL_API
+KSTATUS
+RtlSystemTimeToLocalCalendarTimeCached (
+    PSYSTEM_TIME SystemTime,
+    PCALENDAR_TIME CalendarTime,
+    PTIME_ZONE_TRANSITION_CACHE Cache
+    )
 
-    RtlCopyMemory(&GmtTime, CalendarTime, sizeof(CALENDAR_TIME));
-    RtlAcquireTimeZoneLock();
-    Header = RtlTimeZoneData;
-    if (Header == NULL) {
-        goto SystemTimeToLocalCalendarTimeEnd;
-    }
+/*++
 
-    //
-    // Get a pointer to the current time zone and the beginning of its zone
-    // entries.
-    //
+Routine Description:
 
-    Zone = (PVOID)Header + Header->ZoneOffset;
-    Zone += RtlTimeZoneIndex;
-    ZoneEntries = (PVOID)Header + Header->ZoneEntryOffset;
-    ZoneEntries += Zone->EntryIndex;
+    This routine converts the given system time into calendar time in the
+    current local time zone, consulting and updating the given transition
+    cache along the way.
 
-    //
-    // Find the current zone entry.
-    //
+Arguments:
 
-    for (EntryIndex = 0; EntryIndex < Zone->EntryCount; EntryIndex += 1) {
-        if (ZoneEntries[EntryIndex].Until > SystemTime->Seconds) {
-            break;
-        }
-    }
+    SystemTime - Supplies a pointer to the system time to convert.
 
-    if (EntryIndex == Zone->EntryCount) {
-        if (Zone->EntryCount == 0) {
-            Status = STATUS_FILE_CORRUPT;
-            goto SystemTimeToLocalCalendarTimeEnd;
-        }
+    CalendarTime - Supplies a pointer to the calendar time to initialize based
+        on the given system time.
 
-        EntryIndex = Zone->EntryCount - 1;
-    }
+    Cache - Supplies an optional pointer to the caller's transition cache. The
+        caller is responsible for ensuring that the cache is not used by more
+        than one thread at a time.
 
-    Format = RtlpTimeZoneGetString(Header, ZoneEntries[EntryIndex].Format);
+Return Value:
 
-    //
-    // Compute the local time with the GMT offset for the current zone entry.
-    //
+    STATUS_SUCCESS on success.
 
-    CalendarTime->GmtOffset = ZoneEntries[EntryIndex].GmtOffset +
-                              ZoneEntries[EntryIndex].Save;
+    STATUS_OUT_OF_BOUNDS if the given system time is too funky.
 
-    CalendarTime->Second += CalendarTime->GmtOffset;
-    RtlpNormalizeCalendarTime(CalendarTime);
-    CalendarTime->IsDaylightSaving = FALSE;
-    if (ZoneEntries[EntryIndex].Save != 0) {
-        CalendarTime->IsDaylightSaving = TRUE;
-    }
+--*/
 
-    //
-    // If this timezone has no daylight saving rules, there's no need to go
-    // digging through rules.
-    //
+{
 
-    if (ZoneEntries[EntryIndex].Rules == -1) {
-        RtlpTimeZonePerformSubstitution(ZoneNameBuffer,
-                                        sizeof(ZoneNameBuffer),
-                                        Format,
-                                        NULL);
+    BOOL Found;
+    LONGLONG Seconds;
+    PTIME_ZONE_TRANSITION_CACHE Span;
+    TIME_ZONE_TRANSITION_CACHE SpanBuffer;
+    KSTATUS Status;
 
-        CalendarTime->TimeZone = RtlpTimeZoneCacheString(ZoneNameBuffer);
-        Status = STATUS_SUCCESS;
-        goto SystemTimeToLocalCalendarTimeEnd;
+    Status = RtlSystemTimeToGmtCalendarTime(SystemTime, CalendarTime);
+    if (!KSUCCESS(Status)) {
+        return Status;
     }
 
     //
-    // Figure out the two rules (or at least one) that apply here.
+    // The common case is a time near the last one this caller converted, in
+    // which case nothing shared needs to be touched except the generation.
     //
 
-    RtlpFindTimeZoneRules(Header,
-                          ZoneEntries,
-                          EntryIndex,
-                          CalendarTime->Year,
-                          CalendarTime->Month,
-                          CurrentRules);
+    Seconds = SystemTime->Seconds;
+    if ((Cache != NULL) &&
+        (Cache->Generation == RtlTimeZoneGeneration) &&
+        (Seconds >= Cache->Start) &&
+        (Seconds < Cache->End)) {
 
-    LocalStandardTime = (CalendarTime->Hour * SECONDS_PER_HOUR) +
-                        (CalendarTime->Minute * SECONDS_PER_MINUTE) +
-                        CalendarTime->Second;
+        Span = Cache;
+        goto SystemTimeToLocalCalendarTimeCachedEnd;
+    }
 
     //
-    // Apply the previous rule if there is one.
+    // Search the transition table without the lock. If the table does not
+    // cover this year yet, extend it under the lock and search again. If it
+    // still cannot be covered, evaluate the rules directly.
     //
 
-    if (CurrentRules[1] != NULL) {
-        EffectiveRule = CurrentRules[1];
-        if (CurrentRules[1]->Save != 0) {
-            CalendarTime->Second += CurrentRules[1]->Save;
-            RtlpNormalizeCalendarTime(CalendarTime);
+    Span = &SpanBuffer;
+    Found = RtlpLookupTimeZoneTransition(Seconds, Span);
+    if (Found == FALSE) {
+        RtlAcquireTimeZoneLock();
+        RtlpExtendTimeZoneTransitions(CalendarTime->Year);
+        Found = RtlpLookupTimeZoneTransition(Seconds, Span);
+        if (Found == FALSE) {
+            Status = RtlpComputeLocalCalendarTime(SystemTime, CalendarTime);
+            RtlReleaseTimeZoneLock();
+            return Status;
         }
+
+        RtlReleaseTimeZoneLock();
     }
 
-    //
-    // If there is no first rule to test, this is done.
-    //
+    if (Cache != NULL) {
+        RtlCopyMemory(Cache, Span, sizeof(TIME_ZONE_TRANSITION_CACHE));
+    }
 
-    if (CurrentRules[0] == NULL) {
+SystemTimeToLocalCalendarTimeCachedEnd:
+    CalendarTime->GmtOffset = Span->GmtOffset;
+    CalendarTime->Second += Span->GmtOffset;
+    RtlpNormalizeCalendarTime(CalendarTime);
+    CalendarTime->IsDaylightSaving = Span->IsDaylightSaving;
+    CalendarTime->TimeZone = Span->TimeZone;
+    return STATUS_SUCCESS;
+}
 
-        ASSERT(CurrentRules[1] == NULL);
+RTL_API
+KSTATUS
+RtlLocalCalendarTimeToSystemTime (
+    PCALENDAR_TIME CalendarTime,
+    PSYSTEM_TIME SystemTime
+    )
 
-        Status = STATUS_SUCCESS;
-        goto SystemTimeToLocalCalendarTimeEnd;
-    }
+/*++
 
-    //
-    // Figure out if the first rule applies, and apply it if so.
-    //
+Routine Description:
 
-    RuleApplies = FALSE;
-    RuleMonthDay = 31;
-    Occasion = &(CurrentRules[0]->On);
+    This routine converts the given calendar time, assumed to be a local date
+    and time, into its corresponding system time. On success, this routine will
+    update the supplied calendar time to fill out all fields. The GMT offset
+    of the supplied calendar time will be ignored in favor or the local time
+    zone's GMT offset.
 
-    //
-    // If the current rule is not this month, the rule definitely applies,
-    // either as a previous month of this year, or a month in last year.
-    //
+Arguments:
 
-    if (CurrentRules[0]->Month != CalendarTime->Month) {
-        RuleApplies = TRUE;
+    CalendarTime - Supplies a pointer to the local calendar time to convert.
 
-    //
-    // Calculating the day of the month this rule applies on is easy if it's
-    // spelled out.
-    //
+    SystemTime - Supplies a pointer where the system time will be returned.
 
-    } else if (Occasion->Type == TimeZoneOccasionMonthDate) {
-        RuleMonthDay = CurrentRules[0]->On.MonthDay;
+Return Value:
 
-    //
-    // The day of the month this rule applies on depends on the day of the
-    // week. Start by calculating the day of the week for the first of the
-    // month.
-    //
+    STATUS_SUCCESS on success.
 
-    } else {
-        Status = RtlpCalculateWeekdayForMonth(CalendarTime->Year,
-                                              CalendarTime->Month,
-                                              &Weekday);
+    STATUS_OUT_OF_BOUNDS if the given local calendar time is too funky.
 
-        if (!KSUCCESS(Status)) {
-            goto SystemTimeToLocalCalendarTimeEnd;
-        }
+--*/
 
-        Leap = 0;
-        if (IS_LEAP_YEAR(CalendarTime->Year)) {
-            Leap = 1;
-        }
-
-        DaysInMonth = RtlDaysPerMonth[Leap][CalendarTime->Month];
-        RuleMonthDay = 1;
-
-        //
-        // Make the day of the month line up with the first instance of the
-        // weekday in the rule.
-        //
-
-        if (Occasion->Weekday >= Weekday) {
-            RuleMonthDay += Occasion->Weekday - Weekday;
-
-        } else {
-            RuleMonthDay += DAYS_PER_WEEK - (Weekday - Occasion->Weekday);
-        }
-
-        switch (Occasion->Type) {
-
-        //
-        // Add a week as many times as possible.
-        //
-
-        case TimeZoneOccasionLastWeekday:
-            while (RuleMonthDay + DAYS_PER_WEEK <= DaysInMonth) {
-                RuleMonthDay += DAYS_PER_WEEK;
-            }
-
-            break;
-
-        //
-        // Add a week as long as it's less than the required minimum month day.
-        // If that pushes it over the month, then the occasion doesn't exist.
-        //
-
-        case TimeZoneOccasionGreaterOrEqualWeekday:
-            while (RuleMonthDay < Occasion->MonthDay) {
-                RuleMonthDay += DAYS_PER_WEEK;
-            }
-
-            if (RuleMonthDay > DaysInMonth) {
-                RuleMonthDay = 31;
-            }
-
-            break;
-
-        //
-        // If the first instance of that weekday is already too far, then the
-        // occasion doesn't exist. Otherwise, keep adding weeks as long as it's
-        // still under the limit.
-        //
-
-        case TimeZoneOccasionLessOrEqualWeekday:
-            if (RuleMonthDay > Occasion->MonthDay) {
-                RuleMonthDay = 31;
-
-            } else {
-                while (RuleMonthDay + DAYS_PER_WEEK <
-                       Occasion->MonthDay) {
-
-                    RuleMonthDay += DAYS_PER_WEEK;
-                }
-            }
-
-            break;
-
-        default:
-
-            ASSERT(FALSE);
-
-            Status = STATUS_FILE_CORRUPT;
-            goto SystemTimeToLocalCalendarTimeEnd;
-        }
-    }
-
-    //
-    // If the day of the month is after the rule occasion, the rule definitely
-    // applies. If the day of the month is equal to the day the rule applies,
-    // check the time of day.
-    //
-
-    if (RuleApplies == FALSE) {
-        if (CalendarTime->Day > RuleMonthDay) {
-            RuleApplies = TRUE;
-
-        } else if (CalendarTime->Day == RuleMonthDay) {
-            switch (CurrentRules[0]->AtLens) {
-            case TimeZoneLensLocalTime:
-                Time = (CalendarTime->Hour * SECONDS_PER_HOUR) +
-                       (CalendarTime->Minute * SECONDS_PER_MINUTE) +
-                       CalendarTime->Second;
-
-                break;
-
-            case TimeZoneLensLocalStandardTime:
-                Time = LocalStandardTime;
-                break;
-
-            case TimeZoneLensUtc:
-                Time = (GmtTime.Hour * SECONDS_PER_HOUR) +
-                       (GmtTime.Minute * SECONDS_PER_MINUTE) +
-                       GmtTime.Second;
-
-                break;
-
-            default:
-                Time = SECONDS_PER_DAY;
-                break;
-            }
-
-            if (Time >= CurrentRules[0]->At) {
-                RuleApplies = TRUE;
-            }
-        }
-    }
-
-    //
-    // If after all that this rule applies, apply it and unapply the previous
-    // rule.
-    //
-
-    if (RuleApplies != FALSE) {
-        EffectiveRule = CurrentRules[0];
-        CalendarTime->Second += CurrentRules[0]->Save;
-        if (CurrentRules[1] != NULL) {
-            CalendarTime->Second -= CurrentRules[1]->Save;
-        }
-
-        RtlpNormalizeCalendarTime(CalendarTime);
-    }
-
-SystemTimeToLocalCalendarTimeEnd:
-    if (EffectiveRule != NULL) {
-        if (EffectiveRule->Save != 0) {
-            CalendarTime->IsDaylightSaving = TRUE;
-        }
-
-        CalendarTime->GmtOffset += EffectiveRule->Save;
-        RtlpTimeZonePerformSubstitution(ZoneNameBuffer,
-                                        sizeof(ZoneNameBuffer),
-                                        Format,
-                                        EffectiveRule);
-
-        CalendarTime->TimeZone = RtlpTimeZoneCacheString(ZoneNameBuffer);
-    }
-
-    RtlReleaseTimeZoneLock();
-    return Status;
-}
-
-RTL_API
-KSTATUS
-RtlLocalCalendarTimeToSystemTime (
-    PCALENDAR_TIME CalendarTime,
-    PSYSTEM_TIME SystemTime
-    )
-
-/*++
-
-Routine Description:
-
-    This routine converts the given calendar time, assumed to be a local date
-    and time, into its corresponding system time. On success, this routine will
-    update the supplied calendar time to fill out all fields. The GMT offset
-    of the supplied calendar time will be ignored in favor or the local time
-    zone's GMT offset.
-
-Arguments:
-
-    CalendarTime - Supplies a pointer to the local calendar time to convert.
-
-    SystemTime - Supplies a pointer where the system time will be returned.
-
-Return Value:
-
-    STATUS_SUCCESS on success.
-
-    STATUS_OUT_OF_BOUNDS if the given local calendar time is too funky.
-
---*/
-
-{
+{
 
     PTIME_ZONE_RULE CurrentRules[2];
     LONG Delta;
@@ -2530,6 +2495,7 @@ Return Value:
     }
 
     RtlpSetTimeZoneNames();
+    RtlpInvalidateTimeZoneTransitions();
     Status = STATUS_SUCCESS;
 
 SelectTimeZoneEnd:
@@ -2966,8 +2932,9 @@ RtlpTimeZonePerformSubstitution (
 Routine Description:
 
     This routine writes the given time zone format and letters into the
-    destination buffer. It's like a super limited version of printf. This
-    routine assumes the time zone lock is already held and that the given rule
+    destination buffer. It's like a super limited version of printf. The
+    result is always null terminated, truncated if necessary. This routine
+    assumes the time zone lock is already held and that the given rule
     is from the current time zone data.
 
 Arguments:
@@ -3039,6 +3006,15 @@ Return Value:
         }
     }
 
+    //
+    // Truncate names that do not fit. The result is cached and compared by
+    // pointer, so it must always be terminated.
+    //
+
+    if (RemainingSize == 0) {
+        Destination[DestinationSize - 1] = '\0';
+    }
+
     return;
 }
 
@@ -3131,3 +3107,1207 @@ Return Value:
     return NewString;
 }
 
+KSTATUS
+RtlpComputeLocalCalendarTime (
+    PSYSTEM_TIME SystemTime,
+    PCALENDAR_TIME CalendarTime
+    )
+
+/*++
+
+Routine Description:
+
+    This routine converts the given system time into calendar time in the
+    current local time zone by evaluating the time zone rules directly. This
+    routine assumes the time zone lock is already held.
+
+Arguments:
+
+    SystemTime - Supplies a pointer to the system time to convert.
+
+    CalendarTime - Supplies a pointer to the calendar time to initialize based
+        on the given system time.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_OUT_OF_BOUNDS if the given system time is too funky.
+
+--*/
+
+{
+
+    PTIME_ZONE_RULE CurrentRules[2];
+    PTIME_ZONE_RULE EffectiveRule;
+    ULONG EntryIndex;
+    PCSTR Format;
+    CALENDAR_TIME GmtTime;
+    PTIME_ZONE_HEADER Header;
+    LONG LocalStandardTime;
+    BOOL RuleApplies;
+    LONG RuleMonthDay;
+    KSTATUS Status;
+    LONG Time;
+    PTIME_ZONE Zone;
+    PTIME_ZONE_ENTRY ZoneEntries;
+    CHAR ZoneNameBuffer[TIME_ZONE_NAME_MAX];
+
+    EffectiveRule = NULL;
+    Format = NULL;
+    Status = RtlSystemTimeToGmtCalendarTime(SystemTime, CalendarTime);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    RtlCopyMemory(&GmtTime, CalendarTime, sizeof(CALENDAR_TIME));
+    Header = RtlTimeZoneData;
+    if (Header == NULL) {
+        goto ComputeLocalCalendarTimeEnd;
+    }
+
+    //
+    // Get a pointer to the current time zone and the beginning of its zone
+    // entries.
+    //
+
+    Zone = (PVOID)Header + Header->ZoneOffset;
+    Zone += RtlTimeZoneIndex;
+    ZoneEntries = (PVOID)Header + Header->ZoneEntryOffset;
+    ZoneEntries += Zone->EntryIndex;
+
+    //
+    // Find the current zone entry.
+    //
+
+    for (EntryIndex = 0; EntryIndex < Zone->EntryCount; EntryIndex += 1) {
+        if (ZoneEntries[EntryIndex].Until > SystemTime->Seconds) {
+            break;
+        }
+    }
+
+    if (EntryIndex == Zone->EntryCount) {
+        if (Zone->EntryCount == 0) {
+            Status = STATUS_FILE_CORRUPT;
+            goto ComputeLocalCalendarTimeEnd;
+        }
+
+        EntryIndex = Zone->EntryCount - 1;
+    }
+
+    Format = RtlpTimeZoneGetString(Header, ZoneEntries[EntryIndex].Format);
+
+    //
+    // Compute the local time with the GMT offset for the current zone entry.
+    //
+
+    CalendarTime->GmtOffset = ZoneEntries[EntryIndex].GmtOffset +
+                              ZoneEntries[EntryIndex].Save;
+
+    CalendarTime->Second += CalendarTime->GmtOffset;
+    RtlpNormalizeCalendarTime(CalendarTime);
+    CalendarTime->IsDaylightSaving = FALSE;
+    if (ZoneEntries[EntryIndex].Save != 0) {
+        CalendarTime->IsDaylightSaving = TRUE;
+    }
+
+    //
+    // If this timezone has no daylight saving rules, there's no need to go
+    // digging through rules.
+    //
+
+    if (ZoneEntries[EntryIndex].Rules == -1) {
+        RtlpTimeZonePerformSubstitution(ZoneNameBuffer,
+                                        sizeof(ZoneNameBuffer),
+                                        Format,
+                                        NULL);
+
+        CalendarTime->TimeZone = RtlpTimeZoneCacheString(ZoneNameBuffer);
+        Status = STATUS_SUCCESS;
+        goto ComputeLocalCalendarTimeEnd;
+    }
+
+    //
+    // Figure out the two rules (or at least one) that apply here.
+    //
+
+    RtlpFindTimeZoneRules(Header,
+                          ZoneEntries,
+                          EntryIndex,
+                          CalendarTime->Year,
+                          CalendarTime->Month,
+                          CurrentRules);
+
+    LocalStandardTime = (CalendarTime->Hour * SECONDS_PER_HOUR) +
+                        (CalendarTime->Minute * SECONDS_PER_MINUTE) +
+                        CalendarTime->Second;
+
+    //
+    // Apply the previous rule if there is one.
+    //
+
+    if (CurrentRules[1] != NULL) {
+        EffectiveRule = CurrentRules[1];
+        if (CurrentRules[1]->Save != 0) {
+            CalendarTime->Second += CurrentRules[1]->Save;
+            RtlpNormalizeCalendarTime(CalendarTime);
+        }
+    }
+
+    //
+    // If there is no first rule to test, this is done.
+    //
+
+    if (CurrentRules[0] == NULL) {
+
+        ASSERT(CurrentRules[1] == NULL);
+
+        Status = STATUS_SUCCESS;
+        goto ComputeLocalCalendarTimeEnd;
+    }
+
+    //
+    // Figure out if the first rule applies, and apply it if so. If the
+    // current rule is not this month, the rule definitely applies, either as
+    // a previous month of this year, or a month in last year.
+    //
+
+    RuleApplies = FALSE;
+    RuleMonthDay = 31;
+    if (CurrentRules[0]->Month != CalendarTime->Month) {
+        RuleApplies = TRUE;
+
+    } else {
+        Status = RtlpComputeOccasionMonthDay(CalendarTime->Year,
+                                             CalendarTime->Month,
+                                             &(CurrentRules[0]->On),
+                                             &RuleMonthDay);
+
+        if (!KSUCCESS(Status)) {
+            goto ComputeLocalCalendarTimeEnd;
+        }
+    }
+
+    //
+    // If the day of the month is after the rule occasion, the rule definitely
+    // applies. If the day of the month is equal to the day the rule applies,
+    // check the time of day.
+    //
+
+    if (RuleApplies == FALSE) {
+        if (CalendarTime->Day > RuleMonthDay) {
+            RuleApplies = TRUE;
+
+        } else if (CalendarTime->Day == RuleMonthDay) {
+            switch (CurrentRules[0]->AtLens) {
+            case TimeZoneLensLocalTime:
+                Time = (CalendarTime->Hour * SECONDS_PER_HOUR) +
+                       (CalendarTime->Minute * SECONDS_PER_MINUTE) +
+                       CalendarTime->Second;
+
+                break;
+
+            case TimeZoneLensLocalStandardTime:
+                Time = LocalStandardTime;
+                break;
+
+            case TimeZoneLensUtc:
+                Time = (GmtTime.Hour * SECONDS_PER_HOUR) +
+                       (GmtTime.Minute * SECONDS_PER_MINUTE) +
+                       GmtTime.Second;
+
+                break;
+
+            default:
+                Time = SECONDS_PER_DAY;
+                break;
+            }
+
+            if (Time >= CurrentRules[0]->At) {
+                RuleApplies = TRUE;
+            }
+        }
+    }
+
+    //
+    // If after all that this rule applies, apply it and unapply the previous
+    // rule.
+    //
+
+    if (RuleApplies != FALSE) {
+        EffectiveRule = CurrentRules[0];
+        CalendarTime->Second += CurrentRules[0]->Save;
+        if (CurrentRules[1] != NULL) {
+            CalendarTime->Second -= CurrentRules[1]->Save;
+        }
+
+        RtlpNormalizeCalendarTime(CalendarTime);
+    }
+
+ComputeLocalCalendarTimeEnd:
+    if (EffectiveRule != NULL) {
+        if (EffectiveRule->Save != 0) {
+            CalendarTime->IsDaylightSaving = TRUE;
+        }
+
+        CalendarTime->GmtOffset += EffectiveRule->Save;
+        RtlpTimeZonePerformSubstitution(ZoneNameBuffer,
+                                        sizeof(ZoneNameBuffer),
+                                        Format,
+                                        EffectiveRule);
+
+        CalendarTime->TimeZone = RtlpTimeZoneCacheString(ZoneNameBuffer);
+    }
+
+    return Status;
+}
+
+KSTATUS
+RtlpComputeOccasionMonthDay (
+    LONG Year,
+    LONG Month,
+    PTIME_ZONE_OCCASION Occasion,
+    PLONG MonthDay
+    )
+
+/*++
+
+Routine Description:
+
+    This routine determines the day of the month on which the given rule
+    occasion falls.
+
+Arguments:
+
+    Year - Supplies the year to evaluate the occasion in.
+
+    Month - Supplies the month to evaluate the occasion in.
+
+    Occasion - Supplies a pointer to the occasion.
+
+    MonthDay - Supplies a pointer where the day of the month (starting at 1)
+        will be returned. If the occasion does not occur in the given month,
+        31 is returned.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_OUT_OF_BOUNDS if the year is out of range.
+
+    STATUS_FILE_CORRUPT if the occasion type is invalid.
+
+--*/
+
+{
+
+    LONG DaysInMonth;
+    LONG Leap;
+    LONG RuleMonthDay;
+    KSTATUS Status;
+    LONG Weekday;
+
+    //
+    // Calculating the day of the month this rule applies on is easy if it's
+    // spelled out.
+    //
+
+    if (Occasion->Type == TimeZoneOccasionMonthDate) {
+        *MonthDay = Occasion->MonthDay;
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // The day of the month this rule applies on depends on the day of the
+    // week. Start by calculating the day of the week for the first of the
+    // month.
+    //
+
+    Status = RtlpCalculateWeekdayForMonth(Year, Month, &Weekday);
+    if (!KSUCCESS(Status)) {
+        return Status;
+    }
+
+    Leap = 0;
+    if (IS_LEAP_YEAR(Year)) {
+        Leap = 1;
+    }
+
+    DaysInMonth = RtlDaysPerMonth[Leap][Month];
+    RuleMonthDay = 1;
+
+    //
+    // Make the day of the month line up with the first instance of the
+    // weekday in the rule.
+    //
+
+    if (Occasion->Weekday >= Weekday) {
+        RuleMonthDay += Occasion->Weekday - Weekday;
+
+    } else {
+        RuleMonthDay += DAYS_PER_WEEK - (Weekday - Occasion->Weekday);
+    }
+
+    switch (Occasion->Type) {
+
+    //
+    // Add a week as many times as possible.
+    //
+
+    case TimeZoneOccasionLastWeekday:
+        while (RuleMonthDay + DAYS_PER_WEEK <= DaysInMonth) {
+            RuleMonthDay += DAYS_PER_WEEK;
+        }
+
+        break;
+
+    //
+    // Add a week as long as it's less than the required minimum month day.
+    // If that pushes it over the month, then the occasion doesn't exist.
+    //
+
+    case TimeZoneOccasionGreaterOrEqualWeekday:
+        while (RuleMonthDay < Occasion->MonthDay) {
+            RuleMonthDay += DAYS_PER_WEEK;
+        }
+
+        if (RuleMonthDay > DaysInMonth) {
+            RuleMonthDay = 31;
+        }
+
+        break;
+
+    //
+    // If the first instance of that weekday is already too far, then the
+    // occasion doesn't exist. Otherwise, keep adding weeks as long as it's
+    // still under the limit.
+    //
+
+    case TimeZoneOccasionLessOrEqualWeekday:
+        if (RuleMonthDay > Occasion->MonthDay) {
+            RuleMonthDay = 31;
+
+        } else {
+            while (RuleMonthDay + DAYS_PER_WEEK < Occasion->MonthDay) {
+                RuleMonthDay += DAYS_PER_WEEK;
+            }
+        }
+
+        break;
+
+    default:
+
+        ASSERT(FALSE);
+
+        return STATUS_FILE_CORRUPT;
+    }
+
+    *MonthDay = RuleMonthDay;
+    return STATUS_SUCCESS;
+}
+
+BOOL
+RtlpLookupTimeZoneTransition (
+    LONGLONG Seconds,
+    PTIME_ZONE_TRANSITION_CACHE Span
+    )
+
+/*++
+
+Routine Description:
+
+    This routine searches the current transition table for the span of time
+    containing the given instant. This routine does not need the time zone
+    lock.
+
+Arguments:
+
+    Seconds - Supplies the system time seconds to look up.
+
+    Span - Supplies a pointer where the span containing the given time will be
+        returned on success.
+
+Return Value:
+
+    TRUE if the table covers the given time and the span was returned.
+
+    FALSE if there is no table or it does not cover the given time.
+
+--*/
+
+{
+
+    BOOL Found;
+    ULONG High;
+    ULONG Low;
+    ULONG Middle;
+    PTIME_ZONE_TRANSITION_TABLE Table;
+    PTIME_ZONE_TRANSITION Transition;
+
+    Found = FALSE;
+
+    //
+    // Announce the reader before loading the table pointer so that a writer
+    // replacing the table knows not to free it out from underneath.
+    //
+
+    RtlAtomicAdd32(&RtlTimeZoneTransitionReaders, 1);
+    Table = RtlTimeZoneTransitions;
+    if ((Table != NULL) && (Seconds >= Table->Start) && (Seconds < Table->End)) {
+
+        ASSERT((Table->Count != 0) &&
+               (Table->Transitions[0].Instant == Table->Start));
+
+        //
+        // Find the last transition at or before the given time.
+        //
+
+        Low = 0;
+        High = Table->Count;
+        while (High - Low > 1) {
+            Middle = Low + ((High - Low) / 2);
+            if (Table->Transitions[Middle].Instant <= Seconds) {
+                Low = Middle;
+
+            } else {
+                High = Middle;
+            }
+        }
+
+        Transition = &(Table->Transitions[Low]);
+        Span->Generation = Table->Generation;
+        Span->Start = Transition->Instant;
+        if (Low + 1 < Table->Count) {
+            Span->End = Table->Transitions[Low + 1].Instant;
+
+        } else {
+            Span->End = Table->End;
+        }
+
+        Span->GmtOffset = Transition->GmtOffset;
+        Span->IsDaylightSaving = Transition->IsDaylightSaving;
+        Span->TimeZone = Transition->TimeZone;
+        Found = TRUE;
+    }
+
+    RtlAtomicAdd32(&RtlTimeZoneTransitionReaders, (ULONG)-1);
+    return Found;
+}
+
+VOID
+RtlpExtendTimeZoneTransitions (
+    LONG Year
+    )
+
+/*++
+
+Routine Description:
+
+    This routine builds a new transition table that covers the given year,
+    along with the years covered by the current table if that keeps the table
+    a reasonable size. This routine assumes the time zone lock is already held.
+    Failures are not fatal, as the caller will evaluate the rules directly.
+
+Arguments:
+
+    Year - Supplies the year the new table must cover.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    LONG FirstYear;
+    LONG LastYear;
+    PTIME_ZONE_TRANSITION_TABLE NewTable;
+    KSTATUS Status;
+    PTIME_ZONE_TRANSITION_TABLE Table;
+
+    FirstYear = Year - TIME_ZONE_TRANSITION_YEAR_MARGIN;
+    LastYear = Year + TIME_ZONE_TRANSITION_YEAR_MARGIN;
+    Table = RtlTimeZoneTransitions;
+    if (Table != NULL) {
+
+        //
+        // Another thread may have extended the table while this one waited
+        // for the lock.
+        //
+
+        if ((Year >= Table->FirstYear) && (Year <= Table->LastYear)) {
+            return;
+        }
+
+        //
+        // Extend the current table unless that would make it unreasonably
+        // large, in which case start over around the requested year.
+        //
+
+        if ((Year > Table->LastYear - TIME_ZONE_TRANSITION_YEAR_SPAN_MAX) &&
+            (Year < Table->FirstYear + TIME_ZONE_TRANSITION_YEAR_SPAN_MAX)) {
+
+            if (Table->FirstYear < FirstYear) {
+                FirstYear = Table->FirstYear;
+            }
+
+            if (Table->LastYear > LastYear) {
+                LastYear = Table->LastYear;
+            }
+        }
+    }
+
+    //
+    // Leave the extremes of the calendar to the rules, as local times there
+    // may not be representable.
+    //
+
+    if (FirstYear <= MIN_TIME_ZONE_YEAR) {
+        FirstYear = MIN_TIME_ZONE_YEAR + 1;
+    }
+
+    if (LastYear >= MAX_TIME_ZONE_YEAR) {
+        LastYear = MAX_TIME_ZONE_YEAR - 1;
+    }
+
+    if ((Year < FirstYear) || (Year > LastYear)) {
+        return;
+    }
+
+    Status = RtlpBuildTimeZoneTransitions(FirstYear, LastYear, &NewTable);
+    if (!KSUCCESS(Status)) {
+        return;
+    }
+
+    RtlpReplaceTimeZoneTransitions(NewTable);
+    return;
+}
+
+KSTATUS
+RtlpBuildTimeZoneTransitions (
+    LONG FirstYear,
+    LONG LastYear,
+    PTIME_ZONE_TRANSITION_TABLE *NewTable
+    )
+
+/*++
+
+Routine Description:
+
+    This routine builds a transition table for the current time zone covering
+    the given range of years. This routine assumes the time zone lock is
+    already held.
+
+Arguments:
+
+    FirstYear - Supplies the first year the table should cover.
+
+    LastYear - Supplies the last year (inclusive) the table should cover.
+
+    NewTable - Supplies a pointer where the new table will be returned on
+        success.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+    Other error codes if the rules could not be evaluated.
+
+--*/
+
+{
+
+    UINTN AllocationSize;
+    ULONG Capacity;
+    PTIME_ZONE_HEADER Header;
+    KSTATUS Status;
+    PTIME_ZONE_TRANSITION_TABLE Table;
+    LONG Year;
+
+    *NewTable = NULL;
+
+    //
+    // Most zones have two transitions a year at most.
+    //
+
+    Capacity = ((LastYear - FirstYear + 1) * 2) + 1;
+    AllocationSize = sizeof(TIME_ZONE_TRANSITION_TABLE) +
+                     ((Capacity - ANYSIZE_ARRAY) *
+                      sizeof(TIME_ZONE_TRANSITION));
+
+    Table = RtlTimeZoneReallocate(NULL, AllocationSize);
+    if (Table == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Table, sizeof(TIME_ZONE_TRANSITION_TABLE));
+    Table->Generation = RtlTimeZoneGeneration;
+    Table->Capacity = Capacity;
+
+    //
+    // Without any time zone data, everything is GMT forever.
+    //
+
+    Header = RtlTimeZoneData;
+    if (Header == NULL) {
+        Table->FirstYear = MIN_TIME_ZONE_YEAR;
+        Table->LastYear = MAX_TIME_ZONE_YEAR;
+        Table->Start = MIN_TIME_ZONE_DATE;
+        Table->End = MAX_TIME_ZONE_DATE + 1;
+        Table->Transitions[0].Instant = Table->Start;
+        Table->Count = 1;
+        Status = STATUS_SUCCESS;
+        goto BuildTimeZoneTransitionsEnd;
+    }
+
+    Table->FirstYear = FirstYear;
+    Table->LastYear = LastYear;
+    Table->Start = (LONGLONG)RtlpComputeDaysForYear(FirstYear) *
+                   SECONDS_PER_DAY;
+
+    Table->End = (LONGLONG)RtlpComputeDaysForYear(LastYear + 1) *
+                 SECONDS_PER_DAY;
+
+    for (Year = FirstYear; Year <= LastYear; Year += 1) {
+        Status = RtlpAddTimeZoneTransitions(Header, &Table, Year);
+        if (!KSUCCESS(Status)) {
+            goto BuildTimeZoneTransitionsEnd;
+        }
+    }
+
+    Status = STATUS_SUCCESS;
+
+BuildTimeZoneTransitionsEnd:
+    if (!KSUCCESS(Status)) {
+        RtlTimeZoneReallocate(Table, 0);
+        Table = NULL;
+    }
+
+    *NewTable = Table;
+    return Status;
+}
+
+KSTATUS
+RtlpAddTimeZoneTransitions (
+    PTIME_ZONE_HEADER Header,
+    PTIME_ZONE_TRANSITION_TABLE *Table,
+    LONG Year
+    )
+
+/*++
+
+Routine Description:
+
+    This routine appends the transitions that occur during the given UTC year
+    to a transition table under construction. Rather than reimplement the
+    subtleties of the rule evaluation, this routine computes every instant at
+    which the outcome of the rules could change (zone entry boundaries, rule
+    occasions viewed through each offset that could be in effect, and local
+    month boundaries) and then evaluates the rules at each of those instants.
+    This routine assumes the time zone lock is already held.
+
+Arguments:
+
+    Header - Supplies a pointer to the time zone data header.
+
+    Table - Supplies a pointer to the table under construction, which may be
+        reallocated.
+
+    Year - Supplies the year whose transitions should be added. Years must be
+        added in ascending order.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+    Other error codes if the rules could not be evaluated.
+
+--*/
+
+{
+
+    LONGLONG Base;
+    CALENDAR_TIME CalendarTime;
+    TIME_ZONE_CANDIDATES Candidates;
+    LONG DayBase;
+    LONGLONG EntryEnd;
+    ULONG EntryIndex;
+    LONGLONG EntryStart;
+    ULONG Index;
+    LONG Leap;
+    LONG Month;
+    LONG MonthDay;
+    ULONG OffsetCount;
+    ULONG OffsetIndex;
+    PLONG Offsets;
+    PTIME_ZONE_RULE Rule;
+    ULONG RuleIndex;
+    LONG RuleYear;
+    PTIME_ZONE_RULE Rules;
+    KSTATUS Status;
+    SYSTEM_TIME SystemTime;
+    PTIME_ZONE_TRANSITION Transition;
+    PTIME_ZONE_TRANSITION_TABLE TransitionTable;
+    LONGLONG YearEnd;
+    LONGLONG YearStart;
+    PTIME_ZONE Zone;
+    PTIME_ZONE_ENTRY ZoneEntries;
+    PTIME_ZONE_ENTRY ZoneEntry;
+
+    RtlZeroMemory(&Candidates, sizeof(TIME_ZONE_CANDIDATES));
+
+    //
+    // Every rule could contribute its own offset, so size the offset array
+    // from the rule count rather than risk missing a transition.
+    //
+
+    Offsets = RtlTimeZoneReallocate(
+                 NULL,
+                 (TIME_ZONE_ENTRY_OFFSET_COUNT + Header->RuleCount) *
+                 sizeof(LONG));
+
+    if (Offsets == NULL) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto AddTimeZoneTransitionsEnd;
+    }
+
+    YearStart = (LONGLONG)RtlpComputeDaysForYear(Year) * SECONDS_PER_DAY;
+    YearEnd = (LONGLONG)RtlpComputeDaysForYear(Year + 1) * SECONDS_PER_DAY;
+    Candidates.Start = YearStart;
+    Candidates.End = YearEnd;
+    Status = RtlpAddTimeZoneCandidate(&Candidates, YearStart);
+    if (!KSUCCESS(Status)) {
+        goto AddTimeZoneTransitionsEnd;
+    }
+
+    Zone = (PVOID)Header + Header->ZoneOffset;
+    Zone += RtlTimeZoneIndex;
+    ZoneEntries = (PVOID)Header + Header->ZoneEntryOffset;
+    ZoneEntries += Zone->EntryIndex;
+    Rules = (PVOID)Header + Header->RuleOffset;
+    for (EntryIndex = 0; EntryIndex < Zone->EntryCount; EntryIndex += 1) {
+        ZoneEntry = &(ZoneEntries[EntryIndex]);
+        Status = RtlpAddTimeZoneCandidate(&Candidates, ZoneEntry->Until);
+        if (!KSUCCESS(Status)) {
+            goto AddTimeZoneTransitionsEnd;
+        }
+
+        //
+        // Skip entries that are nowhere near this year. Rules from the
+        // previous year can still influence the current one, so be generous.
+        //
+
+        EntryStart = MIN_TIME_ZONE_DATE;
+        if (EntryIndex != 0) {
+            EntryStart = ZoneEntries[EntryIndex - 1].Until;
+        }
+
+        EntryEnd = ZoneEntry->Until;
+        if (EntryIndex == Zone->EntryCount - 1) {
+            EntryEnd = MAX_TIME_ZONE_DATE;
+        }
+
+        if ((EntryEnd < YearStart - (DAYS_PER_LEAP_YEAR * SECONDS_PER_DAY)) ||
+            (EntryStart > YearEnd + SECONDS_PER_DAY)) {
+
+            continue;
+        }
+
+        //
+        // Collect the offsets from UTC that local times might be viewed
+        // through while this entry is in effect.
+        //
+
+        Offsets[0] = 0;
+        Offsets[1] = ZoneEntry->GmtOffset;
+        Offsets[2] = ZoneEntry->GmtOffset + ZoneEntry->Save;
+        OffsetCount = TIME_ZONE_ENTRY_OFFSET_COUNT;
+        if (ZoneEntry->Rules != -1) {
+            for (RuleIndex = 0; RuleIndex < Header->RuleCount; RuleIndex += 1) {
+                Rule = Rules + RuleIndex;
+                if (Rule->Number != ZoneEntry->Rules) {
+                    continue;
+                }
+
+                for (OffsetIndex = 0;
+                     OffsetIndex < OffsetCount;
+                     OffsetIndex += 1) {
+
+                    if (Offsets[OffsetIndex] ==
+                        ZoneEntry->GmtOffset + Rule->Save) {
+
+                        break;
+                    }
+                }
+
+                if (OffsetIndex == OffsetCount) {
+                    Offsets[OffsetCount] = ZoneEntry->GmtOffset + Rule->Save;
+                    OffsetCount += 1;
+                }
+            }
+        }
+
+        //
+        // The rules consider the local month, so the start of every local
+        // month is a possible transition.
+        //
+
+        Leap = 0;
+        if (IS_LEAP_YEAR(Year)) {
+            Leap = 1;
+        }
+
+        for (Month = 0; Month <= MONTHS_PER_YEAR; Month += 1) {
+            if (Month == MONTHS_PER_YEAR) {
+                Base = YearEnd;
+
+            } else {
+                Base = YearStart +
+                       ((LONGLONG)RtlMonthDays[Leap][Month] * SECONDS_PER_DAY);
+            }
+
+            for (OffsetIndex = 0; OffsetIndex < OffsetCount; OffsetIndex += 1) {
+                Status = RtlpAddTimeZoneCandidate(&Candidates,
+                                                  Base - Offsets[OffsetIndex]);
+
+                if (!KSUCCESS(Status)) {
+                    goto AddTimeZoneTransitionsEnd;
+                }
+            }
+        }
+
+        if (ZoneEntry->Rules == -1) {
+            continue;
+        }
+
+        //
+        // Add the moment each rule takes effect, as well as the local
+        // midnights that bracket the rule's day, since the rule time may be
+        // beyond the end of the day. Rules are evaluated in the surrounding
+        // years even outside their own range of years, as the rule lookup
+        // falls back to the most recent rule and the local year may differ
+        // from the UTC year.
+        //
+
+        for (RuleIndex = 0; RuleIndex < Header->RuleCount; RuleIndex += 1) {
+            Rule = Rules + RuleIndex;
+            if (Rule->Number != ZoneEntry->Rules) {
+                continue;
+            }
+
+            for (RuleYear = Year - 1; RuleYear <= Year + 1; RuleYear += 1) {
+                Status = RtlpComputeOccasionMonthDay(RuleYear,
+                                                     Rule->Month,
+                                                     &(Rule->On),
+                                                     &MonthDay);
+
+                if (!KSUCCESS(Status)) {
+                    goto AddTimeZoneTransitionsEnd;
+                }
+
+                Leap = 0;
+                if (IS_LEAP_YEAR(RuleYear)) {
+                    Leap = 1;
+                }
+
+                if (MonthDay > RtlDaysPerMonth[Leap][(LONG)Rule->Month]) {
+                    continue;
+                }
+
+                DayBase = RtlpComputeDaysForYear(RuleYear) +
+                          RtlMonthDays[Leap][(LONG)Rule->Month] +
+                          MonthDay - 1;
+
+                Base = (LONGLONG)DayBase * SECONDS_PER_DAY;
+                for (OffsetIndex = 0;
+                     OffsetIndex < OffsetCount;
+                     OffsetIndex += 1) {
+
+                    Status = RtlpAddTimeZoneCandidate(
+                                         &Candidates,
+                                         Base + Rule->At - Offsets[OffsetIndex]);
+
+                    if (!KSUCCESS(Status)) {
+                        goto AddTimeZoneTransitionsEnd;
+                    }
+
+                    Status = RtlpAddTimeZoneCandidate(
+                                                 &Candidates,
+                                                 Base - Offsets[OffsetIndex]);
+
+                    if (!KSUCCESS(Status)) {
+                        goto AddTimeZoneTransitionsEnd;
+                    }
+
+                    Status = RtlpAddTimeZoneCandidate(
+                                   &Candidates,
+                                   Base + SECONDS_PER_DAY - Offsets[OffsetIndex]);
+
+                    if (!KSUCCESS(Status)) {
+                        goto AddTimeZoneTransitionsEnd;
+                    }
+                }
+
+                //
+                // A UTC rule time is compared against the UTC time of day
+                // while the local date is on the rule's day, so it can also
+                // take effect on the UTC days on either side.
+                //
+
+                if (Rule->AtLens == TimeZoneLensUtc) {
+                    Status = RtlpAddTimeZoneCandidate(
+                                         &Candidates,
+                                         Base - SECONDS_PER_DAY + Rule->At);
+
+                    if (!KSUCCESS(Status)) {
+                        goto AddTimeZoneTransitionsEnd;
+                    }
+
+                    Status = RtlpAddTimeZoneCandidate(
+                                         &Candidates,
+                                         Base + SECONDS_PER_DAY + Rule->At);
+
+                    if (!KSUCCESS(Status)) {
+                        goto AddTimeZoneTransitionsEnd;
+                    }
+                }
+            }
+        }
+    }
+
+    //
+    // Evaluate the rules at each candidate in order, recording a transition
+    // wherever the outcome differs from the previous one.
+    //
+
+    SystemTime.Nanoseconds = 0;
+    for (Index = 0; Index < Candidates.Count; Index += 1) {
+        if ((Index != 0) &&
+            (Candidates.Instants[Index] == Candidates.Instants[Index - 1])) {
+
+            continue;
+        }
+
+        SystemTime.Seconds = Candidates.Instants[Index];
+        Status = RtlpComputeLocalCalendarTime(&SystemTime, &CalendarTime);
+        if (!KSUCCESS(Status)) {
+            goto AddTimeZoneTransitionsEnd;
+        }
+
+        TransitionTable = *Table;
+        if (TransitionTable->Count != 0) {
+            Transition = &(TransitionTable->Transitions[
+                                                 TransitionTable->Count - 1]);
+
+            if ((Transition->GmtOffset == CalendarTime.GmtOffset) &&
+                (Transition->IsDaylightSaving ==
+                 CalendarTime.IsDaylightSaving) &&
+                (Transition->TimeZone == CalendarTime.TimeZone)) {
+
+                continue;
+            }
+        }
+
+        if (TransitionTable->Count == TransitionTable->Capacity) {
+            TransitionTable = RtlTimeZoneReallocate(
+                            TransitionTable,
+                            sizeof(TIME_ZONE_TRANSITION_TABLE) +
+                            (((TransitionTable->Capacity * 2) - ANYSIZE_ARRAY) *
+                             sizeof(TIME_ZONE_TRANSITION)));
+
+            if (TransitionTable == NULL) {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto AddTimeZoneTransitionsEnd;
+            }
+
+            TransitionTable->Capacity *= 2;
+            *Table = TransitionTable;
+        }
+
+        Transition = &(TransitionTable->Transitions[TransitionTable->Count]);
+        Transition->Instant = SystemTime.Seconds;
+        Transition->GmtOffset = CalendarTime.GmtOffset;
+        Transition->IsDaylightSaving = CalendarTime.IsDaylightSaving;
+        Transition->TimeZone = CalendarTime.TimeZone;
+        TransitionTable->Count += 1;
+    }
+
+    Status = STATUS_SUCCESS;
+
+AddTimeZoneTransitionsEnd:
+    if (Offsets != NULL) {
+        RtlTimeZoneReallocate(Offsets, 0);
+    }
+
+    if (Candidates.Instants != NULL) {
+        RtlTimeZoneReallocate(Candidates.Instants, 0);
+    }
+
+    return Status;
+}
+
+KSTATUS
+RtlpAddTimeZoneCandidate (
+    PTIME_ZONE_CANDIDATES Candidates,
+    LONGLONG Instant
+    )
+
+/*++
+
+Routine Description:
+
+    This routine inserts a candidate transition instant into the sorted array
+    of candidates, if it falls within the range being collected.
+
+Arguments:
+
+    Candidates - Supplies a pointer to the candidate array.
+
+    Instant - Supplies the candidate instant.
+
+Return Value:
+
+    STATUS_SUCCESS on success.
+
+    STATUS_INSUFFICIENT_RESOURCES on allocation failure.
+
+--*/
+
+{
+
+    ULONG Index;
+    PLONGLONG NewInstants;
+
+    if ((Instant < Candidates->Start) || (Instant >= Candidates->End)) {
+        return STATUS_SUCCESS;
+    }
+
+    if (Candidates->Count == Candidates->Capacity) {
+        if (Candidates->Capacity == 0) {
+            Candidates->Capacity = 64;
+
+        } else {
+            Candidates->Capacity *= 2;
+        }
+
+        NewInstants = RtlTimeZoneReallocate(
+                                   Candidates->Instants,
+                                   Candidates->Capacity * sizeof(LONGLONG));
+
+        if (NewInstants == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        Candidates->Instants = NewInstants;
+    }
+
+    //
+    // There are only ever a few dozen candidates, so insertion sort is fine.
+    //
+
+    Index = Candidates->Count;
+    while ((Index != 0) && (Candidates->Instants[Index - 1] > Instant)) {
+        Candidates->Instants[Index] = Candidates->Instants[Index - 1];
+        Index -= 1;
+    }
+
+    Candidates->Instants[Index] = Instant;
+    Candidates->Count += 1;
+    return STATUS_SUCCESS;
+}
+
+VOID
+RtlpReplaceTimeZoneTransitions (
+    PTIME_ZONE_TRANSITION_TABLE NewTable
+    )
+
+/*++
+
+Routine Description:
+
+    This routine publishes a new transition table, retiring the current one.
+    Retired tables are freed once no lock-free readers are observed. This
+    routine assumes the time zone lock is already held.
+
+Arguments:
+
+    NewTable - Supplies an optional pointer to the new table. Supply NULL to
+        simply discard the current table.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PTIME_ZONE_TRANSITION_TABLE NextTable;
+    PTIME_ZONE_TRANSITION_TABLE OldTable;
+
+    //
+    // Make sure the contents of the new table are visible before the pointer
+    // to it is.
+    //
+
+    RtlMemoryBarrier();
+    OldTable = RtlTimeZoneTransitions;
+    RtlTimeZoneTransitions = NewTable;
+    if (OldTable != NULL) {
+        OldTable->Next = RtlRetiredTimeZoneTransitions;
+        RtlRetiredTimeZoneTransitions = OldTable;
+    }
+
+    //
+    // Any reader that arrives after the barrier will see the new table, so if
+    // there are no readers now, none of them can still be looking at a
+    // retired table.
+    //
+
+    RtlMemoryBarrier();
+    if (RtlTimeZoneTransitionReaders == 0) {
+        while (RtlRetiredTimeZoneTransitions != NULL) {
+            NextTable = RtlRetiredTimeZoneTransitions->Next;
+            RtlTimeZoneReallocate(RtlRetiredTimeZoneTransitions, 0);
+            RtlRetiredTimeZoneTransitions = NextTable;
+        }
+    }
+
+    return;
+}
+
+VOID
+RtlpInvalidateTimeZoneTransitions (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine discards the current transition table and any cached spans
+    after the time zone data or the selected time zone changes. This routine
+    assumes the time zone lock is already held.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    RtlTimeZoneGeneration += 1;
+    RtlpReplaceTimeZoneTransitions(NULL);
+    return;
+}
+
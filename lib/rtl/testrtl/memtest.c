@@ -0,0 +1,1168 @@
+/*++
+
+Copyright (c) 2026 Minoca Corp.
+
+    This file is licensed under the terms of the GNU General Public License
+    version 3. Alternative licensing terms are available. Contact
+    info@minocacorp.com for details. See the LICENSE file at the root of this
+    project for complete licensing information.
+
+Module Name:
+
+    memtest.c
+
+Abstract:
+
+    This module tests the memory and string primitives in the runtime
+    library, including the vector implementations.
+
+Author:
+
+    Minoca Developers 18-Oct-2026
+
+Environment:
+
+    Test
+
+--*/
+
+//
+// ------------------------------------------------------------------- Includes
+//
+
+#define RTL_API
+
+#include <minoca/lib/types.h>
+#include <minoca/lib/status.h>
+#include <minoca/lib/rtl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//
+// ---------------------------------------------------------------- Definitions
+//
+
+//
+// The vector routines can be tested if the build machine has the vector
+// extension they're written for. SSE2 is assumed on any x86 build machine.
+//
+
+#if defined(__i386) || defined(__amd64) || defined(__ARM_NEON__)
+
+#define TEST_VECTOR_ROUTINES 1
+
+#endif
+
+//
+// Define the largest size tested exhaustively, and the number of alignments
+// tried for each buffer.
+//
+
+#define MEMORY_TEST_MAX_SMALL_SIZE 300
+#define MEMORY_TEST_ALIGNMENTS 16
+
+//
+// Define the size of the test buffers, which includes room for the largest
+// size, the alignment slop, and guard bytes on either side.
+//
+
+#define MEMORY_TEST_BUFFER_SIZE 0x12000
+#define MEMORY_TEST_GUARD_SIZE 64
+#define MEMORY_TEST_GUARD_BYTE 0xA5
+
+//
+// Define the amount of data each benchmark pass should move.
+//
+
+#define MEMORY_BENCHMARK_TOTAL_BYTES (256ULL * 1024 * 1024)
+
+//
+// ------------------------------------------------------ Data Type Definitions
+//
+
+typedef
+PVOID
+(*PTEST_COPY_MEMORY) (
+    PVOID Destination,
+    PCVOID Source,
+    UINTN ByteCount
+    );
+
+typedef
+VOID
+(*PTEST_SET_MEMORY) (
+    PVOID Buffer,
+    INT Byte,
+    UINTN Count
+    );
+
+typedef
+UINTN
+(*PTEST_STRING_LENGTH) (
+    PCSTR String
+    );
+
+//
+// ----------------------------------------------- Internal Function Prototypes
+//
+
+ULONG
+TestCopyMemory (
+    PSTR Name,
+    PTEST_COPY_MEMORY CopyMemory
+    );
+
+ULONG
+TestSetMemory (
+    PSTR Name,
+    PTEST_SET_MEMORY SetMemory
+    );
+
+ULONG
+TestStringLengthRoutine (
+    PSTR Name,
+    PTEST_STRING_LENGTH StringLength
+    );
+
+ULONG
+TestVectorCompare (
+    VOID
+    );
+
+ULONG
+TestVectorSearch (
+    VOID
+    );
+
+BOOL
+TestCheckGuards (
+    PUCHAR Buffer,
+    UINTN Start,
+    UINTN End
+    );
+
+VOID
+TestFillRandom (
+    PUCHAR Buffer,
+    UINTN Size
+    );
+
+UINTN
+TestStringLengthWrapper (
+    PCSTR String
+    );
+
+VOID
+TestBenchmarkCopy (
+    PSTR Name,
+    PTEST_COPY_MEMORY CopyMemory,
+    UINTN Size
+    );
+
+VOID
+TestBenchmarkSet (
+    PSTR Name,
+    PTEST_SET_MEMORY SetMemory,
+    UINTN Size
+    );
+
+VOID
+TestBenchmarkStringLength (
+    PSTR Name,
+    PTEST_STRING_LENGTH StringLength,
+    UINTN Size
+    );
+
+VOID
+TestPrintBenchmarkResult (
+    PSTR Name,
+    PSTR Operation,
+    UINTN Size,
+    ULONGLONG TotalBytes,
+    clock_t Ticks
+    );
+
+//
+// -------------------------------------------------------------------- Globals
+//
+
+//
+// Define the sizes tested in addition to every size up to the small maximum.
+// These straddle the vector widths and the string instruction threshold.
+//
+
+UINTN TestMemoryLargeSizes[] = {
+    511,
+    512,
+    513,
+    1023,
+    2047,
+    2048,
+    2049,
+    4095,
+    4096,
+    4097,
+    12345,
+    65536,
+    0x10000 + 77
+};
+
+//
+// Define the sizes used by the benchmark.
+//
+
+UINTN TestMemoryBenchmarkSizes[] = {
+    16,
+    64,
+    256,
+    4096,
+    65536,
+    1024 * 1024
+};
+
+//
+// Store the buffers used by the tests.
+//
+
+UCHAR TestSourceBuffer[MEMORY_TEST_BUFFER_SIZE];
+UCHAR TestDestinationBuffer[MEMORY_TEST_BUFFER_SIZE];
+
+//
+// Prevent the compiler from discarding benchmark results.
+//
+
+volatile UINTN TestBenchmarkSink;
+
+//
+// ------------------------------------------------------------------ Functions
+//
+
+ULONG
+TestMemoryRoutines (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests the memory and string primitives in the runtime
+    library.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    ULONG Failures;
+
+    Failures = 0;
+    Failures += TestCopyMemory("RtlCopyMemory", RtlCopyMemory);
+    Failures += TestSetMemory("RtlSetMemory", RtlSetMemory);
+    Failures += TestStringLengthRoutine("RtlStringLength",
+                                        TestStringLengthWrapper);
+
+#if defined(TEST_VECTOR_ROUTINES)
+
+    Failures += TestCopyMemory("RtlVectorCopyMemory", RtlVectorCopyMemory);
+    Failures += TestSetMemory("RtlVectorSetMemory", RtlVectorSetMemory);
+    Failures += TestStringLengthRoutine("RtlVectorStringLength",
+                                        RtlVectorStringLength);
+
+    Failures += TestVectorCompare();
+    Failures += TestVectorSearch();
+
+#endif
+
+    if (Failures != 0) {
+        printf("%d memory test failures.\n", Failures);
+    }
+
+    return Failures;
+}
+
+VOID
+TestMemoryBenchmark (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine measures the throughput of the memory and string primitives
+    at a handful of sizes, and prints the results.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONG SizeCount;
+    ULONG SizeIndex;
+    UINTN Size;
+
+    SizeCount = sizeof(TestMemoryBenchmarkSizes) /
+                sizeof(TestMemoryBenchmarkSizes[0]);
+
+    for (SizeIndex = 0; SizeIndex < SizeCount; SizeIndex += 1) {
+        Size = TestMemoryBenchmarkSizes[SizeIndex];
+        TestBenchmarkCopy("RtlCopyMemory", RtlCopyMemory, Size);
+        TestBenchmarkSet("RtlSetMemory", RtlSetMemory, Size);
+        TestBenchmarkStringLength("RtlStringLength",
+                                  TestStringLengthWrapper,
+                                  Size);
+
+#if defined(TEST_VECTOR_ROUTINES)
+
+        TestBenchmarkCopy("RtlVectorCopyMemory", RtlVectorCopyMemory, Size);
+        TestBenchmarkSet("RtlVectorSetMemory", RtlVectorSetMemory, Size);
+        TestBenchmarkStringLength("RtlVectorStringLength",
+                                  RtlVectorStringLength,
+                                  Size);
+
+#endif
+
+    }
+
+    return;
+}
+
+//
+// --------------------------------------------------------- Internal Functions
+//
+
+ULONG
+TestCopyMemory (
+    PSTR Name,
+    PTEST_COPY_MEMORY CopyMemory
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests a copy memory routine at every small size and a few
+    large ones, with every combination of source and destination alignment.
+
+Arguments:
+
+    Name - Supplies the name of the routine, for error messages.
+
+    CopyMemory - Supplies a pointer to the routine to test.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    UINTN DestinationAlignment;
+    ULONG Failures;
+    ULONG LargeCount;
+    PVOID Result;
+    UINTN Size;
+    ULONG SizeIndex;
+    UINTN SourceAlignment;
+    UINTN Start;
+
+    Failures = 0;
+    LargeCount = sizeof(TestMemoryLargeSizes) / sizeof(TestMemoryLargeSizes[0]);
+    TestFillRandom(TestSourceBuffer, MEMORY_TEST_BUFFER_SIZE);
+    for (SizeIndex = 0;
+         SizeIndex <= MEMORY_TEST_MAX_SMALL_SIZE + LargeCount;
+         SizeIndex += 1) {
+
+        Size = SizeIndex;
+        if (SizeIndex > MEMORY_TEST_MAX_SMALL_SIZE) {
+            Size = TestMemoryLargeSizes[
+                                   SizeIndex - MEMORY_TEST_MAX_SMALL_SIZE - 1];
+        }
+
+        for (SourceAlignment = 0;
+             SourceAlignment < MEMORY_TEST_ALIGNMENTS;
+             SourceAlignment += 1) {
+
+            for (DestinationAlignment = 0;
+                 DestinationAlignment < MEMORY_TEST_ALIGNMENTS;
+                 DestinationAlignment += 1) {
+
+                memset(TestDestinationBuffer,
+                       MEMORY_TEST_GUARD_BYTE,
+                       MEMORY_TEST_BUFFER_SIZE);
+
+                Start = MEMORY_TEST_GUARD_SIZE + DestinationAlignment;
+                Result = CopyMemory(
+                          TestDestinationBuffer + Start,
+                          TestSourceBuffer + SourceAlignment,
+                          Size);
+
+                if ((Result != TestDestinationBuffer + Start) ||
+                    (memcmp(TestDestinationBuffer + Start,
+                            TestSourceBuffer + SourceAlignment,
+                            Size) != 0) ||
+                    (TestCheckGuards(TestDestinationBuffer,
+                                     Start,
+                                     Start + Size) == FALSE)) {
+
+                    printf("%s failed: size %ld, source alignment %ld, "
+                           "destination alignment %ld.\n",
+                           Name,
+                           (long)Size,
+                           (long)SourceAlignment,
+                           (long)DestinationAlignment);
+
+                    Failures += 1;
+                    if (Failures > 10) {
+                        return Failures;
+                    }
+                }
+            }
+        }
+    }
+
+    return Failures;
+}
+
+ULONG
+TestSetMemory (
+    PSTR Name,
+    PTEST_SET_MEMORY SetMemory
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests a set memory routine at every small size and a few
+    large ones, with every alignment.
+
+Arguments:
+
+    Name - Supplies the name of the routine, for error messages.
+
+    SetMemory - Supplies a pointer to the routine to test.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    UINTN Alignment;
+    UCHAR Byte;
+    ULONG Failures;
+    UINTN Index;
+    ULONG LargeCount;
+    UINTN Size;
+    ULONG SizeIndex;
+    UINTN Start;
+
+    Failures = 0;
+    LargeCount = sizeof(TestMemoryLargeSizes) / sizeof(TestMemoryLargeSizes[0]);
+    for (SizeIndex = 0;
+         SizeIndex <= MEMORY_TEST_MAX_SMALL_SIZE + LargeCount;
+         SizeIndex += 1) {
+
+        Size = SizeIndex;
+        if (SizeIndex > MEMORY_TEST_MAX_SMALL_SIZE) {
+            Size = TestMemoryLargeSizes[
+                                   SizeIndex - MEMORY_TEST_MAX_SMALL_SIZE - 1];
+        }
+
+        for (Alignment = 0; Alignment < MEMORY_TEST_ALIGNMENTS; Alignment += 1) {
+            memset(TestDestinationBuffer,
+                   MEMORY_TEST_GUARD_BYTE,
+                   MEMORY_TEST_BUFFER_SIZE);
+
+            //
+            // Pass a value with bits above the low byte set to make sure
+            // only the low byte is used.
+            //
+
+            Byte = (UCHAR)(SizeIndex + Alignment + 1);
+            if (Byte == MEMORY_TEST_GUARD_BYTE) {
+                Byte += 1;
+            }
+
+            Start = MEMORY_TEST_GUARD_SIZE + Alignment;
+            SetMemory(TestDestinationBuffer + Start, Byte | 0x1200, Size);
+            for (Index = 0; Index < Size; Index += 1) {
+                if (TestDestinationBuffer[Start + Index] != Byte) {
+                    break;
+                }
+            }
+
+            if ((Index != Size) ||
+                (TestCheckGuards(TestDestinationBuffer,
+                                 Start,
+                                 Start + Size) == FALSE)) {
+
+                printf("%s failed: size %ld, alignment %ld.\n",
+                       Name,
+                       (long)Size,
+                       (long)Alignment);
+
+                Failures += 1;
+                if (Failures > 10) {
+                    return Failures;
+                }
+            }
+        }
+    }
+
+    return Failures;
+}
+
+ULONG
+TestStringLengthRoutine (
+    PSTR Name,
+    PTEST_STRING_LENGTH StringLength
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests a string length routine at every small length and
+    alignment. Bytes with the high bit set are mixed in to catch word tricks
+    that get them wrong.
+
+Arguments:
+
+    Name - Supplies the name of the routine, for error messages.
+
+    StringLength - Supplies a pointer to the routine to test.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    UINTN Alignment;
+    ULONG Failures;
+    UINTN Index;
+    UINTN Length;
+    UINTN Result;
+    PUCHAR String;
+
+    Failures = 0;
+    for (Length = 0; Length <= MEMORY_TEST_MAX_SMALL_SIZE; Length += 1) {
+        for (Alignment = 0; Alignment < MEMORY_TEST_ALIGNMENTS; Alignment += 1) {
+            String = TestDestinationBuffer + MEMORY_TEST_GUARD_SIZE + Alignment;
+            for (Index = 0; Index < Length; Index += 1) {
+                String[Index] = (UCHAR)((rand() % 255) + 1);
+                if ((Index & 0x3) == 0) {
+                    String[Index] |= 0x80;
+                }
+            }
+
+            String[Length] = '\0';
+            String[Length + 1] = 'x';
+            Result = StringLength((PCSTR)String);
+            if (Result != Length) {
+                printf("%s failed: length %ld, alignment %ld, got %ld.\n",
+                       Name,
+                       (long)Length,
+                       (long)Alignment,
+                       (long)Result);
+
+                Failures += 1;
+                if (Failures > 10) {
+                    return Failures;
+                }
+            }
+        }
+    }
+
+    return Failures;
+}
+
+#if defined(TEST_VECTOR_ROUTINES)
+
+ULONG
+TestVectorCompare (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests the vector memory comparison routine.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    UINTN Alignment;
+    UINTN Difference;
+    ULONG Failures;
+    PUCHAR First;
+    UINTN Result;
+    PUCHAR Second;
+    UINTN Size;
+
+    Failures = 0;
+    TestFillRandom(TestSourceBuffer, MEMORY_TEST_BUFFER_SIZE);
+    for (Size = 0; Size <= MEMORY_TEST_MAX_SMALL_SIZE; Size += 1) {
+        for (Alignment = 0; Alignment < MEMORY_TEST_ALIGNMENTS; Alignment += 1) {
+            First = TestSourceBuffer;
+            Second = TestDestinationBuffer + Alignment;
+            memcpy(Second, First, Size);
+
+            //
+            // Make the byte just past the end differ, which should be ignored.
+            //
+
+            Second[Size] = First[Size] + 1;
+            Result = RtlVectorFindMemoryDifference(First, Second, Size);
+            if (Result != Size) {
+                printf("RtlVectorFindMemoryDifference failed on equal "
+                       "buffers: size %ld, alignment %ld, got %ld.\n",
+                       (long)Size,
+                       (long)Alignment,
+                       (long)Result);
+
+                Failures += 1;
+            }
+
+            //
+            // Try a difference at every position, in both the low and high
+            // bits.
+            //
+
+            for (Difference = 0; Difference < Size; Difference += 1) {
+                Second[Difference] ^= 0x80 >> (Difference & 0x7);
+                Result = RtlVectorFindMemoryDifference(First, Second, Size);
+                Second[Difference] = First[Difference];
+                if (Result != Difference) {
+                    printf("RtlVectorFindMemoryDifference failed: size %ld, "
+                           "alignment %ld, difference at %ld, got %ld.\n",
+                           (long)Size,
+                           (long)Alignment,
+                           (long)Difference,
+                           (long)Result);
+
+                    Failures += 1;
+                }
+
+                if (Failures > 10) {
+                    return Failures;
+                }
+            }
+        }
+    }
+
+    return Failures;
+}
+
+ULONG
+TestVectorSearch (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tests the vector memory and string character search routines.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    Returns the number of test failures.
+
+--*/
+
+{
+
+    UINTN Alignment;
+    PUCHAR Buffer;
+    INT Character;
+    ULONG Failures;
+    UINTN Index;
+    UINTN Position;
+    PVOID Result;
+    UINTN Size;
+    PSTR StringResult;
+
+    Failures = 0;
+    for (Size = 0; Size <= MEMORY_TEST_MAX_SMALL_SIZE; Size += 1) {
+        for (Alignment = 0; Alignment < MEMORY_TEST_ALIGNMENTS; Alignment += 1) {
+            Buffer = TestDestinationBuffer + MEMORY_TEST_GUARD_SIZE + Alignment;
+
+            //
+            // Search for a character with the high bit set, passed as a
+            // negative integer the way a signed char would be promoted.
+            //
+
+            Character = (CHAR)0xF0;
+            for (Index = 0; Index < Size; Index += 1) {
+                Buffer[Index] = 'a' + (Index % 26);
+            }
+
+            Buffer[Size] = 0xF0;
+            Buffer[Size + 1] = '\0';
+
+            //
+            // Search with the character absent. The memory search shouldn't
+            // see the byte past the end, and the string search should stop at
+            // the terminator.
+            //
+
+            Result = RtlVectorFindMemoryCharacter(Buffer, Character, Size);
+            if (Result != NULL) {
+                printf("RtlVectorFindMemoryCharacter found absent character: "
+                       "size %ld, alignment %ld.\n",
+                       (long)Size,
+                       (long)Alignment);
+
+                Failures += 1;
+            }
+
+            Buffer[Size] = '\0';
+            StringResult = RtlVectorStringFindCharacter((PCSTR)Buffer,
+                                                        Character);
+
+            if (StringResult != (PSTR)(Buffer + Size)) {
+                printf("RtlVectorStringFindCharacter missed the terminator: "
+                       "size %ld, alignment %ld.\n",
+                       (long)Size,
+                       (long)Alignment);
+
+                Failures += 1;
+            }
+
+            StringResult = RtlVectorStringFindCharacter((PCSTR)Buffer, 0);
+            if (StringResult != (PSTR)(Buffer + Size)) {
+                printf("RtlVectorStringFindCharacter failed to find the "
+                       "terminator: size %ld, alignment %ld.\n",
+                       (long)Size,
+                       (long)Alignment);
+
+                Failures += 1;
+            }
+
+            //
+            // Now put the character at every position, with a second copy
+            // after it to make sure the first one is found.
+            //
+
+            for (Position = 0; Position < Size; Position += 1) {
+                Buffer[Position] = 0xF0;
+                if (Position + 1 < Size) {
+                    Buffer[Size - 1] = 0xF0;
+                }
+
+                Result = RtlVectorFindMemoryCharacter(Buffer, Character, Size);
+                StringResult = RtlVectorStringFindCharacter((PCSTR)Buffer,
+                                                            Character);
+
+                Buffer[Position] = 'a' + (Position % 26);
+                Buffer[Size - 1] = 'a' + ((Size - 1) % 26);
+                if ((Result != Buffer + Position) ||
+                    (StringResult != (PSTR)(Buffer + Position))) {
+
+                    printf("Vector search failed: size %ld, alignment %ld, "
+                           "position %ld.\n",
+                           (long)Size,
+                           (long)Alignment,
+                           (long)Position);
+
+                    Failures += 1;
+                }
+
+                if (Failures > 10) {
+                    return Failures;
+                }
+            }
+        }
+    }
+
+    return Failures;
+}
+
+#endif
+
+BOOL
+TestCheckGuards (
+    PUCHAR Buffer,
+    UINTN Start,
+    UINTN End
+    )
+
+/*++
+
+Routine Description:
+
+    This routine makes sure the guard bytes around a region of the destination
+    buffer are intact.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the buffer.
+
+    Start - Supplies the offset where the written region starts.
+
+    End - Supplies the offset where the written region ends, exclusive.
+
+Return Value:
+
+    TRUE if the guard bytes are intact.
+
+    FALSE if something was written outside the region.
+
+--*/
+
+{
+
+    UINTN Index;
+
+    for (Index = 0; Index < Start; Index += 1) {
+        if (Buffer[Index] != MEMORY_TEST_GUARD_BYTE) {
+            return FALSE;
+        }
+    }
+
+    for (Index = End; Index < End + MEMORY_TEST_GUARD_SIZE; Index += 1) {
+        if (Buffer[Index] != MEMORY_TEST_GUARD_BYTE) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+VOID
+TestFillRandom (
+    PUCHAR Buffer,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine fills a buffer with random bytes.
+
+Arguments:
+
+    Buffer - Supplies a pointer to the buffer to fill.
+
+    Size - Supplies the size of the buffer in bytes.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    UINTN Index;
+
+    for (Index = 0; Index < Size; Index += 1) {
+        Buffer[Index] = (UCHAR)rand();
+    }
+
+    return;
+}
+
+UINTN
+TestStringLengthWrapper (
+    PCSTR String
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adapts the C string length routine to the prototype of the
+    vector one.
+
+Arguments:
+
+    String - Supplies a pointer to the string.
+
+Return Value:
+
+    Returns the length of the string.
+
+--*/
+
+{
+
+    return RtlStringLength(String);
+}
+
+VOID
+TestBenchmarkCopy (
+    PSTR Name,
+    PTEST_COPY_MEMORY CopyMemory,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine measures the throughput of a copy memory routine.
+
+Arguments:
+
+    Name - Supplies the name of the routine.
+
+    CopyMemory - Supplies a pointer to the routine to measure.
+
+    Size - Supplies the size of each copy.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG Count;
+    PUCHAR Destination;
+    ULONGLONG Index;
+    PUCHAR Source;
+    clock_t Start;
+
+    Destination = malloc(Size);
+    Source = malloc(Size);
+    if ((Destination == NULL) || (Source == NULL)) {
+        goto BenchmarkCopyEnd;
+    }
+
+    memset(Source, 1, Size);
+    Count = MEMORY_BENCHMARK_TOTAL_BYTES / Size;
+    Start = clock();
+    for (Index = 0; Index < Count; Index += 1) {
+        CopyMemory(Destination, Source, Size);
+    }
+
+    TestPrintBenchmarkResult(Name,
+                             "copy",
+                             Size,
+                             Count * Size,
+                             clock() - Start);
+
+    TestBenchmarkSink += Destination[Size - 1];
+
+BenchmarkCopyEnd:
+    if (Destination != NULL) {
+        free(Destination);
+    }
+
+    if (Source != NULL) {
+        free(Source);
+    }
+
+    return;
+}
+
+VOID
+TestBenchmarkSet (
+    PSTR Name,
+    PTEST_SET_MEMORY SetMemory,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine measures the throughput of a set memory routine.
+
+Arguments:
+
+    Name - Supplies the name of the routine.
+
+    SetMemory - Supplies a pointer to the routine to measure.
+
+    Size - Supplies the size of each set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PUCHAR Buffer;
+    ULONGLONG Count;
+    ULONGLONG Index;
+    clock_t Start;
+
+    Buffer = malloc(Size);
+    if (Buffer == NULL) {
+        return;
+    }
+
+    Count = MEMORY_BENCHMARK_TOTAL_BYTES / Size;
+    Start = clock();
+    for (Index = 0; Index < Count; Index += 1) {
+        SetMemory(Buffer, (INT)Index, Size);
+    }
+
+    TestPrintBenchmarkResult(Name,
+                             "set",
+                             Size,
+                             Count * Size,
+                             clock() - Start);
+
+    TestBenchmarkSink += Buffer[Size - 1];
+    free(Buffer);
+    return;
+}
+
+VOID
+TestBenchmarkStringLength (
+    PSTR Name,
+    PTEST_STRING_LENGTH StringLength,
+    UINTN Size
+    )
+
+/*++
+
+Routine Description:
+
+    This routine measures the throughput of a string length routine.
+
+Arguments:
+
+    Name - Supplies the name of the routine.
+
+    StringLength - Supplies a pointer to the routine to measure.
+
+    Size - Supplies the length of the string to measure, including the null
+        terminator.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    ULONGLONG Count;
+    ULONGLONG Index;
+    clock_t Start;
+    PSTR String;
+
+    String = malloc(Size);
+    if (String == NULL) {
+        return;
+    }
+
+    memset(String, 'a', Size - 1);
+    String[Size - 1] = '\0';
+    Count = MEMORY_BENCHMARK_TOTAL_BYTES / Size;
+    Start = clock();
+    for (Index = 0; Index < Count; Index += 1) {
+        TestBenchmarkSink += StringLength(String);
+    }
+
+    TestPrintBenchmarkResult(Name,
+                             "strlen",
+                             Size,
+                             Count * Size,
+                             clock() - Start);
+
+    free(String);
+    return;
+}
+
+VOID
+TestPrintBenchmarkResult (
+    PSTR Name,
+    PSTR Operation,
+    UINTN Size,
+    ULONGLONG TotalBytes,
+    clock_t Ticks
+    )
+
+/*++
+
+Routine Description:
+
+    This routine prints the result of a benchmark pass.
+
+Arguments:
+
+    Name - Supplies the name of the routine measured.
+
+    Operation - Supplies the name of the operation.
+
+    Size - Supplies the size of each operation.
+
+    TotalBytes - Supplies the total number of bytes processed.
+
+    Ticks - Supplies the number of clock ticks the pass took.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    double Rate;
+    double Seconds;
+
+    Seconds = (double)Ticks / CLOCKS_PER_SEC;
+    Rate = 0.0;
+    if (Seconds != 0.0) {
+        Rate = ((double)TotalBytes / (1024.0 * 1024.0)) / Seconds;
+    }
+
+    printf("%-24s %-7s %8ld bytes: %10.1f MB/s\n",
+           Name,
+           Operation,
+           (long)Size,
+           Rate);
+
+    return;
+}
+
@@ -433,6 +433,16 @@ TestTime (
     VOID
     );
 
+ULONG
+TestMemoryRoutines (
+    VOID
+    );
+
+VOID
+TestMemoryBenchmark (
+    VOID
+    );
+
 ULONG
 TestRedBlackTrees (
     BOOL Quiet
@@ -593,12 +603,22 @@ Return Value:
     ULONG StringLength;
     ULONG TestsFailed;
 
+    //
+    // Just run the memory benchmark if requested.
+    //
+
+    if ((ArgumentCount > 1) && (strcmp(Arguments[1], "--benchmark") == 0)) {
+        TestMemoryBenchmark();
+        return 0;
+    }
+
     srand(time(NULL));
     TestsFailed = 0;
     TestsFailed += TestSoftFloatSingle();
     TestsFailed += TestSoftFloatDouble();
     TestsFailed += TestTime();
     TestsFailed += TestHeaps(TRUE);
+    TestsFailed += TestMemoryRoutines();
 
     //
     // Test basic unsigned division.
@@ -50,6 +50,14 @@ Module Name:
     "%a %A %b %B %c %C %d %D %e %F %g %G %h %H %I %j %m %M %p %P %r "       \
     "%R %S %T %u %U %V %w %W %x %X %y %Y %z %Z %%.%n%t."
 
+//
+// Define the range of system times swept when testing the transition cache:
+// January 1, 2014 through January 1, 2017 GMT.
+//
+
+#define TIME_TEST_SWEEP_START 410227200LL
+#define TIME_TEST_SWEEP_END 504921600LL
+
 //
 // ------------------------------------------------------ Data Type Definitions
 //
@@ -75,6 +83,12 @@ VOID
 TestTimeZoneLockFunction (
     );
 
+KSTATUS
+RtlpComputeLocalCalendarTime (
+    PSYSTEM_TIME SystemTime,
+    PCALENDAR_TIME CalendarTime
+    );
+
 //
 // -------------------------------------------------------------------- Globals
 //
@@ -2383,6 +2397,7 @@ Return Value:
 {
 
     PCALENDAR_TEST CalendarTest;
+    CALENDAR_TIME CachedTime;
     CALENDAR_TIME CalendarTime;
     SYSTEM_TIME ComputedSystemTime;
     ULONG Failures;
@@ -2392,12 +2407,14 @@ Return Value:
     PVOID OldData;
     ULONG OldDataSize;
     CALENDAR_TIME ScannedTime;
+    CALENDAR_TIME RuleTime;
     PSTR ScanResult;
     UINTN Size;
     KSTATUS Status;
     SYSTEM_TIME SystemTime;
     ULONG TestCount;
     ULONG TestIndex;
+    TIME_ZONE_TRANSITION_CACHE TransitionCache;
 
     Failures = 0;
 
@@ -2736,6 +2753,122 @@ Return Value:
 
     }
 
+    //
+    // Sweep a few years an hour at a time, making sure that conversions using
+    // the transition table agree with evaluating the time zone rules directly,
+    // and that conversions using a transition cache agree with those that
+    // don't, including across the daylight saving transitions.
+    //
+
+    RtlZeroMemory(&TransitionCache, sizeof(TIME_ZONE_TRANSITION_CACHE));
+    SystemTime.Nanoseconds = 0;
+    for (SystemTime.Seconds = TIME_TEST_SWEEP_START;
+         SystemTime.Seconds < TIME_TEST_SWEEP_END;
+         SystemTime.Seconds += SECONDS_PER_HOUR) {
+
+        Status = RtlSystemTimeToLocalCalendarTime(&SystemTime, &CalendarTime);
+        if (!KSUCCESS(Status)) {
+            printf("TimeTest: Failed to convert system time %lld to local "
+                   "calendar time: %d.\n",
+                   SystemTime.Seconds,
+                   Status);
+
+            Failures += 1;
+            break;
+        }
+
+        Status = RtlpComputeLocalCalendarTime(&SystemTime, &RuleTime);
+        if (!KSUCCESS(Status)) {
+            printf("TimeTest: Failed to evaluate time zone rules for %lld: "
+                   "%d.\n",
+                   SystemTime.Seconds,
+                   Status);
+
+            Failures += 1;
+            break;
+        }
+
+        if ((RuleTime.Year != CalendarTime.Year) ||
+            (RuleTime.YearDay != CalendarTime.YearDay) ||
+            (RuleTime.Hour != CalendarTime.Hour) ||
+            (RuleTime.Minute != CalendarTime.Minute) ||
+            (RuleTime.IsDaylightSaving != CalendarTime.IsDaylightSaving) ||
+            (RuleTime.GmtOffset != CalendarTime.GmtOffset) ||
+            (RuleTime.TimeZone != CalendarTime.TimeZone)) {
+
+            printf("TimeTest: Transition table conversion of %lld was %d %d "
+                   "%02d %d %d, rules say %d %d %02d %d %d.\n",
+                   SystemTime.Seconds,
+                   CalendarTime.Year,
+                   CalendarTime.YearDay,
+                   CalendarTime.Hour,
+                   CalendarTime.IsDaylightSaving,
+                   CalendarTime.GmtOffset,
+                   RuleTime.Year,
+                   RuleTime.YearDay,
+                   RuleTime.Hour,
+                   RuleTime.IsDaylightSaving,
+                   RuleTime.GmtOffset);
+
+            Failures += 1;
+        }
+
+        Status = RtlSystemTimeToLocalCalendarTimeCached(&SystemTime,
+                                                        &CachedTime,
+                                                        &TransitionCache);
+
+        if (!KSUCCESS(Status)) {
+            printf("TimeTest: Failed cached conversion of %lld: %d.\n",
+                   SystemTime.Seconds,
+                   Status);
+
+            Failures += 1;
+            break;
+        }
+
+        if ((CachedTime.Year != CalendarTime.Year) ||
+            (CachedTime.YearDay != CalendarTime.YearDay) ||
+            (CachedTime.Hour != CalendarTime.Hour) ||
+            (CachedTime.IsDaylightSaving != CalendarTime.IsDaylightSaving) ||
+            (CachedTime.GmtOffset != CalendarTime.GmtOffset) ||
+            (CachedTime.TimeZone != CalendarTime.TimeZone)) {
+
+            printf("TimeTest: Cached conversion of %lld was %d %d %02d %d "
+                   "%d, expected %d %d %02d %d %d.\n",
+                   SystemTime.Seconds,
+                   CachedTime.Year,
+                   CachedTime.YearDay,
+                   CachedTime.Hour,
+                   CachedTime.IsDaylightSaving,
+                   CachedTime.GmtOffset,
+                   CalendarTime.Year,
+                   CalendarTime.YearDay,
+                   CalendarTime.Hour,
+                   CalendarTime.IsDaylightSaving,
+                   CalendarTime.GmtOffset);
+
+            Failures += 1;
+        }
+
+        //
+        // Also make sure that the transition from standard to daylight time
+        // and back happens on schedule at least once a year.
+        //
+
+        if ((TransitionCache.Start > SystemTime.Seconds) ||
+            (TransitionCache.End <= SystemTime.Seconds) ||
+            (TransitionCache.End - TransitionCache.Start >
+             (LONGLONG)DAYS_PER_LEAP_YEAR * SECONDS_PER_DAY)) {
+
+            printf("TimeTest: Bad transition span %lld - %lld for %lld.\n",
+                   TransitionCache.Start,
+                   TransitionCache.End,
+                   SystemTime.Seconds);
+
+            Failures += 1;
+        }
+    }
+
     //
     // Try converting a couple times to a string.
     //